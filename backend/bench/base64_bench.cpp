@@ -0,0 +1,89 @@
+/**
+ * base64_bench — throughput of the base64 codecs on 64 B – 64 KiB inputs.
+ *
+ * Compares the dispatched path (AVX2/NEON), the portable scalar path and
+ * libsodium's sodium_bin2base64 / sodium_base642bin.
+ *
+ *     ./base64_bench [min_ms_per_case]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sodium.h>
+
+#include "crypto/base64.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Run `fn` repeatedly for at least `min_ms` and return MiB/s of `bytes`.
+double measure(std::size_t bytes, int min_ms, const std::function<void()>& fn) {
+    std::size_t iters = 0;
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    do {
+        for (int i = 0; i < 64; ++i) fn();
+        iters += 64;
+        elapsed = Clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(min_ms));
+    const double secs = std::chrono::duration<double>(elapsed).count();
+    return static_cast<double>(bytes) * static_cast<double>(iters) / secs / (1024.0 * 1024.0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (sodium_init() < 0) {
+        std::fprintf(stderr, "sodium_init failed\n");
+        return 1;
+    }
+    const int min_ms = argc > 1 ? std::atoi(argv[1]) : 200;
+    std::mt19937 rng(42);
+
+    std::printf("accelerated path: %s, throughput in MiB/s\n\n", base64::implementation());
+    std::printf("%8s  %-6s  %12s  %12s  %12s\n", "size", "op", base64::implementation(),
+                "scalar", "libsodium");
+
+    for (std::size_t size = 64; size <= 64 * 1024; size *= 4) {
+        std::vector<uint8_t> raw(size);
+        for (auto& b : raw) b = static_cast<uint8_t>(rng());
+        std::string text(base64::encoded_size(size), '\0');
+        std::vector<char> sodium_text(sodium_base64_ENCODED_LEN(size, sodium_base64_VARIANT_ORIGINAL));
+        std::vector<uint8_t> decoded(size);
+        std::size_t written = 0;
+
+        const double enc_fast = measure(size, min_ms, [&] {
+            base64::encode_to(raw.data(), size, text.data());
+        });
+        const double enc_scalar = measure(size, min_ms, [&] {
+            base64::scalar::encode_to(raw.data(), size, text.data());
+        });
+        const double enc_sodium = measure(size, min_ms, [&] {
+            sodium_bin2base64(sodium_text.data(), sodium_text.size(), raw.data(), size,
+                              sodium_base64_VARIANT_ORIGINAL);
+        });
+        std::printf("%8zu  %-6s  %12.0f  %12.0f  %12.0f\n", size, "encode",
+                    enc_fast, enc_scalar, enc_sodium);
+
+        const double dec_fast = measure(size, min_ms, [&] {
+            base64::decode_to(text.data(), text.size(), decoded.data(), written);
+        });
+        const double dec_scalar = measure(size, min_ms, [&] {
+            base64::scalar::decode_to(text.data(), text.size(), decoded.data(), written);
+        });
+        const double dec_sodium = measure(size, min_ms, [&] {
+            sodium_base642bin(decoded.data(), decoded.size(), text.data(), text.size(),
+                              nullptr, &written, nullptr, sodium_base64_VARIANT_ORIGINAL);
+        });
+        std::printf("%8zu  %-6s  %12.0f  %12.0f  %12.0f\n", size, "decode",
+                    dec_fast, dec_scalar, dec_sodium);
+    }
+    return 0;
+}
@@ -0,0 +1,694 @@
+/**
+ * p2p_bench — Google Benchmark suite over the hot paths of the backend:
+ * crypto, framing, envelope codecs, base64, message text, the friend and
+ * presence tables, LocalAPI routing and the SQLite store.
+ *
+ * For regression tracking, write the results as JSON:
+ *
+ *     ./secure-p2p-chat-bench --benchmark_out=bench.json --benchmark_out_format=json
+ *
+ * (or `cmake --build . --target bench-json`). Sizes are payload bytes;
+ * throughput is reported as bytes or items per second.
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <nlohmann/json.hpp>
+#include <sodium.h>
+
+#include "api/http_router.h"
+#include "crypto/base64.h"
+#include "crypto/crypto_manager.h"
+#include "crypto/nonce_source.h"
+#include "crypto/peer_sessions.h"
+#include "network/envelope.h"
+#include "network/framing.h"
+#include "network/json_fields.h"
+#include "network/utf8.h"
+#include "node/peer_directory.h"
+#include "node/presence.h"
+#include "storage/message_store.h"
+
+namespace {
+
+using json = nlohmann::json;
+
+std::string random_bytes(std::size_t n) {
+    static std::mt19937 rng(42);
+    std::string out(n, '\0');
+    for (auto& c : out) {
+        c = static_cast<char>(rng());
+    }
+    return out;
+}
+
+/// Two parties with fresh keys; the shared key is cached after first use,
+/// as it is for a peer we talk to regularly.
+struct Parties {
+    Parties() {
+        CryptoManager::init();
+        alice.generate_keypair();
+        bob.generate_keypair();
+    }
+    CryptoManager alice;
+    CryptoManager bob;
+};
+
+Parties& parties() {
+    static Parties p;
+    return p;
+}
+
+Envelope sample_envelope(std::size_t ciphertext_bytes) {
+    Envelope env;
+    env.type = EnvelopeType::Message;
+    env.from = "alice";
+    env.to = "bob";
+    env.timestamp = "2026-01-01T12:00:00Z";
+    env.nonce.assign(24, 0x11);
+    env.ciphertext.assign(ciphertext_bytes, 0x22);
+    env.signature.assign(64, 0x33);
+    return env;
+}
+
+void payload_sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(64)->Arg(1024)->Arg(16 * 1024)->Arg(64 * 1024);
+}
+
+// ─── Crypto ─────────────────────────────────────────────────────────────────
+
+void BM_Encrypt(benchmark::State& state) {
+    auto& p = parties();
+    const std::string plaintext = random_bytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p.alice.encrypt(plaintext, p.bob.public_key()));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Encrypt)->Apply(payload_sizes);
+
+void BM_Decrypt(benchmark::State& state) {
+    auto& p = parties();
+    const std::string sealed = p.alice.encrypt(random_bytes(state.range(0)), p.bob.public_key());
+    for (auto _ : state) {
+        auto plaintext = p.bob.decrypt(sealed, p.alice.public_key());
+        if (plaintext.empty()) {
+            state.SkipWithError("decrypt failed");
+            break;
+        }
+        benchmark::DoNotOptimize(plaintext);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Decrypt)->Apply(payload_sizes);
+
+void BM_Sign(benchmark::State& state) {
+    auto& p = parties();
+    const std::string message = random_bytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p.alice.sign(message));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Sign)->Apply(payload_sizes);
+
+void BM_Verify(benchmark::State& state) {
+    auto& p = parties();
+    const std::string message = random_bytes(state.range(0));
+    const std::string signature = p.alice.sign(message);
+    for (auto _ : state) {
+        if (!p.bob.verify(message, signature, p.alice.signing_public_key())) {
+            state.SkipWithError("verify failed");
+            break;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Verify)->Apply(payload_sizes);
+
+/// `n` fresh X25519 public keys.
+std::vector<std::vector<uint8_t>> recipients(std::size_t n) {
+    std::vector<std::vector<uint8_t>> keys(n, std::vector<uint8_t>(crypto_box_PUBLICKEYBYTES));
+    uint8_t secret[crypto_box_SECRETKEYBYTES];
+    for (auto& key : keys) {
+        crypto_box_keypair(key.data(), secret);
+    }
+    return keys;
+}
+
+/// A 4 KiB payload for state.range(0) recipients whose shared keys are
+/// cached: sealed once with encrypt_for_many, or once per recipient.
+void BM_EncryptForMany(benchmark::State& state) {
+    auto& p = parties();
+    const auto keys = recipients(state.range(0));
+    const std::string plaintext = random_bytes(4096);
+    p.alice.warm_shared_keys(keys);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(p.alice.encrypt_for_many(plaintext, keys));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncryptForMany)->Arg(8)->Arg(64)->Arg(200);
+
+void BM_EncryptLoop(benchmark::State& state) {
+    auto& p = parties();
+    const auto keys = recipients(state.range(0));
+    const std::string plaintext = random_bytes(4096);
+    p.alice.warm_shared_keys(keys);
+    for (auto _ : state) {
+        for (const auto& key : keys) {
+            benchmark::DoNotOptimize(p.alice.encrypt(plaintext, key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EncryptLoop)->Arg(8)->Arg(64)->Arg(200);
+
+void BM_Nonce(benchmark::State& state, bool per_thread) {
+    uint8_t nonce[crypto_box_NONCEBYTES];
+    for (auto _ : state) {
+        if (per_thread) {
+            nonce_source::fill(nonce, sizeof(nonce));
+        } else {
+            randombytes_buf(nonce, sizeof(nonce));
+        }
+        benchmark::DoNotOptimize(nonce);
+    }
+}
+BENCHMARK_CAPTURE(BM_Nonce, nonce_source, true);
+BENCHMARK_CAPTURE(BM_Nonce, randombytes_buf, false);
+
+/// Alice and Bob after a session handshake (alice initiated), as between
+/// two online peers. Seal + open replaces encrypt + sign + verify + decrypt.
+struct Session {
+    explicit Session(bool aes_gcm)
+        : alice(options(aes_gcm)), bob(options(aes_gcm)) {
+        CryptoManager::init();
+        const auto bytes = [](const std::string& s) {
+            return std::span(reinterpret_cast<const uint8_t*>(s.data()), s.size());
+        };
+        const auto init = alice.initiate("bob", true);
+        const auto accept = bob.accept("alice", bytes(*init));
+        alice.complete("bob", bytes(*accept));
+    }
+    static PeerSessions::Options options(bool aes_gcm) {
+        PeerSessions::Options opts;
+        opts.aes_gcm = aes_gcm;
+        return opts;
+    }
+    PeerSessions alice;
+    PeerSessions bob;
+};
+
+/// The negotiated session, XChaCha20-Poly1305 or (CPU permitting) AES-256-GCM.
+Session* session(benchmark::State& state, PeerSessions::Aead aead) {
+    static Session xchacha(false);
+    static Session gcm(true);
+    Session& s = aead == PeerSessions::Aead::Aes256Gcm ? gcm : xchacha;
+    if (s.alice.aead("bob") != aead) {
+        state.SkipWithError("AES-256-GCM needs AES-NI, which this CPU lacks");
+        return nullptr;
+    }
+    return &s;
+}
+
+void BM_SessionSeal(benchmark::State& state, PeerSessions::Aead aead) {
+    auto* session_ptr = session(state, aead);
+    if (!session_ptr) {
+        return;
+    }
+    auto& s = *session_ptr;
+    const std::string plaintext = random_bytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(s.alice.seal("bob", plaintext, "alice"));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_SessionSeal, xchacha20, PeerSessions::Aead::XChaCha20Poly1305)
+    ->Apply(payload_sizes);
+BENCHMARK_CAPTURE(BM_SessionSeal, aes256gcm, PeerSessions::Aead::Aes256Gcm)->Apply(payload_sizes);
+
+void BM_SessionOpen(benchmark::State& state, PeerSessions::Aead aead) {
+    auto* session_ptr = session(state, aead);
+    if (!session_ptr) {
+        return;
+    }
+    auto& s = *session_ptr;
+    const auto sealed = s.alice.seal("bob", random_bytes(state.range(0)), "alice");
+    for (auto _ : state) {
+        auto plaintext = s.bob.open("alice", sealed->nonce, sealed->ciphertext, "alice");
+        if (!plaintext) {
+            state.SkipWithError("open failed");
+            break;
+        }
+        benchmark::DoNotOptimize(plaintext);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_SessionOpen, xchacha20, PeerSessions::Aead::XChaCha20Poly1305)
+    ->Apply(payload_sizes);
+BENCHMARK_CAPTURE(BM_SessionOpen, aes256gcm, PeerSessions::Aead::Aes256Gcm)->Apply(payload_sizes);
+
+// ─── Framing ────────────────────────────────────────────────────────────────
+
+void BM_FrameEncode(benchmark::State& state) {
+    const std::string payload = random_bytes(state.range(0));
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        const auto header = framing::encode_header(static_cast<uint32_t>(payload.size()));
+        out.append(reinterpret_cast<const char*>(header.data()), header.size());
+        out += payload;
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FrameEncode)->Apply(payload_sizes);
+
+// 64 frames arriving in reads of 16 KiB, as from a busy socket.
+void BM_FrameDecode(benchmark::State& state) {
+    constexpr int kFrames = 64;
+    constexpr std::size_t kReadSize = 16 * 1024;
+    const std::string payload = random_bytes(state.range(0));
+    std::string stream;
+    for (int i = 0; i < kFrames; ++i) {
+        const auto header = framing::encode_header(static_cast<uint32_t>(payload.size()));
+        stream.append(reinterpret_cast<const char*>(header.data()), header.size());
+        stream += payload;
+    }
+
+    FrameReader reader;
+    for (auto _ : state) {
+        int frames = 0;
+        for (std::size_t pos = 0; pos < stream.size();) {
+            auto span = reader.prepare();
+            const std::size_t n = std::min({span.size(), kReadSize, stream.size() - pos});
+            std::copy_n(stream.data() + pos, n, span.data());
+            reader.commit(n);
+            pos += n;
+            std::string_view frame;
+            while (reader.next(frame) == FrameReader::Status::Frame) {
+                benchmark::DoNotOptimize(frame.data());
+                ++frames;
+            }
+        }
+        if (frames != kFrames) {
+            state.SkipWithError("lost frames");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * kFrames);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.size()));
+}
+BENCHMARK(BM_FrameDecode)->Apply(payload_sizes);
+
+// ─── Envelopes ──────────────────────────────────────────────────────────────
+
+void BM_EnvelopeEncodeJson(benchmark::State& state) {
+    const Envelope env = sample_envelope(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(envelope::encode_json(env));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EnvelopeEncodeJson)->Apply(payload_sizes);
+
+void BM_EnvelopeEncodeBinary(benchmark::State& state) {
+    const Envelope env = sample_envelope(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(envelope::encode_binary(env));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EnvelopeEncodeBinary)->Apply(payload_sizes);
+
+// The receive path before json_fields: a full nlohmann DOM.
+void BM_EnvelopeDecodeDom(benchmark::State& state) {
+    const std::string frame = envelope::encode_json(sample_envelope(state.range(0)));
+    for (auto _ : state) {
+        auto j = json::parse(frame, nullptr, false);
+        Envelope env;
+        env.from = j.value("from", "");
+        env.to = j.value("to", "");
+        env.timestamp = j.value("timestamp", "");
+        if (!base64::decode(j.value("nonce", ""), env.nonce) ||
+            !base64::decode(j.value("ciphertext", ""), env.ciphertext) ||
+            !base64::decode(j.value("signature", ""), env.signature)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(env);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EnvelopeDecodeDom)->Apply(payload_sizes);
+
+// json_fields: one validating pass, no DOM.
+void BM_EnvelopeDecodeJson(benchmark::State& state) {
+    const std::string frame = envelope::encode_json(sample_envelope(state.range(0)));
+    for (auto _ : state) {
+        auto env = envelope::decode_json(frame);
+        if (!env) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(env);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EnvelopeDecodeJson)->Apply(payload_sizes);
+
+void BM_EnvelopeDecodeBinary(benchmark::State& state) {
+    const std::string frame = envelope::encode_binary(sample_envelope(state.range(0)));
+    for (auto _ : state) {
+        auto env = envelope::decode_binary(frame);
+        if (!env) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(env);
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_EnvelopeDecodeBinary)->Apply(payload_sizes);
+
+// A page of offline messages as PostgREST returns it; range(0) rows.
+std::string offline_page(std::size_t rows) {
+    json page = json::array();
+    const std::string ciphertext = base64::encode(envelope::encode_json(sample_envelope(256)));
+    for (std::size_t i = 0; i < rows; ++i) {
+        page.push_back({{"id", "6f1c2a9e-0000-4000-8000-" + std::to_string(100000000000 + i)},
+                        {"from_user", "alice"},
+                        {"to_user", "bob"},
+                        {"ciphertext", ciphertext},
+                        {"created_at", "2026-01-01T12:00:00.123456+00:00"}});
+    }
+    return page.dump();
+}
+
+void BM_OfflinePageDom(benchmark::State& state) {
+    const std::string body = offline_page(state.range(0));
+    for (auto _ : state) {
+        auto rows = json::parse(body, nullptr, false);
+        std::vector<std::string> ciphertexts;
+        for (const auto& row : rows) {
+            ciphertexts.push_back(row.value("ciphertext", ""));
+        }
+        benchmark::DoNotOptimize(ciphertexts.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_OfflinePageDom)->Arg(10)->Arg(100)->Arg(500);
+
+void BM_OfflinePageFields(benchmark::State& state) {
+    const std::string body = offline_page(state.range(0));
+    std::string id, ciphertext, created_at;
+    const json_fields::Field fields[] = {
+        {"id", &id}, {"ciphertext", &ciphertext}, {"created_at", &created_at}};
+    for (auto _ : state) {
+        std::vector<std::string> ciphertexts;
+        if (!json_fields::read_rows(body, fields, [&] { ciphertexts.push_back(ciphertext); })) {
+            state.SkipWithError("read failed");
+            break;
+        }
+        benchmark::DoNotOptimize(ciphertexts.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_OfflinePageFields)->Arg(10)->Arg(100)->Arg(500);
+
+// ─── Base64 ─────────────────────────────────────────────────────────────────
+
+void BM_Base64Encode(benchmark::State& state) {
+    const std::string bytes = random_bytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(base64::encode(std::string_view(bytes)));
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Encode)->Apply(payload_sizes);
+
+void BM_Base64Decode(benchmark::State& state) {
+    const std::string text = base64::encode(std::string_view(random_bytes(state.range(0))));
+    std::vector<uint8_t> out;
+    for (auto _ : state) {
+        if (!base64::decode(text, out)) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Base64Decode)->Apply(payload_sizes);
+
+// ─── Message text ───────────────────────────────────────────────────────────
+
+/// A long pasted message: mostly ASCII prose with accents, emoji, quotes
+/// and line breaks mixed in.
+std::string pasted_text(std::size_t n) {
+    static const char* const kPieces[] = {
+        "The quick brown fox jumps over the lazy dog. ", "caf\xc3\xa9 ", "na\xc3\xafve ",
+        "\xe2\x82\xac 20 ", "\xf0\x9f\x98\x80 ", "\"quoted\" ", "line\n", "\xe6\x97\xa5\xe6\x9c\xac ",
+    };
+    static std::mt19937 rng(7);
+    std::string out;
+    while (out.size() < n) {
+        out += kPieces[rng() % std::size(kPieces)];
+    }
+    return out;
+}
+
+void BM_Utf8Validate(benchmark::State& state) {
+    const std::string text = pasted_text(state.range(0));
+    state.SetLabel(utf8::implementation());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utf8::valid(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Utf8Validate)->Apply(payload_sizes);
+
+void BM_Utf8ValidateScalar(benchmark::State& state) {
+    const std::string text = pasted_text(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(utf8::scalar::valid(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Utf8ValidateScalar)->Apply(payload_sizes);
+
+// A decrypted message payload, as the receive path reads it.
+void BM_PayloadReadDom(benchmark::State& state) {
+    const std::string payload = json{{"text", pasted_text(state.range(0))},
+                                     {"msg_id", "m-1"},
+                                     {"timestamp", "2026-01-01T12:00:00Z"}}.dump();
+    for (auto _ : state) {
+        auto j = json::parse(payload, nullptr, false);
+        benchmark::DoNotOptimize(j.value("text", ""));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_PayloadReadDom)->Apply(payload_sizes);
+
+void BM_PayloadReadFields(benchmark::State& state) {
+    const std::string payload = json{{"text", pasted_text(state.range(0))},
+                                     {"msg_id", "m-1"},
+                                     {"timestamp", "2026-01-01T12:00:00Z"}}.dump();
+    std::string text, msg_id, timestamp;
+    const json_fields::Field fields[] = {
+        {"text", &text}, {"msg_id", &msg_id}, {"timestamp", &timestamp}};
+    for (auto _ : state) {
+        if (!json_fields::read(payload, fields)) {
+            state.SkipWithError("read failed");
+            break;
+        }
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_PayloadReadFields)->Apply(payload_sizes);
+
+// Escaping text for a LocalAPI response: nlohmann's dump() vs append_string().
+void BM_JsonEscapeDump(benchmark::State& state) {
+    const json text = pasted_text(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(text.dump());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_JsonEscapeDump)->Apply(payload_sizes);
+
+void BM_JsonEscape(benchmark::State& state) {
+    const std::string text = pasted_text(state.range(0));
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        json_fields::append_string(out, text);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_JsonEscape)->Apply(payload_sizes);
+
+// ─── Friend and presence tables ─────────────────────────────────────────────
+
+/// 256 friends, pinned in the directory and online in the presence table.
+struct FriendTables {
+    PeerDirectory directory{nullptr};
+    PresenceTable presence{PresenceTable::Options{}};
+    std::vector<std::string> names;
+
+    FriendTables() {
+        for (int i = 0; i < 256; ++i) {
+            PeerDirectory::Peer peer;
+            peer.username = "friend" + std::to_string(i);
+            peer.ip = "192.0.2.1";
+            peer.port = 9100;
+            directory.pin(peer);
+            presence.heard(peer.username);
+            names.push_back(peer.username);
+        }
+    }
+};
+
+FriendTables& friend_tables() {
+    static FriendTables tables;
+    return tables;
+}
+
+// What the send path and GET /friends read per friend, on 1-16 threads,
+// while thread 0 also applies a heartbeat address and presence update per
+// read. Items/s per thread falling as threads rise is lock contention.
+void BM_FriendTablesRead(benchmark::State& state) {
+    auto& tables = friend_tables();
+    std::size_t i = static_cast<std::size_t>(state.thread_index()) * 37;
+    for (auto _ : state) {
+        const std::string& name = tables.names[i++ % tables.names.size()];
+        benchmark::DoNotOptimize(tables.directory.cached(name));
+        benchmark::DoNotOptimize(tables.presence.is_online(name));
+        if (state.thread_index() == 0) {
+            tables.directory.update_address(name, "192.0.2.2", 9100, "2026-01-01T12:00:00Z", "", "", "");
+            tables.presence.heard(name);
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FriendTablesRead)->ThreadRange(1, 16)->UseRealTime();
+
+// ─── LocalAPI routing ───────────────────────────────────────────────────────
+
+// A mix of what the UI polls, what it posts, and a miss.
+void BM_RouteMatch(benchmark::State& state) {
+    const std::pair<std::string, std::string> requests[] = {
+        {"GET", "/messages"}, {"GET", "/status"}, {"GET", "/metrics"},
+        {"POST", "/messages"}, {"POST", "/groups/4f1c2a/messages"}, {"GET", "/favicon.ico"},
+    };
+    std::size_t i = 0;
+    for (auto _ : state) {
+        const auto& [method, path] = requests[i++ % std::size(requests)];
+        benchmark::DoNotOptimize(http_router::match(method, path));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RouteMatch);
+
+// ─── SQLite store ───────────────────────────────────────────────────────────
+
+/// A store on a scratch database, deleted afterwards.
+class StoreFixture : public benchmark::Fixture {
+public:
+    void SetUp(const benchmark::State&) override {
+        path_ = std::filesystem::temp_directory_path() / "p2p_bench.db";
+        remove_files();
+        MessageStore::Options options;
+        options.path = path_.string();
+        store_ = std::make_unique<MessageStore>(options);
+        store_->open();
+    }
+
+    void TearDown(const benchmark::State&) override {
+        store_.reset();
+        remove_files();
+    }
+
+protected:
+    MessageStore::Message message(std::size_t i) {
+        MessageStore::Message m;
+        m.msg_id = "bench-" + std::to_string(next_id_++);
+        m.peer = i % 2 ? "alice" : "bob";
+        m.direction = MessageStore::Direction::Received;
+        m.plaintext = "see you at eight, bring the charger";
+        m.timestamp = "2026-01-01T12:00:00Z";
+        return m;
+    }
+
+    std::unique_ptr<MessageStore> store_;
+
+private:
+    void remove_files() {
+        std::error_code ec;
+        for (const char* suffix : {"", "-wal", "-shm"}) {
+            std::filesystem::remove(path_.string() + suffix, ec);
+        }
+    }
+
+    std::filesystem::path path_;
+    std::size_t next_id_ = 0;
+};
+
+// A burst of received messages through the group commit, waiting until
+// the last one is durable.
+BENCHMARK_DEFINE_F(StoreFixture, Insert)(benchmark::State& state) {
+    const auto batch = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        std::promise<void> done;
+        auto left = std::make_shared<std::size_t>(batch);
+        for (std::size_t i = 0; i < batch; ++i) {
+            // Callbacks all run on the DB thread, so `left` needs no lock.
+            store_->record_received(message(i), false, [&done, left](auto) {
+                if (--*left == 0) done.set_value();
+            });
+        }
+        store_->flush();
+        done.get_future().wait();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_REGISTER_F(StoreFixture, Insert)->Arg(1)->Arg(64)->Arg(512)->UseRealTime();
+
+BENCHMARK_DEFINE_F(StoreFixture, History)(benchmark::State& state) {
+    std::promise<void> filled;
+    for (std::size_t i = 0; i < 10000; ++i) {
+        store_->insert_message(message(i),
+                               i == 9999 ? MessageStore::Done([&](bool) { filled.set_value(); })
+                                         : MessageStore::Done());
+    }
+    store_->flush();
+    filled.get_future().wait();
+
+    const auto limit = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state) {
+        std::promise<std::size_t> rows;
+        store_->history_before("alice", "2026-01-02T00:00:00Z", limit, [&](auto page) {
+            rows.set_value(page ? page->messages.size() : 0);
+        });
+        if (rows.get_future().get() != limit) {
+            state.SkipWithError("short page");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_REGISTER_F(StoreFixture, History)->Arg(50)->Arg(500)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
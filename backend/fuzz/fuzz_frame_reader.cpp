@@ -0,0 +1,80 @@
+/**
+ * fuzz_frame_reader — FrameReader fed an untrusted byte stream in reads of
+ * every size, each frame passed on to envelope::decode as PeerSession does.
+ *
+ * The first two input bytes pick the frame limit and the read sizes; the
+ * rest is the stream. The frames must match what a one-shot split of the
+ * whole stream gives, however the reads fall.
+ *
+ *     ./fuzz_frame_reader corpus/frame_reader -max_len=65536
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "network/envelope.h"
+#include "network/framing.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    if (size < 2) {
+        return 0;
+    }
+    const std::size_t max_frame = (std::size_t(data[0]) + 1) * 64;
+    uint32_t seed = data[1];
+    const std::string_view stream(reinterpret_cast<const char*>(data + 2), size - 2);
+
+    std::vector<std::string_view> expected;
+    bool oversized = false;
+    for (std::size_t off = 0; off + framing::kHeaderSize <= stream.size();) {
+        const std::size_t length =
+            framing::decode_header(reinterpret_cast<const uint8_t*>(stream.data() + off));
+        if (length > max_frame) {
+            oversized = true;
+            break;
+        }
+        if (off + framing::kHeaderSize + length > stream.size()) {
+            break;
+        }
+        expected.push_back(stream.substr(off + framing::kHeaderSize, length));
+        off += framing::kHeaderSize + length;
+    }
+
+    FrameReader reader(max_frame, 0);
+    std::size_t fed = 0;
+    std::size_t got = 0;
+    while (fed < stream.size()) {
+        const auto span = reader.prepare();
+        seed = seed * 1103515245u + 12345u;
+        const std::size_t n = std::min({span.size(), stream.size() - fed,
+                                        std::size_t(1 + (seed >> 16) % 1500)});
+        std::memcpy(span.data(), stream.data() + fed, n);
+        reader.commit(n);
+        fed += n;
+
+        std::string_view payload;
+        FrameReader::Status status;
+        while ((status = reader.next(payload)) == FrameReader::Status::Frame) {
+            if (got >= expected.size() || payload != expected[got]) {
+                __builtin_trap();
+            }
+            ++got;
+            if (auto env = envelope::decode(payload)) {
+                (void)envelope::encode(*env, WireFormat::Binary);
+            }
+        }
+        if (status == FrameReader::Status::Oversized) {
+            if (!oversized || got != expected.size()) {
+                __builtin_trap();
+            }
+            return 0;
+        }
+    }
+    if (oversized || got != expected.size()) {
+        __builtin_trap();
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * fuzz_http_request — HttpRequestReader, the LocalAPI and WebSocket upgrade
+ * request parser, fed untrusted bytes in reads of every size.
+ *
+ * The first input byte picks the read sizes; the rest is the connection's
+ * byte stream, pipelined requests and all. Limits are small (1 KiB heads,
+ * 4 KiB bodies) so the TooLarge paths get reached too.
+ *
+ *     ./fuzz_http_request corpus/http_request -dict=fuzz/http.dict
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include "api/http_parser.h"
+
+namespace {
+
+constexpr std::size_t kMaxBody = 4096;
+constexpr std::size_t kMaxHead = 1024;
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size) {
+    if (size < 1) {
+        return 0;
+    }
+    uint32_t seed = data[0];
+    const std::string_view stream(reinterpret_cast<const char*>(data + 1), size - 1);
+
+    HttpRequestReader reader(kMaxBody, kMaxHead);
+    HttpRequest request;
+    std::size_t fed = 0;
+    while (fed < stream.size()) {
+        const auto span = reader.prepare();
+        seed = seed * 1103515245u + 12345u;
+        const std::size_t n = std::min({span.size(), stream.size() - fed,
+                                        std::size_t(1 + (seed >> 16) % 700)});
+        std::memcpy(span.data(), stream.data() + fed, n);
+        reader.commit(n);
+        fed += n;
+
+        for (;;) {
+            const std::size_t before = reader.buffered();
+            const auto status = reader.next(request);
+            (void)reader.take_continue();
+            if (status == HttpRequestReader::Status::Request) {
+                // A request consumes at least its head, and nothing it
+                // returns may exceed the limits.
+                if (request.body.size() > kMaxBody || reader.buffered() >= before) {
+                    __builtin_trap();
+                }
+                continue;
+            }
+            if (status != HttpRequestReader::Status::NeedMore) {
+                return 0;               // 400 or 413, and the connection closes
+            }
+            break;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,59 @@
+/**
+ * replay_main — stands in for libFuzzer's main() with compilers that have
+ * no libFuzzer (GCC, MSVC): runs the target once over each file given,
+ * descending into directories, so a corpus or a crash input from a Clang
+ * run can be replayed under P2P_SANITIZE.
+ *
+ *     ./fuzz_envelope corpus/envelope crash-3f2a...
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, std::size_t size);
+
+namespace {
+
+bool run_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::fprintf(stderr, "cannot read %s\n", path.string().c_str());
+        return false;
+    }
+    const std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)),
+                                     std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(input.data(), input.size());
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::size_t runs = 0;
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        const std::filesystem::path arg(argv[i]);
+        if (!arg.empty() && arg.string()[0] == '-') {
+            continue;                   // libFuzzer flags, e.g. -dict=
+        }
+        std::error_code ec;
+        if (std::filesystem::is_directory(arg, ec)) {
+            for (const auto& entry : std::filesystem::recursive_directory_iterator(arg, ec)) {
+                if (entry.is_regular_file()) {
+                    ok = run_file(entry.path()) && ok;
+                    ++runs;
+                }
+            }
+        } else {
+            ok = run_file(arg) && ok;
+            ++runs;
+        }
+    }
+    std::printf("%zu inputs replayed\n", runs);
+    return ok ? 0 : 1;
+}
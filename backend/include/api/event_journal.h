@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+
+/**
+ * The recent UI events, numbered, so a UI that lost its WebSocket (a
+ * reconnect, a laptop waking up) can take just what it missed instead of
+ * reloading every open chat.
+ *
+ * Every event gets a cursor, "<run>.<seq>": `run` is random per process,
+ * so a cursor from before a restart is recognised as such, and `seq`
+ * counts up. batch() answers "what happened after this cursor" in one
+ * JSON object:
+ *
+ *     {"cursor": "<newest>", "reset": false,
+ *      "events": [{"cursor": ..., "event": ..., "data": {...}}, ...]}
+ *
+ * Events that only state something's current value are collapsed to the
+ * last one: a friend's presence (`friend_online` / `friend_offline`), their
+ * latest `read` receipt and the `startup` phase. `typing` is never kept;
+ * it is stale by the time anyone catches up. What is left comes in the
+ * order it happened.
+ *
+ * The journal holds the newest `max_bytes` of serialized events. A cursor
+ * older than that, from another run or unparseable gets `"reset": true`
+ * and no events: the UI reloads over REST as before, then carries on from
+ * the new cursor.
+ *
+ * Not thread-safe: WsEventServer keeps it under its own lock, so that a
+ * client resuming from a cursor misses nothing broadcast meanwhile.
+ */
+class EventJournal {
+public:
+    static constexpr std::size_t kDefaultMaxBytes = 2 * 1024 * 1024;
+
+    explicit EventJournal(std::size_t max_bytes = kDefaultMaxBytes);
+
+    /// Drop the oldest events until the rest fit in `max_bytes`.
+    void set_max_bytes(std::size_t max_bytes);
+
+    /// Record an event. Returns it serialized as {"cursor", "data",
+    /// "event"} (no cursor for `typing`, which isn't kept), ready to frame.
+    std::shared_ptr<const std::string> append(std::string_view event, const nlohmann::json& data);
+
+    /// The cursor of the newest event.
+    [[nodiscard]] std::string cursor() const;
+
+    /// Everything after `cursor`, collapsed, as described above.
+    [[nodiscard]] std::string batch(std::string_view cursor) const;
+
+private:
+    struct Entry {
+        uint64_t seq;
+        std::string key;                        // collapse with later events of this key; empty: never
+        std::shared_ptr<const std::string> text;
+    };
+
+    std::string cursor_for(uint64_t seq) const;
+    void trim();
+
+    std::string run_;
+    uint64_t seq_ = 0;                          // the newest event's
+    uint64_t dropped_ = 0;                      // the newest seq trimmed away
+    std::size_t max_bytes_;
+    std::size_t bytes_ = 0;
+    std::deque<Entry> entries_;
+};
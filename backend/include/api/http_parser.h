@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string>
+#include <vector>
+
+/**
+ * One parsed HTTP/1.1 request. Reused across the requests of a connection,
+ * so its strings keep their capacity.
+ */
+struct HttpRequest {
+    std::string method;
+    std::string path;       // without the query string
+    std::string query;      // after '?', still percent-encoded
+    std::string body;
+    bool keep_alive = true; // false for "Connection: close" or HTTP/1.0 without keep-alive
+    std::string if_none_match;        // raw If-None-Match value, empty if absent
+    std::string client_mode;          // X-Client-Mode ("push" or "poll"), empty if absent
+    bool accepts_zstd = false;        // Accept-Encoding lists zstd (with a nonzero q)
+
+    // Only filled in for the headers the WebSocket upgrade needs.
+    bool upgrade_websocket = false;   // "Upgrade: websocket" + "Connection: upgrade"
+    std::string websocket_key;        // Sec-WebSocket-Key
+    std::string websocket_version;    // Sec-WebSocket-Version
+    std::string origin;               // empty if the client sent none
+};
+
+/**
+ * Incremental HTTP/1.1 request decoder over a reusable per-connection
+ * buffer — the LocalAPI counterpart of FrameReader, with the same usage:
+ *
+ *     auto span = reader.prepare();
+ *     socket.async_read_some(asio::buffer(span.data(), span.size()), ...);
+ *     reader.commit(bytes_read);
+ *     while (reader.next(request) == HttpRequestReader::Status::Request) { ... }
+ *
+ * A single read may hold several pipelined requests; next() returns them
+ * one at a time, in order. The scan for the end of the head resumes where
+ * the previous call stopped, so a request trickling in is not re-parsed
+ * from the start on every read. Bodies must be Content-Length framed;
+ * chunked uploads are rejected.
+ */
+class HttpRequestReader {
+public:
+    enum class Status {
+        Request,    ///< `request` holds the next complete request
+        NeedMore,   ///< read more bytes
+        Invalid,    ///< malformed or unsupported request; answer 400 and close
+        TooLarge    ///< head or body above the limits; answer 413 and close
+    };
+
+    explicit HttpRequestReader(std::size_t max_body_size = 1024 * 1024,
+                               std::size_t max_head_size = 16 * 1024);
+
+    /// Writable region for the next socket read. Never empty.
+    std::span<char> prepare();
+
+    /// Mark `n` bytes of the region returned by prepare() as filled.
+    void commit(std::size_t n);
+
+    /// Extract the next complete request, if any.
+    Status next(HttpRequest& request);
+
+    /// True once per request whose head asked for "Expect: 100-continue"
+    /// while its body has not arrived yet; the caller should send the
+    /// interim response.
+    bool take_continue();
+
+    [[nodiscard]] std::size_t buffered() const { return write_pos_ - read_pos_; }
+
+private:
+    /// Parse the head in [read_pos_, read_pos_ + head_len) into `request`.
+    Status parse_head(std::size_t head_len, HttpRequest& request);
+
+    std::vector<char> buffer_;
+    std::size_t read_pos_  = 0;
+    std::size_t write_pos_ = 0;
+    std::size_t scan_pos_  = 0;        // where the search for "\r\n\r\n" resumes
+    std::size_t max_body_size_;
+    std::size_t max_head_size_;
+
+    // Set once the current request's head has been parsed.
+    std::size_t head_len_ = 0;
+    std::size_t body_len_ = 0;
+    bool expect_continue_ = false;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * LocalAPI's route table, resolved at compile time.
+ *
+ * The routes are fixed, so the table is turned into a perfect hash when
+ * the backend is compiled. A route's key is its method, its first and last
+ * path segments and its segment count, and the hash seed is searched for
+ * at compile time until no two routes share a slot. Matching a request
+ * splits the path into string_views in place, hashes the key once, and
+ * compares against the one route in that slot. Nothing is allocated and no
+ * other route is looked at.
+ *
+ *     const auto match = http_router::match(req.method, req.path);
+ *     switch (match.route) {
+ *     case http_router::Route::GroupSend: send(match.param); ...
+ *
+ * A pattern segment starting with ':' matches any non-empty segment, which
+ * comes back as `param`. It may only appear between the first and last
+ * segments (they are the key), and at most once per pattern. A table that
+ * breaks either rule fails to compile.
+ */
+namespace http_router {
+
+enum class Route : std::uint8_t {
+    NotFound,
+    Status,         // GET  /status
+    Metrics,        // GET  /metrics
+    ListFriends,    // GET  /friends
+    AddFriend,      // POST /friends
+    AddFriends,     // POST /friends/batch
+    History,        // GET  /messages
+    Search,         // GET  /messages/search
+    Send,           // POST /messages
+    MessageDelta,   // POST /messages/:id/deltas
+    SendBatch,      // POST /messages/batch
+    SendStream,     // POST /messages/stream
+    SendFile,       // POST /files
+    AcceptFile,     // POST /files/accept
+    CancelFile,     // POST /files/cancel
+    ListGroups,     // GET  /groups
+    CreateGroup,    // POST /groups
+    GroupSend,      // POST /groups/:id/messages
+    DebugTrace,     // POST /debug/trace
+    Sync,           // GET  /sync
+    Peers,          // GET  /peers
+};
+
+struct Match {
+    Route route = Route::NotFound;
+    std::string_view param;         // the ':' segment, empty if the route has none
+};
+
+namespace detail {
+
+struct Spec {
+    std::string_view method;
+    std::string_view pattern;
+    Route route;
+};
+
+inline constexpr Spec kRoutes[] = {
+    {"GET", "/status", Route::Status},
+    {"GET", "/metrics", Route::Metrics},
+    {"GET", "/friends", Route::ListFriends},
+    {"POST", "/friends", Route::AddFriend},
+    {"POST", "/friends/batch", Route::AddFriends},
+    {"GET", "/messages", Route::History},
+    {"GET", "/messages/search", Route::Search},
+    {"POST", "/messages", Route::Send},
+    {"POST", "/messages/:id/deltas", Route::MessageDelta},
+    {"POST", "/messages/batch", Route::SendBatch},
+    {"POST", "/messages/stream", Route::SendStream},
+    {"POST", "/files", Route::SendFile},
+    {"POST", "/files/accept", Route::AcceptFile},
+    {"POST", "/files/cancel", Route::CancelFile},
+    {"GET", "/groups", Route::ListGroups},
+    {"POST", "/groups", Route::CreateGroup},
+    {"POST", "/groups/:id/messages", Route::GroupSend},
+    {"POST", "/debug/trace", Route::DebugTrace},
+    {"GET", "/sync", Route::Sync},
+    {"GET", "/peers", Route::Peers},
+};
+
+inline constexpr std::size_t kMaxSegments = 3;
+inline constexpr std::size_t kSlots = 64;           // a power of two, well above the route count
+inline constexpr std::uint8_t kEmpty = 0xff;
+
+struct Segments {
+    std::array<std::string_view, kMaxSegments> at{};
+    std::size_t count = 0;
+    bool ok = false;        // false: no leading '/', or more than kMaxSegments
+};
+
+constexpr Segments split(std::string_view path) {
+    Segments out;
+    if (path.empty() || path.front() != '/') {
+        return out;
+    }
+    path.remove_prefix(1);
+    for (;;) {
+        if (out.count == kMaxSegments) {
+            return out;
+        }
+        const std::size_t slash = path.find('/');
+        out.at[out.count++] = path.substr(0, slash);
+        if (slash == std::string_view::npos) {
+            break;
+        }
+        path.remove_prefix(slash + 1);
+    }
+    out.ok = true;
+    return out;
+}
+
+constexpr std::uint32_t mix(std::uint32_t h, std::string_view s) {
+    for (const char c : s) {
+        h = (h ^ static_cast<unsigned char>(c)) * 16777619u;   // FNV-1a
+    }
+    return (h ^ 0xffu) * 16777619u;                             // field separator
+}
+
+constexpr std::size_t slot(std::uint32_t seed, std::string_view method, const Segments& s) {
+    std::uint32_t h = mix(2166136261u ^ seed, method);
+    h = mix(h, s.at[0]);
+    h = mix(h, s.at[s.count - 1]);
+    h = (h ^ static_cast<std::uint32_t>(s.count)) * 16777619u;
+    return (h ^ (h >> 16)) & (kSlots - 1);
+}
+
+struct Compiled {
+    Segments segments;
+    std::size_t param = kMaxSegments;   // index of the ':' segment; kMaxSegments if none
+};
+
+struct Table {
+    std::array<Compiled, std::size(kRoutes)> routes{};
+    std::array<std::uint8_t, kSlots> slots{};
+    std::uint32_t seed = 0;
+    bool valid = false;
+};
+
+constexpr Table build() {
+    Table t;
+    for (std::size_t i = 0; i < std::size(kRoutes); ++i) {
+        Compiled& c = t.routes[i];
+        c.segments = split(kRoutes[i].pattern);
+        if (!c.segments.ok) {
+            return t;
+        }
+        for (std::size_t k = 0; k < c.segments.count; ++k) {
+            if (!c.segments.at[k].starts_with(':')) {
+                continue;
+            }
+            if (k == 0 || k + 1 == c.segments.count || c.param != kMaxSegments) {
+                return t;
+            }
+            c.param = k;
+        }
+    }
+    for (std::uint32_t seed = 0; seed < 1024; ++seed) {
+        t.slots.fill(kEmpty);
+        bool perfect = true;
+        for (std::size_t i = 0; i < std::size(kRoutes) && perfect; ++i) {
+            auto& s = t.slots[slot(seed, kRoutes[i].method, t.routes[i].segments)];
+            perfect = s == kEmpty;
+            s = static_cast<std::uint8_t>(i);
+        }
+        if (perfect) {
+            t.seed = seed;
+            t.valid = true;
+            return t;
+        }
+    }
+    return t;
+}
+
+inline constexpr Table kTable = build();
+static_assert(kTable.valid,
+              "http_router: a pattern has a ':' segment first, last or twice, has too many "
+              "segments, or two routes share a key");
+
+} // namespace detail
+
+/// The route for `method` and `path` (without the query string).
+constexpr Match match(std::string_view method, std::string_view path) {
+    using namespace detail;
+    const Segments s = split(path);
+    if (!s.ok) {
+        return {};
+    }
+    const std::uint8_t index = kTable.slots[slot(kTable.seed, method, s)];
+    if (index == kEmpty || kRoutes[index].method != method) {
+        return {};
+    }
+    const Compiled& c = kTable.routes[index];
+    if (c.segments.count != s.count) {
+        return {};
+    }
+    for (std::size_t k = 0; k < s.count; ++k) {
+        if (k == c.param ? s.at[k].empty() : s.at[k] != c.segments.at[k]) {
+            return {};
+        }
+    }
+    return {kRoutes[index].route, c.param == kMaxSegments ? std::string_view() : s.at[c.param]};
+}
+
+static_assert(match("GET", "/status").route == Route::Status);
+static_assert(match("POST", "/files/cancel").route == Route::CancelFile);
+static_assert(match("POST", "/friends/batch").route == Route::AddFriends);
+static_assert(match("POST", "/messages/stream").route == Route::SendStream);
+static_assert(match("POST", "/groups/g1/messages").param == "g1");
+static_assert(match("POST", "/groups//messages").route == Route::NotFound);
+static_assert(match("DELETE", "/friends").route == Route::NotFound);
+static_assert(match("GET", "/status/").route == Route::NotFound);
+
+} // namespace http_router
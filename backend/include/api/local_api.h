@@ -1,32 +1,216 @@
 #pragma once
 
 #include <asio.hpp>
+#include <chrono>
 #include <cstdint>
+#include <cstddef>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "api/poll_advisor.h"
+#include "api/ui_listener.h"
+#include "network/inline_function.h"
+
+class IoContextPool;
+struct HttpRequest;
 
 /**
  * Minimal localhost-only HTTP API consumed by the Python UI.
  */
 class LocalAPI {
 public:
+    /// Listen on 127.0.0.1:`port`, or on no port if it is 0 (then serve
+    /// only on listen_unix()).
     LocalAPI(asio::io_context& io, uint16_t port);
 
+    /// Listen on the pool's main context; each accepted connection is bound
+    /// to a strand on the next pool context.
+    LocalAPI(IoContextPool& pool, uint16_t port);
+
+    /// Also serve the API on the Unix domain socket at `path`
+    /// (api/ui_listener.h). Call before start(); false if it can't listen.
+    bool listen_unix(const std::string& path);
+
     void start();
     void stop();
 
-    // Callbacks wired to Node methods
-    using SendCallback   = std::function<bool(const std::string& to, const std::string& text)>;
-    using FriendCallback = std::function<bool(const std::string& username)>;
+    // Callbacks wired to Node methods. Stored inline (network/inline_function.h):
+    // a capture of a pointer or two, as main.cpp's are, never allocates.
+    /// `expires_at` is empty, or a future time in the envelope timestamp
+    /// format after which both sides delete the message.
+    using SendCallback   = InlineFunction<asio::awaitable<bool>(const std::string& to,
+                                                               const std::string& text,
+                                                               const std::string& expires_at)>;
+    using FriendCallback = InlineFunction<bool(const std::string& username)>;
+    /// Returns {"added": [...], "not_found": [...]}, or nullopt if nobody
+    /// could be added.
+    using FriendsCallback = InlineFunction<asio::awaitable<std::optional<nlohmann::json>>(
+        std::vector<std::string> usernames)>;
+    /// Returns the transfer id, or nullopt if the file can't be offered.
+    using SendFileCallback = InlineFunction<std::optional<std::string>(const std::string& to,
+                                                                       const std::string& path)>;
+    using TransferCallback = InlineFunction<bool(const std::string& transfer_id)>;
+    /// Returns the new group, or nullopt if a member can't be added.
+    using CreateGroupCallback = InlineFunction<std::optional<nlohmann::json>(
+        const std::string& name, const std::vector<std::string>& members)>;
+    using ListGroupsCallback  = InlineFunction<nlohmann::json()>;
+    /// Returns what was sent to whom, or nullopt if there is no such group.
+    using GroupSendCallback   = InlineFunction<std::optional<nlohmann::json>(
+        const std::string& group_id, const std::string& text)>;
+    /// Returns the delta_id, or nullopt for a bad op or value or an
+    /// unknown conversation.
+    using DeltaCallback       = InlineFunction<asio::awaitable<std::optional<nlohmann::json>>(
+        const std::string& peer, const std::string& msg_id, const std::string& op,
+        const std::string& value)>;
+    /// Extra fields for GET /status; must be cheap and thread-safe.
+    using StatusCallback   = InlineFunction<nlohmann::json()>;
+    /// The `limit` peers costing most by `sort`, or nullopt for an unknown
+    /// `sort`; thread-safe.
+    using PeersCallback    = InlineFunction<std::optional<nlohmann::json>(const std::string& sort,
+                                                                          std::size_t limit)>;
+
+    // Read endpoints are awaited so their storage queries never block the
+    // connection's thread. A null result is reported as a 500. Bodies come
+    // back serialized, written without a json DOM.
+    using ListFriendsCallback = InlineFunction<asio::awaitable<std::optional<std::string>>()>;
+    /// An empty `before` means offset paging; otherwise it's the keyset
+    /// cursor (msg_id or timestamp) and `offset` is ignored. Answers with
+    /// the serialized page, which may be shared with a cache.
+    using HistoryCallback     = InlineFunction<asio::awaitable<std::shared_ptr<const std::string>>(
+        const std::string& peer, std::size_t limit, std::size_t offset,
+        const std::string& before)>;
+    /// Answers with the serialized results.
+    using SearchCallback      = InlineFunction<asio::awaitable<std::optional<std::string>>(
+        const std::string& query, const std::string& peer, std::size_t limit)>;
+    /// Messages stored after the msg_id `since`: an object with keys
+    /// sorted, so one with no messages starts with kNoNewMessages.
+    using SinceCallback       = InlineFunction<asio::awaitable<std::optional<std::string>>(
+        const std::string& peer, const std::string& since, std::size_t limit)>;
+    static constexpr std::string_view kNoNewMessages = R"({"has_more":false,"messages":[])";
+    /// The UI events after `cursor`, serialized (api/event_journal.h);
+    /// must be thread-safe.
+    using SyncCallback        = InlineFunction<std::string(const std::string& cursor)>;
 
     void set_on_send(SendCallback cb);
     void set_on_add_friend(FriendCallback cb);
+    void set_on_add_friends(FriendsCallback cb);
+    void set_on_list_friends(ListFriendsCallback cb);
+    void set_on_history(HistoryCallback cb);
+    void set_on_search(SearchCallback cb);
+    void set_on_messages_since(SinceCallback cb);
+    void set_on_send_file(SendFileCallback cb);
+    void set_on_accept_file(TransferCallback cb);
+    void set_on_cancel_file(TransferCallback cb);
+    void set_on_status(StatusCallback cb);
+    void set_on_peers(PeersCallback cb);
+    void set_on_create_group(CreateGroupCallback cb);
+    void set_on_list_groups(ListGroupsCallback cb);
+    void set_on_group_send(GroupSendCallback cb);
+    void set_on_delta(DeltaCallback cb);
+    void set_on_sync(SyncCallback cb);
+
+    /// A message with `peer` (a username or group id) was stored: wake the long-polls waiting on
+    /// that conversation. Thread-safe.
+    void notify_messages(const std::string& peer);
+
+    /// Something a UI would show happened (any UI event): polling clients
+    /// are told to come back sooner. Thread-safe.
+    void note_activity() { poll_advisor_.activity(); }
+
+    /// Bounds of the interval recommended to polling clients.
+    void set_poll_options(PollAdvisor::Options options) { poll_advisor_.set_options(options); }
 
 private:
-    void do_accept();
-    void handle_request(asio::ip::tcp::socket socket);
+    static constexpr std::chrono::seconds kIdleTimeout{60};
+    /// Upper bound for GET /messages?wait=.
+    static constexpr std::chrono::seconds kMaxWait{60};
+    /// Sends of one POST /messages/batch or /messages/stream in flight at
+    /// once: enough to keep the crypto workers' queues and the peer
+    /// connections' write batches full.
+    static constexpr std::size_t kSendWindow = 256;
+    /// Usernames one POST /friends/batch may add.
+    static constexpr std::size_t kMaxFriendBatch = 1000;
+
+    /// One message of a batch or stream.
+    struct Outgoing {
+        std::string to;
+        std::string text;
+        std::string expires_at;
+    };
+    /// (index in the batch, delivered directly) for a run of sends that
+    /// settled together; false stops the batch from starting more.
+    using SettledRun =
+        std::function<asio::awaitable<bool>(std::span<const std::pair<std::size_t, bool>>)>;
+
+    asio::awaitable<void> accept_loop(ui_listener::Acceptor& acceptor);
+
+    /// Keep-alive loop: parse, dispatch and answer requests until the client
+    /// closes, asks to close, misbehaves or idles past kIdleTimeout.
+    asio::awaitable<void> serve_connection(ui_listener::Socket socket);
+
+    /// Route one request; returns the status code and fills `body` (or
+    /// sets `shared_body` instead, for a body it must not copy),
+    /// `content_type` when the body isn't JSON and `content_encoding` when
+    /// it is compressed.
+    asio::awaitable<int> dispatch(const HttpRequest& req, std::string& body,
+                                  std::shared_ptr<const std::string>& shared_body,
+                                  std::string_view& content_type,
+                                  std::string_view& content_encoding);
+
+    /// Send `messages` through on_send_, up to kSendWindow at a time on the
+    /// calling coroutine's executor, handing each run that settles to
+    /// `settled` in the order they finish. False if `settled` stopped it;
+    /// sends already started still finish.
+    asio::awaitable<bool> send_many(std::vector<Outgoing> messages, const SettledRun& settled);
+
+    /// POST /messages/stream: one message per NDJSON line of the body, each
+    /// answered with a line of a chunked NDJSON response as it settles.
+    /// Writes the whole response itself; false if the socket failed.
+    asio::awaitable<bool> stream_sends(ui_listener::Socket& socket, const HttpRequest& req);
+
+    /// GET /messages?since=: answer at once if there is something new,
+    /// otherwise hold the request for up to `wait` until notify_messages().
+    asio::awaitable<std::optional<std::string>> wait_for_messages(const std::string& peer,
+                                                                  const std::string& since,
+                                                                  std::size_t limit,
+                                                                  std::chrono::seconds wait);
+
+    asio::any_io_executor connection_executor();
+
+    IoContextPool* pool_ = nullptr;
+    ui_listener::Acceptor acceptor_;            // 127.0.0.1:<port>; closed if the port is 0
+    ui_listener::Acceptor unix_acceptor_;
+    std::string unix_path_;
+    SendCallback        on_send_;
+    FriendCallback      on_add_friend_;
+    FriendsCallback     on_add_friends_;
+    ListFriendsCallback on_list_friends_;
+    HistoryCallback     on_history_;
+    SearchCallback      on_search_;
+    SinceCallback       on_since_;
+    SendFileCallback    on_send_file_;
+    TransferCallback    on_accept_file_;
+    TransferCallback    on_cancel_file_;
+    StatusCallback      on_status_;
+    PeersCallback       on_peers_;
+    CreateGroupCallback on_create_group_;
+    ListGroupsCallback  on_list_groups_;
+    GroupSendCallback   on_group_send_;
+    DeltaCallback       on_delta_;
+    SyncCallback        on_sync_;
+    PollAdvisor         poll_advisor_{PollAdvisor::Options{}};
 
-    asio::ip::tcp::acceptor acceptor_;
-    SendCallback   on_send_;
-    FriendCallback on_add_friend_;
+    /// Pending long-polls by peer. A timer is woken by moving its expiry
+    /// to now on its own executor, which also covers a wake-up that lands
+    /// before the wait starts.
+    std::mutex waiters_mutex_;
+    std::unordered_multimap<std::string, std::shared_ptr<asio::steady_timer>> waiters_;
 };
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * How often a polling UI should come back (protocol/api_contract.md §6.2).
+ *
+ * A UI without the WebSocket feed says so with `X-Client-Mode: poll`, and
+ * LocalAPI answers its requests with the interval() as `Retry-After`. The
+ * interval is a quarter of the time since the last activity, within
+ * [min, max]: during a conversation the UI polls every `min`, and a
+ * backend left alone backs off to one wakeup every `max`. Activity is
+ * anything the UI would want to show: a message stored or sent, a delta,
+ * a friend coming or going.
+ *
+ * Push clients (`X-Client-Mode: push`) get no recommendation. Lock-free;
+ * thread-safe.
+ */
+class PollAdvisor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::milliseconds min{1000};
+        std::chrono::milliseconds max{30000};
+    };
+
+    explicit PollAdvisor(Options options);
+
+    /// New bounds (config reload); max is raised to min if below it.
+    void set_options(Options options);
+
+    /// Something happened that a polling UI would show.
+    void activity(Clock::time_point now = Clock::now());
+
+    /// The poll interval to recommend now.
+    [[nodiscard]] std::chrono::milliseconds interval(Clock::time_point now = Clock::now()) const;
+
+private:
+    std::atomic<int64_t> min_ms_;
+    std::atomic<int64_t> max_ms_;
+    std::atomic<Clock::rep> last_activity_;     // Clock ticks since its epoch
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * UI events in a shared-memory ring, for a UI process on the same machine
+ * (the Tauri shell) that would rather map them than parse WebSocket frames
+ * of JSON text. Optional; the WebSocket stream carries the same events.
+ *
+ * The ring is a POSIX shared-memory object (shm_open) created mode 0600.
+ * There is one producer, the node. Any number of readers each keep their
+ * own position and never write, so they may map it read-only. Layout, all
+ * little-endian:
+ *
+ *     0    u32 magic "P2PU", u32 version (1), u64 capacity
+ *     64   u64 head       bytes committed, ever; a record is complete
+ *                         once head has passed its end
+ *     72   u64 reserve    bytes the producer may be writing up to
+ *     128  u32 doorbell   bumped after each record; a Linux futex word
+ *     192  capacity bytes of records, capacity a power of two
+ *
+ * A record starts at an 8-byte aligned offset: u32 size, u32 kind
+ * (1 = event), then `size` bytes of MessagePack {"event": name, "data":
+ * {...}}, padded to 8. A size of kPadding means the rest of the area is
+ * unused and the next record starts at offset 0.
+ *
+ * A reader starts at the current head and reads records up to the head it
+ * loaded with acquire. For a record at absolute position p, it checks
+ * `reserve` (loaded after an acquire fence) twice: after reading the size,
+ * before trusting it, and again after copying the payload. If reserve is
+ * past p + capacity, the producer has lapped the reader and what it read
+ * may be torn. The reader then drops it, jumps to head, and refetches over
+ * REST as it would after a WebSocket reconnect. With nothing new, it
+ * FUTEX_WAITs on `doorbell` (a shared futex, which also works on a
+ * read-only mapping) or, off Linux, polls it.
+ */
+class UiEventRing {
+public:
+    static constexpr uint32_t kMagic = 0x55503250;          // "P2PU"
+    static constexpr uint32_t kVersion = 1;
+    static constexpr uint32_t kPadding = 0xffffffff;
+    static constexpr uint32_t kEventRecord = 1;
+
+    static constexpr std::size_t kHeadOffset = 64;
+    static constexpr std::size_t kReserveOffset = 72;
+    static constexpr std::size_t kDoorbellOffset = 128;
+    static constexpr std::size_t kDataOffset = 192;
+
+    UiEventRing() = default;
+    ~UiEventRing();
+
+    UiEventRing(const UiEventRing&) = delete;
+    UiEventRing& operator=(const UiEventRing&) = delete;
+
+    /// Create the shared-memory object `name` (e.g. "/p2p-chat-alice-ui")
+    /// with `capacity` bytes of records, rounded up to a power of two. An
+    /// object left under that name by an earlier run is replaced. False
+    /// (logged) on failure, or on a platform without POSIX shared memory.
+    bool open(const std::string& name, std::size_t capacity);
+
+    /// Append one event and ring the doorbell. One caller at a time. False
+    /// if the ring isn't open or the event is over a quarter of it.
+    bool publish(std::string_view event, const nlohmann::json& data);
+
+private:
+    std::string name_;
+    unsigned char* base_ = nullptr;
+    std::size_t mapped_ = 0;
+    uint64_t capacity_ = 0;
+    std::vector<uint8_t> record_;               // reused MessagePack buffer
+};
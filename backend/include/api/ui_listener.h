@@ -0,0 +1,36 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstdint>
+#include <string>
+
+/**
+ * Listening sockets for the servers the UI talks to (LocalAPI and
+ * WsEventServer).
+ *
+ * Each server can listen on 127.0.0.1:<port>, on a Unix domain socket, or
+ * on both. Both acceptors are asio::generic::stream_protocol, so
+ * connections from either are the same socket type and go through the same
+ * serve loop. A local socket skips the loopback TCP stack. It doesn't take
+ * a port, so several nodes on one machine can't collide. The socket file
+ * is created mode 0600, so unlike a loopback port it only accepts
+ * connections from the node's own user.
+ */
+namespace ui_listener {
+
+using Acceptor = asio::basic_socket_acceptor<asio::generic::stream_protocol>;
+using Socket = asio::generic::stream_protocol::socket;
+
+/// Listen on 127.0.0.1:`port`. Throws asio::system_error if the port
+/// can't be bound, as a tcp::acceptor constructed on it would.
+void listen_tcp(Acceptor& acceptor, uint16_t port);
+
+/// Listen on the Unix domain socket at `path`. A socket file left there by
+/// a node that is gone is replaced, but one that still accepts connections
+/// is not. False (logged) on failure, or where ASIO has no local sockets.
+bool listen_unix(Acceptor& acceptor, const std::string& path);
+
+/// Close `acceptor`, and remove the socket file at `path` if it is set.
+void close(Acceptor& acceptor, const std::string& path);
+
+} // namespace ui_listener
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * The parts of RFC 6455 the event server needs: the handshake key, server
+ * frame encoding and an incremental decoder for (masked) client frames.
+ * The client side — masked frames, unmasked server frames — serves the
+ * Supabase Realtime link.
+ */
+namespace websocket {
+
+enum class Opcode : uint8_t {
+    Continuation = 0x0,
+    Text         = 0x1,
+    Binary       = 0x2,
+    Close        = 0x8,
+    Ping         = 0x9,
+    Pong         = 0xA,
+};
+
+/// Close status codes we send.
+inline constexpr uint16_t kCloseNormal        = 1000;
+inline constexpr uint16_t kCloseProtocolError = 1002;
+inline constexpr uint16_t kCloseTooBig        = 1009;
+inline constexpr uint16_t kClosePolicy        = 1008;
+
+/// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key.
+std::string accept_key(std::string_view client_key);
+
+/// One complete, unmasked server frame (FIN set). Server frames carry no
+/// mask, so the same bytes can be written to every client.
+std::string encode_frame(Opcode opcode, std::string_view payload);
+
+/// A close frame carrying `code`.
+std::string encode_close(uint16_t code);
+
+/// One complete client frame (FIN set), masked with a fresh random key
+/// as the RFC requires of everything a client sends.
+std::string encode_client_frame(Opcode opcode, std::string_view payload);
+
+/// A random Sec-WebSocket-Key for a client handshake.
+std::string client_key();
+
+/**
+ * Decodes frames from a byte stream: masked client frames by default, or
+ * a server's unmasked ones. Fragmented messages are reassembled; control
+ * frames may arrive between fragments and are returned on their own.
+ */
+class FrameDecoder {
+public:
+    enum class Status {
+        Message,    ///< `opcode`/`payload` hold a complete message or control frame
+        NeedMore,
+        Error       ///< protocol violation or oversized message; see error_code()
+    };
+
+    enum class From { Client, Server };
+
+    explicit FrameDecoder(std::size_t max_message_size = 64 * 1024, From from = From::Client)
+        : max_message_size_(max_message_size), masked_(from == From::Client) {}
+
+    /// Append received bytes.
+    void feed(const char* data, std::size_t n) { buffer_.append(data, n); }
+
+    /// Extract the next message. `payload` stays valid until the next call.
+    Status next(Opcode& opcode, std::string& payload);
+
+    /// Close code describing the last Error.
+    [[nodiscard]] uint16_t error_code() const { return error_code_; }
+
+private:
+    std::string buffer_;
+    std::size_t read_pos_ = 0;
+    std::size_t max_message_size_;
+    bool masked_;                       // frames must (client) or must not (server) be masked
+    std::string message_;               // fragments assembled so far
+    Opcode message_opcode_ = Opcode::Text;
+    bool in_message_ = false;
+    uint16_t error_code_ = kCloseProtocolError;
+};
+
+} // namespace websocket
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "api/event_journal.h"
+#include "api/ui_listener.h"
+#include "network/backpressure.h"
+
+class IoContextPool;
+class WsSession;
+
+/**
+ * Localhost WebSocket endpoint (ws://127.0.0.1:<ws_port>/events, and
+ * optionally the same on a Unix domain socket) that pushes node events to
+ * the UI instead of having it poll the REST API.
+ *
+ * Every event is serialized and framed once; all clients share the same
+ * bytes. Each client has a bounded send queue, and a client that falls that
+ * far behind is disconnected rather than allowed to grow memory without
+ * limit — it reconnects and catches up.
+ *
+ * Every event is also kept, numbered, in an EventJournal, and goes out
+ * with its cursor. A client that reconnects to `/events?cursor=<the last
+ * one it saw>` first gets one `sync` event holding everything it missed
+ * (EventJournal::batch()), then the live stream; sync() serves the same
+ * batch to `GET /sync`.
+ */
+class WsEventServer {
+public:
+    /// Pending frames / bytes per client before it is dropped.
+    static constexpr std::size_t kMaxQueuedFrames = 1024;
+    static constexpr std::size_t kMaxQueuedBytes  = 4 * 1024 * 1024;
+
+    /// `allowed_origins` are the Origin header values accepted on the
+    /// upgrade; a request without Origin (a non-browser client) is allowed.
+    /// A `port` of 0 opens no TCP listener.
+    WsEventServer(IoContextPool& pool, uint16_t port, std::vector<std::string> allowed_origins);
+    ~WsEventServer();
+
+    /// Also accept clients on the Unix domain socket at `path`
+    /// (api/ui_listener.h). Call before start(); false if it can't listen.
+    bool listen_unix(const std::string& path);
+
+    /// Count every client's queued bytes towards `backpressure`: reads
+    /// pause at half of kMaxQueuedBytes and resume at an eighth. Call
+    /// before start().
+    void set_backpressure(Backpressure& backpressure);
+
+    void start();
+    void stop();
+
+    /// Keep up to `bytes` of recent events for clients catching up.
+    void set_sync_bytes(std::size_t bytes);
+
+    /// Journal the event and push `{"cursor": ..., "event": ..., "data":
+    /// ...}` to every connected client. Thread-safe.
+    void broadcast(std::string_view event, const nlohmann::json& data);
+
+    /// What happened after `cursor`, as EventJournal::batch(). Thread-safe.
+    [[nodiscard]] std::string sync(std::string_view cursor) const;
+
+    /// A JSON message sent by a client (e.g. typing). Called on the
+    /// client's strand.
+    using ClientEventCallback = std::function<void(const nlohmann::json& event)>;
+    void set_on_client_event(ClientEventCallback cb);
+
+    [[nodiscard]] std::size_t client_count() const;
+
+private:
+    friend class WsSession;
+
+    asio::awaitable<void> accept_loop(ui_listener::Acceptor& acceptor);
+
+    bool origin_allowed(const std::string& origin) const;
+    /// Start sending `session` events. With `resume`, also returns the
+    /// frame of the `sync` event it should get first.
+    std::shared_ptr<const std::string> add(const std::shared_ptr<WsSession>& session,
+                                           const std::optional<std::string>& resume);
+    void remove(const std::shared_ptr<WsSession>& session);
+
+    IoContextPool& pool_;
+    ui_listener::Acceptor acceptor_;            // 127.0.0.1:<port>; closed if the port is 0
+    ui_listener::Acceptor unix_acceptor_;
+    std::string unix_path_;
+    std::vector<std::string> allowed_origins_;
+    ClientEventCallback on_client_event_;
+    Backpressure::Level* backlog_ = nullptr;    // all clients' queued bytes
+
+    mutable std::mutex mutex_;
+    std::unordered_set<std::shared_ptr<WsSession>> sessions_;   // handshake completed
+    EventJournal journal_;                                      // guarded by mutex_
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "config/rcu_cell.h"
+
+/**
+ * config.json, watched and reloaded while the node runs.
+ *
+ * The parsed config is an RcuCell: current() is one atomic load, and a
+ * reader keeps a consistent version even while a reload publishes the
+ * next. A watcher thread follows the file (inotify on Linux,
+ * FindFirstChangeNotification on Windows, mtime polling elsewhere),
+ * waits for writes to settle, and reloads; a file that doesn't parse,
+ * e.g. one caught mid-save, is logged and the running config kept.
+ *
+ * Listeners decide what a change means: most settings are read once by
+ * the component that uses them, so each applier pushes the values it can
+ * change live and the rest wait for a restart (changed_keys() tells
+ * which changed).
+ */
+class LiveConfig {
+public:
+    /// Runs on the watcher thread after each reload that changed something.
+    using Listener = std::function<void(const nlohmann::json& now, const nlohmann::json& before)>;
+
+    LiveConfig(std::string path, nlohmann::json initial);
+    ~LiveConfig();
+
+    LiveConfig(const LiveConfig&) = delete;
+    LiveConfig& operator=(const LiveConfig&) = delete;
+
+    /// Parse `path`; nullopt, with the reason logged, if it can't be read
+    /// or isn't valid JSON.
+    static std::optional<nlohmann::json> load(const std::string& path);
+
+    /// "section.key" for every second-level value that differs.
+    static std::vector<std::string> changed_keys(const nlohmann::json& now,
+                                                 const nlohmann::json& before);
+
+    [[nodiscard]] const nlohmann::json& current() const { return config_.read(); }
+    [[nodiscard]] uint64_t version() const { return config_.version(); }
+
+    /// Register before start().
+    void on_change(Listener listener);
+
+    void start();
+    void stop();
+
+    /// Re-read the file now. Returns true if a new version was published.
+    bool reload();
+
+private:
+    void watch();
+
+    std::string path_;
+    RcuCell<nlohmann::json> config_;
+    std::vector<Listener> listeners_;
+    std::mutex reload_mutex_;                   // one reload at a time
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+};
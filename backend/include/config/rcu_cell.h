@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * A value that is read on hot paths and replaced rarely (config reloads).
+ *
+ * Readers take one acquire load and get a reference to an immutable
+ * version; they never lock and never see a half-updated value. Writers
+ * serialise on a mutex and publish a new version with a release store.
+ *
+ * Old versions are kept until the cell is destroyed instead of being
+ * reclaimed after a grace period: a reader may hold a reference for as
+ * long as it likes, and with human-driven reloads the retained versions
+ * amount to a few kilobytes over a process's lifetime.
+ */
+template <typename T>
+class RcuCell {
+public:
+    explicit RcuCell(T initial) { publish(std::move(initial)); }
+
+    RcuCell(const RcuCell&) = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+    /// The current version; valid for the lifetime of the cell.
+    [[nodiscard]] const T& read() const noexcept {
+        return *current_.load(std::memory_order_acquire);
+    }
+
+    /// Number of versions published so far, starting at 1.
+    [[nodiscard]] uint64_t version() const noexcept {
+        return version_.load(std::memory_order_acquire);
+    }
+
+    void publish(T value) {
+        std::lock_guard lock(writer_);
+        versions_.push_back(std::make_unique<const T>(std::move(value)));
+        current_.store(versions_.back().get(), std::memory_order_release);
+        version_.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    std::atomic<const T*> current_{nullptr};
+    std::atomic<uint64_t> version_{0};
+    std::mutex writer_;
+    std::vector<std::unique_ptr<const T>> versions_;   // writer_ only
+};
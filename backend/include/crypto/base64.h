@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Standard (RFC 4648 §4, padded) base64 used for every crypto field on the
+ * wire, in keys.json and in Supabase.
+ *
+ * Long inputs take an AVX2 (x86-64) or NEON (AArch64) path chosen once at
+ * startup; the tail and short inputs use a table-driven scalar loop. All
+ * paths produce identical output and reject the same malformed input.
+ */
+namespace base64 {
+
+/// Exact encoded length for `n` input bytes.
+constexpr std::size_t encoded_size(std::size_t n) { return (n + 2) / 3 * 4; }
+
+/// Upper bound on the decoded length of `n` base64 characters.
+constexpr std::size_t max_decoded_size(std::size_t n) { return n / 4 * 3; }
+
+std::string encode(std::span<const uint8_t> bytes);
+std::string encode(std::string_view bytes);
+
+/// Decode into `out`. Returns false (and leaves `out` unspecified) on bad
+/// length, characters outside the alphabet, or misplaced padding.
+bool decode(std::string_view text, std::vector<uint8_t>& out);
+bool decode(std::string_view text, std::string& out);
+
+/// Low-level entry points. `dst` must hold encoded_size(n) /
+/// max_decoded_size(n) bytes respectively.
+void encode_to(const uint8_t* src, std::size_t n, char* dst);
+bool decode_to(const char* src, std::size_t n, uint8_t* dst, std::size_t& written);
+
+/// Name of the accelerated path in use ("avx2", "neon" or "scalar").
+const char* implementation();
+
+namespace scalar {
+/// Portable reference implementation (exposed for tests and benchmarks).
+void encode_to(const uint8_t* src, std::size_t n, char* dst);
+bool decode_to(const char* src, std::size_t n, uint8_t* dst, std::size_t& written);
+} // namespace scalar
+
+} // namespace base64
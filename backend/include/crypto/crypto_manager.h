@@ -1,18 +1,51 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <cstdint>
 
+#include "crypto/secure_arena.h"
+#include "telemetry/memory.h"
+
 /**
  * Wraps libsodium for key management, encryption, and signing.
  *
  * Key exchange:  X25519  (crypto_box_keypair / crypto_box_easy)
  * Signing:       Ed25519 (crypto_sign_keypair / crypto_sign_detached)
+ *
+ * The X25519 shared secret for each peer is computed once with
+ * crypto_box_beforenm and kept in a bounded LRU cache, so repeated messages
+ * to (or from) the same peer skip the scalar multiplication.
+ *
+ * Both secret keys and every cached shared key live in one SecureArena
+ * (guard-paged, mlocked): the cache is a fixed array of 32-byte slots, so
+ * it is wiped with a single sodium_memzero.
+ *
+ * After a key rotation (crypto/key_rotation.h) the X25519 secret key that
+ * was retired can be loaded alongside the current one. Anything that
+ * fails to open under the current key is then tried under the retired
+ * one, uncached, until it expires: friends who haven't heard of the new
+ * key yet keep sealing to the old one.
  */
 class CryptoManager {
 public:
-    CryptoManager();
+    static constexpr std::size_t kDefaultSharedKeyCacheSize = 256;
+
+    explicit CryptoManager(std::size_t shared_key_cache_size = kDefaultSharedKeyCacheSize);
+    ~CryptoManager();   // the arena wipes secret keys and cached shared keys
+
+    CryptoManager(const CryptoManager&) = delete;
+    CryptoManager& operator=(const CryptoManager&) = delete;
 
     /// Must be called once before any other method.
     static bool init();
@@ -20,34 +53,216 @@ public:
     /// Generate a fresh X25519 + Ed25519 key pair.
     void generate_keypair();
 
+    /// Derive both key pairs from `seed`: the same seed always gives the
+    /// same keys, with nothing read from or written to disk. For test
+    /// fleets only; anyone who knows the seed holds the secret keys.
+    void derive_keypair(std::string_view seed);
+
     /// Persist keys to disk (JSON).
     void save_keypair(const std::string& path) const;
 
     /// Load keys from disk.
     bool load_keypair(const std::string& path);
 
+    /// Persist keys to a fixed-layout binary keystore, with `node_id`
+    /// cached beside them. Written mode 0600 to a temporary file that is
+    /// then renamed over `path`. False (logged) on failure.
+    ///
+    ///     0    "P2PK", u32 version (1)
+    ///     8    X25519 public (32), secret (32)
+    ///     72   Ed25519 public (32), secret (64)
+    ///     168  node id, 32 ASCII hex digits
+    ///     200  BLAKE2b-128 of bytes 0..200
+    bool save_keystore(const std::string& path, std::string_view node_id) const;
+
+    /// Load keys written by save_keystore(), and the node id cached with
+    /// them. False if there is no keystore at `path`; false (logged) if it
+    /// is damaged.
+    bool load_keystore(const std::string& path, std::string& node_id);
+
+    /// Keep the X25519 key pair in use now, as retired, in a record of
+    /// its own at `path`, with the key_update that announces its successor
+    /// (`update`: the body, then our signature of it) and the unix time
+    /// `until` which it stays valid. Written like save_keystore(); false
+    /// (logged) on failure.
+    ///
+    ///     0    "P2PR", u32 version (1)
+    ///     8    X25519 public (32), secret (32)
+    ///     72   until, i64
+    ///     80   key_update body (137), then its signature (64)
+    ///     281  BLAKE2b-128 of bytes 0..281
+    bool save_retired(const std::string& path, std::span<const uint8_t> update,
+                      int64_t until) const;
+
+    /// Load the retired key pair written by save_retired() and hand back
+    /// its update and expiry. False, loading nothing, if there is no
+    /// record, it has expired, or it holds our current key (a rotation
+    /// that stopped before the new keystore was written); logged if it
+    /// is damaged. Call after the current keys are loaded and before any
+    /// concurrent use.
+    bool load_retired(const std::string& path, std::vector<uint8_t>& update, int64_t& until);
+
+    [[nodiscard]] bool has_retired_key() const { return has_retired_; }
+
+    /// The node id implied by the signing key: 32 hex digits of its
+    /// BLAKE2b hash. Stable for as long as the keys are.
+    [[nodiscard]] std::string derived_node_id() const;
+
     /// Encrypt a plaintext message for a given peer public key.
+    /// Returns nonce (24 bytes) || ciphertext, or empty on failure.
     std::string encrypt(const std::string& plaintext,
                         const std::vector<uint8_t>& peer_public_key) const;
 
-    /// Decrypt a ciphertext from a given peer public key.
+    /// Decrypt nonce || ciphertext from a given peer public key.
+    /// Returns empty if authentication fails.
     std::string decrypt(const std::string& ciphertext,
                         const std::vector<uint8_t>& peer_public_key) const;
 
-    /// Sign a message with Ed25519.
+    /// One payload sealed for many recipients (encrypt_for_many).
+    struct Broadcast {
+        /// nonce (24) || XSalsa20-Poly1305 of the payload under a random
+        /// content key. The same bytes go to every recipient.
+        std::string body;
+        /// Per recipient, in input order: the content key sealed with the
+        /// shared key for that peer, 48 bytes. Empty for an unusable key.
+        std::vector<std::string> keys;
+    };
+
+    /// Encrypt `plaintext` once and wrap its key for each of `peer_public_keys`,
+    /// spreading the wraps over up to `threads` workers (0 = hardware
+    /// concurrency, or the set_spread() pool). Costs one payload encryption plus 48 bytes and a
+    /// crypto_box (from the shared-key cache) per recipient. The wraps use a
+    /// nonce hashed from `body`, so a recipient can't pass off another body
+    /// under the same content key to the others.
+    Broadcast encrypt_for_many(std::string_view plaintext,
+                               std::span<const std::vector<uint8_t>> peer_public_keys,
+                               std::size_t threads = 0) const;
+
+    /// Open a Broadcast body with our wrapped key from it. Returns empty if
+    /// either fails to authenticate.
+    std::string decrypt_broadcast(std::string_view body, std::string_view wrapped_key,
+                                  const std::vector<uint8_t>& sender_public_key) const;
+
+    /// Sign a message with Ed25519. Returns the raw 64-byte signature.
     std::string sign(const std::string& message) const;
 
     /// Verify an Ed25519 signature.
     bool verify(const std::string& message,
                 const std::string& signature,
-                const std::vector<uint8_t>& peer_signing_key) const;
+                std::span<const uint8_t> peer_signing_key) const;
+
+    /// One received envelope to authenticate and open.
+    struct OpenRequest {
+        std::span<const uint8_t> nonce;           // 24 bytes
+        std::span<const uint8_t> ciphertext;      // the signed bytes
+        std::span<const uint8_t> signature;       // 64 bytes
+        std::span<const uint8_t> peer_public_key;   // X25519
+        std::span<const uint8_t> peer_signing_key;  // Ed25519
+    };
+
+    enum class OpenStatus { Ok, BadSignature, DecryptFailed };
+
+    struct OpenResult {
+        OpenStatus status = OpenStatus::DecryptFailed;
+        std::string plaintext;
+        std::chrono::nanoseconds verify_time{0};
+        std::chrono::nanoseconds decrypt_time{0};
+    };
+
+    /// Verify then decrypt every request, spreading the work over up to
+    /// `threads` workers (0 = hardware concurrency, or the set_spread()
+    /// pool). Results are in input order; a bad item only fails its own
+    /// slot.
+    std::vector<OpenResult> open_batch(std::span<const OpenRequest> requests,
+                                       std::size_t threads = 0) const;
+
+    /// Open ciphertexts of at least `bytes` with the signature check and
+    /// the decryption side by side, as a two-item set_spread() batch
+    /// (0 = never; without a spread, always verify first). The plaintext
+    /// still only comes out once both passed.
+    void set_split_open_bytes(std::size_t bytes) { split_open_bytes_.store(bytes); }
+    static constexpr std::size_t kDefaultSplitOpenBytes = 64 * 1024;
+
+    /// Runs fn(0) .. fn(count - 1) on the calling thread and others,
+    /// returning once all have run (CryptoWorkers::for_each).
+    using Spread =
+        std::function<void(std::size_t count, const std::function<void(std::size_t)>& fn)>;
+
+    /// Spread the batch calls given `threads` = 0 over `spread` instead of
+    /// starting threads for each. Set before any concurrent use.
+    void set_spread(Spread spread) { spread_ = std::move(spread); }
 
     [[nodiscard]] const std::vector<uint8_t>& public_key() const { return public_key_; }
     [[nodiscard]] const std::vector<uint8_t>& signing_public_key() const { return signing_public_key_; }
 
+    /// Drop (and wipe) every cached shared key.
+    void clear_shared_keys() const;
+
+    [[nodiscard]] std::size_t shared_key_cache_size() const;
+
+    /// Public keys of the peers with a cached shared key, most recently
+    /// used first. What a restart needs to rebuild the cache; the shared
+    /// keys themselves never leave the arena.
+    [[nodiscard]] std::vector<std::vector<uint8_t>> cached_peers() const;
+
+    /// Compute and cache the shared keys for `peers` (ordered as
+    /// cached_peers() returns them). Unusable keys are skipped.
+    void warm_shared_keys(const std::vector<std::vector<uint8_t>>& peers) const;
+
 private:
+    using SharedKey = std::array<uint8_t, 32>;   // crypto_box_BEFORENMBYTES
+
+    struct CachedKey {
+        std::string peer;                         // raw peer public key
+        std::size_t slot;                         // index into shared_keys_
+    };
+
+    /// What memory::Area::CryptoCache is charged per cached key: its slot,
+    /// the peer key, and the list and index nodes.
+    static constexpr std::size_t kCachedKeyBytes =
+        32 + 32 + sizeof(CachedKey) + 4 * sizeof(void*) + 64;
+
+    /// Wipe and drop the least recently used key. Requires cache_mutex_
+    /// and a non-empty cache.
+    void evict_lru_locked() const;
+
+    /// Evict least recently used keys until `bytes` are given back
+    /// (memory::Reclaimer).
+    void shrink(std::size_t bytes) const;
+
+    /// Copy the shared key for `peer_public_key` into `out`, computing and
+    /// caching it on a miss. Returns false if the key is unusable.
+    bool shared_key(std::span<const uint8_t> peer_public_key, SharedKey& out) const;
+    /// shared_key() under the retired secret key, never cached. False if
+    /// there is none.
+    bool retired_shared_key(std::span<const uint8_t> peer_public_key, SharedKey& out) const;
+
+    OpenResult open_one(const OpenRequest& request) const;
+    /// open_one() for a large request: verify and decrypt at once.
+    OpenResult open_split(const OpenRequest& request) const;
+    /// The decryption half of both: fills `result` and says if it opened.
+    bool decrypt_into(const OpenRequest& request, OpenResult& result) const;
+
+    std::size_t cache_capacity_;
+
     std::vector<uint8_t> public_key_;       // X25519
-    std::vector<uint8_t> secret_key_;       // X25519
     std::vector<uint8_t> signing_public_key_; // Ed25519
-    std::vector<uint8_t> signing_secret_key_; // Ed25519
+
+    SecureArena arena_;
+    std::span<uint8_t> secret_key_;         // X25519, in arena_
+    std::span<uint8_t> signing_secret_key_; // Ed25519, in arena_
+    std::span<uint8_t> shared_keys_;        // cache_capacity_ slots, in arena_
+    std::span<uint8_t> retired_secret_key_; // X25519, in arena_
+    bool has_keys_ = false;                 // set before any concurrent use
+    bool has_retired_ = false;              // likewise
+    std::atomic<std::size_t> split_open_bytes_{kDefaultSplitOpenBytes};
+    Spread spread_;                         // set before any concurrent use
+
+    mutable std::mutex cache_mutex_;
+    mutable std::list<CachedKey> cache_lru_;  // front = most recently used
+    mutable std::unordered_map<std::string, std::list<CachedKey>::iterator> cache_index_;
+    mutable std::vector<std::size_t> free_slots_;
+
+    memory::Reclaimer reclaimer_{memory::Area::CryptoCache,
+                                 [this](std::size_t bytes) { shrink(bytes); }};
 };
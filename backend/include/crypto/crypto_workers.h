@@ -0,0 +1,93 @@
+#pragma once
+
+#include <asio.hpp>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "network/traffic_class.h"
+
+/**
+ * A small pool that takes signature checks and decryption off the I/O
+ * threads, so a burst of large messages can't stall accepts and API calls.
+ *
+ * Each worker drains its own bounded lock-free queues (many producers, one
+ * consumer), one per TrafficClass. A job's `key`, the sender, picks the
+ * worker, so one sender's frames of a class finish in arrival order. The
+ * work returns a continuation, which is posted back to the I/O executor in
+ * that same order. Control jobs go first, then interactive ones; a bulk
+ * job (device sync) only takes every eighth turn while others wait, so a
+ * history batch never sits in front of a chat message.
+ *
+ * Jobs of at most `inline_max_bytes` run inline on the calling thread when
+ * nothing from their worker is still in flight; below that size the
+ * handoff costs more than the crypto. A full queue makes the producer wait
+ * for room, which pushes back on the connection that is flooding it.
+ *
+ * A batch (for_each(), e.g. a page of the offline backlog) is not bound to
+ * a sender, so it is not queued behind one: the caller works through it in
+ * chunks of eight and wakes workers to steal chunks from the same cursor.
+ * A batch too short for that is cut finer, down to single items, so even
+ * the two halves of a split open (CryptoManager::set_split_open_bytes)
+ * can go to a helper. A helper checks its own queues between chunks, so
+ * its senders' frames wait behind at most one chunk, never the batch.
+ * Queued per-sender jobs are not stolen; they would finish out of order.
+ *
+ * The time each job's work takes is charged to its key in peer_usage, for
+ * GET /peers.
+ */
+class CryptoWorkers {
+public:
+    struct Options {
+        std::size_t threads = 2;                 // 0 = run everything inline
+        std::size_t queue_depth = 1024;          // per worker, rounded up to a power of two
+        std::size_t inline_max_bytes = 512;
+        /// Worker i is pinned to cpus[i % size]; empty = float. Each worker
+        /// pins itself before it builds its queues, so they are allocated
+        /// on its NUMA node.
+        std::vector<unsigned> cpus;
+    };
+
+    /// Runs on a worker; returns what to run on the I/O executor after it.
+    using Work = std::function<std::function<void()>()>;
+
+    /// Continuations are posted to `io`.
+    CryptoWorkers(asio::any_io_executor io, Options options);
+    ~CryptoWorkers();                            // queued jobs are dropped
+
+    CryptoWorkers(const CryptoWorkers&) = delete;
+    CryptoWorkers& operator=(const CryptoWorkers&) = delete;
+
+    /// Run `work` for a frame of `bytes` bytes from `key`. Thread-safe.
+    void run(std::string_view key, std::size_t bytes, Work work,
+             TrafficClass cls = TrafficClass::Interactive);
+
+    /// Run fn(0) .. fn(count - 1) on the calling thread and any workers
+    /// free to help; returns once all have run. Thread-safe.
+    void for_each(std::size_t count, const std::function<void(std::size_t)>& fn);
+
+private:
+    struct Worker;
+    struct Batch;
+    struct Job;
+
+    void loop(Worker& worker);
+    /// Steal chunks from open batches until none are left.
+    void help(Worker& worker);
+    /// Run the job's work and post its continuation.
+    void finish(Worker& worker, Job job);
+
+    asio::any_io_executor io_;
+    Options options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::jthread> threads_;
+
+    std::mutex batches_mutex_;
+    std::condition_variable batch_left_;        // a helper left a batch
+    std::vector<Batch*> batches_;               // open for helpers
+};
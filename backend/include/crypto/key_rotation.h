@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class CryptoManager;
+
+/**
+ * The `key_update` body (protocol/message_format.md §9) that announces a
+ * node's new key pairs to its friends after a rotation.
+ *
+ * Friends pin each other's keys when they become friends, and would
+ * otherwise only learn of new ones by being told to re-add. An update
+ * carries both new public keys and is signed twice: by the new Ed25519 key
+ * inside the body, so nobody can announce keys they don't hold, and by the
+ * retiring one over the whole body in the envelope, so only the holder of
+ * the pinned key can replace it. A friend who takes it swaps the keys it
+ * pins in place and keeps the old ones until `until`, for messages sent
+ * before the rotation that are still in flight or in the offline queue.
+ *
+ * The update isn't addressed to anyone: the same signed bytes go to every
+ * friend. Replaying it does nothing once the new keys are pinned, and an
+ * older update no longer verifies against them.
+ */
+namespace key_rotation {
+
+/// 0x01, new X25519 key, new Ed25519 key, until, the new key's signature.
+inline constexpr std::size_t kBodySize = 1 + 32 + 32 + 8 + 64;
+
+struct Update {
+    std::array<uint8_t, 32> public_key;     // X25519
+    std::array<uint8_t, 32> signing_key;    // Ed25519
+    int64_t until = 0;                      // unix seconds the old keys stay valid to
+};
+
+/// What the envelope signature (the retiring signing key's) covers.
+std::string signed_bytes(std::string_view from, std::span<const uint8_t> body);
+
+/// The body announcing `next`'s keys as `from`'s new ones, with the old
+/// keys valid until `until`.
+std::vector<uint8_t> make_body(const CryptoManager& next, std::string_view from, int64_t until);
+
+/// The update in `body`, if it is one and is signed by the key it
+/// announces. Checking the envelope signature is up to the caller.
+std::optional<Update> parse(std::string_view from, std::span<const uint8_t> body);
+
+} // namespace key_rotation
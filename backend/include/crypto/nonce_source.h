@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * Random nonces without a trip to the OS per message.
+ *
+ * randombytes_buf() may be a getrandom() syscall per call, which the small
+ * messages that CryptoManager::encrypt, GroupChat::seal and EncryptedVfs
+ * seal would each pay. Instead, each thread keys a ChaCha20 stream once
+ * from randombytes_buf() and cuts nonces from its output, a block of
+ * keystream at a time. The first 32 bytes of every block become the next
+ * key and are wiped (fast key erasure, as arc4random does), so a thread's
+ * state never reveals nonces it has already handed out.
+ *
+ * Output is a CSPRNG's, so a random 24-byte nonce keeps the same collision
+ * bound as one from randombytes_buf(). Threads have independent keys. A
+ * forked child rekeys before its first nonce, so parent and child never
+ * share a stream.
+ *
+ * For nonces and other values that are public but must not repeat, such
+ * as message ids. Keys and anything else that must stay secret still come
+ * from randombytes_buf().
+ */
+namespace nonce_source {
+
+/// Fill `out` with fresh random bytes.
+void fill(std::span<uint8_t> out);
+
+inline void fill(uint8_t* out, std::size_t n) { fill(std::span<uint8_t>(out, n)); }
+
+} // namespace nonce_source
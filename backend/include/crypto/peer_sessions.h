@@ -0,0 +1,252 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "crypto/secure_arena.h"
+
+/**
+ * Session keys for direct peer traffic (protocol/message_format.md §9,
+ * "key_exchange" and "session").
+ *
+ * A signed `message` costs an Ed25519 signature to send and a verification
+ * to receive, on top of the crypto_box. Between two online peers that is
+ * redundant: one signed handshake can prove who holds a pair of ephemeral
+ * X25519 keys, and everything after it can be sealed with keys derived
+ * from them.
+ *
+ *   initiator                               responder
+ *     init:   id, ephemeral key, time  ──►
+ *                                      ◄──  accept: id, its ephemeral key,
+ *                                                   the initiator's, time
+ *
+ * Both bodies are signed with the sender's Ed25519 key (the caller signs
+ * and verifies; see signed_bytes()). The two ephemeral keys give each side
+ * a receive and a transmit key (crypto_kx). Frames are then sealed under a
+ * 24-byte nonce of the session id and a 64-bit frame counter, so the
+ * receiver finds the session from the nonce alone.
+ *
+ * The AEAD is XChaCha20-Poly1305 unless the handshake picks AES-256-GCM.
+ * An initiator talking to a peer that advertised aead_v1 appends the AEADs
+ * it offers to its init. AES-256-GCM is offered when libsodium finds
+ * AES-NI and CLMUL on this CPU. The responder picks AES-256-GCM if both
+ * sides have it, and names its choice at the end of the accept. Both
+ * bodies are signed, so the choice can't be downgraded in transit. GCM
+ * takes a 12-byte nonce: the last 12 bytes of the frame nonce, which hold
+ * the counter and so never repeat under one key.
+ *
+ * An init that offers AEADs may also ask for a resumption ticket. The
+ * responder then appends one to its accept: the session's resumption
+ * secret, derived from its keys, and the time of the signed handshake,
+ * sealed under a key only the responder holds. The initiator derives the
+ * same secret. Its next handshake with that peer (a renewal, or after the
+ * session was dropped) is then a resume instead:
+ *
+ *   initiator                               responder
+ *     resume:  id, ephemeral key, time,  ──►
+ *              ticket, MAC
+ *                                      ◄──  resumed: id, both ephemeral
+ *                                                    keys, time, a new
+ *                                                    ticket, MAC
+ *
+ * Neither is signed: both are MACed with the resumption secret, which only
+ * the two peers have, and the new keys mix it into the ephemeral exchange,
+ * so they stay forward secret. A resumed session carries a fresh ticket
+ * with the time of the signed handshake it descends from: after
+ * `resume_window` the next handshake is a signed one again. A responder
+ * that can't open the ticket (it restarted, or the window passed) sends a
+ * reject, and the initiator falls back to a signed init at once.
+ *
+ * The responder sends under a new session only once a frame has arrived on
+ * it, which proves the initiator got the accept. A new init from a peer
+ * means they lost their sessions (a restart), so their older ones stop
+ * being used to send, though frames in flight on them still open. Sessions
+ * are renewed after `lifetime` and dropped a while after that.
+ *
+ * Nothing here is persisted. Keys, resumption secrets, the ticket key and
+ * pending ephemeral secrets live in a SecureArena, in a fixed number of
+ * slots; when they run out the oldest session goes. A ticket is kept with
+ * the session it came with, so it lasts as long as that session is kept.
+ * Thread-safe.
+ */
+class PeerSessions {
+public:
+    static constexpr std::size_t kIdSize = 16;
+    static constexpr std::size_t kNonceSize = 24;           // id || counter
+    static constexpr std::size_t kTicketSize = 80;          // nonce, sealed secret and time
+
+    struct Options {
+        std::chrono::seconds lifetime{3600};                // then a new handshake
+        std::chrono::seconds handshake_timeout{10};         // for an accept
+        std::chrono::seconds retry_after{600};              // after no accept came
+        std::chrono::seconds max_clock_skew{300};           // on handshake times
+        std::size_t max_sessions = 1024;                    // key slots, pending included
+        bool aes_gcm = true;                                // where the CPU has AES-NI
+        /// Resume without signatures until this long after the last signed
+        /// handshake; 0 = no tickets.
+        std::chrono::seconds resume_window{86400};
+    };
+
+    enum class Phase : uint8_t { Init = 1, Accept = 2, Resume = 3, Resumed = 4, Reject = 5 };
+
+    /// Session AEADs; an init offers a mask of 1 << value.
+    enum class Aead : uint8_t { XChaCha20Poly1305 = 0, Aes256Gcm = 1 };
+
+    explicit PeerSessions(Options options);
+    ~PeerSessions();
+
+    PeerSessions(const PeerSessions&) = delete;
+    PeerSessions& operator=(const PeerSessions&) = delete;
+
+    /// What the signature of a key_exchange body covers.
+    static std::string signed_bytes(std::string_view from, std::string_view to,
+                                    std::span<const uint8_t> body);
+
+    /// The phase of a key_exchange body, or nullopt if it isn't one.
+    static std::optional<Phase> phase(std::span<const uint8_t> body);
+
+    /// Whether a body of this phase is sent signed (init and accept).
+    static bool is_signed(Phase phase) { return phase == Phase::Init || phase == Phase::Accept; }
+
+    /// The init body for a handshake with `peer`, or a resume body if we
+    /// hold a ticket from them still in its window; nullopt if a handshake
+    /// is pending, went unanswered recently, or a session to send on is
+    /// already up. `negotiate_aead` (the peer advertised aead_v1) appends
+    /// our AEAD offer and asks for a ticket.
+    std::optional<std::string> initiate(const std::string& peer, bool negotiate_aead = false);
+
+    /// A verified init from `peer`: the accept body to send back, or
+    /// nullopt if it is malformed, stale or a replay.
+    std::optional<std::string> accept(const std::string& peer, std::span<const uint8_t> body);
+
+    /// A verified accept from `peer`; true if it completed our handshake.
+    bool complete(const std::string& peer, std::span<const uint8_t> body);
+
+    /// A resume from `peer` (unsigned; its MAC is checked here): the
+    /// resumed body to send back, a reject if the ticket is no good, or
+    /// nullopt to ignore it.
+    std::optional<std::string> resume(const std::string& peer, std::span<const uint8_t> body);
+
+    /// A resumed body from `peer`; true if it completed our resume.
+    bool resumed(const std::string& peer, std::span<const uint8_t> body);
+
+    /// A reject from `peer`; true if it cancelled our resume, whose ticket
+    /// is then dropped: initiate() gives a signed init next.
+    bool rejected(const std::string& peer, std::span<const uint8_t> body);
+
+    struct Sealed {
+        std::vector<uint8_t> nonce;                         // kNonceSize
+        std::vector<uint8_t> ciphertext;
+    };
+
+    /// Seal `plaintext` for `peer`, binding `aad`; nullopt without a
+    /// session to send on.
+    std::optional<Sealed> seal(const std::string& peer, std::string_view plaintext,
+                               std::string_view aad);
+
+    /// Open a frame from `peer`; nullopt if its session is unknown (or not
+    /// theirs) or it fails authentication.
+    std::optional<std::string> open(const std::string& peer, std::span<const uint8_t> nonce,
+                                    std::span<const uint8_t> ciphertext, std::string_view aad);
+
+    /// Whether a frame sealed under `nonce` went out on the session we
+    /// would still send to `peer` on.
+    [[nodiscard]] bool current(const std::string& peer, std::span<const uint8_t> nonce) const;
+
+    /// The AEAD of the session we would send to `peer` on, if any.
+    [[nodiscard]] std::optional<Aead> aead(const std::string& peer) const;
+
+    /// Whether this process can use AES-256-GCM (CPU support, and allowed).
+    [[nodiscard]] bool aes_gcm() const { return aes_gcm_; }
+
+    /// Drop every session and handshake with `peer`.
+    void forget(const std::string& peer);
+
+    /// Established sessions, all peers.
+    [[nodiscard]] std::size_t size() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    using Id = std::array<uint8_t, kIdSize>;
+    using PublicKey = std::array<uint8_t, 32>;
+    using Ticket = std::array<uint8_t, kTicketSize>;
+
+    struct Session {
+        std::string peer;
+        std::size_t slot = 0;                   // rx key, tx key, resumption secret
+        Clock::time_point created;
+        uint64_t next_counter = 0;
+        bool confirmed = false;                 // the peer has sent on it
+        bool retired = false;                   // superseded: receive only
+        Aead aead = Aead::XChaCha20Poly1305;
+        std::optional<Ticket> ticket;           // theirs for us to resume with
+        int64_t authenticated = 0;              // unix time of the signed handshake behind it
+    };
+
+    struct Pending {
+        Id id{};
+        PublicKey ephemeral{};                  // secret in `slot`
+        std::size_t slot = 0;
+        Clock::time_point started;
+        uint8_t offer = 0;                      // AEAD mask sent, 0 for a plain init
+        bool resume = false;                    // the ticket's secret is in `slot` too
+        int64_t authenticated = 0;              // a resume's, from its ticket
+    };
+
+    struct PeerState {
+        std::optional<Pending> pending;
+        Clock::time_point quiet_until{};        // no new init before this
+        std::vector<Id> sessions;               // oldest first
+    };
+
+    /// The session to send to `peer` on, or null. Requires mutex_.
+    const Id* tx_locked(const PeerState& state, Clock::time_point now) const;
+
+    /// The newest of `peer`'s sessions holding a ticket still in its
+    /// window, or null. Requires mutex_.
+    Session* ticket_locked(PeerState& state);
+    /// Forget every ticket from `peer`. Requires mutex_.
+    void drop_tickets_locked(PeerState& state);
+
+    /// A ticket for `peer` holding `secret`, from a signed handshake at
+    /// `authenticated`.
+    Ticket issue_ticket(const std::string& peer, std::span<const uint8_t> secret,
+                        int64_t authenticated) const;
+    /// The secret and handshake time sealed in a ticket we issued to `peer`.
+    bool open_ticket(const std::string& peer, std::span<const uint8_t> ticket,
+                     std::span<uint8_t> secret, int64_t& authenticated) const;
+
+    /// Drop `peer`'s expired sessions and timed-out handshake. Requires mutex_.
+    void prune_locked(PeerState& state, Clock::time_point now);
+
+    /// Keep a new session for `peer`, evicting to make room. Requires mutex_.
+    void add_locked(const std::string& peer, const Id& id, Session session);
+    void drop_locked(const Id& id);
+
+    /// A free key slot, evicting the oldest session if none is left.
+    /// Requires mutex_.
+    std::size_t take_slot_locked();
+    void free_slot_locked(std::size_t slot);
+    std::span<uint8_t> slot_bytes(std::size_t slot) const;
+
+    Options options_;
+    bool aes_gcm_ = false;
+    SecureArena arena_;
+    std::span<uint8_t> keys_;                   // max_sessions slots of 96 bytes
+    std::span<uint8_t> ticket_key_;             // random, this process only
+
+    mutable std::mutex mutex_;
+    std::map<Id, Session> sessions_;
+    std::unordered_map<std::string, PeerState> peers_;
+    std::vector<std::size_t> free_slots_;
+};
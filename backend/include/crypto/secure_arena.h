@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/**
+ * One contiguous sodium_malloc'd region for long-lived secrets.
+ *
+ * libsodium places the region between guard pages, behind a canary, and
+ * mlocks it so it is never swapped out or included in core dumps. Secrets
+ * carved from it never move, so unlike a std::vector they leave no stale
+ * copies behind on reallocation. sodium_free wipes the whole region.
+ *
+ * The owner carves the region into its fixed parts with take() right
+ * after construction; there is no per-part free.
+ */
+class SecureArena {
+public:
+    /// Allocate `size` zeroed bytes. Initialises libsodium if needed and
+    /// throws std::bad_alloc if the region can't be allocated.
+    explicit SecureArena(std::size_t size);
+    ~SecureArena();
+
+    SecureArena(const SecureArena&) = delete;
+    SecureArena& operator=(const SecureArena&) = delete;
+
+    /// The next `n` bytes, starting on a 16-byte boundary. Throws
+    /// std::bad_alloc past the end of the region.
+    std::span<uint8_t> take(std::size_t n);
+
+    /// Bytes needed for parts of the given sizes, padding included.
+    static constexpr std::size_t size_for(std::span<const std::size_t> parts) {
+        std::size_t total = 0;
+        for (std::size_t n : parts) {
+            total += align(n);
+        }
+        return total;
+    }
+
+private:
+    static constexpr std::size_t kAlign = 16;
+    static constexpr std::size_t align(std::size_t n) { return (n + kAlign - 1) / kAlign * kAlign; }
+
+    uint8_t* base_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t used_ = 0;
+};
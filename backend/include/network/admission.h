@@ -0,0 +1,79 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "network/token_bucket.h"
+#include "network/user_id.h"
+
+/**
+ * Admission control for inbound peer traffic: cheap checks that run before
+ * any frame costs a signature verification.
+ *
+ *  - Connections: a cap on inbound sessions in total and per IP, checked
+ *    by PeerServer as it accepts, and none at all while the PeerSessions
+ *    memory budget is spent (telemetry/memory.h).
+ *  - Frames per IP: a token bucket per remote address, charged by
+ *    PeerSession for every frame before it is decoded.
+ *  - Frames per sender: a token bucket per sender's UserId, charged by Node
+ *    after decoding, and only once the sender is known to be a friend or
+ *    cached user, so spoofed names can't grow the table.
+ *
+ * Whatever fails a check is dropped (a connection is closed at once) and
+ * counted in metrics, so one peer spamming garbage costs the others little
+ * more than the read. Limits are in frames a second; 0 turns one off.
+ *
+ * Shared by PeerServer, its sessions and Node, from any thread.
+ */
+class AdmissionControl {
+public:
+    struct Options {
+        std::size_t max_connections = 512;
+        std::size_t max_connections_per_ip = 16;
+        double ip_frames_per_sec = 1000;
+        double ip_frame_burst = 2000;
+        double sender_frames_per_sec = 500;
+        double sender_frame_burst = 1000;
+    };
+
+    explicit AdmissionControl(Options options);
+
+    /// New limits (config reload); open connections stay open.
+    void set_options(Options options);
+
+    /// A session from `address` is opening; false if that would pass a
+    /// cap. Every true must be matched by one close_connection().
+    bool open_connection(const asio::ip::address& address);
+    void close_connection(const asio::ip::address& address);
+
+    /// Charge one frame read from `address`.
+    bool admit_frame(const asio::ip::address& address);
+
+    /// Charge one decoded frame from `sender` (Envelope::sender). Senders
+    /// without an id (the UserId table is full) share one bucket.
+    bool admit_sender(UserId sender);
+
+    [[nodiscard]] std::size_t connections() const;
+
+private:
+    struct Remote {
+        std::size_t connections = 0;
+        TokenBucket frames;
+    };
+
+    static constexpr std::size_t kMinPruneAt = 4096;
+
+    /// Drop sender buckets that have refilled, once the table gets big.
+    void prune_senders_locked(TokenBucket::Clock::time_point now);
+
+    mutable std::mutex mutex_;                  // guards everything below
+    Options options_;
+    std::size_t connections_ = 0;
+    std::map<asio::ip::address, Remote> remotes_;   // IPs with open sessions
+    std::unordered_map<UserId, TokenBucket> senders_;
+    std::size_t prune_at_ = kMinPruneAt;
+};
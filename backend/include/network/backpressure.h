@@ -0,0 +1,85 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Backpressure from the queues that peer frames fill into the sessions
+ * that read them.
+ *
+ * Each such queue (the DB writer's backlog, each UI event stage, the
+ * WebSocket clients' send queues) reports its depth through a Level with
+ * a high and a low water mark. Once any Level reaches its high mark, every
+ * PeerSession waits before its next read until all of them are back at or
+ * below their low marks. Unread bytes then stay in the kernel, whose
+ * receive window throttles the sending peers, instead of in our queues.
+ *
+ * A wait never outlasts `max_pause`; the session reads once more and then
+ * waits again if it must. A consumer that stopped for good thus slows the
+ * network without stalling it. It eventually passes its own limit, and is
+ * dropped as it would have been anyway.
+ *
+ * Thread-safe: Levels are updated from any thread, and paused() is one
+ * atomic load.
+ */
+class Backpressure {
+public:
+    struct Options {
+        std::chrono::milliseconds max_pause{2000};
+    };
+
+    /// One queue's depth.
+    class Level {
+    public:
+        /// The depth grew (`n` > 0) or shrank by `n`.
+        void add(std::ptrdiff_t n);
+
+        [[nodiscard]] std::size_t depth() const { return depth_.load(std::memory_order_relaxed); }
+
+    private:
+        friend class Backpressure;
+
+        Level(Backpressure& owner, std::string name, std::size_t high, std::size_t low)
+            : owner_(owner), name_(std::move(name)), high_(high), low_(low) {}
+
+        Backpressure& owner_;
+        std::string name_;
+        std::size_t high_;
+        std::size_t low_;
+        std::atomic<std::size_t> depth_{0};
+        std::atomic<bool> over_{false};         // reached high_, not yet back to low_
+    };
+
+    explicit Backpressure(Options options);
+
+    Backpressure(const Backpressure&) = delete;
+    Backpressure& operator=(const Backpressure&) = delete;
+
+    /// A queue named `name` (for logs) that pauses reads at `high` and
+    /// lets them go on at `low`. Valid as long as this object.
+    Level& level(std::string name, std::size_t high, std::size_t low);
+
+    /// Whether reads should wait.
+    [[nodiscard]] bool paused() const { return over_.load(std::memory_order_acquire) > 0; }
+
+    /// Return once reads may go on, or after `max_pause`. At once if not
+    /// paused. Runs on the caller's executor.
+    asio::awaitable<void> wait();
+
+private:
+    void on_over(const Level& level);
+    void on_under();
+
+    Options options_;
+    std::atomic<int> over_{0};                  // Levels past their high mark
+
+    std::mutex mutex_;                          // guards levels_, waiters_
+    std::vector<std::unique_ptr<Level>> levels_;
+    std::vector<std::shared_ptr<asio::steady_timer>> waiters_;
+};
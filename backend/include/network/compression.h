@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * zstd compression of `message` plaintexts before encryption
+ * (protocol/message_format.md §4.3), and of large REST responses for
+ * clients that accept it.
+ *
+ * Both directions share a built-in raw-content dictionary: the payload's
+ * JSON skeleton plus common chat words. With it even a one-line message
+ * has something to match against, which plain zstd doesn't at that size.
+ * Changing the dictionary changes the format, so it would need a new
+ * capability bit (envelope::kCapZstdV1 names this one).
+ *
+ * Compiled in only when the build found libzstd (P2P_HAVE_ZSTD); without
+ * it available() is false and every plaintext goes out as-is.
+ */
+namespace compression {
+
+/// Plaintexts shorter than this are not worth a compression attempt
+/// (node.compress_min_bytes).
+inline constexpr std::size_t kDefaultMinSize = 128;
+
+/// Cap on a decompressed plaintext, so a small frame can't expand into an
+/// arbitrarily large allocation.
+inline constexpr std::size_t kMaxDecompressedSize = 4 * 1024 * 1024;
+
+/// Whether this build can compress and decompress.
+bool available();
+
+/// Compress `plaintext` if it is at least `min_size` bytes. Returns nullopt
+/// when compression is unavailable, skipped, or wouldn't save anything.
+std::optional<std::string> compress(std::string_view plaintext,
+                                    std::size_t min_size = kDefaultMinSize);
+
+/// Undo compress(). Returns nullopt for malformed input or a result over
+/// kMaxDecompressedSize.
+std::optional<std::string> decompress(std::string_view data);
+
+/// A plain zstd frame of `data`, without the dictionary, that any zstd
+/// decoder reads: for an HTTP body sent with `Content-Encoding: zstd`.
+/// Nullopt when compression is unavailable or wouldn't save anything.
+std::optional<std::string> compress_standalone(std::string_view data);
+
+} // namespace compression
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <utility>
+
+/**
+ * Glue between the callback-style async APIs and C++20 coroutines.
+ *
+ * Several components complete on a thread of their own choosing (the peer
+ * pool's I/O thread, the CurlMulti strand). from_callback() turns such an
+ * API into something a coroutine can `co_await`, and always resumes the
+ * coroutine on its own executor rather than on the completing thread.
+ */
+namespace coro {
+
+/// Await a single callback delivering a `T`.
+///
+/// `start` receives a `std::function<void(T)>` and must arrange for it to
+/// be called exactly once (it may call it inline). It runs when the result
+/// is awaited, so it may capture the awaiting coroutine's locals by
+/// reference.
+///
+///     bool ok = co_await coro::from_callback<bool>([&](auto done) {
+///         supabase.async_heartbeat(user, ip, std::move(done));
+///     });
+template <typename T, typename Start>
+asio::awaitable<T> from_callback(Start start) {
+    // The value travels boxed in a tuple so that an error_code result is
+    // returned to the caller instead of being thrown by use_awaitable.
+    using Boxed = std::tuple<T>;
+    Boxed result = co_await asio::async_initiate<const asio::use_awaitable_t<>&, void(Boxed)>(
+        [&start](auto handler) {
+            using Handler = decltype(handler);
+            auto shared = std::make_shared<Handler>(std::move(handler));
+            start(std::function<void(T)>([shared](T value) {
+                auto ex = asio::get_associated_executor(*shared);
+                asio::post(ex, [shared, boxed = Boxed(std::move(value))]() mutable {
+                    (*shared)(std::move(boxed));
+                });
+            }));
+        },
+        asio::use_awaitable);
+    co_return std::get<0>(std::move(result));
+}
+
+/// A callback-style operation started now and collected later, so that a
+/// coroutine can have several in flight at once:
+///
+///     auto connected = coro::Deferred<bool>::start([&](auto done) {
+///         pool.connect_async(user, ip, port, std::move(done));
+///     });
+///     auto sealed = co_await seal();          // the connect runs meanwhile
+///     bool ok = co_await connected->get();
+///
+/// The value goes to exactly one consumer: get(), a get_for() that did not
+/// time out, or on_ready(). Thread-safe.
+template <typename T>
+class Deferred : public std::enable_shared_from_this<Deferred<T>> {
+public:
+    /// `start` is called at once, like from_callback's.
+    template <typename Start>
+    static std::shared_ptr<Deferred> start(Start start) {
+        auto self = std::make_shared<Deferred>();
+        start(std::function<void(T)>([self](T value) { self->set(std::move(value)); }));
+        return self;
+    }
+
+    /// Hand the value to `consumer`: now, on this thread, if it is already
+    /// in, otherwise on the completing thread.
+    void on_ready(std::function<void(T)> consumer) {
+        std::unique_lock lock(mutex_);
+        if (!value_) {
+            consumer_ = std::move(consumer);
+            return;
+        }
+        T value = std::move(*value_);
+        value_.reset();
+        lock.unlock();
+        consumer(std::move(value));
+    }
+
+    asio::awaitable<T> get() {
+        co_return co_await from_callback<T>([this](auto done) { on_ready(std::move(done)); });
+    }
+
+    /// get(), giving up after `timeout`. The value then stays for a later
+    /// consumer.
+    asio::awaitable<std::optional<T>> get_for(std::chrono::steady_clock::duration timeout) {
+        auto timer = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor, timeout);
+        co_return co_await from_callback<std::optional<T>>([&](auto done) {
+            on_ready([timer, done](T value) {
+                timer->cancel();
+                done(std::move(value));
+            });
+            timer->async_wait([self = this->shared_from_this(), done](const asio::error_code& ec) {
+                if (!ec && self->withdraw()) {
+                    done(std::nullopt);
+                }
+            });
+        });
+    }
+
+private:
+    void set(T value) {
+        std::unique_lock lock(mutex_);
+        if (!consumer_) {
+            value_ = std::move(value);
+            return;
+        }
+        auto consumer = std::move(consumer_);
+        consumer_ = nullptr;
+        lock.unlock();
+        consumer(std::move(value));
+    }
+
+    /// Drop the waiting consumer; false if the value already went to it.
+    bool withdraw() {
+        std::lock_guard lock(mutex_);
+        const bool waiting = static_cast<bool>(consumer_);
+        consumer_ = nullptr;
+        return waiting;
+    }
+
+    std::mutex mutex_;
+    std::optional<T> value_;
+    std::function<void(T)> consumer_;
+};
+
+} // namespace coro
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+/**
+ * Pins threads to CPUs: the I/O threads (`node.io_cpus`), the crypto
+ * workers (`node.crypto_cpus`) and the DB thread (`database.cpus`).
+ *
+ * A CPU list is written as Linux writes them, "0-3,8,10-11", and may name
+ * whole NUMA nodes as "node:1". Left empty, threads float as before.
+ *
+ * Pinned threads pin themselves before they allocate what they work on.
+ * Linux places a page on the NUMA node of the thread that first touches
+ * it, so a pinned crypto worker's queues and the DB thread's page cache
+ * end up on their own socket without libnuma.
+ *
+ * Linux only: elsewhere parse() still works and pin_current() returns
+ * false.
+ */
+namespace cpu_affinity {
+
+/// The CPUs in `spec`, ascending, keeping only those in allowed(). An
+/// empty spec gives an empty list; nullopt if it doesn't parse or names a
+/// NUMA node that doesn't exist.
+std::optional<std::vector<unsigned>> parse(std::string_view spec);
+
+/// The CPUs this process may run on, as they were on the first call
+/// (which pin_current() makes before it changes anything).
+const std::vector<unsigned>& allowed();
+
+/// `cpus` with one hyperthread of each physical core: the lowest of its
+/// siblings that is in `cpus`. Unchanged where the topology can't be read.
+std::vector<unsigned> one_per_core(const std::vector<unsigned>& cpus);
+
+/// Pin the calling thread to `cpus`. False (logged) if the OS refuses;
+/// false if `cpus` is empty.
+bool pin_current(std::span<const unsigned> cpus);
+
+/// Let the calling thread run anywhere in allowed() again, e.g. a helper
+/// thread started from a pinned one.
+void unpin_current();
+
+/// parse() for config key `key`: logs and returns an empty list (no
+/// pinning) if `spec` is malformed or leaves no CPU.
+std::vector<unsigned> from_config(std::string_view key, std::string_view spec);
+
+} // namespace cpu_affinity
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Host name → addresses, resolved off the caller's thread and cached, for
+ * the names PeerClient dials (a peer that publishes "host:port") and the
+ * Supabase host (SupabaseClient hands curl the addresses with
+ * CURLOPT_RESOLVE).
+ *
+ * getaddrinfo() reports no TTL, so an answer is kept for `ttl`. A name
+ * looked up within the last fifth of that is resolved again in the
+ * background, so one in steady use never expires. After `ttl` its old
+ * addresses are still served, for up to another `ttl`, while the refresh
+ * runs; a refresh that fails keeps them for that long too. A name that
+ * doesn't resolve is remembered as such for `negative_ttl`.
+ *
+ * Resolution runs on a thread of the cache's own (asio's resolver, one
+ * name at a time). lookup() never blocks: a miss starts the resolution
+ * and returns nothing, and only a caller with no other address to try
+ * waits, with resolve(). Thread-safe.
+ */
+class DnsCache {
+public:
+    struct Options {
+        std::chrono::seconds ttl{300};
+        std::chrono::seconds negative_ttl{30};
+        std::size_t max_hosts = 1024;           // least recently used go first
+    };
+
+    using Addresses = std::vector<asio::ip::address>;
+    using Callback = std::function<void(const Addresses&)>;
+
+    /// The cache PeerClient and SupabaseClient share.
+    static DnsCache& shared();
+
+    explicit DnsCache(Options options);
+    ~DnsCache();
+
+    DnsCache(const DnsCache&) = delete;
+    DnsCache& operator=(const DnsCache&) = delete;
+
+    void set_options(const Options& options);
+
+    /// Whether `host` is a DNS name rather than an address or garbage.
+    static bool is_hostname(std::string_view host);
+
+    /// `host`'s addresses if known, empty if known not to resolve; nullopt
+    /// on a miss, which starts resolving it. Never blocks. An IP literal
+    /// is its own answer.
+    std::optional<Addresses> lookup(const std::string& host);
+
+    /// `done` with `host`'s addresses (empty if it doesn't resolve): at
+    /// once on this thread if known, else on the resolver thread.
+    void resolve(const std::string& host, Callback done);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Addresses addresses;
+        Clock::time_point expires;              // served as fresh until then
+        Clock::time_point refresh_at;           // resolved again once used after this
+        Clock::time_point used;
+        bool resolving = false;
+        std::vector<Callback> waiters;
+    };
+
+    /// The addresses to serve from `entry` now, or nullopt if there are
+    /// none; starts a refresh when due. Requires mutex_.
+    std::optional<Addresses> serve_locked(const std::string& host, Entry& entry,
+                                          Clock::time_point now);
+    void start_locked(const std::string& host, Entry& entry);
+    void finished(const std::string& host, const asio::error_code& ec,
+                  const asio::ip::tcp::resolver::results_type& results);
+    /// Drop least recently used idle entries over max_hosts. Requires mutex_.
+    void trim_locked();
+
+    asio::io_context io_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    asio::ip::tcp::resolver resolver_;
+
+    std::mutex mutex_;
+    Options options_;
+    std::unordered_map<std::string, Entry> entries_;
+
+    std::jthread thread_;                       // last: joined before the rest goes
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "network/user_id.h"
+
+/**
+ * The outer wrapper of every peer frame (protocol/message_format.md §3).
+ *
+ * Binary fields hold raw bytes; base64 only exists in the JSON encoding.
+ */
+enum class EnvelopeType : uint8_t {
+    Message     = 0,
+    Ack         = 1,
+    Ping        = 2,
+    KeyExchange = 3,
+    Hello       = 4,
+    FileOffer   = 5,
+    FileChunk   = 6,
+    FileAck     = 7,
+    FileCancel  = 8,
+    GroupKey    = 9,
+    GroupMessage = 10,
+    Session     = 11,
+    Sync        = 12,
+    Signal      = 13,       // inside `session` frames only
+    KeyUpdate   = 14,
+    Unknown     = 0xFF
+};
+
+/// How a `message` plaintext was compressed before encryption.
+enum class PayloadCompression : uint8_t {
+    None = 0,
+    Zstd = 1,                           // zstd with the built-in dictionary (network/compression.h)
+};
+
+struct Envelope {
+    EnvelopeType type = EnvelopeType::Unknown;
+    std::string from;
+    std::string to;
+    std::string timestamp;              // ISO 8601 UTC, e.g. "2026-02-11T16:00:00Z"
+    UserId sender = UserId::None;       // `from` interned, set by decode() for known users
+
+    std::vector<uint8_t> nonce;         // 24 bytes for `message`, `file_offer`, group and session frames
+    std::vector<uint8_t> ciphertext;
+    std::vector<uint8_t> signature;     // 64 bytes
+
+    std::string ack_msg_id;             // `ack` only
+    uint32_t capabilities = 0;          // `hello` only, see envelope::kCap*
+    PayloadCompression compression = PayloadCompression::None;   // `message` only
+};
+
+/// How a frame is laid out on the wire.
+enum class WireFormat { Json, Binary };
+
+namespace envelope {
+
+/// First byte of a binary frame. JSON frames always start with '{'.
+inline constexpr uint8_t kBinaryVersion = 0x01;
+
+/// Capability bits advertised in `hello`.
+inline constexpr uint32_t kCapBinaryV1 = 1u << 0;
+/// Decodes PayloadCompression::Zstd. Advertised only by builds with zstd.
+inline constexpr uint32_t kCapZstdV1 = 1u << 1;
+/// Opens `signal` session frames (typing, read receipts). Advertised by
+/// every build that has it, whatever its envelope format.
+inline constexpr uint32_t kCapSignalV1 = 1u << 2;
+/// Takes an AEAD offer in a session init and answers with its choice
+/// (crypto/peer_sessions.h). Advertised by every build that has it.
+inline constexpr uint32_t kCapAeadV1 = 1u << 3;
+/// Reads offline rows that pack several envelopes (node/mailbox_pack.h).
+/// Advertised by every build that has it.
+inline constexpr uint32_t kCapMailboxPackV1 = 1u << 4;
+/// Takes channels of several identities on one connection (network/mux.h).
+/// Advertised by every build that has it.
+inline constexpr uint32_t kCapMuxV1 = 1u << 5;
+/// Opens chunks of a file's shared stream (node/attachment_store.h).
+/// Advertised by every build that has it.
+inline constexpr uint32_t kCapFileShareV1 = 1u << 6;
+/// Reads session acks that carry the receiver's hold time
+/// (node/latency_slo.h). Advertised while latency tracking is on.
+inline constexpr uint32_t kCapTimingV1 = 1u << 7;
+
+/// Everything this build's envelope codec understands; kCapZstdV1 is added
+/// at runtime when compression::available().
+inline constexpr uint32_t kLocalCapabilities = kCapBinaryV1;
+
+/// Set in the binary type byte when the payload is compressed.
+inline constexpr uint8_t kBinaryCompressedFlag = 0x80;
+
+/**
+ * Binary v1 layout (all integers big-endian):
+ *
+ *   off  size  field
+ *     0     1  version (0x01)
+ *     1     1  type (EnvelopeType); bit 7 = compressed payload
+ *     2     1  from length  (F)
+ *     3     1  to length    (T)
+ *     4     8  timestamp, seconds since Unix epoch (signed)
+ *    12    24  nonce (zero-filled when absent)
+ *    36    64  signature (zero-filled when absent)
+ *   100     4  body length (B): ciphertext, or ack_msg_id for `ack`
+ *   104     F  from
+ *         T  to
+ *         B  body
+ *
+ * Fixed offsets let the receiver reach the signature and ciphertext with no
+ * parsing at all. `hello` is always sent as JSON so older peers can read it.
+ */
+inline constexpr std::size_t kBinaryHeaderSize = 104;
+
+const char* type_name(EnvelopeType type);
+EnvelopeType type_from_name(std::string_view name);
+
+/// Current time in the envelope timestamp format.
+std::string now_timestamp();
+
+/// Seconds since the Unix epoch in the envelope timestamp format.
+std::string format_timestamp(int64_t seconds);
+
+/// Seconds since the Unix epoch for an envelope timestamp, or nullopt if
+/// it isn't one.
+std::optional<int64_t> parse_timestamp(const std::string& ts);
+
+/// The `hello` frame announcing `capabilities` on a new connection.
+std::string make_hello(const std::string& from, uint32_t capabilities);
+
+/// Detect the encoding of a frame from its first byte.
+std::optional<WireFormat> detect(std::string_view frame);
+
+std::string encode(const Envelope& env, WireFormat format);
+std::string encode_json(const Envelope& env);
+std::string encode_binary(const Envelope& env);
+
+/// The `to` field alone, without decoding the rest: what a listener shared
+/// by several nodes routes on (main.cpp). Empty when the frame has none
+/// (`hello`); nullopt if it isn't a frame.
+std::optional<std::string> recipient(std::string_view frame);
+
+/// Decode either encoding, with `sender` looked up. Returns nullopt for
+/// malformed frames.
+std::optional<Envelope> decode(std::string_view frame);
+std::optional<Envelope> decode_json(std::string_view frame);
+std::optional<Envelope> decode_binary(std::string_view frame);
+
+} // namespace envelope
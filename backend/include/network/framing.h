@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "network/huge_pages.h"
+
+/**
+ * Length-prefixed framing helpers (protocol/message_format.md §2).
+ *
+ * Every frame on the wire is a 4-byte big-endian length followed by that
+ * many payload bytes.
+ */
+namespace framing {
+
+inline constexpr std::size_t kHeaderSize = 4;
+
+/// Upper bound on a single frame payload. Anything larger is treated as a
+/// protocol violation so a corrupt header can't force a huge allocation.
+inline constexpr std::size_t kDefaultMaxFrameSize = 1024 * 1024;
+
+/// A FrameReader's storage: in the huge page arena when there is one
+/// (network/huge_pages.h), on the heap otherwise.
+using Buffer = std::vector<char, huge_pages::Allocator<char>>;
+
+/// Encode a payload length as a 4-byte big-endian header.
+inline std::array<uint8_t, kHeaderSize> encode_header(uint32_t length) {
+    return {
+        static_cast<uint8_t>((length >> 24) & 0xFF),
+        static_cast<uint8_t>((length >> 16) & 0xFF),
+        static_cast<uint8_t>((length >> 8)  & 0xFF),
+        static_cast<uint8_t>((length)       & 0xFF)
+    };
+}
+
+/// Decode a 4-byte big-endian header.
+inline uint32_t decode_header(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) |
+           (uint32_t(p[1]) << 16) |
+           (uint32_t(p[2]) << 8)  |
+           (uint32_t(p[3]));
+}
+
+} // namespace framing
+
+/**
+ * Incremental frame decoder over a reusable per-session buffer.
+ *
+ * Usage from a read loop:
+ *
+ *     auto span = reader.prepare();
+ *     socket.async_read_some(asio::buffer(span.data(), span.size()), ...);
+ *     // on completion:
+ *     reader.commit(bytes_read);
+ *     std::string_view payload;
+ *     while (reader.next(payload) == FrameReader::Status::Frame) { ... }
+ *
+ * A single read may complete any number of frames; each is returned as a
+ * view into the internal buffer with no copy. Views stay valid until the
+ * next call to prepare().
+ *
+ * The buffer is linear (not wrap-around) so every frame is contiguous.
+ * Consumed bytes are reclaimed lazily by sliding the unread tail to the
+ * front in prepare(), which in steady state moves at most one partial frame.
+ */
+class FrameReader {
+public:
+    enum class Status {
+        Frame,      ///< `payload` holds a complete frame
+        NeedMore,   ///< buffer holds a partial frame; read more bytes
+        Oversized   ///< header announced a frame above the limit; drop the peer
+    };
+
+    explicit FrameReader(std::size_t max_frame_size = framing::kDefaultMaxFrameSize,
+                         std::size_t initial_capacity = 16 * 1024);
+
+    /// Read into `storage` (e.g. a buffer from SessionPool) instead of a
+    /// fresh one; its size is the initial capacity.
+    FrameReader(std::size_t max_frame_size, framing::Buffer storage);
+
+    /// Writable region for the next socket read. Never empty.
+    std::span<char> prepare();
+
+    /// Mark `n` bytes of the region returned by prepare() as filled.
+    void commit(std::size_t n);
+
+    /// Extract the next complete frame, if any.
+    Status next(std::string_view& payload);
+
+    /// Drop all buffered data (e.g. after a protocol error).
+    void reset();
+
+    /// Give up the buffer, e.g. to recycle it; the reader is empty after.
+    framing::Buffer release();
+
+    [[nodiscard]] std::size_t buffered() const { return write_pos_ - read_pos_; }
+    [[nodiscard]] std::size_t capacity() const { return buffer_.size(); }
+    [[nodiscard]] std::size_t max_frame_size() const { return max_frame_size_; }
+
+private:
+    framing::Buffer buffer_;
+    std::size_t read_pos_  = 0;
+    std::size_t write_pos_ = 0;
+    std::size_t max_frame_size_;
+    std::size_t initial_capacity_;
+    std::size_t pending_frame_ = 0;   // size of the frame being assembled, 0 if unknown
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Per-object memory for asio completion handlers.
+ *
+ * Every async_write or post with a plain lambda makes asio allocate the
+ * operation holding it. On a session writing a frame per message that is
+ * an allocation and a free per message. A HandlerMemory slot is a small
+ * buffer inside the object that owns the handler: the operation is built
+ * there instead, so the steady-state write path never reaches malloc.
+ *
+ * A slot holds one operation at a time — give each kind of outstanding
+ * operation (a write, a post) its own. Anything that doesn't fit, or that
+ * arrives while the slot is taken, goes to the heap as before; those are
+ * counted in p2p_handler_heap_allocations_total.
+ *
+ *     asio::async_write(socket_, buffers,
+ *         bind_handler_memory(write_memory_, [self](auto ec, auto) { ... }));
+ */
+class HandlerMemory {
+public:
+    HandlerMemory() = default;
+    HandlerMemory(const HandlerMemory&) = delete;
+    HandlerMemory& operator=(const HandlerMemory&) = delete;
+
+    void* allocate(std::size_t size) {
+        if (size <= sizeof(storage_) && !in_use_.exchange(true, std::memory_order_acquire)) {
+            return storage_;
+        }
+        count_heap_allocation();
+        return ::operator new(size);
+    }
+
+    void deallocate(void* p) {
+        if (p == storage_) {
+            in_use_.store(false, std::memory_order_release);
+        } else {
+            ::operator delete(p);
+        }
+    }
+
+private:
+    static void count_heap_allocation();
+
+    // asio's write_op around a gather list and a lambda holding a
+    // shared_ptr is about 500 bytes.
+    alignas(std::max_align_t) unsigned char storage_[1024];
+    std::atomic<bool> in_use_{false};
+};
+
+/// Allocator over a HandlerMemory slot, as asio's associated allocator.
+template <typename T>
+class HandlerAllocator {
+public:
+    using value_type = T;
+
+    explicit HandlerAllocator(HandlerMemory& memory) : memory_(&memory) {}
+    template <typename U>
+    HandlerAllocator(const HandlerAllocator<U>& other) noexcept : memory_(other.memory_) {}
+
+    T* allocate(std::size_t n) const { return static_cast<T*>(memory_->allocate(sizeof(T) * n)); }
+    void deallocate(T* p, std::size_t) const { memory_->deallocate(p); }
+
+    template <typename U>
+    bool operator==(const HandlerAllocator<U>& other) const noexcept {
+        return memory_ == other.memory_;
+    }
+    template <typename U>
+    bool operator!=(const HandlerAllocator<U>& other) const noexcept {
+        return memory_ != other.memory_;
+    }
+
+private:
+    template <typename> friend class HandlerAllocator;
+    HandlerMemory* memory_;
+};
+
+/// A completion handler that asks asio to allocate from `memory`.
+template <typename Handler>
+class MemoryBoundHandler {
+public:
+    using allocator_type = HandlerAllocator<Handler>;
+
+    MemoryBoundHandler(HandlerMemory& memory, Handler handler)
+        : memory_(memory), handler_(std::move(handler)) {}
+
+    allocator_type get_allocator() const noexcept { return allocator_type(memory_); }
+
+    template <typename... Args>
+    void operator()(Args&&... args) {
+        handler_(std::forward<Args>(args)...);
+    }
+
+private:
+    HandlerMemory& memory_;
+    Handler handler_;
+};
+
+/// `handler`, allocating its operation in `memory`. The slot must outlive
+/// the operation: keep it in the object the handler holds alive.
+template <typename Handler>
+MemoryBoundHandler<std::decay_t<Handler>> bind_handler_memory(HandlerMemory& memory,
+                                                               Handler&& handler) {
+    return MemoryBoundHandler<std::decay_t<Handler>>(memory, std::forward<Handler>(handler));
+}
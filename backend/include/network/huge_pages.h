@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * An arena on huge pages for the memory every connection holds: pooled
+ * session blocks and FrameReader buffers (network/session_pool.h).
+ *
+ * With thousands of connections, those 16 KiB buffers spread over
+ * thousands of 4 KiB pages, and reads miss the TLB. From one 2 MiB page
+ * they don't. start() maps the arena once: explicit huge pages
+ * (MAP_HUGETLB) if the kernel has enough reserved (vm.nr_hugepages), else
+ * ordinary pages marked MADV_HUGEPAGE for transparent huge pages, else
+ * nothing, and every allocation goes to the heap as before.
+ *
+ * Blocks are carved from the arena and freed blocks kept on a list per
+ * size for the next allocation of that size; the arena never shrinks.
+ * Anything larger than kMaxBlock (a jumbo frame's buffer), or that doesn't
+ * fit once the arena is full, comes from operator new, and deallocate()
+ * tells the two apart by address. Linux only; elsewhere start() returns
+ * Backing::None. Thread-safe.
+ */
+namespace huge_pages {
+
+inline constexpr std::size_t kPageSize = 2 * 1024 * 1024;
+inline constexpr std::size_t kMaxBlock = 256 * 1024;
+
+enum class Backing { None, Explicit, Transparent };
+
+/// Map an arena of `bytes`, rounded up to whole huge pages. Call once at
+/// startup, before the pools allocate; 0 leaves it off.
+Backing start(std::size_t bytes);
+
+/// `bytes` from the arena if it is on and has room, else from operator new.
+void* allocate(std::size_t bytes);
+
+/// Give back what allocate() returned, with the same `bytes`.
+void deallocate(void* block, std::size_t bytes) noexcept;
+
+struct Coverage {
+    Backing backing = Backing::None;
+    std::size_t arena_bytes = 0;                // mapped
+    std::size_t used_bytes = 0;                 // carved out, free lists included
+    std::size_t huge_bytes = 0;                 // of the arena, on huge pages now
+};
+
+/// For GET /metrics. With transparent huge pages, huge_bytes is what the
+/// kernel reports for the arena in /proc/self/smaps.
+Coverage coverage();
+
+/// Allocator for containers that should live in the arena.
+template <typename T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+    template <typename U>
+    Allocator(const Allocator<U>&) {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(huge_pages::allocate(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t n) noexcept { huge_pages::deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const Allocator<U>&) const { return true; }
+};
+
+} // namespace huge_pages
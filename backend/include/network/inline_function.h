@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * A move-only callable stored inline, with no heap fallback, for the
+ * callbacks on hot paths: PeerServer, PeerSession, UdpTransport, LocalAPI
+ * and the event bus (node/event_bus.h).
+ *
+ * std::function must be copyable, and it heap-allocates any target bigger
+ * than its small buffer (two pointers in libstdc++). Here a target that
+ * doesn't fit `Capacity` is a compile error, so setting a callback never
+ * allocates and a call is one indirect jump into the inline target.
+ * Capture a pointer to anything larger.
+ *
+ *     using FrameCallback = InlineFunction<void(std::string_view frame)>;
+ *     FrameCallback cb = [&node](std::string_view frame) { ... };
+ *
+ * Calls go through a const target, as with std::function, so mutable
+ * lambdas aren't accepted.
+ */
+template <typename Signature, std::size_t Capacity = 4 * sizeof(void*)>
+class InlineFunction;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R(Args...), Capacity> {
+public:
+    InlineFunction() noexcept = default;
+    InlineFunction(std::nullptr_t) noexcept {}
+
+    template <typename F>
+        requires(!std::is_same_v<std::remove_cvref_t<F>, InlineFunction> &&
+                 std::is_invocable_r_v<R, const std::remove_cvref_t<F>&, Args...>)
+    InlineFunction(F&& f) {
+        using T = std::remove_cvref_t<F>;
+        static_assert(sizeof(T) <= Capacity,
+                      "callback target too large for InlineFunction: capture a pointer instead");
+        static_assert(alignof(T) <= alignof(std::max_align_t));
+        static_assert(std::is_nothrow_move_constructible_v<T>);
+        ::new (static_cast<void*>(storage_)) T(std::forward<F>(f));
+        invoke_ = [](const void* target, Args&&... args) -> R {
+            return std::invoke(*static_cast<const T*>(target), std::forward<Args>(args)...);
+        };
+        relocate_ = [](void* to, void* from) noexcept {
+            T* source = static_cast<T*>(from);
+            if (to) {
+                ::new (to) T(std::move(*source));
+            }
+            source->~T();
+        };
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept { take(other); }
+
+    InlineFunction& operator=(InlineFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() { reset(); }
+
+    explicit operator bool() const noexcept { return invoke_ != nullptr; }
+
+    R operator()(Args... args) const {
+        return invoke_(storage_, std::forward<Args>(args)...);
+    }
+
+private:
+    void take(InlineFunction& other) noexcept {
+        if (other.relocate_) {
+            other.relocate_(storage_, other.storage_);
+            invoke_ = std::exchange(other.invoke_, nullptr);
+            relocate_ = std::exchange(other.relocate_, nullptr);
+        }
+    }
+
+    void reset() noexcept {
+        if (relocate_) {
+            relocate_(nullptr, storage_);   // destroy only
+            invoke_ = nullptr;
+            relocate_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    R (*invoke_)(const void*, Args&&...) = nullptr;
+    /// Move the target to `to` and destroy it at `from`; a null `to` only destroys.
+    void (*relocate_)(void* to, void* from) noexcept = nullptr;
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "telemetry/watchdog.h"
+
+/**
+ * Set of io_contexts and the threads that run them.
+ *
+ * Two layouts, selected by `node.io_mode`:
+ *
+ *   per_core — one io_context per thread. Objects bound to a context never
+ *              migrate, so cache locality is good and handlers on one
+ *              context are implicitly serialized.
+ *   shared   — a single io_context run by all threads. Load balances better
+ *              for uneven work; per-connection strands keep handlers ordered.
+ *
+ * Index 0 is the "main" context: acceptors, timers and anything that assumes
+ * the old single-threaded model live there.
+ *
+ * With CPUs set (`node.io_cpus`), each per_core thread is pinned to one of
+ * them in turn, and shared threads to all of them.
+ */
+class IoContextPool {
+public:
+    enum class Mode { PerCore, Shared };
+
+    /// `threads == 0` means one per hardware thread.
+    explicit IoContextPool(std::size_t threads = 1, Mode mode = Mode::PerCore);
+
+    IoContextPool(const IoContextPool&) = delete;
+    IoContextPool& operator=(const IoContextPool&) = delete;
+
+    /// Parse "per_core" / "shared"; anything else falls back to PerCore.
+    static Mode parse_mode(const std::string& name);
+
+    /// The context for listeners and global timers.
+    asio::io_context& main() { return *contexts_.front(); }
+
+    /// Round-robin context for a new connection.
+    asio::io_context& next();
+
+    /// The context worker `i` runs (index 0 is main()).
+    asio::io_context& context(std::size_t i) { return *contexts_[i % contexts_.size()]; }
+
+    /// CPUs to pin the threads to (network/cpu_affinity.h); empty = float.
+    /// Call before run().
+    void set_cpus(std::vector<unsigned> cpus) { cpus_ = std::move(cpus); }
+
+    /// Run all threads. The calling thread becomes worker 0 and this blocks
+    /// until stop() is called.
+    void run();
+
+    /// Stop all contexts; run() returns once every worker has exited.
+    void stop();
+
+    [[nodiscard]] std::size_t thread_count() const { return threads_; }
+    [[nodiscard]] Mode mode() const { return mode_; }
+
+private:
+    using WorkGuard = asio::executor_work_guard<asio::io_context::executor_type>;
+
+    std::size_t threads_;
+    Mode mode_;
+    std::vector<std::unique_ptr<asio::io_context>> contexts_;
+    std::list<WorkGuard> guards_;
+    std::list<watchdog::Registration> watched_;
+    std::vector<std::thread> workers_;
+    std::atomic<std::size_t> next_{0};
+    std::vector<unsigned> cpus_;
+};
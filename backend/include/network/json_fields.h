@@ -0,0 +1,59 @@
+#pragma once
+
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * DOM-free extraction of the top-level fields of a small JSON object, used
+ * on the receive path for envelopes and decrypted payloads, for Supabase
+ * result pages and for LocalAPI request bodies, plus the string escaping
+ * needed to write one.
+ *
+ * The document is validated in one pass and only the listed fields are
+ * copied out; no json values are built. Output strings keep their
+ * capacity, so a caller that reuses them (e.g. thread_local scratch)
+ * reaches a steady state with no allocations at all.
+ */
+namespace json_fields {
+
+/// One field to extract. Set exactly one of `value` or `items`.
+struct Field {
+    std::string_view key;
+    std::string* value = nullptr;               // string field
+    std::vector<std::string>* items = nullptr;  // array field; non-string items are skipped
+    bool* present = nullptr;                    // optional: set if the key was found
+};
+
+/**
+ * Parse `text` and fill the listed fields. Unlisted keys are skipped, and
+ * so is an `items` field holding something other than an array.
+ *
+ * Returns false for malformed JSON (including invalid UTF-8), a root that
+ * is not an object, or a `value` field holding something other than a
+ * string. Outputs may be
+ * partly written then. Fields that are absent are left untouched.
+ * A duplicate key is checked each time it appears; the last value wins.
+ */
+bool read(std::string_view text, std::span<const Field> fields);
+
+/**
+ * Parse `text` as an array of objects — a PostgREST result set — and call
+ * `row` once each object's fields have been read. Every listed output is
+ * cleared (and `present` reset) before each object, so a field a row
+ * lacks reads as empty. Elements that aren't objects are skipped.
+ *
+ * Returns false under the same conditions as read(), for the root or for
+ * any row; `row` may have been called for the rows before it.
+ */
+bool read_rows(std::string_view text, std::span<const Field> fields,
+               const std::function<void()>& row);
+
+/// Append `s` to `out` as a quoted JSON string. Quotes, backslashes and
+/// control characters are escaped; other bytes are copied, so `s` should
+/// be UTF-8.
+void append_string(std::string& out, std::string_view s);
+
+} // namespace json_fields
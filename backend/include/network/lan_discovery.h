@@ -0,0 +1,98 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include "telemetry/watchdog.h"
+
+/**
+ * Finding friends on the same LAN without Supabase
+ * (protocol/message_format.md §2.7).
+ *
+ * Every node with discovery on sends a small signed announcement to an
+ * IPv4 multicast group: its username, node id, a hash of its signing key
+ * and the TCP port it listens on. It does so when started, every
+ * `interval`, and (at most once a second) when it hears a node it hadn't
+ * heard lately, so a node that just joined learns the others within a
+ * round trip instead of an interval. The TTL is 1: announcements never
+ * leave the local network.
+ *
+ * This class only sends and parses. Whether an announcement is believed —
+ * from a friend, with the signing key we have on file, recently signed —
+ * is Node's call. Like RelayLink, it runs on its own io_context and thread;
+ * the handler runs on that thread.
+ */
+class LanDiscovery {
+public:
+    struct Options {
+        std::string username;
+        std::string node_id;
+        std::string key_hash;                   // key_hash() of our signing key
+        uint16_t listen_port = 0;               // our TCP peer port
+        std::string group = "239.255.80.80";
+        uint16_t port = 9199;
+        std::chrono::seconds interval{30};
+    };
+
+    struct Announcement {
+        std::string username;
+        std::string node_id;
+        std::string key_hash;
+        uint16_t port = 0;
+        int64_t timestamp = 0;                  // unix seconds
+        std::string signature;                  // raw Ed25519, over signed_bytes()
+    };
+
+    /// Detached Ed25519 signature of `bytes` with our signing key.
+    using Signer = std::function<std::string(const std::string& bytes)>;
+    /// A well-formed announcement from another node; `ip` is where it came
+    /// from. Runs on the discovery thread.
+    using Handler = std::function<void(const Announcement& announcement, const std::string& ip)>;
+
+    LanDiscovery(Options options, Signer sign, Handler on_announcement);
+    ~LanDiscovery();
+
+    LanDiscovery(const LanDiscovery&) = delete;
+    LanDiscovery& operator=(const LanDiscovery&) = delete;
+
+    /// Join the group and start announcing. False (logged) if the socket
+    /// can't be set up.
+    bool start();
+    void stop();
+
+    /// 32 hex digits of the BLAKE2b hash of an Ed25519 public key.
+    static std::string key_hash(std::span<const uint8_t> signing_key);
+
+    /// What an announcement's signature covers.
+    static std::string signed_bytes(const Announcement& announcement);
+
+    static std::string encode(const Announcement& announcement);
+    static std::optional<Announcement> decode(std::string_view packet);
+
+private:
+    asio::awaitable<void> receive_loop();
+    void announce();
+    void arm_timer(std::chrono::steady_clock::duration delay);
+
+    Options options_;
+    Signer sign_;
+    Handler on_announcement_;
+
+    asio::io_context io_;
+    watchdog::Registration watched_{"lan-discovery", io_};
+    asio::ip::udp::socket socket_;
+    asio::ip::udp::endpoint group_;
+    asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point last_announce_{};
+    /// "username\nnode id" → when last heard; discovery thread only.
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> heard_;
+    std::thread thread_;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * Multiplexed link frames (protocol/message_format.md §2.8).
+ *
+ * Several identity pairs in two processes share one TCP connection, each
+ * on its own channel. The channel id goes in a small header inside an
+ * ordinary length-prefixed frame; the envelope frame after it is the one
+ * that would otherwise have had a connection to itself.
+ *
+ * Layout:
+ *
+ *   off  size  field
+ *     0     1  magic (0x4D, 'M'; envelopes start with '{' or 0x01)
+ *     1     1  op (Op)
+ *     2     4  channel id, big-endian, chosen by the connecting side
+ *     6        body: `data` → the envelope frame; `window` → 4-byte
+ *              big-endian byte credit; `close` → empty
+ *
+ * Flow control is per channel: the sender may have kWindow bytes of data
+ * bodies outstanding, and the receiver hands credit back with `window`
+ * frames as it consumes them. One busy channel then can't take the whole
+ * connection's send queue from the others.
+ */
+namespace mux {
+
+inline constexpr uint8_t kMagic = 0x4D;
+inline constexpr std::size_t kHeaderSize = 6;
+/// Bytes of data bodies a channel may have unacknowledged.
+inline constexpr uint32_t kWindow = 256 * 1024;
+/// Channels one connection may open on the receiving side.
+inline constexpr std::size_t kMaxChannels = 4096;
+
+enum class Op : uint8_t {
+    Data   = 1,     ///< an envelope frame on the channel (sender → receiver)
+    Window = 2,     ///< credit for that many more bytes (receiver → sender)
+    Close  = 3,     ///< the sender is done with the channel
+};
+
+/// A mux frame's header, with a view of its body.
+struct Frame {
+    Op op;
+    uint32_t channel;
+    std::string_view body;
+};
+
+/// Whether `frame` is a mux frame rather than an envelope.
+inline bool is_mux_frame(std::string_view frame) {
+    return !frame.empty() && static_cast<uint8_t>(frame.front()) == kMagic;
+}
+
+/// Parse the header; nullopt if the frame is truncated, the op unknown or
+/// a window body malformed.
+std::optional<Frame> parse(std::string_view frame);
+
+/// A window frame's credit; nullopt if `body` isn't 4 bytes.
+std::optional<uint32_t> parse_window(std::string_view body);
+
+std::string encode_data(uint32_t channel, std::string_view envelope);
+std::string encode_window(uint32_t channel, uint32_t credit);
+std::string encode_close(uint32_t channel);
+
+} // namespace mux
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+/**
+ * Reports changes to the host's network interfaces and addresses.
+ *
+ * On Linux a watcher thread listens on an rtnetlink socket for links and
+ * addresses coming and going. Changes arrive in bursts (a Wi-Fi roam drops
+ * the address, the link and brings both back), so the listener runs once
+ * the burst has been quiet for a second. Elsewhere start() returns false
+ * and the owner falls back to polling.
+ */
+class NetworkWatcher {
+public:
+    /// Runs on the watcher thread.
+    using Listener = std::function<void()>;
+
+    explicit NetworkWatcher(Listener on_change);
+    ~NetworkWatcher();
+
+    NetworkWatcher(const NetworkWatcher&) = delete;
+    NetworkWatcher& operator=(const NetworkWatcher&) = delete;
+
+    /// False if this platform (or sandbox) gives no change notifications.
+    bool start();
+    void stop();
+
+private:
+    void watch(int fd);
+
+    Listener on_change_;
+    std::atomic<bool> stopping_{false};
+    std::thread thread_;
+};
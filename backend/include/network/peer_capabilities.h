@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "network/envelope.h"
+
+/**
+ * What each peer has told us it can decode.
+ *
+ * Learned passively: from a peer's `hello` when it connects to us, or from
+ * any binary frame it sends (which proves it speaks binary v1). Peers we
+ * have never heard from get JSON, the format every version understands.
+ */
+class PeerCapabilities {
+public:
+    /// `binary_enabled` = false pins every peer to JSON (node.binary_envelope).
+    explicit PeerCapabilities(bool binary_enabled = true);
+
+    /// Record the capability bits advertised by `username`.
+    void update(const std::string& username, uint32_t capabilities);
+
+    /// Update from any received envelope (hello or an implicit binary frame).
+    void observe(const Envelope& env, WireFormat format);
+
+    /// Encoding to use when sending to `username`.
+    [[nodiscard]] WireFormat format_for(const std::string& username) const;
+
+    /// Whether `username` advertised every bit of `capabilities`.
+    [[nodiscard]] bool supports(const std::string& username, uint32_t capabilities) const;
+
+    /// Forget a peer, e.g. after it was removed as a friend.
+    void forget(const std::string& username);
+
+    [[nodiscard]] bool binary_enabled() const { return binary_enabled_; }
+
+private:
+    bool binary_enabled_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, uint32_t> caps_;
+};
@@ -1,20 +1,196 @@
 #pragma once
 
 #include <asio.hpp>
-#include <string>
+#include <array>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "network/framing.h"
+#include "network/handler_memory.h"
+#include "network/inline_function.h"
+#include "network/traffic_class.h"
+#include "network/zero_copy.h"
+
+class Backpressure;
+
+/**
+ * Where a peer listens: the address it published as `last_ip`, and any
+ * others it listed in `addresses` (IPv6, LAN), each "ip", "ip:port" or
+ * "[ipv6]:port". An alternate without a port uses `port`. Any of them may
+ * be a host name instead, resolved through DnsCache.
+ */
+struct PeerAddress {
+    std::string ip;
+    uint16_t port = 0;
+    std::vector<std::string> alternates;
+
+    bool operator==(const PeerAddress&) const = default;
+};
 
 /**
  * TCP client for connecting to a single remote peer.
+ *
+ * Outgoing frames go through per-connection queues, one per TrafficClass:
+ * whatever is pending when the previous write completes is flushed as one
+ * gathered asio::async_write (header + body buffers per frame, no
+ * concatenation), so back-to-back sends share a syscall. At most one write
+ * is in flight. The queues share each write by deficit round robin
+ * (traffic::kQuantum), so a chat message waits behind at most a round of
+ * file chunks, not behind all of them. On Linux a batch of at least
+ * `zerocopy_min_bytes` is written with MSG_ZEROCOPY (network/zero_copy.h)
+ * instead of being copied into the socket buffer.
+ *
+ * The socket is TCP_NODELAY, so a lone chat frame leaves at once. When a
+ * batch leaves frames queued behind it, the writer sets TCP_CORK until the
+ * queue drains, and a burst goes out in full segments rather than a short
+ * packet per write. A batch carrying a control or interactive frame is
+ * uncorked as soon as it is written, so those never wait for the bulk
+ * behind them.
+ *
+ * The blocking calls wait for their operation to finish, but the I/O itself
+ * runs on `io`, which must be driven by a thread other than the caller
+ * (PeerConnectionPool owns one for this purpose). Coroutines should use the
+ * co_* variants instead, which suspend rather than block and resume on the
+ * awaiting coroutine's executor.
  */
-class PeerClient {
+class PeerClient : public std::enable_shared_from_this<PeerClient> {
 public:
-    explicit PeerClient(asio::io_context& io);
+    using Completion = std::function<void(const asio::error_code&)>;
+    /// `payload` is only valid for the duration of the call.
+    using FrameHandler = InlineFunction<void(std::string_view payload)>;
+
+    static constexpr std::size_t kDefaultQueueBudget = 4 * 1024 * 1024;
+
+    /// `zerocopy_min_bytes` = 0 never uses MSG_ZEROCOPY.
+    explicit PeerClient(asio::io_context& io,
+                        std::size_t queue_budget = kDefaultQueueBudget,
+                        std::size_t zerocopy_min_bytes = 0);
+
+    /// RFC 8305 ("happy eyeballs") spacing of connect attempts.
+    static constexpr std::chrono::milliseconds kConnectStagger{250};
+
+    bool connect(const std::string& ip, uint16_t port,
+                 std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    /// Connect to whichever of `address`'s endpoints answers first. The
+    /// published address is tried first, the rest alternating between IPv6
+    /// and IPv4. A new attempt starts every kConnectStagger, or at once when
+    /// the one before fails, and the first to connect wins. The losers are
+    /// closed. `timeout` bounds the whole race. A host name DnsCache doesn't
+    /// have yet is left out if there is anything else to try, and waited
+    /// for only if there isn't.
+    bool connect(const PeerAddress& address,
+                 std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    /// Queue one frame and wait until it has been written. If the queue is
+    /// over budget, waits up to `timeout` for it to drain before giving up.
+    bool send(std::string_view payload,
+              std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    /// Queue one frame without waiting. Returns false (and never calls
+    /// `done`) if the queue is over its byte budget (for bulk, its share of
+    /// it) — the caller should back off or take the offline path.
+    bool send_async(std::string payload, Completion done = {},
+                    TrafficClass cls = TrafficClass::Interactive);
+
+    /// Awaitable connect; never blocks, so it is safe on any executor.
+    asio::awaitable<bool> co_connect(std::string ip, uint16_t port,
+                                     std::chrono::milliseconds timeout = std::chrono::seconds(5));
+    asio::awaitable<bool> co_connect(PeerAddress address,
+                                     std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    /// Awaitable send: completes once the frame has been written. Fails at
+    /// once, like send_async, if the queue is over its byte budget.
+    asio::awaitable<bool> co_send(std::string payload);
+
+    /// Read the frames the remote writes back until the connection closes.
+    /// Only relays write to their clients (network/relay_hub.h), and the
+    /// receiving end of a mux link its window frames (network/mux.h);
+    /// await it on `io`.
+    asio::awaitable<void> co_read(FrameHandler on_frame,
+                                  std::size_t max_frame_size = framing::kDefaultMaxFrameSize);
+
+    /// Wait before each co_read() read while `backpressure` is paused, as
+    /// PeerSession does. Set before co_read().
+    void set_backpressure(std::shared_ptr<Backpressure> backpressure) {
+        backpressure_ = std::move(backpressure);
+    }
 
-    bool connect(const std::string& ip, uint16_t port);
-    bool send(const std::string& json_payload);
     void disconnect();
 
+    [[nodiscard]] bool is_open() const { return socket_.is_open(); }
+
+    /// Bytes accepted by send/send_async but not yet written.
+    [[nodiscard]] std::size_t queued_bytes() const;
+
 private:
+    struct OutFrame {
+        std::array<uint8_t, 4> header;
+        std::string payload;
+        Completion done;
+        TrafficClass cls;
+    };
+
+    /// One connect raced over several endpoints. Lives on io_.
+    struct Race;
+
+    /// Start connecting to `endpoints` on `io_`, giving up after
+    /// `timeout`; `done` runs on the I/O thread.
+    void start_connect(std::vector<asio::ip::tcp::endpoint> endpoints,
+                       std::chrono::milliseconds timeout, Completion done);
+    /// Start the race's next attempt, if it has one left.
+    void next_attempt(const std::shared_ptr<Race>& race);
+    /// Settle the race once: close the other attempts and call done.
+    void end_race(Race& race, const asio::error_code& ec);
+    /// `address`'s endpoints in the order to try them; empty if none parse.
+    /// Host names count only if DnsCache has them; the others are added to
+    /// `unresolved`, now being resolved.
+    static std::vector<asio::ip::tcp::endpoint> resolve_endpoints(
+        const PeerAddress& address, std::vector<std::string>* unresolved = nullptr);
+    bool finish_connect(const PeerAddress& address, const asio::error_code& ec);
+
+    bool enqueue_locked(std::string payload, Completion done, TrafficClass cls);
+    /// Whether a `bytes`-byte frame of `cls` fits the budget. Requires mutex_.
+    bool has_room_locked(std::size_t bytes, TrafficClass cls) const;
+    void write_pending();
+    void on_write(const asio::error_code& ec);
+    /// The queue just emptied: uncork, and count the segments sent since
+    /// the last drain. Requires mutex_.
+    void on_drain_locked();
+    void fail_all(const asio::error_code& ec);
+
+    asio::io_context& io_;
     asio::ip::tcp::socket socket_;
+    std::size_t queue_budget_;
+    std::size_t zerocopy_min_bytes_;
+    std::shared_ptr<Backpressure> backpressure_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable drained_;
+    std::array<std::deque<OutFrame>, kTrafficClasses> queues_;
+    std::array<std::size_t, kTrafficClasses> deficit_{};   // DRR credit per class
+    std::array<std::size_t, kTrafficClasses> class_bytes_{};
+    std::size_t queued_bytes_ = 0;
+    bool writing_ = false;
+    bool corked_ = false;                       // TCP_CORK set on socket_
+    bool urgent_batch_ = false;                 // the corked write in flight holds a non-bulk frame
+    std::optional<uint32_t> segments_seen_;     // TCP_INFO segs_out at the last drain
+    std::string remote_;                        // "ip:port" once connected, for capture.h
+
+    // Owned by the I/O thread while a write is in flight.
+    std::vector<OutFrame> inflight_;
+    std::vector<asio::const_buffer> gather_;
+    HandlerMemory write_memory_;                // the write in flight
+    HandlerMemory post_memory_;                 // the post that starts one
+    ZeroCopySender zerocopy_;
+    bool zerocopy_batch_ = false;               // inflight_ went out zero-copy
 };
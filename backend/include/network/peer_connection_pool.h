@@ -0,0 +1,133 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "network/traffic_class.h"
+#include "telemetry/watchdog.h"
+
+#include "network/peer_client.h"
+
+/**
+ * Warm outbound connections to recently contacted peers.
+ *
+ * Keyed by username. A send to a known peer reuses its open PeerClient, so
+ * only the first message after a connect (or after idle eviction) pays the
+ * TCP handshake; later frames are multiplexed over the same socket.
+ *
+ * The pool owns a dedicated io_context and thread for client sockets, which
+ * lets send() block the caller without stalling the main event loop's
+ * handlers that aren't waiting on it.
+ */
+class PeerConnectionPool {
+public:
+    struct Options {
+        std::chrono::seconds idle_timeout{60};
+        std::chrono::milliseconds connect_timeout{5000};
+        std::size_t max_connections = 256;
+        std::size_t send_queue_bytes = 4 * 1024 * 1024;   // per-connection backpressure budget
+        std::size_t zerocopy_min_bytes = 0;               // MSG_ZEROCOPY batches from here; 0 = off
+        /// Builds the `hello` frame sent first on every new connection, so
+        /// the remote learns our capabilities. Unset = send nothing.
+        std::function<std::string()> hello;
+    };
+
+    PeerConnectionPool();
+    explicit PeerConnectionPool(Options options);
+    ~PeerConnectionPool();
+
+    PeerConnectionPool(const PeerConnectionPool&) = delete;
+    PeerConnectionPool& operator=(const PeerConnectionPool&) = delete;
+
+    /// Send one frame to `username` at `address`, connecting if needed
+    /// (racing its endpoints, PeerClient::connect). A pooled connection that
+    /// turns out to be dead is replaced once, as is one made to an address
+    /// that has since changed.
+    bool send(const std::string& username, const PeerAddress& address, std::string_view payload);
+
+    /// Fire-and-forget send that never blocks the caller: a warm connection
+    /// is used directly, otherwise the connect runs as a coroutine on the
+    /// pool's thread and sends issued meanwhile wait for it rather than
+    /// opening sockets of their own. `done` (optional) runs on the pool
+    /// thread with the outcome. `cls` picks the connection's queue.
+    void send_async(const std::string& username, const PeerAddress& address, std::string payload, std::function<void(bool ok)> done = {},
+                    TrafficClass cls = TrafficClass::Interactive);
+
+    /// Have a connection to `username` ready without sending anything: a
+    /// warm one counts at once, otherwise the connect starts as for
+    /// send_async(). `done` runs on the pool thread with the outcome.
+    void connect_async(const std::string& username, const PeerAddress& address,
+                       std::function<void(bool ok)> done);
+
+    /// Whether a live connection to `username` is currently pooled.
+    [[nodiscard]] bool has_connection(const std::string& username) const;
+
+    /// Drop the connection for `username`, if any.
+    void evict(const std::string& username);
+
+    /// Exempt connections to `usernames` from idle eviction, replacing the
+    /// previous set. Connections still close when they die or the pool is
+    /// full; this only stops the sweep from dropping them for being unused.
+    void keep_warm(std::vector<std::string> usernames);
+
+    /// Close every pooled connection.
+    void close_all();
+
+    /// Wait until every frame queued on a pooled connection has been
+    /// written and no connect_async() is in flight, or until `deadline`.
+    /// Returns whether it got there. Blocks; not from the pool's thread.
+    bool drain(std::chrono::steady_clock::time_point deadline);
+
+    [[nodiscard]] std::size_t size() const;
+
+    /// Bytes queued on each pooled connection and not yet written, by
+    /// username; connections with nothing queued are left out.
+    [[nodiscard]] std::unordered_map<std::string, std::size_t> queued_by_peer() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<PeerClient> client;
+        PeerAddress address;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    std::shared_ptr<PeerClient> acquire(const std::string& username, const PeerAddress& address,
+                                        bool force_new);
+    struct QueuedSend {
+        std::string payload;
+        std::function<void(bool)> done;
+        bool connect_only = false;              // connect_async(): nothing to send
+        TrafficClass cls = TrafficClass::Interactive;
+    };
+
+    /// send_async's slow path: connect, pool the client and flush every
+    /// send queued for `username` while the connect was in flight.
+    asio::awaitable<void> connect_and_flush(std::string username, PeerAddress address);
+
+    void evict_lru_locked();
+    void schedule_sweep();
+    void sweep();
+
+    Options options_;
+    asio::io_context io_;
+    watchdog::Registration watched_{"peer-pool", io_};
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    asio::steady_timer sweep_timer_;
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::unordered_map<std::string, std::shared_ptr<std::mutex>> connecting_;
+    std::unordered_map<std::string, std::vector<QueuedSend>> connecting_async_;
+    std::unordered_set<std::string> warm_;      // keep_warm()
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "network/peer_client.h"
+#include "network/traffic_class.h"
+#include "telemetry/watchdog.h"
+
+/**
+ * Outbound connections shared by several local identities: one TCP link
+ * per remote process, one channel per (from, to) pair on it
+ * (network/mux.h).
+ *
+ * A host process (ARCHITECTURE.md §7.1.2) talking to another host would
+ * otherwise open a PeerConnectionPool socket per identity pair, with a
+ * handshake each: hundreds of pairs, hundreds of sockets. Here they share
+ * one link per remote "ip:port". Each channel's first frame is its sender's
+ * hello, so the remote learns every identity's capabilities as before.
+ *
+ * Each channel may have mux::kWindow bytes outstanding. Frames past that
+ * wait in the channel, up to `channel_queue_bytes`, until the receiver's
+ * window frames return credit; the link's own queue (PeerClient) only ever
+ * holds what channels have credit for, so a bulk channel can't crowd the
+ * others out of it.
+ *
+ * Use it only with peers that advertise mux_v1. Like PeerConnectionPool it
+ * owns an io_context and thread for its sockets.
+ */
+class PeerLinks {
+public:
+    struct Options {
+        std::chrono::seconds idle_timeout{60};
+        std::chrono::milliseconds connect_timeout{5000};
+        std::size_t max_links = 256;
+        std::size_t send_queue_bytes = 4 * 1024 * 1024;     // per link
+        std::size_t channel_queue_bytes = 1024 * 1024;      // waiting for credit, per channel
+        std::size_t zerocopy_min_bytes = 0;
+    };
+
+    PeerLinks();
+    explicit PeerLinks(Options options);
+    ~PeerLinks();
+
+    PeerLinks(const PeerLinks&) = delete;
+    PeerLinks& operator=(const PeerLinks&) = delete;
+
+    /// Builds `from`'s hello, sent first on each of its new channels.
+    /// Unset = send nothing.
+    void set_hello(const std::string& from, std::function<std::string()> hello);
+
+    /// Send one frame from `from` to `to` at `address`, and wait until it
+    /// has been written. Not from the links' thread.
+    bool send(const std::string& from, const std::string& to, const PeerAddress& address,
+              std::string_view payload);
+
+    /// Queue one frame without waiting; opens the link and channel as
+    /// needed. `done` (optional) runs on the links' thread with the outcome.
+    void send_async(const std::string& from, const std::string& to, const PeerAddress& address,
+                    std::string payload, std::function<void(bool ok)> done = {},
+                    TrafficClass cls = TrafficClass::Interactive);
+
+    /// Have the link to `address` open and a channel from `from` to `to`
+    /// on it. `done` runs on the links' thread with the outcome.
+    void connect_async(const std::string& from, const std::string& to,
+                       const PeerAddress& address, std::function<void(bool ok)> done);
+
+    /// Whether `from` has a channel to `to` on a live link.
+    [[nodiscard]] bool has_channel(const std::string& from, const std::string& to) const;
+
+    /// Exempt `from`'s channels to `usernames` (and so their links) from
+    /// idle eviction, replacing `from`'s previous set.
+    void keep_warm(const std::string& from, std::vector<std::string> usernames);
+
+    /// Close `from`'s channels, and each link left with none. Frames still
+    /// waiting for credit fail.
+    void close_channels(const std::string& from);
+
+    /// Wait until nothing is queued on any link or waiting for credit, and
+    /// no connect is in flight, or until `deadline`. Blocks; not from the
+    /// links' thread.
+    bool drain(std::chrono::steady_clock::time_point deadline);
+
+    [[nodiscard]] std::size_t links() const;
+    [[nodiscard]] std::size_t channels() const;
+
+private:
+    struct Waiting {
+        std::string payload;
+        std::function<void(bool)> done;
+        TrafficClass cls;
+    };
+
+    struct Channel {
+        uint32_t id = 0;
+        std::string from;
+        std::string to;
+        int64_t credit = 0;                     // bytes it may still send
+        bool greeted = false;                   // hello sent
+        std::deque<Waiting> waiting;            // frames past the window, or before connect
+        std::size_t waiting_bytes = 0;
+        std::chrono::steady_clock::time_point last_used;
+    };
+
+    struct Link {
+        std::shared_ptr<PeerClient> client;
+        PeerAddress address;
+        bool connected = false;                 // false while the connect is in flight
+        std::chrono::steady_clock::time_point last_used;
+        std::unordered_map<uint32_t, Channel> channels;
+        std::unordered_map<std::string, uint32_t> by_pair;   // pair_key(from, to) → id
+        uint32_t next_id = 1;
+    };
+
+    static std::string link_key(const PeerAddress& address);
+    static std::string pair_key(const std::string& from, const std::string& to);
+
+    /// The channel from `from` to `to` on the link to `address`, opening
+    /// either as needed. Requires mutex_.
+    Channel& channel_locked(const std::string& from, const std::string& to,
+                            const PeerAddress& address, std::shared_ptr<Link>& link);
+
+    /// Hand the channel's waiting frames to the link while it has credit,
+    /// its hello first. Failures go to `failed`. Requires mutex_.
+    void pump_locked(Link& link, Channel& channel, std::vector<std::function<void(bool)>>& failed);
+
+    /// Connect `link`, then read its window frames until it closes.
+    asio::awaitable<void> run_link(std::shared_ptr<Link> link);
+    void on_window(Link& link, std::string_view frame);
+    /// Forget `link` and fail what its channels still held.
+    void drop_link(const std::shared_ptr<Link>& link);
+
+    /// Run each of `dones` with false on the links' thread.
+    void fail(std::vector<std::function<void(bool)>> dones);
+
+    void evict_lru_locked();
+    void schedule_sweep();
+    void sweep();
+    void update_gauges_locked();
+
+    Options options_;
+    asio::io_context io_;
+    watchdog::Registration watched_{"peer-links", io_};
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    asio::steady_timer sweep_timer_;
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Link>> links_;   // link_key → link
+    std::unordered_map<std::string, std::function<std::string()>> hellos_;
+    std::unordered_map<std::string, std::unordered_set<std::string>> warm_;  // from → to
+};
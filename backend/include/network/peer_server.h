@@ -5,26 +5,93 @@
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
+#include "network/framing.h"
+#include "network/inline_function.h"
+
+class AdmissionControl;
+class Backpressure;
+class IoContextPool;
+class PeerSession;
+class RelayHub;
+class SessionPool;
 
 /**
  * Async TCP server that accepts peer connections.
  */
 class PeerServer {
 public:
-    using MessageCallback = std::function<void(const std::string& from,
-                                                const std::string& payload)>;
+    /// `remote` is the peer's "ip:port"; `payload` is a view into the
+    /// session's read buffer and is only valid for the duration of the call.
+    using MessageCallback = InlineFunction<void(const std::string& remote,
+                                                std::string_view payload)>;
+
+    /// With `reuse_port` (Linux SO_REUSEPORT), a second process can listen
+    /// on the same port while this one drains, so an upgrade never refuses
+    /// a connection: start the new process, then stop the old one.
+    PeerServer(asio::io_context& io, uint16_t port,
+               std::size_t max_frame_size = framing::kDefaultMaxFrameSize,
+               bool reuse_port = false);
 
-    PeerServer(asio::io_context& io, uint16_t port);
+    struct Listen {
+        std::size_t max_frame_size = framing::kDefaultMaxFrameSize;
+        bool reuse_port = false;
+        /// Listening sockets, each on its own pool context and bound with
+        /// SO_REUSEPORT so the kernel spreads connections across them;
+        /// 0 = one per I/O thread. Where SO_REUSEPORT is missing, 1.
+        std::size_t acceptors = 1;
+    };
+
+    /// With one acceptor, listen on the pool's main context and spread
+    /// accepted sessions round-robin across all of its contexts. With
+    /// several, acceptor i listens on context i and keeps what it accepts
+    /// there, so accepts run in parallel and each thread serves the share
+    /// the kernel hands it.
+    PeerServer(IoContextPool& pool, uint16_t port, Listen listen);
 
     void start();
+    /// Stop accepting. Open sessions keep reading until their peers close
+    /// them, so acks for what we sent still arrive while Node::drain waits.
+    /// Each acceptor closes on its own context.
     void stop();
 
     /// Set the callback invoked when a complete message arrives.
     void set_on_message(MessageCallback cb);
 
+    /// Serve as a relay: relay frames go to `hub` (relay mode). Set before
+    /// start().
+    void set_relay_hub(RelayHub* hub);
+
+    /// Cap connections and rate-limit frames per remote IP. Set before
+    /// start().
+    void set_admission(std::shared_ptr<AdmissionControl> admission);
+
+    /// Pause every session's reads while `backpressure` says so. Set
+    /// before start().
+    void set_backpressure(std::shared_ptr<Backpressure> backpressure);
+
+    /// How many closed sessions' memory to keep for reuse (default 256).
+    /// Set before start().
+    void set_pool_idle(std::size_t max_idle);
+
 private:
-    void do_accept();
+    /// Accept on `acceptor` until it is closed.
+    asio::awaitable<void> accept_loop(asio::ip::tcp::acceptor& acceptor);
+
+    /// Executor a new session's socket is bound to: a fresh strand, so its
+    /// handlers never run concurrently. On the next pool context with a
+    /// single acceptor, on `acceptor`'s own with several.
+    asio::any_io_executor session_executor(asio::ip::tcp::acceptor& acceptor);
 
-    asio::ip::tcp::acceptor acceptor_;
+    IoContextPool* pool_ = nullptr;
+    std::vector<asio::ip::tcp::acceptor> acceptors_;
     MessageCallback on_message_;
+    RelayHub* relay_hub_ = nullptr;
+    std::shared_ptr<AdmissionControl> admission_;
+    std::shared_ptr<Backpressure> backpressure_;
+    /// Session blocks and read buffers, recycled across connections.
+    std::shared_ptr<SessionPool> session_pool_;
+    std::size_t max_frame_size_;
 };
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <asio.hpp>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "network/framing.h"
+#include "network/handler_memory.h"
+#include "network/inline_function.h"
+#include "network/zero_copy.h"
+
+class AdmissionControl;
+class Backpressure;
+class RelayHub;
+class SessionPool;
+
+/**
+ * One accepted peer connection.
+ *
+ * The read loop is a coroutine: the FrameReader buffer and loop state live
+ * in its frame, and the frame holds the only long-lived reference to the
+ * session, so a read costs no handler allocation or refcount traffic. Each
+ * payload is handed to the frame handler as a view — no per-frame copy.
+ *
+ * Peers only ever write to us, except on a relay: there the session of a
+ * client registered with the RelayHub also carries the frames forwarded to
+ * that client, through send_async(). A multiplexed link (network/mux.h)
+ * is the other exception: the session unwraps each channel's envelopes
+ * for the frame handler and writes back the channel's window credit.
+ */
+class PeerSession : public std::enable_shared_from_this<PeerSession> {
+public:
+    /// `payload` is only valid for the duration of the call.
+    using FrameHandler = InlineFunction<void(const std::string& remote,
+                                             std::string_view payload)>;
+
+    PeerSession(asio::ip::tcp::socket socket,
+                FrameHandler on_frame,
+                std::size_t max_frame_size = framing::kDefaultMaxFrameSize);
+    ~PeerSession();
+
+    /// Charge every frame to the remote's IP budget, and hand the
+    /// connection back to `admission` when the session ends. Set before
+    /// start(), for a connection `admission` has opened.
+    void set_admission(std::shared_ptr<AdmissionControl> admission) {
+        admission_ = std::move(admission);
+    }
+
+    /// Wait before each read while `backpressure` is paused. Set before
+    /// start().
+    void set_backpressure(std::shared_ptr<Backpressure> backpressure) {
+        backpressure_ = std::move(backpressure);
+    }
+
+    /// Hand relay frames (network/relay.h) to `hub` instead of the frame
+    /// handler. Set before start().
+    void set_relay_hub(RelayHub* hub) { relay_hub_ = hub; }
+
+    /// Take the read buffer from `pool` and give it back when the read
+    /// loop ends. Set before start().
+    void set_pool(std::shared_ptr<SessionPool> pool) { pool_ = std::move(pool); }
+
+    /// Spawn the read loop on the socket's executor.
+    void start();
+    void close();
+
+    /// Queue one frame to the remote without waiting; writes are gathered
+    /// like PeerClient's. Returns false if the session is closed or more
+    /// than `budget` bytes would be queued. Thread-safe.
+    bool send_async(std::string payload, std::size_t budget);
+
+    /// Write batches of at least `min_bytes` with MSG_ZEROCOPY where the
+    /// kernel supports it (network/zero_copy.h). Thread-safe.
+    void enable_zerocopy(std::size_t min_bytes);
+
+    [[nodiscard]] const std::string& remote() const { return remote_; }
+
+private:
+    struct OutFrame {
+        std::array<uint8_t, framing::kHeaderSize> header;
+        std::string payload;
+    };
+
+    /// Read frames until the peer disconnects or misbehaves.
+    static asio::awaitable<void> run(std::shared_ptr<PeerSession> self);
+
+    /// Hand a mux frame's envelope to the frame handler and grant its
+    /// channel more credit. False if the peer broke the protocol.
+    bool on_mux_frame(std::string_view frame);
+
+    void write_pending();
+    void on_write(const asio::error_code& ec);
+
+    asio::ip::tcp::socket socket_;
+    FrameHandler on_frame_;
+    std::size_t max_frame_size_;
+    asio::ip::address address_;
+    std::string remote_;
+    RelayHub* relay_hub_ = nullptr;
+    std::shared_ptr<AdmissionControl> admission_;
+    std::shared_ptr<Backpressure> backpressure_;
+    std::shared_ptr<SessionPool> pool_;
+    /// Bytes consumed per mux channel since its last window frame; the
+    /// read loop only.
+    std::unordered_map<uint32_t, uint32_t> mux_consumed_;
+
+    std::atomic<bool> closed_{false};
+    std::mutex mutex_;                          // guards queue_, queued_bytes_, writing_
+    std::deque<OutFrame> queue_;
+    std::size_t queued_bytes_ = 0;
+    bool writing_ = false;
+    // Owned by the socket's strand while a write is in flight.
+    std::vector<OutFrame> inflight_;
+    std::vector<asio::const_buffer> gather_;
+    HandlerMemory write_memory_;                // the write in flight
+    HandlerMemory post_memory_;                 // the post that starts one
+    ZeroCopySender zerocopy_;                   // the socket's strand only
+    bool zerocopy_batch_ = false;               // inflight_ went out zero-copy
+};
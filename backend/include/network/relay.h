@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+/**
+ * Relay frames (protocol/message_format.md §2.5).
+ *
+ * A peer behind NAT keeps one outbound connection open to a relay node and
+ * registers on it; anyone who can't dial the peer sends it frames through
+ * the relay instead. The relay only reads the small header below to find
+ * the recipient's connection. The envelope inside is forwarded as it
+ * arrived: never decoded, decrypted or re-encoded.
+ *
+ * Layout, inside an ordinary length-prefixed frame:
+ *
+ *   off  size  field
+ *     0     1  magic (0x52, 'R'; envelopes start with '{' or 0x01)
+ *     1     1  op (Op)
+ *     2     1  username length (N)
+ *     3     N  username: the one registering, or the recipient
+ *   3+N        body: `register` → 8-byte big-endian timestamp (seconds
+ *              since the Unix epoch) and a 64-byte Ed25519 signature over
+ *              register_signed_bytes(); `forward` → the envelope frame
+ */
+namespace relay {
+
+inline constexpr uint8_t kMagic = 0x52;
+inline constexpr std::size_t kHeaderSize = 3;
+inline constexpr std::size_t kSignatureSize = 64;
+
+enum class Op : uint8_t {
+    Register = 1,     ///< bind this connection to the username
+    Forward  = 2,     ///< deliver the body to the username's connection
+};
+
+/// A relay frame's header, with views into the frame.
+struct Frame {
+    Op op;
+    std::string_view username;
+    std::string_view body;
+};
+
+/// Whether `frame` is a relay frame rather than an envelope.
+inline bool is_relay_frame(std::string_view frame) {
+    return !frame.empty() && static_cast<uint8_t>(frame.front()) == kMagic;
+}
+
+/// Parse the header; nullopt if the frame is truncated or the op unknown.
+std::optional<Frame> parse(std::string_view frame);
+
+/// What a registration's signature covers. Binding the time limits a
+/// captured registration to the relay's clock-skew window.
+std::string register_signed_bytes(std::string_view username, int64_t timestamp);
+
+std::string encode_register(std::string_view username, int64_t timestamp,
+                            std::span<const uint8_t> signature);
+std::string encode_forward(std::string_view to, std::string_view envelope);
+
+/// A register body's timestamp and signature; nullopt if malformed.
+struct Registration {
+    int64_t timestamp = 0;
+    std::string_view signature;
+};
+std::optional<Registration> parse_register(std::string_view body);
+
+} // namespace relay
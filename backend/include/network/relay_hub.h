@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "network/token_bucket.h"
+
+class PeerSession;
+
+/**
+ * The forwarding side of relay mode (protocol/message_format.md §2.5).
+ *
+ * A client behind NAT registers its inbound session here under its
+ * username, proving the name with a signature. Any `forward` frame for
+ * that username, from any session, is then queued on the client's session
+ * byte for byte, header included. Only the relay header is read; the
+ * envelope inside stays opaque. The one copy is out of the reading
+ * session's buffer, which the next read reuses.
+ *
+ * Relays are open to any sender, so forwarding is bounded by token buckets:
+ * one for everything the relay forwards and one per client, plus a cap on
+ * each client's write queue. A frame that doesn't fit is dropped, and the
+ * sender falls back as if the client were offline (no ack).
+ *
+ * Forwarding is the hot path: every I/O thread forwards at once, so it
+ * takes the registry lock shared and only the recipient's own bucket
+ * exclusively (and the relay-wide one, when that has a limit). There is no
+ * transport encryption to pay for: envelopes are end-to-end encrypted by
+ * their sender, and the relay never touches their bytes.
+ *
+ * Called from the session strands; thread-safe.
+ */
+class RelayHub {
+public:
+    struct Options {
+        std::size_t max_clients = 1024;
+        uint64_t bytes_per_sec = 8 * 1024 * 1024;        // all forwarding; 0 = unlimited
+        uint64_t client_bytes_per_sec = 1024 * 1024;     // to any one client; 0 = unlimited
+        std::size_t client_queue_bytes = 1024 * 1024;    // unwritten bytes per client
+        std::chrono::seconds max_clock_skew{300};        // on a registration's timestamp
+        std::size_t zerocopy_min_bytes = 0;              // client writes; 0 = always copy
+    };
+
+    /// Check `signature` over `signed_bytes` against `username`'s signing
+    /// key and call `done` once, from any thread.
+    using Verifier = std::function<void(const std::string& username, std::string signed_bytes,
+                                        std::string signature, std::function<void(bool)> done)>;
+
+    RelayHub(Options options, Verifier verify);
+
+    /// New limits (config reload); clients stay registered.
+    void set_options(Options options);
+
+    /// A relay frame read by `session`.
+    void on_frame(const std::shared_ptr<PeerSession>& session, std::string_view frame);
+
+    /// `session` closed: drop any registration it holds.
+    void on_close(const PeerSession& session);
+
+    [[nodiscard]] std::size_t clients() const;
+
+private:
+    using Clock = TokenBucket::Clock;
+
+    /// Take `bytes` from a bucket refilled at `rate` bytes a second, holding
+    /// a second's worth or one full frame, whichever is more.
+    static bool take(TokenBucket& bucket, std::size_t bytes, uint64_t rate, Clock::time_point now);
+
+    struct Client {
+        std::weak_ptr<PeerSession> session;
+        std::mutex mutex;                       // guards bucket
+        TokenBucket bucket;
+    };
+
+    /// Lets forward() look a recipient up by the view in its frame.
+    struct Hash {
+        using is_transparent = void;
+        std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    /// Drop `to`'s registration if its session has gone.
+    void forget_closed(std::string_view to);
+
+    void on_register(const std::shared_ptr<PeerSession>& session, std::string username,
+                     std::string_view body);
+    void forward(std::string_view to, std::string_view frame);
+
+    Verifier verify_;
+
+    mutable std::shared_mutex mutex_;           // guards options_ and clients_
+    Options options_;
+    std::unordered_map<std::string, Client, Hash, std::equal_to<>> clients_;
+    std::mutex total_mutex_;                    // guards total_
+    TokenBucket total_;
+};
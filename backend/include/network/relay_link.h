@@ -0,0 +1,83 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "network/inline_function.h"
+#include "telemetry/watchdog.h"
+
+class Backpressure;
+class PeerClient;
+
+/**
+ * This node's registration with a relay, for nodes peers can't dial
+ * (protocol/message_format.md §2.5).
+ *
+ * Keeps one outbound connection open to the relay and registers on it,
+ * signed with our identity key; the relay then writes every frame sent to
+ * us through it back on that connection. The registration is repeated
+ * every `refresh`, which also keeps the NAT mapping open, and a dropped
+ * connection is redialled with doubling backoff.
+ *
+ * Like PeerConnectionPool, the link runs on its own io_context and thread.
+ */
+class RelayLink {
+public:
+    struct Options {
+        std::string ip;                                  // the relay
+        uint16_t port = 0;
+        std::chrono::seconds refresh{30};
+        std::chrono::milliseconds connect_timeout{5000};
+        std::chrono::seconds max_backoff{60};
+        /// Pauses reading forwarded frames, as for inbound sessions.
+        std::shared_ptr<Backpressure> backpressure;
+    };
+
+    /// Detached Ed25519 signature of `bytes` with our signing key.
+    using Signer = std::function<std::string(const std::string& bytes)>;
+    /// An envelope frame the relay forwarded to us; `remote` names the relay.
+    /// Runs on the link's thread; `frame` is only valid for the call.
+    using FrameHandler = InlineFunction<void(const std::string& remote, std::string_view frame)>;
+
+    RelayLink(std::string username, Options options, Signer sign, FrameHandler on_frame);
+    ~RelayLink();
+
+    RelayLink(const RelayLink&) = delete;
+    RelayLink& operator=(const RelayLink&) = delete;
+
+    void start();
+    void stop();
+
+    /// Whether the link is up and registered (as far as we know).
+    [[nodiscard]] bool connected() const { return connected_; }
+
+private:
+    /// Connect, register and read until stopped.
+    asio::awaitable<void> run();
+    /// Register again every `refresh` while `client` stays open.
+    asio::awaitable<void> keep_registered(std::shared_ptr<PeerClient> client);
+    std::string registration() const;
+    void deliver(std::string_view frame);
+
+    std::string username_;
+    Options options_;
+    Signer sign_;
+    FrameHandler on_frame_;
+    std::string remote_;                        // "relay ip:port"
+
+    asio::io_context io_;
+    watchdog::Registration watched_{"relay-link", io_};
+    asio::steady_timer refresh_timer_;
+    asio::steady_timer retry_timer_;
+    std::shared_ptr<PeerClient> client_;        // link thread only
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> connected_{false};
+    std::thread thread_;
+};
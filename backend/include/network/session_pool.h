@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "network/framing.h"
+#include "telemetry/memory.h"
+
+/**
+ * Recycled storage for PeerSession: the block each session and its
+ * shared_ptr control block live in, and the read buffer its FrameReader
+ * fills.
+ *
+ * Mobile peers reconnect constantly, and every connection used to allocate
+ * and free a session and a 16 KiB buffer. Over days that churn fragments
+ * the heap and RSS creeps up. Here a closed session's memory goes on a
+ * free list and the next accepted connection takes it back, so the heap
+ * sees a new allocation only when more sessions are open at once than
+ * ever before. Both come from the huge page arena when node.huge_pages_mb
+ * sets one up (network/huge_pages.h).
+ *
+ * Up to `max_idle` of each are kept; anything beyond that is freed, so a
+ * burst of connections doesn't pin its peak forever, and none while the
+ * Pools memory budget is spent (telemetry/memory.h), which also frees the
+ * spares on demand. Thread-safe. Owned
+ * by shared_ptr: sessions hold a reference, as they may outlive the
+ * server that accepted them.
+ */
+class SessionPool {
+public:
+    struct Options {
+        std::size_t max_idle = 256;             // idle sessions (and buffers) kept
+        std::size_t buffer_size = 16 * 1024;    // a read buffer as handed out
+    };
+
+    explicit SessionPool(Options options);
+    ~SessionPool();
+
+    SessionPool(const SessionPool&) = delete;
+    SessionPool& operator=(const SessionPool&) = delete;
+
+    /// Memory for one session. Blocks are all the size of the first one
+    /// asked for; any other size goes straight to the heap.
+    void* allocate(std::size_t bytes);
+    void deallocate(void* block, std::size_t bytes);
+
+    /// A read buffer of buffer_size bytes, recycled when one is idle.
+    framing::Buffer take_buffer();
+    /// Hand a read buffer back; one that grew for a jumbo frame is
+    /// shrunk first.
+    void give_buffer(framing::Buffer buffer);
+
+    /// std::allocate_shared allocator drawing from a pool.
+    template <typename T>
+    struct Allocator {
+        using value_type = T;
+
+        explicit Allocator(std::shared_ptr<SessionPool> p) : pool(std::move(p)) {}
+        template <typename U>
+        Allocator(const Allocator<U>& other) : pool(other.pool) {}
+
+        T* allocate(std::size_t n) { return static_cast<T*>(pool->allocate(n * sizeof(T))); }
+        void deallocate(T* p, std::size_t n) { pool->deallocate(p, n * sizeof(T)); }
+
+        template <typename U>
+        bool operator==(const Allocator<U>& other) const { return pool == other.pool; }
+
+        std::shared_ptr<SessionPool> pool;
+    };
+
+private:
+    /// Free spares until `bytes` are released or none are left.
+    void trim(std::size_t bytes);
+
+    const Options options_;
+    std::mutex mutex_;
+    std::size_t block_size_ = 0;
+    std::vector<void*> idle_blocks_;
+    std::vector<framing::Buffer> idle_buffers_;
+    memory::Reclaimer reclaimer_;
+};
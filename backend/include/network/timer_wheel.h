@@ -0,0 +1,130 @@
+#pragma once
+
+#include <asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "network/inline_function.h"
+
+/**
+ * A hierarchical timer wheel: the deadlines that come and go with
+ * connections and requests — idle eviction, long-poll timeouts, handshake
+ * and connect deadlines — on one steady_timer per io_context.
+ *
+ * asio keeps every steady_timer of a context in one heap, and each wait
+ * allocates its handler. Here a timer is a node in a slab, linked into a
+ * slot list, so schedule() and cancel() are O(1) and stop allocating once
+ * the slab has grown to the most timers ever pending at once.
+ *
+ * Level 0 has 64 slots of one tick (10 ms); level k has 64 slots of 64^k
+ * ticks and holds deadlines 64^k to 64^(k+1) ticks out, pouring a slot into
+ * the levels below when the wheel reaches it. Four levels span 46 hours;
+ * anything further waits in the top level's last slot and is placed again
+ * from there. The steady_timer sleeps until the next occupied slot (found
+ * from a bitmap per level), so an empty wheel never wakes and one holding
+ * only long timers wakes a few times per lap of the level above.
+ *
+ *     auto& wheel = TimerWheel::of(session->executor());
+ *     auto idle = wheel.schedule(60s, [session] {
+ *         asio::post(session->executor(), [session] { session->abort(); });
+ *     });
+ *     ...
+ *     wheel.cancel(idle);
+ *
+ * Callbacks run on the io_context, on no strand and outside the wheel's
+ * lock; a callback that touches strand state posts to its strand. One that
+ * is already due when cancel() is called still runs (cancel() then returns
+ * false), just as with steady_timer::cancel().
+ */
+class TimerWheel : public asio::execution_context::service {
+public:
+    using Clock = std::chrono::steady_clock;
+    /// Room for an executor and a shared_ptr; capture a pointer to more.
+    using Callback = InlineFunction<void(), 8 * sizeof(void*)>;
+
+    /// A scheduled callback; default-constructed, none.
+    struct Handle {
+        uint32_t index = 0;
+        uint32_t generation = 0;        // 0: none
+
+        explicit operator bool() const { return generation != 0; }
+    };
+
+    static constexpr std::chrono::milliseconds kTick{10};
+
+    /// The wheel of `io`, made on first use. It lives as long as `io`.
+    static TimerWheel& of(asio::io_context& io);
+    /// The wheel of the io_context `ex` runs on.
+    static TimerWheel& of(const asio::any_io_executor& ex);
+
+    /// Run `callback` on the wheel's io_context once `delay` has passed,
+    /// rounded up to a whole tick. Thread-safe.
+    Handle schedule(Clock::duration delay, Callback callback);
+
+    /// Keep `handle` from running. False if it already ran or is running,
+    /// was cancelled before, or is none. Thread-safe.
+    bool cancel(Handle handle);
+
+    [[nodiscard]] std::size_t pending() const;
+
+    // asio service plumbing; use of().
+    static asio::execution_context::id id;
+    explicit TimerWheel(asio::execution_context& context);
+
+private:
+    static constexpr unsigned kLevelBits = 6;
+    static constexpr std::size_t kSlots = std::size_t{1} << kLevelBits;
+    static constexpr std::size_t kLevels = 4;
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    struct Node {
+        Callback callback;
+        uint64_t deadline = 0;          // in ticks since epoch_
+        uint32_t generation = 0;        // 0 while free
+        uint32_t prev = kNil;
+        uint32_t next = kNil;           // also the free list
+        uint32_t slot = 0;              // level * kSlots + index
+    };
+
+    void shutdown() override;
+
+    uint64_t current_tick() const;
+
+    /// Put node `i` in the slot for its deadline, relative to now_.
+    void link(uint32_t i);
+    void unlink(uint32_t i);
+    /// Take node `i` out of the wheel and move its callback to `out`.
+    void release(uint32_t i, std::vector<Callback>& out);
+    /// The same for a node already off its slot list.
+    void free_node(uint32_t i, std::vector<Callback>& out);
+
+    /// The first tick after now_ with an occupied slot to run or pour.
+    uint64_t next_tick() const;
+
+    /// Run the wheel up to `target`, collecting the callbacks due.
+    void advance(uint64_t target, std::vector<Callback>& due);
+
+    /// Point the steady_timer at next_tick() if that is sooner than it is
+    /// set for. Requires mutex_.
+    void arm_locked();
+
+    void on_timer();
+
+    const Clock::time_point epoch_ = Clock::now();
+    asio::steady_timer timer_;
+
+    mutable std::mutex mutex_;
+    std::vector<Node> nodes_;
+    uint32_t free_ = kNil;
+    std::array<uint32_t, kLevels * kSlots> heads_;
+    std::array<uint64_t, kLevels> occupied_{};  // bit i: slot i is non-empty
+    uint64_t now_ = 0;                          // the last tick run
+    uint64_t armed_for_ = UINT64_MAX;           // tick the timer is set for
+    uint32_t next_generation_ = 0;
+    std::size_t pending_ = 0;
+    bool shut_down_ = false;
+};
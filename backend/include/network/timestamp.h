@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/**
+ * The envelope timestamp format, "YYYY-MM-DDTHH:MM:SSZ" in UTC
+ * (message_format.md §3.3), without strftime, sscanf or a std::tm.
+ *
+ * Every envelope is stamped and checked for freshness with these, and
+ * every binary frame converts one each way, so both directions are plain
+ * arithmetic on fixed offsets: no locale, no time zone lookup, no
+ * allocation unless the caller asks for a std::string.
+ *
+ *   char buf[timestamp::kSize];
+ *   timestamp::format(1700000000, buf);           // "2023-11-14T22:13:20Z"
+ *   timestamp::parse("2023-11-14T22:13:20Z");     // 1700000000
+ *
+ * Years 0000–9999 only; format() clamps to that range.
+ */
+namespace timestamp {
+
+/// Characters format() writes (no terminating NUL).
+inline constexpr std::size_t kSize = 20;
+
+namespace detail {
+
+inline constexpr int64_t kMinSeconds = -62167219200;    // 0000-01-01T00:00:00Z
+inline constexpr int64_t kMaxSeconds = 253402300799;    // 9999-12-31T23:59:59Z
+
+inline constexpr std::array<char, 200> kPairs = [] {
+    std::array<char, 200> pairs{};
+    for (int i = 0; i < 100; ++i) {
+        pairs[i * 2] = static_cast<char>('0' + i / 10);
+        pairs[i * 2 + 1] = static_cast<char>('0' + i % 10);
+    }
+    return pairs;
+}();
+
+inline constexpr std::array<uint8_t, 13> kMonthDays = {0,  31, 29, 31, 30, 31, 30,
+                                                       31, 31, 30, 31, 30, 31};
+
+// Days since 1970-01-01 for a proleptic Gregorian date, and back
+// (H. Hinnant's algorithms).
+constexpr int64_t days_from_civil(int64_t y, unsigned m, unsigned d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const auto yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+struct Civil {
+    int64_t year;
+    unsigned month;
+    unsigned day;
+};
+
+constexpr Civil civil_from_days(int64_t z) {
+    z += 719468;
+    const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const auto doe = static_cast<unsigned>(z - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    const unsigned d = doy - (153 * mp + 2) / 5 + 1;
+    const unsigned m = mp < 10 ? mp + 3 : mp - 9;
+    return {static_cast<int64_t>(yoe) + era * 400 + (m <= 2), m, d};
+}
+
+constexpr void put2(char* out, unsigned v) {
+    out[0] = kPairs[v * 2];
+    out[1] = kPairs[v * 2 + 1];
+}
+
+// The two digits at `p`, or -1.
+constexpr int get2(const char* p) {
+    const unsigned a = static_cast<unsigned char>(p[0]) - '0';
+    const unsigned b = static_cast<unsigned char>(p[1]) - '0';
+    return (a < 10) & (b < 10) ? static_cast<int>(a * 10 + b) : -1;
+}
+
+} // namespace detail
+
+/// Write `seconds` since the Unix epoch to `out[0..kSize)`.
+constexpr void format(int64_t seconds, char* out) {
+    using namespace detail;
+    seconds = seconds < kMinSeconds ? kMinSeconds : seconds > kMaxSeconds ? kMaxSeconds : seconds;
+    // Floor division, so times before 1970 land on the right day.
+    const int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    const auto sod = static_cast<unsigned>(seconds - days * 86400);
+    const Civil c = civil_from_days(days);
+    const auto year = static_cast<unsigned>(c.year);
+    put2(out, year / 100);
+    put2(out + 2, year % 100);
+    out[4] = '-';
+    put2(out + 5, c.month);
+    out[7] = '-';
+    put2(out + 8, c.day);
+    out[10] = 'T';
+    put2(out + 11, sod / 3600);
+    out[13] = ':';
+    put2(out + 14, sod / 60 % 60);
+    out[16] = ':';
+    put2(out + 17, sod % 60);
+    out[19] = 'Z';
+}
+
+inline std::string format(int64_t seconds) {
+    std::string out(kSize, '\0');
+    format(seconds, out.data());
+    return out;
+}
+
+/// Seconds since the Unix epoch for "YYYY-MM-DDTHH:MM:SS", followed by
+/// nothing, "Z", or an optional fraction (ignored) and then "Z" or a
+/// "+HH:MM" / "-HH:MM" offset, as PostgREST reports them. nullopt for
+/// anything else, including impossible dates.
+constexpr std::optional<int64_t> parse(std::string_view text) {
+    using namespace detail;
+    if (text.size() < 19 || text[4] != '-' || text[7] != '-' || text[10] != 'T' ||
+        text[13] != ':' || text[16] != ':') {
+        return std::nullopt;
+    }
+    const char* p = text.data();
+    const int hi = get2(p), lo = get2(p + 2);
+    const int month = get2(p + 5), day = get2(p + 8);
+    const int hour = get2(p + 11), minute = get2(p + 14), second = get2(p + 17);
+    if (hi < 0 || lo < 0 || month < 1 || month > 12 || day < 1 || day > kMonthDays[month] ||
+        hour < 0 || hour > 23 || minute < 0 || minute > 59 || second < 0 || second > 60) {
+        return std::nullopt;
+    }
+    const int year = hi * 100 + lo;
+    if (month == 2 && day == 29 && (year % 4 != 0 || (year % 100 == 0 && year % 400 != 0))) {
+        return std::nullopt;
+    }
+    const int64_t seconds = days_from_civil(year, static_cast<unsigned>(month),
+                                      static_cast<unsigned>(day)) * 86400 +
+                      hour * 3600 + minute * 60 + second;
+
+    std::size_t i = 19;
+    if (i < text.size() && text[i] == '.') {
+        for (++i; i < text.size() && text[i] >= '0' && text[i] <= '9'; ++i) {
+        }
+    }
+    if (i == text.size()) {
+        return seconds;
+    }
+    if (text[i] == 'Z') {
+        return i + 1 == text.size() ? std::optional<int64_t>(seconds) : std::nullopt;
+    }
+    if ((text[i] != '+' && text[i] != '-') || text.size() - i != 6 || text[i + 3] != ':') {
+        return std::nullopt;
+    }
+    const int off_h = get2(p + i + 1), off_m = get2(p + i + 4);
+    if (off_h < 0 || off_h > 23 || off_m < 0 || off_m > 59) {
+        return std::nullopt;
+    }
+    const int64_t offset = off_h * 3600 + off_m * 60;
+    return text[i] == '+' ? seconds - offset : seconds + offset;
+}
+
+} // namespace timestamp
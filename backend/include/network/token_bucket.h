@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+/**
+ * A token bucket: `rate` tokens a second, holding at most `burst`, full at
+ * first use. The limits are passed in on every take() so a config reload
+ * applies to buckets that already exist. Not thread-safe; callers lock.
+ */
+struct TokenBucket {
+    using Clock = std::chrono::steady_clock;
+
+    double tokens = 0;
+    Clock::time_point refilled{};
+
+    /// Take `cost` tokens if there are that many. A rate of 0 means no limit.
+    bool take(double cost, double rate, double burst, Clock::time_point now) {
+        if (rate <= 0) {
+            return true;
+        }
+        if (refilled == Clock::time_point{}) {
+            tokens = burst;
+        } else {
+            const std::chrono::duration<double> elapsed = now - refilled;
+            tokens = std::min(burst, tokens + elapsed.count() * rate);
+        }
+        refilled = now;
+        if (tokens < cost) {
+            return false;
+        }
+        tokens -= cost;
+        return true;
+    }
+
+    /// Whether the bucket has refilled completely by `now`, i.e. holds no
+    /// state worth keeping.
+    [[nodiscard]] bool full(double rate, double burst, Clock::time_point now) const {
+        const std::chrono::duration<double> elapsed = now - refilled;
+        return rate <= 0 || tokens + elapsed.count() * rate >= burst;
+    }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * What a piece of outbound work is for, so bulk traffic can't hold up a
+ * keystroke-sized message behind it.
+ *
+ *   - Control: acks, pings, hellos, key exchanges, file offers and file
+ *     acks. Tiny, and other traffic is waiting on them.
+ *   - Interactive: chat and group messages and their retransmits.
+ *   - Bulk: file chunks and device sync.
+ *
+ * PeerClient's write loop shares each gathered write among its per-class
+ * queues by weight (deficit round robin), and bulk may only fill part of
+ * the connection's queue budget. The crypto pool and the DB thread run
+ * bulk jobs only between the others. UDP maps Bulk to its Files stream.
+ */
+enum class TrafficClass : uint8_t {
+    Control = 0,
+    Interactive = 1,
+    Bulk = 2,
+};
+
+inline constexpr std::size_t kTrafficClasses = 3;
+
+namespace traffic {
+
+inline constexpr std::size_t index(TrafficClass cls) { return static_cast<std::size_t>(cls); }
+
+/// Bytes each class may write per scheduling round, in class order. A
+/// file chunk (64 KiB by default) goes out every fourth round while chat
+/// is waiting, and back to back when nothing else is.
+inline constexpr std::array<std::size_t, kTrafficClasses> kQuantum = {64 * 1024, 64 * 1024,
+                                                                      16 * 1024};
+
+/// Share of a connection's queue budget that bulk frames may fill, so
+/// there is always room left for chat.
+inline constexpr std::size_t kBulkBudgetPercent = 75;
+
+} // namespace traffic
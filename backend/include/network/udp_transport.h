@@ -0,0 +1,202 @@
+#pragma once
+
+#include <asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "network/framing.h"
+#include "network/inline_function.h"
+#include "telemetry/watchdog.h"
+
+/**
+ * Peer frames over UDP, with hole punching (protocol/message_format.md §2.6).
+ *
+ * Every node that enables it publishes its UDP endpoint in Supabase
+ * (`users.udp`). To reach a peer we punch: send probes to its endpoint
+ * until it answers. The peer punches us from its side too (each node
+ * punches its friends every presence round), so both NATs have a mapping
+ * open and the probes meet. Once answered, the connection is established
+ * and carries frames until it goes quiet for `idle_timeout`; keepalives
+ * hold the NAT mapping open meanwhile.
+ *
+ * A connection is named by a random 64-bit id rather than by its addresses,
+ * so when a peer's address changes (a phone moving between networks) its
+ * next packet just moves the connection there: no handshake, no lost queue.
+ *
+ * Frames travel on independent reliable, ordered streams, QUIC-style: a
+ * frame is split into numbered fragments, each acknowledged on its own and
+ * resent after a timeout, and each stream reassembles in its own order. A
+ * lost file chunk therefore never holds up a chat message behind it, as it
+ * would on one TCP socket. The window of unacknowledged fragments is shared
+ * by the streams and grows and shrinks with loss (AIMD); Messages goes out
+ * before Files, and a little past a window Files has filled.
+ *
+ * Inbound frames reach the same callback shape as PeerServer's, and the
+ * send calls mirror PeerConnectionPool's, keyed by username; Node picks the
+ * transport per frame. Like the pool, the transport runs on its own
+ * io_context and thread, and every public call is thread-safe.
+ */
+class UdpTransport {
+public:
+    enum class Stream : uint8_t {
+        Messages = 0,       ///< envelopes, acks, pings, control
+        Files    = 1,       ///< file chunks and their acks
+    };
+    static constexpr std::size_t kStreams = 2;
+
+    struct Options {
+        std::string username;                   // ours, carried in punches
+        uint16_t port = 9100;
+        std::size_t max_connections = 256;
+        std::size_t send_queue_bytes = 4 * 1024 * 1024;  // per connection, unacked included
+        std::size_t max_frame_size = framing::kDefaultMaxFrameSize;
+        std::chrono::milliseconds punch_interval{200};
+        int punch_attempts = 25;
+        std::chrono::seconds keepalive{15};
+        std::chrono::seconds idle_timeout{60};
+    };
+
+    /// Same shape as PeerServer::MessageCallback; `remote` is "udp ip:port".
+    /// Runs on the transport's thread.
+    using MessageCallback = InlineFunction<void(const std::string& remote,
+                                                std::string_view payload)>;
+
+    explicit UdpTransport(Options options);
+    ~UdpTransport();
+
+    UdpTransport(const UdpTransport&) = delete;
+    UdpTransport& operator=(const UdpTransport&) = delete;
+
+    /// Set before start().
+    void set_on_message(MessageCallback cb);
+
+    /// Bind the port and start the thread; false if the port is taken.
+    bool start();
+    void stop();
+
+    /// Punch towards `username` at ip:port, unless a connection to them is
+    /// already established or punching.
+    void punch(const std::string& username, const std::string& ip, uint16_t port);
+
+    /// Whether frames to `username` can go over UDP right now.
+    [[nodiscard]] bool established(const std::string& username) const;
+
+    /// Queue one frame for `username` on `stream`. `done` (optional) runs on
+    /// the transport's thread once the frame's last fragment has been sent
+    /// the first time; resending is the transport's job from then on. Fails
+    /// if there is no connection to them or its queue is over budget.
+    void send_async(const std::string& username, std::string payload,
+                    Stream stream = Stream::Messages, std::function<void(bool ok)> done = {});
+
+    /// Blocking send_async, like PeerConnectionPool::send. Not from the
+    /// transport's own thread.
+    bool send(const std::string& username, std::string_view payload,
+              Stream stream = Stream::Messages,
+              std::chrono::milliseconds timeout = std::chrono::seconds(5));
+
+    /// Open connections, established or not.
+    [[nodiscard]] std::size_t size() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Fragment {
+        uint32_t seq = 0;
+        std::string packet;                     // the whole datagram, for resends
+        std::size_t bytes = 0;                  // payload bytes, for the queue budget
+        Clock::time_point sent{};
+        int sends = 0;
+        int overtaken = 0;                      // later fragments acked before this one
+        std::function<void(bool)> done;        // on a frame's last fragment
+    };
+
+    struct SendStream {
+        uint32_t next_seq = 0;
+        std::deque<Fragment> pending;           // not yet sent
+        std::map<uint32_t, Fragment> unacked;
+    };
+
+    struct RecvStream {
+        uint32_t next = 0;                      // every fragment below has been delivered
+        std::map<uint32_t, std::pair<bool, std::string>> early;   // seq → (last, bytes)
+        std::string partial;                    // the frame being reassembled
+    };
+
+    struct Connection {
+        uint64_t id = 0;
+        std::string username;                   // whom we punched; empty if they punched us
+        asio::ip::udp::endpoint remote;
+        std::string remote_name;                // "udp ip:port"
+        bool established = false;
+        int punches_left = 0;
+        Clock::time_point next_punch{};         // unset unless punching
+        Clock::time_point last_heard{};
+        Clock::time_point last_sent{};
+        std::array<SendStream, kStreams> send;
+        std::array<RecvStream, kStreams> recv;
+        std::size_t queued_bytes = 0;
+        std::size_t in_flight = 0;              // fragments sent and not yet acked
+        double cwnd = 16;                       // fragments allowed in flight
+        double ssthresh = 256;                  // cwnd grows by one per ack below this
+        double srtt = 0;                        // seconds; 0 = no sample yet
+        double rttvar = 0;
+        std::chrono::milliseconds rto{500};
+    };
+
+    asio::awaitable<void> receive_loop();
+    void on_packet(const asio::ip::udp::endpoint& from, std::string_view packet);
+    void on_punch(const asio::ip::udp::endpoint& from, uint64_t id, std::string_view name);
+    void on_data(Connection& conn, std::string_view body);
+    void on_ack(Connection& conn, std::string_view body);
+
+    void do_punch(const std::string& username, const asio::ip::udp::endpoint& remote);
+    void send_punch(Connection& conn, Clock::time_point now);
+    /// The last punch went unanswered: fail what was queued meanwhile.
+    void give_up(Connection& conn);
+    void do_send(const std::string& username, std::string payload, Stream stream,
+                 std::function<void(bool)> done);
+    /// Send what the window allows, Messages first.
+    void flush(Connection& conn);
+    void transmit(Connection& conn, Fragment& fragment);
+    void send_control(Connection& conn, uint8_t type, std::string_view body = {});
+    void send_raw(const asio::ip::udp::endpoint& to, std::string_view packet);
+    void sample_rtt(Connection& conn, Clock::duration rtt);
+    void set_established(Connection& conn, bool established);
+    void drop(uint64_t id);
+
+    /// Resends, punches, keepalives and idle checks: every 50 ms while
+    /// anything is in flight or punching, every second otherwise.
+    void tick();
+    void arm_timer(bool busy);
+    /// Switch to the fast tick if not on it already.
+    void wake();
+
+    Options options_;
+    MessageCallback on_message_;
+
+    asio::io_context io_;
+    watchdog::Registration watched_{"udp", io_};
+    asio::ip::udp::socket socket_;
+    asio::steady_timer timer_;
+    bool timer_busy_ = false;
+    std::thread thread_;
+
+    // Transport thread only.
+    std::unordered_map<uint64_t, std::unique_ptr<Connection>> conns_;
+    std::unordered_map<std::string, uint64_t> by_user_;
+
+    mutable std::mutex mutex_;                  // guards established_ and size_
+    std::unordered_set<std::string> established_;
+    std::size_t size_ = 0;
+};
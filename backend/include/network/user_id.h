@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * Interned usernames: a small integer per name in a process-wide table,
+ * so per-frame bookkeeping can key on a 32-bit id instead of hashing and
+ * comparing the string again in every map it passes through.
+ *
+ * Names are only interned for users this node knows (PeerDirectory adds
+ * each entry it stores, Node its own name); envelope::decode() looks the
+ * sender up without adding it and leaves None for anyone else, so spoofed
+ * names can't grow the table. Ids are dense from 1 and never reused, and a
+ * name lives as long as the process. Past kMaxUsers, intern() returns None
+ * and callers keep using the string.
+ *
+ *   const UserId id = user_id::intern("alice");
+ *   user_id::name(id);                  // "alice"
+ *
+ * Thread-safe; lookups take a shared lock, name() none at all.
+ */
+enum class UserId : uint32_t { None = 0 };
+
+namespace user_id {
+
+inline constexpr uint32_t kMaxUsers = 1u << 20;
+
+/// The id of `username`, adding it if new. None for an empty name or a
+/// full table.
+UserId intern(std::string_view username);
+
+/// The id of `username` if it was interned, else None. Never adds.
+UserId find(std::string_view username);
+
+/// The name behind `id`; empty for None. Valid for the process lifetime.
+const std::string& name(UserId id);
+
+} // namespace user_id
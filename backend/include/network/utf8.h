@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string_view>
+
+/**
+ * UTF-8 validation for message text on the receive path.
+ *
+ * Accepts exactly what RFC 3629 allows: no overlong forms, no surrogates
+ * (U+D800–U+DFFF) and nothing past U+10FFFF. Inputs of 32 bytes or more
+ * take an AVX2 (x86-64) or NEON (AArch64) path chosen once at startup;
+ * shorter ones use the scalar loop. All paths agree on every input.
+ */
+namespace utf8 {
+
+/// True if `text` is well-formed UTF-8.
+bool valid(std::string_view text);
+
+/// Name of the accelerated path in use ("avx2", "neon" or "scalar").
+const char* implementation();
+
+namespace scalar {
+/// Portable reference implementation (exposed for tests and benchmarks).
+bool valid(std::string_view text);
+} // namespace scalar
+
+} // namespace utf8
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <asio.hpp>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
+
+/**
+ * MSG_ZEROCOPY writes for large gathered batches on a TCP socket (Linux).
+ *
+ * A plain send copies every byte into the socket buffer. With
+ * MSG_ZEROCOPY the kernel instead pins the pages and sends from them, so
+ * the caller's buffers must stay untouched until the kernel reports them
+ * released through the socket's error queue — which can be well after the
+ * write itself has completed. retain() takes ownership of them until then.
+ *
+ *     if (zerocopy_.wants(bytes)) {
+ *         zerocopy_.async_write(socket_, buffers, [self](auto ec) { ... });
+ *     }
+ *     ...                                   // in the completion, after callbacks:
+ *     zerocopy_.retain(std::exchange(inflight_, {}));
+ *
+ * Pinning only pays off for large writes, so wants() is true from
+ * `min_bytes` up. If the kernel reports that it copied anyway (loopback,
+ * or a NIC without scatter-gather), the sender turns itself off for the
+ * rest of the connection. Elsewhere than Linux enable() returns false and
+ * wants() is never true.
+ *
+ * One write at a time, on the socket's executor (or strand); not
+ * thread-safe.
+ */
+class ZeroCopySender {
+public:
+    using Completion = std::function<void(const asio::error_code&)>;
+
+    ZeroCopySender();
+    ~ZeroCopySender();
+
+    ZeroCopySender(const ZeroCopySender&) = delete;
+    ZeroCopySender& operator=(const ZeroCopySender&) = delete;
+
+    /// Turn on SO_ZEROCOPY for the connected `socket`, for writes of at
+    /// least `min_bytes`. False where the platform or kernel lacks it.
+    bool enable(asio::ip::tcp::socket& socket, std::size_t min_bytes);
+
+    /// Whether a batch of `bytes` should go through async_write().
+    [[nodiscard]] bool wants(std::size_t bytes) const;
+
+    /// Write all of `buffers` to the socket passed to enable(); `done` runs
+    /// once the kernel has taken every byte. The buffers must then be
+    /// handed to retain().
+    void async_write(std::span<const asio::const_buffer> buffers, Completion done);
+
+    /// Keep `buffers` (whatever owns the memory of the last write) alive
+    /// until the kernel has released its pages.
+    template <typename T>
+    void retain(T buffers) {
+        retain_erased(std::make_shared<T>(std::move(buffers)));
+    }
+
+private:
+    struct State;
+
+    void retain_erased(std::shared_ptr<void> buffers);
+
+    std::shared_ptr<State> state_;              // shared with pending handlers
+};
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "network/envelope.h"
+
+/**
+ * Messages sent directly that the peer has not acknowledged yet
+ * (protocol/message_format.md §9, "ack").
+ *
+ * Each one is retransmitted with exponential backoff, starting at
+ * `ack_timeout`, until its ack arrives; after `max_retries` retransmits
+ * it is handed to the give-up callback (the Supabase offline queue).
+ *
+ * Deadlines live in a hashed timer wheel driven by one steady_timer, so
+ * tracking, acking and expiring are O(1) however many messages are in
+ * flight. An ack only erases the message's entry; its slot reference is
+ * dropped when the wheel next reaches it. The timer only runs while
+ * something is pending.
+ *
+ * A message sent under a session key (crypto/peer_sessions.h) can't go to
+ * Supabase as it is, and is useless once the session is gone; it is tracked
+ * with a reseal callback that builds the signed envelope instead, run only
+ * if it is needed.
+ */
+class AckTracker {
+public:
+    struct Options {
+        std::chrono::milliseconds ack_timeout{2000};    // before the first retransmit
+        std::chrono::milliseconds max_backoff{60000};
+        int max_retries = 4;
+        std::chrono::milliseconds tick{250};            // wheel resolution
+        std::size_t slots = 256;
+    };
+
+    /// Send `envelope` again. Called on the timer's executor.
+    using Retransmit = std::function<void(const std::string& msg_id, const Envelope& envelope)>;
+    /// Out of retries. Called on the timer's executor.
+    using GiveUp = std::function<void(const std::string& msg_id, Envelope envelope)>;
+    /// The message as a signed envelope, or nullopt if that fails.
+    using Reseal = std::function<std::optional<Envelope>()>;
+
+    AckTracker(asio::io_context& io, Options options, Retransmit retransmit, GiveUp give_up);
+
+    /// Start waiting for the ack of `msg_id`, sent (or about to be sent)
+    /// as `envelope`. With `reseal`, the give-up callback gets its result
+    /// rather than `envelope`. Thread-safe.
+    void track(std::string msg_id, Envelope envelope, Reseal reseal = {});
+
+    /// Replace `msg_id`'s envelope with its resealed one from now on, and
+    /// return it; nullopt if it isn't pending, has no reseal callback or
+    /// the callback fails. Thread-safe.
+    std::optional<Envelope> reseal(const std::string& msg_id);
+
+    /// The peer acknowledged `msg_id`. Returns false if it wasn't pending
+    /// (already acked, given up on, or never tracked). Thread-safe.
+    bool acknowledge(const std::string& msg_id);
+
+    /// Stop tracking `msg_id` without an ack, e.g. because the send that
+    /// track() anticipated failed. Thread-safe.
+    void cancel(const std::string& msg_id);
+
+    /// Forget everything pending and stop the timer.
+    void stop();
+
+    /// Hand everything pending to the give-up callback now, as if it had
+    /// run out of retries, and stop: on shutdown, what the peer hasn't
+    /// acknowledged goes to the offline queue instead of being forgotten.
+    /// Runs the callbacks on the calling thread. Returns how many.
+    std::size_t give_up_all();
+
+    [[nodiscard]] std::size_t pending() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Envelope envelope;
+        Reseal reseal;
+        uint64_t deadline = 0;        // in ticks
+        uint32_t generation = 0;      // matches the live slot reference
+        int retries = 0;
+    };
+
+    struct SlotRef {
+        std::string msg_id;
+        uint32_t generation;
+    };
+
+    uint64_t now_tick() const;
+    std::chrono::milliseconds backoff(int retries) const;
+
+    /// Put `id` in the slot for `entry.deadline`. Requires mutex_.
+    void schedule_locked(const std::string& id, Entry& entry);
+
+    /// Arm the timer for the next tick if it isn't running. Requires mutex_.
+    void arm_locked();
+
+    void on_tick();
+
+    /// Pass `expired` to give_up_, resealing where asked.
+    void give_up(std::vector<std::tuple<std::string, Envelope, Reseal>>& expired);
+
+    Options options_;
+    Retransmit retransmit_;
+    GiveUp give_up_;
+    asio::steady_timer timer_;
+    const Clock::time_point epoch_ = Clock::now();
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::vector<std::vector<SlotRef>> wheel_;
+    uint64_t processed_tick_;         // every slot up to here has been run
+    uint32_t next_generation_ = 0;
+    bool armed_ = false;
+    bool stopped_ = false;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sodium.h>
+
+#include "storage/disk_file.h"
+
+/**
+ * Content-addressed state behind FileTransfers, keyed by the BLAKE2b-256
+ * hash (crypto_generichash) of a file's content.
+ *
+ * Sending: the first transfer of some content to a peer that advertised
+ * `file_share_v1` opens a Shared stream for it, with one secretstream key
+ * and header. Every chunk of that stream is sealed once, when the first
+ * transfer reaches it, and appended to a spool file `<dir>/<hash>.sealed`;
+ * any other transfer of the same content reads the sealed bytes back from
+ * there. Forwarding a video to ten friends encrypts it once. The additional
+ * data of a shared chunk is the hash and offset rather than the transfer id,
+ * so the sealed bytes are the same for every recipient. Keys live in memory
+ * only; a stream nobody has used for `keep` is dropped with its spool.
+ *
+ * Receiving: every completed download is recorded by hash in `<dir>/received`,
+ * so an offer of content already on disk needs no chunks at all.
+ *
+ * Owned by FileTransfers and used on its thread only; not thread-safe.
+ */
+class AttachmentStore {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Hash = std::array<uint8_t, crypto_generichash_BYTES>;
+
+    static constexpr std::size_t kSealBytes = crypto_secretstream_xchacha20poly1305_ABYTES;
+
+    struct Shared {
+        Hash hash{};
+        std::array<uint8_t, crypto_secretstream_xchacha20poly1305_KEYBYTES> key{};
+        std::array<uint8_t, crypto_secretstream_xchacha20poly1305_HEADERBYTES> header{};
+        uint64_t size = 0;
+        std::size_t chunk_size = 0;
+        DiskFile source;
+        DiskFile spool;
+        crypto_secretstream_xchacha20poly1305_state state{};
+        uint64_t sealed = 0;                    // content bytes sealed so far
+        uint64_t spooled = 0;                   // of which readable from the spool
+        bool failed = false;                    // never handed out again
+        int users = 0;                          // outgoing transfers streaming it
+        Clock::time_point last_used;
+    };
+
+    AttachmentStore(std::filesystem::path dir, std::chrono::seconds keep);
+    ~AttachmentStore();                         // wipes keys, removes spools
+
+    AttachmentStore(const AttachmentStore&) = delete;
+    AttachmentStore& operator=(const AttachmentStore&) = delete;
+
+    /// Hash the first `size` bytes of `file`, reading through `buffer`.
+    /// nullopt if the file ends first.
+    static std::optional<Hash> hash_file(DiskFile& file, uint64_t size,
+                                         std::vector<uint8_t>& buffer);
+
+    static std::string hex(const Hash& hash);
+    /// Parse 64 hex characters; nullopt otherwise.
+    static std::optional<Hash> parse(std::string_view hex);
+
+    /// Read the received index and clear spools left by an earlier run.
+    void load();
+
+    /// The shared stream of `hash` in chunks of `chunk_size`, sealing from
+    /// `path` on first use. Null if it failed before, was opened with
+    /// another chunk size, or its spool can't be created. Pair with release().
+    Shared* share(const Hash& hash, const std::filesystem::path& path, uint64_t size,
+                  std::size_t chunk_size);
+    void release(Shared& shared);
+
+    /// The sealed chunk at `offset` into `out` (its content length plus
+    /// kSealBytes). Seals it from the source if no transfer got this far
+    /// yet. False if the source can't be read (marking the stream failed)
+    /// or the chunk is neither in the spool nor next to seal.
+    bool sealed_chunk(Shared& shared, uint64_t offset, std::span<uint8_t> out,
+                      std::vector<uint8_t>& buffer);
+
+    /// Additional data of a shared chunk: the first 16 bytes of the hash
+    /// and the offset, big-endian.
+    static void additional_data(const Hash& hash, uint64_t offset, uint8_t out[24]);
+
+    /// Drop shared streams idle for `keep`.
+    void sweep(Clock::time_point now);
+
+    /// Where content `hash` of `size` bytes was last saved, if it is still
+    /// there unchanged.
+    [[nodiscard]] std::optional<std::filesystem::path> find(const Hash& hash, uint64_t size) const;
+    /// Record a completed download.
+    void remember(const Hash& hash, uint64_t size, const std::filesystem::path& path);
+
+private:
+    struct Received {
+        uint64_t size = 0;
+        int64_t mtime = 0;                      // file_time ticks when it was saved
+        std::filesystem::path path;
+    };
+
+    std::filesystem::path spool_path(const Hash& hash) const;
+    void drop(std::map<Hash, Shared>::iterator it);
+
+    std::filesystem::path dir_;
+    std::chrono::seconds keep_;
+    std::map<Hash, Shared> shared_;             // stable addresses for Outgoing
+    std::map<Hash, Received> received_;
+};
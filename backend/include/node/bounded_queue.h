@@ -0,0 +1,80 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <memory>
+
+/**
+ * Bounded lock-free queue after D. Vyukov's array queue: each cell's
+ * sequence number says whether it is free for the push at that position or
+ * holds the value for the pop there. Producers claim positions with a CAS;
+ * the single consumer could use a plain load but shares the same code.
+ *
+ * Many producers, one consumer: CryptoWorkers' job queues and the event
+ * bus stages (node/event_bus.h).
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(std::size_t capacity)
+        : mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+          cells_(new Cell[mask_ + 1]) {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /// Moves from `value` only on success.
+    bool try_push(T& value) {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = std::move(value);
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;                    // full
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& out) {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const std::size_t seq = cell.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(cell.value);
+                    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;                    // empty
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> seq;
+        T value;
+    };
+
+    const std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/**
+ * How to deliver a message to a friend: dial them, go to the offline
+ * mailbox, or both at once.
+ *
+ * Without it every send dials first and queues the offline copy only after
+ * three quarters of the connect timeout, which for a friend who has been
+ * gone for a week is seconds of "sending" before the inevitable. Node asks
+ * choose() before opening the route, with what it knows right now: whether
+ * a connection is up, whether presence has heard from the friend, and how
+ * long ago they were last seen anywhere. The rest is learned: every connect
+ * Node opens for a send is record()ed, and each friend keeps a moving
+ * average of how often their connects succeed (`weight` for the newest).
+ *
+ *  - Direct: a connection is up, or the friend is online and their
+ *    connects usually work. Today's behaviour, fallback timer included.
+ *  - Both: the offline copy is queued at once and the direct copy follows
+ *    if the connect succeeds; the peer keeps one of the two by msg_id.
+ *    For a friend who is online but flaky, or looks away but has answered
+ *    connects recently.
+ *  - Offline: looks away (not heard, last seen over `stale_after` ago) and
+ *    connects to them have kept failing. No connect at all, except one
+ *    send per `probe_every` that goes as Both, so a friend who is back is
+ *    noticed without waiting for presence.
+ *
+ * Estimates live in memory only; an unknown friend starts at `prior`. The
+ * predictor only decides; Node sends. Thread-safe.
+ */
+class DeliveryPredictor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        double prior = 0.7;                     // of a new friend: Direct while online
+        double weight = 0.3;                    // of the newest outcome
+        double both_below = 0.6;                // online and below: Both
+        double offline_below = 0.15;            // away and below: Offline
+        std::chrono::seconds stale_after{10 * 60};
+        std::chrono::seconds probe_every{60};
+    };
+
+    enum class Path { Direct, Both, Offline };
+
+    /// What Node knows about the friend at send time.
+    struct Signals {
+        bool connected = false;                 // a pooled, linked or UDP connection is up
+        bool online = false;                    // PresenceTable::is_online
+        std::optional<std::chrono::seconds> seen_ago;   // newest of last_heard and last_seen
+    };
+
+    explicit DeliveryPredictor(Options options);
+
+    [[nodiscard]] Path choose(const std::string& peer, const Signals& signals,
+                              Clock::time_point now = Clock::now());
+
+    /// The outcome of a connect opened for a send to `peer`.
+    void record(const std::string& peer, bool ok);
+
+    /// `peer`'s estimated connect success rate.
+    [[nodiscard]] double success_rate(const std::string& peer) const;
+
+private:
+    struct Entry {
+        double rate = 0;
+        Clock::time_point probed_at{};
+    };
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include "storage/message_store.h"
+
+/**
+ * History sync between one user's own devices (protocol/message_format.md
+ * §9, "Device sync").
+ *
+ * A user running the node on a laptop and a desktop gets a different
+ * history on each: whatever arrived while one was off is only on the
+ * other. Every `interval`, each device compares its `messages` table with
+ * every other one in `devices`, top-down over MessageStore's range
+ * digests, and only the rows one side lacks cross the wire:
+ *
+ *   ranges (months)  ──►   differing months
+ *                    ◄──   ranges (days within them)
+ *   ids (of the differing days)  ──►
+ *                    ◄──   rows the sender lacks, want: ids it lacks
+ *   rows  ──►
+ *
+ * Histories that match cost one small frame. A device that was off for a
+ * week differs in about seven days, so it gets their ids and then the
+ * missing rows in a few large batches rather than message by message.
+ * There is no log or clock to keep: the digests are a function of the
+ * rows, so devices that also receive from friends on their own converge
+ * all the same.
+ *
+ * Deletions are not synced. A message deleted on one device comes back
+ * from another unless it was a received one, whose seen id keeps it out.
+ *
+ * Node seals and sends the messages built here (Send) and hands incoming
+ * ones to on_message(). Every message names the address to answer to.
+ * Must be owned by a shared_ptr: store callbacks hold a weak reference.
+ * Thread-safe.
+ */
+class DeviceSync : public std::enable_shared_from_this<DeviceSync> {
+public:
+    struct Options {
+        std::vector<std::string> devices;       // "ip" or "ip:port" of each other device
+        std::string self;                       // this device's address, as they dial it
+        std::chrono::seconds interval{300};
+        std::size_t batch_bytes = 256 * 1024;   // message text per `rows` message
+        std::size_t max_ids = 8192;             // msg_ids per `ids` or `want` message
+    };
+
+    /// Deliver `message` (a sync payload) to the device at `address`.
+    using Send = std::function<void(const std::string& address, const nlohmann::json& message)>;
+    /// Rows copied in from another device; `count` were new.
+    using Imported = std::function<void(std::size_t count)>;
+
+    /// The timer runs on `io`.
+    DeviceSync(asio::io_context& io, MessageStore& store, Options options, Send send,
+               Imported imported = {});
+
+    /// Start a round with every device now and every `interval` after.
+    void start();
+    void stop();
+
+    /// A verified, decompressed sync payload from one of our devices.
+    void on_message(std::string_view payload);
+
+private:
+    /// Send our month digests to `device`.
+    void begin_round(const std::string& device);
+    void on_ranges(const std::string& reply_to, std::size_t level,
+                   const std::vector<std::string>& within,
+                   std::vector<MessageStore::RangeDigest> theirs);
+    void on_ids(const std::string& reply_to, const std::vector<std::string>& days,
+                std::vector<std::string> theirs);
+    /// Send the rows for `msg_ids`, batch_bytes at a time.
+    void send_rows(const std::string& reply_to, std::vector<std::string> msg_ids);
+    void on_rows(const nlohmann::json& rows);
+
+    void send(const std::string& address, nlohmann::json message) const;
+    void arm();
+
+    Options options_;
+    MessageStore& store_;
+    Send send_;
+    Imported imported_;
+
+    std::mutex mutex_;
+    asio::steady_timer timer_;                  // guarded by mutex_
+    bool stopped_ = false;
+};
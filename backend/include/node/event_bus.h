@@ -0,0 +1,131 @@
+#pragma once
+
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "network/backpressure.h"
+#include "network/inline_function.h"
+#include "node/bounded_queue.h"
+#include "telemetry/metrics.h"
+
+/**
+ * Typed events between subsystems, so a slow consumer never runs on the
+ * producer's thread.
+ *
+ * A Topic carries one event type to any number of stages. Each stage is a
+ * consumer with its own bounded lock-free queue (node/bounded_queue.h),
+ * drained on its own executor. publish() copies the event into every
+ * stage's queue and returns at once. A stage whose queue is full drops the
+ * event, and the drop is counted. Each stage's backlog and drops are on
+ * /metrics as p2p_event_<stage>_queue_depth and
+ * p2p_event_<stage>_dropped_total, so a stage that falls behind shows up
+ * there and not as a stalled I/O thread. A stage given a Backpressure
+ * pauses peer reads once its queue is three quarters full, until it is
+ * down to a quarter, so a burst of peer traffic waits in the kernel rather
+ * than being dropped here.
+ *
+ *     Topic<UiEvent> ui;
+ *     ui.subscribe("ws", asio::make_strand(pool.next()), [&](UiEvent& e) { ... });
+ *     ui.publish({"new_message", data});
+ *
+ * Subscribe before the first publish. publish() is thread-safe. A stage's
+ * handler runs on its executor, one event at a time and in publish order.
+ */
+template <typename Event>
+class Topic {
+public:
+    using Handler = InlineFunction<void(Event& event)>;
+
+    /// Handlers run this many events before yielding the executor.
+    static constexpr std::size_t kDrainBatch = 64;
+
+    Topic() = default;
+    Topic(const Topic&) = delete;
+    Topic& operator=(const Topic&) = delete;
+
+    /// Add a stage named `name` (a metric name fragment) that runs
+    /// `handler` on `executor`, with room for `depth` unhandled events,
+    /// whose backlog counts towards `backpressure` if given.
+    void subscribe(const std::string& name, asio::any_io_executor executor, Handler handler,
+                   std::size_t depth = 1024, Backpressure* backpressure = nullptr) {
+        auto stage = std::make_shared<Stage>(name, std::move(executor), std::move(handler), depth);
+        if (backpressure) {
+            stage->level = &backpressure->level("event_" + name, depth * 3 / 4, depth / 4);
+        }
+        stages_.push_back(std::move(stage));
+    }
+
+    void publish(Event event) {
+        for (std::size_t i = 0; i < stages_.size(); ++i) {
+            if (i + 1 == stages_.size()) {
+                stages_[i]->push(stages_[i], event);
+            } else {
+                Event copy = event;
+                stages_[i]->push(stages_[i], copy);
+            }
+        }
+    }
+
+private:
+    struct Stage {
+        Stage(const std::string& name, asio::any_io_executor ex, Handler fn, std::size_t depth)
+            : executor(std::move(ex)),
+              handler(std::move(fn)),
+              queue(depth),
+              queued(metrics::gauge("p2p_event_" + name + "_queue_depth",
+                                    "Events waiting for the " + name + " stage")),
+              dropped(metrics::counter("p2p_event_" + name + "_dropped_total",
+                                       "Events the " + name + " stage had no room for")) {}
+
+        void push(const std::shared_ptr<Stage>& self, Event& event) {
+            pending.fetch_add(1);               // before the push, so a drain never sees it uncounted
+            if (!queue.try_push(event)) {
+                pending.fetch_sub(1);
+                dropped.inc();
+                return;
+            }
+            queued.add(1);
+            if (level) level->add(1);
+            schedule(self);
+        }
+
+        void schedule(const std::shared_ptr<Stage>& self) {
+            if (!scheduled.exchange(true)) {
+                asio::post(executor, [self] { self->drain(self); });
+            }
+        }
+
+        void drain(const std::shared_ptr<Stage>& self) {
+            Event event;
+            for (std::size_t i = 0; i < kDrainBatch && queue.try_pop(event); ++i) {
+                pending.fetch_sub(1);
+                queued.add(-1);
+                if (level) level->add(-1);
+                handler(event);
+            }
+            // A push that saw `scheduled` still set has already counted
+            // itself in `pending`, so it is picked up here.
+            scheduled.store(false);
+            if (pending.load() > 0) {
+                schedule(self);
+            }
+        }
+
+        asio::any_io_executor executor;
+        Handler handler;
+        BoundedQueue<Event> queue;
+        std::atomic<std::size_t> pending{0};
+        std::atomic<bool> scheduled{false};     // a drain is posted or running
+        metrics::Gauge& queued;
+        metrics::Counter& dropped;
+        Backpressure::Level* level = nullptr;
+    };
+
+    std::vector<std::shared_ptr<Stage>> stages_;
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <asio.hpp>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+#include <sodium.h>
+
+#include "network/envelope.h"
+#include "node/attachment_store.h"
+#include "storage/disk_file.h"
+#include "telemetry/watchdog.h"
+
+/**
+ * Streamed file transfers between friends (protocol/message_format.md §9,
+ * "File transfer").
+ *
+ * A file goes out as fixed-size chunks read from disk one at a time and
+ * sealed with crypto_secretstream_xchacha20poly1305 under a per-transfer
+ * key. The key travels in the `file_offer`, which Node seals with
+ * crypto_box like a message. The receiver writes each chunk straight to
+ * `<download_dir>/<transfer_id>.part` and renames it when the final chunk
+ * arrives. Neither side ever holds more than one chunk, plus the sender's
+ * window of chunks queued on the connection, so memory use doesn't depend on
+ * the file size.
+ *
+ * Flow control: the sender keeps at most `window_chunks` unacknowledged
+ * chunks in flight; the receiver acks every half window. A `file_ack` with
+ * the restart flag (re)starts the stream at its offset with a fresh
+ * secretstream header. Receivers send one to accept, to resume a `.part`
+ * left by an earlier attempt, and whenever a chunk fails to open. A sender
+ * that hears nothing for `stall_timeout` offers the file again, which a
+ * receiver already streaming answers with a restart at its offset. After
+ * `max_stalls` silent rounds the transfer fails.
+ *
+ * Offers name the file's content by its BLAKE2b hash (node/attachment_store.h).
+ * The receiver checks what it wrote against it, and accepting content it
+ * already has completes at once without a chunk. Towards peers that take
+ * shared streams, a file is sealed once for all its transfers: their
+ * chunks from offset 0 come from the content's spool, and only a stream
+ * restarted elsewhere is sealed for its own transfer.
+ *
+ * All state lives on a dedicated thread, so disk I/O never runs on the
+ * peer or API threads. Public methods are thread-safe.
+ */
+class FileTransfers {
+public:
+    struct Options {
+        std::filesystem::path download_dir = "downloads";
+        std::size_t chunk_size = 64 * 1024;
+        std::size_t window_chunks = 8;
+        std::chrono::seconds stall_timeout{15};
+        int max_stalls = 20;                     // also how long an offer waits to be accepted
+        /// Hash files and share their sealed streams (AttachmentStore).
+        bool content_addressed = true;
+        /// Spools and the received index; empty means `<download_dir>/.attachments`.
+        std::filesystem::path attachment_dir;
+        /// How long a shared stream outlives its last transfer.
+        std::chrono::seconds share_keep{3600};
+    };
+
+    /// Largest chunk a receiver accepts; keeps a chunk frame far below the
+    /// peer frame limit even as base64 JSON.
+    static constexpr std::size_t kMaxChunkSize = 256 * 1024;
+
+    /// What a `file_offer` carries inside its crypto_box.
+    struct Offer {
+        std::string transfer_id;                 // 32 hex characters
+        std::string name;
+        uint64_t size = 0;
+        std::size_t chunk_size = 0;
+        std::array<uint8_t, crypto_secretstream_xchacha20poly1305_KEYBYTES> key{};
+        std::optional<AttachmentStore::Hash> hash; // of the content; older senders leave it out
+    };
+
+    /// The offer's plaintext payload.
+    static std::string offer_payload(const Offer& offer);
+    /// Parse and validate an offer payload; nullopt if it is malformed.
+    static std::optional<Offer> parse_offer(std::string_view payload);
+
+    /// How frames leave; Node seals, signs and encodes them. Called on the
+    /// transfer thread.
+    struct Transport {
+        std::function<void(const std::string& to, const Offer& offer)> send_offer;
+        /// `file_chunk`, `file_ack` or `file_cancel` with `body` as its ciphertext.
+        std::function<void(const std::string& to, EnvelopeType type, std::string body)> send;
+        /// Whether `to` opens shared streams (`file_share_v1`).
+        std::function<bool(const std::string& to)> shares;
+    };
+
+    /// file_offer / file_done UI events (docs/websocket-events-guide.md §2).
+    using EventCallback = std::function<void(std::string_view event, const nlohmann::json& data)>;
+
+    FileTransfers(Options options, Transport transport, EventCallback on_event);
+    ~FileTransfers();                            // keeps .part files for a later resume
+
+    FileTransfers(const FileTransfers&) = delete;
+    FileTransfers& operator=(const FileTransfers&) = delete;
+
+    /// Offer the regular file at `path` to `to`. Returns the transfer id,
+    /// or nullopt if the file can't be read.
+    std::optional<std::string> send(const std::string& to, const std::filesystem::path& path);
+
+    /// Accept an offer. False if `transfer_id` isn't a pending offer or
+    /// its .part file can't be opened.
+    bool accept(const std::string& transfer_id);
+
+    /// Cancel a transfer in either direction and tell the peer. False if
+    /// there is no such transfer.
+    bool cancel(const std::string& transfer_id);
+
+    /// Frames from `from`. Offers have been opened and acks and cancels
+    /// verified by Node; chunks are authenticated here by the stream.
+    void on_offer(const std::string& from, Offer offer);
+    void on_chunk(const std::string& from, std::vector<uint8_t> body);
+    void on_ack(const std::string& from, std::vector<uint8_t> body);
+    void on_cancel(const std::string& from, std::vector<uint8_t> body);
+
+    /// Stop the stall timer; unfinished transfers stay resumable.
+    void stop();
+
+private:
+    using StreamState = crypto_secretstream_xchacha20poly1305_state;
+    using Clock = std::chrono::steady_clock;
+
+    struct Outgoing {
+        std::string to;
+        Offer offer;
+        DiskFile file;
+        AttachmentStore::Shared* shared = nullptr; // the content's stream, if `to` takes it
+        bool streaming = false;                  // the receiver asked for chunks
+        bool shared_stream = false;              // streaming from `shared`
+        bool final_sent = false;
+        bool header_due = false;                 // next chunk opens a new stream
+        uint64_t sent = 0;                       // next offset to send
+        uint64_t acked = 0;                      // the receiver has everything below
+        StreamState state{};
+        Clock::time_point last_heard;
+        int stalls = 0;
+    };
+
+    struct Incoming {
+        std::string from;
+        Offer offer;
+        DiskFile file;
+        bool accepted = false;
+        bool streaming = false;                  // a stream header has been read
+        bool shared_stream = false;              // ... of the content's shared stream
+        crypto_generichash_state digest{};       // of bytes 0..received, with a hash offer
+        uint64_t received = 0;                   // bytes written to the .part file
+        uint64_t acked = 0;                      // last offset acked to the sender
+        StreamState state{};
+        Clock::time_point last_heard;
+    };
+
+    /// Run `fn` on the transfer thread and wait for its result.
+    template <typename Fn>
+    auto call(Fn fn) -> decltype(fn());
+
+    /// Send chunks until the window is full or the file is out.
+    void pump(Outgoing& out);
+    void restart(Outgoing& out, uint64_t offset);
+
+    /// Ack what has been written; a restart also drops the current stream
+    /// so only a fresh header at `received` is read after it.
+    void send_ack(Incoming& in, bool restart);
+    /// Start hashing from the .part file's first `in.received` bytes.
+    bool hash_part(Incoming& in);
+    /// Rename the finished .part file into the download directory.
+    void complete(Incoming& in);
+
+    void finish_outgoing(const std::string& id, std::string_view status);
+    void finish_incoming(const std::string& id, std::string_view status, bool keep_part);
+
+    std::filesystem::path part_path(const std::string& id) const;
+
+    void arm_sweep();
+    void sweep();
+
+    Options options_;
+    Transport transport_;
+    EventCallback on_event_;
+
+    std::unordered_map<std::string, Outgoing> outgoing_;   // by transfer id; transfer thread only
+    std::unordered_map<std::string, Incoming> incoming_;
+    std::vector<uint8_t> buffer_;                          // one chunk; transfer thread only
+    AttachmentStore store_;                                // transfer thread only
+    bool stopped_ = false;                                 // transfer thread only
+
+    asio::io_context io_;
+    watchdog::Registration watched_{"file-transfers", io_};
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    asio::steady_timer sweep_timer_;
+    std::thread thread_;
+};
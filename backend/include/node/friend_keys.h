@@ -0,0 +1,51 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Friends' public keys as a flat, read-only table for the verify path.
+ *
+ * Each friend is a 64-bit hash of their username in one sorted array and
+ * their X25519 + Ed25519 keys, one cache line, at the same index in
+ * another. A lookup is a binary search over the hashes (a few lines for
+ * hundreds of friends), a check of the username against the copy kept in
+ * a third array, and the one line of keys. There are no per-friend
+ * allocations or locks to go through, unlike PeerDirectory's entries.
+ *
+ * Never modified once built: PeerDirectory builds a new table whenever
+ * the friend list changes and publishes it through an RcuCell, so a Keys
+ * pointer stays valid for as long as the directory does.
+ */
+class FriendKeys {
+public:
+    struct alignas(64) Keys {
+        std::array<uint8_t, 32> public_key;     // X25519
+        std::array<uint8_t, 32> signing_key;    // Ed25519
+    };
+
+    /// Add a friend. Returns false, adding nothing, unless both keys are
+    /// 32 bytes. Call sort() after the last one.
+    bool add(std::string_view username, std::span<const uint8_t> public_key,
+             std::span<const uint8_t> signing_key);
+
+    /// Order the table for find().
+    void sort();
+
+    /// `username`'s keys, or null if they aren't in the table.
+    [[nodiscard]] const Keys* find(std::string_view username) const;
+
+    [[nodiscard]] std::size_t size() const { return hashes_.size(); }
+
+private:
+    static uint64_t hash(std::string_view username);
+
+    std::vector<uint64_t> hashes_;              // ascending after sort()
+    std::vector<Keys> keys_;                    // same order as hashes_
+    std::vector<std::string> usernames_;        // same order; tells colliding hashes apart
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sodium.h>
+
+#include "storage/message_store.h"
+
+/**
+ * Group conversations with sender keys (protocol/message_format.md §9,
+ * "Group chat").
+ *
+ * Each member seals its group messages with a random crypto_secretbox
+ * key of its own, its sender key. The key reaches each other member once,
+ * in a `group_key` envelope that Node seals with crypto_box like a
+ * message. After that, a message to a group of N costs one secretbox and
+ * one signature whatever N is, and every member gets the same frame.
+ * Without sender keys it would take N crypto_box seals and N signatures.
+ *
+ * Membership is set by the creator: the first grant a member receives for
+ * a group brings the group, and later grants can change the name or
+ * members only if they come from the creator.
+ *
+ * Groups and every known sender key live in memory, backed by
+ * MessageStore. Node builds the envelopes, signs them and sends them.
+ * Thread-safe.
+ */
+class GroupChat {
+public:
+    using Group = MessageStore::Group;
+    using Key = std::array<uint8_t, crypto_secretbox_KEYBYTES>;
+
+    /// Largest group, ourselves included.
+    static constexpr std::size_t kMaxMembers = 256;
+
+    /// What a `group_key` carries inside its crypto_box: the group as its
+    /// sender knows it, and the sender's key.
+    struct Grant {
+        Group group;                             // created_at is not sent
+        Key key{};
+    };
+
+    /// The grant's plaintext payload.
+    static std::string grant_payload(const Grant& grant);
+    /// Parse and validate a grant payload; nullopt if it is malformed.
+    static std::optional<Grant> parse_grant(std::string_view payload);
+
+    /// `self` is the local username.
+    GroupChat(MessageStore& store, std::string self);
+    ~GroupChat();   // wipes every key
+
+    GroupChat(const GroupChat&) = delete;
+    GroupChat& operator=(const GroupChat&) = delete;
+
+    /// Read the groups and sender keys from the store. Blocks; for startup.
+    void load();
+
+    /// A new group of `members` plus ourselves, stored. Our sender key is
+    /// made on the first send.
+    Group create(std::string name, std::vector<std::string> members);
+
+    [[nodiscard]] std::optional<Group> find(const std::string& group_id) const;
+    [[nodiscard]] std::vector<Group> list() const;
+
+    static bool is_member(const Group& group, const std::string& username);
+
+    /// Seal `plaintext` for `group_id` with our sender key, making it on
+    /// first use. Returns nonce (24 bytes) || ciphertext, or empty if we
+    /// are not a member.
+    std::string seal(const std::string& group_id, std::string_view plaintext);
+
+    /// Our grant for `group_id`, for the members take_ungranted() returns;
+    /// makes our sender key if there is none yet. nullopt if we are not a
+    /// member.
+    std::optional<Grant> own_grant(const std::string& group_id);
+
+    /// Members other than us who have not been sent our sender key since
+    /// it was made or since this process started. They count as granted
+    /// from here on; call grant_failed() for any the grant can't reach.
+    std::vector<std::string> take_ungranted(const std::string& group_id);
+    void grant_failed(const std::string& group_id, const std::string& member);
+
+    /// Take the sender key `from` granted us, along with the group if it
+    /// is new to us. Returns false if the grant is refused: it leaves us or
+    /// `from` out, or `from` is not a member of the group as we know it.
+    /// Name and member changes are taken from the creator only. `joined`
+    /// is set if the group was new.
+    bool accept_grant(const std::string& from, Grant grant, bool& joined);
+
+    /// Open a message `from` sealed for `group_id`. nullopt if we have no
+    /// key from them for it, or it doesn't authenticate.
+    std::optional<std::string> open(const std::string& group_id, const std::string& from,
+                                    std::span<const uint8_t> nonce,
+                                    std::span<const uint8_t> ciphertext) const;
+
+private:
+    using KeyId = std::pair<std::string, std::string>;   // (group_id, sender)
+
+    void store_key(const std::string& group_id, const std::string& sender, const Key& key);
+    /// Copy our sender key for `group_id` into `out`, making (and storing)
+    /// it first if needed. False if we are not a member.
+    bool own_key(const std::string& group_id, Key& out);
+
+    MessageStore& store_;
+    const std::string self_;
+
+    mutable std::mutex mutex_;                  // guards everything below
+    std::unordered_map<std::string, Group> groups_;
+    std::map<KeyId, Key> keys_;
+    /// Members already sent our current key, per group.
+    std::unordered_map<std::string, std::set<std::string>> granted_;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+
+/**
+ * When to send the Supabase heartbeat (ARCHITECTURE.md §5.7).
+ *
+ * Node checks every `interval` and sends only if due():
+ *   - at once when the advertised address differs from the last one sent,
+ *     or after network_changed() or a failed heartbeat;
+ *   - otherwise once the current delay has passed. The delay starts at
+ *     `interval` and doubles after each heartbeat that found the address
+ *     unchanged, up to `max_interval`;
+ *   - a due heartbeat is skipped while peers keep dialling us directly,
+ *     since they already reach us at the advertised address.
+ * Nothing waits longer than `max_interval`: friends treat a last_seen
+ * older than five minutes as offline, so it must stay below that.
+ *
+ * Like PresenceTable, the schedule only decides; Node sends. Thread-safe.
+ */
+class HeartbeatSchedule {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::seconds interval{60};
+        std::chrono::seconds max_interval{240};
+    };
+
+    explicit HeartbeatSchedule(Options options);
+
+    /// New timings (config reload); the current delay is clamped to them.
+    void set_options(Options options);
+
+    /// A peer reached us directly over our listener.
+    void reached(Clock::time_point now = Clock::now());
+
+    /// An interface or address changed; the next due() sends.
+    void network_changed();
+
+    /// Whether to heartbeat now, advertising `address`. Returning true
+    /// counts as having sent; report the outcome with sent().
+    bool due(const std::string& address, Clock::time_point now = Clock::now());
+
+    /// Outcome of the heartbeat due() asked for.
+    void sent(bool ok);
+
+    /// How long the schedule waits now between unforced heartbeats.
+    [[nodiscard]] std::chrono::seconds delay() const;
+
+private:
+    Options options_;
+    mutable std::mutex mutex_;
+    bool force_ = true;                       // send at the next check
+    std::string address_;                     // last address Supabase accepted
+    std::string sending_;                     // address of the heartbeat in flight
+    Clock::time_point last_sent_{};
+    Clock::time_point last_reached_{};
+    std::chrono::seconds delay_{0};
+};
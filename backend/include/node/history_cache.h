@@ -0,0 +1,90 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "telemetry/memory.h"
+
+/**
+ * Serialized `GET /messages` answers for the newest page of recently read
+ * conversations.
+ *
+ * The UI re-reads the latest page of the open chat on every poll. Without
+ * this, each read is an SQLite query and a JSON serialization of the same
+ * rows. With it, a repeated read costs a lookup and a shared buffer. Only
+ * the newest page (no offset, no `before`) is cached, per page size, since
+ * that is the one that is polled.
+ *
+ * Any change to a conversation's rows drops its pages: MessageStore reports
+ * inserts, delivery updates and deletes after they commit. A page read
+ * from the store while such a change was committing could be stale, so
+ * put() only keeps it if no change to the conversation came in since
+ * ticket(). Changes are counted in a fixed set of slots by hash of the
+ * peer, so the counters take no memory per conversation. A collision
+ * just costs one fill.
+ *
+ * Conversations are evicted least recently read first once the bodies
+ * pass `max_bytes`, or by as much as the History memory budget is over
+ * (telemetry/memory.h). A max_bytes of 0 turns the cache off. Thread-safe.
+ */
+class HistoryCache {
+public:
+    using Body = std::shared_ptr<const std::string>;
+
+    explicit HistoryCache(std::size_t max_bytes);
+    ~HistoryCache();
+
+    HistoryCache(const HistoryCache&) = delete;
+    HistoryCache& operator=(const HistoryCache&) = delete;
+
+    /// New byte cap (config reload); evicts down to it at once.
+    void set_max_bytes(std::size_t max_bytes);
+
+    /// The cached newest page of `limit` messages with `peer`, or null.
+    Body get(const std::string& peer, std::size_t limit);
+
+    /// Taken before reading a page from the store, then passed to put().
+    [[nodiscard]] uint64_t ticket(const std::string& peer) const;
+
+    /// Keep `body` as the newest page of `limit` messages with `peer`,
+    /// unless the conversation changed since `ticket`.
+    void put(const std::string& peer, std::size_t limit, Body body, uint64_t ticket);
+
+    /// The conversation with `peer` changed.
+    void invalidate(const std::string& peer);
+
+    [[nodiscard]] std::size_t bytes() const;
+
+private:
+    static constexpr std::size_t kSlots = 64;
+
+    struct Entry {
+        std::map<std::size_t, Body> pages;      // by limit
+        std::size_t bytes = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::size_t slot(const std::string& peer) const;
+    void erase_locked(std::unordered_map<std::string, Entry>::iterator it);
+    /// Drop least recently read conversations until `bytes` are freed.
+    void shrink_locked(std::size_t bytes);
+    void evict_locked();
+    /// Bring the History memory account and gauge up to date with bytes_.
+    void account_locked();
+
+    mutable std::mutex mutex_;
+    std::size_t max_bytes_;
+    std::size_t bytes_ = 0;
+    std::size_t charged_ = 0;                   // bytes_ as last charged
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> lru_;                // front = most recently read
+    std::array<uint64_t, kSlots> changes_{};    // invalidations by slot(peer)
+    memory::Reclaimer reclaimer_;
+};
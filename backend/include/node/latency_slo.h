@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Sender-UI-to-receiver-UI latency of direct messages, split into stages
+ * and checked against a latency objective, for GET /metrics.
+ *
+ * The two nodes' clocks are not compared: each stage is timed on one
+ * clock. We time `seal` (send_message to the frame handed to the
+ * transport) and the round trip to the ack. The peer times how long it
+ * held the message (frame in to row committed, which is also when its UI
+ * is told) and returns that in the ack (protocol/message_format.md §9,
+ * "ack", timing_v1). `network` is the round trip less that hold, and the
+ * end-to-end figure is seal + network / 2 + peer: one way, assuming the
+ * ack takes as long as the message.
+ *
+ * Each message is counted against `objective` and each stage against its
+ * budget, so the burn rate is breaches over messages per window. Only
+ * sends the peer answers with timing are measured; sent() entries whose
+ * ack never comes are dropped after `max_age` or beyond `max_pending`.
+ * Thread-safe.
+ */
+class LatencySlo {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::milliseconds objective{200};
+        std::chrono::milliseconds seal_budget{40};
+        std::chrono::milliseconds network_budget{120};
+        std::chrono::milliseconds peer_budget{40};
+        std::chrono::seconds max_age{60};
+        std::size_t max_pending = 4096;
+    };
+
+    explicit LatencySlo(Options options);
+
+    /// `msg_id` went out direct: queued at `enqueued`, handed to the
+    /// transport at `wire`.
+    void sent(const std::string& msg_id, Clock::time_point enqueued, Clock::time_point wire);
+
+    /// Its ack came in at `acked`, saying the peer held it for `held`.
+    /// False if it wasn't sent() or has expired.
+    bool acked(const std::string& msg_id, Clock::duration held, Clock::time_point acked = Clock::now());
+
+private:
+    struct Sent {
+        Clock::time_point enqueued;
+        Clock::time_point wire;
+    };
+
+    /// Drop what has waited longer than max_age, or the oldest beyond
+    /// max_pending. Requires mutex_.
+    void expire_locked(Clock::time_point now);
+
+    const Options options_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Sent> pending_;
+    std::deque<std::pair<Clock::time_point, std::string>> order_;   // by wire time
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "network/envelope.h"
+
+/**
+ * Several offline messages to one recipient in one Supabase row
+ * (protocol/message_format.md §5.6).
+ *
+ * A single offline row holds one envelope as base64 JSON. That is about
+ * twice the size of the binary envelope, and every row repeats from, to
+ * and created_at. A pack row holds many envelopes, each binary, with a
+ * u32 length before each one. The whole run is zstd-compressed when that
+ * helps, and the row's ciphertext is kPrefix followed by its base64.
+ * Envelopes keep their own encryption and signature, so a pack adds no
+ * trust: the recipient checks each one as if it had its own row.
+ *
+ * Only recipients that advertised envelope::kCapMailboxPackV1 get packs.
+ * An older build would drop a row it can't decode.
+ */
+namespace mailbox_pack {
+
+/// Starts a pack row's ciphertext. ':' is not a base64 character, so no
+/// single-envelope row starts this way.
+inline constexpr std::string_view kPrefix = "pack1:";
+
+[[nodiscard]] inline bool is_pack(std::string_view ciphertext) {
+    return ciphertext.starts_with(kPrefix);
+}
+
+/// Pack the envelopes of some outbox rows (each base64 JSON, as queued)
+/// into one row's ciphertext. nullopt if one doesn't decode.
+std::optional<std::string> pack(std::span<const std::string> rows);
+
+/// The envelopes in a pack row's ciphertext, in order. nullopt if it is
+/// malformed or would unpack past compression::kMaxDecompressedSize.
+std::optional<std::vector<Envelope>> unpack(std::string_view ciphertext);
+
+/// Row id of a pack of `msg_ids`: a UUID hashed from them. Reinserting the
+/// same pack after a crash is then ignored as a duplicate, like a single
+/// row is.
+std::string row_id(std::span<const std::string> msg_ids);
+
+} // namespace mailbox_pack
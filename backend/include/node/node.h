@@ -1,35 +1,728 @@
 #pragma once
 
+#include <asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <nlohmann/json.hpp>
 
+#include "crypto/crypto_manager.h"
+#include "crypto/crypto_workers.h"
+#include "crypto/peer_sessions.h"
+#include "network/admission.h"
+#include "network/envelope.h"
+#include "network/lan_discovery.h"
+#include "network/network_watcher.h"
+#include "network/peer_capabilities.h"
+#include "network/peer_connection_pool.h"
+#include "network/peer_links.h"
+#include "network/relay_hub.h"
+#include "network/relay_link.h"
+#include "network/udp_transport.h"
+#include "node/ack_tracker.h"
+#include "node/delivery_predictor.h"
+#include "node/device_sync.h"
+#include "node/file_transfers.h"
+#include "node/group_chat.h"
+#include "node/heartbeat_schedule.h"
+#include "node/history_cache.h"
+#include "node/latency_slo.h"
+#include "node/offline_mailbox.h"
+#include "node/peer_directory.h"
+#include "config/rcu_cell.h"
+#include "node/presence.h"
+#include "node/prewarm_policy.h"
+#include "node/reorder_buffer.h"
+#include "node/signal_gate.h"
+#include "storage/message_store.h"
+#include "supabase/realtime.h"
+#include "supabase/supabase_client.h"
+#include "telemetry/logging.h"
+
 /**
  * Represents the local P2P chat node.
  */
 class Node {
 public:
-    explicit Node(const nlohmann::json& config);
+    /// Peers listen here unless their advertised address says otherwise.
+    static constexpr uint16_t kDefaultPeerPort = 9100;
+    /// Offline messages live for 7 days in Supabase, so that is the oldest
+    /// signed timestamp a message may carry (`node.replay_window`).
+    static constexpr int kDefaultReplayWindow = 7 * 24 * 3600;
+
+    /// How the config's `database` section opens the store; also used by
+    /// the history export and import commands (main.cpp).
+    static MessageStore::Options store_options(const nlohmann::json& config);
+
+    /// `<config> rotate-keys` (main.cpp): replace the key pairs in
+    /// `node.key_store`, keeping the node id, and leave the old X25519 key
+    /// and a signed key_update in `<key_store>.previous` for the next
+    /// start to announce to friends for `node.key_grace_days`. Run with
+    /// the node stopped. False (logged) if there are no keys to rotate or
+    /// a file can't be written.
+    static bool rotate_keys(const nlohmann::json& config);
+
+    /// `node.crypto_threads` and friends.
+    static CryptoWorkers::Options crypto_worker_options(const nlohmann::json& config);
+
+    /// The pool's `node.peer_*` limits, for the links a host's nodes share.
+    static PeerLinks::Options link_options(const nlohmann::json& config);
+
+    /// What several nodes in one process (main.cpp's `nodes` mode) share
+    /// instead of each building their own. Null members are built per node.
+    struct Shared {
+        std::shared_ptr<CryptoWorkers> crypto_workers;  // continuations posted to the same `io`
+        std::shared_ptr<SupabaseClient::Transport> supabase;
+        /// Links to other hosts, one channel per identity pair; null = each
+        /// node dials every peer through its own pool.
+        std::shared_ptr<PeerLinks> links;
+        /// Water marks on the queues behind peer reads; the node adds its
+        /// DB writer's backlog. Null = reads never pause.
+        std::shared_ptr<Backpressure> backpressure;
+    };
+
+    /// `io` drives the heartbeat timer and async Supabase calls.
+    Node(const nlohmann::json& config, asio::io_context& io, Shared shared = {});
+
+    /// Register this node's public key and IP with Supabase, then drain the
+    /// offline queue, without holding up startup: registration is an async
+    /// request on `io`, and the paged offline fetch (blocking HTTPS plus
+    /// crypto) runs on its own thread once registration has settled. The UI
+    /// follows progress through `startup` events and status_json().
+    void start_sync();
+
+    /// Flush offline messages an earlier run left in the outbox.
+    void start_mailbox();
+
+    /// Start the adaptive Supabase heartbeat (ARCHITECTURE.md §5.7) and,
+    /// where supported, the watch on network interfaces that triggers it.
+    void start_heartbeat();
+
+    /// Ping friends now and every `node.presence_interval` after that.
+    void start_presence();
+
+    /// Register with the relay in `relay.server`, so peers that can't dial
+    /// us reach us through it. Does nothing without one.
+    void start_relay();
+
+    /// Bind the UDP transport (`udp.enabled`), so friends can punch through
+    /// to us. Call before start_sync(), which publishes its endpoint.
+    void start_udp();
+
+    /// Announce ourselves on the LAN and listen for friends doing the same
+    /// (`lan.enabled`). Does nothing when off.
+    void start_lan();
 
-    /// Register this node's public key and IP with Supabase.
-    void register_with_supabase();
+    /// Sync history with our other devices (`sync.devices`) now and every
+    /// `sync.interval`. Does nothing without any.
+    void start_device_sync();
+
+    /// Let in-flight traffic finish before stop(): wait until every frame
+    /// queued to a peer is written and every direct message acknowledged,
+    /// or until `deadline`; then hand what is still unacknowledged to the
+    /// offline queue, whose outbox outlives the restart, and commit
+    /// buffered inserts. Returns false if the deadline cut it short.
+    /// Blocks; call it off the io threads, which must keep running.
+    bool drain(std::chrono::steady_clock::time_point deadline);
+
+    void stop();
+
+    /// Forwarding state for PeerServer when this node serves as a relay
+    /// (`relay.enabled`); null otherwise.
+    [[nodiscard]] RelayHub* relay_hub() { return relay_hub_.get(); }
+
+    /// Connection caps and frame budgets for PeerServer; Node charges the
+    /// per-sender budget itself.
+    [[nodiscard]] std::shared_ptr<AdmissionControl> admission() const { return admission_; }
 
     /// Look up a friend by username via Supabase and store them locally.
     bool add_friend(const std::string& username);
 
-    /// Encrypt and send a message (direct or offline fallback).
-    bool send_message(const std::string& to_user, const std::string& plaintext);
+    /// add_friend() for a whole contact list, as served by POST
+    /// /friends/batch: one concurrent Supabase lookup for the names not
+    /// already cached, one transaction, one friend key table rebuild, and
+    /// the shared keys computed on a crypto worker. Returns `added` and
+    /// `not_found` username arrays; nullopt if the lookup or the store
+    /// failed, in which case nobody was added.
+    asio::awaitable<std::optional<nlohmann::json>> add_friends(std::vector<std::string> usernames);
+
+    /// The friend list as served by GET /friends, with each conversation's
+    /// newest message and unread count, already serialized.
+    asio::awaitable<std::optional<std::string>> friends_page();
+
+    /// One page of history with `peer` as served by GET /messages, already
+    /// serialized: keyset paged from `before` when it is set, offset paged
+    /// otherwise. Null if the store could not be read. The newest page is
+    /// served from history_cache_ when it can be.
+    asio::awaitable<HistoryCache::Body> history_page(std::string peer, std::size_t limit,
+                                                     std::size_t offset, std::string before);
+
+    /// Messages stored after `since` (a msg_id; empty for the whole
+    /// conversation), oldest first, as served by GET /messages?since=,
+    /// already serialized. Nullopt if the store could not be read.
+    asio::awaitable<std::optional<std::string>> messages_since_page(std::string peer,
+                                                                    std::string since,
+                                                                    std::size_t limit);
+
+    /// Ranked full-text search as served by GET /messages/search, already
+    /// serialized; an empty `peer` searches every conversation. Nullopt
+    /// if the store could not be read.
+    asio::awaitable<std::optional<std::string>> search_page(std::string query, std::string peer,
+                                                            std::size_t limit);
+
+    /// Encrypt and send a message (direct or offline fallback). Returns
+    /// true if it was delivered directly to the peer, false if it went to
+    /// the offline queue (or nowhere). The connect to the peer runs while
+    /// the message is sealed; a connect still pending as its deadline nears
+    /// gets the offline copy queued alongside (ARCHITECTURE.md §5.3).
+    /// With `expires_at` (an envelope timestamp) the message disappears
+    /// from both sides' history at that time.
+    asio::awaitable<bool> send_message(std::string to_user, std::string plaintext,
+                                       std::string expires_at = {});
+
+    /// Start a group with `members`, who must be friends, and send each of
+    /// them the group with our sender key (POST /groups). Returns the group
+    /// as GET /groups lists it, or nullopt if a member isn't a friend.
+    std::optional<nlohmann::json> create_group(const std::string& name,
+                                               const std::vector<std::string>& members);
+
+    /// Every group we are in, as served by GET /groups.
+    [[nodiscard]] nlohmann::json groups_json() const;
+
+    /// Seal and sign `plaintext` once and send the same frame to every
+    /// member with a known address (POST /groups/:id/messages). Returns
+    /// msg_id and who it went to, or nullopt if there is no such group.
+    std::optional<nlohmann::json> send_group_message(const std::string& group_id,
+                                                     const std::string& plaintext);
+
+    /// React to, unreact to, edit or delete message `target` in `peer`'s
+    /// conversation (a friend or a group id): POST /messages/:id/deltas.
+    /// `op` is react, unreact, edit or delete; `value` the emoji or the new
+    /// text, empty for delete. Deltas to one conversation within
+    /// `node.delta_batch_ms` go out as one envelope and are stored as rows
+    /// of message_deltas, never as messages. Returns the delta_id, or
+    /// nullopt for a bad op or value or an unknown conversation.
+    asio::awaitable<std::optional<nlohmann::json>> send_delta(std::string peer, std::string target,
+                                                              std::string op, std::string value);
+
+    /// Offer the file at `path` to a friend. Returns the transfer id, or
+    /// nullopt if the friend has no address or the file can't be read.
+    std::optional<std::string> send_file(const std::string& to_user, const std::string& path);
 
-    /// Called when a message is received from a peer.
-    void on_message_received(const std::string& from_user,
-                             const std::string& ciphertext,
-                             const std::string& signature);
+    /// Accept or cancel a transfer (POST /files/accept, /files/cancel).
+    bool accept_file(const std::string& transfer_id);
+    bool cancel_file(const std::string& transfer_id);
+
+    /// Tell an online friend we started or stopped typing (the UI's
+    /// `typing` event). Sent only inside a peer session: never signed,
+    /// stored or queued offline, and dropped when there is no session.
+    /// Coalesced and rate-limited per friend by SignalGate.
+    void send_typing(const std::string& to, bool typing);
+
+    /// Tell `peer` we have read up to `msg_id` (the UI's `mark_read`
+    /// event); sent like send_typing(). Also clears the conversation's
+    /// unread count up to that message locally, whether or not it is sent.
+    void send_read_receipt(const std::string& peer, const std::string& msg_id);
+
+    /// Entry point for every peer frame, whatever transport read it.
+    void on_frame(const std::string& remote, std::string_view frame);
+
+    /// Frames read by PeerServer: the peer dialled our advertised address,
+    /// which lets the heartbeat wait.
+    void on_direct_frame(const std::string& remote, std::string_view frame);
+
+    /// Runs once a received message is durably stored (or was already
+    /// stored), i.e. when it is safe to acknowledge it. Called on the DB thread.
+    using DurableCallback = std::function<void(const std::string& msg_id)>;
+
+    /// Called when a message is received from a peer (directly or from the
+    /// offline queue). Returns false if it was rejected.
+    bool on_message_received(const Envelope& envelope, DurableCallback on_durable = {});
+
+    /// Drain the Supabase offline queue (ARCHITECTURE.md §5.6), then emit
+    /// one backlog_loaded event for everything it stored. Blocks; returns
+    /// false if the queue could not be read.
+    bool fetch_offline_messages();
+
+    /// UI push events (new_message, friend_online, friend_offline, typing,
+    /// read, file_offer, file_done; see docs/websocket-events-guide.md §2). May be
+    /// called from any thread, including the DB and transfer threads. Set
+    /// before the node starts receiving.
+    using EventCallback = std::function<void(std::string_view event, const nlohmann::json& data)>;
+    void set_on_event(EventCallback cb);
+
+    /// One of those events as main.cpp passes it on, over a Topic
+    /// (node/event_bus.h), to the WebSocket and long-poll stages.
+    struct UiEvent {
+        std::string name;
+        nlohmann::json data;
+    };
+
+    /// Apply the settings of a reloaded config that can change while
+    /// running (ARCHITECTURE.md §13); the rest need a restart.
+    void apply_config(const nlohmann::json& config);
+
+    /// Identity and startup progress, merged into GET /status.
+    [[nodiscard]] nlohmann::json status_json() const;
+
+    /// What each peer has cost since start (telemetry/peer_usage.h) and
+    /// what is queued to them now, for GET /peers: the `limit` highest by
+    /// `sort`, one of the reported fields. Nullopt for any other `sort`.
+    [[nodiscard]] std::optional<nlohmann::json> peers_json(const std::string& sort,
+                                                           std::size_t limit) const;
 
     [[nodiscard]] const std::string& username() const { return username_; }
     [[nodiscard]] const std::string& node_id()  const { return node_id_; }
 
 private:
+    /// Settings a config reload can change, read lock-free on hot paths.
+    struct Tunables {
+        std::chrono::seconds heartbeat_interval;
+        std::chrono::seconds presence_interval;
+        std::chrono::seconds max_clock_skew;     // how far ahead a sender's clock may be
+        std::size_t compress_min_bytes;          // smallest plaintext sent compressed
+    };
+    static Tunables tunables_from(const nlohmann::json& config);
+
+    enum class SyncState : uint8_t { Pending, Running, Done, Failed, Skipped };
+    static const char* sync_state_name(SyncState state);
+    /// Record a startup phase's progress and tell the UI.
+    void set_sync_state(const char* phase, std::atomic<SyncState>& slot, SyncState state);
+
+    /// Load, derive or generate the key pair, and settle node_id_ if the
+    /// config didn't set it. Reads the binary keystore when there is one;
+    /// otherwise falls back to the JSON key file and writes the keystore.
+    /// A node that isn't `durable` (in-memory database) writes no key files.
+    void load_identity(const nlohmann::json& node, bool durable);
+
+    /// Send `to` our pending key_update, unless there is none, its grace
+    /// window is over or `to` had it within the hour. With `offline`, the
+    /// update is queued in the mailbox instead, ahead of what follows.
+    void announce_keys(const std::string& to, bool offline = false);
+    /// A friend's key_update: verify it against the keys we pin for them
+    /// and, if it holds, pin the new ones and keep the old for its window.
+    void on_key_update(const Envelope& envelope);
+    /// Verify and open a signed message from a friend under `keys`, then,
+    /// if that fails, under the keys they had before a rotation.
+    CryptoManager::OpenResult open_signed(const Envelope& envelope,
+                                          const FriendKeys::Keys& keys) const;
+
+    /// The address other peers should dial, "ip" or "ip:port".
+    std::string advertised_address() const;
+    /// The other endpoints peers may race it with, comma-separated, as
+    /// published in `users.addresses` (`node.advertise_addresses`).
+    std::string alternate_addresses() const;
+
+    /// Convert a Supabase `users` row into a directory entry.
+    static std::optional<PeerDirectory::Peer> peer_from_row(const nlohmann::json& row);
+
+    /// Runs every `node.heartbeat_interval`: heartbeat if the schedule says so.
+    void heartbeat_check();
+
+    /// Heartbeat, which also brings back every friend's Supabase row.
+    void heartbeat_tick();
+
+    /// Usernames of the pinned directory entries, i.e. friends.
+    std::vector<std::string> friend_usernames() const;
+
+    /// Apply Supabase `users` rows of friends to the directory; returns the
+    /// peers that parsed.
+    std::vector<PeerDirectory::Peer> refresh_friends(const std::vector<nlohmann::json>& rows);
+
+    void emit(std::string_view event, const nlohmann::json& data) const;
+
+    /// Whether `peer` has somewhere to send to: its own address, a LAN
+    /// endpoint, a relay or a UDP endpoint.
+    bool reachable(const PeerDirectory::Peer& peer) const;
+
+    /// Send one frame to `peer`: straight over the pool when they were
+    /// found on the LAN, else over UDP once a connection to them is
+    /// established, otherwise over the pool, directly or wrapped for the
+    /// relay it registered with. send_frame() blocks like
+    /// PeerConnectionPool::send and falls back to TCP if UDP fails.
+    /// `cls` picks the connection's queue (network/traffic_class.h); on
+    /// UDP, Bulk goes on the Files stream.
+    bool send_frame(const PeerDirectory::Peer& peer, std::string_view frame);
+    void send_frame_async(const PeerDirectory::Peer& peer, std::string frame,
+                          std::function<void(bool ok)> done = {},
+                          TrafficClass cls = TrafficClass::Interactive);
+
+    /// Get the transport send_frame_async() would use for `peer` ready: a
+    /// pooled connection to them or their relay, or an established UDP
+    /// connection. `done` runs on any thread.
+    void open_route(const PeerDirectory::Peer& peer, std::function<void(bool ok)> done);
+
+    /// Whether to send to `peer` over UDP; if they publish an endpoint we
+    /// have no connection to yet, punches towards it for the next frame.
+    bool over_udp(const PeerDirectory::Peer& peer);
+
+    /// Whether a direct frame to `peer` goes on a channel of the shared
+    /// links: they are set and `peer` advertised mux_v1.
+    [[nodiscard]] bool over_link(const PeerDirectory::Peer& peer) const;
+
+    /// RelayHub's check of a registration against `username`'s signing
+    /// key, from the directory or else Supabase.
+    void verify_relay_client(const std::string& username, std::string signed_bytes,
+                             std::string signature, std::function<void(bool)> done);
+
+    /// An announcement LanDiscovery heard: if it is a friend's, signed with
+    /// the key we have for them and recent, dial them at `ip` from now on.
+    void on_lan_announcement(const LanDiscovery::Announcement& announcement,
+                             const std::string& ip);
+    /// Forget LAN endpoints not announced for three rounds; run from
+    /// presence_tick().
+    void expire_lan_peers();
+
+    /// Note verified traffic from `username`; reports friend_online if they
+    /// were not considered online.
+    void mark_active(const std::string& username);
+
+    /// A message to `username` may follow (chat opened, typing): connect
+    /// and start a session now, if prewarm_ agrees and they are online.
+    void prewarm(const std::string& username);
+    /// Keep the pool's connections to prewarm_'s top friends; run from
+    /// presence_tick().
+    void keep_warm();
+    /// open_route() to `peer`, then start_session() once it is up.
+    void warm_route(const PeerDirectory::Peer& peer);
+
+    /// What delivery_ weighs for a send to `peer`: a connection up,
+    /// presence, and when they were last seen.
+    DeliveryPredictor::Signals delivery_signals(const PeerDirectory::Peer& peer) const;
+
+    /// One PresenceTable round: pings, Supabase refreshes, friend_offline.
+    void presence_tick();
+
+    /// Send a signed `ping` to `to` without blocking.
+    void send_ping(const std::string& to);
+    void on_ping_received(const Envelope& envelope);
+
+    /// Send an `ack` for `msg_id` back to `to` without blocking: under the
+    /// session key if one is up, signed otherwise. A sealed ack to a
+    /// timing_v1 peer carries `held`, how long we had the message.
+    void send_ack(const std::string& to, const std::string& msg_id,
+                  std::optional<std::chrono::steady_clock::duration> held = std::nullopt);
+    void on_ack_received(const Envelope& envelope);
+    /// A verified ack, signed or sealed.
+    void acknowledged(const std::string& from, const std::string& msg_id);
+
+    /// A signed `message` envelope for `to`: what every peer and the
+    /// offline mailbox accept. Nullopt if encryption fails.
+    std::optional<Envelope> seal_message(const std::string& to,
+                                         const std::vector<uint8_t>& public_key,
+                                         const std::string& body, PayloadCompression compression,
+                                         const std::string& timestamp) const;
+
+    /// seal_message() on a crypto worker, resuming on the caller's executor.
+    asio::awaitable<std::optional<Envelope>> seal_on_worker(
+        const std::string& to, std::size_t bytes, std::function<std::optional<Envelope>()> seal);
+
+    /// The tail of send_message(): seal `body` for `peer`, send it direct
+    /// with an ack tracked under `msg_id`, else queue it for Supabase.
+    /// `keep` stores our copy once its route is known ("direct" or
+    /// "offline"). Returns true if it went direct.
+    asio::awaitable<bool> send_payload(PeerDirectory::Peer peer, std::string msg_id,
+                                       std::string timestamp, std::string body,
+                                       std::function<void(const char*)> keep);
+
+    /// Send a batch of our deltas to `peer` (a friend or a group), in
+    /// payloads of at most 64 records, and store it.
+    asio::awaitable<void> send_deltas(std::string peer, std::vector<MessageStore::Delta> batch);
+
+    /// The `message_delta` UI event for `deltas` in `peer`'s conversation.
+    nlohmann::json deltas_json(const std::string& peer,
+                               const std::vector<MessageStore::Delta>& deltas) const;
+
+    /// Hand a signed message to the offline mailbox.
+    void queue_offline(const std::string& msg_id, const std::string& to, const Envelope& env);
+
+    /// A `session` envelope carrying `payload` as an `inner` frame for
+    /// `to`; nullopt unless a session with them is up.
+    std::optional<Envelope> seal_session(const std::string& to, EnvelopeType inner,
+                                         PayloadCompression compression, std::string_view payload);
+
+    /// Send a signed key_exchange to `peer`, if PeerSessions wants one.
+    void start_session(const PeerDirectory::Peer& peer);
+    void send_key_exchange(const PeerDirectory::Peer& peer, const std::string& body);
+    void on_key_exchange(const Envelope& envelope);
+    /// A session frame: open it on a crypto worker, then deliver the
+    /// message or note the ack back on the I/O thread.
+    void receive_session(Envelope envelope);
+
+    /// `seq` for the next direct message to `to`.
+    std::string next_seq(const std::string& to);
+    /// Arm reorder_timer_ for the earliest held message. On its strand.
+    void arm_reorder_timer();
+
+    /// Pass a typing or read signal through signals_: send it now, or wake
+    /// signal_timer_ for when it may go.
+    void offer_signal(SignalGate::Signal signal);
+    /// Seal a signal under the session with its peer and send it.
+    void transmit_signal(const SignalGate::Signal& signal);
+    /// Arm signal_timer_ for the earliest held signal. On its strand.
+    void arm_signal_timer();
+    /// The inner frame of a `signal` session frame from `from`.
+    void on_signal(const std::string& from, std::string_view body);
+
+    /// FileTransfers transport: seal and sign an offer like a message, sign
+    /// acks and cancels; chunks are sealed already.
+    void send_file_offer(const std::string& to, const FileTransfers::Offer& offer);
+    void send_file_frame(const std::string& to, EnvelopeType type, std::string body);
+    void on_file_offer(const Envelope& envelope);
+    /// Verify a file_ack or file_cancel against the sender's signing key.
+    bool verify_file_control(const Envelope& envelope);
+
+    /// Send our sender key for `group_id` to the members who lack it,
+    /// sealed with crypto_box.
+    void send_group_keys(const std::string& group_id);
+    /// Seal `body` once under our sender key for `group` and send the same
+    /// frame to every member with a known address. Returns who it went to
+    /// and who had no address, or nullopt if we are not in the group.
+    std::optional<std::pair<nlohmann::json, nlohmann::json>> broadcast_group(
+        const GroupChat::Group& group, const std::string& body, const std::string& timestamp);
+    void on_group_key(const Envelope& envelope);
+    /// A group message: verify and open it on a crypto worker, then store
+    /// it back on the I/O thread. Group messages are not acked.
+    void receive_group(Envelope envelope);
+    static nlohmann::json group_json(const GroupChat::Group& group);
+
+    /// AckTracker callbacks: send an unacked message again over the pool,
+    /// or hand it to the offline mailbox when it runs out of retries.
+    void retransmit(const std::string& msg_id, const Envelope& envelope);
+    void give_up_direct(const std::string& msg_id, Envelope envelope);
+
+    /// DeviceSync transport: a `sync` envelope sealed to our own key and
+    /// signed, sent to another device's `address`.
+    void send_device_sync(const std::string& address, const nlohmann::json& message);
+    /// Verify and open a sync envelope on a crypto worker, then hand it to
+    /// DeviceSync.
+    void receive_device_sync(Envelope envelope);
+
+    /// A history row in the API's message object format.
+    nlohmann::json message_json(const MessageStore::Message& m) const;
+    /// The same object serialized onto `out` (byte for byte what dumping
+    /// message_json() gives), plus `snippet` for search hits.
+    void append_message_json(std::string& out, const MessageStore::Message& m,
+                             const std::string* snippet = nullptr) const;
+
+    /// A decrypted message ready for the store.
+    struct Accepted {
+        MessageStore::Message message;
+        bool signed_timestamp = false;       // message.timestamp came from the ciphertext
+        std::optional<ReorderBuffer::Seq> seq;  // direct messages from current builds
+        /// A delta batch: message is then just its msg_id, conversation
+        /// and timestamp.
+        std::vector<MessageStore::Delta> deltas;
+    };
+
+    /// A direct message: verify and open it on a crypto worker, then store
+    /// and ack it back on the I/O thread.
+    void receive_direct(Envelope envelope);
+
+    /// Store an opened message; false if it was rejected. `trace`, when
+    /// tracing is on, gets the store and notify stages.
+    bool deliver_received(const Envelope& envelope, const CryptoManager::OpenResult& result,
+                          DurableCallback on_durable,
+                          std::shared_ptr<logging::MessageTrace> trace = {});
+
+    /// Shared tail of the direct and offline receive paths: check the
+    /// decrypted payload (including the replay window) and turn it into a
+    /// history row.
+    std::optional<Accepted> accept_plaintext(const Envelope& envelope,
+                                             const CryptoManager::OpenResult& result);
+    /// Store an accepted message (record_received()) or delta batch
+    /// (record_deltas()).
+    void record_accepted(Accepted accepted, MessageStore::InsertCallback done);
+    /// The UI event to emit once `accepted` is stored: new_message or
+    /// message_delta. Empty without an event callback.
+    std::pair<std::string_view, nlohmann::json> accepted_event(const Accepted& accepted) const;
+
+    /// One page of offline messages handed to the store but not yet
+    /// known to be committed.
+    struct OfflineStage {
+        struct Pending {
+            std::size_t row;
+            std::string peer;
+            std::future<MessageStore::InsertResult> result;
+        };
+        std::vector<std::string> ids;       // every row of the page
+        std::vector<Pending> pending;
+    };
+    /// Messages and delta batches stored by a drain, per conversation.
+    using BacklogCounts = std::map<std::string, std::size_t>;
+
+    /// Verify and open one page of offline messages as a batch and queue
+    /// them for the store, announcing each as it is stored if `announce`.
+    /// Caller holds offline_mutex_.
+    OfflineStage stage_offline_page(const std::vector<SupabaseClient::OfflineMessage>& page,
+                                    bool announce);
+    /// Wait for a staged page's inserts and return the ids that are done
+    /// with and may be deleted from Supabase; what was stored is added to
+    /// `counts` if given. Blocks.
+    std::vector<std::string> settle_offline_page(OfflineStage& stage, BacklogCounts* counts);
+    /// Rows pushed by realtime_: stored like a fetched page, then deleted.
+    void receive_pushed_offline(std::vector<SupabaseClient::OfflineMessage> rows);
+
+    /// Pin every friend from the local database in the directory.
+    void load_friends();
+
+    /// Seed the directory, presence and shared-key cache from the state
+    /// snapshot instead; false if there is no valid one.
+    bool restore_snapshot();
+    /// Write the state snapshot (on clean shutdown).
+    void save_snapshot();
+
     std::string username_;
     std::string node_id_;
-    // TODO: Add key pair fields, friend list, DB handle, etc.
+    bool binary_envelope_;
+    uint16_t listen_port_;
+    std::string advertise_ip_;
+    std::optional<std::vector<std::string>> advertise_addresses_;   // nullopt: detect
+    std::string published_addresses_;       // last alternate_addresses() sent
+    std::chrono::seconds replay_window_;     // oldest signed timestamp accepted
+    RcuCell<Tunables> tunables_;
+
+    CryptoManager crypto_;
+    /// Verifies and opens direct messages off the I/O threads; possibly
+    /// shared with other nodes (Shared).
+    std::shared_ptr<CryptoWorkers> crypto_workers_;
+    /// Session keys with online peers (`node.peer_sessions`); null when off.
+    std::unique_ptr<PeerSessions> sessions_;
+    /// Serialized newest history pages (`database.history_cache_bytes`);
+    /// declared before store_, which reports changes to it.
+    HistoryCache history_cache_;
+    MessageStore store_;
+    /// Groups and their sender keys.
+    GroupChat groups_;
+    std::unique_ptr<SupabaseClient> supabase_;   // null when no Supabase is configured
+
+    /// Contact details for friends (pinned) and recently looked-up users.
+    PeerDirectory directory_;
+
+    /// Warm outbound connections reused across send_message calls.
+    PeerConnectionPool peer_pool_;
+    /// Shared with the other nodes of a host (Shared); null otherwise.
+    std::shared_ptr<PeerLinks> links_;
+    /// Whom to connect to before sending (`node.prewarm`); null when off.
+    std::unique_ptr<PrewarmPolicy> prewarm_;
+    /// Direct, offline or both per send (`node.predict_delivery`); null
+    /// when off, and every send dials first.
+    std::unique_ptr<DeliveryPredictor> delivery_;
+
+    /// Per-peer envelope encoding (JSON or binary v1), learned from hellos.
+    PeerCapabilities peer_caps_;
+
+    /// `relay.server` as published to Supabase; nullopt leaves the column be.
+    std::optional<std::string> relay_server_;
+    /// Clients we forward for, when serving as a relay.
+    std::unique_ptr<RelayHub> relay_hub_;
+
+    /// Limits on inbound peer connections and frames, shared with PeerServer.
+    std::shared_ptr<AdmissionControl> admission_;
+
+    /// Direct sends still waiting for their ack.
+    AckTracker acks_;
+    /// End-to-end latency of direct sends (`node.latency_slo_ms`); null
+    /// when off.
+    std::unique_ptr<LatencySlo> latency_;
+
+    /// How long a send waits on its connect before also queueing the
+    /// offline copy: three quarters of the pool's connect timeout.
+    std::chrono::milliseconds offline_fallback_after_;
+
+    /// Offline messages on their way to Supabase; null without Supabase.
+    std::shared_ptr<OfflineMailbox> mailbox_;
+
+    /// History sync with our other devices; null without `sync.devices`.
+    std::shared_ptr<DeviceSync> device_sync_;
+
+    /// File streams in both directions, on their own thread.
+    FileTransfers transfers_;
+
+    /// Who is online, from verified messages, acks and pings.
+    PresenceTable presence_;
+
+    /// When the heartbeat is worth sending.
+    HeartbeatSchedule heartbeat_;
+    std::unique_ptr<NetworkWatcher> network_watcher_;
+
+    asio::steady_timer heartbeat_timer_;
+    asio::steady_timer presence_timer_;
+
+    /// Typing and read signals, coalesced per friend; held ones go out
+    /// from signal_timer_, which runs on its own strand.
+    SignalGate signals_;
+    asio::steady_timer signal_timer_;
+
+    /// Received direct messages put back in each sender's order before they
+    /// are stored; null with `node.reorder_hold_ms` 0. Holds run out on
+    /// reorder_timer_, on its own strand.
+    std::unique_ptr<ReorderBuffer> reorder_;
+    asio::steady_timer reorder_timer_;
+    /// Our `seq` run, and the next number per recipient.
+    const uint64_t seq_run_;
+    std::mutex seq_mutex_;
+    std::unordered_map<std::string, uint64_t> next_seq_;
+
+    /// Our deltas waiting out `node.delta_batch_ms`, by conversation.
+    const std::chrono::milliseconds delta_batch_;
+    std::mutex deltas_mutex_;
+    std::unordered_map<std::string, std::vector<MessageStore::Delta>> pending_deltas_;
+
+    std::string snapshot_path_;             // empty: no state snapshot
+    bool database_ok_ = false;
+    std::atomic<SyncState> register_state_{SyncState::Pending};
+    std::atomic<SyncState> offline_state_{SyncState::Pending};
+    std::atomic<bool> stopping_{false};
+
+    EventCallback on_event_;
+
+    /// Our registration with `relay.server`, if any; its thread delivers
+    /// frames to on_frame().
+    std::unique_ptr<RelayLink> relay_link_;
+
+    /// `udp` as published to Supabase; nullopt leaves the column be.
+    std::optional<std::string> udp_endpoint_;
+    /// The UDP transport, when enabled; its thread delivers frames to
+    /// on_frame() too.
+    std::unique_ptr<UdpTransport> udp_;
+
+    /// LAN discovery, when enabled; its thread runs on_lan_announcement().
+    std::unique_ptr<LanDiscovery> lan_;
+    std::chrono::seconds lan_interval_{30};
+    /// When each friend with a LAN endpoint in the directory last announced.
+    std::mutex lan_mutex_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> lan_seen_;
+
+    /// After a rotation: the key_update body, then our old key's signature
+    /// of it, and until when it is announced. Set in load_identity().
+    std::vector<uint8_t> key_update_;
+    int64_t key_update_until_ = 0;
+    /// When each friend was last sent it, live and through the mailbox.
+    std::mutex key_update_mutex_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> key_update_sent_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> key_update_queued_;
+
+    /// Serializes offline drains and pushed rows, which run on sync_thread_
+    /// and realtime_'s thread.
+    std::mutex offline_mutex_;
+    /// Offline messages pushed as they are queued (`supabase.realtime`);
+    /// null without Supabase or when off. Its thread runs the handlers.
+    std::unique_ptr<SupabaseRealtime> realtime_;
+
+    // Last, so the offline fetch and key warm-up are joined before anything
+    // they use goes away.
+    std::jthread sync_thread_;
+    std::jthread warm_thread_;
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "storage/message_store.h"
+#include "supabase/supabase_client.h"
+
+/**
+ * Outbound offline messages on their way to Supabase's `messages` table
+ * (ARCHITECTURE.md §5.4).
+ *
+ * post() writes the message to the local `outbox` table first, so nothing
+ * queued is lost to a restart or an outage. Flushes then drain the outbox
+ * with one bulk insert per `batch_size` rows; sends arriving within
+ * `flush_delay` of each other share an insert.
+ *
+ * A failed insert is retried on a backoff that doubles from `retry_delay`
+ * up to `max_retry_delay`, or as soon as network_up() reports Supabase
+ * reachable again. A batch Supabase rejects outright is halved until the
+ * offending row is on its own, so one bad row can't hold up the rest.
+ * Compaction drops rows older than `max_age` (the recipient would reject
+ * them as replays) and rows that failed `max_attempts` times.
+ *
+ * Messages to a recipient that `packable` accepts wait up to `pack_window`
+ * for company. Those in one batch then go as pack rows of up to
+ * `pack_max_messages` envelopes and `pack_max_bytes` (node/mailbox_pack.h),
+ * so a week of messages to a friend who is away costs a few rows, not
+ * hundreds.
+ *
+ * Must be owned by a shared_ptr: store and Supabase callbacks hold a weak
+ * reference. Thread-safe.
+ */
+class OfflineMailbox : public std::enable_shared_from_this<OfflineMailbox> {
+public:
+    struct Options {
+        std::chrono::milliseconds flush_delay{200};
+        std::size_t batch_size = 500;
+        std::chrono::milliseconds retry_delay{5000};
+        std::chrono::milliseconds max_retry_delay{300000};
+        int max_attempts = 20;
+        std::chrono::seconds max_age{7 * 24 * 3600};
+        std::chrono::milliseconds pack_window{2000};
+        std::size_t pack_max_messages = 64;
+        std::size_t pack_max_bytes = 256 * 1024;    // of base64 envelopes
+    };
+
+    /// Whether a recipient can unpack pack rows.
+    using Packable = std::function<bool(const std::string& to_user)>;
+
+    /// `from_user` fills every row's from_user. The timer runs on `io`.
+    /// Without `packable`, every message gets its own row.
+    OfflineMailbox(asio::io_context& io, MessageStore& store, SupabaseClient& supabase,
+                   std::string from_user, Options options, Packable packable = {});
+
+    /// Queue an offline message for `to_user`. `done(ok)` runs once it is
+    /// in the outbox (on the DB thread). If the outbox can't be written,
+    /// one immediate insert is tried instead and `done` reports that.
+    void post(std::string msg_id, std::string to_user, std::string ciphertext,
+              MessageStore::Done done = {});
+
+    /// Compact the outbox and flush what an earlier run left in it.
+    void start();
+
+    /// Supabase answered again: skip any retry backoff and flush now.
+    void network_up();
+
+    /// Cancel the timer; in-flight work finishes without starting more.
+    void stop();
+
+private:
+    /// Read the next batch from the outbox and insert it.
+    void flush();
+    /// Insert `entries`, read with `limit`.
+    void on_batch(std::vector<MessageStore::OutboxEntry> entries, std::size_t limit);
+    /// A flush finished: `ok` says Supabase took the batch, `more` that
+    /// the outbox may hold further rows.
+    void finish(bool ok, bool more);
+    void compact();
+
+    /// Flush after `delay` unless a flush is running or already due by
+    /// then. Requires mutex_.
+    void arm_locked(std::chrono::milliseconds delay);
+
+    /// Rows for `entries`, packing each packable recipient's messages.
+    std::vector<SupabaseClient::OfflineMessage> rows_for(
+        std::vector<MessageStore::OutboxEntry> entries) const;
+
+    Options options_;
+    MessageStore& store_;
+    SupabaseClient& supabase_;
+    std::string from_user_;
+    Packable packable_;
+    asio::steady_timer timer_;
+
+    std::mutex mutex_;
+    bool flushing_ = false;
+    bool again_ = false;              // a post() arrived during the flush
+    bool armed_ = false;
+    bool stopped_ = false;
+    std::chrono::milliseconds backoff_{0};   // non-zero while Supabase is failing
+    std::size_t batch_limit_;                // shrinks while isolating a rejected row
+};
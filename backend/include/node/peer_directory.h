@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config/rcu_cell.h"
+#include "node/friend_keys.h"
+#include "telemetry/memory.h"
+
+/**
+ * In-memory cache of peer contact details in front of Supabase.
+ *
+ * Friends are pinned: they are seeded from the local friends table at
+ * startup, never expire, and only have their address refreshed (from
+ * heartbeat / presence data). Everyone else is cached for a TTL, with
+ * unknown usernames cached negatively for a shorter one. Concurrent misses
+ * for the same username share a single fetch.
+ *
+ * The table is striped by username hash into kShards shards, each with its
+ * own lock, LRU and share of `max_entries`, so the send path and GET
+ * /friends only contend with updates to the same shard. Options are read
+ * without a lock. Entries are charged to the Directory memory area at a
+ * flat estimate each (telemetry/memory.h); over budget, unpinned ones go
+ * least recently used first.
+ *
+ * Friends' keys are also kept in a FriendKeys table, rebuilt whenever a
+ * friend is pinned or unpinned, which the verify path reads through keys()
+ * without taking a shard lock or copying an entry. A friend who rotates
+ * their keys (crypto/key_rotation.h) has them replaced in place, and the
+ * old ones stay available from retired() for the window they gave.
+ * Thread-safe.
+ */
+class PeerDirectory {
+public:
+    struct Peer {
+        std::string username;
+        std::vector<uint8_t> public_key;      // X25519
+        std::vector<uint8_t> signing_key;     // Ed25519 (may be empty for non-friends)
+        std::string ip;
+        uint16_t port = 0;
+        std::string last_seen;                // ISO 8601, as reported by Supabase
+        std::string relay;                    // "ip:port" to reach them through; empty = direct
+        std::string udp;                      // "ip:port" of their UDP transport; empty = none
+        std::string addresses;                // more endpoints to race with ip, comma-separated
+        std::string lan;                      // "ip:port" heard on the LAN; never from Supabase
+    };
+
+    /// Fetches a peer from the authoritative source (Supabase). Returns
+    /// nullopt if the user does not exist or the fetch failed.
+    using Fetcher = std::function<std::optional<Peer>(const std::string& username)>;
+
+    struct Options {
+        std::chrono::seconds ttl{300};
+        std::chrono::seconds negative_ttl{30};
+        std::size_t max_entries = 4096;       // unpinned entries only
+    };
+
+    explicit PeerDirectory(Fetcher fetcher);
+    PeerDirectory(Fetcher fetcher, Options options);
+    ~PeerDirectory();
+
+    PeerDirectory(const PeerDirectory&) = delete;
+    PeerDirectory& operator=(const PeerDirectory&) = delete;
+
+    /// New TTLs and size limit (config reload); cached entries keep the
+    /// expiry they were given.
+    void set_options(Options options);
+
+    /// Cached entry if fresh, otherwise fetch (deduplicated per username).
+    std::optional<Peer> lookup(const std::string& username);
+
+    /// Cached entry only; never touches the network.
+    [[nodiscard]] std::optional<Peer> cached(const std::string& username) const;
+
+    /// Whether cached() would return an entry, without copying it.
+    [[nodiscard]] bool known(const std::string& username) const;
+
+    /// `username`'s keys: from the friend key table, else from a cached
+    /// entry that has both. nullopt if neither; never touches the network.
+    [[nodiscard]] std::optional<FriendKeys::Keys> keys(const std::string& username) const;
+
+    /// The current friend key table; valid for the directory's lifetime.
+    [[nodiscard]] const FriendKeys& friend_keys() const { return friend_keys_.read(); }
+
+    /// Pin peers (friends) so they never expire.
+    void seed(const std::vector<Peer>& friends);
+    void pin(const Peer& peer);
+
+    /// Stop pinning `username` and drop its entry.
+    void unpin(const std::string& username);
+
+    /// Replace a pinned friend's keys with `next` after a verified
+    /// key_update, keeping the current ones for retired() until `until`
+    /// (unix seconds). Returns the updated entry, or nullopt if `username`
+    /// isn't pinned.
+    std::optional<Peer> rotate_keys(const std::string& username, const FriendKeys::Keys& next,
+                                    int64_t until);
+
+    /// The keys `username` had before their last rotation, while those are
+    /// still valid; otherwise nullopt.
+    [[nodiscard]] std::optional<FriendKeys::Keys> retired(const std::string& username) const;
+
+    /// Refresh the address of a known peer; keys are left untouched (TOFU).
+    void update_address(const std::string& username, const std::string& ip,
+                        uint16_t port, const std::string& last_seen,
+                        const std::string& relay, const std::string& udp,
+                        const std::string& addresses);
+
+    /// Set (or, with "", clear) the LAN endpoint of a known peer.
+    /// update_address() leaves it be.
+    void set_lan(const std::string& username, const std::string& lan);
+
+    /// Drop any cached (unpinned) entry, e.g. after a failed connect.
+    void invalidate(const std::string& username);
+
+    [[nodiscard]] std::vector<Peer> pinned() const;
+    [[nodiscard]] std::size_t size() const;
+
+    static constexpr std::size_t kShards = 16;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::optional<Peer> peer;             // nullopt = negative entry
+        Clock::time_point expires;
+        bool pinned = false;
+        std::list<std::string>::iterator lru;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;             // guards the rest
+        std::unordered_map<std::string, Entry> entries;
+        std::list<std::string> lru;           // unpinned entries, front = most recent
+        std::unordered_map<std::string, std::shared_future<std::optional<Peer>>> inflight;
+    };
+
+    /// What an entry costs, for memory accounting: the node, the keys and
+    /// the usual address strings.
+    static constexpr std::size_t kEntryBytes =
+        sizeof(std::pair<const std::string, Entry>) + 4 * sizeof(void*) + 64 + 128;
+
+    Shard& shard(const std::string& username) const;
+
+    /// Drop least recently used unpinned entries, round robin over the
+    /// shards, until about `bytes` are freed.
+    void shrink(std::size_t bytes);
+    /// Pop `shard`'s least recently used unpinned entry. Requires its lock.
+    static void evict_one_locked(Shard& shard);
+
+    void store_locked(Shard& shard, const std::string& username, std::optional<Peer> peer);
+    /// pin() without rebuilding the key table.
+    void pin_entry(const Peer& peer);
+    /// Build and publish a key table of the pinned entries.
+    void rebuild_friend_keys();
+    static void touch_locked(Shard& shard, Entry& entry);
+
+    Fetcher fetcher_;
+    RcuCell<Options> options_;
+    mutable std::array<Shard, kShards> shards_;
+    std::mutex friend_keys_mutex_;          // one rebuild at a time, so the last one wins
+    RcuCell<FriendKeys> friend_keys_{FriendKeys{}};
+
+    struct Retired {
+        FriendKeys::Keys keys;
+        int64_t until;                      // unix seconds
+    };
+    mutable std::mutex retired_mutex_;      // guards retired_
+    mutable std::unordered_map<std::string, Retired> retired_;
+    memory::Reclaimer reclaimer_;
+};
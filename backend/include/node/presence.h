@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config/rcu_cell.h"
+
+/**
+ * In-memory online/offline state of friends, fed by verified peer traffic
+ * (messages, acks and signed pings) rather than Supabase's last_seen.
+ *
+ * The table only decides; Node sends the pings and emits the events. Each
+ * tick() returns a Plan:
+ *   - online friends quiet for `interval` are pinged, and reported offline
+ *     once quiet for `timeout`;
+ *   - offline friends are probed with a ping on a backoff that doubles from
+ *     `interval` up to `max_probe_interval`; once there, each probe also
+ *     refreshes their address from Supabase, since a long-offline peer has
+ *     most likely moved.
+ *
+ * A ping is answered with a ping, unless we pinged that peer within the
+ * last `interval`; the incoming one is then taken as the reply, so two
+ * peers never bounce pings back and forth.
+ *
+ * Entries are striped by username hash over kShards locks, so the traffic
+ * that calls heard() and GET /friends' is_online() only contend within a
+ * shard; tick() takes the shards one at a time. Thread-safe.
+ */
+class PresenceTable {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::seconds interval{30};
+        std::chrono::seconds timeout{90};
+        std::chrono::seconds max_probe_interval{600};
+    };
+
+    struct Plan {
+        std::vector<std::string> ping;
+        std::vector<std::string> lookup;          // refresh from Supabase, then ping
+        std::vector<std::string> went_offline;
+    };
+
+    explicit PresenceTable(Options options);
+
+    /// New timings (config reload); running backoffs continue from where
+    /// they are.
+    void set_options(Options options);
+
+    /// Verified traffic from `username`. Returns true if they were offline.
+    bool heard(const std::string& username, Clock::time_point now = Clock::now());
+
+    /// Whether to answer `username`'s ping. Returning true counts as
+    /// having pinged them now.
+    bool should_reply(const std::string& username, Clock::time_point now = Clock::now());
+
+    /// Note a ping sent outside tick(), e.g. after a Supabase lookup.
+    void pinged(const std::string& username, Clock::time_point now = Clock::now());
+
+    /// Advance every friend's state. Entries of users no longer in
+    /// `friends` are dropped.
+    Plan tick(const std::vector<std::string>& friends, Clock::time_point now = Clock::now());
+
+    [[nodiscard]] bool is_online(const std::string& username) const;
+
+    /// Envelope-format time we last heard from `username`, if ever.
+    [[nodiscard]] std::optional<std::string> last_heard(const std::string& username) const;
+
+    /// Carry a last-heard time over a restart (state snapshot). The friend
+    /// still starts offline; ignored if we have heard from them since.
+    void restore_last_heard(const std::string& username, std::string at);
+
+    static constexpr std::size_t kShards = 16;
+
+private:
+    struct Entry {
+        bool online = false;
+        Clock::time_point last_heard{};
+        Clock::time_point last_pinged{};
+        Clock::time_point next_probe{};           // offline only
+        std::chrono::seconds probe_delay{0};
+        std::string last_heard_at;                // ISO 8601, for GET /friends
+    };
+
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;                 // guards entries
+        std::unordered_map<std::string, Entry> entries;
+    };
+
+    Shard& shard(const std::string& username) const;
+
+    RcuCell<Options> options_;
+    mutable std::array<Shard, kShards> shards_;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Which friends to connect to before there is anything to send.
+ *
+ * PeerConnectionPool already reuses a connection for as long as it is in
+ * use. After idle eviction the next message pays a TCP connect and a
+ * session handshake, and that is usually the first message of a new
+ * conversation, the one the user is watching. Node asks this class two
+ * things:
+ *
+ *  - On a hint that a message is coming (the UI opened a chat, or the user
+ *    started typing), whether to connect now. One connect per friend per
+ *    `cooldown`, so a typing burst or a UI re-reading history asks once.
+ *
+ *  - Which friends to keep connected at all times: the `keep_warm` with
+ *    the highest contact score. Every message to or from a friend adds 1
+ *    to their score, and scores halve every `half_life`, so the set
+ *    follows who the user talks to now rather than who they talked to
+ *    most ever.
+ *
+ * Scores live in memory only and start from zero on each run. The policy
+ * only decides; Node connects. Thread-safe.
+ */
+class PrewarmPolicy {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::size_t keep_warm = 8;              // 0: warm on hints only
+        std::chrono::seconds half_life{24 * 3600};
+        std::chrono::seconds cooldown{30};
+    };
+
+    explicit PrewarmPolicy(Options options);
+
+    /// A message to or from `peer`.
+    void contacted(const std::string& peer, Clock::time_point now = Clock::now());
+
+    /// A hint that a message to `peer` may follow. True to connect now.
+    bool hinted(const std::string& peer, Clock::time_point now = Clock::now());
+
+    /// Up to keep_warm peers with the highest scores, highest first.
+    [[nodiscard]] std::vector<std::string> keep_warm(Clock::time_point now = Clock::now()) const;
+
+private:
+    struct Entry {
+        double score = 0;                       // as of `scored_at`
+        Clock::time_point scored_at{};
+        Clock::time_point hinted_at{};
+        bool hinted_ever = false;
+    };
+
+    /// `entry`'s score decayed to `now`.
+    double score_at(const Entry& entry, Clock::time_point now) const;
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
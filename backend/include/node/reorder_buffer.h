@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "network/user_id.h"
+
+/**
+ * Puts each friend's direct messages back in the order they were sent
+ * (protocol/message_format.md §4.4).
+ *
+ * Messages from one friend can reach Node out of order: they are opened
+ * on parallel crypto workers, arrive over more than one connection or
+ * transport, and a backlog from Supabase can interleave with live ones.
+ * Each payload carries `seq`: the sender's run (its start time in ms) and
+ * a counter it keeps per recipient. A message that is next in its
+ * sender's sequence is released at once, with any held ones it unblocks.
+ * One that skips ahead is held until the gap fills, or for `hold` at most,
+ * then released with the rest anyway. A late message (a number already
+ * passed, or an earlier run) is released at once: it is a retransmit or
+ * was overtaken, and the store still dates it by its signed timestamp.
+ *
+ * A later run means the sender restarted, and starts its sequence over.
+ * State is in memory only: after our own restart, the first message from
+ * each friend sets where their sequence stands.
+ *
+ * Releases run on the calling thread, in order, under the buffer's lock,
+ * so the store receives each friend's messages in sequence. They must not
+ * call back into the buffer. Thread-safe.
+ */
+class ReorderBuffer {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Release = std::function<void()>;
+
+    struct Seq {
+        uint64_t run = 0;
+        uint64_t n = 0;
+    };
+
+    struct Options {
+        std::chrono::milliseconds hold{250};
+        std::size_t max_held = 64;              // per sender; past it the gap is given up
+        std::size_t max_senders = 4096;         // idle ones are forgotten past it
+    };
+
+    /// "<run>.<n>", as carried in the payload.
+    static std::string format(Seq seq);
+    /// nullopt unless `text` is two decimal numbers joined by '.'.
+    static std::optional<Seq> parse(std::string_view text);
+
+    explicit ReorderBuffer(Options options);
+
+    /// Release `release` now, or hold it until the messages before it from
+    /// `sender` arrive. With `may_hold` false (a batch the caller has
+    /// already sorted) it is released now, after any held messages it
+    /// overtakes, but still advances the sequence. True if it was held.
+    /// A sender without an id (UserId::None) is not ordered at all.
+    bool offer(UserId sender, Seq seq, Release release, bool may_hold = true,
+               Clock::time_point now = Clock::now());
+
+    /// Release, in order, everything held from senders whose hold ran out.
+    void expire(Clock::time_point now = Clock::now());
+
+    /// When the earliest hold runs out; nullopt if nothing is held.
+    [[nodiscard]] std::optional<Clock::time_point> next_deadline() const;
+
+    /// Messages held, across all senders.
+    [[nodiscard]] std::size_t held() const;
+
+private:
+    struct Sender {
+        uint64_t run = 0;
+        uint64_t next = 0;                      // 0: nothing seen this run
+        std::map<uint64_t, Release> held;
+        Clock::time_point deadline{};           // of the hold on held.begin()
+    };
+
+    /// Release held messages from `s.next` on for as long as they follow
+    /// on; restarts the hold for a gap that remains.
+    void drain(Sender& s, Clock::time_point now);
+    /// Release everything held, in order, and carry on after the last.
+    static void flush(Sender& s);
+    /// Make room for a new sender by forgetting those holding nothing.
+    void evict_idle();
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<UserId, Sender> senders_;
+};
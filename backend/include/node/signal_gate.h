@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Coalescing and rate limits for conversation signals: typing indicators
+ * and read receipts (protocol/message_format.md §9, "signal").
+ *
+ * A signal is state, not a message: only the latest one per peer and kind
+ * matters, so nothing queues. Outbound, offer() lets a signal go at once
+ * if the last one of its kind to that peer went `min_interval` ago or
+ * more; otherwise it is held, replacing whatever was held before, and
+ * flush() hands it over when the interval is up. A repeat of the state
+ * last sent is dropped, except that "typing" is repeated every
+ * `typing_refresh` so the receiver's auto-clear (5 s in the UI) doesn't
+ * fire while the user is still typing.
+ *
+ * Inbound, received() passes a signal on to the UI only if it changes the
+ * state, or repeats "typing" `min_interval` or more after the last one
+ * passed (which restarts the UI's auto-clear).
+ *
+ * The gate only decides; Node seals, sends and emits. Thread-safe.
+ */
+class SignalGate {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Kind : uint8_t { Typing = 1, Read = 2 };
+
+    struct Options {
+        std::chrono::milliseconds min_interval{1000};
+        std::chrono::milliseconds typing_refresh{3000};
+    };
+
+    struct Signal {
+        std::string peer;
+        Kind kind = Kind::Typing;
+        std::string value;                      // typing: "0" or "1"; read: msg_id
+    };
+
+    explicit SignalGate(Options options);
+
+    /// A signal from the user. True to send it now; otherwise it was held
+    /// or dropped.
+    bool offer(const Signal& signal, Clock::time_point now = Clock::now());
+
+    /// Held signals whose interval is up, now counted as sent.
+    std::vector<Signal> flush(Clock::time_point now = Clock::now());
+
+    /// When the earliest held signal falls due, if one is held.
+    [[nodiscard]] std::optional<Clock::time_point> next_due() const;
+
+    /// A signal from `signal.peer`. True to pass it on to the UI.
+    bool received(const Signal& signal, Clock::time_point now = Clock::now());
+
+private:
+    struct Lane {
+        std::string value;                      // last sent or passed on
+        Clock::time_point at{};
+        std::optional<std::string> held;        // outbound only
+    };
+
+    struct Entry {
+        std::array<Lane, 2> out;                // by Kind - 1
+        std::array<Lane, 2> in;
+    };
+
+    /// Whether sending `value` on `lane` now would tell the peer nothing new.
+    bool repeat(const Lane& lane, Kind kind, const std::string& value,
+                Clock::time_point now) const;
+
+    Options options_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "node/peer_directory.h"
+
+/**
+ * In-memory node state saved on clean shutdown so the next start can skip
+ * rebuilding it (`node.state_snapshot`).
+ *
+ * Holds the pinned friend directory, when each friend was last heard from,
+ * and which peers had a cached shared key — their public keys only; the
+ * shared keys are recomputed, never written out. The file is memory-mapped
+ * read-only on load and trusted only if its checksum holds and its
+ * generation equals the database's (MessageStore::generation()), which
+ * every change to the friends table bumps. Anything else means a crash or
+ * an edit since it was written, and the caller falls back to SQLite.
+ */
+struct StateSnapshot {
+    struct Friend {
+        PeerDirectory::Peer peer;
+        std::string last_heard;                 // ISO 8601; empty if never
+    };
+
+    uint64_t generation = 0;
+    std::vector<Friend> friends;
+    std::vector<std::vector<uint8_t>> shared_key_peers;   // most recently used first
+
+    /// Write to `path` atomically (temporary file, then rename).
+    bool save(const std::string& path) const;
+
+    /// Map and decode `path`; nullopt if it is missing, corrupt or not of
+    /// `generation`.
+    static std::optional<StateSnapshot> load(const std::string& path, uint64_t generation);
+};
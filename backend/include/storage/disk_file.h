@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+/**
+ * A file read and written at explicit offsets: pread / pwrite, or
+ * ReadFile / WriteFile with an OVERLAPPED offset on Windows. One system
+ * call per chunk and no shared file position, where a stream needs a seek
+ * before every read or write. Used for file-transfer chunks
+ * (node/file_transfers.h). Not thread-safe.
+ */
+class DiskFile {
+public:
+    enum class Mode {
+        Read,
+        ReadWrite,                              // created if missing
+    };
+
+    DiskFile() = default;
+    ~DiskFile();
+
+    DiskFile(DiskFile&& other) noexcept;
+    DiskFile& operator=(DiskFile&& other) noexcept;
+    DiskFile(const DiskFile&) = delete;
+    DiskFile& operator=(const DiskFile&) = delete;
+
+    /// Open `path`, closing whatever was open. False if it can't be.
+    bool open(const std::filesystem::path& path, Mode mode);
+    void close();
+    [[nodiscard]] bool is_open() const;
+
+    /// Fill `out` from `offset`. False on an error, or if the file ends
+    /// first.
+    bool read_at(uint64_t offset, std::span<uint8_t> out);
+
+    /// Write all of `data` at `offset`.
+    bool write_at(uint64_t offset, std::span<const uint8_t> data);
+
+private:
+#ifdef _WIN32
+    void* handle_ = nullptr;                    // HANDLE
+#else
+    int fd_ = -1;
+#endif
+};
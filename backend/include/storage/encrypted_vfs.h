@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <sqlite3.h>
+
+#include "crypto/secure_arena.h"
+
+/**
+ * An SQLite VFS that encrypts the database at rest, one page at a time.
+ *
+ * Every page image that reaches the disk — in the database file, the WAL
+ * or a rollback journal — is sealed with XChaCha20-Poly1305 under a key
+ * derived from the user's passphrase (Argon2id). The first kPageSize -
+ * kReserveBytes bytes of a page are ciphertext; the page's random nonce
+ * and tag take the last kReserveBytes, which SQLite is told to leave
+ * unused (SQLITE_FCNTL_RESERVE_BYTES). Headers, WAL frame headers and
+ * the shared-memory index carry no message data and stay as they are.
+ *
+ * Encryption sits below SQLite's page cache, so the cache holds decrypted
+ * pages: scrolling history and FTS queries that hit it cost no crypto at
+ * all, and only a cache miss pays for one page decryption. Memory-mapped
+ * I/O is not offered, as it would bypass the cipher.
+ *
+ * The key lives in a SecureArena. The salt and a key check sit next to
+ * the database in `<path>-salt`, so a wrong passphrase is reported as
+ * such instead of as a corrupt file.
+ */
+class EncryptedVfs {
+public:
+    /// Every page is this size; MessageStore sets `PRAGMA page_size` to it.
+    static constexpr int kPageSize = 4096;
+    /// Nonce and tag at the end of each page.
+    static constexpr int kReserveBytes = 24 + 16;
+
+    /// Derive the key for the database at `path` and register a VFS for
+    /// it. A new database gets a fresh salt. Returns null (and logs why)
+    /// for a wrong passphrase, or for an existing database that was
+    /// created unencrypted.
+    static std::unique_ptr<EncryptedVfs> open(const std::string& path,
+                                              std::string_view passphrase);
+
+    ~EncryptedVfs();
+
+    EncryptedVfs(const EncryptedVfs&) = delete;
+    EncryptedVfs& operator=(const EncryptedVfs&) = delete;
+
+    /// The VFS name to pass to sqlite3_open_v2().
+    [[nodiscard]] const char* name() const { return name_.c_str(); }
+
+    /// Seal `page` (kPageSize bytes) in place.
+    void encrypt_page(uint8_t* page) const;
+    /// Open `page` in place; false if it was not sealed with this key.
+    /// An all-zero page (a hole in the file) is left as it is.
+    [[nodiscard]] bool decrypt_page(uint8_t* page) const;
+
+    /// Seal a blob kept outside the database (history archive blocks)
+    /// under the same key: nonce | tag | ciphertext. `context` is
+    /// authenticated too, so a blob can't be moved to another context.
+    [[nodiscard]] std::string seal(std::string_view plain, std::string_view context) const;
+    /// Undo seal(); nullopt if the blob or its context was tampered with.
+    [[nodiscard]] std::optional<std::string> unseal(std::string_view sealed,
+                                                    std::string_view context) const;
+
+    /// The VFS this one forwards to.
+    [[nodiscard]] sqlite3_vfs* real() const { return real_; }
+
+private:
+    EncryptedVfs(sqlite3_vfs* real, std::string name);
+
+    sqlite3_vfs* real_;
+    std::string name_;
+    SecureArena arena_;
+    std::span<uint8_t> key_;
+    sqlite3_vfs vfs_{};
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "storage/mapped_file.h"
+#include "storage/message_store.h"
+
+class EncryptedVfs;
+
+/**
+ * Segment files for archived history (MessageStore::Options::archive_after).
+ *
+ * Old messages leave the `messages` table in blocks of up to
+ * kBlockMessages, oldest first. Each block is compressed (zstd, when the
+ * build has it), sealed under the database key when the store is
+ * encrypted, and appended to its conversation's segment file
+ * `<dir>/<hex peer>.<n>.seg`. Segments are only ever appended to, except
+ * that deleting an archived message rewrites its conversation into the
+ * next segment number.
+ *
+ * The sparse index — one row per block in `archive_blocks` (offset,
+ * length, count, time range and a term filter) — lives in SQLite, which
+ * makes SQLite the source of truth: a block is part of the archive once
+ * the transaction that indexes it and deletes its rows from `messages`
+ * commits. Bytes a crash left past the last indexed block are cut off
+ * before the next append.
+ *
+ * Reads map the segment and decode just the blocks asked for; the most
+ * recently decoded ones are kept, so paging back through old history
+ * decodes each block once. This class only does file I/O and encoding —
+ * MessageStore owns the index and calls it on the DB thread only.
+ */
+class HistoryArchive {
+public:
+    /// Most messages per block; a block also closes once its text passes
+    /// kBlockBytes.
+    static constexpr std::size_t kBlockMessages = 256;
+    static constexpr std::size_t kBlockBytes = 64 * 1024;
+
+    /// Bloom filter over a block's lowercased words and their 3-byte
+    /// prefixes, so search skips blocks without decoding them.
+    using Terms = std::array<uint8_t, 1024>;
+
+    /// One `archive_blocks` row.
+    struct Block {
+        int64_t segment = 0;
+        uint64_t offset = 0;
+        uint32_t length = 0;
+        uint32_t count = 0;
+        std::string first_ts;                   // oldest timestamp in the block
+        std::string last_ts;                    // newest
+        Terms terms{};
+    };
+
+    using Messages = std::vector<MessageStore::Message>;
+
+    /// A search() query against archived text: every word must appear,
+    /// and the last one may be a prefix unless `text` ends in a space —
+    /// as for the FTS index, but with ASCII-only case folding.
+    class Query {
+    public:
+        explicit Query(std::string_view text);
+
+        [[nodiscard]] bool empty() const { return words_.empty(); }
+        /// False when `terms` proves no message in the block matches.
+        [[nodiscard]] bool may_match(const Terms& terms) const;
+        /// An excerpt of `text` with the matched words wrapped in `**`, or
+        /// nullopt if it doesn't match.
+        [[nodiscard]] std::optional<std::string> match(std::string_view text) const;
+
+    private:
+        std::vector<std::string> words_;
+        bool last_is_prefix_ = false;
+    };
+
+    /// `cipher` seals blocks when set; it must outlive the archive.
+    HistoryArchive(std::string dir, const EncryptedVfs* cipher);
+
+    /// Append `messages` (one conversation, oldest first) to segment
+    /// `segment` at `end`, the end of its last indexed block. The block is
+    /// on disk when this returns; the caller then indexes it.
+    std::optional<Block> append(const std::string& peer, int64_t segment, uint64_t end,
+                                const Messages& messages);
+
+    /// Decode an indexed block; nullptr (logged) if it is unreadable.
+    std::shared_ptr<const Messages> read(const std::string& peer, const Block& block);
+
+    /// Write `blocks` as segment `segment` from scratch, returning their
+    /// index rows. Used to drop a deleted message; the caller swaps the
+    /// index over, then calls remove_segments().
+    std::optional<std::vector<Block>> rewrite(const std::string& peer, int64_t segment,
+                                              const std::vector<Messages>& blocks);
+
+    /// Delete `peer`'s segment files other than `keep` (all if negative).
+    void remove_segments(const std::string& peer, int64_t keep);
+
+private:
+    std::string segment_path(const std::string& peer, int64_t segment) const;
+    /// Encode a block and append it to `out`; returns its index row with
+    /// offset and length filled in relative to `base`.
+    Block encode(const std::string& peer, const Messages& messages, uint64_t base,
+                 std::string& out) const;
+    const MappedFile& mapping(const std::string& path);
+    void forget(const std::string& path);
+
+    std::string dir_;
+    const EncryptedVfs* cipher_;
+    std::map<std::string, std::unique_ptr<MappedFile>> mappings_;
+    /// Recently decoded blocks, most recent first, keyed by path and offset.
+    std::list<std::pair<std::string, std::shared_ptr<const Messages>>> decoded_;
+};
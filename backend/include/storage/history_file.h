@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "storage/message_store.h"
+
+/**
+ * The whole-history file that `<config> export <file>` writes and
+ * `<config> import <file>` reads (main.cpp), for moving a chat history to
+ * another machine without paging it through GET /messages.
+ *
+ * After an 8-byte header comes a run of chunks, each holding up to about
+ * kChunkBytes of message records, compressed like archive blocks (zstd,
+ * when the build has it) and length-prefixed, so both ends stream it a
+ * chunk at a time whatever the size of the history. A chunk with no
+ * records ends the file, which tells a complete copy from a truncated one.
+ *
+ * The records are not encrypted: the file is as sensitive as an
+ * unencrypted database, and export creates it readable by its owner only.
+ */
+class HistoryFileWriter {
+public:
+    /// Raw record bytes per chunk, well under the decompression cap.
+    static constexpr std::size_t kChunkBytes = 1024 * 1024;
+
+    /// Writes to `out`, which the caller opened in binary mode and closes.
+    explicit HistoryFileWriter(std::FILE* out);
+
+    /// Add a message; false (logged) once a write has failed.
+    bool add(const MessageStore::Message& message);
+
+    /// Write the last chunk and the end marker, and flush.
+    bool finish();
+
+private:
+    bool write_chunk();
+
+    std::FILE* out_;
+    std::string raw_;
+    uint32_t count_ = 0;
+    bool started_ = false;                      // header written
+    bool ok_ = true;
+};
+
+class HistoryFileReader {
+public:
+    /// Reads from `in`, which the caller opened in binary mode and closes.
+    explicit HistoryFileReader(std::FILE* in);
+
+    /// The next chunk's messages; an empty batch once the end marker is
+    /// read. Nullopt (logged) if this is not a history file, or it is
+    /// damaged or ends early.
+    std::optional<std::vector<MessageStore::Message>> next();
+
+private:
+    std::FILE* in_;
+    bool started_ = false;                      // header read
+    bool ended_ = false;
+};
+
+namespace history_file {
+
+/// Write every message in `store` to `path` ("-" for stdout). Blocking;
+/// false (logged) on failure.
+bool export_to(MessageStore& store, const std::string& path);
+
+/// Import a file export_to() wrote ("-" for stdin) into `store`
+/// (MessageStore::import_history). Blocking; false (logged) on failure.
+bool import_from(MessageStore& store, const std::string& path);
+
+} // namespace history_file
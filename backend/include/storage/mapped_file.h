@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+
+/**
+ * Read-only memory mapping of a whole file, for formats read in place:
+ * the state snapshot (node/state_snapshot.h) and history archive segments
+ * (storage/history_archive.h). Empty if the file is missing, empty or
+ * can't be mapped. The mapping is a snapshot of the file's length when
+ * opened; map it again after the file grows.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    [[nodiscard]] std::span<const uint8_t> bytes() const {
+        return {static_cast<const uint8_t*>(data_), size_};
+    }
+
+private:
+#ifdef _WIN32
+    void* file_ = nullptr;                      // HANDLE
+    void* mapping_ = nullptr;                   // HANDLE
+#else
+    int fd_ = -1;
+#endif
+    void* data_ = nullptr;
+    std::size_t size_ = 0;
+};
@@ -0,0 +1,755 @@
+#pragma once
+
+#include <asio.hpp>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "network/backpressure.h"
+#include "network/timer_wheel.h"
+#include "telemetry/watchdog.h"
+
+struct sqlite3;
+struct sqlite3_stmt;
+class EncryptedVfs;
+class HistoryArchive;
+
+/**
+ * Local SQLite store for chat history, friends and replay protection
+ * (ARCHITECTURE.md §8).
+ *
+ * The connection belongs to a dedicated DB thread: every public call just
+ * queues work there and returns, so SQLite I/O never runs on (or blocks) an
+ * io_context thread. Completion callbacks run on the DB thread — keep them
+ * short and hop back to your own executor (coro::from_callback does this
+ * for coroutines).
+ *
+ * The database runs in WAL mode and every statement on the hot paths is
+ * prepared once at open() and reused. History pages, search and export
+ * are served by a pool of Options::read_connections read-only connections,
+ * each on a reader thread of its own with its own prepared statements, so
+ * they run side by side and neither wait for nor hold up the writer; their
+ * callbacks run on that reader thread. A read reaches a reader straight
+ * away when nothing is queued on the DB thread, and otherwise once the DB
+ * thread gets to it, so it still sees every write made before it. Each
+ * runs in one read transaction. The history archive belongs to the DB
+ * thread: a read that would run on into archived messages is handed back
+ * to it.
+ *
+ * Message inserts are group-committed: they are buffered for up to
+ * Options::commit_window (or until Options::commit_batch rows are waiting)
+ * and written in one transaction, so a burst of messages costs one fsync
+ * rather than one each. An insert's callback runs only after its
+ * transaction has committed, which makes it the signal that the message is
+ * durable. Every other operation flushes the buffer first, so reads always
+ * see earlier writes.
+ *
+ * The `outbox` table holds offline messages that still have to reach
+ * Supabase (OfflineMailbox), so they survive a restart.
+ *
+ * Group conversations (GroupChat) keep their members and sender keys in
+ * `groups`, `group_members` and `group_sender_keys`; their messages are
+ * ordinary `messages` rows whose peer is the group id and whose `sender`
+ * names the member who wrote them.
+ *
+ * For device sync (DeviceSync) the store keeps a digest of `messages` per
+ * UTC day in memory: a row count and the XOR of a hash of every msg_id.
+ * It is built by one scan on first use and then kept up to date by the
+ * inserts, so comparing two devices' histories costs no table scan. The
+ * device-sync calls and archive passes are bulk work (network/
+ * traffic_class.h): they run one job per pass through the DB thread's
+ * queue, so chat inserts and history reads posted meanwhile go first.
+ *
+ * With Options::archive_after set, a background pass moves old messages
+ * out of `messages` into compressed per-conversation segment files
+ * (storage/history_archive.h), keeping the live tables and their indexes
+ * small. Archived messages stay visible to every read: history pages run
+ * on into them, search scans them after the FTS index, and device sync
+ * counts them. They are read-only, except that they can be deleted.
+ *
+ * The friends list needs each conversation's newest message and unread
+ * count. Triggers keep them in `conversation_summary` as messages are
+ * inserted and deleted, and a copy of that table lives in memory, so
+ * summary() costs a map lookup rather than a query per friend.
+ *
+ * A disappearing message carries an `expires_at`. A partial index holds
+ * just those rows, soonest first, and one timer on the DB thread's
+ * TimerWheel is set for the soonest: when it fires, the due rows are
+ * deleted a batch per transaction (the triggers take them out of the
+ * search index and the summaries) and on_change_ tells the node to drop
+ * them from its caches. A sweep costs what it deletes, however large the
+ * table. Disappearing messages are never archived or exported.
+ *
+ * Reactions, edits and deletes (Delta) never rewrite a message row. They
+ * are appended to `message_deltas`, in the same group commits as message
+ * inserts, and folded into the messages a read returns: history pages and
+ * search hits carry the latest text, the reactions and the edited and
+ * deleted flags. A fold is cached per message, least recently read first
+ * out, and the ids of messages with any deltas are kept in memory, so a
+ * page of messages nobody reacted to costs no extra query.
+ */
+class MessageStore {
+public:
+    struct Options {
+        std::string path = "local_chat.db";
+        /// Keep the whole database in memory (`database.engine: "memory"`):
+        /// same schema and queries, no file, no journal, nothing survives
+        /// close(). `path`, `encrypt` and `archive_after` are ignored.
+        bool in_memory = false;
+        /// `PRAGMA synchronous`. NORMAL is durable across application
+        /// crashes in WAL mode; only a power loss can drop the last commits.
+        std::string synchronous = "NORMAL";
+        /// Page cache size in KiB (`PRAGMA cache_size = -N`). With
+        /// encryption this is also the cache of decrypted pages.
+        int cache_size_kib = 8 * 1024;
+        /// Encrypt every page at rest (storage/encrypted_vfs.h) under a key
+        /// derived from `passphrase`, which open() wipes once used.
+        bool encrypt = false;
+        std::string passphrase;
+        std::chrono::milliseconds busy_timeout{5000};
+        /// How long an insert may wait for others to share its commit.
+        std::chrono::milliseconds commit_window{5};
+        /// Commit early once this many inserts are buffered.
+        std::size_t commit_batch = 256;
+        /// Seen ids whose signed send time is older than this are pruned
+        /// (0 keeps them forever). Only safe if the caller rejects messages
+        /// older than the same window.
+        std::chrono::seconds replay_window{0};
+        std::chrono::seconds prune_interval{3600};
+        /// search() ranks only this many of the most recent matches, which
+        /// keeps a query for a very common word as fast as for a rare one.
+        std::size_t search_candidates = 1000;
+        /// Messages older than this move to the history archive (0 never
+        /// archives). Sent messages wait until they are delivered.
+        std::chrono::hours archive_after{0};
+        /// Segment file directory; empty means `<path>-archive`.
+        std::string archive_dir;
+        std::chrono::seconds archive_interval{3600};
+        /// Folded delta views kept in memory, one per message.
+        std::size_t delta_views = 4096;
+        /// Read-only connections serving history(), search() and
+        /// export_history(), each with its own thread and page cache of
+        /// `cache_size_kib`. 0 reads on the DB thread; ignored in memory.
+        std::size_t read_connections = 2;
+        /// CPUs to pin the DB thread to (network/cpu_affinity.h); empty =
+        /// float. It pins itself before opening anything, so the page
+        /// cache is allocated on its NUMA node.
+        std::vector<unsigned> cpus;
+    };
+
+    enum class Direction { Sent, Received };
+
+    /// One reaction by `from` (empty: us).
+    struct Reaction {
+        std::string emoji;
+        std::string from;
+
+        bool operator==(const Reaction&) const = default;
+    };
+
+    /// One row of `messages`.
+    struct Message {
+        std::string msg_id;
+        std::string peer;
+        Direction direction = Direction::Sent;
+        std::string plaintext;
+        std::string timestamp;                  // ISO 8601 UTC
+        bool delivered = false;
+        std::string delivery_method = "direct"; // "direct" or "offline"
+        std::string sender;                     // group messages only: the author
+        std::string expires_at;                 // ISO 8601 UTC; empty: never
+        // Folded from message_deltas by reads; never stored in the row.
+        std::vector<Reaction> reactions;        // in the order they were added
+        bool edited = false;                    // plaintext is the latest edit
+        bool deleted = false;                   // deleted by its author; plaintext empty
+    };
+
+    enum class DeltaOp : uint8_t { React = 1, Unreact = 2, Edit = 3, Delete = 4 };
+
+    /// One row of `message_deltas`: a change to message `target`. Edits and
+    /// deletes count only from the message's author, and only deltas filed
+    /// under the message's own conversation count at all.
+    struct Delta {
+        std::string delta_id;                   // unique; a stored id is not applied twice
+        std::string target;                     // msg_id
+        std::string peer;                       // the conversation: username or group id
+        std::string author;                     // empty: us
+        DeltaOp op = DeltaOp::React;
+        std::string value;                      // the emoji, or the new text
+        std::string timestamp;                  // ISO 8601 UTC
+    };
+
+    /// One row of `friends`.
+    struct Friend {
+        std::string username;
+        std::vector<uint8_t> public_key;        // raw X25519 key
+        std::vector<uint8_t> signing_key;       // raw Ed25519 key
+        std::string last_ip;
+        std::string last_seen;
+        std::string added_at;
+    };
+
+    /// One row of `groups` with its members.
+    struct Group {
+        std::string group_id;
+        std::string name;
+        std::string created_by;
+        std::vector<std::string> members;       // including created_by
+        std::string created_at;
+    };
+
+    /// One row of `group_sender_keys`: the key `sender` seals its messages
+    /// to `group_id` with.
+    struct SenderKey {
+        std::string group_id;
+        std::string sender;
+        std::vector<uint8_t> key;
+    };
+
+    /// A window of one conversation, oldest first.
+    struct HistoryPage {
+        std::vector<Message> messages;
+        bool has_more = false;                  // more beyond the page (older, or
+                                                // newer for history_after)
+        std::optional<std::size_t> total;       // offset queries only
+    };
+
+    /// One search() result: the message plus an excerpt with the matched
+    /// words wrapped in `**`.
+    struct SearchHit {
+        Message message;
+        std::string snippet;
+    };
+
+    /// One row of `outbox`: an offline message not yet inserted in Supabase.
+    struct OutboxEntry {
+        std::string msg_id;                     // also the Supabase row id
+        std::string to_user;
+        std::string ciphertext;                 // base64 of the whole envelope
+        std::string queued_at;                  // ISO 8601 UTC
+        int attempts = 0;                       // failed inserts so far
+    };
+
+    /// The messages whose timestamp starts with `key` ("YYYY-MM-DD" for a
+    /// day, "YYYY-MM" for a month), summarised: equal digests mean, short
+    /// of a hash collision, the same set of msg_ids.
+    struct RangeDigest {
+        std::string key;
+        uint64_t count = 0;
+        std::array<uint8_t, 16> hash{};         // XOR of BLAKE2b-128(msg_id)
+
+        bool operator==(const RangeDigest&) const = default;
+    };
+
+    /// One row of `conversation_summary`: what the friends list shows.
+    struct Summary {
+        std::string last_msg_id;
+        std::string last_text;                  // the first 160 characters
+        std::string last_timestamp;             // ISO 8601 UTC
+        Direction last_direction = Direction::Sent;
+        std::size_t unread = 0;                 // received since the last one read
+    };
+
+    enum class InsertResult { Inserted, Duplicate, Failed };
+
+    using Done            = std::function<void(bool ok)>;
+    using InsertCallback  = std::function<void(InsertResult result)>;
+    using HistoryCallback = std::function<void(std::optional<HistoryPage> page)>;
+    using FriendsCallback = std::function<void(std::vector<Friend> friends)>;
+    using SearchCallback  = std::function<void(std::optional<std::vector<SearchHit>> hits)>;
+    using OutboxCallback  = std::function<void(std::optional<std::vector<OutboxEntry>> entries)>;
+    using IdsCallback     = std::function<void(std::vector<std::string> msg_ids)>;
+    using GroupsCallback  = std::function<void(std::vector<Group> groups)>;
+    using DigestsCallback = std::function<void(std::vector<RangeDigest> digests)>;
+    using MessagesCallback = std::function<void(std::vector<Message> messages)>;
+    using CountCallback   = std::function<void(std::size_t count)>;
+    using ChangeCallback  = std::function<void(const std::string& peer)>;
+    using MessageSink     = std::function<bool(const Message& message)>;
+    using MessageSource   = std::function<std::optional<std::vector<Message>>()>;
+    using TransferCallback = std::function<void(std::optional<std::size_t> count)>;
+
+    /// Rows import_history() writes per transaction.
+    static constexpr std::size_t kImportTransactionRows = 50000;
+
+    MessageStore();
+    explicit MessageStore(Options options);
+    ~MessageStore();
+
+    MessageStore(const MessageStore&) = delete;
+    MessageStore& operator=(const MessageStore&) = delete;
+
+    /// Open (or create) the database, apply the pragmas and schema and
+    /// prepare statements. Blocks until done. Until it succeeds every call
+    /// below fails immediately.
+    bool open();
+
+    /// open() without waiting: the DB thread opens the database while the
+    /// caller gets on with other startup work.
+    std::future<bool> open_async();
+
+    /// Finish queued work and close the database.
+    void close();
+
+    [[nodiscard]] bool is_open() const { return open_; }
+
+    /// Change Options::commit_window and commit_batch (config reload);
+    /// applies from the next batch.
+    void set_commit_policy(std::chrono::milliseconds window, std::size_t batch);
+
+    /// Called on the DB thread once a change to the conversation with
+    /// `peer` is durable: a message stored, marked delivered, given a new
+    /// delivery method or deleted. Set before open().
+    void set_on_change(ChangeCallback cb) { on_change_ = std::move(cb); }
+
+    /// Count inserts the DB thread hasn't taken up yet towards
+    /// `backpressure`: peer reads pause at kBacklogHigh of them and go on
+    /// at kBacklogLow. Set before the first insert.
+    void set_backpressure(Backpressure& backpressure) {
+        backlog_ = &backpressure.level("store_inserts", kBacklogHigh, kBacklogLow);
+    }
+    static constexpr std::size_t kBacklogHigh = 4096;
+    static constexpr std::size_t kBacklogLow = 1024;
+
+    // ── Messages ────────────────────────────────────────────────────────
+
+    /// Store a message we sent (or any message without replay checks).
+    void insert_message(Message message, Done done = {});
+
+    /// Store a received message and mark its id as seen, atomically. A
+    /// message whose id was already seen is reported as Duplicate and not
+    /// stored again. `done` runs once the outcome is durable.
+    ///
+    /// `expires` says message.timestamp was authenticated by the sender, so
+    /// the seen entry may be pruned once it leaves Options::replay_window.
+    /// Ids of messages without one are kept forever.
+    void record_received(Message message, bool expires, InsertCallback done);
+
+    /// Commit buffered inserts now instead of at the end of the window.
+    void flush();
+
+    /// Append our own deltas; they share the next group commit.
+    void append_deltas(std::vector<Delta> deltas, Done done = {});
+
+    /// Store a batch of received deltas, all from one sender in one
+    /// conversation, and mark `batch_id` as seen, atomically: like
+    /// record_received(), a batch seen before is reported as Duplicate.
+    /// `sent_at` is the batch's timestamp, authenticated when `expires`.
+    void record_deltas(std::string batch_id, std::string sent_at, bool expires,
+                       std::vector<Delta> deltas, InsertCallback done);
+
+    void mark_delivered(std::string msg_id, Done done = {});
+    /// E.g. "offline" once an unacked direct message was queued in Supabase.
+    void set_delivery_method(std::string msg_id, std::string method, Done done = {});
+    void delete_message(std::string msg_id, Done done = {});
+
+    /// `limit` messages of the conversation with `peer`, skipping the
+    /// `offset` most recent ones, returned oldest first. Also counts the
+    /// conversation; cost grows with `offset`.
+    void history(std::string peer, std::size_t limit, std::size_t offset,
+                 HistoryCallback done);
+
+    /// Keyset variant: the `limit` messages just older than `before`, which
+    /// is either a msg_id (exclusive) or an ISO 8601 timestamp. Served from
+    /// the (peer, timestamp) index, so every page costs the same however
+    /// far back it is. An unknown msg_id yields an empty page.
+    void history_before(std::string peer, std::string before, std::size_t limit,
+                        HistoryCallback done);
+
+    /// Forward variant for polling: up to `limit` messages stored after
+    /// message `since` (all messages when empty), in the order they were
+    /// stored. An unknown msg_id yields an empty page.
+    void history_after(std::string peer, std::string since, std::size_t limit,
+                       HistoryCallback done);
+
+    /// Full-text search over message text, best match first. Every word
+    /// of `text` must match; the last may be a prefix. An empty `peer`
+    /// searches all conversations. Fails (nullopt) if SQLite lacks FTS5.
+    /// When the live matches don't fill `limit`, archived messages follow,
+    /// newest first and unranked.
+    void search(std::string text, std::string peer, std::size_t limit, SearchCallback done);
+
+    /// The newest message and unread count of the conversation with
+    /// `peer`, from memory: callable from any thread, and never waits for
+    /// the DB thread. Nullopt if it has no messages (or before open()).
+    [[nodiscard]] std::optional<Summary> summary(const std::string& peer) const;
+
+    /// The user has read the conversation with `peer` up to message
+    /// `msg_id`: received messages no newer than it stop counting as
+    /// unread. Marking an older message than before changes nothing.
+    void mark_read(std::string peer, std::string msg_id, Done done = {});
+
+    // ── Friends ─────────────────────────────────────────────────────────
+
+    void upsert_friend(Friend f, Done done = {});
+    /// upsert_friend() for many, in one transaction: all or none.
+    void upsert_friends(std::vector<Friend> friends, Done done = {});
+    void remove_friend(std::string username, Done done = {});
+    void friends(FriendsCallback done);
+
+    /// Blocking friends() for startup.
+    std::vector<Friend> load_friends();
+
+    /// Counter bumped (by trigger) on every change to the friends table;
+    /// a state snapshot is valid only for the generation it was written
+    /// at. Blocking; 0 if the database is closed.
+    uint64_t generation();
+
+    // ── Groups ──────────────────────────────────────────────────────────
+
+    /// Insert a group or rename it, and replace its member list.
+    void upsert_group(Group group, Done done = {});
+    void groups(GroupsCallback done);
+
+    /// Blocking groups() for startup.
+    std::vector<Group> load_groups();
+
+    /// Store (or replace) a member's sender key for a group.
+    void set_sender_key(SenderKey key, Done done = {});
+
+    /// Every stored sender key. Blocking, for startup.
+    std::vector<SenderKey> load_sender_keys();
+
+    // ── Outbox ──────────────────────────────────────────────────────────
+
+    /// Queue an offline message. Queuing a msg_id again replaces its entry.
+    void outbox_add(OutboxEntry entry, Done done = {});
+
+    /// Up to `limit` entries, fewest attempts first, then oldest first — so
+    /// a row Supabase keeps refusing doesn't hold up the ones behind it.
+    void outbox_peek(std::size_t limit, OutboxCallback done);
+
+    /// Drop entries Supabase has accepted.
+    void outbox_remove(std::vector<std::string> msg_ids, Done done = {});
+
+    /// Count one more failed insert for each entry.
+    void outbox_failed(std::vector<std::string> msg_ids, Done done = {});
+
+    /// Delete entries queued more than `max_age` ago (the recipient would
+    /// reject them as replays) or tried `max_attempts` times. Reports the
+    /// msg_ids dropped.
+    void outbox_compact(std::chrono::seconds max_age, int max_attempts, IdsCallback done);
+
+    // ── Device sync ─────────────────────────────────────────────────────
+
+    /// Digests of every day (`key_length` 10) or month (7) that has
+    /// messages, in key order, limited to keys starting with one of
+    /// `within` (all when empty).
+    void range_digests(std::size_t key_length, std::vector<std::string> within,
+                       DigestsCallback done);
+
+    /// The msg_ids of every message on the given days.
+    void ids_for_days(std::vector<std::string> days, IdsCallback done);
+
+    /// The stored messages among `msg_ids`; unknown ids are skipped.
+    void messages_by_ids(std::vector<std::string> msg_ids, MessagesCallback done);
+
+    /// Store messages copied from another device. Received ones are marked
+    /// seen like record_received(), so the same message arriving from the
+    /// peer later is a duplicate. Reports how many were new.
+    void import_messages(std::vector<Message> messages, CountCallback done);
+
+    // ── Bulk transfer ───────────────────────────────────────────────────
+
+    /// Hand every message but the disappearing ones to `sink` on the
+    /// reading thread, archived ones included: each conversation's archive oldest first, then the live
+    /// rows in the order they were stored. It all comes from one read
+    /// transaction, so a node writing meanwhile can't tear the copy.
+    /// `sink` returns false to stop. Reports how many messages it was
+    /// given; nullopt if stopped or on a database error.
+    void export_history(MessageSink sink, TransferCallback done);
+
+    /// Store the batches `next` returns, on the DB thread, until it returns
+    /// an empty one; nullopt stops the import, keeping what was committed.
+    /// For moving a whole history rather than syncing one: the secondary
+    /// indexes on `messages`, the search index and the conversation
+    /// summaries are brought up to date once at the end instead of row by
+    /// row (open() does it if a crash cuts that short), rows are written
+    /// kImportTransactionRows to a transaction, and imported messages count
+    /// as read. Messages already stored are skipped, so an interrupted
+    /// import can simply be run again. Run it with no node using the
+    /// database. Reports how many messages were new; nullopt on failure.
+    void import_history(MessageSource next, TransferCallback done);
+
+private:
+    enum Statement : std::size_t {
+        kInsertMessage,
+        kInsertSeen,
+        kPruneSeen,
+        kMarkDelivered,
+        kSetDeliveryMethod,
+        kDeleteMessage,
+        kSelectHistory,
+        kSelectHistoryBeforeId,
+        kSelectHistoryBeforeTime,
+        kSelectHistoryAfter,
+        kSearch,
+        kCountHistory,
+        kUpsertFriend,
+        kDeleteFriend,
+        kSelectFriends,
+        kSelectGeneration,
+        kUpsertGroup,
+        kDeleteGroupMembers,
+        kInsertGroupMember,
+        kSelectGroups,
+        kUpsertSenderKey,
+        kSelectSenderKeys,
+        kOutboxAdd,
+        kOutboxSelect,
+        kOutboxDelete,
+        kOutboxFailed,
+        kOutboxSelectStale,
+        kSelectDigestRows,
+        kSelectIdsForDay,
+        kSelectMessage,
+        kSelectPeer,
+        kArchivePeer,
+        kArchiveSelect,
+        kArchiveTail,
+        kArchiveInsertBlock,
+        kArchiveInsertId,
+        kArchiveBlocks,
+        kArchiveSearchBlocks,
+        kSelectArchived,
+        kArchiveDeleteBlocks,
+        kArchiveDeleteId,
+        kHasArchive,
+        kSelectSummaries,
+        kMarkRead,
+        kCountUnread,
+        kExportBlocks,
+        kExportMessages,
+        kSelectExpired,
+        kNextExpiry,
+        kInsertDelta,
+        kSelectDeltas,
+        kSelectDeltaTargets,
+        kDeleteDeltas,
+        kBegin,
+        kCommit,
+        kRollback,
+        kSavepoint,
+        kRelease,
+        kRollbackTo,
+        kStatementCount
+    };
+
+    /// Disappearing messages deleted per transaction; the next batch waits
+    /// behind whatever was posted meanwhile.
+    static constexpr std::size_t kExpireBatch = 200;
+
+    /// One buffered insert waiting for the next group commit.
+    struct PendingInsert {
+        Message message;                      // for deltas: just msg_id, peer and timestamp
+        bool check_seen = false;              // record_received: replay check + seen row
+        bool expires = false;                 // seen row carries sent_at
+        InsertCallback done;
+        std::vector<Delta> deltas;            // non-empty: delta rows instead of a message
+    };
+
+    /// A message's deltas, folded for its author.
+    struct DeltaView {
+        std::vector<Reaction> reactions;
+        std::optional<std::string> text;      // latest edit
+        bool deleted = false;
+        std::list<std::string>::iterator lru;
+    };
+
+    /// One conversation's `archive_blocks` rows, oldest first.
+    struct ArchiveIndex;
+
+    /// A read-only connection and its statements, owned by one reader thread.
+    struct Reader;
+
+    /// Queue `fn` on the DB thread.
+    void post(std::function<void()> fn);
+    /// Queue bulk work on the DB thread. It runs after everything posted
+    /// before it; work posted after it may overtake it.
+    void post_bulk(std::function<void()> fn);
+    /// Run the oldest bulk job, then requeue behind whatever has arrived.
+    void run_bulk();
+    /// Run `read` on a reader once everything posted before it is
+    /// committed. If it returns false (it needs the archive, or its
+    /// connection failed) or there are no readers, `on_db` is posted (or
+    /// bulk-posted) to do the read on the DB thread instead.
+    void post_read(std::function<bool(Reader&)> read, std::function<void()> on_db,
+                   bool bulk = false);
+    /// Credit the jobs run since the last call to unsettled_ once nothing
+    /// they buffered is still uncommitted. DB thread only.
+    void settle();
+    /// Start the reader threads; DB thread, at the end of open().
+    void start_readers();
+    /// Let the readers finish what is queued and join them.
+    void stop_readers();
+    /// Open `reader`'s connection and prepare its statements; false
+    /// (logged) on failure. Reader thread.
+    bool open_reader(Reader& reader);
+
+    // DB thread only.
+    void enqueue_insert(PendingInsert insert);
+    void commit_pending();
+    /// `stored` says whether a messages row (or a delta row) was actually
+    /// added.
+    InsertResult write_one(const PendingInsert& insert, bool& stored);
+    /// Fold each message's deltas into it, from delta_views_ or the table.
+    void apply_deltas(std::vector<Message>& messages);
+    void apply_deltas(Message& m);
+    /// The same on a reader, folding straight from its snapshot of the
+    /// table: delta_views_ belongs to the DB thread.
+    void apply_deltas(Reader& reader, std::vector<Message>& messages);
+    void apply_deltas(Reader& reader, Message& m);
+    /// Fold `m`'s rows from a kSelectDeltas statement into `view`; false on
+    /// a database error.
+    static bool fold_deltas(sqlite3_stmt* s, const Message& m, DeltaView& view);
+    static void apply_view(const DeltaView& view, Message& m);
+    /// `m`'s view, folded from `message_deltas` on a miss; nullptr on a
+    /// database error.
+    const DeltaView* delta_view(const Message& m);
+    /// Forget the cached view of `target` (its deltas changed) and, with
+    /// `gone`, that it has any.
+    void drop_delta_view(const std::string& target, bool gone = false);
+    /// Delete expired seen ids and re-arm prune_timer_.
+    void prune_seen();
+    /// Delete up to kExpireBatch messages past their expires_at, then
+    /// queue the next batch or schedule_expiry() once none are due.
+    void expire_messages();
+    /// Point expiry_timer_ at the soonest expires_at, if it isn't already.
+    void schedule_expiry();
+    /// Create the FTS5 index (indexing existing rows the first time, or
+    /// after an interrupted import_history()) or leave search disabled if
+    /// this SQLite can't.
+    void open_search_index();
+    /// The conversation message `msg_id` belongs to, for on_change_ and
+    /// summaries_; empty if there is no such message.
+    std::string peer_of(const std::string& msg_id);
+    /// Archive one block of the oldest messages, then queue the next
+    /// round; re-arm archive_timer_ once nothing is old enough.
+    void archive_old();
+    /// Move up to a block of `peer`'s messages older than `age` (an SQLite
+    /// time modifier) into the archive; false if there were none or it
+    /// failed.
+    bool archive_block(const std::string& peer, const std::string& age);
+    ArchiveIndex archive_index(const std::string& peer);
+    /// Whether `msg_id` is a live message of the conversation with `peer`.
+    bool is_live(const std::string& msg_id, const std::string& peer);
+    /// The position of archived message `msg_id` in `peer`'s archive
+    /// (messages before it, oldest first), if it is there.
+    std::optional<std::size_t> archive_position(const std::string& peer,
+                                                const ArchiveIndex& index,
+                                                const std::string& msg_id);
+    /// Append up to `want` archived messages before position `end`, newest
+    /// first, after skipping `skip` of them and any not older than
+    /// `before_time` (when set).
+    void archive_back(const std::string& peer, const ArchiveIndex& index, std::size_t end,
+                      std::size_t skip, const std::string& before_time, std::size_t want,
+                      std::vector<Message>& out);
+    /// Append up to `want` archived messages from position `begin`, oldest
+    /// first.
+    void archive_forward(const std::string& peer, const ArchiveIndex& index, std::size_t begin,
+                         std::size_t want, std::vector<Message>& out);
+    /// Top up a backward page that ran out of live rows with archived ones.
+    void fill_from_archive(HistoryPage& page, std::size_t limit, const std::string& peer,
+                           const ArchiveIndex& index, std::size_t end, std::size_t skip,
+                           const std::string& before_time);
+    /// Append archived matches for search() to `hits`, up to `limit`.
+    void search_archive(const std::string& text, const std::string& peer, std::size_t limit,
+                        std::vector<SearchHit>& hits);
+    /// Delete an archived message by rewriting its conversation's segment.
+    bool delete_archived(const std::string& msg_id, std::string& peer);
+    /// Build day_digests_ if it isn't; false on a database error.
+    bool load_digests();
+    /// Toggle `m` in its day's digest, if the digests are loaded.
+    void add_to_digest(const Message& m);
+    /// Undo add_to_digest() for a deleted message.
+    void remove_from_digest(const Message& m);
+    /// Reload summaries_ from `conversation_summary`: every row, or just
+    /// `peer`'s (dropping it if the row is gone).
+    bool load_summaries(const std::string* peer = nullptr);
+    /// Schema upgrade for databases created by older builds.
+    bool add_column_if_missing(const char* table, const char* column, const char* type);
+    /// Rewrite seen ids stored as UUID text before they were kept packed.
+    bool pack_seen_ids();
+    /// Step a bound history query (limit is bound here) into a page,
+    /// oldest first; `newest_first` says the query selected descending.
+    std::optional<HistoryPage> read_history(sqlite3_stmt* s, std::size_t limit,
+                                            bool newest_first);
+
+    /// Step a bound statement once; logs and returns false on error.
+    bool step_done(sqlite3_stmt* stmt);
+    /// Step a parameterless cached statement (BEGIN/COMMIT/...) and reset it.
+    bool run(Statement s);
+    bool exec(const char* sql);
+    /// Bind `m` to kInsertMessage's parameters and step it.
+    bool bind_message(sqlite3_stmt* stmt, const Message& m);
+    /// Run the one-parameter statement `s` for every id in one transaction.
+    bool for_each_id(Statement s, const std::vector<std::string>& ids);
+    sqlite3_stmt* stmt(Statement s) const { return stmts_[s]; }
+
+    void finalize_statements();
+
+    Options options_;
+    sqlite3* db_ = nullptr;                     // DB thread only
+    std::unique_ptr<EncryptedVfs> vfs_;         // set when Options::encrypt; outlives db_
+    std::unique_ptr<HistoryArchive> archive_;   // DB thread only; set by open()
+    std::atomic<bool> open_{false};
+    std::array<sqlite3_stmt*, kStatementCount> stmts_{};
+    bool search_enabled_ = false;               // DB thread only
+    /// Per-day digests of `messages`, by "YYYY-MM-DD"; DB thread only,
+    /// loaded on first use and dropped when a delete makes them stale.
+    std::optional<std::map<std::string, RangeDigest>> day_digests_;
+    ChangeCallback on_change_;
+    Backpressure::Level* backlog_ = nullptr;    // inserts posted, not yet queued
+    /// Messages with rows in `message_deltas`, and the folded views of the
+    /// most recently read; DB thread only, except that readers look up
+    /// delta_targets_ under delta_targets_mutex_ (the DB thread writes it
+    /// under that lock).
+    std::unordered_set<std::string> delta_targets_;
+    mutable std::shared_mutex delta_targets_mutex_;
+    std::unordered_map<std::string, DeltaView> delta_views_;
+    std::list<std::string> delta_lru_;          // most recently read first
+    /// Copy of `conversation_summary`, by peer; written on the DB thread
+    /// after each change commits, read by summary() from any thread.
+    std::unordered_map<std::string, Summary> summaries_;
+    mutable std::mutex summaries_mutex_;
+
+    asio::io_context io_;
+    watchdog::Registration watched_{"store", io_};
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    asio::steady_timer commit_timer_;
+    asio::steady_timer prune_timer_;
+    asio::steady_timer archive_timer_;
+    TimerWheel::Handle expiry_timer_;           // DB thread only
+    std::string expiry_due_;                    // expires_at it is set for; empty: none
+    std::vector<PendingInsert> pending_;        // DB thread only
+    bool commit_scheduled_ = false;
+    std::mutex bulk_mutex_;
+    std::deque<std::function<void()>> bulk_;
+    bool bulk_posted_ = false;                  // a run_bulk() is queued
+    /// Jobs posted to the DB thread that haven't run, or ran and left
+    /// inserts in pending_. A read may skip the DB thread only at 0.
+    std::atomic<std::size_t> unsettled_{0};
+    std::size_t ran_ = 0;                       // DB thread only: run, not yet settled
+
+    asio::io_context read_io_;                  // one queue for all readers
+    std::optional<asio::executor_work_guard<asio::io_context::executor_type>> read_work_;
+    std::vector<std::thread> readers_;
+    std::atomic<bool> reading_{false};          // readers_ are up
+    static thread_local Reader* current_reader_;
+    std::thread thread_;
+};
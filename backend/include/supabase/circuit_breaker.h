@@ -0,0 +1,92 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/**
+ * Fails Supabase requests fast while the project is down, instead of each
+ * one waiting out curl's timeout, and watches for it to come back.
+ *
+ * Closed, requests go through and their outcomes are kept for `window`.
+ * Once at least `min_requests` of those are in and `failure_ratio` of them
+ * failed (no response, 5xx, 408 or 429), the breaker opens: allow() says no
+ * for `open_for`. Then it is half-open and lets one request through as a
+ * probe. A probe that succeeds closes the breaker; one that fails opens it
+ * again for twice as long, up to `max_open_for`.
+ *
+ * It also learns how long successful requests take, for hedging: see
+ * hedge_after(). Thread-safe.
+ */
+class CircuitBreaker {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Options {
+        std::chrono::seconds window{30};
+        std::size_t min_requests = 10;
+        double failure_ratio = 0.5;
+        std::chrono::seconds open_for{5};
+        std::chrono::seconds max_open_for{60};
+    };
+
+    enum class State { Closed, Open, HalfOpen };
+
+    /// What allow() decided for one request.
+    enum class Admit { No, Yes, Probe };
+
+    explicit CircuitBreaker(Options options) : options_(options) {}
+
+    CircuitBreaker(const CircuitBreaker&) = delete;
+    CircuitBreaker& operator=(const CircuitBreaker&) = delete;
+
+    /// Whether a request may be sent now: Probe for the one request a
+    /// half-open breaker lets through. Every request admitted must be
+    /// followed by record() with what this returned.
+    Admit allow(Clock::time_point now = Clock::now());
+
+    /// The outcome of an admitted request: `status` as HttpResponse has it
+    /// (0 for no response) and how long it took. While half-open only the
+    /// probe counts; a request admitted before the breaker opened says
+    /// nothing about the server now.
+    void record(Admit admitted, long status, Clock::duration took,
+                Clock::time_point now = Clock::now());
+
+    /// How long to wait for an idempotent request before sending it again:
+    /// the p95 of recent successful requests. nullopt while the breaker
+    /// isn't closed or too few requests have succeeded to tell.
+    [[nodiscard]] std::optional<Clock::duration> hedge_after() const;
+
+    [[nodiscard]] State state() const;
+
+    /// No response, or one saying the server can't serve us right now.
+    static bool failed(long status) {
+        return status == 0 || status >= 500 || status == 408 || status == 429;
+    }
+
+private:
+    static constexpr std::size_t kLatencies = 64;
+    static constexpr std::size_t kMinLatencies = 16;
+
+    struct Outcome {
+        Clock::time_point at;
+        bool failed;
+    };
+
+    void open_locked(Clock::time_point now);
+
+    const Options options_;
+    mutable std::mutex mutex_;
+    State state_ = State::Closed;
+    std::deque<Outcome> outcomes_;              // while closed, newest last
+    std::size_t failures_ = 0;                  // in outcomes_
+    Clock::time_point open_until_{};
+    Clock::duration open_for_{};                // of the current opening
+    bool probing_ = false;                      // a half-open probe is in flight
+
+    std::array<Clock::duration, kLatencies> latencies_{};   // successes, a ring
+    std::size_t latency_count_ = 0;
+};
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <asio.hpp>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+#include <curl/curl.h>
+
+/**
+ * Drives libcurl's multi interface from an asio event loop.
+ *
+ * curl tells us which sockets it cares about (CURLMOPT_SOCKETFUNCTION) and
+ * when it next needs a timeout (CURLMOPT_TIMERFUNCTION); we translate those
+ * into async_wait / steady_timer operations and call
+ * curl_multi_socket_action when they fire. Sockets are opened through asio
+ * (CURLOPT_OPENSOCKETFUNCTION) so they can be waited on directly; curl's
+ * own helper sockets (the threaded resolver's wake-up pair) are adopted
+ * for the duration of the watch and released, not closed, afterwards.
+ *
+ * All curl calls happen on one strand, so the driver is safe with a
+ * multi-threaded io_context. HTTP/2 multiplexing is enabled: concurrent
+ * transfers to the same host share one connection.
+ */
+class CurlMulti {
+public:
+    /// Called on the strand when a transfer finishes; the easy handle is
+    /// already removed from the multi and ownership returns to the caller.
+    using Completion = std::function<void(CURL* easy, CURLcode result)>;
+
+    explicit CurlMulti(asio::io_context& io);
+    ~CurlMulti();
+
+    CurlMulti(const CurlMulti&) = delete;
+    CurlMulti& operator=(const CurlMulti&) = delete;
+
+    /// Start a fully configured easy handle. Thread-safe.
+    void start(CURL* easy, Completion done);
+
+    /// The strand completions run on, for timers that race them.
+    [[nodiscard]] asio::strand<asio::io_context::executor_type>& strand() { return strand_; }
+
+    /// Number of transfers currently running.
+    [[nodiscard]] std::size_t active() const { return transfers_.size(); }
+
+private:
+    struct Watch {
+        std::shared_ptr<asio::ip::tcp::socket> socket;
+        int what = CURL_POLL_NONE;      // what curl currently wants
+        bool reading = false;           // async_wait(read) pending
+        bool writing = false;           // async_wait(write) pending
+        bool owned = true;              // opened by open_socket (vs. curl-internal, e.g. resolver)
+    };
+
+    void add_locked(CURL* easy, Completion done);
+    void arm(curl_socket_t fd);
+    void on_ready(curl_socket_t fd, int direction, const asio::error_code& ec);
+    void on_timeout(const asio::error_code& ec);
+    void drain_completed();
+
+    static int socket_callback(CURL* easy, curl_socket_t fd, int what, void* userp, void* socketp);
+    static int timer_callback(CURLM* multi, long timeout_ms, void* userp);
+    static curl_socket_t open_socket(void* userp, curlsocktype purpose, curl_sockaddr* address);
+    static int close_socket(void* userp, curl_socket_t fd);
+
+    asio::io_context& io_;
+    asio::strand<asio::io_context::executor_type> strand_;
+    asio::steady_timer timer_;
+    CURLM* multi_ = nullptr;
+
+    std::unordered_map<curl_socket_t, Watch> watches_;
+    std::unordered_map<CURL*, Completion> transfers_;
+
+    /// Handlers hold a weak copy and bail out once the driver is gone.
+    std::shared_ptr<int> alive_ = std::make_shared<int>(0);
+};
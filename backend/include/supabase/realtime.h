@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "supabase/supabase_client.h"
+
+/**
+ * Push delivery of offline messages over Supabase Realtime.
+ *
+ * Keeps one WebSocket open to the project's Realtime endpoint
+ * (/realtime/v1/websocket, Phoenix channel protocol 1.0.0) and joins a
+ * channel subscribed to INSERTs on `messages` where `to_user=eq.<us>`.
+ * Every inserted row is handed to `on_rows` as it arrives; rows that
+ * arrive together are handed over together.
+ *
+ * Realtime only reports rows inserted while the channel is joined, so
+ * `on_joined` runs after every successful join — the first one and each
+ * rejoin after a dropped connection — for the owner to drain whatever was
+ * queued meanwhile through the REST API. A row can then come both ways;
+ * the store drops the second copy by msg_id.
+ *
+ * TLS comes from libcurl (CURLOPT_CONNECT_ONLY) and the framing from
+ * api/websocket.h. curl owns the socket, so the link is a poll() loop on
+ * its own thread rather than an io_context; both handlers run on that
+ * thread and may block. A dropped connection, a refused join or a missed
+ * heartbeat reply is redialled with doubling backoff.
+ *
+ * The project needs `messages` in the `supabase_realtime` publication
+ * (docs/infrastructure/01-supabase-setup.md).
+ */
+class SupabaseRealtime {
+public:
+    struct Options {
+        /// Phoenix heartbeat; the server closes a socket silent for 60 s.
+        /// A heartbeat unanswered by the next one drops the connection.
+        std::chrono::seconds heartbeat{25};
+        std::chrono::milliseconds connect_timeout{10000};
+        std::chrono::seconds max_backoff{60};
+        /// Largest Realtime message accepted; a row carries one envelope.
+        std::size_t max_message_bytes = 4 * 1024 * 1024;
+    };
+
+    using RowsHandler = std::function<void(std::vector<SupabaseClient::OfflineMessage> rows)>;
+    using JoinedHandler = std::function<void()>;
+
+    SupabaseRealtime(std::string base_url, std::string anon_key, std::string username,
+                     Options options, RowsHandler on_rows, JoinedHandler on_joined);
+    ~SupabaseRealtime();
+
+    SupabaseRealtime(const SupabaseRealtime&) = delete;
+    SupabaseRealtime& operator=(const SupabaseRealtime&) = delete;
+
+    void start();
+    void stop();
+
+    /// Reconnect to another project or with another key (config reload).
+    void set_endpoint(std::string base_url, std::string anon_key);
+
+    /// Whether the channel is joined (as far as we know).
+    [[nodiscard]] bool joined() const { return joined_; }
+
+private:
+    class Connection;
+
+    void run();
+    /// One connection, from dial to drop. True if the channel was joined.
+    bool session();
+    /// Handle one Phoenix message; false to drop the connection.
+    bool on_message(std::string_view text, std::vector<SupabaseClient::OfflineMessage>& rows);
+    std::string join_message();
+    std::string heartbeat_message();
+    /// Sleep for `delay` unless stopped or woken first.
+    void wait(std::chrono::milliseconds delay);
+    void wake();
+
+    std::string username_;
+    Options options_;
+    RowsHandler on_rows_;
+    JoinedHandler on_joined_;
+
+    std::mutex mutex_;                          // guards base_url_, anon_key_
+    std::string base_url_;
+    std::string anon_key_;
+
+    std::string topic_;                         // "realtime:p2p-inbox-<username>"
+    uint64_t next_ref_ = 1;                     // link thread only
+    std::string join_ref_;
+    std::string heartbeat_ref_;                 // empty once answered
+
+    int wake_pipe_[2] = {-1, -1};               // stop() and set_endpoint() interrupt poll()
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> redial_{false};
+    std::atomic<bool> joined_{false};
+    std::thread thread_;
+};
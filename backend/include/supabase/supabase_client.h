@@ -1,46 +1,288 @@
 #pragma once
 
+#include <asio.hpp>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 #include <optional>
 #include <nlohmann/json.hpp>
 
+#include "config/rcu_cell.h"
+#include "supabase/circuit_breaker.h"
+#include "supabase/curl_multi.h"
+
 /**
  * Lightweight REST client for Supabase PostgREST API.
  *
- * All HTTP calls use libcurl under the hood.
+ * All HTTP calls use libcurl under the hood. Easy handles are pooled and
+ * share one DNS / TLS-session / connection cache (CURLSH), so every call
+ * after the first reuses a warm HTTP/2 connection to the project host
+ * instead of paying a fresh TCP + TLS handshake.
+ *
+ * The blocking methods are for startup and worker threads. Code running on
+ * the event loop (heartbeat timer, API handlers) should use the async_*
+ * variants, which run on a CurlMulti bound to the io_context given at
+ * construction and never block it.
+ *
+ * Every request passes a CircuitBreaker: while Supabase is failing, calls
+ * fail at once (as a transport failure, status 0) rather than each
+ * waiting out the timeout. An async GET still unanswered after the p95 of
+ * recent requests is sent a second time, and the first good answer wins.
  */
 class SupabaseClient {
 public:
+    /// One row of the `messages` table.
+    struct OfflineMessage {
+        std::string id;
+        std::string from_user;
+        std::string to_user;
+        std::string ciphertext;     // base64 of the whole envelope
+        std::string created_at;
+    };
+
+    /// Receives one page of offline messages and returns the ids it has
+    /// durably handled. Only those are deleted from Supabase; anything not
+    /// returned stays queued for the next fetch.
+    using OfflinePageHandler =
+        std::function<std::vector<std::string>(const std::vector<OfflineMessage>& page)>;
+
+    static constexpr std::size_t kDefaultOfflinePageSize = 100;
+
+    /// Outcome of a bulk insert. Rejected means PostgREST refused the rows
+    /// themselves (a 4xx other than 408/429), so sending the same batch
+    /// again won't help; Failed is worth retrying.
+    enum class PushStatus { Ok, Failed, Rejected };
+
+    using BoolCallback = std::function<void(bool ok)>;
+    using JsonCallback = std::function<void(std::optional<nlohmann::json> result)>;
+    using RowsCallback = std::function<void(std::optional<std::vector<nlohmann::json>> rows)>;
+    using PushCallback = std::function<void(PushStatus status)>;
+
+    /// The curl side of a client: the easy-handle pool, its DNS / TLS /
+    /// connection caches and, given an io_context, the CurlMulti driver.
+    /// Clients built on one Transport (several identities in one process,
+    /// main.cpp) share warm connections to the project host.
+    struct Transport;
+    static std::shared_ptr<Transport> make_transport(asio::io_context* io = nullptr);
+
     SupabaseClient(const std::string& base_url, const std::string& anon_key);
 
-    /// Insert or upsert this node into the `users` table.
+    /// Same, plus an async transport driven by `io`.
+    SupabaseClient(asio::io_context& io, const std::string& base_url, const std::string& anon_key);
+
+    /// Same, over `transport`, which other clients may share.
+    SupabaseClient(std::shared_ptr<Transport> transport, const std::string& base_url,
+                   const std::string& anon_key);
+    ~SupabaseClient();
+
+    SupabaseClient(const SupabaseClient&) = delete;
+    SupabaseClient& operator=(const SupabaseClient&) = delete;
+
+    /// Point later requests at another project or key (config reload).
+    /// Requests already in flight finish against the old one.
+    void set_endpoint(const std::string& base_url, const std::string& anon_key);
+
+    /// Insert or upsert this node into the `users` table. `relay` is the
+    /// relay peers should reach us through and `udp` our UDP transport's
+    /// endpoint (both "ip:port"); `addresses` lists other endpoints we
+    /// listen on, comma-separated (PeerAddress::alternates). Empty clears
+    /// the column, nullopt leaves it out of the request (for projects
+    /// created before the column existed).
     bool register_user(const std::string& username,
                        const std::string& node_id,
                        const std::string& public_key,
-                       const std::string& ip);
+                       const std::string& signing_key,
+                       const std::string& ip,
+                       const std::optional<std::string>& relay = std::nullopt,
+                       const std::optional<std::string>& udp = std::nullopt,
+                       const std::optional<std::string>& addresses = std::nullopt);
 
     /// Update last_seen and last_ip for heartbeat.
     bool heartbeat(const std::string& username, const std::string& ip);
 
+    /// Heartbeat that also returns the `users` rows of `friends`, in one
+    /// round trip through the `heartbeat` SQL function
+    /// (docs/infrastructure/01-supabase-setup.md §5). Projects without the
+    /// function get a PATCH plus lookup_users() instead. nullopt if our own
+    /// row could not be updated; friends missing from Supabase are absent.
+    std::optional<std::vector<nlohmann::json>> heartbeat(const std::string& username,
+                                                         const std::string& ip,
+                                                         std::span<const std::string> friends);
+
     /// Look up a user by username. Returns JSON with public_key, last_ip, etc.
     std::optional<nlohmann::json> lookup_user(const std::string& username);
 
+    /// Look up many users with `username=in.(...)`, one request per 100
+    /// names. Unknown users are absent; nullopt if any request failed.
+    std::optional<std::vector<nlohmann::json>> lookup_users(std::span<const std::string> usernames);
+
     /// Push an encrypted offline message to the `messages` table.
     bool push_offline_message(const std::string& to_user,
                               const std::string& from_user,
                               const std::string& ciphertext);
 
+    /// Insert many offline messages with one POST whose body is a JSON
+    /// array; `created_at` is left to the server. Each row's `id` is sent
+    /// too, and duplicates are ignored, so resending a batch whose response
+    /// was lost doesn't store anything twice.
+    PushStatus push_offline_messages(std::span<const OfflineMessage> messages);
+
     /// Fetch (and delete) all pending offline messages for this user.
     std::vector<nlohmann::json> fetch_offline_messages(const std::string& username);
 
+    /// Stream pending offline messages page by page (oldest first). The next
+    /// page is requested while `handler` works on the current one. Through
+    /// the `take_offline_messages` SQL function
+    /// (docs/infrastructure/01-supabase-setup.md §5), each request also
+    /// deletes the ids acknowledged for the page before, so a drain is one
+    /// request per page plus a last one for the final acks. Projects without
+    /// the function get a GET per page plus a DELETE per acknowledged page.
+    /// Returns the number of messages delivered to `handler`, or nullopt if
+    /// the first page could not be fetched.
+    std::optional<std::size_t> fetch_offline_messages_paged(const std::string& username,
+                                                            const OfflinePageHandler& handler,
+                                                            std::size_t page_size = kDefaultOfflinePageSize);
+
+    /// Delete the given rows from `messages` (`id=in.(...)`).
+    bool delete_offline_messages(const std::vector<std::string>& ids);
+
+    // ── Non-blocking variants ────────────────────────────────────────────
+    // Callbacks run on the CurlMulti strand of the io_context passed to the
+    // constructor. Without one they fall back to the blocking call inline.
+
+    void async_register_user(const std::string& username, const std::string& node_id,
+                             const std::string& public_key, const std::string& signing_key,
+                             const std::string& ip, const std::optional<std::string>& relay,
+                             const std::optional<std::string>& udp,
+                             const std::optional<std::string>& addresses,
+                             BoolCallback done);
+    /// Set our row's `addresses` (see register_user) after a network change.
+    void async_update_addresses(const std::string& username, const std::string& addresses,
+                                BoolCallback done);
+    void async_heartbeat(const std::string& username, const std::string& ip, BoolCallback done);
+    void async_heartbeat(const std::string& username, const std::string& ip,
+                         std::vector<std::string> friends, RowsCallback done);
+    void async_lookup_user(const std::string& username, JsonCallback done);
+    void async_lookup_users(std::vector<std::string> usernames, RowsCallback done);
+    void async_push_offline_message(const std::string& to_user, const std::string& from_user,
+                                    const std::string& ciphertext, BoolCallback done);
+    void async_push_offline_messages(std::vector<OfflineMessage> messages, PushCallback done);
+
+    // ── Coroutine variants ───────────────────────────────────────────────
+    // Awaitable wrappers over async_*; they resume on the awaiting
+    // coroutine's executor.
+
+    asio::awaitable<bool> co_register_user(std::string username, std::string node_id,
+                                           std::string public_key, std::string signing_key,
+                                           std::string ip,
+                                           std::optional<std::string> relay = std::nullopt,
+                                           std::optional<std::string> udp = std::nullopt,
+                                           std::optional<std::string> addresses = std::nullopt);
+    asio::awaitable<bool> co_heartbeat(std::string username, std::string ip);
+    asio::awaitable<std::optional<std::vector<nlohmann::json>>> co_heartbeat(
+        std::string username, std::string ip, std::vector<std::string> friends);
+    asio::awaitable<std::optional<nlohmann::json>> co_lookup_user(std::string username);
+    asio::awaitable<std::optional<std::vector<nlohmann::json>>> co_lookup_users(
+        std::vector<std::string> usernames);
+    asio::awaitable<bool> co_push_offline_message(std::string to_user, std::string from_user,
+                                                  std::string ciphertext);
+    asio::awaitable<PushStatus> co_push_offline_messages(std::vector<OfflineMessage> messages);
+
 private:
+    struct HttpResponse {
+        long status = 0;            // 0 = transport failure
+        std::string body;
+
+        [[nodiscard]] bool ok() const { return status >= 200 && status < 300; }
+    };
+
     /// Generic HTTP helpers
-    std::string http_get(const std::string& endpoint);
-    std::string http_post(const std::string& endpoint, const std::string& body);
-    std::string http_patch(const std::string& endpoint, const std::string& body);
-    std::string http_delete(const std::string& endpoint);
+    HttpResponse http_get(const std::string& endpoint);
+    HttpResponse http_post(const std::string& endpoint, const std::string& body,
+                           const std::string& prefer = "");
+    HttpResponse http_patch(const std::string& endpoint, const std::string& body);
+    HttpResponse http_delete(const std::string& endpoint);
+
+    HttpResponse perform(const char* method, const std::string& endpoint,
+                         const std::string* body, const std::string& prefer);
+
+    using ResponseCallback = std::function<void(HttpResponse)>;
+    /// Through the breaker, hedging a GET; see the class comment.
+    void perform_async(const char* method, std::string endpoint, std::string body,
+                       std::string prefer, ResponseCallback done);
+    /// One transfer on the CurlMulti that the breaker `admitted`, its
+    /// outcome recorded with it.
+    void start_transfer(CircuitBreaker::Admit admitted, const char* method,
+                        const std::string& endpoint, const std::string& body,
+                        const std::string& prefer, ResponseCallback done);
+
+    struct Endpoint {
+        std::string base_url;                   // no trailing slash
+        std::string anon_key;
+        std::string host;                       // of base_url, for DnsCache
+        uint16_t port = 443;
+    };
+    static Endpoint make_endpoint(const std::string& base_url, const std::string& anon_key);
+
+    /// Shared easy-handle setup for the blocking and async paths. Returns
+    /// the headers; `resolve` gets the CURLOPT_RESOLVE list, if any. Both
+    /// are the caller's to free once the transfer is done.
+    curl_slist* configure(CURL* curl, const char* method, const Endpoint& ep,
+                          const std::string& url, const std::string* body,
+                          const std::string& prefer, std::string* response_body,
+                          curl_slist** resolve);
+
+    static nlohmann::json user_row(const std::string& username, const std::string& node_id,
+                                   const std::string& public_key, const std::string& signing_key,
+                                   const std::string& ip,
+                                   const std::optional<std::string>& relay,
+                                   const std::optional<std::string>& udp,
+                                   const std::optional<std::string>& addresses);
+    static std::optional<nlohmann::json> first_row(const HttpResponse& res);
+    static std::optional<std::vector<nlohmann::json>> rows(const HttpResponse& res);
+    static std::string offline_rows(std::span<const OfflineMessage> messages);
+    static PushStatus push_status(const HttpResponse& res);
+
+    /// PostgREST answers 404 for an RPC the schema doesn't define.
+    void note_heartbeat_rpc_missing();
+    void note_take_rpc_missing();
+    void note_addresses_column_missing();
+
+    /// A page of `messages` rows from a GET or an RPC; nullopt if malformed.
+    static std::optional<std::vector<OfflineMessage>> offline_page(const HttpResponse& res,
+                                                                   std::size_t limit);
+
+    /// One page of messages strictly after (after_created_at, after_id).
+    std::optional<std::vector<OfflineMessage>> fetch_offline_page(const std::string& username,
+                                                                  const std::string& after_created_at,
+                                                                  const std::string& after_id,
+                                                                  std::size_t limit);
+
+    /// Delete `acks`, then return up to `limit` messages after (after_created_at,
+    /// after_id), in one take_offline_messages call. nullopt on failure,
+    /// with take_rpc_missing_ set if the function doesn't exist.
+    std::optional<std::vector<OfflineMessage>> take_offline_page(const std::string& username,
+                                                                 const std::vector<std::string>& acks,
+                                                                 const std::string& after_created_at,
+                                                                 const std::string& after_id,
+                                                                 std::size_t limit);
+
+    /// fetch_offline_messages_paged() through take_offline_page().
+    std::optional<std::size_t> take_offline_messages_paged(const std::string& username,
+                                                           const OfflinePageHandler& handler,
+                                                           std::size_t page_size);
 
-    std::string base_url_;
-    std::string anon_key_;
+    RcuCell<Endpoint> endpoint_;            // read per request, swapped on reload
+    std::shared_ptr<Transport> transport_;
+    CircuitBreaker breaker_{CircuitBreaker::Options{}};
+    /// Async completions hold a weak copy: once this client is gone, a
+    /// shared transport finishing its transfers doesn't call back into it.
+    std::shared_ptr<int> alive_ = std::make_shared<int>(0);
+    std::atomic<bool> heartbeat_rpc_missing_{false};
+    std::atomic<bool> take_rpc_missing_{false};
+    std::atomic<bool> addresses_column_missing_{false};
 };
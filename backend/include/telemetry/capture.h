@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+
+/**
+ * Wire capture: a compact binary log of what a node saw on the wire, for
+ * reproducing a performance problem without anyone's plaintext.
+ *
+ * With `logging.capture_file` set, PeerServer and PeerClient record every
+ * frame they read or queue (envelopes, still sealed) and SupabaseClient
+ * every request with its response, each stamped with its offset from the
+ * start of the capture. HTTP headers, which carry the anon key, are not
+ * recorded. tools/p2p_replay.cpp feeds a capture back into a node started
+ * with the captured identity (`node.key_seed`), through its real listener
+ * and a stand-in for Supabase, at the original pace or faster.
+ *
+ *   capture::frame(capture::Kind::FrameIn, remote, payload);
+ *
+ * The file starts with kMagic. Each record is a kind byte, the microseconds
+ * since the previous record, then length-prefixed fields, all lengths and
+ * numbers as LEB128 varints:
+ *
+ *   FrameIn / FrameOut   remote address, frame payload
+ *   Http                 "METHOD endpoint", status, request body, response body
+ *
+ * Recording stops, and the file is closed, once it reaches
+ * `logging.capture_max_mib`. Off (the default), a call costs one relaxed
+ * load and a branch.
+ */
+namespace capture {
+
+inline constexpr std::string_view kMagic = "p2pcap1\n";
+
+enum class Kind : uint8_t {
+    FrameIn = 1,            ///< a frame read from a peer
+    FrameOut = 2,           ///< a frame queued to a peer
+    Http = 3,               ///< a Supabase request and its response
+};
+
+namespace detail {
+inline std::atomic<bool> enabled{false};
+}
+
+/// Whether a capture is being written.
+inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+/// Start writing to `path`, truncating it, or stop with an empty path.
+/// Returns false if the file can't be opened; any capture already running
+/// has then been closed.
+bool start(const std::string& path, uint64_t max_bytes);
+
+/// `logging.capture_file` and `logging.capture_max_mib` from `config`; a
+/// capture already writing to the same file carries on.
+void apply(const nlohmann::json& config);
+
+/// Record a frame's payload (without its length prefix).
+void frame(Kind kind, std::string_view remote, std::string_view payload);
+
+/// Record a Supabase exchange; `status` is 0 for a transport failure.
+void http(std::string_view method, std::string_view endpoint, long status,
+          std::string_view request, std::string_view response);
+
+/// One record read back from a capture.
+struct Record {
+    Kind kind = Kind::FrameIn;
+    std::chrono::microseconds at{0};    // since the start of the capture
+    std::string label;                  // remote address, or "METHOD endpoint"
+    long status = 0;                    // Http only
+    std::string request;                // Http only
+    std::string payload;                // the frame, or the response body
+};
+
+/// Reads a capture file record by record.
+class Reader {
+public:
+    explicit Reader(const std::string& path);
+    ~Reader();
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /// False if the file couldn't be opened or isn't a capture.
+    [[nodiscard]] bool ok() const { return file_ != nullptr; }
+
+    /// The next record; false at the end of the file or at a record cut
+    /// short (a capture whose writer was killed).
+    bool next(Record& record);
+
+private:
+    std::FILE* file_ = nullptr;
+    std::chrono::microseconds at_{0};
+};
+
+} // namespace capture
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+/**
+ * A count of heap allocations (every global operator new), for telling how
+ * many allocations a message costs: GET /metrics reports it as
+ * `p2p_heap_allocations_total`, and `perf-report` divides its growth over
+ * a load run by the messages handled.
+ *
+ * Only built with P2P_COUNT_ALLOCATIONS, which replaces the global
+ * operator new with one that counts into per-thread shards (as histogram
+ * shards are picked) before calling malloc. Off by default: the shards
+ * are cheap but not free, and a shipped binary has no use for the count.
+ */
+namespace heap_count {
+
+/// Allocations since the process started; nullopt when not counted.
+[[nodiscard]] std::optional<uint64_t> total();
+
+} // namespace heap_count
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+/**
+ * Process-wide logging set up from the config's `logging` section.
+ *
+ * Every logger writes through spdlog's async thread pool, so a slow disk
+ * never blocks an I/O thread: the calling thread only formats the record
+ * into a bounded queue. Output goes to the console and to a size-rotated
+ * `logging.file`.
+ *
+ * SPDLOG_TRACE / SPDLOG_DEBUG calls below the build's SPDLOG_ACTIVE_LEVEL
+ * (CMake `P2P_LOG_CUTOFF`) are compiled out entirely.
+ */
+namespace logging {
+
+/// Install the async default logger. Call once, before other threads log.
+void init(const nlohmann::json& config);
+
+/// Apply `logging.level`, `logging.trace_messages`,
+/// `logging.trace_sample_every` (telemetry/trace.h) and
+/// `logging.capture_file` (telemetry/capture.h) from a reloaded config.
+/// Sinks and the queue keep their startup settings.
+void apply(const nlohmann::json& config);
+
+/// Flush queued records and stop the pool; call before exit.
+void shutdown();
+
+namespace detail {
+inline std::atomic<bool> trace_messages{false};
+}
+
+/// Whether per-message traces are on (`logging.trace_messages`). A
+/// constant false when the build compiled trace calls out.
+inline bool tracing() {
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+    return detail::trace_messages.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+/**
+ * The lifecycle of one received message, logged as a single trace record
+ * once it ends, e.g.
+ *
+ *   msg from=alice msg_id=4f… result=stored queue=12us verify=61us
+ *   decrypt=4us store=812us notify=3us total=905us
+ *
+ * One record with explicit fields rather than spdlog's MDC: the MDC is
+ * thread-local, which the async pool can't see, and a message crosses the
+ * I/O, crypto and DB threads anyway. Stages the message never reached are
+ * left out. Not thread-safe; each stage happens-after the previous one.
+ */
+class MessageTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit MessageTrace(std::string from);
+    ~MessageTrace();                             // writes the record
+
+    MessageTrace(const MessageTrace&) = delete;
+    MessageTrace& operator=(const MessageTrace&) = delete;
+
+    void set_msg_id(std::string msg_id) { msg_id_ = std::move(msg_id); }
+    void set_result(std::string_view result) { result_ = result; }
+
+    /// The time since the previous stage (or since receipt) went to `name`.
+    void stage(std::string_view name);
+    /// `name` took `took`, measured by the caller; the next stage is timed
+    /// from now.
+    void stage(std::string_view name, std::chrono::nanoseconds took);
+
+private:
+    std::string from_;
+    std::string msg_id_;
+    std::string_view result_ = "dropped";
+    std::string stages_;
+    Clock::time_point start_;
+    Clock::time_point last_;
+};
+
+} // namespace logging
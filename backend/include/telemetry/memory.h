@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <nlohmann/json.hpp>
+
+/**
+ * Memory accounting per subsystem, and budgets that act on it.
+ *
+ * Whatever grows with load charges what it holds to an Area: session
+ * blocks and read buffers, the spares kept for reuse, peer directory
+ * entries, cached history pages, frames queued for peers, cached shared
+ * keys. GET /metrics reports each area as `p2p_memory_<area>_bytes` and
+ * the sum as `p2p_memory_bytes`. A charge is two relaxed atomic adds. The
+ * figures are payload plus a fixed estimate for bookkeeping, not what the
+ * allocator handed out: enough to see where RSS goes, and to act before
+ * the OOM killer does.
+ *
+ * Budgets (`node.memory_budget_mb` for the process, `node.memory_budgets_mb`
+ * per area) are enforced two ways:
+ *   - backpressure: over_budget() refuses growth where refusing is safe.
+ *     AdmissionControl turns new peer connections away, and PeerClient
+ *     refuses non-control frames, so sends fall back to the offline path.
+ *   - reclaim: caches register a Reclaimer. The thread start() runs asks
+ *     those in an area over its budget, or in any area while the total is
+ *     over, to give back the excess, least recently used first.
+ *
+ *   memory::start(memory::options(config));
+ *   ...
+ *   memory::stop();
+ *
+ * Without start() there are no budgets; the accounting still runs.
+ */
+namespace memory {
+
+enum class Area : uint8_t {
+    PeerSessions = 0,   // open sessions and the read buffers they hold
+    Pools,              // spare session blocks and buffers kept for reuse
+    Directory,          // PeerDirectory entries
+    History,            // HistoryCache pages
+    SendQueues,         // frames queued in PeerClients
+    CryptoCache,        // cached shared keys
+};
+
+inline constexpr std::size_t kAreas = 6;
+
+struct Options {
+    std::size_t total = 0;                       // bytes, all areas; 0 = no budget
+    std::array<std::size_t, kAreas> areas{};     // bytes per area; 0 = no budget
+    std::chrono::milliseconds interval{1000};    // reclaim check with no budget crossed
+};
+
+/// Options from the `node.memory_*` config keys.
+Options options(const nlohmann::json& config);
+
+/// Apply the budgets and start the reclaim thread. No-op if running.
+void start(Options options);
+
+/// Stop and join the reclaim thread, and drop the budgets.
+void stop();
+
+/// Add `bytes` (negative to release) to `area`. Lock-free; wakes the
+/// reclaim thread when it takes the area or the total over budget.
+void charge(Area area, int64_t bytes);
+
+[[nodiscard]] int64_t used(Area area);
+
+/// Bytes `area` should give back now: how far it is over its budget or,
+/// if more, how far the total is over, but no more than it holds.
+[[nodiscard]] std::size_t excess(Area area);
+
+/// Whether adding `bytes` to `area` would take it or the total over budget.
+[[nodiscard]] bool over_budget(Area area, std::size_t bytes = 0);
+
+namespace detail {
+struct Registered;
+}
+
+/**
+ * A cache that can give memory back: `shrink(bytes)` drops at least that
+ * much if it holds it, least recently used first, charging the release
+ * as usual. It runs on the reclaim thread, under the lock that ~Reclaimer
+ * takes, so it must not create or destroy a Reclaimer. Declare it as the
+ * owner's last member, so it goes before what it shrinks.
+ */
+class Reclaimer {
+public:
+    Reclaimer(Area area, std::function<void(std::size_t bytes)> shrink);
+    ~Reclaimer();
+
+    Reclaimer(const Reclaimer&) = delete;
+    Reclaimer& operator=(const Reclaimer&) = delete;
+
+private:
+    std::unique_ptr<detail::Registered> state_;
+};
+
+} // namespace memory
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Process-wide counters, gauges and latency histograms, served in the
+ * Prometheus text format by GET /metrics.
+ *
+ * Recording never locks: counters and gauges are single relaxed atomics,
+ * and a histogram is split into per-thread shards (picked once per thread)
+ * so the I/O, crypto and DB threads don't contend on one cache line. A
+ * scrape merges the shards. Only registration takes a lock, so metrics are
+ * looked up once, e.g. into a namespace-scope reference:
+ *
+ *   metrics::Histogram& verify_seconds =
+ *       metrics::histogram("p2p_verify_seconds", "Signature check of a direct message");
+ *
+ * Registering an existing name returns the same metric.
+ */
+namespace metrics {
+
+class Counter {
+public:
+    void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+class Gauge {
+public:
+    void set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+    void add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+    [[nodiscard]] int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+/**
+ * Durations in log-linear buckets, as in HdrHistogram: 16 linear
+ * sub-buckets per power of two of nanoseconds, so any quantile is within
+ * 1/16 (6.25%) of the true value. Covers 1 ns to ~18 minutes; longer
+ * durations land in the last bucket. Counts since process start.
+ */
+class Histogram {
+public:
+    static constexpr unsigned kSubBits = 4;
+    static constexpr unsigned kMaxBits = 40;
+    static constexpr std::size_t kBuckets = (kMaxBits - kSubBits + 1) << kSubBits;
+    static constexpr std::size_t kShards = 8;
+
+    struct Snapshot {
+        std::vector<uint64_t> buckets;
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+
+        /// Nanoseconds at quantile `q` in [0, 1]; 0 when empty.
+        [[nodiscard]] uint64_t quantile(double q) const;
+    };
+
+    void record(std::chrono::nanoseconds duration);
+    [[nodiscard]] Snapshot snapshot() const;
+
+    static std::size_t bucket_of(uint64_t ns);
+    /// Midpoint of the values that land in `bucket`.
+    static uint64_t value_of(std::size_t bucket);
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum_ns{0};
+    };
+
+    std::array<Shard, kShards> shards_;
+};
+
+/// Records the time from construction to destruction into `histogram`.
+class ScopedTimer {
+public:
+    explicit ScopedTimer(Histogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer() { histogram_.record(std::chrono::steady_clock::now() - start_); }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+    Histogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+/// Register (or look up) a metric. Names follow Prometheus conventions:
+/// counters end in `_total`, histograms in `_seconds`. Thread-safe.
+Counter& counter(const std::string& name, const std::string& help);
+Gauge& gauge(const std::string& name, const std::string& help);
+Histogram& histogram(const std::string& name, const std::string& help);
+
+/// Every metric in the Prometheus text exposition format (0.0.4).
+/// Histograms are written as summaries with p50, p90 and p99 in seconds.
+std::string render_prometheus();
+
+} // namespace metrics
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * What each peer costs this node, for finding the one that eats its CPU or
+ * bandwidth: frames and bytes received from them (counted once the sender
+ * is known to be a friend) and sent to them through the connection pool,
+ * and time spent in crypto on their behalf (CryptoWorkers jobs keyed by
+ * them). GET /peers lists it, with what is queued to each right now.
+ *
+ * Counting must stay off the hot paths' shared cache lines. Each peer has
+ * an Entry of relaxed atomics, and a thread finds it through a lookup
+ * cache of its own, so only the first count from a thread for a peer takes
+ * the table's lock. Frames of one peer are read on one strand and its
+ * crypto jobs run on one worker, so an Entry's lines rarely move between
+ * cores either.
+ *
+ * Entries live for the process: one per friend or own device it counted.
+ * Totals are since start.
+ */
+namespace peer_usage {
+
+struct Counters {
+    uint64_t frames_in = 0;
+    uint64_t bytes_in = 0;
+    uint64_t frames_out = 0;
+    uint64_t bytes_out = 0;
+    uint64_t crypto_ns = 0;
+};
+
+class Entry {
+public:
+    void received(std::size_t bytes) {
+        frames_in_.fetch_add(1, std::memory_order_relaxed);
+        bytes_in_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void sent(std::size_t bytes) {
+        frames_out_.fetch_add(1, std::memory_order_relaxed);
+        bytes_out_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    void crypto(std::chrono::nanoseconds spent) {
+        crypto_ns_.fetch_add(static_cast<uint64_t>(std::max<int64_t>(0, spent.count())),
+                             std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] Counters counters() const;
+
+private:
+    std::atomic<uint64_t> frames_in_{0};
+    std::atomic<uint64_t> bytes_in_{0};
+    std::atomic<uint64_t> frames_out_{0};
+    std::atomic<uint64_t> bytes_out_{0};
+    std::atomic<uint64_t> crypto_ns_{0};
+};
+
+/// `peer`'s entry, made on first use. Thread-safe; lock-free after this
+/// thread's first call for `peer`.
+Entry& of(std::string_view peer);
+
+/// Every peer's counters, in no particular order.
+[[nodiscard]] std::vector<std::pair<std::string, Counters>> snapshot();
+
+} // namespace peer_usage
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <nlohmann/json.hpp>
+
+/**
+ * Sampled spans for offline analysis of one slow message, in Chrome's
+ * trace-event format (chrome://tracing, ui.perfetto.dev).
+ *
+ * The histograms on GET /metrics say a stage is slow; a trace shows which
+ * message was, and where it waited. One message in `sample_every` gets a
+ * flow id as its frame comes off the wire, and every stage it passes
+ * through records a span under that id — the frame in PeerServer, the
+ * crypto worker's open, Node's handling, the store's group commit, the UI
+ * notification — on whichever thread runs it. Supabase calls are recorded
+ * whenever tracing is on.
+ *
+ *   trace::Span span("node", "on_frame", trace::current());
+ *
+ * Each thread writes to its own ring of kRingEvents spans, without locks;
+ * the oldest are overwritten. POST /debug/trace collects every ring into
+ * one JSON document, with spans of the same flow linked by flow arrows.
+ *
+ * Off (the default), a span costs one relaxed load and a predictable
+ * branch, and sample() returns 0 so the message's later spans don't look.
+ */
+namespace trace {
+
+/// A sampled message's id; 0 means not sampled, and records nothing.
+using Flow = uint64_t;
+using Clock = std::chrono::steady_clock;
+
+inline constexpr std::size_t kRingEvents = 16384;
+
+namespace detail {
+inline std::atomic<bool> enabled{false};
+}
+
+/// Whether tracing is on.
+inline bool enabled() {
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+/// Trace one message in `every`; 0 turns tracing off.
+void set_sample_every(uint32_t every);
+
+/// `logging.trace_sample_every` from `config`.
+void apply(const nlohmann::json& config);
+
+/// A new flow for one message in `sample_every`, else 0.
+Flow sample();
+
+/// The flow of the innermost Span on this thread that has one, else 0.
+Flow current();
+
+/// Record a span that ran from `start` to now, for work that began on
+/// another thread or before a co_await. Strings must outlive the process:
+/// literals, or intern().
+void complete(const char* category, const char* name, Clock::time_point start, Flow flow = 0);
+
+/// A copy of `s` that lives as long as the process, for span names built
+/// at runtime. Takes a lock; use only where tracing is on and calls rare.
+const char* intern(std::string_view s);
+
+/// Every ring's spans as a Chrome trace-event JSON document.
+std::string dump();
+
+/**
+ * Times its scope. With a flow, it records only if the flow is sampled,
+ * and the flow becomes the thread's current() until it ends. Without one,
+ * it records whenever tracing is on, under current().
+ */
+class Span {
+public:
+    Span(const char* category, const char* name) noexcept;
+    Span(const char* category, const char* name, Flow flow) noexcept;
+    ~Span();
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* category_;
+    const char* name_;
+    Flow flow_ = 0;
+    Flow outer_ = 0;                // current() to restore
+    bool on_ = false;
+    bool scoped_ = false;           // set current() to flow_
+    Clock::time_point start_;
+};
+
+} // namespace trace
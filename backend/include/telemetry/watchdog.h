@@ -0,0 +1,82 @@
+#pragma once
+
+#include <asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <nlohmann/json.hpp>
+
+/**
+ * Event-loop stall detection.
+ *
+ * A watchdog thread posts a heartbeat onto every registered io_context and
+ * times how long it takes to run. Scheduling lag goes into the
+ * `p2p_io_lag_seconds` histogram; a heartbeat still queued after
+ * `threshold` means some handler has held that context's thread too long,
+ * and is logged once with the context's name and the tag of the handler
+ * running there. When the heartbeat finally runs, the stall is counted in
+ * `p2p_io_stalls_total` and its length recorded in `p2p_io_stall_seconds`.
+ *
+ * Components register their own contexts (a Registration member declared
+ * after the io_context), so the watchdog only needs starting:
+ *
+ *   watchdog::start(watchdog::options(config));
+ *   ...
+ *   watchdog::stop();
+ *
+ * Without start() registrations are inert, so tools and benches that build
+ * a MessageStore pay nothing.
+ */
+namespace watchdog {
+
+namespace detail {
+struct Watched;
+}
+
+struct Options {
+    std::chrono::milliseconds interval{100};     // heartbeat period per context
+    std::chrono::milliseconds threshold{250};    // lag reported as a stall
+};
+
+/// Options from the `node.watchdog_*` config keys; interval 0 disables.
+Options options(const nlohmann::json& config);
+
+/// Start the watchdog thread. No-op if already running or interval is 0.
+void start(Options options);
+
+/// Stop and join the watchdog thread. Call before tearing down the loops
+/// it watches so shutdown isn't reported as a stall.
+void stop();
+
+/// Keeps `io` watched for the lifetime of this object.
+class Registration {
+public:
+    Registration(std::string name, asio::io_context& io);
+    ~Registration();
+
+    Registration(const Registration&) = delete;
+    Registration& operator=(const Registration&) = delete;
+
+private:
+    std::shared_ptr<detail::Watched> state_;
+};
+
+/**
+ * Names the work this thread is doing, for stall reports. Costs two relaxed
+ * stores; nests, restoring the outer tag on destruction. `what` must be a
+ * string literal (it is read from the watchdog thread), and a Tag must not
+ * live across a co_await.
+ */
+class Tag {
+public:
+    explicit Tag(const char* what) noexcept;
+    ~Tag();
+
+    Tag(const Tag&) = delete;
+    Tag& operator=(const Tag&) = delete;
+
+private:
+    const char* prev_;
+};
+
+} // namespace watchdog
@@ -0,0 +1,125 @@
+/**
+ * EventJournal — numbered recent UI events for catching up after a
+ * reconnect.
+ */
+
+#include "api/event_journal.h"
+
+#include <charconv>
+#include <random>
+#include <unordered_set>
+#include <vector>
+
+using json = nlohmann::json;
+
+namespace {
+
+/// Events that would never be worth catching up on.
+bool transient(std::string_view event) {
+    return event == "typing";
+}
+
+/// Events that state a current value: only the last of each key counts.
+std::string collapse_key(std::string_view event, const json& data) {
+    const std::string username =
+        data.is_object() ? data.value("username", std::string()) : std::string();
+    if (event == "friend_online" || event == "friend_offline") {
+        return "presence/" + username;
+    }
+    if (event == "read") {
+        return "read/" + username;
+    }
+    if (event == "startup") {
+        return "startup";
+    }
+    return {};
+}
+
+} // namespace
+
+EventJournal::EventJournal(std::size_t max_bytes) : max_bytes_(max_bytes) {
+    std::random_device random;
+    const uint64_t run = (uint64_t{random()} << 32) | random();
+    char digits[16];
+    const auto end = std::to_chars(digits, digits + sizeof(digits), run, 16).ptr;
+    run_.assign(digits, end);
+}
+
+void EventJournal::set_max_bytes(std::size_t max_bytes) {
+    max_bytes_ = max_bytes;
+    trim();
+}
+
+std::string EventJournal::cursor_for(uint64_t seq) const {
+    return run_ + '.' + std::to_string(seq);
+}
+
+std::string EventJournal::cursor() const {
+    return cursor_for(seq_);
+}
+
+std::shared_ptr<const std::string> EventJournal::append(std::string_view event, const json& data) {
+    std::string text = "{";
+    const bool kept = !transient(event);
+    if (kept) {
+        text += "\"cursor\":\"" + cursor_for(seq_ + 1) + "\",";
+    }
+    text += "\"data\":";
+    text += data.dump();
+    text += ",\"event\":";
+    text += json(event).dump();
+    text += '}';
+    auto shared = std::make_shared<const std::string>(std::move(text));
+    if (kept) {
+        Entry entry{++seq_, collapse_key(event, data), shared};
+        bytes_ += entry.text->size() + entry.key.size();
+        entries_.push_back(std::move(entry));
+        trim();
+    }
+    return shared;
+}
+
+void EventJournal::trim() {
+    while (!entries_.empty() && bytes_ > max_bytes_) {
+        const Entry& oldest = entries_.front();
+        bytes_ -= oldest.text->size() + oldest.key.size();
+        dropped_ = oldest.seq;
+        entries_.pop_front();
+    }
+}
+
+std::string EventJournal::batch(std::string_view cursor) const {
+    bool known = false;
+    uint64_t after = 0;
+    if (const auto dot = cursor.rfind('.');
+        dot != std::string_view::npos && cursor.substr(0, dot) == run_) {
+        const char* end = cursor.data() + cursor.size();
+        const auto [ptr, ec] = std::from_chars(cursor.data() + dot + 1, end, after);
+        // Trimmed events are gone; a cursor past seq_ is not one we gave out.
+        known = ec == std::errc() && ptr == end && after >= dropped_ && after <= seq_;
+    }
+
+    // Keys in the order json::dump() sorts them.
+    std::string out = "{\"cursor\":\"" + cursor_for(seq_) + "\",\"events\":[";
+    if (known) {
+        // Newest first, so the last event of each key is the one kept.
+        std::vector<const Entry*> picked;
+        std::unordered_set<std::string_view> keys;
+        for (auto it = entries_.rbegin(); it != entries_.rend() && it->seq > after; ++it) {
+            if (!it->key.empty() && !keys.insert(it->key).second) {
+                continue;
+            }
+            picked.push_back(&*it);
+        }
+        for (auto it = picked.rbegin(); it != picked.rend(); ++it) {
+            if (it != picked.rbegin()) {
+                out += ',';
+            }
+            out += *(*it)->text;
+        }
+    }
+    out += "],\"reset\":";
+    out += known ? "false" : "true";
+    out += '}';
+    return out;
+}
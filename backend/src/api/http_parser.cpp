@@ -0,0 +1,258 @@
+/**
+ * HttpRequestReader — Incremental HTTP/1.1 request decoder.
+ *
+ * Plain byte scanning, no regex and no per-line allocations; the only copies
+ * are into the caller's reusable HttpRequest. See include/api/http_parser.h
+ * for the contract.
+ */
+
+#include "api/http_parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string_view>
+
+namespace {
+
+// Below this much free tail space, compact before the next read.
+constexpr std::size_t kMinReadSize = 4096;
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+char ascii_lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+bool iequals(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(),
+                      [](char x, char y) { return ascii_lower(x) == ascii_lower(y); });
+}
+
+/// Does the comma-separated header value contain `token`?
+bool has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        const auto comma = value.find(',');
+        if (iequals(trim(value.substr(0, comma)), token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+/// Does an Accept-Encoding value accept `coding`? "zstd;q=0" refuses it.
+bool accepts_coding(std::string_view value, std::string_view coding) {
+    while (!value.empty()) {
+        const auto comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        const auto semi = item.find(';');
+        if (iequals(trim(item.substr(0, semi)), coding)) {
+            std::string_view params = semi == std::string_view::npos ? std::string_view()
+                                                                      : trim(item.substr(semi + 1));
+            if (!params.starts_with("q=") && !params.starts_with("Q=")) {
+                return true;
+            }
+            params.remove_prefix(2);
+            return params.find_first_not_of("0.") != std::string_view::npos;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+bool parse_length(std::string_view s, std::size_t& out) {
+    if (s.empty() || s.size() > 18) {
+        return false;
+    }
+    std::size_t v = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') return false;
+        v = v * 10 + static_cast<std::size_t>(c - '0');
+    }
+    out = v;
+    return true;
+}
+
+} // namespace
+
+HttpRequestReader::HttpRequestReader(std::size_t max_body_size, std::size_t max_head_size)
+    : buffer_(kMinReadSize * 2),
+      max_body_size_(max_body_size),
+      max_head_size_(max_head_size) {}
+
+std::span<char> HttpRequestReader::prepare() {
+    if (read_pos_ == write_pos_) {
+        read_pos_ = write_pos_ = scan_pos_ = 0;
+    }
+
+    const std::size_t request_total = head_len_ ? head_len_ + body_len_ : 0;
+    const std::size_t want =
+        std::max(kMinReadSize, request_total > buffered() ? request_total - buffered() : 0);
+
+    if (buffer_.size() - write_pos_ < want && read_pos_ > 0) {
+        const std::size_t n = buffered();
+        std::memmove(buffer_.data(), buffer_.data() + read_pos_, n);
+        scan_pos_ = scan_pos_ > read_pos_ ? scan_pos_ - read_pos_ : 0;
+        read_pos_ = 0;
+        write_pos_ = n;
+    }
+
+    // Growth is bounded: a head only until max_head_size_ (next() gives up
+    // beyond that) and a body only once its Content-Length was accepted.
+    if (request_total > buffer_.size()) {
+        buffer_.resize(request_total);
+    } else if (buffer_.size() - write_pos_ < kMinReadSize) {
+        buffer_.resize(buffer_.size() * 2);
+    }
+    return {buffer_.data() + write_pos_, buffer_.size() - write_pos_};
+}
+
+void HttpRequestReader::commit(std::size_t n) {
+    write_pos_ = std::min(write_pos_ + n, buffer_.size());
+}
+
+bool HttpRequestReader::take_continue() {
+    if (!expect_continue_) {
+        return false;
+    }
+    expect_continue_ = false;
+    return true;
+}
+
+HttpRequestReader::Status HttpRequestReader::next(HttpRequest& request) {
+    if (head_len_ == 0) {
+        // Tolerate the stray CRLFs some clients send between requests.
+        while (read_pos_ + 1 < write_pos_ && buffer_[read_pos_] == '\r' &&
+               buffer_[read_pos_ + 1] == '\n') {
+            read_pos_ += 2;
+        }
+        scan_pos_ = std::max(scan_pos_, read_pos_);
+
+        const std::string_view data(buffer_.data(), write_pos_);
+        const std::size_t from = scan_pos_ >= read_pos_ + 3 ? scan_pos_ - 3 : read_pos_;
+        const auto end = data.find("\r\n\r\n", from);
+        if (end == std::string_view::npos) {
+            scan_pos_ = write_pos_;
+            return buffered() > max_head_size_ ? Status::TooLarge : Status::NeedMore;
+        }
+        const std::size_t head_len = end + 4 - read_pos_;
+        if (head_len > max_head_size_) {
+            return Status::TooLarge;
+        }
+        if (const auto status = parse_head(head_len, request); status != Status::Request) {
+            return status;
+        }
+        head_len_ = head_len;
+    }
+
+    if (buffered() < head_len_ + body_len_) {
+        return Status::NeedMore;
+    }
+    request.body.assign(buffer_.data() + read_pos_ + head_len_, body_len_);
+    read_pos_ += head_len_ + body_len_;
+    scan_pos_ = read_pos_;
+    head_len_ = body_len_ = 0;
+    expect_continue_ = false;
+    return Status::Request;
+}
+
+HttpRequestReader::Status HttpRequestReader::parse_head(std::size_t head_len,
+                                                        HttpRequest& request) {
+    std::string_view head(buffer_.data() + read_pos_, head_len - 2);   // keep each line's CRLF
+
+    // Request line: METHOD SP target SP HTTP/1.x
+    const auto line_end = head.find("\r\n");
+    const std::string_view line = head.substr(0, line_end);
+    const auto sp1 = line.find(' ');
+    const auto sp2 = line.find(' ', sp1 + 1);
+    if (sp1 == 0 || sp1 == std::string_view::npos || sp2 == std::string_view::npos ||
+        sp2 == sp1 + 1) {
+        return Status::Invalid;
+    }
+    const std::string_view version = line.substr(sp2 + 1);
+    if (version != "HTTP/1.1" && version != "HTTP/1.0") {
+        return Status::Invalid;
+    }
+    const std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    const auto q = target.find('?');
+    request.method.assign(line.substr(0, sp1));
+    request.path.assign(target.substr(0, q));
+    request.query.assign(q == std::string_view::npos ? std::string_view() : target.substr(q + 1));
+    request.body.clear();
+    request.keep_alive = version == "HTTP/1.1";
+    request.if_none_match.clear();
+    request.client_mode.clear();
+    request.accepts_zstd = false;
+    request.websocket_key.clear();
+    request.websocket_version.clear();
+    request.origin.clear();
+    bool upgrade_token = false;
+    bool upgrade_websocket = false;
+
+    bool have_length = false;
+    std::size_t length = 0;
+    bool expect_continue = false;
+    for (std::size_t pos = line_end + 2; pos < head.size();) {
+        const auto end = head.find("\r\n", pos);
+        const std::string_view header = head.substr(pos, end - pos);
+        pos = end + 2;
+
+        const auto colon = header.find(':');
+        if (colon == std::string_view::npos || colon == 0) {
+            return Status::Invalid;
+        }
+        const std::string_view name = header.substr(0, colon);
+        const std::string_view value = trim(header.substr(colon + 1));
+        if (iequals(name, "content-length")) {
+            std::size_t v = 0;
+            if (!parse_length(value, v) || (have_length && v != length)) {
+                return Status::Invalid;
+            }
+            have_length = true;
+            length = v;
+        } else if (iequals(name, "transfer-encoding")) {
+            return Status::Invalid;               // chunked uploads are not supported
+        } else if (iequals(name, "connection")) {
+            if (has_token(value, "close")) {
+                request.keep_alive = false;
+            } else if (has_token(value, "keep-alive")) {
+                request.keep_alive = true;
+            }
+            upgrade_token = upgrade_token || has_token(value, "upgrade");
+        } else if (iequals(name, "expect")) {
+            expect_continue = iequals(value, "100-continue");
+        } else if (iequals(name, "if-none-match")) {
+            request.if_none_match.assign(value);
+        } else if (iequals(name, "x-client-mode")) {
+            request.client_mode.assign(value);
+        } else if (iequals(name, "accept-encoding")) {
+            request.accepts_zstd = accepts_coding(value, "zstd");
+        } else if (iequals(name, "upgrade")) {
+            upgrade_websocket = has_token(value, "websocket");
+        } else if (iequals(name, "sec-websocket-key")) {
+            request.websocket_key.assign(value);
+        } else if (iequals(name, "sec-websocket-version")) {
+            request.websocket_version.assign(value);
+        } else if (iequals(name, "origin")) {
+            request.origin.assign(value);
+        }
+    }
+    request.upgrade_websocket = upgrade_token && upgrade_websocket;
+    if (length > max_body_size_) {
+        return Status::TooLarge;
+    }
+    body_len_ = length;
+    expect_continue_ = expect_continue && buffered() < head_len + length;
+    return Status::Request;
+}
@@ -7,17 +7,1168 @@
  *   - add friends
  *   - fetch chat history
  *
- * Runs on 127.0.0.1:<api_port> using ASIO.
+ * Runs on 127.0.0.1:<api_port> using ASIO, and optionally on a Unix domain
+ * socket (node.api_socket; api/ui_listener.h). Each connection is served by
+ * one coroutine that owns its socket and buffers. Connections are HTTP/1.1
+ * keep-alive, so the UI's polling reuses one socket; pipelined requests are
+ * answered in order, and a run of them in one write.
+ *
+ * Endpoints (see protocol/api_contract.md for details):
+ *
+ *   GET  /status                — health check
+ *   GET  /metrics               — Prometheus metrics (text format)
+ *   GET  /friends               — list friends
+ *   POST /friends               — add friend by username
+ *   POST /friends/batch         — add many: { "usernames": [...] }
+ *   GET  /messages?peer=<user>&limit=&before=  — chat history with a peer
+ *                                               (or &offset= instead of before)
+ *   GET  /messages?peer=&since=<msg_id>&wait=  — newer messages; long-polls
+ *                                               up to `wait` seconds
+ *
+ * Every 200 answer to a GET carries an ETag; a matching If-None-Match gets
+ * an empty 304 instead, so an unchanged poll costs no body on the wire. A
+ * client that sends `X-Client-Mode: poll` also gets `Retry-After`, the poll
+ * interval api/poll_advisor.h recommends.
+ *   GET  /messages/search?q=&peer=&limit=      — ranked full-text search
+ *   POST /messages              — send a message { "to": "...", "text": "..." }
+ *   POST /messages/batch        — send many: [{ "to", "text" }, ...]
+ *   POST /messages/stream       — send many as NDJSON lines; the results
+ *                                 stream back as chunked NDJSON
+ *   GET  /groups                — list groups
+ *   POST /groups                — create a group { "name": "...", "members": [...] }
+ *   POST /groups/<id>/messages  — send to a group { "text": "..." }
  */
 
 #include "api/local_api.h"
+#include "api/http_parser.h"
+#include "api/http_router.h"
+#include "network/io_context_pool.h"
+#include "network/compression.h"
+#include "network/envelope.h"
+#include "network/json_fields.h"
+#include "network/timer_wheel.h"
+#include "telemetry/metrics.h"
+#include "telemetry/trace.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::string_view kJsonType = "application/json";
+constexpr std::string_view kPrometheusType = "text/plain; version=0.0.4";
+
+// A /sync batch smaller than this goes out as is; zstd wouldn't pay.
+constexpr std::size_t kMinCompressedBody = 1024;
+
+// Bodies read with json_fields, which reports no position: malformed JSON,
+// a root that isn't an object, or a field that isn't a string.
+constexpr const char* kInvalidBody = "Invalid JSON: expected an object with string fields";
+constexpr const char* kInvalidExpiry = "Invalid 'expires_at': expected a future ISO 8601 UTC time";
+
+metrics::Counter& requests_total =
+    metrics::counter("p2p_api_requests_total", "Requests answered by the local REST API");
+metrics::Gauge& requests_in_flight =
+    metrics::gauge("p2p_api_requests_in_flight", "REST requests being handled, long-polls included");
+
+/// Check an optional `expires_at` and put it in the envelope timestamp
+/// format; empty (never expires) passes as is.
+bool normalize_expiry(std::string& expires_at) {
+    if (expires_at.empty()) {
+        return true;
+    }
+    const auto at = envelope::parse_timestamp(expires_at);
+    if (!at || *at <= static_cast<int64_t>(std::time(nullptr))) {
+        return false;
+    }
+    expires_at = envelope::format_timestamp(*at);
+    return true;
+}
+
+const char* status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 409: return "Conflict";
+    case 413: return "Payload Too Large";
+    default:  return "Internal Server Error";
+    }
+}
+
+/**
+ * Responses not yet written on one connection, in request order.
+ *
+ * Header blocks are formatted into one buffer that the connection keeps
+ * for its lifetime; bodies are not copied at all. Each response keeps its
+ * own body string, or a reference to one shared with the history cache,
+ * and flush() hands the socket a gather list of header and body pieces,
+ * so a run of pipelined responses still goes out in one write (one
+ * sendmsg with an iovec per piece).
+ */
+class ResponseBatch {
+public:
+    using Shared = std::shared_ptr<const std::string>;
+
+    /// Queue a Content-Length framed response; a 304 drops the body. A
+    /// nonzero `retry_after` (seconds) is sent as Retry-After.
+    void add(int status, std::string body, Shared shared, bool keep_alive,
+             std::string_view etag = {}, std::string_view content_type = kJsonType,
+             uint32_t retry_after = 0, std::string_view content_encoding = {}) {
+        const std::size_t begin = heads_.size();
+        const std::size_t length = shared ? shared->size() : body.size();
+        heads_ += "HTTP/1.1 ";
+        append_number(status);
+        heads_ += ' ';
+        heads_ += status_text(status);
+        if (!etag.empty()) {
+            heads_ += "\r\nETag: ";
+            heads_ += etag;
+        }
+        if (retry_after != 0) {
+            heads_ += "\r\nRetry-After: ";
+            append_number(retry_after);
+        }
+        if (status != 304) {
+            heads_ += "\r\nContent-Type: ";
+            heads_ += content_type;
+            if (!content_encoding.empty()) {
+                heads_ += "\r\nContent-Encoding: ";
+                heads_ += content_encoding;
+            }
+            heads_ += "\r\nContent-Length: ";
+            append_number(length);
+        } else {
+            body.clear();
+            shared.reset();
+        }
+        heads_ += keep_alive ? "\r\nConnection: keep-alive\r\n\r\n"
+                             : "\r\nConnection: close\r\n\r\n";
+        pending_.push_back({begin, heads_.size(), std::move(body), std::move(shared)});
+    }
+
+    /// Queue bytes with no body, such as an interim 100 Continue.
+    void add_raw(std::string_view bytes) {
+        const std::size_t begin = heads_.size();
+        heads_ += bytes;
+        pending_.push_back({begin, heads_.size(), {}, nullptr});
+    }
+
+    [[nodiscard]] bool empty() const { return pending_.empty(); }
+
+    /// The gather list for everything queued; valid until clear().
+    const std::vector<asio::const_buffer>& buffers() {
+        gather_.clear();
+        for (const auto& p : pending_) {
+            gather_.push_back(asio::buffer(heads_.data() + p.head_begin, p.head_end - p.head_begin));
+            const std::string& body = p.shared ? *p.shared : p.owned;
+            if (!body.empty()) {
+                gather_.push_back(asio::buffer(body));
+            }
+        }
+        return gather_;
+    }
+
+    /// Written: forget the responses but keep the buffers' capacity.
+    void clear() {
+        heads_.clear();
+        pending_.clear();
+        gather_.clear();
+    }
+
+private:
+    struct Pending {
+        std::size_t head_begin;
+        std::size_t head_end;
+        std::string owned;
+        Shared shared;
+    };
+
+    template <typename T>
+    void append_number(T value) {
+        char digits[24];
+        const auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        heads_.append(digits, end);
+    }
+
+    std::string heads_;
+    std::vector<Pending> pending_;
+    std::vector<asio::const_buffer> gather_;
+};
+
+/// Strong validator for a response body: its 64-bit FNV-1a hash.
+std::string etag_for(std::string_view body) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned char c : body) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    static constexpr char kHex[] = "0123456789abcdef";
+    std::string tag(18, '"');
+    for (int i = 0; i < 16; ++i) {
+        tag[16 - i] = kHex[(h >> (i * 4)) & 0xF];
+    }
+    return tag;
+}
+
+/// Does an If-None-Match list name `etag`? Comparison is weak, as RFC 9110
+/// prescribes for this header.
+bool etag_matches(std::string_view header, std::string_view etag) {
+    while (!header.empty()) {
+        const auto comma = header.find(',');
+        std::string_view tag = header.substr(0, comma);
+        while (!tag.empty() && tag.front() == ' ') tag.remove_prefix(1);
+        while (!tag.empty() && tag.back() == ' ') tag.remove_suffix(1);
+        if (tag.substr(0, 2) == "W/") tag.remove_prefix(2);
+        if (tag == "*" || tag == etag) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        header.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+std::string error_body(const std::string& message) {
+    return json{{"error", message}}.dump();
+}
+
+void append_outcome(std::string& out, bool delivered) {
+    out += delivered ? R"("delivered":true,"method":"direct")"
+                     : R"("delivered":false,"method":"offline")";
+}
+
+/// One chunk of a chunked response.
+void append_chunk(std::string& out, std::string_view data) {
+    char size[16];
+    const auto end = std::to_chars(size, size + sizeof(size), data.size(), 16).ptr;
+    out.append(size, end);
+    out += "\r\n";
+    out += data;
+    out += "\r\n";
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+std::string url_decode(std::string_view in) {
+    std::string out;
+    out.reserve(in.size());
+    for (std::size_t i = 0; i < in.size(); ++i) {
+        if (in[i] == '+') {
+            out += ' ';
+        } else if (in[i] == '%' && i + 2 < in.size() &&
+                   hex_value(in[i + 1]) >= 0 && hex_value(in[i + 2]) >= 0) {
+            out += static_cast<char>(hex_value(in[i + 1]) * 16 + hex_value(in[i + 2]));
+            i += 2;
+        } else {
+            out += in[i];
+        }
+    }
+    return out;
+}
+
+/// Value of `key` in a query string, decoded; nullopt if absent.
+std::optional<std::string> query_param(std::string_view query, std::string_view key) {
+    while (!query.empty()) {
+        const auto amp = query.find('&');
+        const auto pair = query.substr(0, amp);
+        const auto eq = pair.find('=');
+        if (pair.substr(0, eq) == key) {
+            return eq == std::string_view::npos ? std::string() : url_decode(pair.substr(eq + 1));
+        }
+        if (amp == std::string_view::npos) {
+            break;
+        }
+        query.remove_prefix(amp + 1);
+    }
+    return std::nullopt;
+}
+
+/// Numeric query parameter clamped to [lo, hi]; `fallback` if absent or invalid.
+std::size_t query_number(std::string_view query, std::string_view key, std::size_t fallback,
+                         std::size_t lo, std::size_t hi) {
+    auto raw = query_param(query, key);
+    if (!raw || raw->empty()) {
+        return fallback;
+    }
+    char* end = nullptr;
+    const unsigned long long v = std::strtoull(raw->c_str(), &end, 10);
+    if (*end != '\0') {
+        return fallback;
+    }
+    return std::clamp<std::size_t>(static_cast<std::size_t>(v), lo, hi);
+}
+
+} // namespace
+
+LocalAPI::LocalAPI(asio::io_context& io, uint16_t port)
+    : acceptor_(io), unix_acceptor_(io) {
+    if (port != 0) {
+        ui_listener::listen_tcp(acceptor_, port);
+    }
+}
+
+LocalAPI::LocalAPI(IoContextPool& pool, uint16_t port)
+    : pool_(&pool),
+      acceptor_(pool.main()),
+      unix_acceptor_(pool.main()) {
+    if (port != 0) {
+        ui_listener::listen_tcp(acceptor_, port);
+    }
+}
+
+bool LocalAPI::listen_unix(const std::string& path) {
+    if (!ui_listener::listen_unix(unix_acceptor_, path)) {
+        return false;
+    }
+    unix_path_ = path;
+    return true;
+}
+
+void LocalAPI::start() {
+    for (auto* acceptor : {&acceptor_, &unix_acceptor_}) {
+        if (acceptor->is_open()) {
+            asio::co_spawn(acceptor->get_executor(), accept_loop(*acceptor), asio::detached);
+        }
+    }
+}
+
+void LocalAPI::stop() {
+    ui_listener::close(acceptor_, "");
+    ui_listener::close(unix_acceptor_, unix_path_);
+
+    // Release held long-polls so their connections can finish.
+    std::lock_guard lock(waiters_mutex_);
+    for (const auto& [peer, timer] : waiters_) {
+        asio::post(timer->get_executor(), [timer] { timer->expires_after(std::chrono::seconds(0)); });
+    }
+}
+
+void LocalAPI::set_on_send(SendCallback cb) {
+    on_send_ = std::move(cb);
+}
+
+void LocalAPI::set_on_add_friend(FriendCallback cb) {
+    on_add_friend_ = std::move(cb);
+}
+
+void LocalAPI::set_on_add_friends(FriendsCallback cb) {
+    on_add_friends_ = std::move(cb);
+}
+
+void LocalAPI::set_on_list_friends(ListFriendsCallback cb) {
+    on_list_friends_ = std::move(cb);
+}
+
+void LocalAPI::set_on_history(HistoryCallback cb) {
+    on_history_ = std::move(cb);
+}
+
+void LocalAPI::set_on_search(SearchCallback cb) {
+    on_search_ = std::move(cb);
+}
+
+void LocalAPI::set_on_messages_since(SinceCallback cb) {
+    on_since_ = std::move(cb);
+}
+
+void LocalAPI::set_on_send_file(SendFileCallback cb) {
+    on_send_file_ = std::move(cb);
+}
+
+void LocalAPI::set_on_accept_file(TransferCallback cb) {
+    on_accept_file_ = std::move(cb);
+}
+
+void LocalAPI::set_on_cancel_file(TransferCallback cb) {
+    on_cancel_file_ = std::move(cb);
+}
+
+void LocalAPI::set_on_status(StatusCallback cb) {
+    on_status_ = std::move(cb);
+}
+
+void LocalAPI::set_on_create_group(CreateGroupCallback cb) {
+    on_create_group_ = std::move(cb);
+}
+
+void LocalAPI::set_on_list_groups(ListGroupsCallback cb) {
+    on_list_groups_ = std::move(cb);
+}
+
+void LocalAPI::set_on_group_send(GroupSendCallback cb) {
+    on_group_send_ = std::move(cb);
+}
+
+void LocalAPI::set_on_delta(DeltaCallback cb) {
+    on_delta_ = std::move(cb);
+}
+
+void LocalAPI::set_on_peers(PeersCallback cb) {
+    on_peers_ = std::move(cb);
+}
+
+void LocalAPI::set_on_sync(SyncCallback cb) {
+    on_sync_ = std::move(cb);
+}
+
+void LocalAPI::notify_messages(const std::string& peer) {
+    poll_advisor_.activity();
+    std::lock_guard lock(waiters_mutex_);
+    auto [first, last] = waiters_.equal_range(peer);
+    for (; first != last; ++first) {
+        asio::post(first->second->get_executor(),
+                   [timer = first->second] { timer->expires_after(std::chrono::seconds(0)); });
+    }
+}
+
+asio::awaitable<std::optional<std::string>> LocalAPI::wait_for_messages(const std::string& peer,
+                                                                        const std::string& since,
+                                                                        std::size_t limit,
+                                                                        std::chrono::seconds wait) {
+    if (wait.count() == 0) {
+        co_return co_await on_since_(peer, since, limit);
+    }
+
+    // Registered before the first query, so a message stored while that
+    // query runs still cuts the wait short. The timer only wakes the
+    // waiter, as notify_messages() does; the timeout is on the context's
+    // timer wheel.
+    const auto ex = co_await asio::this_coro::executor;
+    auto timer = std::make_shared<asio::steady_timer>(ex, asio::steady_timer::time_point::max());
+    {
+        std::lock_guard lock(waiters_mutex_);
+        waiters_.emplace(peer, timer);
+    }
+    TimerWheel& wheel = TimerWheel::of(ex);
+    const TimerWheel::Handle timeout = wheel.schedule(wait, [ex, timer] {
+        asio::post(ex, [timer] { timer->expires_after(std::chrono::seconds(0)); });
+    });
+    struct Registration {
+        LocalAPI& api;
+        const std::string& peer;
+        const std::shared_ptr<asio::steady_timer>& timer;
+        TimerWheel& wheel;
+        TimerWheel::Handle timeout;
+        ~Registration() {
+            wheel.cancel(timeout);
+            std::lock_guard lock(api.waiters_mutex_);
+            auto [first, last] = api.waiters_.equal_range(peer);
+            for (; first != last; ++first) {
+                if (first->second == timer) {
+                    api.waiters_.erase(first);
+                    break;
+                }
+            }
+        }
+    } registration{*this, peer, timer, wheel, timeout};
+
+    auto page = co_await on_since_(peer, since, limit);
+    if (page && page->starts_with(kNoNewMessages)) {
+        asio::error_code ec;
+        co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+        page = co_await on_since_(peer, since, limit);
+    }
+    co_return page;
+}
+
+asio::any_io_executor LocalAPI::connection_executor() {
+    if (pool_) {
+        return asio::make_strand(pool_->next());
+    }
+    return asio::make_strand(acceptor_.get_executor());
+}
+
+asio::awaitable<void> LocalAPI::accept_loop(ui_listener::Acceptor& acceptor) {
+    for (;;) {
+        asio::error_code ec;
+        ui_listener::Socket socket = co_await acceptor.async_accept(
+            connection_executor(), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec == asio::error::operation_aborted || !acceptor.is_open()) {
+                co_return;
+            }
+            spdlog::warn("API accept failed: {}", ec.message());
+            continue;
+        }
+        auto ex = socket.get_executor();
+        asio::co_spawn(ex, serve_connection(std::move(socket)), asio::detached);
+    }
+}
+
+asio::awaitable<bool> LocalAPI::send_many(std::vector<Outgoing> messages,
+                                          const SettledRun& settled) {
+    // Each send runs as its own coroutine on this executor (the connection's
+    // strand), so sealing and peer writes overlap across the window; their
+    // results queue here and wake the loop below.
+    struct State {
+        explicit State(const asio::any_io_executor& ex) : wake(ex) {}
+        asio::steady_timer wake;
+        std::vector<std::pair<std::size_t, bool>> done;
+    };
+    auto ex = co_await asio::this_coro::executor;
+    auto state = std::make_shared<State>(ex);
+    std::vector<std::pair<std::size_t, bool>> run;
+    std::size_t next = 0;
+    std::size_t running = 0;
+    while (next < messages.size() || running > 0) {
+        for (; next < messages.size() && running < kSendWindow; ++next, ++running) {
+            asio::co_spawn(
+                ex,
+                [this, state, index = next, to = std::move(messages[next].to),
+                 text = std::move(messages[next].text),
+                 expires_at = std::move(messages[next].expires_at)]() -> asio::awaitable<void> {
+                    const bool delivered = on_send_ && co_await on_send_(to, text, expires_at);
+                    state->done.emplace_back(index, delivered);
+                    state->wake.expires_after(std::chrono::seconds(0));
+                },
+                asio::detached);
+        }
+        if (state->done.empty()) {
+            state->wake.expires_at(asio::steady_timer::time_point::max());
+            asio::error_code ec;
+            co_await state->wake.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+            continue;
+        }
+        run.swap(state->done);
+        state->done.clear();
+        running -= run.size();
+        if (!co_await settled(run)) {
+            co_return false;
+        }
+        run.clear();
+    }
+    co_return true;
+}
+
+asio::awaitable<bool> LocalAPI::stream_sends(ui_listener::Socket& socket, const HttpRequest& req) {
+    std::string head = "HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\n"
+                       "Transfer-Encoding: chunked\r\n";
+    head += req.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+    // Lines that can't be sent are answered up front, with the head.
+    std::vector<Outgoing> messages;
+    std::vector<std::size_t> line_of;   // message -> index of its line
+    std::vector<std::string> ids;       // message -> its "id", if any
+    std::string rejected;
+    std::string to, text, id, expires_at;
+    bool has_to = false, has_text = false;
+    const json_fields::Field fields[] = {
+        {"to", &to, nullptr, &has_to},
+        {"text", &text, nullptr, &has_text},
+        {"id", &id, nullptr, nullptr},
+        {"expires_at", &expires_at, nullptr, nullptr},
+    };
+    std::string_view rest = req.body;
+    for (std::size_t index = 0; !rest.empty();) {
+        const auto eol = rest.find('\n');
+        std::string_view line = rest.substr(0, eol);
+        rest.remove_prefix(eol == std::string_view::npos ? rest.size() : eol + 1);
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            continue;
+        }
+        to.clear();
+        text.clear();
+        id.clear();
+        expires_at.clear();
+        has_to = has_text = false;
+        const char* error = nullptr;
+        if (!json_fields::read(line, fields)) {
+            error = kInvalidBody;
+        } else if (!has_to || !has_text) {
+            error = "Missing required field: 'to' or 'text'";
+        } else if (!normalize_expiry(expires_at)) {
+            error = kInvalidExpiry;
+        }
+        if (error) {
+            rejected += R"({"index":)" + std::to_string(index) + R"(,"error":)";
+            json_fields::append_string(rejected, error);
+            rejected += "}\n";
+        } else {
+            messages.push_back({std::move(to), std::move(text), std::move(expires_at)});
+            line_of.push_back(index);
+            ids.push_back(std::move(id));
+        }
+        ++index;
+    }
+    if (!rejected.empty()) {
+        append_chunk(head, rejected);
+    }
+
+    asio::error_code ec;
+    co_await asio::async_write(socket, asio::buffer(head),
+                               asio::redirect_error(asio::use_awaitable, ec));
+    if (ec) {
+        co_return false;
+    }
+
+    std::vector<std::string> recipients;
+    recipients.reserve(messages.size());
+    for (const auto& m : messages) {
+        recipients.push_back(m.to);
+    }
+    // Everything that settled while the last chunk was being written goes
+    // out as the next one.
+    std::string lines;
+    std::string chunk;
+    const bool written = co_await send_many(
+        std::move(messages),
+        [&](std::span<const std::pair<std::size_t, bool>> run) -> asio::awaitable<bool> {
+            lines.clear();
+            for (const auto& [i, delivered] : run) {
+                lines += R"({"index":)" + std::to_string(line_of[i]);
+                if (!ids[i].empty()) {
+                    lines += R"(,"id":)";
+                    json_fields::append_string(lines, ids[i]);
+                }
+                lines += ',';
+                append_outcome(lines, delivered);
+                lines += "}\n";
+                notify_messages(recipients[i]);
+            }
+            chunk.clear();
+            append_chunk(chunk, lines);
+            asio::error_code write_ec;
+            co_await asio::async_write(socket, asio::buffer(chunk),
+                                       asio::redirect_error(asio::use_awaitable, write_ec));
+            co_return !write_ec;
+        });
+    if (!written) {
+        co_return false;
+    }
+    co_await asio::async_write(socket, asio::buffer(std::string_view("0\r\n\r\n")),
+                               asio::redirect_error(asio::use_awaitable, ec));
+    co_return !ec;
+}
+
+asio::awaitable<void> LocalAPI::serve_connection(ui_listener::Socket socket) {
+    HttpRequestReader reader;
+    HttpRequest req;
+    ResponseBatch out;
+    std::string body;
+    std::shared_ptr<const std::string> shared_body;
+
+    // Closing the socket is what ends an idle keep-alive connection: the
+    // pending read fails and the loop exits. The deadline is on the
+    // context's timer wheel, which runs it off the strand, so it posts the
+    // close back; one already under way when the coroutine finishes must
+    // not touch the socket, hence the liveness flag (read on the strand).
+    struct Connection {
+        asio::any_io_executor strand;
+        ui_listener::Socket* socket;
+        bool alive = true;
+    };
+    auto connection = std::make_shared<Connection>(Connection{socket.get_executor(), &socket});
+    TimerWheel& wheel = TimerWheel::of(socket.get_executor());
+    TimerWheel::Handle idle;
+    struct Alive {
+        Connection& connection;
+        TimerWheel& wheel;
+        TimerWheel::Handle& idle;
+        ~Alive() {
+            connection.alive = false;
+            wheel.cancel(idle);
+        }
+    } alive_guard{*connection, wheel, idle};
+    auto arm_idle = [&] {
+        idle = wheel.schedule(kIdleTimeout, [connection] {
+            asio::post(connection->strand, [connection] {
+                if (connection->alive) {
+                    asio::error_code ignored;
+                    connection->socket->close(ignored);
+                }
+            });
+        });
+    };
+
+    asio::error_code ec;
+    bool open = true;
+    while (open) {
+        const auto status = reader.next(req);
+        if (status == HttpRequestReader::Status::Request && on_send_ &&
+            http_router::match(req.method, req.path).route == http_router::Route::SendStream) {
+            // Answered as its sends settle, after whatever is queued ahead.
+            if (!out.empty()) {
+                co_await asio::async_write(socket, out.buffers(),
+                                           asio::redirect_error(asio::use_awaitable, ec));
+                if (ec) {
+                    co_return;
+                }
+                out.clear();
+            }
+            requests_in_flight.add(1);
+            const bool written = co_await stream_sends(socket, req);
+            requests_in_flight.add(-1);
+            requests_total.inc();
+            if (!written) {
+                co_return;
+            }
+            open = req.keep_alive;
+            continue;
+        }
+        if (status == HttpRequestReader::Status::Request) {
+            body.clear();
+            shared_body.reset();
+            std::string_view content_type = kJsonType;
+            std::string_view content_encoding;
+            requests_in_flight.add(1);
+            int code = co_await dispatch(req, body, shared_body, content_type, content_encoding);
+            requests_in_flight.add(-1);
+            requests_total.inc();
+            open = req.keep_alive;
+            std::string etag;
+            if (req.method == "GET" && code == 200) {
+                etag = etag_for(shared_body ? *shared_body : body);
+                if (!req.if_none_match.empty() && etag_matches(req.if_none_match, etag)) {
+                    code = 304;
+                }
+            }
+            uint32_t retry_after = 0;
+            if (req.client_mode == "poll") {
+                // Whole seconds, as the header takes; never 0, which is "now".
+                const auto ms = poll_advisor_.interval().count();
+                retry_after = static_cast<uint32_t>(std::max<int64_t>(1, (ms + 999) / 1000));
+            }
+            out.add(code, std::move(body), std::move(shared_body), open, etag, content_type,
+                    retry_after, content_encoding);
+            body = std::string();
+            continue;       // a pipelined request may already be buffered
+        }
+        if (status != HttpRequestReader::Status::NeedMore) {
+            const bool too_large = status == HttpRequestReader::Status::TooLarge;
+            out.add(too_large ? 413 : 400,
+                    error_body(too_large ? "Request too large" : "Malformed request"), nullptr,
+                    false);
+            open = false;
+            break;
+        }
+
+        // Nothing complete left: flush the batch, then wait for more.
+        if (reader.take_continue()) {
+            out.add_raw("HTTP/1.1 100 Continue\r\n\r\n");
+        }
+        if (!out.empty()) {
+            co_await asio::async_write(socket, out.buffers(),
+                                       asio::redirect_error(asio::use_awaitable, ec));
+            if (ec) {
+                co_return;
+            }
+            out.clear();
+        }
+        arm_idle();
+        auto span = reader.prepare();
+        const std::size_t n = co_await socket.async_read_some(
+            asio::buffer(span.data(), span.size()), asio::redirect_error(asio::use_awaitable, ec));
+        wheel.cancel(idle);
+        if (ec) {
+            co_return;      // client closed, idle timeout, or reset
+        }
+        reader.commit(n);
+    }
+
+    if (!out.empty()) {
+        co_await asio::async_write(socket, out.buffers(),
+                                   asio::redirect_error(asio::use_awaitable, ec));
+    }
+    socket.shutdown(asio::socket_base::shutdown_both, ec);
+}
+
+asio::awaitable<int> LocalAPI::dispatch(const HttpRequest& req, std::string& body,
+                                        std::shared_ptr<const std::string>& shared_body,
+                                        std::string_view& content_type,
+                                        std::string_view& content_encoding) {
+    int status = 404;
+    body = error_body("Not found");
+
+    const http_router::Match route = http_router::match(req.method, req.path);
+    try {
+        switch (route.route) {
+        case http_router::Route::Status: {
+            status = 200;
+            json reply = on_status_ ? on_status_() : json::object();
+            reply["status"] = "ok";
+            // Negotiation: the mode the client declared, and for a poller
+            // the interval Retry-After rounds to seconds.
+            if (req.client_mode == "poll") {
+                reply["client_mode"] = "poll";
+                reply["poll_interval_ms"] = poll_advisor_.interval().count();
+            } else if (req.client_mode == "push") {
+                reply["client_mode"] = "push";
+            }
+            body = reply.dump();
+            break;
+        }
+        case http_router::Route::Peers: {
+            if (!on_peers_) {
+                break;
+            }
+            const std::string sort = query_param(req.query, "sort").value_or("crypto_us");
+            auto peers = on_peers_(sort, query_number(req.query, "limit", 50, 1, 1000));
+            status = peers ? 200 : 400;
+            body = peers ? peers->dump() : error_body("Unknown sort: '" + sort + "'");
+            break;
+        }
+        case http_router::Route::Metrics:
+            status = 200;
+            body = metrics::render_prometheus();
+            content_type = kPrometheusType;
+            break;
+        case http_router::Route::DebugTrace: {
+            // An optional {"sample_every": N} switches tracing first; 0 is off.
+            if (!req.body.empty()) {
+                auto j = json::parse(req.body);
+                if (j.contains("sample_every")) {
+                    const auto every = j.at("sample_every").get<int64_t>();
+                    if (every < 0 || every > UINT32_MAX) {
+                        status = 400;
+                        body = error_body("sample_every must be a non-negative number");
+                        break;
+                    }
+                    trace::set_sample_every(static_cast<uint32_t>(every));
+                }
+            }
+            status = 200;
+            body = trace::dump();
+            break;
+        }
+        case http_router::Route::Sync: {
+            if (!on_sync_) {
+                break;
+            }
+            status = 200;
+            body = on_sync_(query_param(req.query, "cursor").value_or(""));
+            // A long catch-up is mostly repeated keys and ids.
+            if (req.accepts_zstd && body.size() >= kMinCompressedBody) {
+                if (auto packed = compression::compress_standalone(body)) {
+                    body = std::move(*packed);
+                    content_encoding = "zstd";
+                }
+            }
+            break;
+        }
+        case http_router::Route::ListFriends: {
+            if (!on_list_friends_) {
+                break;
+            }
+            auto friends = co_await on_list_friends_();
+            status = friends ? 200 : 500;
+            body = friends ? std::move(*friends) : error_body("Could not read the friend list");
+            break;
+        }
+        case http_router::Route::History: {
+            if (!on_history_) {
+                break;
+            }
+            auto peer = query_param(req.query, "peer");
+            if (!peer || peer->empty()) {
+                status = 400;
+                body = error_body("Missing required parameter: 'peer'");
+            } else {
+                const std::size_t limit = query_number(req.query, "limit", 50, 1, 500);
+                if (auto since = query_param(req.query, "since"); since && on_since_) {
+                    const std::chrono::seconds wait(
+                        query_number(req.query, "wait", 0, 0, kMaxWait.count()));
+                    auto fresh = co_await wait_for_messages(*peer, *since, limit, wait);
+                    status = fresh ? 200 : 500;
+                    body = fresh ? std::move(*fresh) : error_body("Could not read chat history");
+                } else {
+                    const std::size_t offset = query_number(req.query, "offset", 0, 0, SIZE_MAX);
+                    const std::string before = query_param(req.query, "before").value_or("");
+                    // Written straight from the (possibly cached) page, not copied.
+                    shared_body = co_await on_history_(*peer, limit, offset, before);
+                    status = shared_body ? 200 : 500;
+                    body = shared_body ? std::string() : error_body("Could not read chat history");
+                }
+            }
+            break;
+        }
+        case http_router::Route::Search: {
+            if (!on_search_) {
+                break;
+            }
+            auto q = query_param(req.query, "q");
+            if (!q || q->empty()) {
+                status = 400;
+                body = error_body("Missing required parameter: 'q'");
+            } else {
+                const std::size_t limit = query_number(req.query, "limit", 20, 1, 100);
+                const std::string peer = query_param(req.query, "peer").value_or("");
+                auto hits = co_await on_search_(*q, peer, limit);
+                status = hits ? 200 : 500;
+                body = hits ? std::move(*hits) : error_body("Search is unavailable");
+            }
+            break;
+        }
+        case http_router::Route::Send: {
+            // The one body that carries long text; read without a DOM.
+            std::string to, text, expires_at;
+            bool has_to = false, has_text = false;
+            const json_fields::Field fields[] = {
+                {"to", &to, nullptr, &has_to},
+                {"text", &text, nullptr, &has_text},
+                {"expires_at", &expires_at, nullptr, nullptr},
+            };
+            if (!json_fields::read(req.body, fields)) {
+                status = 400;
+                body = error_body(kInvalidBody);
+            } else if (!has_to || !has_text) {
+                status = 400;
+                body = error_body("Missing required field: 'to' or 'text'");
+            } else if (!normalize_expiry(expires_at)) {
+                status = 400;
+                body = error_body(kInvalidExpiry);
+            } else {
+                const bool delivered = on_send_ && co_await on_send_(to, text, expires_at);
+                notify_messages(to);
+                status = delivered ? 200 : 202;
+                body = json{{"delivered", delivered},
+                            {"method", delivered ? "direct" : "offline"}}.dump();
+            }
+            break;
+        }
+        case http_router::Route::SendBatch: {
+            if (!on_send_) {
+                break;
+            }
+            std::vector<Outgoing> messages;
+            std::string to, text, expires_at;
+            bool has_to = false, has_text = false, complete = true, valid = true;
+            const json_fields::Field fields[] = {
+                {"to", &to, nullptr, &has_to},
+                {"text", &text, nullptr, &has_text},
+                {"expires_at", &expires_at, nullptr, nullptr},
+            };
+            const bool parsed = json_fields::read_rows(req.body, fields, [&] {
+                complete = complete && has_to && has_text;
+                valid = valid && normalize_expiry(expires_at);
+                messages.push_back({std::move(to), std::move(text), std::move(expires_at)});
+            });
+            if (!parsed) {
+                status = 400;
+                body = error_body("Invalid JSON: expected an array of objects with string fields");
+            } else if (!complete) {
+                status = 400;
+                body = error_body("Missing required field: 'to' or 'text'");
+            } else if (!valid) {
+                status = 400;
+                body = error_body(kInvalidExpiry);
+            } else {
+                std::vector<std::string> recipients;
+                for (const auto& m : messages) {
+                    recipients.push_back(m.to);
+                }
+                std::vector<char> delivered(messages.size(), 0);
+                co_await send_many(
+                    std::move(messages),
+                    [&](std::span<const std::pair<std::size_t, bool>> run)
+                        -> asio::awaitable<bool> {
+                        for (const auto& [i, ok] : run) {
+                            delivered[i] = ok;
+                        }
+                        co_return true;
+                    });
+                std::sort(recipients.begin(), recipients.end());
+                recipients.erase(std::unique(recipients.begin(), recipients.end()),
+                                 recipients.end());
+                for (const auto& peer : recipients) {
+                    notify_messages(peer);
+                }
+                status = 200;
+                body = R"({"results":[)";
+                for (std::size_t i = 0; i < delivered.size(); ++i) {
+                    body += i ? ",{" : "{";
+                    append_outcome(body, delivered[i]);
+                    body += '}';
+                }
+                body += "]}";
+            }
+            break;
+        }
+        case http_router::Route::SendStream:
+            break;      // answered by serve_connection as the sends settle
+        case http_router::Route::SendFile: {
+            if (!on_send_file_) {
+                break;
+            }
+            auto j = json::parse(req.body);
+            if (!j.contains("to") || !j.contains("path")) {
+                status = 400;
+                body = error_body("Missing required field: 'to' or 'path'");
+            } else if (auto id = on_send_file_(j["to"].get<std::string>(),
+                                               j["path"].get<std::string>())) {
+                status = 202;
+                body = json{{"transfer_id", *id}}.dump();
+            } else {
+                status = 404;
+                body = error_body("The file can't be read or the recipient has no address");
+            }
+            break;
+        }
+        case http_router::Route::AcceptFile:
+        case http_router::Route::CancelFile: {
+            const auto& handler = route.route == http_router::Route::AcceptFile ? on_accept_file_
+                                                                                : on_cancel_file_;
+            auto j = json::parse(req.body);
+            if (!j.contains("transfer_id")) {
+                status = 400;
+                body = error_body("Missing required field: 'transfer_id'");
+            } else {
+                auto id = j["transfer_id"].get<std::string>();
+                if (handler && handler(id)) {
+                    status = 200;
+                    body = json{{"transfer_id", id}}.dump();
+                } else {
+                    status = 404;
+                    body = error_body("No pending transfer '" + id + "'");
+                }
+            }
+            break;
+        }
+        case http_router::Route::ListGroups:
+            if (!on_list_groups_) {
+                break;
+            }
+            status = 200;
+            body = on_list_groups_().dump();
+            break;
+        case http_router::Route::CreateGroup: {
+            if (!on_create_group_) {
+                break;
+            }
+            auto j = json::parse(req.body);
+            if (!j.contains("name") || !j.contains("members") || !j["members"].is_array()) {
+                status = 400;
+                body = error_body("Missing required field: 'name' or 'members'");
+            } else if (auto group = on_create_group_(
+                           j["name"].get<std::string>(),
+                           j["members"].get<std::vector<std::string>>())) {
+                status = 201;
+                body = group->dump();
+            } else {
+                status = 400;
+                body = error_body("Every member must be a friend");
+            }
+            break;
+        }
+        case http_router::Route::GroupSend: {
+            if (!on_group_send_) {
+                break;
+            }
+            const std::string group_id(route.param);
+            std::string text;
+            bool has_text = false;
+            const json_fields::Field fields[] = {{"text", &text, nullptr, &has_text}};
+            if (!json_fields::read(req.body, fields)) {
+                status = 400;
+                body = error_body(kInvalidBody);
+            } else if (!has_text) {
+                status = 400;
+                body = error_body("Missing required field: 'text'");
+            } else if (auto sent = on_group_send_(group_id, text)) {
+                notify_messages(group_id);
+                status = 200;
+                body = sent->dump();
+            } else {
+                status = 404;
+                body = error_body("No group '" + group_id + "'");
+            }
+            break;
+        }
+        case http_router::Route::MessageDelta: {
+            if (!on_delta_) {
+                break;
+            }
+            const std::string msg_id(route.param);
+            std::string peer, op, value;
+            bool has_peer = false, has_op = false;
+            const json_fields::Field fields[] = {
+                {"peer", &peer, nullptr, &has_peer},
+                {"op", &op, nullptr, &has_op},
+                {"value", &value, nullptr, nullptr},
+            };
+            if (!json_fields::read(req.body, fields)) {
+                status = 400;
+                body = error_body(kInvalidBody);
+            } else if (!has_peer || !has_op) {
+                status = 400;
+                body = error_body("Missing required field: 'peer' or 'op'");
+            } else if (auto delta = co_await on_delta_(peer, msg_id, op, value)) {
+                // Queued: it goes out with the rest of its batch.
+                status = 202;
+                body = delta->dump();
+            } else {
+                status = 400;
+                body = error_body("Invalid delta for '" + peer + "'");
+            }
+            break;
+        }
+        case http_router::Route::AddFriend: {
+            auto j = json::parse(req.body);
+            if (!j.contains("username")) {
+                status = 400;
+                body = error_body("Missing required field: 'username'");
+            } else {
+                auto username = j["username"].get<std::string>();
+                if (on_add_friend_ && on_add_friend_(username)) {
+                    status = 201;
+                    body = json{{"username", username}}.dump();
+                } else {
+                    status = 404;
+                    body = error_body("User '" + username + "' not found.");
+                }
+            }
+            break;
+        }
+        case http_router::Route::AddFriends: {
+            if (!on_add_friends_) {
+                break;
+            }
+            auto j = json::parse(req.body);
+            if (!j.is_object() || !j.contains("usernames") || !j["usernames"].is_array()) {
+                status = 400;
+                body = error_body("Missing required field: 'usernames' (an array)");
+            } else if (j["usernames"].size() > kMaxFriendBatch) {
+                status = 413;
+                body = error_body("At most " + std::to_string(kMaxFriendBatch) +
+                                  " usernames per request");
+            } else if (auto result = co_await on_add_friends_(
+                           j["usernames"].get<std::vector<std::string>>())) {
+                status = 200;
+                body = result->dump();
+            } else {
+                status = 502;
+                body = error_body("Could not look up or store the friends; nobody was added");
+            }
+            break;
+        }
+        case http_router::Route::NotFound:
+            break;
+        }
+    } catch (const json::exception& e) {
+        status = 400;
+        body = error_body(std::string("Invalid JSON: ") + e.what());
+    }
 
-// TODO: Implement a minimal HTTP/1.1 server (or use a micro-framework)
-//
-// Endpoints (see protocol/api_contract.md for details):
-//
-//   GET  /status                — health check
-//   GET  /friends               — list friends
-//   POST /friends               — add friend by username
-//   GET  /messages?peer=<user>  — chat history with a peer
-//   POST /messages              — send a message { "to": "...", "text": "..." }
+    co_return status;
+}
@@ -0,0 +1,30 @@
+/**
+ * PollAdvisor — the poll interval recommended to polling UIs.
+ */
+
+#include "api/poll_advisor.h"
+
+#include <algorithm>
+
+PollAdvisor::PollAdvisor(Options options)
+    : min_ms_(0), max_ms_(0), last_activity_(Clock::now().time_since_epoch().count()) {
+    set_options(options);
+}
+
+void PollAdvisor::set_options(Options options) {
+    const int64_t min = std::max<int64_t>(options.min.count(), 1);
+    min_ms_.store(min, std::memory_order_relaxed);
+    max_ms_.store(std::max<int64_t>(options.max.count(), min), std::memory_order_relaxed);
+}
+
+void PollAdvisor::activity(Clock::time_point now) {
+    last_activity_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+}
+
+std::chrono::milliseconds PollAdvisor::interval(Clock::time_point now) const {
+    const Clock::time_point last{Clock::duration(last_activity_.load(std::memory_order_relaxed))};
+    const auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(now - last);
+    return std::chrono::milliseconds(std::clamp<int64_t>(idle.count() / 4,
+                                                         min_ms_.load(std::memory_order_relaxed),
+                                                         max_ms_.load(std::memory_order_relaxed)));
+}
@@ -0,0 +1,146 @@
+/**
+ * UiEventRing — single-producer broadcast ring in POSIX shared memory.
+ */
+
+#include "api/ui_event_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+template <typename T>
+std::atomic_ref<T> field(unsigned char* base, std::size_t offset) {
+    return std::atomic_ref<T>(*reinterpret_cast<T*>(base + offset));
+}
+
+void put_u32(unsigned char* at, uint32_t v) {
+    std::memcpy(at, &v, sizeof(v));             // the ring is little-endian, as are our targets
+}
+
+/// MessagePack str header for `n` bytes, then the bytes.
+void append_str(std::vector<uint8_t>& out, std::string_view s) {
+    const std::size_t n = s.size();
+    if (n < 32) {
+        out.push_back(static_cast<uint8_t>(0xa0 | n));
+    } else if (n <= 0xff) {
+        out.insert(out.end(), {0xd9, static_cast<uint8_t>(n)});
+    } else if (n <= 0xffff) {
+        out.insert(out.end(), {0xda, static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(n)});
+    } else {
+        out.insert(out.end(), {0xdb, static_cast<uint8_t>(n >> 24), static_cast<uint8_t>(n >> 16),
+                               static_cast<uint8_t>(n >> 8), static_cast<uint8_t>(n)});
+    }
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+} // namespace
+
+UiEventRing::~UiEventRing() {
+#ifndef _WIN32
+    if (base_) {
+        ::munmap(base_, mapped_);
+        ::shm_unlink(name_.c_str());
+    }
+#endif
+}
+
+bool UiEventRing::open(const std::string& name, std::size_t capacity) {
+#ifdef _WIN32
+    spdlog::error("UI event ring {}: needs POSIX shared memory", name);
+    return false;
+#else
+    capacity_ = std::bit_ceil(std::max<std::size_t>(capacity, 4096));
+    mapped_ = kDataOffset + capacity_;
+
+    ::shm_unlink(name.c_str());                 // left by a run that didn't exit cleanly
+    const int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        spdlog::error("UI event ring {}: {}", name, std::strerror(errno));
+        return false;
+    }
+    void* base = MAP_FAILED;
+    if (::ftruncate(fd, static_cast<off_t>(mapped_)) == 0) {
+        base = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    const int err = errno;
+    ::close(fd);                                // the mapping keeps the object alive
+    if (base == MAP_FAILED) {
+        spdlog::error("UI event ring {}: {}", name, std::strerror(err));
+        ::shm_unlink(name.c_str());
+        return false;
+    }
+
+    name_ = name;
+    base_ = static_cast<unsigned char*>(base);
+    put_u32(base_, kMagic);
+    put_u32(base_ + 4, kVersion);
+    std::memcpy(base_ + 8, &capacity_, sizeof(capacity_));
+    return true;
+#endif
+}
+
+bool UiEventRing::publish(std::string_view event, const nlohmann::json& data) {
+    if (!base_) {
+        return false;
+    }
+    record_.clear();
+    record_.push_back(0x82);                    // map of two
+    append_str(record_, "event");
+    append_str(record_, event);
+    append_str(record_, "data");
+    nlohmann::json::to_msgpack(data, record_);
+    if (record_.size() > capacity_ / 4) {
+        spdlog::debug("UI event {} ({} bytes) is too large for the ring", event, record_.size());
+        return false;
+    }
+
+    auto head = field<uint64_t>(base_, kHeadOffset);
+    auto reserve = field<uint64_t>(base_, kReserveOffset);
+    const uint64_t need = 8 + ((record_.size() + 7) & ~uint64_t{7});
+    uint64_t start = head.load(std::memory_order_relaxed);
+    const uint64_t pad_at = start & (capacity_ - 1);
+    const bool wrap = pad_at + need > capacity_;
+    if (wrap) {
+        start += capacity_ - pad_at;
+    }
+    const uint64_t end = start + need;
+
+    // As a seqlock writer: claim the bytes before touching them, so a
+    // reader that copied from under us sees it in `reserve`.
+    reserve.store(end, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    unsigned char* data_area = base_ + kDataOffset;
+    if (wrap) {
+        put_u32(data_area + pad_at, kPadding);
+    }
+    unsigned char* at = data_area + (start & (capacity_ - 1));
+    put_u32(at, static_cast<uint32_t>(record_.size()));
+    put_u32(at + 4, kEventRecord);
+    std::memcpy(at + 8, record_.data(), record_.size());
+    head.store(end, std::memory_order_release);
+
+    auto doorbell = field<uint32_t>(base_, kDoorbellOffset);
+    doorbell.fetch_add(1, std::memory_order_release);
+#if defined(__linux__)
+    ::syscall(SYS_futex, base_ + kDoorbellOffset, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    return true;
+}
@@ -0,0 +1,82 @@
+/**
+ * ui_listener — loopback TCP and Unix domain socket acceptors for the UI.
+ */
+
+#include "api/ui_listener.h"
+
+#include <filesystem>
+#include <system_error>
+
+#include <spdlog/spdlog.h>
+
+namespace ui_listener {
+
+void listen_tcp(Acceptor& acceptor, uint16_t port) {
+    const asio::generic::stream_protocol::endpoint endpoint(
+        asio::ip::tcp::endpoint(asio::ip::make_address("127.0.0.1"), port));
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(asio::socket_base::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
+
+bool listen_unix(Acceptor& acceptor, const std::string& path) {
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+    asio::local::stream_protocol::endpoint local;
+    try {
+        local = asio::local::stream_protocol::endpoint(path);
+    } catch (const std::system_error& e) {
+        spdlog::error("Can't listen on {}: {}", path, e.what());     // e.g. a path too long
+        return false;
+    }
+
+    std::error_code fs_ec;
+    if (std::filesystem::is_socket(path, fs_ec)) {
+        asio::local::stream_protocol::socket probe(acceptor.get_executor());
+        asio::error_code probe_ec;
+        probe.connect(local, probe_ec);
+        if (!probe_ec) {
+            spdlog::error("Can't listen on {}: another process is serving it", path);
+            return false;
+        }
+        std::filesystem::remove(path, fs_ec);   // stale, from a node that didn't shut down
+    }
+
+    const asio::generic::stream_protocol::endpoint endpoint(local);
+    asio::error_code ec;
+    acceptor.open(endpoint.protocol(), ec);
+    if (!ec) {
+        acceptor.bind(endpoint, ec);
+    }
+    const bool bound = !ec;                     // the file at `path` is now ours
+    if (bound) {
+        // Restrict the file before listen(): until then nobody can connect.
+        std::filesystem::permissions(path,
+                                     std::filesystem::perms::owner_read |
+                                         std::filesystem::perms::owner_write,
+                                     std::filesystem::perm_options::replace, fs_ec);
+        acceptor.listen(asio::socket_base::max_listen_connections, ec);
+    }
+    if (ec) {
+        spdlog::error("Can't listen on {}: {}", path, ec.message());
+        close(acceptor, bound ? path : std::string());
+        return false;
+    }
+    return true;
+#else
+    (void)acceptor;
+    spdlog::error("Can't listen on {}: this platform has no Unix domain sockets", path);
+    return false;
+#endif
+}
+
+void close(Acceptor& acceptor, const std::string& path) {
+    asio::error_code ec;
+    acceptor.close(ec);
+    if (!path.empty()) {
+        std::error_code fs_ec;
+        std::filesystem::remove(path, fs_ec);
+    }
+}
+
+} // namespace ui_listener
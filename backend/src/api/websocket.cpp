@@ -0,0 +1,204 @@
+/**
+ * WebSocket — RFC 6455 handshake key, frame encoding and decoding.
+ *
+ * SHA-1 is only used for the handshake's Sec-WebSocket-Accept, which the
+ * RFC mandates; libsodium doesn't ship it, so a compact implementation
+ * lives here.
+ */
+
+#include "api/websocket.h"
+#include "crypto/base64.h"
+
+#include <array>
+#include <cstring>
+
+#include <sodium.h>
+
+namespace {
+
+std::array<uint8_t, 20> sha1(std::string_view data) {
+    uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    auto rol = [](uint32_t v, int s) { return (v << s) | (v >> (32 - s)); };
+
+    std::string msg(data);
+    const uint64_t bit_len = static_cast<uint64_t>(data.size()) * 8;
+    msg += static_cast<char>(0x80);
+    while (msg.size() % 64 != 56) msg += '\0';
+    for (int i = 7; i >= 0; --i) msg += static_cast<char>((bit_len >> (i * 8)) & 0xFF);
+
+    for (std::size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const auto* p = reinterpret_cast<const uint8_t*>(msg.data() + chunk + i * 4);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        }
+        for (int i = 16; i < 80; ++i) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+            const uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(b, 30); b = a; a = t;
+        }
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    std::array<uint8_t, 20> out{};
+    for (int i = 0; i < 5; ++i) {
+        out[i * 4]     = static_cast<uint8_t>(h[i] >> 24);
+        out[i * 4 + 1] = static_cast<uint8_t>(h[i] >> 16);
+        out[i * 4 + 2] = static_cast<uint8_t>(h[i] >> 8);
+        out[i * 4 + 3] = static_cast<uint8_t>(h[i]);
+    }
+    return out;
+}
+
+bool is_control(websocket::Opcode op) {
+    return static_cast<uint8_t>(op) & 0x8;
+}
+
+/// A FIN frame; masked with `mask` when it is set (client frames).
+std::string encode(websocket::Opcode opcode, std::string_view payload, const uint8_t* mask) {
+    std::string out;
+    out.reserve(payload.size() + 14);
+    out += static_cast<char>(0x80 | static_cast<uint8_t>(opcode));
+    const char mask_bit = mask ? static_cast<char>(0x80) : 0;
+    const uint64_t n = payload.size();
+    if (n < 126) {
+        out += static_cast<char>(mask_bit | static_cast<char>(n));
+    } else if (n <= 0xFFFF) {
+        out += static_cast<char>(mask_bit | 126);
+        out += static_cast<char>((n >> 8) & 0xFF);
+        out += static_cast<char>(n & 0xFF);
+    } else {
+        out += static_cast<char>(mask_bit | 127);
+        for (int i = 7; i >= 0; --i) out += static_cast<char>((n >> (i * 8)) & 0xFF);
+    }
+    if (!mask) {
+        out.append(payload);
+        return out;
+    }
+    out.append(reinterpret_cast<const char*>(mask), 4);
+    const std::size_t start = out.size();
+    out.append(payload);
+    for (std::size_t i = 0; i < payload.size(); ++i) {
+        out[start + i] = static_cast<char>(out[start + i] ^ mask[i % 4]);
+    }
+    return out;
+}
+
+} // namespace
+
+namespace websocket {
+
+std::string accept_key(std::string_view client_key) {
+    std::string input(client_key);
+    input += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";   // RFC 6455 §1.3
+    const auto digest = sha1(input);
+    return base64::encode(std::span<const uint8_t>(digest));
+}
+
+std::string encode_frame(Opcode opcode, std::string_view payload) {
+    return encode(opcode, payload, nullptr);
+}
+
+std::string encode_client_frame(Opcode opcode, std::string_view payload) {
+    uint8_t mask[4];
+    randombytes_buf(mask, sizeof mask);
+    return encode(opcode, payload, mask);
+}
+
+std::string client_key() {
+    uint8_t nonce[16];
+    randombytes_buf(nonce, sizeof nonce);
+    return base64::encode(std::span<const uint8_t>(nonce));
+}
+
+std::string encode_close(uint16_t code) {
+    const char body[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)};
+    return encode_frame(Opcode::Close, std::string_view(body, 2));
+}
+
+FrameDecoder::Status FrameDecoder::next(Opcode& opcode, std::string& payload) {
+    for (;;) {
+        // Consumed bytes are dropped lazily, once they outweigh the rest.
+        if (read_pos_ > 0 && read_pos_ * 2 >= buffer_.size()) {
+            buffer_.erase(0, read_pos_);
+            read_pos_ = 0;
+        }
+        const auto* p = reinterpret_cast<const uint8_t*>(buffer_.data() + read_pos_);
+        const std::size_t avail = buffer_.size() - read_pos_;
+        if (avail < 2) {
+            return Status::NeedMore;
+        }
+
+        const bool fin = p[0] & 0x80;
+        const auto op = static_cast<Opcode>(p[0] & 0x0F);
+        const bool masked = p[1] & 0x80;
+        uint64_t len = p[1] & 0x7F;
+        std::size_t header = 2;
+        if ((p[0] & 0x70) || masked != masked_) { // no extensions; only clients mask
+            error_code_ = kCloseProtocolError;
+            return Status::Error;
+        }
+        if (len == 126) {
+            if (avail < 4) return Status::NeedMore;
+            len = (uint64_t(p[2]) << 8) | p[3];
+            header = 4;
+        } else if (len == 127) {
+            if (avail < 10) return Status::NeedMore;
+            len = 0;
+            for (int i = 0; i < 8; ++i) len = (len << 8) | p[2 + i];
+            header = 10;
+        }
+        if (is_control(op) && (!fin || len > 125)) {
+            error_code_ = kCloseProtocolError;
+            return Status::Error;
+        }
+        if (len + message_.size() > max_message_size_) {
+            error_code_ = kCloseTooBig;
+            return Status::Error;
+        }
+        const std::size_t mask_bytes = masked ? 4 : 0;
+        if (avail < header + mask_bytes + len) {
+            return Status::NeedMore;
+        }
+
+        const uint8_t* mask = p + header;
+        std::string data(reinterpret_cast<const char*>(mask + mask_bytes), static_cast<std::size_t>(len));
+        if (masked) {
+            for (std::size_t i = 0; i < data.size(); ++i) {
+                data[i] = static_cast<char>(data[i] ^ mask[i % 4]);
+            }
+        }
+        read_pos_ += header + mask_bytes + static_cast<std::size_t>(len);
+
+        if (is_control(op)) {
+            opcode = op;
+            payload = std::move(data);
+            return Status::Message;
+        }
+        if (op == Opcode::Continuation ? !in_message_ : in_message_) {
+            error_code_ = kCloseProtocolError;
+            return Status::Error;
+        }
+        if (op != Opcode::Continuation) {
+            message_opcode_ = op;
+            message_.clear();
+        }
+        message_ += data;
+        in_message_ = !fin;
+        if (fin) {
+            opcode = message_opcode_;
+            payload = std::move(message_);
+            message_.clear();
+            return Status::Message;
+        }
+    }
+}
+
+} // namespace websocket
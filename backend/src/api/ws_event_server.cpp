@@ -0,0 +1,420 @@
+/**
+ * WsEventServer — WebSocket push channel for the UI.
+ *
+ * A WsSession owns one upgraded connection: a coroutine reads the upgrade
+ * request (with the LocalAPI's HttpRequestReader) and then client frames,
+ * while outgoing frames go through a bounded queue drained by a callback
+ * write chain. Both run on the connection's strand, so the queue needs no
+ * lock. Broadcasts build the frame once and post the shared bytes to every
+ * session's strand. See protocol/websocket-events-guide.md for the events.
+ */
+
+#include "api/ws_event_server.h"
+#include "api/http_parser.h"
+#include "api/websocket.h"
+#include "network/handler_memory.h"
+#include "network/io_context_pool.h"
+#include "network/timer_wheel.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <deque>
+#include <optional>
+
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+/// How long a client may take to send its upgrade request.
+constexpr std::chrono::seconds kHandshakeTimeout{10};
+
+/// The value of `name` in a query string, undecoded; nullopt if absent.
+std::optional<std::string> query_value(std::string_view query, std::string_view name) {
+    while (!query.empty()) {
+        const std::size_t amp = query.find('&');
+        const std::string_view pair = query.substr(0, amp);
+        if (pair.size() > name.size() && pair.starts_with(name) && pair[name.size()] == '=') {
+            return std::string(pair.substr(name.size() + 1));
+        }
+        query = amp == std::string_view::npos ? std::string_view() : query.substr(amp + 1);
+    }
+    return std::nullopt;
+}
+
+std::string http_error(int status, std::string_view reason) {
+    std::string out = "HTTP/1.1 " + std::to_string(status) + " ";
+    out += reason;
+    out += "\r\nContent-Length: 0\r\nConnection: close\r\n";
+    if (status == 426) {
+        out += "Sec-WebSocket-Version: 13\r\n";
+    }
+    out += "\r\n";
+    return out;
+}
+
+} // namespace
+
+class WsSession : public std::enable_shared_from_this<WsSession> {
+public:
+    WsSession(WsEventServer& server, ui_listener::Socket socket)
+        : server_(server), socket_(std::move(socket)) {}
+    ~WsSession() { account(-static_cast<std::ptrdiff_t>(queued_bytes_)); }
+
+    asio::any_io_executor executor() { return socket_.get_executor(); }
+
+    /// Upgrade, then read client frames until the connection ends. Takes
+    /// the owning pointer so the coroutine frame keeps the session alive.
+    static asio::awaitable<void> run(std::shared_ptr<WsSession> self);
+
+    /// Queue a frame. Must be called on the session's strand.
+    void send(std::shared_ptr<const std::string> frame);
+
+    /// Drop the connection without a closing handshake.
+    void abort() {
+        asio::error_code ignored;
+        socket_.close(ignored);
+    }
+
+private:
+    /// Validate the upgrade request and answer it. Returns false (after
+    /// writing an error response) if the client is refused.
+    asio::awaitable<bool> handshake();
+
+    /// Decode client frames until the client closes or misbehaves.
+    asio::awaitable<void> read_loop();
+
+    /// Handle one decoded message or control frame; false ends the session.
+    bool on_message(websocket::Opcode opcode, const std::string& payload);
+
+    /// Send a close frame, then close the socket once the queue is flushed.
+    void close(uint16_t code);
+
+    void write_next();
+
+    /// Grow or shrink queued_bytes_, and the server's backpressure level.
+    void account(std::ptrdiff_t bytes) {
+        queued_bytes_ += static_cast<std::size_t>(bytes);
+        if (server_.backlog_) {
+            server_.backlog_->add(bytes);
+        }
+    }
+
+    WsEventServer& server_;
+    ui_listener::Socket socket_;
+
+    std::deque<std::shared_ptr<const std::string>> queue_;
+    std::size_t queued_bytes_ = 0;
+    bool writing_ = false;
+    bool closing_ = false;
+    HandlerMemory write_memory_;                // the write in flight
+    std::optional<std::string> resume_;         // ?cursor= of the upgrade request
+};
+
+asio::awaitable<void> WsSession::run(std::shared_ptr<WsSession> self) {
+    const bool upgraded = co_await self->handshake();
+    if (upgraded) {
+        if (auto sync = self->server_.add(self, self->resume_)) {
+            self->send(std::move(sync));        // ahead of any live event: we're on the strand
+        }
+        co_await self->read_loop();
+        self->server_.remove(self);
+    }
+
+    // With a close frame still queued, write_next() closes the socket.
+    if (!self->writing_) {
+        self->abort();
+    }
+}
+
+asio::awaitable<void> WsSession::read_loop() {
+    websocket::FrameDecoder decoder;
+    std::array<char, 4096> buf;
+    websocket::Opcode opcode;
+    std::string payload;
+    asio::error_code ec;
+    for (;;) {
+        const std::size_t n = co_await socket_.async_read_some(
+            asio::buffer(buf), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            co_return;
+        }
+        decoder.feed(buf.data(), n);
+        for (;;) {
+            const auto status = decoder.next(opcode, payload);
+            if (status == websocket::FrameDecoder::Status::NeedMore) {
+                break;
+            }
+            if (status == websocket::FrameDecoder::Status::Error) {
+                close(decoder.error_code());
+                co_return;
+            }
+            if (!on_message(opcode, payload)) {
+                co_return;
+            }
+        }
+    }
+}
+
+asio::awaitable<bool> WsSession::handshake() {
+    auto self = shared_from_this();
+    // On the context's timer wheel, which runs it off the strand.
+    TimerWheel& wheel = TimerWheel::of(executor());
+    const auto deadline = wheel.schedule(kHandshakeTimeout, [self] {
+        asio::post(self->executor(), [self] { self->abort(); });
+    });
+
+    HttpRequestReader reader(0, 8 * 1024);
+    HttpRequest req;
+    asio::error_code ec;
+    HttpRequestReader::Status status;
+    while ((status = reader.next(req)) == HttpRequestReader::Status::NeedMore) {
+        auto span = reader.prepare();
+        const std::size_t n = co_await socket_.async_read_some(
+            asio::buffer(span.data(), span.size()), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            wheel.cancel(deadline);
+            co_return false;
+        }
+        reader.commit(n);
+    }
+    wheel.cancel(deadline);
+
+    std::string response;
+    if (status != HttpRequestReader::Status::Request) {
+        response = http_error(400, "Bad Request");
+    } else if (req.method != "GET" || req.path != "/events") {
+        response = http_error(404, "Not Found");
+    } else if (!req.upgrade_websocket || req.websocket_key.empty()) {
+        response = http_error(400, "Bad Request");
+    } else if (req.websocket_version != "13") {
+        response = http_error(426, "Upgrade Required");
+    } else if (!server_.origin_allowed(req.origin)) {
+        // A web page the user happens to visit can open ws://127.0.0.1
+        // too; only the UI's own origins may subscribe to their messages.
+        spdlog::warn("WebSocket upgrade from origin '{}' refused", req.origin);
+        response = http_error(403, "Forbidden");
+    }
+
+    const bool accepted = response.empty();
+    if (accepted) {
+        resume_ = query_value(req.query, "cursor");
+        response = "HTTP/1.1 101 Switching Protocols\r\n"
+                   "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: " + websocket::accept_key(req.websocket_key) +
+                   "\r\n\r\n";
+    }
+    co_await asio::async_write(socket_, asio::buffer(response),
+                               asio::redirect_error(asio::use_awaitable, ec));
+    co_return accepted && !ec;
+}
+
+bool WsSession::on_message(websocket::Opcode opcode, const std::string& payload) {
+    switch (opcode) {
+    case websocket::Opcode::Ping:
+        send(std::make_shared<const std::string>(
+            websocket::encode_frame(websocket::Opcode::Pong, payload)));
+        return true;
+    case websocket::Opcode::Pong:
+        return true;
+    case websocket::Opcode::Close:
+        close(websocket::kCloseNormal);
+        return false;
+    case websocket::Opcode::Text: {
+        auto event = json::parse(payload, nullptr, false);
+        if (event.is_object() && event.contains("event") && event["event"].is_string()) {
+            if (server_.on_client_event_) {
+                server_.on_client_event_(event);
+            }
+        } else {
+            spdlog::debug("Ignoring malformed WebSocket message");
+        }
+        return true;
+    }
+    default:
+        return true;                    // binary frames carry nothing we use
+    }
+}
+
+void WsSession::send(std::shared_ptr<const std::string> frame) {
+    if (closing_) {
+        return;
+    }
+    if (queue_.size() >= WsEventServer::kMaxQueuedFrames ||
+        queued_bytes_ + frame->size() > WsEventServer::kMaxQueuedBytes) {
+        spdlog::warn("WebSocket client is not keeping up; disconnecting it");
+        closing_ = true;
+        abort();
+        return;
+    }
+    account(static_cast<std::ptrdiff_t>(frame->size()));
+    queue_.push_back(std::move(frame));
+    if (!writing_) {
+        write_next();
+    }
+}
+
+void WsSession::close(uint16_t code) {
+    if (closing_) {
+        return;
+    }
+    auto frame = std::make_shared<const std::string>(websocket::encode_close(code));
+    account(static_cast<std::ptrdiff_t>(frame->size()));
+    queue_.push_back(std::move(frame));
+    closing_ = true;
+    if (!writing_) {
+        write_next();
+    }
+}
+
+void WsSession::write_next() {
+    if (queue_.empty()) {
+        writing_ = false;
+        if (closing_) {
+            abort();
+        }
+        return;
+    }
+    writing_ = true;
+    asio::async_write(socket_, asio::buffer(*queue_.front()), bind_handler_memory(write_memory_,
+                      [self = shared_from_this()](const asio::error_code& ec, std::size_t) {
+        self->account(-static_cast<std::ptrdiff_t>(self->queue_.front()->size()));
+        self->queue_.pop_front();
+        if (ec) {
+            self->closing_ = true;
+            self->queue_.clear();
+            self->account(-static_cast<std::ptrdiff_t>(self->queued_bytes_));
+            self->writing_ = false;
+            self->abort();
+            return;
+        }
+        self->write_next();
+    }));
+}
+
+WsEventServer::WsEventServer(IoContextPool& pool, uint16_t port,
+                             std::vector<std::string> allowed_origins)
+    : pool_(pool),
+      acceptor_(pool.main()),
+      unix_acceptor_(pool.main()),
+      allowed_origins_(std::move(allowed_origins)) {
+    if (port != 0) {
+        ui_listener::listen_tcp(acceptor_, port);
+    }
+}
+
+WsEventServer::~WsEventServer() = default;
+
+bool WsEventServer::listen_unix(const std::string& path) {
+    if (!ui_listener::listen_unix(unix_acceptor_, path)) {
+        return false;
+    }
+    unix_path_ = path;
+    return true;
+}
+
+void WsEventServer::set_backpressure(Backpressure& backpressure) {
+    backlog_ = &backpressure.level("ws_send_bytes", kMaxQueuedBytes / 2, kMaxQueuedBytes / 8);
+}
+
+void WsEventServer::start() {
+    for (auto* acceptor : {&acceptor_, &unix_acceptor_}) {
+        if (acceptor->is_open()) {
+            asio::co_spawn(acceptor->get_executor(), accept_loop(*acceptor), asio::detached);
+        }
+    }
+}
+
+void WsEventServer::stop() {
+    ui_listener::close(acceptor_, "");
+    ui_listener::close(unix_acceptor_, unix_path_);
+
+    std::lock_guard lock(mutex_);
+    for (const auto& session : sessions_) {
+        asio::post(session->executor(), [session] { session->abort(); });
+    }
+}
+
+void WsEventServer::set_on_client_event(ClientEventCallback cb) {
+    on_client_event_ = std::move(cb);
+}
+
+std::size_t WsEventServer::client_count() const {
+    std::lock_guard lock(mutex_);
+    return sessions_.size();
+}
+
+void WsEventServer::set_sync_bytes(std::size_t bytes) {
+    std::lock_guard lock(mutex_);
+    journal_.set_max_bytes(bytes);
+}
+
+void WsEventServer::broadcast(std::string_view event, const json& data) {
+    std::vector<std::shared_ptr<WsSession>> targets;
+    std::shared_ptr<const std::string> message;
+    {
+        // Journaled under the lock that add() takes, so a client resuming
+        // from a cursor gets each event once: in its sync batch or live.
+        std::lock_guard lock(mutex_);
+        message = journal_.append(event, data);
+        if (sessions_.empty()) {
+            return;
+        }
+        targets.assign(sessions_.begin(), sessions_.end());
+    }
+
+    auto frame = std::make_shared<const std::string>(
+        websocket::encode_frame(websocket::Opcode::Text, *message));
+    for (auto& session : targets) {
+        auto ex = session->executor();
+        asio::post(ex, [session = std::move(session), frame] { session->send(frame); });
+    }
+}
+
+bool WsEventServer::origin_allowed(const std::string& origin) const {
+    return origin.empty() ||
+           std::find(allowed_origins_.begin(), allowed_origins_.end(), origin) !=
+               allowed_origins_.end();
+}
+
+std::string WsEventServer::sync(std::string_view cursor) const {
+    std::lock_guard lock(mutex_);
+    return journal_.batch(cursor);
+}
+
+std::shared_ptr<const std::string> WsEventServer::add(const std::shared_ptr<WsSession>& session,
+                                                      const std::optional<std::string>& resume) {
+    std::lock_guard lock(mutex_);
+    sessions_.insert(session);
+    if (!resume) {
+        return nullptr;
+    }
+    return std::make_shared<const std::string>(websocket::encode_frame(
+        websocket::Opcode::Text, "{\"data\":" + journal_.batch(*resume) + ",\"event\":\"sync\"}"));
+}
+
+void WsEventServer::remove(const std::shared_ptr<WsSession>& session) {
+    std::lock_guard lock(mutex_);
+    sessions_.erase(session);
+}
+
+asio::awaitable<void> WsEventServer::accept_loop(ui_listener::Acceptor& acceptor) {
+    for (;;) {
+        asio::error_code ec;
+        ui_listener::Socket socket = co_await acceptor.async_accept(
+            asio::make_strand(pool_.next()), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec == asio::error::operation_aborted || !acceptor.is_open()) {
+                co_return;
+            }
+            spdlog::warn("WebSocket accept failed: {}", ec.message());
+            continue;
+        }
+        auto session = std::make_shared<WsSession>(*this, std::move(socket));
+        auto ex = session->executor();
+        asio::co_spawn(ex, WsSession::run(std::move(session)), asio::detached);
+    }
+}
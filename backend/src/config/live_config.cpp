@@ -0,0 +1,199 @@
+/**
+ * LiveConfig — file watching and versioned reloads.
+ */
+
+#include "config/live_config.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr auto kPollInterval = std::chrono::milliseconds(500);
+// Editors save in several steps (truncate, write, rename); reload once
+// the file has been quiet this long.
+constexpr auto kSettle = std::chrono::milliseconds(200);
+
+} // namespace
+
+LiveConfig::LiveConfig(std::string path, json initial)
+    : path_(std::move(path)), config_(std::move(initial)) {}
+
+LiveConfig::~LiveConfig() {
+    stop();
+}
+
+std::optional<json> LiveConfig::load(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        spdlog::error("Cannot open config file: {}", path);
+        return std::nullopt;
+    }
+    json config = json::parse(file, nullptr, false);
+    if (config.is_discarded() || !config.is_object()) {
+        spdlog::error("Config file {} is not a valid JSON object", path);
+        return std::nullopt;
+    }
+    return config;
+}
+
+std::vector<std::string> LiveConfig::changed_keys(const json& now, const json& before) {
+    std::vector<std::string> keys;
+    auto compare = [&](const std::string& section, const json& a, const json& b) {
+        for (const auto& [key, value] : a.items()) {
+            if (!b.contains(key) || b[key] != value) {
+                keys.push_back(section + "." + key);
+            }
+        }
+        for (const auto& [key, value] : b.items()) {
+            if (!a.contains(key)) {
+                keys.push_back(section + "." + key);
+            }
+        }
+    };
+    const json empty = json::object();
+    for (const auto& [section, value] : now.items()) {
+        const json& old = before.contains(section) ? before[section] : empty;
+        if (value.is_object() && old.is_object()) {
+            compare(section, value, old);
+        } else if (value != old) {
+            keys.push_back(section);
+        }
+    }
+    for (const auto& [section, value] : before.items()) {
+        if (!now.contains(section)) {
+            keys.push_back(section);
+        }
+    }
+    return keys;
+}
+
+void LiveConfig::on_change(Listener listener) {
+    listeners_.push_back(std::move(listener));
+}
+
+void LiveConfig::start() {
+    if (thread_.joinable()) {
+        return;
+    }
+    stopping_ = false;
+    thread_ = std::thread([this] { watch(); });
+}
+
+void LiveConfig::stop() {
+    stopping_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool LiveConfig::reload() {
+    std::lock_guard lock(reload_mutex_);
+    auto next = load(path_);
+    if (!next) {
+        spdlog::warn("Keeping config version {}", version());
+        return false;
+    }
+    const json& before = current();
+    if (*next == before) {
+        return false;
+    }
+    config_.publish(std::move(*next));
+    const json& now = current();
+    spdlog::info("Config {} reloaded (version {})", path_, version());
+    for (const auto& listener : listeners_) {
+        listener(now, before);
+    }
+    return true;
+}
+
+void LiveConfig::watch() {
+    namespace fs = std::filesystem;
+    const fs::path file = fs::absolute(path_);
+    using Clock = std::chrono::steady_clock;
+    std::optional<Clock::time_point> due;     // reload after the writes settle
+
+#if defined(__linux__)
+    // Watch the directory: editors often replace the file by renaming a
+    // new one over it, which a watch on the file itself would miss.
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0 || inotify_add_watch(fd, file.parent_path().c_str(),
+                                    IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        spdlog::warn("Cannot watch {}; config changes need a restart", path_);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    const std::string name = file.filename().string();
+    alignas(inotify_event) char buf[4096];
+    while (!stopping_) {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, static_cast<int>(kPollInterval.count())) > 0) {
+            ssize_t n;
+            while ((n = read(fd, buf, sizeof(buf))) > 0) {
+                for (char* p = buf; p < buf + n;) {
+                    const auto* ev = reinterpret_cast<const inotify_event*>(p);
+                    if (ev->len && name == ev->name) {
+                        due = Clock::now() + kSettle;
+                    }
+                    p += sizeof(inotify_event) + ev->len;
+                }
+            }
+        }
+        if (due && Clock::now() >= *due) {
+            due.reset();
+            reload();
+        }
+    }
+    close(fd);
+#elif defined(_WIN32)
+    HANDLE change = FindFirstChangeNotificationW(
+        file.parent_path().c_str(), FALSE,
+        FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+    if (change == INVALID_HANDLE_VALUE) {
+        spdlog::warn("Cannot watch {}; config changes need a restart", path_);
+        return;
+    }
+    while (!stopping_) {
+        // Notifications are per directory; reload() ignores unchanged content.
+        if (WaitForSingleObject(change, static_cast<DWORD>(kPollInterval.count())) == WAIT_OBJECT_0) {
+            due = Clock::now() + kSettle;
+            FindNextChangeNotification(change);
+        }
+        if (due && Clock::now() >= *due) {
+            due.reset();
+            reload();
+        }
+    }
+    FindCloseChangeNotification(change);
+#else
+    std::error_code ec;
+    auto seen = fs::last_write_time(file, ec);
+    while (!stopping_) {
+        std::this_thread::sleep_for(kPollInterval);
+        const auto mtime = fs::last_write_time(file, ec);
+        if (!ec && mtime != seen) {
+            seen = mtime;
+            due = Clock::now() + kSettle;
+        }
+        if (due && Clock::now() >= *due) {
+            due.reset();
+            reload();
+        }
+    }
+#endif
+}
@@ -4,16 +4,747 @@
  * - X25519 key exchange (crypto_box)
  * - Ed25519 signing / verification
  * - Key generation and persistence
+ * - Per-peer precomputed shared keys (crypto_box_beforenm)
  */
 
 #include "crypto/crypto_manager.h"
+#include "crypto/base64.h"
+#include "crypto/key_rotation.h"
+#include "crypto/nonce_source.h"
+#include "telemetry/metrics.h"
 
-// TODO: Implement
-// - CryptoManager::init()                     — call sodium_init()
-// - CryptoManager::generate_keypair()         — X25519 + Ed25519
-// - CryptoManager::load_keypair(path)         — from local file
-// - CryptoManager::save_keypair(path)         — to local file
-// - CryptoManager::encrypt(plaintext, peer_pk) — sealed box or crypto_box
-// - CryptoManager::decrypt(ciphertext, peer_pk)
-// - CryptoManager::sign(message)              — Ed25519
-// - CryptoManager::verify(message, sig, pk)   — Ed25519
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+#include <nlohmann/json.hpp>
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+metrics::Histogram& verify_seconds =
+    metrics::histogram("p2p_verify_seconds", "Signature check of a received message");
+metrics::Histogram& decrypt_seconds =
+    metrics::histogram("p2p_decrypt_seconds", "Decryption of a received message, shared key included");
+
+constexpr std::size_t kSharedKeyBytes = crypto_box_BEFORENMBYTES;
+constexpr std::size_t kWrappedKeyBytes = crypto_secretbox_KEYBYTES + crypto_box_MACBYTES;   // 48
+
+// Keystore layout; see save_keystore() in the header.
+constexpr char kKeystoreMagic[4] = {'P', '2', 'P', 'K'};
+constexpr uint32_t kKeystoreVersion = 1;
+constexpr std::size_t kNodeIdChars = 32;
+constexpr std::size_t kBoxPkAt = 8;
+constexpr std::size_t kBoxSkAt = kBoxPkAt + crypto_box_PUBLICKEYBYTES;
+constexpr std::size_t kSignPkAt = kBoxSkAt + crypto_box_SECRETKEYBYTES;
+constexpr std::size_t kSignSkAt = kSignPkAt + crypto_sign_PUBLICKEYBYTES;
+constexpr std::size_t kNodeIdAt = kSignSkAt + crypto_sign_SECRETKEYBYTES;
+constexpr std::size_t kChecksumAt = kNodeIdAt + kNodeIdChars;
+constexpr std::size_t kKeystoreBytes = kChecksumAt + 16;
+static_assert(kChecksumAt == 200);
+
+using KeystoreRecord = std::array<uint8_t, kKeystoreBytes>;
+
+void keystore_checksum(const KeystoreRecord& record, uint8_t* out) {
+    crypto_generichash(out, kKeystoreBytes - kChecksumAt, record.data(), kChecksumAt, nullptr, 0);
+}
+
+// Retired key record; see save_retired() in the header.
+constexpr char kRetiredMagic[4] = {'P', '2', 'P', 'R'};
+constexpr uint32_t kRetiredVersion = 1;
+constexpr std::size_t kRetiredPkAt = 8;
+constexpr std::size_t kRetiredSkAt = kRetiredPkAt + crypto_box_PUBLICKEYBYTES;
+constexpr std::size_t kRetiredUntilAt = kRetiredSkAt + crypto_box_SECRETKEYBYTES;
+constexpr std::size_t kRetiredUpdateAt = kRetiredUntilAt + 8;
+constexpr std::size_t kRetiredUpdateBytes = key_rotation::kBodySize + crypto_sign_BYTES;
+constexpr std::size_t kRetiredChecksumAt = kRetiredUpdateAt + kRetiredUpdateBytes;
+constexpr std::size_t kRetiredBytes = kRetiredChecksumAt + 16;
+static_assert(kRetiredChecksumAt == 281);
+
+using RetiredRecord = std::array<uint8_t, kRetiredBytes>;
+
+void retired_checksum(const RetiredRecord& record, uint8_t* out) {
+    crypto_generichash(out, kRetiredBytes - kRetiredChecksumAt, record.data(), kRetiredChecksumAt,
+                       nullptr, 0);
+}
+
+/// Write `bytes` to `path` through a temporary file that is created
+/// owner-only before any secret goes into it, then renamed into place.
+bool write_private(const std::string& path, std::span<const uint8_t> bytes) {
+    const std::string tmp = path + ".tmp";
+    std::error_code ec;
+    bool ok = false;
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        std::filesystem::permissions(tmp,
+                                     std::filesystem::perms::owner_read |
+                                         std::filesystem::perms::owner_write,
+                                     std::filesystem::perm_options::replace, ec);
+        if (out && !ec) {
+            out.write(reinterpret_cast<const char*>(bytes.data()),
+                      static_cast<std::streamsize>(bytes.size()));
+            ok = static_cast<bool>(out.flush());
+        }
+    }
+    if (ok) {
+        std::filesystem::rename(tmp, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        std::filesystem::remove(tmp, ec);
+    }
+    return ok;
+}
+
+std::size_t arena_size(std::size_t cache_capacity) {
+    const std::size_t parts[] = {crypto_box_SECRETKEYBYTES, crypto_sign_SECRETKEYBYTES,
+                                 cache_capacity * kSharedKeyBytes, crypto_box_SECRETKEYBYTES};
+    return SecureArena::size_for(parts);
+}
+
+/// Run fn(0) .. fn(count - 1) on up to `threads` threads (0 = `spread` if
+/// set, else hardware concurrency), the calling thread included.
+template <typename Fn>
+void parallel_for(std::size_t count, std::size_t threads, const CryptoManager::Spread& spread,
+                  Fn fn) {
+    if (threads == 0 && spread) {
+        spread(count, std::function<void(std::size_t)>(std::ref(fn)));
+        return;
+    }
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // Below ~32 items per worker the thread start-up costs more than it saves.
+    constexpr std::size_t kMinPerWorker = 32;
+    threads = std::min(threads, std::max<std::size_t>(1, count / kMinPerWorker));
+
+    // Workers pull small chunks from a shared cursor so one slow item
+    // (e.g. a shared-key cache miss) doesn't stall a fixed partition.
+    constexpr std::size_t kChunk = 8;
+    std::atomic<std::size_t> cursor{0};
+    auto worker = [&] {
+        for (;;) {
+            const std::size_t begin = cursor.fetch_add(kChunk, std::memory_order_relaxed);
+            if (begin >= count) {
+                return;
+            }
+            const std::size_t end = std::min(begin + kChunk, count);
+            for (std::size_t i = begin; i < end; ++i) {
+                fn(i);
+            }
+        }
+    };
+
+    std::vector<std::jthread> pool;
+    pool.reserve(threads - 1);
+    for (std::size_t i = 1; i < threads; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+}
+
+} // namespace
+
+CryptoManager::CryptoManager(std::size_t shared_key_cache_size)
+    : cache_capacity_(shared_key_cache_size),
+      arena_(arena_size(shared_key_cache_size)),
+      secret_key_(arena_.take(crypto_box_SECRETKEYBYTES)),
+      signing_secret_key_(arena_.take(crypto_sign_SECRETKEYBYTES)),
+      shared_keys_(arena_.take(shared_key_cache_size * kSharedKeyBytes)),
+      retired_secret_key_(arena_.take(crypto_box_SECRETKEYBYTES)) {
+    // Hand out low slots first, so a small cache stays on few cache lines.
+    for (std::size_t slot = cache_capacity_; slot-- > 0;) {
+        free_slots_.push_back(slot);
+    }
+}
+
+CryptoManager::~CryptoManager() {
+    memory::charge(memory::Area::CryptoCache,
+                   -static_cast<int64_t>(cache_lru_.size() * kCachedKeyBytes));
+}
+
+bool CryptoManager::init() {
+    if (sodium_init() < 0) {
+        spdlog::critical("libsodium failed to initialise");
+        return false;
+    }
+    return true;
+}
+
+void CryptoManager::clear_shared_keys() const {
+    std::lock_guard lock(cache_mutex_);
+    sodium_memzero(shared_keys_.data(), shared_keys_.size());
+    for (const auto& entry : cache_lru_) {
+        free_slots_.push_back(entry.slot);
+    }
+    memory::charge(memory::Area::CryptoCache,
+                   -static_cast<int64_t>(cache_lru_.size() * kCachedKeyBytes));
+    cache_lru_.clear();
+    cache_index_.clear();
+}
+
+void CryptoManager::evict_lru_locked() const {
+    auto& victim = cache_lru_.back();
+    sodium_memzero(shared_keys_.data() + victim.slot * kSharedKeyBytes, kSharedKeyBytes);
+    free_slots_.push_back(victim.slot);
+    cache_index_.erase(victim.peer);
+    cache_lru_.pop_back();
+    memory::charge(memory::Area::CryptoCache, -static_cast<int64_t>(kCachedKeyBytes));
+}
+
+void CryptoManager::shrink(std::size_t bytes) const {
+    std::lock_guard lock(cache_mutex_);
+    for (std::size_t freed = 0; freed < bytes && !cache_lru_.empty(); freed += kCachedKeyBytes) {
+        evict_lru_locked();
+    }
+}
+
+std::size_t CryptoManager::shared_key_cache_size() const {
+    std::lock_guard lock(cache_mutex_);
+    return cache_lru_.size();
+}
+
+std::vector<std::vector<uint8_t>> CryptoManager::cached_peers() const {
+    std::lock_guard lock(cache_mutex_);
+    std::vector<std::vector<uint8_t>> peers;
+    peers.reserve(cache_lru_.size());
+    for (const auto& entry : cache_lru_) {
+        peers.emplace_back(entry.peer.begin(), entry.peer.end());
+    }
+    return peers;
+}
+
+void CryptoManager::warm_shared_keys(const std::vector<std::vector<uint8_t>>& peers) const {
+    // Least recently used first, so the cache ends up in the saved order.
+    SharedKey key;
+    for (auto it = peers.rbegin(); it != peers.rend(); ++it) {
+        shared_key(*it, key);
+    }
+    sodium_memzero(key.data(), key.size());
+}
+
+bool CryptoManager::shared_key(std::span<const uint8_t> peer_public_key, SharedKey& out) const {
+    if (peer_public_key.size() != crypto_box_PUBLICKEYBYTES || !has_keys_) {
+        return false;
+    }
+    std::string peer(reinterpret_cast<const char*>(peer_public_key.data()), peer_public_key.size());
+
+    {
+        std::lock_guard lock(cache_mutex_);
+        auto it = cache_index_.find(peer);
+        if (it != cache_index_.end()) {
+            cache_lru_.splice(cache_lru_.begin(), cache_lru_, it->second);
+            std::copy_n(shared_keys_.data() + it->second->slot * kSharedKeyBytes, kSharedKeyBytes,
+                        out.begin());
+            return true;
+        }
+    }
+
+    // Compute outside the lock; a racing miss for the same peer just does
+    // the work twice and keeps one result.
+    if (crypto_box_beforenm(out.data(), peer_public_key.data(), secret_key_.data()) != 0) {
+        return false;   // low-order / all-zero public key
+    }
+    if (cache_capacity_ == 0) {
+        return true;
+    }
+
+    std::lock_guard lock(cache_mutex_);
+    if (cache_index_.count(peer)) {
+        return true;
+    }
+    if (free_slots_.empty()) {
+        evict_lru_locked();
+    }
+    const std::size_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    std::copy(out.begin(), out.end(), shared_keys_.data() + slot * kSharedKeyBytes);
+    cache_lru_.push_front(CachedKey{peer, slot});
+    cache_index_.emplace(std::move(peer), cache_lru_.begin());
+    memory::charge(memory::Area::CryptoCache, static_cast<int64_t>(kCachedKeyBytes));
+    return true;
+}
+
+void CryptoManager::generate_keypair() {
+    clear_shared_keys();
+    public_key_.resize(crypto_box_PUBLICKEYBYTES);
+    crypto_box_keypair(public_key_.data(), secret_key_.data());
+
+    signing_public_key_.resize(crypto_sign_PUBLICKEYBYTES);
+    crypto_sign_keypair(signing_public_key_.data(), signing_secret_key_.data());
+    has_keys_ = true;
+}
+
+void CryptoManager::derive_keypair(std::string_view seed) {
+    // One master key from the seed, then an independent subkey per key
+    // pair, so the X25519 and Ed25519 secrets don't share a seed.
+    uint8_t master[crypto_kdf_KEYBYTES];
+    uint8_t box_seed[crypto_box_SEEDBYTES];
+    uint8_t sign_seed[crypto_sign_SEEDBYTES];
+    static_assert(sizeof(box_seed) == crypto_kdf_KEYBYTES && sizeof(sign_seed) == crypto_kdf_KEYBYTES);
+    crypto_generichash(master, sizeof(master), reinterpret_cast<const uint8_t*>(seed.data()),
+                       seed.size(), nullptr, 0);
+    crypto_kdf_derive_from_key(box_seed, sizeof(box_seed), 1, "p2pkeys_", master);
+    crypto_kdf_derive_from_key(sign_seed, sizeof(sign_seed), 2, "p2pkeys_", master);
+
+    clear_shared_keys();
+    public_key_.resize(crypto_box_PUBLICKEYBYTES);
+    crypto_box_seed_keypair(public_key_.data(), secret_key_.data(), box_seed);
+    signing_public_key_.resize(crypto_sign_PUBLICKEYBYTES);
+    crypto_sign_seed_keypair(signing_public_key_.data(), signing_secret_key_.data(), sign_seed);
+    has_keys_ = true;
+
+    sodium_memzero(master, sizeof(master));
+    sodium_memzero(box_seed, sizeof(box_seed));
+    sodium_memzero(sign_seed, sizeof(sign_seed));
+}
+
+std::string CryptoManager::derived_node_id() const {
+    uint8_t hash[kNodeIdChars / 2];
+    crypto_generichash(hash, sizeof(hash), signing_public_key_.data(), signing_public_key_.size(),
+                       nullptr, 0);
+    std::string hex(kNodeIdChars + 1, '\0');
+    sodium_bin2hex(hex.data(), hex.size(), hash, sizeof(hash));
+    hex.pop_back();
+    return hex;
+}
+
+void CryptoManager::save_keypair(const std::string& path) const {
+    const json j = {
+        {"public_key", base64::encode(public_key_)},
+        {"secret_key", base64::encode(std::span<const uint8_t>(secret_key_))},
+        {"signing_public_key", base64::encode(signing_public_key_)},
+        {"signing_secret_key", base64::encode(std::span<const uint8_t>(signing_secret_key_))},
+    };
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        spdlog::error("Cannot write key file {}", path);
+        return;
+    }
+    out << j.dump(4) << '\n';
+}
+
+bool CryptoManager::load_keypair(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    try {
+        const json j = json::parse(in);
+        std::vector<uint8_t> pk, sk, spk, ssk;
+        // The decoded secrets pass through the heap once; wipe them as soon
+        // as they are in the arena.
+        auto wipe = [&] {
+            sodium_memzero(sk.data(), sk.size());
+            sodium_memzero(ssk.data(), ssk.size());
+        };
+        if (!base64::decode(j.at("public_key").get<std::string>(), pk) ||
+            !base64::decode(j.at("secret_key").get<std::string>(), sk) ||
+            !base64::decode(j.at("signing_public_key").get<std::string>(), spk) ||
+            !base64::decode(j.at("signing_secret_key").get<std::string>(), ssk) ||
+            pk.size() != crypto_box_PUBLICKEYBYTES || sk.size() != crypto_box_SECRETKEYBYTES ||
+            spk.size() != crypto_sign_PUBLICKEYBYTES || ssk.size() != crypto_sign_SECRETKEYBYTES) {
+            wipe();
+            spdlog::error("Key file {} is malformed", path);
+            return false;
+        }
+        clear_shared_keys();
+        public_key_ = std::move(pk);
+        signing_public_key_ = std::move(spk);
+        std::copy(sk.begin(), sk.end(), secret_key_.begin());
+        std::copy(ssk.begin(), ssk.end(), signing_secret_key_.begin());
+        wipe();
+        has_keys_ = true;
+        return true;
+    } catch (const json::exception& e) {
+        spdlog::error("Key file {} is not valid JSON: {}", path, e.what());
+        return false;
+    }
+}
+
+bool CryptoManager::save_keystore(const std::string& path, std::string_view node_id) const {
+    if (!has_keys_ || node_id.size() != kNodeIdChars) {
+        spdlog::error("Not writing keystore {}: no keys, or a node id that isn't {} characters",
+                      path, kNodeIdChars);
+        return false;
+    }
+    KeystoreRecord record{};
+    std::memcpy(record.data(), kKeystoreMagic, sizeof(kKeystoreMagic));
+    std::memcpy(record.data() + 4, &kKeystoreVersion, sizeof(kKeystoreVersion));   // little-endian
+    std::copy(public_key_.begin(), public_key_.end(), record.begin() + kBoxPkAt);
+    std::copy(secret_key_.begin(), secret_key_.end(), record.begin() + kBoxSkAt);
+    std::copy(signing_public_key_.begin(), signing_public_key_.end(), record.begin() + kSignPkAt);
+    std::copy(signing_secret_key_.begin(), signing_secret_key_.end(), record.begin() + kSignSkAt);
+    std::copy(node_id.begin(), node_id.end(), record.begin() + kNodeIdAt);
+    keystore_checksum(record, record.data() + kChecksumAt);
+
+    const bool ok = write_private(path, record);
+    sodium_memzero(record.data(), record.size());
+    if (!ok) {
+        spdlog::error("Cannot write keystore {}", path);
+    }
+    return ok;
+}
+
+bool CryptoManager::load_keystore(const std::string& path, std::string& node_id) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        return false;
+    }
+    KeystoreRecord record{};
+    in.read(reinterpret_cast<char*>(record.data()), record.size());
+    const bool complete = in.gcount() == static_cast<std::streamsize>(record.size()) &&
+                          in.peek() == std::ifstream::traits_type::eof();
+    uint32_t version = 0;
+    std::memcpy(&version, record.data() + 4, sizeof(version));
+    uint8_t checksum[kKeystoreBytes - kChecksumAt];
+    keystore_checksum(record, checksum);
+    // An Ed25519 secret key ends with its public key: a cheap check that
+    // the halves belong together.
+    const bool ok = complete &&
+                    std::memcmp(record.data(), kKeystoreMagic, sizeof(kKeystoreMagic)) == 0 &&
+                    version == kKeystoreVersion &&
+                    sodium_memcmp(checksum, record.data() + kChecksumAt, sizeof(checksum)) == 0 &&
+                    std::memcmp(record.data() + kSignSkAt + 32, record.data() + kSignPkAt,
+                                crypto_sign_PUBLICKEYBYTES) == 0;
+    if (!ok) {
+        sodium_memzero(record.data(), record.size());
+        spdlog::error("Keystore {} is damaged or from another version", path);
+        return false;
+    }
+
+    clear_shared_keys();
+    public_key_.assign(record.begin() + kBoxPkAt, record.begin() + kBoxSkAt);
+    std::copy(record.begin() + kBoxSkAt, record.begin() + kSignPkAt, secret_key_.begin());
+    signing_public_key_.assign(record.begin() + kSignPkAt, record.begin() + kSignSkAt);
+    std::copy(record.begin() + kSignSkAt, record.begin() + kNodeIdAt, signing_secret_key_.begin());
+    node_id.assign(reinterpret_cast<const char*>(record.data()) + kNodeIdAt, kNodeIdChars);
+    sodium_memzero(record.data(), record.size());
+    has_keys_ = true;
+    return true;
+}
+
+bool CryptoManager::save_retired(const std::string& path, std::span<const uint8_t> update,
+                                 int64_t until) const {
+    if (!has_keys_ || update.size() != kRetiredUpdateBytes) {
+        spdlog::error("Not writing retired keys {}: no keys, or not a signed key update", path);
+        return false;
+    }
+    RetiredRecord record{};
+    std::memcpy(record.data(), kRetiredMagic, sizeof(kRetiredMagic));
+    std::memcpy(record.data() + 4, &kRetiredVersion, sizeof(kRetiredVersion));
+    std::copy(public_key_.begin(), public_key_.end(), record.begin() + kRetiredPkAt);
+    std::copy(secret_key_.begin(), secret_key_.end(), record.begin() + kRetiredSkAt);
+    std::memcpy(record.data() + kRetiredUntilAt, &until, sizeof(until));
+    std::copy(update.begin(), update.end(), record.begin() + kRetiredUpdateAt);
+    retired_checksum(record, record.data() + kRetiredChecksumAt);
+
+    const bool ok = write_private(path, record);
+    sodium_memzero(record.data(), record.size());
+    if (!ok) {
+        spdlog::error("Cannot write retired keys {}", path);
+    }
+    return ok;
+}
+
+bool CryptoManager::load_retired(const std::string& path, std::vector<uint8_t>& update,
+                                 int64_t& until) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in || !has_keys_) {
+        return false;
+    }
+    RetiredRecord record{};
+    in.read(reinterpret_cast<char*>(record.data()), record.size());
+    const bool complete = in.gcount() == static_cast<std::streamsize>(record.size()) &&
+                          in.peek() == std::ifstream::traits_type::eof();
+    uint32_t version = 0;
+    std::memcpy(&version, record.data() + 4, sizeof(version));
+    uint8_t checksum[kRetiredBytes - kRetiredChecksumAt];
+    retired_checksum(record, checksum);
+    const bool ok = complete &&
+                    std::memcmp(record.data(), kRetiredMagic, sizeof(kRetiredMagic)) == 0 &&
+                    version == kRetiredVersion &&
+                    sodium_memcmp(checksum, record.data() + kRetiredChecksumAt,
+                                  sizeof(checksum)) == 0;
+    if (!ok) {
+        sodium_memzero(record.data(), record.size());
+        spdlog::error("Retired keys {} are damaged or from another version", path);
+        return false;
+    }
+    int64_t expires = 0;
+    std::memcpy(&expires, record.data() + kRetiredUntilAt, sizeof(expires));
+    if (expires <= static_cast<int64_t>(std::time(nullptr)) ||
+        std::equal(public_key_.begin(), public_key_.end(), record.begin() + kRetiredPkAt)) {
+        sodium_memzero(record.data(), record.size());
+        return false;
+    }
+
+    std::copy(record.begin() + kRetiredSkAt, record.begin() + kRetiredUntilAt,
+              retired_secret_key_.begin());
+    update.assign(record.begin() + kRetiredUpdateAt, record.begin() + kRetiredChecksumAt);
+    until = expires;
+    sodium_memzero(record.data(), record.size());
+    has_retired_ = true;
+    return true;
+}
+
+bool CryptoManager::retired_shared_key(std::span<const uint8_t> peer_public_key,
+                                       SharedKey& out) const {
+    return has_retired_ && peer_public_key.size() == crypto_box_PUBLICKEYBYTES &&
+           crypto_box_beforenm(out.data(), peer_public_key.data(),
+                               retired_secret_key_.data()) == 0;
+}
+
+std::string CryptoManager::encrypt(const std::string& plaintext,
+                                   const std::vector<uint8_t>& peer_public_key) const {
+    SharedKey key;
+    if (!shared_key(peer_public_key, key)) {
+        return {};
+    }
+    std::string out(crypto_box_NONCEBYTES + crypto_box_MACBYTES + plaintext.size(), '\0');
+    auto* nonce = reinterpret_cast<uint8_t*>(out.data());
+    nonce_source::fill(nonce, crypto_box_NONCEBYTES);
+    const int rc = crypto_box_easy_afternm(nonce + crypto_box_NONCEBYTES,
+                                           reinterpret_cast<const uint8_t*>(plaintext.data()),
+                                           plaintext.size(), nonce, key.data());
+    sodium_memzero(key.data(), key.size());
+    if (rc != 0) {
+        return {};
+    }
+    return out;
+}
+
+std::string CryptoManager::decrypt(const std::string& ciphertext,
+                                   const std::vector<uint8_t>& peer_public_key) const {
+    if (ciphertext.size() < crypto_box_NONCEBYTES + crypto_box_MACBYTES) {
+        return {};
+    }
+    SharedKey key;
+    if (!shared_key(peer_public_key, key)) {
+        return {};
+    }
+    const auto* nonce = reinterpret_cast<const uint8_t*>(ciphertext.data());
+    const std::size_t boxed = ciphertext.size() - crypto_box_NONCEBYTES;
+    std::string out(boxed - crypto_box_MACBYTES, '\0');
+    auto open = [&] {
+        return crypto_box_open_easy_afternm(reinterpret_cast<uint8_t*>(out.data()),
+                                            nonce + crypto_box_NONCEBYTES, boxed, nonce,
+                                            key.data());
+    };
+    int rc = open();
+    if (rc != 0 && retired_shared_key(peer_public_key, key)) {
+        rc = open();
+    }
+    sodium_memzero(key.data(), key.size());
+    if (rc != 0) {
+        return {};
+    }
+    return out;
+}
+
+CryptoManager::Broadcast
+CryptoManager::encrypt_for_many(std::string_view plaintext,
+                                std::span<const std::vector<uint8_t>> peer_public_keys,
+                                std::size_t threads) const {
+    Broadcast out;
+    uint8_t content_key[crypto_secretbox_KEYBYTES];
+    randombytes_buf(content_key, sizeof(content_key));
+    out.body.resize(crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES + plaintext.size());
+    auto* nonce = reinterpret_cast<uint8_t*>(out.body.data());
+    nonce_source::fill(nonce, crypto_secretbox_NONCEBYTES);
+    crypto_secretbox_easy(nonce + crypto_secretbox_NONCEBYTES,
+                          reinterpret_cast<const uint8_t*>(plaintext.data()), plaintext.size(),
+                          nonce, content_key);
+
+    // Every wrap shares one nonce: each is under a different shared key.
+    // Hashing it from the body ties the content key to this body.
+    uint8_t wrap_nonce[crypto_box_NONCEBYTES];
+    crypto_generichash(wrap_nonce, sizeof(wrap_nonce), nonce, out.body.size(), nullptr, 0);
+
+    out.keys.resize(peer_public_keys.size());
+    parallel_for(peer_public_keys.size(), threads, spread_, [&](std::size_t i) {
+        SharedKey key;
+        if (!shared_key(peer_public_keys[i], key)) {
+            return;
+        }
+        std::string& wrapped = out.keys[i];
+        wrapped.resize(kWrappedKeyBytes);
+        crypto_box_easy_afternm(reinterpret_cast<uint8_t*>(wrapped.data()), content_key,
+                                sizeof(content_key), wrap_nonce, key.data());
+        sodium_memzero(key.data(), key.size());
+    });
+    sodium_memzero(content_key, sizeof(content_key));
+    return out;
+}
+
+std::string CryptoManager::decrypt_broadcast(std::string_view body, std::string_view wrapped_key,
+                                             const std::vector<uint8_t>& sender_public_key) const {
+    if (body.size() < crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES ||
+        wrapped_key.size() != kWrappedKeyBytes) {
+        return {};
+    }
+    SharedKey key;
+    if (!shared_key(sender_public_key, key)) {
+        return {};
+    }
+    const auto* nonce = reinterpret_cast<const uint8_t*>(body.data());
+    uint8_t wrap_nonce[crypto_box_NONCEBYTES];
+    crypto_generichash(wrap_nonce, sizeof(wrap_nonce), nonce, body.size(), nullptr, 0);
+    uint8_t content_key[crypto_secretbox_KEYBYTES];
+    auto unwrap = [&] {
+        return crypto_box_open_easy_afternm(
+            content_key, reinterpret_cast<const uint8_t*>(wrapped_key.data()), wrapped_key.size(),
+            wrap_nonce, key.data());
+    };
+    int unwrapped = unwrap();
+    if (unwrapped != 0 && retired_shared_key(sender_public_key, key)) {
+        unwrapped = unwrap();
+    }
+    sodium_memzero(key.data(), key.size());
+    if (unwrapped != 0) {
+        return {};
+    }
+    const std::size_t boxed = body.size() - crypto_secretbox_NONCEBYTES;
+    std::string out(boxed - crypto_secretbox_MACBYTES, '\0');
+    const int rc = crypto_secretbox_open_easy(reinterpret_cast<uint8_t*>(out.data()),
+                                              nonce + crypto_secretbox_NONCEBYTES, boxed, nonce,
+                                              content_key);
+    sodium_memzero(content_key, sizeof(content_key));
+    if (rc != 0) {
+        return {};
+    }
+    return out;
+}
+
+std::string CryptoManager::sign(const std::string& message) const {
+    if (!has_keys_) {
+        return {};
+    }
+    std::string sig(crypto_sign_BYTES, '\0');
+    crypto_sign_detached(reinterpret_cast<uint8_t*>(sig.data()), nullptr,
+                         reinterpret_cast<const uint8_t*>(message.data()), message.size(),
+                         signing_secret_key_.data());
+    return sig;
+}
+
+bool CryptoManager::verify(const std::string& message,
+                           const std::string& signature,
+                           std::span<const uint8_t> peer_signing_key) const {
+    if (signature.size() != crypto_sign_BYTES ||
+        peer_signing_key.size() != crypto_sign_PUBLICKEYBYTES) {
+        return false;
+    }
+    return crypto_sign_verify_detached(reinterpret_cast<const uint8_t*>(signature.data()),
+                                       reinterpret_cast<const uint8_t*>(message.data()),
+                                       message.size(), peer_signing_key.data()) == 0;
+}
+
+CryptoManager::OpenResult CryptoManager::open_one(const OpenRequest& request) const {
+    using Clock = std::chrono::steady_clock;
+    const std::size_t split = split_open_bytes_.load(std::memory_order_relaxed);
+    if (split != 0 && request.ciphertext.size() >= split && spread_) {
+        return open_split(request);
+    }
+    OpenResult result;
+    const auto start = Clock::now();
+    if (request.signature.size() != crypto_sign_BYTES ||
+        request.peer_signing_key.size() != crypto_sign_PUBLICKEYBYTES ||
+        crypto_sign_verify_detached(request.signature.data(), request.ciphertext.data(),
+                                    request.ciphertext.size(),
+                                    request.peer_signing_key.data()) != 0) {
+        result.status = OpenStatus::BadSignature;
+        result.verify_time = Clock::now() - start;
+        verify_seconds.record(result.verify_time);
+        return result;
+    }
+    result.verify_time = Clock::now() - start;
+    verify_seconds.record(result.verify_time);
+    if (decrypt_into(request, result)) {
+        result.status = OpenStatus::Ok;
+    }
+    return result;
+}
+
+CryptoManager::OpenResult CryptoManager::open_split(const OpenRequest& request) const {
+    using Clock = std::chrono::steady_clock;
+    OpenResult result;
+    if (request.signature.size() != crypto_sign_BYTES ||
+        request.peer_signing_key.size() != crypto_sign_PUBLICKEYBYTES) {
+        result.status = OpenStatus::BadSignature;
+        return result;
+    }
+    // Both passes only read the ciphertext, and each is one pass over it,
+    // so side by side they take about as long as the slower one. A crypto
+    // worker free to help takes one; if none is, this thread runs both.
+    // Nothing the decryption produced leaves here unless the signature
+    // holds.
+    bool verified = false;
+    bool opened = false;
+    spread_(2, [&](std::size_t half) {
+        if (half == 0) {
+            opened = decrypt_into(request, result);
+            return;
+        }
+        const auto start = Clock::now();
+        verified = crypto_sign_verify_detached(request.signature.data(),
+                                               request.ciphertext.data(),
+                                               request.ciphertext.size(),
+                                               request.peer_signing_key.data()) == 0;
+        result.verify_time = Clock::now() - start;
+    });
+    verify_seconds.record(result.verify_time);
+    if (!verified) {
+        sodium_memzero(result.plaintext.data(), result.plaintext.size());
+        result.plaintext.clear();
+        result.status = OpenStatus::BadSignature;
+        return result;
+    }
+    if (opened) {
+        result.status = OpenStatus::Ok;
+    }
+    return result;
+}
+
+bool CryptoManager::decrypt_into(const OpenRequest& request, OpenResult& result) const {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    SharedKey key;
+    if (request.nonce.size() != crypto_box_NONCEBYTES ||
+        request.ciphertext.size() < crypto_box_MACBYTES ||
+        !shared_key(request.peer_public_key, key)) {
+        return false;
+    }
+    result.plaintext.resize(request.ciphertext.size() - crypto_box_MACBYTES);
+    auto open = [&] {
+        return crypto_box_open_easy_afternm(
+            reinterpret_cast<uint8_t*>(result.plaintext.data()), request.ciphertext.data(),
+            request.ciphertext.size(), request.nonce.data(), key.data());
+    };
+    int rc = open();
+    if (rc != 0 && retired_shared_key(request.peer_public_key, key)) {
+        rc = open();    // sealed to our key from before a rotation
+    }
+    sodium_memzero(key.data(), key.size());
+    result.decrypt_time = Clock::now() - start;
+    decrypt_seconds.record(result.decrypt_time);
+    if (rc != 0) {
+        result.plaintext.clear();
+        return false;
+    }
+    return true;
+}
+
+std::vector<CryptoManager::OpenResult>
+CryptoManager::open_batch(std::span<const OpenRequest> requests, std::size_t threads) const {
+    std::vector<OpenResult> results(requests.size());
+    parallel_for(requests.size(), threads, spread_,
+                 [&](std::size_t i) { results[i] = open_one(requests[i]); });
+    return results;
+}
@@ -0,0 +1,259 @@
+/**
+ * CryptoWorkers — verify/decrypt offload with per-sender ordering.
+ */
+
+#include "crypto/crypto_workers.h"
+#include "network/cpu_affinity.h"
+#include "node/bounded_queue.h"
+#include "telemetry/metrics.h"
+#include "telemetry/peer_usage.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <latch>
+#include <semaphore>
+
+namespace {
+
+metrics::Gauge& queue_depth =
+    metrics::gauge("p2p_crypto_queue_depth", "Crypto jobs queued or awaiting their continuation");
+
+} // namespace
+
+// While other work waits, a bulk job gets one turn in this many.
+constexpr unsigned kBulkTurn = 8;
+// Items of a batch taken at a time; also the most a helper's own jobs wait.
+// A batch too short to give every helper a chunk of this takes smaller ones.
+constexpr std::size_t kChunk = 8;
+
+/// A queued job, and the sender its time is charged to (GET /peers).
+struct CryptoWorkers::Job {
+    Work work;
+    peer_usage::Entry* usage = nullptr;
+};
+
+namespace {
+
+/// Run `work`, charging its time to `usage`; returns its continuation.
+std::function<void()> timed(const CryptoWorkers::Work& work, peer_usage::Entry& usage) {
+    const auto start = std::chrono::steady_clock::now();
+    auto then = work();
+    usage.crypto(std::chrono::steady_clock::now() - start);
+    return then;
+}
+
+} // namespace
+
+struct CryptoWorkers::Worker {
+    explicit Worker(std::size_t depth) : queues{BoundedQueue<Job>(depth), BoundedQueue<Job>(depth),
+                                                BoundedQueue<Job>(depth)} {}
+
+    /// Pop the next job by class. Consumer only.
+    bool try_pop(Job& out) {
+        const bool bulk_first = ++turn % kBulkTurn == 0;
+        if (bulk_first && queues[traffic::index(TrafficClass::Bulk)].try_pop(out)) {
+            return true;
+        }
+        for (auto& queue : queues) {
+            if (queue.try_pop(out)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// After taking a token from `ready`: the job it stands for, or false
+    /// if it was a wake-up to help with a batch. Consumer only.
+    bool take(Job& out) {
+        if (wake.exchange(false, std::memory_order_acq_rel)) {
+            return false;
+        }
+        // Pushed before its token, but an earlier push may still be
+        // filling the cell in front of it.
+        while (!try_pop(out)) {
+            std::this_thread::yield();
+        }
+        return true;
+    }
+
+    std::array<BoundedQueue<Job>, kTrafficClasses> queues;
+    unsigned turn = 0;                          // consumer only
+    std::counting_semaphore<> ready{0};         // one token per job, plus one per wake-up
+    std::atomic<bool> wake{false};              // a wake-up token is outstanding
+    std::atomic<std::size_t> in_flight{0};      // queued or awaiting its continuation
+    std::atomic<bool> stopping{false};
+};
+
+struct CryptoWorkers::Batch {
+    std::size_t count;
+    std::size_t chunk;
+    const std::function<void(std::size_t)>& fn;
+    std::atomic<std::size_t> next{0};
+    std::size_t helpers = 0;                    // guarded by batches_mutex_
+
+    /// Run the next chunk; false once there is none.
+    bool run_chunk() {
+        const std::size_t begin = next.fetch_add(chunk, std::memory_order_relaxed);
+        if (begin >= count) {
+            return false;
+        }
+        const std::size_t end = std::min(begin + chunk, count);
+        for (std::size_t i = begin; i < end; ++i) {
+            fn(i);
+        }
+        return true;
+    }
+};
+
+CryptoWorkers::CryptoWorkers(asio::any_io_executor io, Options options)
+    : io_(std::move(io)), options_(std::move(options)), workers_(options_.threads) {
+    // Each worker builds its own queues, after pinning itself: the pages
+    // are first touched, and so placed, on the NUMA node it runs on.
+    std::latch built(static_cast<std::ptrdiff_t>(workers_.size()));
+    for (std::size_t i = 0; i < workers_.size(); ++i) {
+        threads_.emplace_back([this, i, &built] {
+            if (!options_.cpus.empty()) {
+                cpu_affinity::pin_current(std::span(&options_.cpus[i % options_.cpus.size()], 1));
+            }
+            workers_[i] = std::make_unique<Worker>(options_.queue_depth);
+            Worker& worker = *workers_[i];
+            built.count_down();
+            loop(worker);
+        });
+    }
+    built.wait();
+}
+
+CryptoWorkers::~CryptoWorkers() {
+    for (auto& worker : workers_) {
+        worker->stopping.store(true, std::memory_order_relaxed);
+        worker->ready.release();
+    }
+    threads_.clear();   // join
+}
+
+void CryptoWorkers::run(std::string_view key, std::size_t bytes, Work work, TrafficClass cls) {
+    peer_usage::Entry& usage = peer_usage::of(key);
+    if (workers_.empty()) {
+        if (auto then = timed(work, usage)) then();
+        return;
+    }
+    Worker& worker = *workers_[std::hash<std::string_view>{}(key) % workers_.size()];
+
+    // Inline only with nothing ahead of it, so the sender's order holds.
+    if (bytes <= options_.inline_max_bytes &&
+        worker.in_flight.load(std::memory_order_acquire) == 0) {
+        if (auto then = timed(work, usage)) then();
+        return;
+    }
+
+    worker.in_flight.fetch_add(1, std::memory_order_acq_rel);
+    queue_depth.add(1);
+    Job job{std::move(work), &usage};
+    while (!worker.queues[traffic::index(cls)].try_push(job)) {
+        std::this_thread::yield();
+    }
+    worker.ready.release();
+}
+
+void CryptoWorkers::for_each(std::size_t count, const std::function<void(std::size_t)>& fn) {
+    const std::size_t chunk = std::clamp<std::size_t>(count / (workers_.size() + 1), 1, kChunk);
+    Batch batch{count, chunk, fn};
+    const std::size_t helpers = workers_.empty() || count == 0
+        ? 0 : std::min(workers_.size(), (count - 1) / chunk);
+    if (count == 0 || helpers == 0) {
+        while (batch.run_chunk()) {}
+        return;
+    }
+    {
+        std::lock_guard lock(batches_mutex_);
+        batches_.push_back(&batch);
+    }
+    // Idle workers first; a busy one joins once its current job is done.
+    std::size_t woken = 0;
+    for (const bool idle : {true, false}) {
+        for (auto& worker : workers_) {
+            if (woken == helpers) {
+                break;
+            }
+            if ((worker->in_flight.load(std::memory_order_relaxed) == 0) != idle) {
+                continue;
+            }
+            if (!worker->wake.exchange(true, std::memory_order_acq_rel)) {
+                worker->ready.release();
+            }
+            ++woken;
+        }
+    }
+
+    while (batch.run_chunk()) {}
+
+    // Nothing left to take: close it and wait out chunks still running.
+    std::unique_lock lock(batches_mutex_);
+    std::erase(batches_, &batch);
+    batch_left_.wait(lock, [&] { return batch.helpers == 0; });
+}
+
+void CryptoWorkers::help(Worker& worker) {
+    for (;;) {
+        Batch* batch = nullptr;
+        {
+            std::lock_guard lock(batches_mutex_);
+            if (batches_.empty()) {
+                return;
+            }
+            batch = batches_.front();
+            ++batch->helpers;
+        }
+        bool stopping = false;
+        do {
+            // Our own senders' jobs first: a chunk is all they wait behind.
+            while (worker.ready.try_acquire()) {
+                if (worker.stopping.load(std::memory_order_relaxed)) {
+                    worker.ready.release();     // for loop() to see
+                    stopping = true;
+                    break;
+                }
+                if (Job job; worker.take(job)) {
+                    finish(worker, std::move(job));
+                }
+            }
+        } while (!stopping && batch->run_chunk());
+        {
+            std::lock_guard lock(batches_mutex_);
+            if (!stopping) {
+                std::erase(batches_, batch);    // spent; the caller may not be done yet
+            }
+            if (--batch->helpers == 0) {
+                batch_left_.notify_all();
+            }
+        }
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void CryptoWorkers::finish(Worker& worker, Job job) {
+    asio::post(io_, [&worker, then = timed(job.work, *job.usage)] {
+        if (then) then();
+        worker.in_flight.fetch_sub(1, std::memory_order_acq_rel);
+        queue_depth.add(-1);
+    });
+}
+
+void CryptoWorkers::loop(Worker& worker) {
+    for (;;) {
+        worker.ready.acquire();
+        if (worker.stopping.load(std::memory_order_relaxed)) {
+            return;
+        }
+        if (Job job; worker.take(job)) {
+            finish(worker, std::move(job));
+        } else {
+            help(worker);
+        }
+    }
+}
@@ -0,0 +1,88 @@
+/**
+ * key_rotation — the signed `key_update` body.
+ *
+ * Layout (integers big-endian):
+ *
+ *    0   1  version (1)
+ *    1  32  new X25519 public key
+ *   33  32  new Ed25519 public key
+ *   65   8  until, unix seconds
+ *   73  64  the new Ed25519 key's signature over
+ *           kInnerDomain || from || 0x00 || bytes 0..73
+ */
+
+#include "crypto/key_rotation.h"
+#include "crypto/crypto_manager.h"
+
+#include <algorithm>
+
+#include <sodium.h>
+
+namespace key_rotation {
+namespace {
+
+constexpr std::string_view kDomain = "p2p-chat key_update v1";
+constexpr std::string_view kInnerDomain = "p2p-chat key_update v1 new key";
+constexpr uint8_t kVersion = 1;
+constexpr std::size_t kBoxPkAt = 1;
+constexpr std::size_t kSignPkAt = kBoxPkAt + 32;
+constexpr std::size_t kUntilAt = kSignPkAt + 32;
+constexpr std::size_t kSignatureAt = kUntilAt + 8;
+static_assert(kSignatureAt + crypto_sign_BYTES == kBodySize);
+
+std::string with_domain(std::string_view domain, std::string_view from,
+                        std::span<const uint8_t> bytes) {
+    std::string out;
+    out.reserve(domain.size() + from.size() + 1 + bytes.size());
+    out.append(domain);
+    out.append(from);
+    out.push_back('\0');
+    out.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return out;
+}
+
+} // namespace
+
+std::string signed_bytes(std::string_view from, std::span<const uint8_t> body) {
+    return with_domain(kDomain, from, body);
+}
+
+std::vector<uint8_t> make_body(const CryptoManager& next, std::string_view from, int64_t until) {
+    std::vector<uint8_t> body(kBodySize);
+    body[0] = kVersion;
+    std::copy(next.public_key().begin(), next.public_key().end(), body.begin() + kBoxPkAt);
+    std::copy(next.signing_public_key().begin(), next.signing_public_key().end(),
+              body.begin() + kSignPkAt);
+    auto v = static_cast<uint64_t>(until);
+    for (int i = 7; i >= 0; --i) {
+        body[kUntilAt + i] = static_cast<uint8_t>(v & 0xFF);
+        v >>= 8;
+    }
+    const std::string sig =
+        next.sign(with_domain(kInnerDomain, from, std::span(body).first(kSignatureAt)));
+    std::copy(sig.begin(), sig.end(), body.begin() + kSignatureAt);
+    return body;
+}
+
+std::optional<Update> parse(std::string_view from, std::span<const uint8_t> body) {
+    if (body.size() != kBodySize || body[0] != kVersion) {
+        return std::nullopt;
+    }
+    const std::string inner = with_domain(kInnerDomain, from, body.first(kSignatureAt));
+    if (crypto_sign_verify_detached(body.data() + kSignatureAt,
+                                    reinterpret_cast<const uint8_t*>(inner.data()), inner.size(),
+                                    body.data() + kSignPkAt) != 0) {
+        return std::nullopt;
+    }
+    Update update;
+    std::copy_n(body.begin() + kBoxPkAt, 32, update.public_key.begin());
+    std::copy_n(body.begin() + kSignPkAt, 32, update.signing_key.begin());
+    uint64_t v = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+        v = (v << 8) | body[kUntilAt + i];
+    }
+    update.until = static_cast<int64_t>(v);
+    return update;
+}
+
+} // namespace key_rotation
@@ -0,0 +1,88 @@
+/**
+ * nonce_source — per-thread ChaCha20 keystream for nonces.
+ */
+
+#include "crypto/nonce_source.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include <sodium.h>
+
+namespace {
+
+constexpr std::size_t kKeyBytes = crypto_stream_chacha20_KEYBYTES;
+constexpr std::size_t kBlockBytes = 512;        // keystream per refill; the first kKeyBytes rekey
+
+// Bumped in a forked child, so every inherited state is stale there.
+std::atomic<uint64_t> fork_generation{0};
+
+void watch_forks() {
+#ifndef _WIN32
+    static std::once_flag once;
+    std::call_once(once, [] {
+        pthread_atfork(nullptr, nullptr,
+                       [] { fork_generation.fetch_add(1, std::memory_order_relaxed); });
+    });
+#endif
+}
+
+struct State {
+    uint8_t key[kKeyBytes];
+    uint8_t block[kBlockBytes];
+    std::size_t next = kBlockBytes;             // first unused byte of block
+    uint64_t generation = 0;
+    bool keyed = false;
+
+    ~State() {
+        sodium_memzero(key, sizeof(key));
+        sodium_memzero(block, sizeof(block));
+    }
+
+    void rekey() {
+        watch_forks();
+        generation = fork_generation.load(std::memory_order_relaxed);
+        randombytes_buf(key, sizeof(key));
+        next = kBlockBytes;                     // drop anything cut from the old key
+        keyed = true;
+    }
+
+    void refill() {
+        // The key changes on every refill, so a zero stream nonce is
+        // never reused under one key.
+        static constexpr uint8_t kStreamNonce[crypto_stream_chacha20_NONCEBYTES] = {};
+        crypto_stream_chacha20(block, sizeof(block), kStreamNonce, key);
+        std::copy_n(block, kKeyBytes, key);
+        sodium_memzero(block, kKeyBytes);
+        next = kKeyBytes;
+    }
+};
+
+thread_local State state;
+
+} // namespace
+
+namespace nonce_source {
+
+void fill(std::span<uint8_t> out) {
+    if (!state.keyed || state.generation != fork_generation.load(std::memory_order_relaxed)) {
+        state.rekey();
+    }
+    while (!out.empty()) {
+        if (state.next == kBlockBytes) {
+            state.refill();
+        }
+        const std::size_t n = std::min(out.size(), kBlockBytes - state.next);
+        std::copy_n(state.block + state.next, n, out.begin());
+        sodium_memzero(state.block + state.next, n);    // handed out; don't keep a copy
+        state.next += n;
+        out = out.subspan(n);
+    }
+}
+
+} // namespace nonce_source
@@ -0,0 +1,830 @@
+/**
+ * PeerSessions — ephemeral key exchange and per-frame session sealing.
+ *
+ * Key exchange bodies (all integers big-endian):
+ *
+ *   init    1  phase (1)          accept  1  phase (2)
+ *          16  session id                 16  session id
+ *          32  initiator key              32  responder key
+ *           8  unix time                  32  initiator key
+ *         [ 1  AEAD offer mask]            8  unix time
+ *                                        [ 1  AEAD chosen]
+ *                                        [80  ticket]
+ *
+ * The bracketed bytes of an init and the first of an accept's are present
+ * together or not at all: an accept ends with the chosen AEAD exactly when
+ * the init offered some. It carries a ticket only if the offer also had
+ * bit 7 set.
+ *
+ *   resume  1  phase (3)          resumed 1  phase (4)     reject  1  phase (5)
+ *          16  session id                16  session id           16  session id
+ *          32  initiator key             32  responder key
+ *           8  unix time                 32  initiator key
+ *           1  AEAD offer mask            8  unix time
+ *          80  ticket                     1  AEAD chosen
+ *          32  MAC                       80  new ticket
+ *                                        32  MAC
+ *
+ * A ticket is a 24-byte nonce and the XChaCha20-Poly1305 of the resumption
+ * secret (32) and the signed handshake's unix time (8) under the ticket
+ * key, with the initiator's name as additional data. A MAC is the keyed
+ * BLAKE2b-256 of the body before it, under the secret in the resume's
+ * ticket.
+ */
+
+#include "crypto/peer_sessions.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <limits>
+
+#include <sodium.h>
+
+namespace {
+
+metrics::Counter& handshakes =
+    metrics::counter("p2p_session_handshakes_total", "Peer session key exchanges completed, either side");
+metrics::Counter& open_failures =
+    metrics::counter("p2p_session_open_failures_total",
+                     "Session frames dropped: unknown session or failed authentication");
+
+metrics::Counter& resumes =
+    metrics::counter("p2p_session_resumes_total",
+                     "Peer sessions resumed from a ticket instead of a signed handshake, either side");
+
+constexpr std::string_view kDomain = "p2p-chat key_exchange v1";
+constexpr std::string_view kResumeDomain = "p2p-chat resume v1";
+constexpr std::size_t kKeyBytes = crypto_kx_SESSIONKEYBYTES;
+constexpr std::size_t kSlotBytes = 3 * kKeyBytes;           // rx, tx, resumption secret
+constexpr std::size_t kSecretAt = 2 * kKeyBytes;            // in a slot
+constexpr std::size_t kMacBytes = crypto_generichash_BYTES;
+constexpr std::size_t kTicketNonceBytes = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+constexpr std::size_t kInitSize = 1 + PeerSessions::kIdSize + 32 + 8;
+constexpr std::size_t kAcceptSize = 1 + PeerSessions::kIdSize + 32 + 32 + 8;
+constexpr std::size_t kResumeSize = kInitSize + 1 + PeerSessions::kTicketSize + kMacBytes;
+constexpr std::size_t kResumedSize = kAcceptSize + 1 + PeerSessions::kTicketSize + kMacBytes;
+constexpr std::size_t kRejectSize = 1 + PeerSessions::kIdSize;
+constexpr uint8_t kWantsTicket = 0x80;                      // in an init's offer
+constexpr std::size_t kTagBytes = crypto_aead_xchacha20poly1305_ietf_ABYTES;
+constexpr std::size_t kGcmNonceOffset = PeerSessions::kNonceSize - crypto_aead_aes256gcm_NPUBBYTES;
+constexpr std::size_t kMaxPerPeer = 4;
+constexpr std::size_t kNoSlot = std::numeric_limits<std::size_t>::max();
+
+static_assert(crypto_kx_PUBLICKEYBYTES == 32 && crypto_kx_SECRETKEYBYTES == 32);
+static_assert(crypto_aead_xchacha20poly1305_ietf_NPUBBYTES == PeerSessions::kNonceSize);
+static_assert(crypto_aead_xchacha20poly1305_ietf_KEYBYTES == kKeyBytes);
+static_assert(crypto_aead_aes256gcm_KEYBYTES == kKeyBytes);
+static_assert(crypto_aead_aes256gcm_ABYTES == kTagBytes);
+// The GCM nonce (id tail + counter) keeps the whole counter.
+static_assert(crypto_aead_aes256gcm_NPUBBYTES >= 8);
+static_assert(PeerSessions::kTicketSize == kTicketNonceBytes + kKeyBytes + 8 + kTagBytes);
+static_assert(kMacBytes == 32);
+
+metrics::Counter& aes_gcm_sessions =
+    metrics::counter("p2p_session_aes_gcm_total", "Peer sessions established with AES-256-GCM");
+
+constexpr uint8_t mask(PeerSessions::Aead aead) {
+    return static_cast<uint8_t>(1u << static_cast<uint8_t>(aead));
+}
+
+void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) {
+        p[i] = static_cast<uint8_t>(v & 0xFF);
+        v >>= 8;
+    }
+}
+
+uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+int64_t unix_now() {
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+/// The resumption secret of the session with `keys` (rx, tx) and `id`:
+/// both ends hash the two keys, the initiator's transmit key first.
+void resume_secret(std::span<const uint8_t> keys, bool initiator, const uint8_t* id,
+                   uint8_t* out) {
+    std::array<uint8_t, 2 * kKeyBytes> key;
+    const uint8_t* rx = keys.data();
+    const uint8_t* tx = keys.data() + kKeyBytes;
+    std::copy_n(initiator ? tx : rx, kKeyBytes, key.begin());
+    std::copy_n(initiator ? rx : tx, kKeyBytes, key.begin() + kKeyBytes);
+    std::array<uint8_t, kResumeDomain.size() + PeerSessions::kIdSize> message;
+    std::copy(kResumeDomain.begin(), kResumeDomain.end(), message.begin());
+    std::copy_n(id, PeerSessions::kIdSize, message.begin() + kResumeDomain.size());
+    crypto_generichash(out, kKeyBytes, message.data(), message.size(), key.data(), key.size());
+    sodium_memzero(key.data(), key.size());
+}
+
+/// Mix the resumption secret into freshly exchanged keys (rx, tx), so a
+/// resumed session needs both it and the ephemeral secrets.
+void bind_keys(std::span<uint8_t> keys, const uint8_t* secret) {
+    for (std::size_t at = 0; at < 2 * kKeyBytes; at += kKeyBytes) {
+        crypto_generichash(keys.data() + at, kKeyBytes, keys.data() + at, kKeyBytes, secret,
+                           kKeyBytes);
+    }
+}
+
+void mac(std::span<const uint8_t> bytes, const uint8_t* secret, uint8_t* out) {
+    crypto_generichash(out, kMacBytes, bytes.data(), bytes.size(), secret, kKeyBytes);
+}
+
+/// Whether the body ends with the right MAC under `secret`.
+bool mac_ok(std::span<const uint8_t> body, const uint8_t* secret) {
+    std::array<uint8_t, kMacBytes> expected;
+    mac(body.first(body.size() - kMacBytes), secret, expected.data());
+    return crypto_verify_32(expected.data(), body.data() + body.size() - kMacBytes) == 0;
+}
+
+} // namespace
+
+PeerSessions::PeerSessions(Options options)
+    : options_(options),
+      // sodium_init() runs the CPU feature detection is_available() reads.
+      aes_gcm_(options.aes_gcm && sodium_init() >= 0 && crypto_aead_aes256gcm_is_available()),
+      arena_(SecureArena::size_for(std::array<std::size_t, 2>{
+          std::max<std::size_t>(1, options.max_sessions) * kSlotBytes, kKeyBytes})),
+      keys_(arena_.take(std::max<std::size_t>(1, options.max_sessions) * kSlotBytes)),
+      ticket_key_(arena_.take(kKeyBytes)) {
+    for (std::size_t slot = keys_.size() / kSlotBytes; slot-- > 0;) {
+        free_slots_.push_back(slot);
+    }
+    randombytes_buf(ticket_key_.data(), ticket_key_.size());
+}
+
+PeerSessions::~PeerSessions() = default;
+
+std::string PeerSessions::signed_bytes(std::string_view from, std::string_view to,
+                                       std::span<const uint8_t> body) {
+    std::string out;
+    out.reserve(kDomain.size() + from.size() + to.size() + 2 + body.size());
+    out.append(kDomain);
+    out.append(from);
+    out.push_back('\0');
+    out.append(to);
+    out.push_back('\0');
+    out.append(reinterpret_cast<const char*>(body.data()), body.size());
+    return out;
+}
+
+std::optional<PeerSessions::Phase> PeerSessions::phase(std::span<const uint8_t> body) {
+    if ((body.size() == kInitSize || body.size() == kInitSize + 1) &&
+        body[0] == static_cast<uint8_t>(Phase::Init)) {
+        return Phase::Init;
+    }
+    if ((body.size() == kAcceptSize || body.size() == kAcceptSize + 1 ||
+         body.size() == kAcceptSize + 1 + kTicketSize) &&
+        body[0] == static_cast<uint8_t>(Phase::Accept)) {
+        return Phase::Accept;
+    }
+    const std::pair<Phase, std::size_t> fixed[] = {
+        {Phase::Resume, kResumeSize}, {Phase::Resumed, kResumedSize}, {Phase::Reject, kRejectSize}};
+    for (const auto& [phase, size] : fixed) {
+        if (body.size() == size && body[0] == static_cast<uint8_t>(phase)) {
+            return phase;
+        }
+    }
+    return std::nullopt;
+}
+
+PeerSessions::Ticket PeerSessions::issue_ticket(const std::string& peer,
+                                                std::span<const uint8_t> secret,
+                                                int64_t authenticated) const {
+    Ticket ticket{};
+    std::array<uint8_t, kKeyBytes + 8> plain;
+    std::copy_n(secret.data(), kKeyBytes, plain.begin());
+    put_u64(plain.data() + kKeyBytes, static_cast<uint64_t>(authenticated));
+    randombytes_buf(ticket.data(), kTicketNonceBytes);
+    unsigned long long len = 0;
+    crypto_aead_xchacha20poly1305_ietf_encrypt(
+        ticket.data() + kTicketNonceBytes, &len, plain.data(), plain.size(),
+        reinterpret_cast<const uint8_t*>(peer.data()), peer.size(), nullptr, ticket.data(),
+        ticket_key_.data());
+    sodium_memzero(plain.data(), plain.size());
+    return ticket;
+}
+
+bool PeerSessions::open_ticket(const std::string& peer, std::span<const uint8_t> ticket,
+                               std::span<uint8_t> secret, int64_t& authenticated) const {
+    std::array<uint8_t, kKeyBytes + 8> plain;
+    unsigned long long len = 0;
+    if (ticket.size() != kTicketSize ||
+        crypto_aead_xchacha20poly1305_ietf_decrypt(
+            plain.data(), &len, nullptr, ticket.data() + kTicketNonceBytes,
+            kTicketSize - kTicketNonceBytes, reinterpret_cast<const uint8_t*>(peer.data()),
+            peer.size(), ticket.data(), ticket_key_.data()) != 0) {
+        return false;
+    }
+    std::copy_n(plain.begin(), kKeyBytes, secret.begin());
+    authenticated = static_cast<int64_t>(get_u64(plain.data() + kKeyBytes));
+    sodium_memzero(plain.data(), plain.size());
+    return true;
+}
+
+std::span<uint8_t> PeerSessions::slot_bytes(std::size_t slot) const {
+    return keys_.subspan(slot * kSlotBytes, kSlotBytes);
+}
+
+std::size_t PeerSessions::take_slot_locked() {
+    if (free_slots_.empty() && !sessions_.empty()) {
+        auto oldest = std::min_element(sessions_.begin(), sessions_.end(),
+                                       [](const auto& a, const auto& b) {
+                                           return a.second.created < b.second.created;
+                                       });
+        drop_locked(oldest->first);
+    }
+    if (free_slots_.empty()) {
+        return kNoSlot;                         // every slot is a pending handshake
+    }
+    const std::size_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
+
+void PeerSessions::free_slot_locked(std::size_t slot) {
+    sodium_memzero(slot_bytes(slot).data(), kSlotBytes);
+    free_slots_.push_back(slot);
+}
+
+void PeerSessions::drop_locked(const Id& id) {
+    auto it = sessions_.find(id);
+    if (it == sessions_.end()) {
+        return;
+    }
+    free_slot_locked(it->second.slot);
+    if (auto peer = peers_.find(it->second.peer); peer != peers_.end()) {
+        std::erase(peer->second.sessions, id);
+    }
+    sessions_.erase(it);
+}
+
+void PeerSessions::add_locked(const std::string& peer, const Id& id, Session session) {
+    auto& state = peers_[peer];
+    while (state.sessions.size() >= kMaxPerPeer) {
+        drop_locked(state.sessions.front());
+    }
+    state.sessions.push_back(id);
+    const Aead aead = session.aead;
+    sessions_.emplace(id, std::move(session));
+    handshakes.inc();
+    if (aead == Aead::Aes256Gcm) {
+        aes_gcm_sessions.inc();
+    }
+}
+
+void PeerSessions::prune_locked(PeerState& state, Clock::time_point now) {
+    // Kept for receiving until twice their lifetime, so frames sent just
+    // before a renewal still open.
+    const auto ids = state.sessions;
+    for (const auto& id : ids) {
+        auto it = sessions_.find(id);
+        if (it != sessions_.end() && now - it->second.created >= 2 * options_.lifetime) {
+            drop_locked(id);
+        }
+    }
+    if (state.pending && now - state.pending->started >= options_.handshake_timeout) {
+        const bool resume = state.pending->resume;
+        free_slot_locked(state.pending->slot);
+        state.pending.reset();
+        if (resume) {
+            drop_tickets_locked(state);                     // a signed init next
+        } else {
+            state.quiet_until = now + options_.retry_after; // most likely an older build
+        }
+    }
+}
+
+PeerSessions::Session* PeerSessions::ticket_locked(PeerState& state) {
+    const int64_t now = unix_now();
+    for (auto id = state.sessions.rbegin(); id != state.sessions.rend(); ++id) {
+        auto it = sessions_.find(*id);
+        if (it != sessions_.end() && it->second.ticket &&
+            now - it->second.authenticated < options_.resume_window.count()) {
+            return &it->second;
+        }
+    }
+    return nullptr;
+}
+
+void PeerSessions::drop_tickets_locked(PeerState& state) {
+    for (const auto& id : state.sessions) {
+        if (auto it = sessions_.find(id); it != sessions_.end()) {
+            it->second.ticket.reset();
+        }
+    }
+}
+
+const PeerSessions::Id* PeerSessions::tx_locked(const PeerState& state, Clock::time_point now) const {
+    for (auto id = state.sessions.rbegin(); id != state.sessions.rend(); ++id) {
+        auto it = sessions_.find(*id);
+        if (it != sessions_.end() && it->second.confirmed && !it->second.retired &&
+            now - it->second.created < 2 * options_.lifetime) {
+            return &*id;
+        }
+    }
+    return nullptr;
+}
+
+std::optional<std::string> PeerSessions::initiate(const std::string& peer, bool negotiate_aead) {
+    std::lock_guard lock(mutex_);
+    const auto now = Clock::now();
+    auto& state = peers_[peer];
+    prune_locked(state, now);
+    if (state.pending || now < state.quiet_until) {
+        return std::nullopt;
+    }
+    if (const Id* tx = tx_locked(state, now);
+        tx && now - sessions_.at(*tx).created < options_.lifetime) {
+        return std::nullopt;                    // up, and not due for renewal
+    }
+    const std::size_t slot = take_slot_locked();
+    if (slot == kNoSlot) {
+        return std::nullopt;
+    }
+
+    Pending pending;
+    pending.slot = slot;
+    pending.started = now;
+    const uint8_t aeads = mask(Aead::XChaCha20Poly1305) | (aes_gcm_ ? mask(Aead::Aes256Gcm) : 0);
+    randombytes_buf(pending.id.data(), pending.id.size());
+    crypto_kx_keypair(pending.ephemeral.data(), slot_bytes(slot).data());
+
+    // Looked up after take_slot_locked(), which may have evicted it.
+    if (const Session* from = ticket_locked(state)) {
+        pending.resume = true;
+        pending.authenticated = from->authenticated;
+        pending.offer = aeads;
+        std::copy_n(slot_bytes(from->slot).data() + kSecretAt, kKeyBytes,
+                    slot_bytes(slot).data() + kSecretAt);
+
+        std::string body(kResumeSize, '\0');
+        auto* p = reinterpret_cast<uint8_t*>(body.data());
+        p[0] = static_cast<uint8_t>(Phase::Resume);
+        std::copy(pending.id.begin(), pending.id.end(), p + 1);
+        std::copy(pending.ephemeral.begin(), pending.ephemeral.end(), p + 1 + kIdSize);
+        put_u64(p + 1 + kIdSize + 32, static_cast<uint64_t>(unix_now()));
+        p[kInitSize] = pending.offer;
+        std::copy(from->ticket->begin(), from->ticket->end(), p + kInitSize + 1);
+        mac(std::span(p, kResumeSize - kMacBytes), slot_bytes(slot).data() + kSecretAt,
+            p + kResumeSize - kMacBytes);
+        state.pending = pending;
+        return body;
+    }
+
+    if (negotiate_aead) {
+        pending.offer = aeads | (options_.resume_window.count() > 0 ? kWantsTicket : 0);
+    }
+
+    std::string body(pending.offer ? kInitSize + 1 : kInitSize, '\0');
+    auto* p = reinterpret_cast<uint8_t*>(body.data());
+    p[0] = static_cast<uint8_t>(Phase::Init);
+    std::copy(pending.id.begin(), pending.id.end(), p + 1);
+    std::copy(pending.ephemeral.begin(), pending.ephemeral.end(), p + 1 + kIdSize);
+    put_u64(p + 1 + kIdSize + 32, static_cast<uint64_t>(unix_now()));
+    if (pending.offer) {
+        p[kInitSize] = pending.offer;
+    }
+    state.pending = pending;
+    return body;
+}
+
+std::optional<std::string> PeerSessions::accept(const std::string& peer,
+                                                std::span<const uint8_t> body) {
+    if (phase(body) != Phase::Init) {
+        return std::nullopt;
+    }
+    const auto sent = static_cast<int64_t>(get_u64(body.data() + 1 + kIdSize + 32));
+    if (std::abs(unix_now() - sent) > options_.max_clock_skew.count()) {
+        return std::nullopt;
+    }
+    Id id;
+    std::copy_n(body.data() + 1, kIdSize, id.begin());
+    const uint8_t* initiator = body.data() + 1 + kIdSize;
+
+    const bool negotiated = body.size() == kInitSize + 1;
+    const uint8_t offer = negotiated ? body[kInitSize] : 0;
+    const bool ticket = (offer & kWantsTicket) && options_.resume_window.count() > 0;
+    Aead aead = Aead::XChaCha20Poly1305;
+    if (negotiated) {
+        if (aes_gcm_ && (offer & mask(Aead::Aes256Gcm))) {
+            aead = Aead::Aes256Gcm;
+        } else if (!(offer & mask(Aead::XChaCha20Poly1305))) {
+            return std::nullopt;                // nothing we share
+        }
+    }
+
+    std::lock_guard lock(mutex_);
+    const auto now = Clock::now();
+    if (sessions_.contains(id)) {
+        return std::nullopt;                    // a replay
+    }
+    auto& state = peers_[peer];
+    prune_locked(state, now);
+    const std::size_t slot = take_slot_locked();
+    if (slot == kNoSlot) {
+        return std::nullopt;
+    }
+
+    PublicKey ephemeral;
+    std::array<uint8_t, crypto_kx_SECRETKEYBYTES> secret;
+    crypto_kx_keypair(ephemeral.data(), secret.data());
+    auto keys = slot_bytes(slot);
+    const bool ok = crypto_kx_server_session_keys(keys.data(), keys.data() + kKeyBytes,
+                                                  ephemeral.data(), secret.data(), initiator) == 0;
+    sodium_memzero(secret.data(), secret.size());
+    if (!ok) {
+        free_slot_locked(slot);
+        return std::nullopt;
+    }
+
+    // They started over, so whatever we were sending on is gone at their end.
+    for (const auto& old : state.sessions) {
+        sessions_.at(old).retired = true;
+    }
+    state.quiet_until = {};
+    add_locked(peer, id, Session{peer, slot, now, 0, false, false, aead});
+
+    std::string reply(negotiated ? kAcceptSize + 1 + (ticket ? kTicketSize : 0) : kAcceptSize,
+                      '\0');
+    auto* p = reinterpret_cast<uint8_t*>(reply.data());
+    p[0] = static_cast<uint8_t>(Phase::Accept);
+    std::copy(id.begin(), id.end(), p + 1);
+    std::copy(ephemeral.begin(), ephemeral.end(), p + 1 + kIdSize);
+    std::copy_n(initiator, 32, p + 1 + kIdSize + 32);
+    put_u64(p + 1 + kIdSize + 64, static_cast<uint64_t>(unix_now()));
+    if (negotiated) {
+        p[kAcceptSize] = static_cast<uint8_t>(aead);
+    }
+    if (ticket) {
+        std::array<uint8_t, kKeyBytes> secret;
+        resume_secret(keys, false, id.data(), secret.data());
+        const Ticket issued = issue_ticket(peer, secret, unix_now());
+        sodium_memzero(secret.data(), secret.size());
+        std::copy(issued.begin(), issued.end(), p + kAcceptSize + 1);
+    }
+    return reply;
+}
+
+bool PeerSessions::complete(const std::string& peer, std::span<const uint8_t> body) {
+    if (phase(body) != Phase::Accept) {
+        return false;
+    }
+    const auto sent = static_cast<int64_t>(get_u64(body.data() + 1 + kIdSize + 64));
+    if (std::abs(unix_now() - sent) > options_.max_clock_skew.count()) {
+        return false;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end() || !found->second.pending) {
+        return false;
+    }
+    auto& state = found->second;
+    const Pending pending = *state.pending;
+    if (pending.resume || !std::equal(pending.id.begin(), pending.id.end(), body.data() + 1) ||
+        !std::equal(pending.ephemeral.begin(), pending.ephemeral.end(),
+                    body.data() + 1 + kIdSize + 32)) {
+        return false;                           // not an answer to our init
+    }
+    Aead aead = Aead::XChaCha20Poly1305;
+    const bool with_ticket = body.size() == kAcceptSize + 1 + kTicketSize;
+    if (pending.offer) {
+        if (body.size() == kAcceptSize || (with_ticket && !(pending.offer & kWantsTicket)) ||
+            body[kAcceptSize] > 7 || !(pending.offer & ~kWantsTicket & (1u << body[kAcceptSize]))) {
+            return false;                       // chose something we didn't offer
+        }
+        aead = static_cast<Aead>(body[kAcceptSize]);
+    } else if (body.size() != kAcceptSize) {
+        return false;
+    }
+    state.pending.reset();
+
+    auto keys = slot_bytes(pending.slot);
+    std::array<uint8_t, crypto_kx_SECRETKEYBYTES> secret;
+    std::copy_n(keys.data(), secret.size(), secret.begin());
+    const bool ok = crypto_kx_client_session_keys(keys.data(), keys.data() + kKeyBytes,
+                                                  pending.ephemeral.data(), secret.data(),
+                                                  body.data() + 1 + kIdSize) == 0;
+    sodium_memzero(secret.data(), secret.size());
+    if (!ok) {
+        free_slot_locked(pending.slot);
+        return false;
+    }
+    Session session{peer, pending.slot, Clock::now(), 0, true, false, aead};
+    if (with_ticket) {
+        resume_secret(keys, true, pending.id.data(), keys.data() + kSecretAt);
+        session.ticket.emplace();
+        std::copy_n(body.data() + kAcceptSize + 1, kTicketSize, session.ticket->begin());
+        session.authenticated = unix_now();
+        drop_tickets_locked(state);
+    }
+    state.quiet_until = {};
+    add_locked(peer, pending.id, std::move(session));
+    return true;
+}
+
+std::optional<std::string> PeerSessions::resume(const std::string& peer,
+                                                std::span<const uint8_t> body) {
+    if (phase(body) != Phase::Resume || options_.resume_window.count() == 0) {
+        return std::nullopt;
+    }
+    const auto sent = static_cast<int64_t>(get_u64(body.data() + 1 + kIdSize + 32));
+    if (std::abs(unix_now() - sent) > options_.max_clock_skew.count()) {
+        return std::nullopt;
+    }
+    Id id;
+    std::copy_n(body.data() + 1, kIdSize, id.begin());
+    const uint8_t* initiator = body.data() + 1 + kIdSize;
+
+    // Ours, for this peer, and in its window; else they start over signed.
+    std::array<uint8_t, kKeyBytes> secret;
+    int64_t authenticated = 0;
+    if (!open_ticket(peer, body.subspan(kInitSize + 1, kTicketSize), secret, authenticated) ||
+        unix_now() - authenticated >= options_.resume_window.count()) {
+        std::string reject(kRejectSize, '\0');
+        reject[0] = static_cast<char>(Phase::Reject);
+        std::copy(id.begin(), id.end(), reject.begin() + 1);
+        return reject;
+    }
+    const uint8_t offer = body[kInitSize];
+    Aead aead = Aead::XChaCha20Poly1305;
+    if (aes_gcm_ && (offer & mask(Aead::Aes256Gcm))) {
+        aead = Aead::Aes256Gcm;
+    } else if (!(offer & mask(Aead::XChaCha20Poly1305))) {
+        sodium_memzero(secret.data(), secret.size());
+        return std::nullopt;
+    }
+    if (!mac_ok(body, secret.data())) {
+        sodium_memzero(secret.data(), secret.size());
+        return std::nullopt;                    // not from whoever holds the ticket
+    }
+
+    std::lock_guard lock(mutex_);
+    const auto now = Clock::now();
+    std::size_t slot = kNoSlot;
+    if (!sessions_.contains(id)) {              // else a replay
+        auto& state = peers_[peer];
+        prune_locked(state, now);
+        slot = take_slot_locked();
+    }
+    if (slot == kNoSlot) {
+        sodium_memzero(secret.data(), secret.size());
+        return std::nullopt;
+    }
+
+    PublicKey ephemeral;
+    std::array<uint8_t, crypto_kx_SECRETKEYBYTES> ephemeral_secret;
+    crypto_kx_keypair(ephemeral.data(), ephemeral_secret.data());
+    auto keys = slot_bytes(slot);
+    const bool ok = crypto_kx_server_session_keys(keys.data(), keys.data() + kKeyBytes,
+                                                  ephemeral.data(), ephemeral_secret.data(),
+                                                  initiator) == 0;
+    sodium_memzero(ephemeral_secret.data(), ephemeral_secret.size());
+    if (!ok) {
+        sodium_memzero(secret.data(), secret.size());
+        free_slot_locked(slot);
+        return std::nullopt;
+    }
+    bind_keys(keys, secret.data());
+    std::array<uint8_t, kKeyBytes> next;
+    resume_secret(keys, false, id.data(), next.data());
+    const Ticket issued = issue_ticket(peer, next, authenticated);
+    sodium_memzero(next.data(), next.size());
+
+    auto& state = peers_[peer];
+    for (const auto& old : state.sessions) {
+        sessions_.at(old).retired = true;
+    }
+    state.quiet_until = {};
+    add_locked(peer, id, Session{peer, slot, now, 0, false, false, aead, std::nullopt,
+                                 authenticated});
+    resumes.inc();
+
+    std::string reply(kResumedSize, '\0');
+    auto* p = reinterpret_cast<uint8_t*>(reply.data());
+    p[0] = static_cast<uint8_t>(Phase::Resumed);
+    std::copy(id.begin(), id.end(), p + 1);
+    std::copy(ephemeral.begin(), ephemeral.end(), p + 1 + kIdSize);
+    std::copy_n(initiator, 32, p + 1 + kIdSize + 32);
+    put_u64(p + 1 + kIdSize + 64, static_cast<uint64_t>(unix_now()));
+    p[kAcceptSize] = static_cast<uint8_t>(aead);
+    std::copy(issued.begin(), issued.end(), p + kAcceptSize + 1);
+    mac(std::span(p, kResumedSize - kMacBytes), secret.data(), p + kResumedSize - kMacBytes);
+    sodium_memzero(secret.data(), secret.size());
+    return reply;
+}
+
+bool PeerSessions::resumed(const std::string& peer, std::span<const uint8_t> body) {
+    if (phase(body) != Phase::Resumed) {
+        return false;
+    }
+    const auto sent = static_cast<int64_t>(get_u64(body.data() + 1 + kIdSize + 64));
+    if (std::abs(unix_now() - sent) > options_.max_clock_skew.count()) {
+        return false;
+    }
+
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end() || !found->second.pending || !found->second.pending->resume) {
+        return false;
+    }
+    auto& state = found->second;
+    const Pending pending = *state.pending;
+    auto keys = slot_bytes(pending.slot);
+    if (!std::equal(pending.id.begin(), pending.id.end(), body.data() + 1) ||
+        !std::equal(pending.ephemeral.begin(), pending.ephemeral.end(),
+                    body.data() + 1 + kIdSize + 32) ||
+        !mac_ok(body, keys.data() + kSecretAt)) {
+        return false;                           // not an answer to our resume
+    }
+    if (body[kAcceptSize] > 7 || !(pending.offer & (1u << body[kAcceptSize]))) {
+        return false;
+    }
+    const auto aead = static_cast<Aead>(body[kAcceptSize]);
+    state.pending.reset();
+
+    std::array<uint8_t, crypto_kx_SECRETKEYBYTES> secret;
+    std::copy_n(keys.data(), secret.size(), secret.begin());
+    const bool ok = crypto_kx_client_session_keys(keys.data(), keys.data() + kKeyBytes,
+                                                  pending.ephemeral.data(), secret.data(),
+                                                  body.data() + 1 + kIdSize) == 0;
+    sodium_memzero(secret.data(), secret.size());
+    if (!ok) {
+        free_slot_locked(pending.slot);
+        return false;
+    }
+    bind_keys(keys, keys.data() + kSecretAt);
+    resume_secret(keys, true, pending.id.data(), keys.data() + kSecretAt);
+
+    Session session{peer, pending.slot, Clock::now(), 0, true, false, aead};
+    session.ticket.emplace();
+    std::copy_n(body.data() + kAcceptSize + 1, kTicketSize, session.ticket->begin());
+    session.authenticated = pending.authenticated;
+    drop_tickets_locked(state);
+    state.quiet_until = {};
+    add_locked(peer, pending.id, std::move(session));
+    resumes.inc();
+    return true;
+}
+
+bool PeerSessions::rejected(const std::string& peer, std::span<const uint8_t> body) {
+    if (phase(body) != Phase::Reject) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end() || !found->second.pending || !found->second.pending->resume ||
+        !std::equal(found->second.pending->id.begin(), found->second.pending->id.end(),
+                    body.data() + 1)) {
+        return false;
+    }
+    auto& state = found->second;
+    free_slot_locked(state.pending->slot);
+    state.pending.reset();
+    drop_tickets_locked(state);
+    return true;
+}
+
+std::optional<PeerSessions::Sealed> PeerSessions::seal(const std::string& peer,
+                                                       std::string_view plaintext,
+                                                       std::string_view aad) {
+    Sealed out;
+    std::array<uint8_t, kKeyBytes> key;
+    Aead aead;
+    {
+        std::lock_guard lock(mutex_);
+        auto found = peers_.find(peer);
+        if (found == peers_.end()) {
+            return std::nullopt;
+        }
+        const Id* id = tx_locked(found->second, Clock::now());
+        if (!id) {
+            return std::nullopt;
+        }
+        Session& session = sessions_.at(*id);
+        out.nonce.resize(kNonceSize);
+        std::copy(id->begin(), id->end(), out.nonce.begin());
+        put_u64(out.nonce.data() + kIdSize, session.next_counter++);
+        std::copy_n(slot_bytes(session.slot).data() + kKeyBytes, kKeyBytes, key.begin());
+        aead = session.aead;
+    }
+    out.ciphertext.resize(plaintext.size() + kTagBytes);
+    unsigned long long len = 0;
+    const auto* m = reinterpret_cast<const uint8_t*>(plaintext.data());
+    const auto* ad = reinterpret_cast<const uint8_t*>(aad.data());
+    if (aead == Aead::Aes256Gcm) {
+        crypto_aead_aes256gcm_encrypt(out.ciphertext.data(), &len, m, plaintext.size(), ad,
+                                      aad.size(), nullptr, out.nonce.data() + kGcmNonceOffset,
+                                      key.data());
+    } else {
+        crypto_aead_xchacha20poly1305_ietf_encrypt(out.ciphertext.data(), &len, m,
+                                                   plaintext.size(), ad, aad.size(), nullptr,
+                                                   out.nonce.data(), key.data());
+    }
+    sodium_memzero(key.data(), key.size());
+    out.ciphertext.resize(len);
+    return out;
+}
+
+std::optional<std::string> PeerSessions::open(const std::string& peer,
+                                              std::span<const uint8_t> nonce,
+                                              std::span<const uint8_t> ciphertext,
+                                              std::string_view aad) {
+    if (nonce.size() != kNonceSize || ciphertext.size() < kTagBytes) {
+        open_failures.inc();
+        return std::nullopt;
+    }
+    Id id;
+    std::copy_n(nonce.begin(), kIdSize, id.begin());
+    std::array<uint8_t, kKeyBytes> key;
+    Aead aead;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = sessions_.find(id);
+        if (it == sessions_.end() || it->second.peer != peer) {
+            open_failures.inc();
+            return std::nullopt;
+        }
+        std::copy_n(slot_bytes(it->second.slot).data(), kKeyBytes, key.begin());
+        aead = it->second.aead;
+    }
+
+    std::string plaintext(ciphertext.size() - kTagBytes, '\0');
+    unsigned long long len = 0;
+    auto* m = reinterpret_cast<uint8_t*>(plaintext.data());
+    const auto* ad = reinterpret_cast<const uint8_t*>(aad.data());
+    const bool ok =
+        aead == Aead::Aes256Gcm
+            ? crypto_aead_aes256gcm_decrypt(m, &len, nullptr, ciphertext.data(), ciphertext.size(),
+                                            ad, aad.size(), nonce.data() + kGcmNonceOffset,
+                                            key.data()) == 0
+            : crypto_aead_xchacha20poly1305_ietf_decrypt(m, &len, nullptr, ciphertext.data(),
+                                                         ciphertext.size(), ad, aad.size(),
+                                                         nonce.data(), key.data()) == 0;
+    sodium_memzero(key.data(), key.size());
+    if (!ok) {
+        open_failures.inc();
+        return std::nullopt;
+    }
+    plaintext.resize(len);
+
+    std::lock_guard lock(mutex_);
+    if (auto it = sessions_.find(id); it != sessions_.end()) {
+        it->second.confirmed = true;            // they hold the keys: ours to send on too
+    }
+    return plaintext;
+}
+
+bool PeerSessions::current(const std::string& peer, std::span<const uint8_t> nonce) const {
+    if (nonce.size() != kNonceSize) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end()) {
+        return false;
+    }
+    const Id* id = tx_locked(found->second, Clock::now());
+    return id && std::equal(id->begin(), id->end(), nonce.begin());
+}
+
+std::optional<PeerSessions::Aead> PeerSessions::aead(const std::string& peer) const {
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end()) {
+        return std::nullopt;
+    }
+    const Id* id = tx_locked(found->second, Clock::now());
+    if (!id) {
+        return std::nullopt;
+    }
+    return sessions_.at(*id).aead;
+}
+
+void PeerSessions::forget(const std::string& peer) {
+    std::lock_guard lock(mutex_);
+    auto found = peers_.find(peer);
+    if (found == peers_.end()) {
+        return;
+    }
+    for (const auto ids = found->second.sessions; const auto& id : ids) {
+        drop_locked(id);
+    }
+    if (found->second.pending) {
+        free_slot_locked(found->second.pending->slot);
+    }
+    peers_.erase(found);
+}
+
+std::size_t PeerSessions::size() const {
+    std::lock_guard lock(mutex_);
+    return sessions_.size();
+}
@@ -0,0 +1,36 @@
+/**
+ * SecureArena — guard-paged, page-locked storage for secret keys.
+ */
+
+#include "crypto/secure_arena.h"
+
+#include <new>
+
+#include <sodium.h>
+
+// sodium_malloc puts the region's end against the trailing guard page, so
+// only a size that is a multiple of kAlign keeps its start aligned too.
+SecureArena::SecureArena(std::size_t size) : size_(align(size)) {
+    // sodium_malloc needs the page size sodium_init() records.
+    if (sodium_init() < 0) {
+        throw std::bad_alloc();
+    }
+    base_ = static_cast<uint8_t*>(sodium_malloc(size_ == 0 ? 1 : size_));
+    if (!base_) {
+        throw std::bad_alloc();
+    }
+    sodium_memzero(base_, size_);
+}
+
+SecureArena::~SecureArena() {
+    sodium_free(base_);
+}
+
+std::span<uint8_t> SecureArena::take(std::size_t n) {
+    if (align(n) > size_ - used_) {
+        throw std::bad_alloc();
+    }
+    std::span<uint8_t> part(base_ + used_, n);
+    used_ += align(n);
+    return part;
+}
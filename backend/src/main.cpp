@@ -2,64 +2,560 @@
  * secure-p2p-chat — Backend Entry Point
  *
  * Initialises the node: loads config, generates/loads key pair,
- * starts the local REST API (for the Python UI), the peer listener,
- * and the Supabase heartbeat loop.
+ * starts the local REST API and WebSocket event feed (for the UI), the
+ * peer listener, and the Supabase heartbeat loop.
+ *
+ * A config with a `nodes` list instead hosts several identities in one
+ * process (ARCHITECTURE.md §7.1.2): one thread pool, one set of crypto
+ * workers, one Supabase transport and one peer listener between them.
+ *
+ * Only local work (config, keys and the database, the latter two in
+ * parallel) happens before the event loop runs. Supabase registration and
+ * the offline drain follow in the background, so the API is up within
+ * milliseconds rather than after several HTTPS round trips.
  */
 
-#include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <asio.hpp>
 #include <nlohmann/json.hpp>
+#include <spdlog/sinks/stdout_color_sinks.h>
 #include <spdlog/spdlog.h>
 
-// TODO: Uncomment as you implement each module
-// #include "node/node.h"
-// #include "crypto/crypto_manager.h"
-// #include "network/peer_server.h"
-// #include "api/local_api.h"
-// #include "supabase/supabase_client.h"
+#include "api/local_api.h"
+#include "api/ui_event_ring.h"
+#include "api/ws_event_server.h"
+#include "config/live_config.h"
+#include "network/backpressure.h"
+#include "network/cpu_affinity.h"
+#include "network/dns_cache.h"
+#include "network/huge_pages.h"
+#include "network/io_context_pool.h"
+#include "network/peer_server.h"
+#include "node/event_bus.h"
+#include "node/node.h"
+#include "storage/history_file.h"
+#include "telemetry/logging.h"
+#include "telemetry/memory.h"
+#include "telemetry/watchdog.h"
 
 using json = nlohmann::json;
 
-static json load_config(const std::string& path) {
-    std::ifstream file(path);
-    if (!file.is_open()) {
-        spdlog::error("Cannot open config file: {}", path);
-        std::exit(1);
+// Settings a reload applies without a restart; see Node::apply_config and
+// logging::apply. Anything else that changes is only logged.
+constexpr std::string_view kReloadable[] = {
+    "logging.level", "logging.trace_messages", "logging.trace_sample_every",
+    "logging.capture_file", "logging.capture_max_mib",
+    "supabase.url", "supabase.anon_key",
+    "database.commit_window_ms", "database.commit_batch", "database.history_cache_bytes",
+    "node.heartbeat_interval", "node.heartbeat_max_interval",
+    "node.max_clock_skew", "node.compress_min_bytes",
+    "node.presence_interval", "node.presence_timeout", "node.presence_max_probe_interval",
+    "node.peer_cache_ttl", "node.peer_cache_negative_ttl",
+    "node.max_peer_connections", "node.max_connections_per_ip",
+    "node.ip_frames_per_sec", "node.ip_frame_burst",
+    "node.peer_frames_per_sec", "node.peer_frame_burst",
+    "relay.max_clients", "relay.bytes_per_sec", "relay.client_bytes_per_sec",
+    "relay.client_queue_bytes",
+};
+
+namespace {
+
+/// `<config> export|import <file>`: copy the whole chat history out of the
+/// database or into it (storage/history_file.h), then exit. "-" is
+/// stdout / stdin, so a history can be piped straight to another machine.
+int transfer_history(const json& config, std::string_view command, const std::string& path) {
+    auto options = Node::store_options(config);
+    options.archive_after = std::chrono::hours(0);  // no archive pass under our feet
+    MessageStore store(options);
+    if (!store.open()) {
+        return 1;
     }
-    return json::parse(file);
+    const bool ok = command == "export" ? history_file::export_to(store, path)
+                                        : history_file::import_from(store, path);
+    store.close();
+    return ok ? 0 : 1;
 }
 
-int main(int argc, char* argv[]) {
-    spdlog::set_level(spdlog::level::info);
-    spdlog::info("secure-p2p-chat backend starting…");
+/// A host config's `nodes`, each a node config or the path of one, with
+/// `defaults` merged under it. Every node listens on the host's port.
+/// Nullopt (logged) if one can't be loaded or two share a username.
+std::optional<std::vector<json>> host_node_configs(const json& host, uint16_t listen_port) {
+    const json defaults = host.value("defaults", json::object());
+    std::vector<json> configs;
+    std::unordered_map<std::string, std::size_t> usernames;
+    for (const auto& entry : host["nodes"]) {
+        std::optional<json> own = entry.is_string() ? LiveConfig::load(entry.get<std::string>())
+                                                    : std::optional<json>(entry);
+        if (!own || !own->is_object()) {
+            spdlog::error("Node {} of the host config is not a config", configs.size());
+            return std::nullopt;
+        }
+        json config = defaults;
+        config.merge_patch(*own);
+        const std::string username = config.value("node", json::object()).value("username", "");
+        if (username.empty() || !usernames.emplace(username, configs.size()).second) {
+            spdlog::error("Node {} of the host config has no username, or a duplicate one ('{}')",
+                          configs.size(), username);
+            return std::nullopt;
+        }
+        config["node"]["listen_port"] = listen_port;
+        configs.push_back(std::move(config));
+    }
+    if (configs.empty()) {
+        spdlog::error("The host config lists no nodes");
+        return std::nullopt;
+    }
+    return configs;
+}
+
+/// The UI side of one node: REST API, WebSocket events and the optional
+/// shared-memory ring, fed from the node through an event bus. In
+/// `headless` mode (a host's nodes) each is off unless its config asks for
+/// it, and a node without any raises no events at all.
+class Frontend {
+public:
+    Frontend(IoContextPool& pool, const json& node_cfg, bool headless) : pool_(pool) {
+        const uint16_t default_api = headless ? 0 : 8080;
+        const uint16_t default_ws = headless ? 0 : 8081;
+        api_port_ = node_cfg.value("api_port", default_api);
+        ws_port_ = node_cfg.value("ws_port", default_ws);
+        api_socket_ = node_cfg.value("api_socket", "");
+        ws_socket_ = node_cfg.value("ws_socket", "");
+        if (api_port_ != 0 || !api_socket_.empty()) {
+            api_ = std::make_unique<LocalAPI>(pool, api_port_);
+            api_->set_poll_options(
+                {std::chrono::milliseconds(node_cfg.value("poll_min_ms", 1000)),
+                 std::chrono::milliseconds(node_cfg.value("poll_max_ms", 30000))});
+        }
+        if (ws_port_ != 0 || !ws_socket_.empty()) {
+            events_ = std::make_unique<WsEventServer>(
+                pool, ws_port_,
+                node_cfg.value("ws_allowed_origins",
+                               std::vector<std::string>{"tauri://localhost",
+                                                        "http://tauri.localhost",
+                                                        "https://tauri.localhost",
+                                                        "http://localhost:1420",
+                                                        "http://127.0.0.1:1420"}));
+            events_->set_sync_bytes(
+                node_cfg.value("ui_sync_bytes", EventJournal::kDefaultMaxBytes));
+        }
+        // Optional shared-memory copy of the event stream for a local UI.
+        if (const std::string ring = node_cfg.value("ui_ring", ""); !ring.empty()) {
+            ui_ring_ = std::make_unique<UiEventRing>();
+            if (ui_ring_->open(ring, node_cfg.value("ui_ring_bytes", std::size_t{4} << 20))) {
+                spdlog::info("UI events also in shared memory {}", ring);
+            } else {
+                ui_ring_.reset();
+            }
+        }
+    }
+
+    /// Wire the servers to `node` and start them. The event stages and
+    /// WebSocket clients count towards `backpressure` if given.
+    void start(Node& node, Backpressure* backpressure) {
+        // Events reach the UI through the bus, so the thread that raised one
+        // (I/O, DB, crypto or transfer) never serializes or fans it out itself.
+        if (events_) {
+            events_->set_on_client_event([&node](const json& event) {
+                const auto name = event["event"].get<std::string>();
+                try {
+                    const auto& data = event.at("data");
+                    if (name == "typing") {
+                        node.send_typing(data.at("to").get<std::string>(),
+                                         data.at("typing").get<bool>());
+                    } else if (name == "mark_read") {
+                        node.send_read_receipt(data.at("peer").get<std::string>(),
+                                               data.at("msg_id").get<std::string>());
+                    } else {
+                        spdlog::debug("UI event: {}", name);
+                    }
+                } catch (const json::exception&) {
+                    spdlog::debug("Ignoring malformed UI event {}", name);
+                }
+            });
+            ui_events_.subscribe("ws", asio::make_strand(pool_.next()),
+                                 [events = events_.get()](Node::UiEvent& event) {
+                                     events->broadcast(event.name, event.data);
+                                 },
+                                 kEventDepth, backpressure);
+            if (backpressure) {
+                events_->set_backpressure(*backpressure);
+            }
+        }
+        if (api_) {
+            ui_events_.subscribe("api", asio::make_strand(pool_.next()),
+                                 [api = api_.get()](Node::UiEvent& event) {
+                                     api->note_activity();
+                                     if (event.name == "new_message") {
+                                         // Group messages are filed under the group, not the sender.
+                                         api->notify_messages(event.data.value(
+                                             "group_id", event.data.value("from", "")));
+                                     }
+                                 },
+                                 kEventDepth, backpressure);
+        }
+        if (ui_ring_) {
+            ui_events_.subscribe("ring", asio::make_strand(pool_.next()),
+                                 [ring = ui_ring_.get()](Node::UiEvent& event) {
+                                     ring->publish(event.name, event.data);
+                                 },
+                                 kEventDepth, backpressure);
+        }
+        if (events_ || api_ || ui_ring_) {
+            node.set_on_event([this](std::string_view event, const json& data) {
+                ui_events_.publish({std::string(event), data});
+            });
+        }
+
+        if (events_) {
+            // A Unix domain socket alongside (or, with a port of 0, instead
+            // of) the loopback port: lower latency, and nothing to collide
+            // with when several nodes run on one machine.
+            if (!ws_socket_.empty() && events_->listen_unix(ws_socket_)) {
+                spdlog::info("WebSocket events on {} (/events)", ws_socket_);
+            }
+            events_->start();
+            if (ws_port_ != 0) {
+                spdlog::info("WebSocket events on ws://127.0.0.1:{}/events", ws_port_);
+            }
+        }
+        if (api_) {
+            wire_api(node);
+            if (!api_socket_.empty() && api_->listen_unix(api_socket_)) {
+                spdlog::info("REST API listening on {}", api_socket_);
+            }
+            api_->start();
+            if (api_port_ != 0) {
+                spdlog::info("REST API listening on 127.0.0.1:{}", api_port_);
+            }
+        }
+    }
+
+    void stop() {
+        if (api_) api_->stop();
+        if (events_) events_->stop();
+    }
+
+private:
+    static constexpr std::size_t kEventDepth = 1024;
+
+    void wire_api(Node& node) {
+        LocalAPI& api = *api_;
+        api.set_on_send([&node](const std::string& to, const std::string& text,
+                                const std::string& expires_at) {
+            return node.send_message(to, text, expires_at);
+        });
+        api.set_on_delta([&node](const std::string& peer, const std::string& msg_id,
+                                 const std::string& op, const std::string& value) {
+            return node.send_delta(peer, msg_id, op, value);
+        });
+        api.set_on_add_friend([&node](const std::string& username) {
+            return node.add_friend(username);
+        });
+        api.set_on_add_friends([&node](std::vector<std::string> usernames) {
+            return node.add_friends(std::move(usernames));
+        });
+        api.set_on_list_friends([&node] { return node.friends_page(); });
+        api.set_on_history([&node](const std::string& peer, std::size_t limit, std::size_t offset,
+                                   const std::string& before) {
+            return node.history_page(peer, limit, offset, before);
+        });
+        api.set_on_search([&node](const std::string& query, const std::string& peer,
+                                  std::size_t limit) {
+            return node.search_page(query, peer, limit);
+        });
+        api.set_on_messages_since([&node](const std::string& peer, const std::string& since,
+                                          std::size_t limit) {
+            return node.messages_since_page(peer, since, limit);
+        });
+        api.set_on_send_file([&node](const std::string& to, const std::string& path) {
+            return node.send_file(to, path);
+        });
+        api.set_on_accept_file([&node](const std::string& id) { return node.accept_file(id); });
+        api.set_on_cancel_file([&node](const std::string& id) { return node.cancel_file(id); });
+        api.set_on_status([&node] { return node.status_json(); });
+        api.set_on_peers([&node](const std::string& sort, std::size_t limit) {
+            return node.peers_json(sort, limit);
+        });
+        api.set_on_list_groups([&node] { return node.groups_json(); });
+        api.set_on_create_group([&node](const std::string& name,
+                                        const std::vector<std::string>& members) {
+            return node.create_group(name, members);
+        });
+        api.set_on_group_send([&node](const std::string& group_id, const std::string& text) {
+            return node.send_group_message(group_id, text);
+        });
+        // The catch-up journal is kept with the WebSocket stream it resumes.
+        if (events_) {
+            api.set_on_sync([events = events_.get()](const std::string& cursor) {
+                return events->sync(cursor);
+            });
+        }
+    }
+
+    IoContextPool& pool_;
+    uint16_t api_port_ = 0;
+    uint16_t ws_port_ = 0;
+    std::string api_socket_;
+    std::string ws_socket_;
+    std::unique_ptr<LocalAPI> api_;
+    std::unique_ptr<WsEventServer> events_;
+    std::unique_ptr<UiEventRing> ui_ring_;
+    // Between the node and the servers above, so it outlives the node too.
+    Topic<Node::UiEvent> ui_events_;
+};
+
+/// One identity: its UI side, declared first so that the node's DB thread
+/// may still report events to it while the node shuts down.
+struct Hosted {
+    std::unique_ptr<Frontend> frontend;
+    std::unique_ptr<Node> node;
+};
 
+} // namespace
+
+int main(int argc, char* argv[]) {
     std::string config_path = (argc > 1) ? argv[1] : "config.json";
-    json config = load_config(config_path);
+    const std::string_view command = (argc > 2) ? argv[2] : "";
+    if (!command.empty()) {
+        // Logs go to stderr: stdout may be carrying the history.
+        spdlog::set_default_logger(spdlog::stderr_color_mt("history"));
+        if (command != "export" && command != "import" && command != "rotate-keys") {
+            spdlog::error("Unknown command '{}'; usage: {} [config.json] "
+                          "[export|import <file> | rotate-keys]",
+                          command, argv[0]);
+            return 2;
+        }
+    }
+    const auto started = std::chrono::steady_clock::now();
+    auto loaded = LiveConfig::load(config_path);
+    if (!loaded) {
+        return 1;
+    }
+    const json config = std::move(*loaded);
+    const bool host_mode = config.contains("nodes");
+    if (!command.empty()) {
+        if (host_mode) {
+            spdlog::error("export, import and rotate-keys take one node's config, not a host "
+                          "config");
+            return 2;
+        }
+        if (command == "rotate-keys") {
+            return Node::rotate_keys(config) ? 0 : 1;
+        }
+        return transfer_history(config, command, argc > 3 ? argv[3] : "-");
+    }
 
+    // A host's own settings (logging, threads, the peer port) are its
+    // `defaults`, which every node shares too.
+    const json process_config = host_mode ? config.value("defaults", json::object()) : config;
+    if (!process_config.is_object() || (host_mode && !config["nodes"].is_array())) {
+        spdlog::error("A host config needs a `nodes` list and a `defaults` object");
+        return 1;
+    }
+    logging::init(process_config);
+    spdlog::info("secure-p2p-chat backend starting…");
     spdlog::info("Loaded config from {}", config_path);
-    spdlog::info("Username: {}", config["node"]["username"].get<std::string>());
+#if defined(ASIO_HAS_IO_URING) && defined(ASIO_DISABLE_EPOLL)
+    spdlog::info("Sockets and timers on io_uring (P2P_IO_URING)");
+#endif
 
-    // ── Phase 1: Plaintext P2P ──────────────────────────────────────────────
-    // TODO: Initialise ASIO peer server on config["node"]["listen_port"]
-    // TODO: Start local HTTP API on config["node"]["api_port"]
+    const json process_node_cfg = process_config.value("node", json::object());
+    const uint16_t listen_port = process_node_cfg.value("listen_port", Node::kDefaultPeerPort);
+    std::vector<json> configs;
+    if (host_mode) {
+        auto hosted = host_node_configs(config, listen_port);
+        if (!hosted) {
+            return 1;
+        }
+        configs = std::move(*hosted);
+        spdlog::info("Hosting {} nodes", configs.size());
+    } else {
+        spdlog::info("Username: {}", config["node"]["username"].get<std::string>());
+        configs.push_back(config);
+    }
 
-    // ── Phase 2: Supabase Discovery ─────────────────────────────────────────
-    // TODO: Register user in Supabase (username, public_key, IP)
-    // TODO: Start heartbeat loop to update last_seen
+    // io_threads = 1 keeps the single-threaded model; 0 = one per core.
+    IoContextPool pool(process_node_cfg.value("io_threads", 1),
+                       IoContextPool::parse_mode(process_node_cfg.value("io_mode", "per_core")));
+    pool.set_cpus(cpu_affinity::from_config("node.io_cpus", process_node_cfg.value("io_cpus", "")));
+    // Before any client looks a name up.
+    DnsCache::Options dns;
+    dns.ttl = std::chrono::seconds(std::max(1, process_node_cfg.value("dns_ttl", 300)));
+    dns.negative_ttl =
+        std::chrono::seconds(std::max(1, process_node_cfg.value("dns_negative_ttl", 30)));
+    DnsCache::shared().set_options(dns);
 
-    // ── Phase 3: Encryption ─────────────────────────────────────────────────
-    // TODO: Generate or load X25519 + Ed25519 key pair
-    // TODO: Encrypt outgoing messages, verify incoming signatures
+    // A host's nodes share the crypto workers, the Supabase transport and
+    // their links to other hosts; a lone node builds its own.
+    Node::Shared shared;
+    // Queues that peer frames fill pause the peer reads that fill them.
+    std::shared_ptr<Backpressure> backpressure;
+    if (process_node_cfg.value("backpressure", true)) {
+        backpressure = std::make_shared<Backpressure>(Backpressure::Options{
+            std::chrono::milliseconds(process_node_cfg.value("backpressure_max_pause_ms", 2000))});
+        shared.backpressure = backpressure;
+    }
+    if (host_mode) {
+        shared.crypto_workers = std::make_shared<CryptoWorkers>(
+            pool.main().get_executor(), Node::crypto_worker_options(process_config));
+        shared.supabase = SupabaseClient::make_transport(&pool.main());
+        if (process_node_cfg.value("peer_mux", true)) {
+            shared.links = std::make_shared<PeerLinks>(Node::link_options(process_config));
+        }
+    }
 
-    // ── Phase 4: Offline Messages ───────────────────────────────────────────
-    // TODO: On startup, fetch & decrypt offline messages from Supabase
-    // TODO: On send failure, push encrypted message to Supabase
+    // Identity (keys.json) and local database, loaded in parallel; Supabase
+    // client and peer directory.
+    std::vector<Hosted> nodes;
+    nodes.reserve(configs.size());
+    for (const auto& node_config : configs) {
+        Hosted hosted;
+        hosted.frontend = std::make_unique<Frontend>(pool, node_config["node"], host_mode);
+        hosted.node = std::make_unique<Node>(node_config, pool.main(), shared);
+        hosted.frontend->start(*hosted.node, backpressure.get());
+        nodes.push_back(std::move(hosted));
+    }
+    shared = {};
 
-    spdlog::info("Backend ready. Press Ctrl+C to exit.");
+    // ── Peer listener ───────────────────────────────────────────────────────
+    // Shared by a host's nodes: a frame goes to the node it is addressed
+    // to. One addressed to none of them (a group message, addressed to the
+    // group, or a hello) goes to all, and each drops what isn't theirs.
+    std::unordered_map<std::string, Node*> by_username;
+    for (auto& hosted : nodes) {
+        by_username.emplace(hosted.node->username(), hosted.node.get());
+    }
+    PeerServer::Listen listen;
+    listen.reuse_port = process_node_cfg.value("listen_reuse_port", false);
+    listen.acceptors = process_node_cfg.value("listen_acceptors", std::size_t{0});
+    PeerServer peer_server(pool, listen_port, listen);
+    if (nodes.size() == 1) {
+        peer_server.set_on_message([&node = *nodes.front().node](const std::string& remote,
+                                                                 std::string_view frame) {
+            node.on_direct_frame(remote, frame);
+        });
+    } else {
+        peer_server.set_on_message([&nodes, &by_username](const std::string& remote,
+                                                          std::string_view frame) {
+            const auto to = envelope::recipient(frame);
+            if (!to) {
+                spdlog::debug("Malformed frame from {}", remote);
+                return;
+            }
+            if (const auto it = by_username.find(*to); it != by_username.end()) {
+                it->second->on_direct_frame(remote, frame);
+                return;
+            }
+            for (auto& hosted : nodes) {
+                hosted.node->on_direct_frame(remote, frame);
+            }
+        });
+    }
+    // The listener's connection caps are the first node's; only one node
+    // can serve as a relay on it.
+    RelayHub* relay_hub = nullptr;
+    for (auto& hosted : nodes) {
+        if (RelayHub* hub = hosted.node->relay_hub(); hub && !relay_hub) {
+            relay_hub = hub;
+        } else if (hub) {
+            spdlog::warn("{} also has relay.enabled; only {} relays on the shared port",
+                         hosted.node->username(), nodes.front().node->username());
+        }
+    }
+    peer_server.set_relay_hub(relay_hub);
+    peer_server.set_admission(nodes.front().node->admission());
+    peer_server.set_backpressure(backpressure);
+    // Before the pool hands out its first block or buffer.
+    huge_pages::start(process_node_cfg.value("huge_pages_mb", std::size_t{0}) << 20);
+    peer_server.set_pool_idle(process_node_cfg.value("session_pool_idle", std::size_t{256}));
+    peer_server.start();
+    spdlog::info("Peer server listening on :{}", listen_port);
+
+    // ── Supabase discovery + offline queue ──────────────────────────────────
+    // In the background: the API answers as soon as the pool runs, and the
+    // UI follows these round trips through `startup` events.
+    for (auto& hosted : nodes) {
+        Node& node = *hosted.node;
+        node.start_udp();
+        node.start_lan();
+        node.start_sync();
+        node.start_mailbox();
+        node.start_heartbeat();
+        node.start_presence();
+        node.start_relay();
+        node.start_device_sync();
+    }
 
-    // Keep the process alive (will be replaced by ASIO io_context.run())
-    std::cin.get();
+    // ── Config hot reload ───────────────────────────────────────────────────
+    // A lone node's only: a host's nodes keep the config they started with.
+    std::unique_ptr<LiveConfig> live_config;
+    if (!host_mode) {
+        live_config = std::make_unique<LiveConfig>(config_path, config);
+        live_config->on_change([&node = *nodes.front().node](const json& now, const json& before) {
+            logging::apply(now);
+            node.apply_config(now);
+            for (const auto& key : LiveConfig::changed_keys(now, before)) {
+                if (std::find(std::begin(kReloadable), std::end(kReloadable), key) ==
+                    std::end(kReloadable)) {
+                    spdlog::warn("Config change to {} takes effect after a restart", key);
+                }
+            }
+        });
+        live_config->start();
+    }
+
+    // Shutdown stops accepting first, then drains: queued frames are
+    // written and acks awaited up to `node.drain_timeout_ms`, with the pool
+    // still running to carry them, before the nodes stop.
+    const auto drain_timeout =
+        std::chrono::milliseconds(process_node_cfg.value("drain_timeout_ms", 5000));
+    std::thread drainer;
+    asio::signal_set signals(pool.main(), SIGINT, SIGTERM);
+    signals.async_wait([&](const asio::error_code&, int) {
+        spdlog::info("Shutting down…");
+        if (live_config) {
+            live_config->stop();
+        }
+        watchdog::stop();
+        memory::stop();
+        for (auto& hosted : nodes) {
+            hosted.frontend->stop();
+        }
+        peer_server.stop();
+        drainer = std::thread([&] {
+            const auto deadline = std::chrono::steady_clock::now() + drain_timeout;
+            for (auto& hosted : nodes) {
+                hosted.node->drain(deadline);
+            }
+            asio::post(pool.main(), [&] {
+                for (auto& hosted : nodes) {
+                    hosted.node->stop();
+                }
+                pool.stop();
+            });
+        });
+    });
+
+    watchdog::start(watchdog::options(process_config));
+    memory::start(memory::options(process_config));
+
+    spdlog::info("Backend ready in {} ms. Press Ctrl+C to exit.",
+                 std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::chrono::steady_clock::now() - started).count());
+    pool.run();
+    if (drainer.joinable()) {
+        drainer.join();
+    }
+    logging::shutdown();
     return 0;
 }
@@ -0,0 +1,109 @@
+/**
+ * AdmissionControl — connection caps and per-IP / per-sender frame budgets.
+ */
+
+#include "network/admission.h"
+#include "telemetry/memory.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+
+namespace {
+
+metrics::Counter& rejected_connections =
+    metrics::counter("p2p_admission_connections_rejected_total",
+                     "Inbound peer connections closed at accept: over the total or per-IP cap "
+                     "or the memory budget");
+metrics::Counter& limited_ip_frames =
+    metrics::counter("p2p_admission_ip_frames_dropped_total",
+                     "Peer frames dropped before decoding: their IP was over its rate limit");
+metrics::Counter& limited_sender_frames =
+    metrics::counter("p2p_admission_sender_frames_dropped_total",
+                     "Peer frames dropped before verification: their sender was over its rate limit");
+metrics::Gauge& open_connections =
+    metrics::gauge("p2p_peer_connections", "Open inbound peer connections");
+
+} // namespace
+
+AdmissionControl::AdmissionControl(Options options) : options_(options) {}
+
+void AdmissionControl::set_options(Options options) {
+    std::lock_guard lock(mutex_);
+    options_ = options;
+}
+
+std::size_t AdmissionControl::connections() const {
+    std::lock_guard lock(mutex_);
+    return connections_;
+}
+
+bool AdmissionControl::open_connection(const asio::ip::address& address) {
+    std::lock_guard lock(mutex_);
+    auto it = remotes_.find(address);
+    const std::size_t from_ip = it == remotes_.end() ? 0 : it->second.connections;
+    if ((options_.max_connections && connections_ >= options_.max_connections) ||
+        (options_.max_connections_per_ip && from_ip >= options_.max_connections_per_ip) ||
+        memory::over_budget(memory::Area::PeerSessions)) {
+        rejected_connections.inc();
+        return false;
+    }
+    if (it == remotes_.end()) {
+        it = remotes_.emplace(address, Remote{}).first;
+    }
+    ++it->second.connections;
+    ++connections_;
+    open_connections.set(static_cast<int64_t>(connections_));
+    return true;
+}
+
+void AdmissionControl::close_connection(const asio::ip::address& address) {
+    std::lock_guard lock(mutex_);
+    auto it = remotes_.find(address);
+    if (it == remotes_.end()) {
+        return;
+    }
+    if (--it->second.connections == 0) {
+        remotes_.erase(it);
+    }
+    --connections_;
+    open_connections.set(static_cast<int64_t>(connections_));
+}
+
+bool AdmissionControl::admit_frame(const asio::ip::address& address) {
+    std::lock_guard lock(mutex_);
+    auto it = remotes_.find(address);
+    if (it == remotes_.end()) {
+        return true;                    // not a session we admitted; nothing to charge
+    }
+    if (!it->second.frames.take(1, options_.ip_frames_per_sec, options_.ip_frame_burst,
+                                TokenBucket::Clock::now())) {
+        limited_ip_frames.inc();
+        return false;
+    }
+    return true;
+}
+
+bool AdmissionControl::admit_sender(UserId sender) {
+    std::lock_guard lock(mutex_);
+    if (options_.sender_frames_per_sec <= 0) {
+        return true;
+    }
+    const auto now = TokenBucket::Clock::now();
+    if (senders_.size() >= prune_at_ && !senders_.contains(sender)) {
+        prune_senders_locked(now);
+    }
+    if (!senders_[sender].take(1, options_.sender_frames_per_sec,
+                                 options_.sender_frame_burst, now)) {
+        limited_sender_frames.inc();
+        return false;
+    }
+    return true;
+}
+
+void AdmissionControl::prune_senders_locked(TokenBucket::Clock::time_point now) {
+    std::erase_if(senders_, [&](const auto& entry) {
+        return entry.second.full(options_.sender_frames_per_sec, options_.sender_frame_burst, now);
+    });
+    // If most are still busy, don't scan again before the table doubles.
+    prune_at_ = std::max(kMinPruneAt, senders_.size() * 2);
+}
@@ -0,0 +1,90 @@
+/**
+ * Backpressure — water marks on the queues behind peer reads.
+ */
+
+#include "network/backpressure.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Gauge& paused_gauge =
+    metrics::gauge("p2p_backpressure_paused", "1 while peer reads wait for a queue to drain");
+metrics::Counter& pauses =
+    metrics::counter("p2p_backpressure_pauses_total", "Times peer reads were paused");
+
+} // namespace
+
+void Backpressure::Level::add(std::ptrdiff_t n) {
+    const std::size_t depth = depth_.fetch_add(static_cast<std::size_t>(n),
+                                               std::memory_order_relaxed) +
+                              static_cast<std::size_t>(n);
+    // Each crossing is recounted after the flag flips, so two threads
+    // crossing opposite ways at once can't leave the flag wrong.
+    if (depth >= high_) {
+        if (!over_.exchange(true)) {
+            owner_.on_over(*this);
+            if (this->depth() <= low_ && over_.exchange(false)) {
+                owner_.on_under();
+            }
+        }
+    } else if (depth <= low_) {
+        if (over_.exchange(false)) {
+            owner_.on_under();
+            if (this->depth() >= high_ && !over_.exchange(true)) {
+                owner_.on_over(*this);
+            }
+        }
+    }
+}
+
+Backpressure::Backpressure(Options options) : options_(options) {}
+
+Backpressure::Level& Backpressure::level(std::string name, std::size_t high, std::size_t low) {
+    std::lock_guard lock(mutex_);
+    levels_.push_back(std::unique_ptr<Level>(
+        new Level(*this, std::move(name), std::max<std::size_t>(high, 1), std::min(low, high))));
+    return *levels_.back();
+}
+
+void Backpressure::on_over(const Level& level) {
+    if (over_.fetch_add(1, std::memory_order_acq_rel) == 0) {
+        paused_gauge.set(1);
+        pauses.inc();
+        spdlog::debug("Pausing peer reads: {} is {} deep", level.name_, level.depth());
+    }
+}
+
+void Backpressure::on_under() {
+    if (over_.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+    paused_gauge.set(0);
+    std::lock_guard lock(mutex_);
+    for (auto& timer : waiters_) {
+        asio::post(timer->get_executor(), [timer] { timer->cancel(); });
+    }
+    waiters_.clear();
+}
+
+asio::awaitable<void> Backpressure::wait() {
+    if (!paused()) {
+        co_return;
+    }
+    auto timer = std::make_shared<asio::steady_timer>(co_await asio::this_coro::executor,
+                                                      options_.max_pause);
+    {
+        std::lock_guard lock(mutex_);
+        waiters_.push_back(timer);
+    }
+    // A resume between the check above and the push has nobody to wake.
+    if (paused()) {
+        asio::error_code ec;
+        co_await timer->async_wait(asio::redirect_error(asio::use_awaitable, ec));
+    }
+    std::lock_guard lock(mutex_);
+    std::erase(waiters_, timer);
+}
@@ -0,0 +1,142 @@
+/**
+ * compression — zstd with a shared dictionary for message plaintexts.
+ *
+ * The dictionaries are digested once per process (ZSTD_CDict / ZSTD_DDict
+ * are read-only and shared by every thread) and each thread keeps its own
+ * context, so a call allocates nothing but its output.
+ */
+
+#include "network/compression.h"
+
+#ifdef P2P_HAVE_ZSTD
+#include <memory>
+#include <zstd.h>
+#endif
+
+namespace {
+
+#ifdef P2P_HAVE_ZSTD
+
+constexpr int kLevel = 3;
+
+// Raw-content dictionary; zstd finds matches near the end most cheaply, so
+// the payload skeleton (keys in nlohmann's sorted order) comes last. Part
+// of the wire format: see compression.h before editing.
+constexpr std::string_view kDictionary =
+    "the and you that have for not with this but what are was can just will "
+    "yes no ok okay thanks thank you please sorry lol haha hey hi hello bye "
+    "good morning night today tomorrow tonight later soon now when where why "
+    "how about going to be I'm I'll I think I don't know do you want let me "
+    "see https:// http://www. .com github error warning failed exception "
+    "return const std::string void int auto if (nullptr) { } for while "
+    "function def import from class self true false null undefined "
+    "\n    \n        \n\n```\n"
+    "{\"msg_id\":\"00000000-0000-4000-8000-000000000000\",\"text\":\"\","
+    "\"timestamp\":\"2026-01-01T00:00:00Z\"}"
+    "{\"msg_id\":\"\",\"text\":\"";
+
+const ZSTD_CDict* shared_cdict() {
+    static ZSTD_CDict* const dict =
+        ZSTD_createCDict(kDictionary.data(), kDictionary.size(), kLevel);
+    return dict;
+}
+
+const ZSTD_DDict* shared_ddict() {
+    static ZSTD_DDict* const dict = ZSTD_createDDict(kDictionary.data(), kDictionary.size());
+    return dict;
+}
+
+ZSTD_CCtx* thread_cctx() {
+    thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> ctx(ZSTD_createCCtx(),
+                                                                          &ZSTD_freeCCtx);
+    return ctx.get();
+}
+
+ZSTD_DCtx* thread_dctx() {
+    thread_local std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> ctx(ZSTD_createDCtx(),
+                                                                          &ZSTD_freeDCtx);
+    return ctx.get();
+}
+
+#endif
+
+} // namespace
+
+namespace compression {
+
+bool available() {
+#ifdef P2P_HAVE_ZSTD
+    return shared_cdict() && shared_ddict();
+#else
+    return false;
+#endif
+}
+
+std::optional<std::string> compress(std::string_view plaintext, std::size_t min_size) {
+#ifdef P2P_HAVE_ZSTD
+    auto* ctx = thread_cctx();
+    if (plaintext.size() < min_size || !ctx || !shared_cdict()) {
+        return std::nullopt;
+    }
+    std::string out(ZSTD_compressBound(plaintext.size()), '\0');
+    const std::size_t n = ZSTD_compress_usingCDict(ctx, out.data(), out.size(), plaintext.data(),
+                                                   plaintext.size(), shared_cdict());
+    if (ZSTD_isError(n) || n >= plaintext.size()) {
+        return std::nullopt;
+    }
+    out.resize(n);
+    return out;
+#else
+    (void)plaintext;
+    (void)min_size;
+    return std::nullopt;
+#endif
+}
+
+std::optional<std::string> decompress(std::string_view data) {
+#ifdef P2P_HAVE_ZSTD
+    auto* ctx = thread_dctx();
+    if (!ctx || !shared_ddict()) {
+        return std::nullopt;
+    }
+    // The frame header carries the size, so the output is allocated once
+    // and checked against the cap before any work is done.
+    const unsigned long long size = ZSTD_getFrameContentSize(data.data(), data.size());
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN ||
+        size > kMaxDecompressedSize) {
+        return std::nullopt;
+    }
+    std::string out(static_cast<std::size_t>(size), '\0');
+    const std::size_t n = ZSTD_decompress_usingDDict(ctx, out.data(), out.size(), data.data(),
+                                                     data.size(), shared_ddict());
+    if (ZSTD_isError(n) || n != out.size()) {
+        return std::nullopt;
+    }
+    return out;
+#else
+    (void)data;
+    return std::nullopt;
+#endif
+}
+
+std::optional<std::string> compress_standalone(std::string_view data) {
+#ifdef P2P_HAVE_ZSTD
+    auto* ctx = thread_cctx();
+    if (!ctx) {
+        return std::nullopt;
+    }
+    std::string out(ZSTD_compressBound(data.size()), '\0');
+    const std::size_t n = ZSTD_compressCCtx(ctx, out.data(), out.size(), data.data(), data.size(),
+                                            kLevel);
+    if (ZSTD_isError(n) || n >= data.size()) {
+        return std::nullopt;
+    }
+    out.resize(n);
+    return out;
+#else
+    (void)data;
+    return std::nullopt;
+#endif
+}
+
+} // namespace compression
@@ -0,0 +1,192 @@
+/**
+ * cpu_affinity — CPU lists, NUMA nodes and thread pinning from sysfs.
+ */
+
+#include "network/cpu_affinity.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <spdlog/spdlog.h>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpu_affinity {
+namespace {
+
+constexpr unsigned kMaxCpus = 4096;
+
+/// Add the CPUs of a Linux CPU list ("0-3,8") to `out`; false if malformed.
+bool parse_list(std::string_view list, std::set<unsigned>& out) {
+    auto number = [](std::string_view& s, unsigned& value) {
+        std::size_t i = 0;
+        value = 0;
+        for (; i < s.size() && s[i] >= '0' && s[i] <= '9' && i < 5; ++i) {
+            value = value * 10 + static_cast<unsigned>(s[i] - '0');
+        }
+        s.remove_prefix(i);
+        return i > 0;
+    };
+    while (!list.empty()) {
+        const std::size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        unsigned first = 0, last = 0;
+        if (!number(item, first)) {
+            return false;
+        }
+        last = first;
+        if (!item.empty() && item.front() == '-') {
+            item.remove_prefix(1);
+            if (!number(item, last) || last < first) {
+                return false;
+            }
+        }
+        if (!item.empty() || last >= kMaxCpus) {
+            return false;
+        }
+        for (unsigned cpu = first; cpu <= last; ++cpu) {
+            out.insert(cpu);
+        }
+    }
+    return true;
+}
+
+/// The first line of a sysfs file, without its newline; empty if unreadable.
+std::string read_line(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+std::vector<unsigned> detect_allowed() {
+    std::vector<unsigned> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpus.empty()) {
+        const unsigned n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+} // namespace
+
+const std::vector<unsigned>& allowed() {
+    static const std::vector<unsigned> cpus = detect_allowed();
+    return cpus;
+}
+
+std::optional<std::vector<unsigned>> parse(std::string_view spec) {
+    std::set<unsigned> cpus;
+    while (!spec.empty()) {
+        const std::size_t comma = spec.find(',');
+        const std::string_view item = spec.substr(0, comma);
+        spec = comma == std::string_view::npos ? std::string_view() : spec.substr(comma + 1);
+        if (item.starts_with("node:")) {
+            const std::string_view node = item.substr(5);
+            if (node.empty() || node.size() > 4 ||
+                !std::all_of(node.begin(), node.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+                return std::nullopt;
+            }
+            const std::string list =
+                read_line("/sys/devices/system/node/node" + std::string(node) + "/cpulist");
+            if (list.empty() || !parse_list(list, cpus)) {
+                return std::nullopt;
+            }
+        } else if (!parse_list(item, cpus)) {
+            return std::nullopt;
+        }
+    }
+    const auto& usable = allowed();
+    std::vector<unsigned> out;
+    std::ranges::set_intersection(cpus, usable, std::back_inserter(out));
+    return out;
+}
+
+std::vector<unsigned> one_per_core(const std::vector<unsigned>& cpus) {
+    std::vector<unsigned> out;
+    std::set<unsigned> taken;               // cpus whose core already has a member in `out`
+    for (const unsigned cpu : cpus) {
+        if (taken.count(cpu)) {
+            continue;
+        }
+        out.push_back(cpu);
+        std::set<unsigned> siblings;
+        if (parse_list(read_line("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                                 "/topology/thread_siblings_list"),
+                       siblings)) {
+            taken.insert(siblings.begin(), siblings.end());
+        }
+    }
+    return out;
+}
+
+bool pin_current(std::span<const unsigned> cpus) {
+    allowed();      // remember the unpinned set first
+    if (cpus.empty()) {
+        return false;
+    }
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const unsigned cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if (const int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set); rc != 0) {
+        spdlog::warn("Cannot pin a thread to {} CPU(s) from {}: error {}", cpus.size(),
+                     cpus.front(), rc);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void unpin_current() {
+#if defined(__linux__)
+    const auto& cpus = allowed();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const unsigned cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+std::vector<unsigned> from_config(std::string_view key, std::string_view spec) {
+    auto cpus = parse(spec);
+    if (!cpus) {
+        spdlog::warn("Ignoring {} '{}': not a CPU list", key, spec);
+        return {};
+    }
+    if (cpus->empty() && !spec.empty()) {
+        spdlog::warn("Ignoring {} '{}': none of those CPUs is available", key, spec);
+    }
+    return std::move(*cpus);
+}
+
+} // namespace cpu_affinity
@@ -0,0 +1,187 @@
+/**
+ * DnsCache — async name resolution with TTL, negative caching and refresh
+ * ahead of expiry.
+ */
+
+#include "network/dns_cache.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Counter& resolutions =
+    metrics::counter("p2p_dns_resolutions_total", "Host names resolved, refreshes included");
+metrics::Counter& misses =
+    metrics::counter("p2p_dns_cache_misses_total", "Host name lookups with nothing cached to serve");
+
+} // namespace
+
+DnsCache& DnsCache::shared() {
+    static DnsCache cache{Options{}};
+    return cache;
+}
+
+DnsCache::DnsCache(Options options)
+    : work_(asio::make_work_guard(io_)), resolver_(io_), options_(options),
+      thread_([this] { io_.run(); }) {}
+
+DnsCache::~DnsCache() {
+    work_.reset();
+    io_.stop();
+}
+
+void DnsCache::set_options(const Options& options) {
+    std::lock_guard lock(mutex_);
+    options_ = options;
+}
+
+bool DnsCache::is_hostname(std::string_view host) {
+    if (host.empty() || host.size() > 253 || host.front() == '.' || host.front() == '-') {
+        return false;
+    }
+    bool letter = false;                        // all digits and dots is a bad IPv4
+    for (const char c : host) {
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '-') {
+            letter = true;
+        } else if (!(c >= '0' && c <= '9') && c != '.') {
+            return false;
+        }
+    }
+    return letter;
+}
+
+std::optional<DnsCache::Addresses> DnsCache::lookup(const std::string& host) {
+    asio::error_code ec;
+    if (const auto address = asio::ip::make_address(host, ec); !ec) {
+        return Addresses{address};
+    }
+    std::lock_guard lock(mutex_);
+    const auto now = Clock::now();
+    auto [it, fresh] = entries_.try_emplace(host);
+    it->second.used = now;
+    if (auto served = serve_locked(host, it->second, now)) {
+        return served;
+    }
+    misses.inc();
+    if (fresh) {
+        trim_locked();
+    }
+    return std::nullopt;
+}
+
+void DnsCache::resolve(const std::string& host, Callback done) {
+    std::optional<Addresses> served;
+    {
+        asio::error_code ec;
+        if (const auto address = asio::ip::make_address(host, ec); !ec) {
+            served = Addresses{address};
+        } else {
+            std::lock_guard lock(mutex_);
+            const auto now = Clock::now();
+            auto [it, fresh] = entries_.try_emplace(host);
+            it->second.used = now;
+            served = serve_locked(host, it->second, now);
+            if (!served) {
+                misses.inc();
+                it->second.waiters.push_back(std::move(done));
+                if (fresh) {
+                    trim_locked();
+                }
+                return;
+            }
+        }
+    }
+    done(*served);
+}
+
+std::optional<DnsCache::Addresses> DnsCache::serve_locked(const std::string& host, Entry& entry,
+                                                          Clock::time_point now) {
+    const bool known = entry.expires != Clock::time_point{};
+    if (!entry.resolving && (!known || now >= entry.refresh_at)) {
+        start_locked(host, entry);
+    }
+    if (!known) {
+        return std::nullopt;
+    }
+    if (now < entry.expires) {
+        return entry.addresses;                 // empty for a negative entry
+    }
+    if (!entry.addresses.empty() && now < entry.expires + options_.ttl) {
+        return entry.addresses;                 // stale, while the refresh runs
+    }
+    return std::nullopt;
+}
+
+void DnsCache::start_locked(const std::string& host, Entry& entry) {
+    entry.resolving = true;
+    resolver_.async_resolve(host, "",
+                            [this, host](const asio::error_code& ec,
+                                         asio::ip::tcp::resolver::results_type results) {
+                                finished(host, ec, results);
+                            });
+}
+
+void DnsCache::finished(const std::string& host, const asio::error_code& ec,
+                        const asio::ip::tcp::resolver::results_type& results) {
+    resolutions.inc();
+    Addresses addresses;
+    if (!ec) {
+        for (const auto& result : results) {
+            const auto address = result.endpoint().address();
+            if (std::ranges::find(addresses, address) == addresses.end()) {
+                addresses.push_back(address);
+            }
+        }
+    }
+
+    std::vector<Callback> waiters;
+    Addresses served;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(host);
+        if (it == entries_.end()) {
+            return;                             // trimmed meanwhile
+        }
+        Entry& entry = it->second;
+        const auto now = Clock::now();
+        entry.resolving = false;
+        if (!addresses.empty()) {
+            entry.addresses = std::move(addresses);
+            entry.expires = now + options_.ttl;
+            entry.refresh_at = entry.expires - options_.ttl / 5;
+        } else if (!entry.addresses.empty() && now < entry.expires + options_.ttl) {
+            // Keep serving the old answer; try again in a while.
+            spdlog::debug("Could not refresh {}: {}", host, ec ? ec.message() : "no addresses");
+            entry.refresh_at = now + options_.negative_ttl;
+        } else {
+            spdlog::warn("Could not resolve {}: {}", host, ec ? ec.message() : "no addresses");
+            entry.addresses.clear();
+            entry.expires = now + options_.negative_ttl;
+            entry.refresh_at = entry.expires;
+        }
+        waiters.swap(entry.waiters);
+        served = entry.addresses;
+    }
+    for (auto& waiter : waiters) {
+        waiter(served);
+    }
+}
+
+void DnsCache::trim_locked() {
+    while (entries_.size() > options_.max_hosts) {
+        auto oldest = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (!it->second.resolving && (oldest == entries_.end() ||
+                                          it->second.used < oldest->second.used)) {
+                oldest = it;
+            }
+        }
+        if (oldest == entries_.end()) {
+            return;                             // all in flight
+        }
+        entries_.erase(oldest);
+    }
+}
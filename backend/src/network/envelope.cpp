@@ -0,0 +1,389 @@
+/**
+ * Envelope codecs — JSON (base64 fields) and binary v1.
+ *
+ * The JSON form is the compatibility baseline every peer understands. Both
+ * of its directions are driven by the kJsonFields table and go through
+ * json_fields rather than a json DOM. The binary
+ * form skips base64 and the JSON parse entirely and is used only towards
+ * peers that advertised kCapBinaryV1.
+ */
+
+#include "network/envelope.h"
+#include "crypto/base64.h"
+#include "network/json_fields.h"
+#include "network/timestamp.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <utility>
+
+namespace {
+
+constexpr std::size_t kNonceSize = 24;
+constexpr std::size_t kSignatureSize = 64;
+
+constexpr std::pair<EnvelopeType, std::string_view> kTypeNames[] = {
+    {EnvelopeType::Message,     "message"},
+    {EnvelopeType::Ack,         "ack"},
+    {EnvelopeType::Ping,        "ping"},
+    {EnvelopeType::KeyExchange, "key_exchange"},
+    {EnvelopeType::Hello,       "hello"},
+    {EnvelopeType::FileOffer,   "file_offer"},
+    {EnvelopeType::FileChunk,   "file_chunk"},
+    {EnvelopeType::FileAck,     "file_ack"},
+    {EnvelopeType::FileCancel,  "file_cancel"},
+    {EnvelopeType::GroupKey,    "group_key"},
+    {EnvelopeType::GroupMessage, "group_message"},
+    {EnvelopeType::Session,     "session"},
+    {EnvelopeType::Sync,        "sync"},
+    {EnvelopeType::Signal,      "signal"},
+    {EnvelopeType::KeyUpdate,   "key_update"},
+};
+
+constexpr std::pair<uint32_t, std::string_view> kCapabilityNames[] = {
+    {envelope::kCapBinaryV1, "binary_v1"},
+    {envelope::kCapZstdV1,   "zstd_v1"},
+    {envelope::kCapSignalV1, "signal_v1"},
+    {envelope::kCapAeadV1,   "aead_v1"},
+    {envelope::kCapMailboxPackV1, "mailbox_pack_v1"},
+    {envelope::kCapMuxV1,    "mux_v1"},
+    {envelope::kCapFileShareV1, "file_share_v1"},
+    {envelope::kCapTimingV1, "timing_v1"},
+};
+
+constexpr std::pair<PayloadCompression, std::string_view> kCompressionNames[] = {
+    {PayloadCompression::Zstd, "zstd"},
+};
+
+// Zero for Unknown, and for the undefined values a binary frame can carry.
+constexpr uint32_t type_bit(EnvelopeType type) {
+    return static_cast<uint8_t>(type) < 32 ? 1u << static_cast<uint8_t>(type) : 0;
+}
+
+constexpr uint32_t kAllTypes = ~0u;
+
+/**
+ * One member of the JSON encoding. `text` fields are plain strings; `bytes`
+ * fields are base64 on the wire and omitted when empty. `types` selects the
+ * envelope types whose encoding carries the field; the decoder accepts
+ * every field on every type. `type` and `capabilities` are not listed: they
+ * map to an enum and a bit set rather than to a member, and neither is
+ * `compression`, which is an enum omitted when None.
+ */
+struct JsonField {
+    std::string_view key;
+    std::string Envelope::* text = nullptr;
+    std::vector<uint8_t> Envelope::* bytes = nullptr;
+    uint32_t types = kAllTypes;
+};
+
+constexpr JsonField kJsonFields[] = {
+    {"from",       &Envelope::from},
+    {"to",         &Envelope::to},
+    {"timestamp",  &Envelope::timestamp},
+    {"nonce",      nullptr, &Envelope::nonce},
+    {"ciphertext", nullptr, &Envelope::ciphertext},
+    {"signature",  nullptr, &Envelope::signature},
+    {"ack_msg_id", &Envelope::ack_msg_id, nullptr, type_bit(EnvelopeType::Ack)},
+};
+
+static_assert([] {
+    for (const auto& f : kJsonFields) {
+        if ((f.text == nullptr) == (f.bytes == nullptr)) return false;
+    }
+    return true;
+}(), "each JsonField maps exactly one member");
+
+void put_u32(std::string& out, std::size_t off, uint32_t v) {
+    out[off]     = static_cast<char>((v >> 24) & 0xFF);
+    out[off + 1] = static_cast<char>((v >> 16) & 0xFF);
+    out[off + 2] = static_cast<char>((v >> 8) & 0xFF);
+    out[off + 3] = static_cast<char>(v & 0xFF);
+}
+
+uint32_t get_u32(const uint8_t* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+}
+
+} // namespace
+
+namespace envelope {
+
+const char* type_name(EnvelopeType type) {
+    for (const auto& [t, name] : kTypeNames) {
+        if (t == type) return name.data();
+    }
+    return "unknown";
+}
+
+EnvelopeType type_from_name(std::string_view name) {
+    for (const auto& [t, n] : kTypeNames) {
+        if (n == name) return t;
+    }
+    return EnvelopeType::Unknown;
+}
+
+std::string now_timestamp() {
+    return timestamp::format(static_cast<int64_t>(std::time(nullptr)));
+}
+
+std::string format_timestamp(int64_t seconds) {
+    return timestamp::format(seconds);
+}
+
+std::optional<int64_t> parse_timestamp(const std::string& ts) {
+    return timestamp::parse(ts);
+}
+
+std::string make_hello(const std::string& from, uint32_t capabilities) {
+    Envelope env;
+    env.type = EnvelopeType::Hello;
+    env.from = from;
+    env.timestamp = now_timestamp();
+    env.capabilities = capabilities;
+    return encode_json(env);
+}
+
+std::optional<WireFormat> detect(std::string_view frame) {
+    if (frame.empty()) {
+        return std::nullopt;
+    }
+    if (static_cast<uint8_t>(frame[0]) == kBinaryVersion) {
+        return WireFormat::Binary;
+    }
+    if (frame[0] == '{') {
+        return WireFormat::Json;
+    }
+    return std::nullopt;
+}
+
+std::string encode(const Envelope& env, WireFormat format) {
+    if (format == WireFormat::Binary && env.type != EnvelopeType::Hello) {
+        return encode_binary(env);
+    }
+    return encode_json(env);
+}
+
+std::string encode_json(const Envelope& env) {
+    std::string out;
+    out.reserve(128 + base64::encoded_size(env.nonce.size() + env.ciphertext.size() +
+                                           env.signature.size()));
+    out += "{\"type\":";
+    json_fields::append_string(out, type_name(env.type));
+    for (const auto& field : kJsonFields) {
+        if (!(field.types & type_bit(env.type))) {
+            continue;
+        }
+        if (field.bytes && (env.*field.bytes).empty()) {
+            continue;
+        }
+        out += ",\"";
+        out += field.key;
+        out += "\":";
+        if (field.text) {
+            json_fields::append_string(out, env.*field.text);
+        } else {
+            const auto& raw = env.*field.bytes;
+            const std::size_t at = out.size() + 1;
+            out.resize(at + base64::encoded_size(raw.size()) + 1, '"');
+            base64::encode_to(raw.data(), raw.size(), out.data() + at);
+        }
+    }
+    for (const auto& [c, name] : kCompressionNames) {
+        if (c == env.compression) {
+            out += ",\"compression\":";
+            json_fields::append_string(out, name);
+        }
+    }
+    if (env.type == EnvelopeType::Hello) {
+        out += ",\"capabilities\":[";
+        bool first = true;
+        for (const auto& [bit, name] : kCapabilityNames) {
+            if (env.capabilities & bit) {
+                if (!first) out += ',';
+                json_fields::append_string(out, name);
+                first = false;
+            }
+        }
+        out += ']';
+    }
+    out += '}';
+    return out;
+}
+
+std::string encode_binary(const Envelope& env) {
+    const std::string_view body = env.type == EnvelopeType::Ack
+        ? std::string_view(env.ack_msg_id)
+        : std::string_view(reinterpret_cast<const char*>(env.ciphertext.data()), env.ciphertext.size());
+    const std::size_t from_len = std::min<std::size_t>(env.from.size(), 0xFF);
+    const std::size_t to_len = std::min<std::size_t>(env.to.size(), 0xFF);
+
+    std::string out(kBinaryHeaderSize + from_len + to_len + body.size(), '\0');
+    out[0] = static_cast<char>(kBinaryVersion);
+    out[1] = static_cast<char>(static_cast<uint8_t>(env.type) |
+                               (env.compression == PayloadCompression::Zstd ? kBinaryCompressedFlag : 0));
+    out[2] = static_cast<char>(from_len);
+    out[3] = static_cast<char>(to_len);
+
+    const uint64_t ts = static_cast<uint64_t>(timestamp::parse(env.timestamp).value_or(0));
+    put_u32(out, 4, static_cast<uint32_t>(ts >> 32));
+    put_u32(out, 8, static_cast<uint32_t>(ts));
+
+    if (env.nonce.size() == kNonceSize) {
+        std::memcpy(out.data() + 12, env.nonce.data(), kNonceSize);
+    }
+    if (env.signature.size() == kSignatureSize) {
+        std::memcpy(out.data() + 36, env.signature.data(), kSignatureSize);
+    }
+    put_u32(out, 100, static_cast<uint32_t>(body.size()));
+
+    std::size_t off = kBinaryHeaderSize;
+    std::memcpy(out.data() + off, env.from.data(), from_len);
+    off += from_len;
+    std::memcpy(out.data() + off, env.to.data(), to_len);
+    off += to_len;
+    if (!body.empty()) {
+        std::memcpy(out.data() + off, body.data(), body.size());   // data() may be null
+    }
+    return out;
+}
+
+std::optional<Envelope> decode(std::string_view frame) {
+    std::optional<Envelope> env;
+    switch (detect(frame).value_or(WireFormat::Json)) {
+    case WireFormat::Binary: env = decode_binary(frame); break;
+    case WireFormat::Json:   env = decode_json(frame); break;
+    }
+    if (env) {
+        env->sender = user_id::find(env->from);
+    }
+    return env;
+}
+
+std::optional<std::string> recipient(std::string_view frame) {
+    const auto format = detect(frame);
+    if (format == WireFormat::Binary) {
+        if (frame.size() < kBinaryHeaderSize) {
+            return std::nullopt;
+        }
+        const auto* p = reinterpret_cast<const uint8_t*>(frame.data());
+        const std::size_t from_len = p[2];
+        const std::size_t to_len = p[3];
+        if (frame.size() < kBinaryHeaderSize + from_len + to_len) {
+            return std::nullopt;
+        }
+        return std::string(frame.substr(kBinaryHeaderSize + from_len, to_len));
+    }
+    if (format == WireFormat::Json) {
+        std::string to;
+        const json_fields::Field fields[] = {{"to", &to}};
+        if (json_fields::read(frame, fields)) {
+            return to;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<Envelope> decode_json(std::string_view frame) {
+    // The base64 fields only pass through on their way to raw bytes, so
+    // they land in per-thread buffers that keep their capacity between
+    // frames instead of in fresh strings.
+    struct Scratch {
+        std::string type;
+        std::string compression;
+        std::string base64[std::size(kJsonFields)];
+        std::vector<std::string> capabilities;
+    };
+    thread_local Scratch scratch;
+
+    Envelope env;
+    bool has_type = false;
+    bool has_compression = false;
+    std::array<json_fields::Field, std::size(kJsonFields) + 3> fields;
+    fields[0] = {"type", &scratch.type, nullptr, &has_type};
+    fields[1] = {"capabilities", nullptr, &scratch.capabilities};
+    fields[2] = {"compression", &scratch.compression, nullptr, &has_compression};
+    scratch.capabilities.clear();
+    for (std::size_t i = 0; i < std::size(kJsonFields); ++i) {
+        const auto& field = kJsonFields[i];
+        std::string* value = field.text ? &(env.*field.text) : &scratch.base64[i];
+        value->clear();
+        fields[i + 3] = {field.key, value};
+    }
+    if (!json_fields::read(frame, fields) || !has_type) {
+        return std::nullopt;
+    }
+
+    env.type = type_from_name(scratch.type);
+    if (has_compression) {
+        // An unknown scheme can't be opened; better to reject it here than
+        // to mistake compressed bytes for a payload.
+        const auto* it = std::find_if(std::begin(kCompressionNames), std::end(kCompressionNames),
+                                      [&](const auto& c) { return c.second == scratch.compression; });
+        if (it == std::end(kCompressionNames)) {
+            return std::nullopt;
+        }
+        env.compression = it->first;
+    }
+    for (std::size_t i = 0; i < std::size(kJsonFields); ++i) {
+        const auto& field = kJsonFields[i];
+        if (field.bytes && !base64::decode(scratch.base64[i], env.*field.bytes)) {
+            return std::nullopt;
+        }
+    }
+    for (const auto& cap : scratch.capabilities) {
+        for (const auto& [bit, name] : kCapabilityNames) {
+            if (cap == name) env.capabilities |= bit;
+        }
+    }
+    return env;
+}
+
+std::optional<Envelope> decode_binary(std::string_view frame) {
+    if (frame.size() < kBinaryHeaderSize || static_cast<uint8_t>(frame[0]) != kBinaryVersion) {
+        return std::nullopt;
+    }
+    const auto* p = reinterpret_cast<const uint8_t*>(frame.data());
+    const std::size_t from_len = p[2];
+    const std::size_t to_len = p[3];
+    const std::size_t body_len = get_u32(p + 100);
+    if (frame.size() != kBinaryHeaderSize + from_len + to_len + body_len) {
+        return std::nullopt;
+    }
+
+    Envelope env;
+    env.type = static_cast<EnvelopeType>(p[1] & ~kBinaryCompressedFlag);
+    if (p[1] & kBinaryCompressedFlag) {
+        env.compression = PayloadCompression::Zstd;
+    }
+    const int64_t ts = static_cast<int64_t>((uint64_t(get_u32(p + 4)) << 32) | get_u32(p + 8));
+    env.timestamp.resize(timestamp::kSize);
+    timestamp::format(ts, env.timestamp.data());
+
+    std::size_t off = kBinaryHeaderSize;
+    env.from.assign(frame.data() + off, from_len);
+    off += from_len;
+    env.to.assign(frame.data() + off, to_len);
+    off += to_len;
+
+    if (env.type == EnvelopeType::Ack) {
+        env.ack_msg_id.assign(frame.data() + off, body_len);
+    } else {
+        env.ciphertext.assign(p + off, p + off + body_len);
+    }
+    if (env.type == EnvelopeType::Message || env.type == EnvelopeType::FileOffer ||
+        env.type == EnvelopeType::GroupKey || env.type == EnvelopeType::GroupMessage ||
+        env.type == EnvelopeType::Session || env.type == EnvelopeType::Sync) {
+        env.nonce.assign(p + 12, p + 12 + kNonceSize);
+    }
+    static constexpr uint8_t kZeroSig[kSignatureSize] = {};
+    if (std::memcmp(p + 36, kZeroSig, kSignatureSize) != 0) {
+        env.signature.assign(p + 36, p + 36 + kSignatureSize);
+    }
+    return env;
+}
+
+} // namespace envelope
@@ -0,0 +1,98 @@
+/**
+ * FrameReader — Incremental length-prefixed frame decoder.
+ *
+ * Keeps one buffer per session and parses as many frames as a single
+ * async_read_some delivered. See include/network/framing.h for the contract.
+ */
+
+#include "network/framing.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace {
+// Below this much free tail space, compact before the next read.
+constexpr std::size_t kMinReadSize = 4096;
+}
+
+FrameReader::FrameReader(std::size_t max_frame_size, std::size_t initial_capacity)
+    : buffer_(std::max(initial_capacity, kMinReadSize)),
+      max_frame_size_(max_frame_size),
+      initial_capacity_(buffer_.size()) {}
+
+FrameReader::FrameReader(std::size_t max_frame_size, framing::Buffer storage)
+    : buffer_(std::move(storage)),
+      max_frame_size_(max_frame_size) {
+    if (buffer_.size() < kMinReadSize) {
+        buffer_.resize(kMinReadSize);
+    }
+    initial_capacity_ = buffer_.size();
+}
+
+std::span<char> FrameReader::prepare() {
+    if (read_pos_ == write_pos_) {
+        read_pos_ = write_pos_ = 0;
+        // A jumbo frame grew the buffer; give the memory back once it's drained.
+        if (buffer_.size() > initial_capacity_ * 4) {
+            buffer_.resize(initial_capacity_);
+            buffer_.shrink_to_fit();
+        }
+    }
+
+    const std::size_t frame_total = pending_frame_ ? framing::kHeaderSize + pending_frame_ : 0;
+    const std::size_t want = std::max(kMinReadSize, frame_total > buffered() ? frame_total - buffered() : 0);
+
+    if (buffer_.size() - write_pos_ < want && read_pos_ > 0) {
+        const std::size_t n = buffered();
+        std::memmove(buffer_.data(), buffer_.data() + read_pos_, n);
+        read_pos_ = 0;
+        write_pos_ = n;
+    }
+
+    // Only grow for a frame we've already accepted the header of, so the
+    // size is bounded by max_frame_size_.
+    if (frame_total > buffer_.size()) {
+        buffer_.resize(frame_total);
+    } else if (write_pos_ == buffer_.size()) {
+        buffer_.resize(buffer_.size() * 2);
+    }
+
+    return {buffer_.data() + write_pos_, buffer_.size() - write_pos_};
+}
+
+void FrameReader::commit(std::size_t n) {
+    write_pos_ = std::min(write_pos_ + n, buffer_.size());
+}
+
+FrameReader::Status FrameReader::next(std::string_view& payload) {
+    const std::size_t avail = buffered();
+    if (avail < framing::kHeaderSize) {
+        return Status::NeedMore;
+    }
+
+    const auto* head = reinterpret_cast<const uint8_t*>(buffer_.data() + read_pos_);
+    const std::size_t length = framing::decode_header(head);
+    if (length > max_frame_size_) {
+        return Status::Oversized;
+    }
+    if (avail < framing::kHeaderSize + length) {
+        pending_frame_ = length;
+        return Status::NeedMore;
+    }
+
+    payload = std::string_view(buffer_.data() + read_pos_ + framing::kHeaderSize, length);
+    read_pos_ += framing::kHeaderSize + length;
+    pending_frame_ = 0;
+    return Status::Frame;
+}
+
+void FrameReader::reset() {
+    read_pos_ = write_pos_ = 0;
+    pending_frame_ = 0;
+}
+
+framing::Buffer FrameReader::release() {
+    reset();
+    return std::exchange(buffer_, {});
+}
@@ -0,0 +1,18 @@
+/**
+ * HandlerMemory — the out-of-line part: counting heap fallbacks.
+ */
+
+#include "network/handler_memory.h"
+#include "telemetry/metrics.h"
+
+namespace {
+
+metrics::Counter& heap_allocations =
+    metrics::counter("p2p_handler_heap_allocations_total",
+                     "Completion handlers that did not fit their object's handler slot");
+
+} // namespace
+
+void HandlerMemory::count_heap_allocation() {
+    heap_allocations.inc();
+}
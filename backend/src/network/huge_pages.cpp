@@ -0,0 +1,172 @@
+/**
+ * huge_pages — an arena of huge pages for pooled connection memory.
+ */
+
+#include "network/huge_pages.h"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+namespace huge_pages {
+
+namespace {
+
+// Blocks are rounded up to this, so they stay cache-line aligned.
+constexpr std::size_t kAlign = 64;
+
+struct Arena {
+    // Set once by start(); read on every deallocate(), so atomics.
+    std::atomic<char*> base{nullptr};
+    std::atomic<std::size_t> size{0};
+    Backing backing = Backing::None;
+
+    std::mutex mutex;                           // guards used and free
+    std::size_t used = 0;
+    std::unordered_map<std::size_t, std::vector<void*>> free;
+};
+
+Arena& arena() {
+    static Arena a;
+    return a;
+}
+
+std::size_t round_up(std::size_t bytes) {
+    return (bytes + kAlign - 1) / kAlign * kAlign;
+}
+
+bool owns(const Arena& a, const void* block) {
+    const char* base = a.base.load(std::memory_order_acquire);
+    const auto* p = static_cast<const char*>(block);
+    return base && p >= base && p < base + a.size.load(std::memory_order_relaxed);
+}
+
+/// AnonHugePages of the mapping at `base`, from /proc/self/smaps.
+std::size_t transparent_bytes(const char* base) {
+    std::ifstream smaps("/proc/self/smaps");
+    const std::string start = fmt::format("{:x}-", reinterpret_cast<uintptr_t>(base));
+    std::string line;
+    bool in_arena = false;
+    while (std::getline(smaps, line)) {
+        // "7f2a...-7f2c... rw-p ..." starts a mapping; "Name:  value" follows.
+        if (line.find(':') > line.find(' ')) {
+            in_arena = line.starts_with(start);
+        } else if (in_arena && line.starts_with("AnonHugePages:")) {
+            return std::stoull(line.substr(14)) * 1024;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+Backing start(std::size_t bytes) {
+    Arena& a = arena();
+    if (bytes == 0 || a.base.load()) {
+        return a.backing;
+    }
+#ifdef __linux__
+    bytes = (bytes + kPageSize - 1) / kPageSize * kPageSize;
+    void* mapped = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapped != MAP_FAILED) {
+        a.backing = Backing::Explicit;
+    } else {
+        // Over-map by a page so the arena can start on a huge page boundary.
+        const std::size_t span = bytes + kPageSize;
+        char* raw = static_cast<char*>(::mmap(nullptr, span, PROT_READ | PROT_WRITE,
+                                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (raw == MAP_FAILED) {
+            spdlog::warn("Could not map a {} MiB buffer arena; buffers stay on the heap",
+                         bytes >> 20);
+            return Backing::None;
+        }
+        const auto addr = reinterpret_cast<uintptr_t>(raw);
+        char* aligned = raw + ((kPageSize - addr % kPageSize) % kPageSize);
+        if (aligned > raw) {
+            ::munmap(raw, static_cast<std::size_t>(aligned - raw));
+        }
+        if (char* end = aligned + bytes; end < raw + span) {
+            ::munmap(end, static_cast<std::size_t>(raw + span - end));
+        }
+        if (::madvise(aligned, bytes, MADV_HUGEPAGE) != 0) {
+            // THP disabled: no better than the heap, and never shrinks.
+            ::munmap(aligned, bytes);
+            spdlog::info("Huge pages are unavailable; buffers stay on the heap");
+            return Backing::None;
+        }
+        mapped = aligned;
+        a.backing = Backing::Transparent;
+    }
+    a.size.store(bytes, std::memory_order_relaxed);
+    a.base.store(static_cast<char*>(mapped), std::memory_order_release);
+    spdlog::info("Buffer arena: {} MiB on {} huge pages", bytes >> 20,
+                 a.backing == Backing::Explicit ? "explicit" : "transparent");
+    return a.backing;
+#else
+    spdlog::info("Huge pages are only supported on Linux; buffers stay on the heap");
+    return Backing::None;
+#endif
+}
+
+void* allocate(std::size_t bytes) {
+    Arena& a = arena();
+    if (a.base.load(std::memory_order_acquire) && bytes > 0 && bytes <= kMaxBlock) {
+        const std::size_t rounded = round_up(bytes);
+        std::lock_guard lock(a.mutex);
+        if (auto it = a.free.find(rounded); it != a.free.end() && !it->second.empty()) {
+            void* block = it->second.back();
+            it->second.pop_back();
+            return block;
+        }
+        if (a.used + rounded <= a.size.load(std::memory_order_relaxed)) {
+            void* block = a.base.load(std::memory_order_relaxed) + a.used;
+            a.used += rounded;
+            return block;
+        }
+    }
+    return ::operator new(bytes);
+}
+
+void deallocate(void* block, std::size_t bytes) noexcept {
+    Arena& a = arena();
+    if (!owns(a, block)) {
+        ::operator delete(block);
+        return;
+    }
+    std::lock_guard lock(a.mutex);
+    try {
+        a.free[round_up(bytes)].push_back(block);
+    } catch (const std::bad_alloc&) {
+        // Lost to the arena until exit; never freed twice.
+    }
+}
+
+Coverage coverage() {
+    Arena& a = arena();
+    Coverage out;
+    char* base = a.base.load(std::memory_order_acquire);
+    if (!base) {
+        return out;
+    }
+    out.backing = a.backing;
+    out.arena_bytes = a.size.load(std::memory_order_relaxed);
+    {
+        std::lock_guard lock(a.mutex);
+        out.used_bytes = a.used;
+    }
+    out.huge_bytes = a.backing == Backing::Explicit ? out.arena_bytes : transparent_bytes(base);
+    return out;
+}
+
+} // namespace huge_pages
@@ -0,0 +1,84 @@
+/**
+ * IoContextPool — Runs the backend's event loops on N threads.
+ *
+ * With io_threads = 1 (the default) this degenerates to the original
+ * single-threaded model: one io_context, run on the main thread.
+ */
+
+#include "network/io_context_pool.h"
+#include "network/cpu_affinity.h"
+
+#include <spdlog/spdlog.h>
+
+IoContextPool::IoContextPool(std::size_t threads, Mode mode)
+    : threads_(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      mode_(mode) {
+    const std::size_t n = (mode_ == Mode::Shared) ? 1 : threads_;
+    contexts_.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        // Concurrency hint 1 lets ASIO drop internal locking on per-core contexts.
+        contexts_.push_back(std::make_unique<asio::io_context>(
+            mode_ == Mode::Shared ? static_cast<int>(threads_) : 1));
+        guards_.emplace_back(asio::make_work_guard(*contexts_.back()));
+        watched_.emplace_back(n == 1 ? std::string("io") : "io-" + std::to_string(i),
+                              *contexts_.back());
+    }
+}
+
+IoContextPool::Mode IoContextPool::parse_mode(const std::string& name) {
+    if (name == "shared") {
+        return Mode::Shared;
+    }
+    if (name != "per_core") {
+        spdlog::warn("Unknown node.io_mode '{}', using per_core", name);
+    }
+    return Mode::PerCore;
+}
+
+asio::io_context& IoContextPool::next() {
+    const std::size_t i = next_.fetch_add(1, std::memory_order_relaxed);
+    return *contexts_[i % contexts_.size()];
+}
+
+void IoContextPool::run() {
+    spdlog::info("Starting {} I/O thread(s), mode={}", threads_,
+                 mode_ == Mode::Shared ? "shared" : "per_core");
+
+    // Worker i on CPU i (mod the list) per core; all of them when shared.
+    auto pin = [this](std::size_t i) {
+        if (cpus_.empty()) {
+            return;
+        }
+        if (mode_ == Mode::Shared) {
+            cpu_affinity::pin_current(cpus_);
+        } else {
+            cpu_affinity::pin_current(std::span(&cpus_[i % cpus_.size()], 1));
+        }
+    };
+    if (!cpus_.empty()) {
+        spdlog::info("I/O threads pinned to {} CPU(s)", cpus_.size());
+    }
+    for (std::size_t i = 1; i < threads_; ++i) {
+        auto& ctx = *contexts_[i % contexts_.size()];
+        workers_.emplace_back([&ctx, pin, i] {
+            pin(i);
+            ctx.run();
+        });
+    }
+    pin(0);
+    main().run();
+
+    for (auto& t : workers_) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    workers_.clear();
+}
+
+void IoContextPool::stop() {
+    guards_.clear();
+    for (auto& ctx : contexts_) {
+        ctx->stop();
+    }
+}
@@ -0,0 +1,512 @@
+/**
+ * json_fields — single-pass field extraction for small JSON objects and
+ * arrays of them.
+ *
+ * A strict RFC 8259 scanner: the whole document is validated (grammar,
+ * control characters, UTF-8) as nlohmann would, but only the listed
+ * top-level fields are copied out and everything else is skipped in place.
+ * Strings without escapes are copied with one assign; nested values that
+ * aren't wanted are walked with a bit stack instead of recursion.
+ * append_string() is the matching writer for the encoders.
+ *
+ * Both directions look for the same bytes in a string — a quote, a
+ * backslash or a control character — so both use special(), which tests
+ * 16 bytes at a time (SSE2 on x86-64, NEON on AArch64). Everything in
+ * between is copied as one run; a run with non-ASCII bytes is checked with
+ * utf8::valid(), which is exact because no sequence can span an ASCII byte.
+ */
+
+#include "network/json_fields.h"
+
+#include <cstdint>
+#include <functional>
+
+#include "network/utf8.h"
+
+#if defined(__SSE2__)
+    #define P2P_JSON_SSE2 1
+    #include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #define P2P_JSON_NEON 1
+    #include <arm_neon.h>
+#endif
+
+namespace {
+
+/// The first byte in [p, end) that can't be copied into a JSON string as
+/// is: '"', '\\' or below 0x20. `end` if there is none. The bytes before
+/// it are ORed into `seen`, so `seen & 0x80` tells whether they were all
+/// ASCII.
+const char* special(const char* p, const char* end, uint8_t& seen) {
+#if P2P_JSON_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    __m128i high = _mm_setzero_si128();
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));        // v <= 0x1F
+        if (const int mask = _mm_movemask_epi8(hit)) {
+            const int first = __builtin_ctz(static_cast<unsigned>(mask));
+            // Only the bytes before the hit count towards `seen`.
+            if (_mm_movemask_epi8(high) | (_mm_movemask_epi8(v) & ((1 << first) - 1))) {
+                seen |= 0x80;
+            }
+            return p + first;
+        }
+        high = _mm_or_si128(high, v);
+    }
+    if (_mm_movemask_epi8(high)) {
+        seen |= 0x80;
+    }
+#elif P2P_JSON_NEON
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t control = vdupq_n_u8(0x20);
+    uint8x16_t high = vdupq_n_u8(0);
+    for (; end - p >= 16; p += 16) {
+        const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+        const uint8x16_t hit = vorrq_u8(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, backslash)),
+                                        vcltq_u8(v, control));
+        // Narrow to four bits per byte to find the first hit.
+        const uint64_t mask = vget_lane_u64(
+            vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hit), 4)), 0);
+        if (mask) {
+            seen |= vmaxvq_u8(high);
+            const char* hit_at = p + (__builtin_ctzll(mask) >> 2);
+            for (; p < hit_at; ++p) seen |= static_cast<uint8_t>(*p);
+            return hit_at;
+        }
+        high = vorrq_u8(high, v);
+    }
+    seen |= vmaxvq_u8(high);
+#endif
+    for (; p < end; ++p) {
+        const auto b = static_cast<unsigned char>(*p);
+        if (b == '"' || b == '\\' || b < 0x20) break;
+        seen |= b;
+    }
+    return p;
+}
+
+/// Nesting limit for skipped values; one bit per level in Scanner::skip().
+constexpr int kMaxDepth = 64;
+
+class Scanner {
+public:
+    Scanner(std::string_view text) : p_(text.data()), end_(text.data() + text.size()) {}
+
+    bool read_object(std::span<const json_fields::Field> fields) {
+        ws();
+        return object(fields) && at_end();
+    }
+
+    bool read_rows(std::span<const json_fields::Field> fields, const std::function<void()>& row) {
+        ws();
+        if (!eat('[')) {
+            return false;
+        }
+        ws();
+        if (eat(']')) {
+            return at_end();
+        }
+        for (;;) {
+            if (peek() == '{') {
+                for (const auto& f : fields) {
+                    if (f.value) f.value->clear();
+                    if (f.items) f.items->clear();
+                    if (f.present) *f.present = false;
+                }
+                if (!object(fields)) {
+                    return false;
+                }
+                row();
+            } else if (!skip()) {
+                return false;
+            }
+            ws();
+            if (eat(']')) {
+                return at_end();
+            }
+            if (!eat(',')) {
+                return false;
+            }
+            ws();
+        }
+    }
+
+private:
+    /// An object whose listed members are copied out.
+    bool object(std::span<const json_fields::Field> fields) {
+        if (!eat('{')) {
+            return false;
+        }
+        ws();
+        if (eat('}')) {
+            return true;
+        }
+        thread_local std::string key;
+        for (;;) {
+            if (!string(key)) {
+                return false;
+            }
+            ws();
+            if (!eat(':')) {
+                return false;
+            }
+            ws();
+            if (!field_value(find(fields, key))) {
+                return false;
+            }
+            ws();
+            if (eat('}')) {
+                return true;
+            }
+            if (!eat(',')) {
+                return false;
+            }
+            ws();
+        }
+    }
+
+    static const json_fields::Field* find(std::span<const json_fields::Field> fields,
+                                          std::string_view key) {
+        for (const auto& f : fields) {
+            if (f.key == key) return &f;
+        }
+        return nullptr;
+    }
+
+    /// The value of a top-level key; `f` is null for unlisted keys.
+    bool field_value(const json_fields::Field* f) {
+        if (f && f->value) {
+            if (!string(*f->value)) {
+                return false;               // a string field must hold a string
+            }
+        } else if (f && f->items && peek() == '[') {
+            if (!items(*f->items)) {
+                return false;
+            }
+        } else {
+            return skip();
+        }
+        if (f->present) *f->present = true;
+        return true;
+    }
+
+    /// An array whose string elements are collected; others are skipped.
+    bool items(std::vector<std::string>& out) {
+        out.clear();
+        ++p_;                               // '['
+        ws();
+        if (eat(']')) {
+            return true;
+        }
+        for (;;) {
+            if (peek() == '"') {
+                out.emplace_back();
+                if (!string(out.back())) {
+                    return false;
+                }
+            } else if (!skip()) {
+                return false;
+            }
+            ws();
+            if (eat(']')) {
+                return true;
+            }
+            if (!eat(',')) {
+                return false;
+            }
+            ws();
+        }
+    }
+
+    /// Validate and step over any value.
+    bool skip() {
+        uint64_t in_array = 0;              // bit d set: level d is an array
+        int depth = 0;
+        for (;;) {
+            // A value.
+            const char c = peek();
+            if (c == '{' || c == '[') {
+                if (depth == kMaxDepth) {
+                    return false;
+                }
+                ++p_;
+                ws();
+                if (c == '[') {
+                    in_array |= uint64_t{1} << depth;
+                } else {
+                    in_array &= ~(uint64_t{1} << depth);
+                }
+                ++depth;
+                if (!eat(c == '[' ? ']' : '}')) {
+                    if (c == '{' && !member_key()) {
+                        return false;
+                    }
+                    continue;               // first element
+                }
+                --depth;
+            } else if (c == '"') {
+                if (!skip_string()) {
+                    return false;
+                }
+            } else if (!literal() && !number()) {
+                return false;
+            }
+
+            // What follows it: close containers, then a separator or the end.
+            for (;;) {
+                if (depth == 0) {
+                    return true;
+                }
+                ws();
+                const bool array = in_array & (uint64_t{1} << (depth - 1));
+                if (eat(array ? ']' : '}')) {
+                    --depth;
+                    continue;
+                }
+                if (!eat(',')) {
+                    return false;
+                }
+                ws();
+                if (!array && !member_key()) {
+                    return false;
+                }
+                break;
+            }
+        }
+    }
+
+    /// `"key" :` inside a skipped object, leaving the cursor on the value.
+    bool member_key() {
+        if (!skip_string()) {
+            return false;
+        }
+        ws();
+        if (!eat(':')) {
+            return false;
+        }
+        ws();
+        return true;
+    }
+
+    bool skip_string() {
+        thread_local std::string sink;
+        return string(sink);
+    }
+
+    /// Decode a string into `out`, reusing its capacity.
+    bool string(std::string& out) {
+        if (!eat('"')) {
+            return false;
+        }
+        out.clear();
+        for (;;) {
+            // Copy the run up to the next quote, escape or control byte.
+            const char* run = p_;
+            uint8_t seen = 0;
+            p_ = special(p_, end_, seen);
+            const std::string_view text(run, static_cast<std::size_t>(p_ - run));
+            if ((seen & 0x80) && !utf8::valid(text)) {
+                return false;
+            }
+            out.append(text);
+            if (p_ == end_) {
+                return false;
+            }
+            const auto b = static_cast<unsigned char>(*p_);
+            if (b == '"') {
+                ++p_;
+                return true;
+            }
+            if (b < 0x20) {
+                return false;               // raw control characters are not allowed
+            }
+            ++p_;                           // backslash
+            if (p_ == end_) {
+                return false;
+            }
+            switch (*p_++) {
+            case '"':  out += '"';  break;
+            case '\\': out += '\\'; break;
+            case '/':  out += '/';  break;
+            case 'b':  out += '\b'; break;
+            case 'f':  out += '\f'; break;
+            case 'n':  out += '\n'; break;
+            case 'r':  out += '\r'; break;
+            case 't':  out += '\t'; break;
+            case 'u':
+                if (!unicode_escape(out)) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+            }
+        }
+    }
+
+    /// The XXXX of \uXXXX (plus a trailing low surrogate), as UTF-8.
+    bool unicode_escape(std::string& out) {
+        uint32_t cp;
+        if (!hex4(cp)) {
+            return false;
+        }
+        if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            return false;                   // lone low surrogate
+        }
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            uint32_t low;
+            if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u') {
+                return false;
+            }
+            p_ += 2;
+            if (!hex4(low) || low < 0xDC00 || low > 0xDFFF) {
+                return false;
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        }
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        return true;
+    }
+
+    bool hex4(uint32_t& v) {
+        if (end_ - p_ < 4) {
+            return false;
+        }
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            const char c = *p_++;
+            v <<= 4;
+            if (c >= '0' && c <= '9')      v |= static_cast<uint32_t>(c - '0');
+            else if (c >= 'a' && c <= 'f') v |= static_cast<uint32_t>(c - 'a' + 10);
+            else if (c >= 'A' && c <= 'F') v |= static_cast<uint32_t>(c - 'A' + 10);
+            else return false;
+        }
+        return true;
+    }
+
+    bool literal() {
+        for (std::string_view word : {"true", "false", "null"}) {
+            if (std::string_view(p_, static_cast<std::size_t>(end_ - p_)).starts_with(word)) {
+                p_ += word.size();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+    bool number() {
+        eat('-');
+        if (eat('0')) {
+            // no leading zeros
+        } else if (!digits()) {
+            return false;
+        }
+        if (eat('.') && !digits()) {
+            return false;
+        }
+        if (eat('e') || eat('E')) {
+            if (!eat('+')) eat('-');
+            if (!digits()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool digits() {
+        const char* start = p_;
+        while (p_ < end_ && *p_ >= '0' && *p_ <= '9') ++p_;
+        return p_ != start;
+    }
+
+    void ws() {
+        while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) ++p_;
+    }
+
+    bool at_end() {
+        ws();
+        return p_ == end_;
+    }
+
+    char peek() const { return p_ < end_ ? *p_ : '\0'; }
+
+    bool eat(char c) {
+        if (p_ < end_ && *p_ == c) {
+            ++p_;
+            return true;
+        }
+        return false;
+    }
+
+    const char* p_;
+    const char* end_;
+};
+
+} // namespace
+
+namespace json_fields {
+
+bool read(std::string_view text, std::span<const Field> fields) {
+    return Scanner(text).read_object(fields);
+}
+
+bool read_rows(std::string_view text, std::span<const Field> fields,
+               const std::function<void()>& row) {
+    return Scanner(text).read_rows(fields, row);
+}
+
+void append_string(std::string& out, std::string_view s) {
+    static constexpr char kHex[] = "0123456789abcdef";
+    out += '"';
+    const char* p = s.data();
+    const char* end = p + s.size();
+    uint8_t seen = 0;                   // unused: output isn't validated
+    for (;;) {
+        const char* run = p;
+        p = special(p, end, seen);
+        out.append(run, p);
+        if (p == end) {
+            break;
+        }
+        const auto b = static_cast<unsigned char>(*p++);
+        out += '\\';
+        switch (b) {
+        case '"':  out += '"';  break;
+        case '\\': out += '\\'; break;
+        case '\b': out += 'b';  break;
+        case '\f': out += 'f';  break;
+        case '\n': out += 'n';  break;
+        case '\r': out += 'r';  break;
+        case '\t': out += 't';  break;
+        default:
+            out += "u00";
+            out += kHex[b >> 4];
+            out += kHex[b & 0xF];
+            break;
+        }
+    }
+    out += '"';
+}
+
+} // namespace json_fields
@@ -0,0 +1,211 @@
+/**
+ * LanDiscovery — signed multicast announcements.
+ *
+ *   "p2plan1 " {"u": username, "n": node id, "k": key hash, "p": TCP port,
+ *               "t": unix seconds, "s": base64 Ed25519 signature}
+ */
+
+#include "network/lan_discovery.h"
+#include "crypto/base64.h"
+
+#include <algorithm>
+#include <array>
+#include <ctime>
+
+#include <nlohmann/json.hpp>
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+using asio::ip::udp;
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::string_view kMagic = "p2plan1 ";
+/// Least time between two announcements prompted by newly heard nodes.
+constexpr auto kMinReannounce = std::chrono::seconds(1);
+/// Bound on the nodes remembered as heard; a LAN has far fewer.
+constexpr std::size_t kMaxHeard = 1024;
+
+} // namespace
+
+LanDiscovery::LanDiscovery(Options options, Signer sign, Handler on_announcement)
+    : options_(std::move(options)),
+      sign_(std::move(sign)),
+      on_announcement_(std::move(on_announcement)),
+      socket_(io_),
+      timer_(io_) {}
+
+LanDiscovery::~LanDiscovery() {
+    stop();
+}
+
+std::string LanDiscovery::key_hash(std::span<const uint8_t> signing_key) {
+    uint8_t hash[16];
+    crypto_generichash(hash, sizeof(hash), signing_key.data(), signing_key.size(), nullptr, 0);
+    char hex[sizeof(hash) * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), hash, sizeof(hash));
+    return hex;
+}
+
+std::string LanDiscovery::signed_bytes(const Announcement& a) {
+    return "lan_announce\n" + a.username + "\n" + a.node_id + "\n" + a.key_hash + "\n" +
+           std::to_string(a.port) + "\n" + std::to_string(a.timestamp);
+}
+
+std::string LanDiscovery::encode(const Announcement& a) {
+    return std::string(kMagic) + json{{"u", a.username},
+                                      {"n", a.node_id},
+                                      {"k", a.key_hash},
+                                      {"p", a.port},
+                                      {"t", a.timestamp},
+                                      {"s", base64::encode(a.signature)}}
+                                     .dump();
+}
+
+std::optional<LanDiscovery::Announcement> LanDiscovery::decode(std::string_view packet) {
+    if (!packet.starts_with(kMagic)) {
+        return std::nullopt;
+    }
+    const auto j = json::parse(packet.substr(kMagic.size()), nullptr, false);
+    if (!j.is_object() || !j.contains("u") || !j["u"].is_string() || !j.contains("n") ||
+        !j["n"].is_string() || !j.contains("k") || !j["k"].is_string() || !j.contains("p") ||
+        !j["p"].is_number_unsigned() || !j.contains("t") || !j["t"].is_number_integer() ||
+        !j.contains("s") || !j["s"].is_string()) {
+        return std::nullopt;
+    }
+    Announcement a;
+    a.username = j["u"].get<std::string>();
+    a.node_id = j["n"].get<std::string>();
+    a.key_hash = j["k"].get<std::string>();
+    const auto port = j["p"].get<uint64_t>();
+    a.timestamp = j["t"].get<int64_t>();
+    if (a.username.empty() || port == 0 || port > 0xFFFF ||
+        !base64::decode(j["s"].get<std::string>(), a.signature)) {
+        return std::nullopt;
+    }
+    a.port = static_cast<uint16_t>(port);
+    return a;
+}
+
+bool LanDiscovery::start() {
+    if (thread_.joinable()) {
+        return true;
+    }
+    asio::error_code ec;
+    const auto group = asio::ip::make_address_v4(options_.group, ec);
+    if (ec || !group.is_multicast()) {
+        spdlog::error("LAN discovery: '{}' is not an IPv4 multicast group", options_.group);
+        return false;
+    }
+    group_ = udp::endpoint(group, options_.port);
+    socket_.open(udp::v4(), ec);
+    if (!ec) {
+        // Every node on this host binds the same port.
+        socket_.set_option(udp::socket::reuse_address(true), ec);
+    }
+    if (!ec) {
+        socket_.bind(udp::endpoint(udp::v4(), options_.port), ec);
+    }
+    if (!ec) {
+        socket_.set_option(asio::ip::multicast::join_group(group), ec);
+    }
+    if (!ec) {
+        socket_.set_option(asio::ip::multicast::hops(1), ec);
+    }
+    if (!ec) {
+        socket_.set_option(asio::ip::multicast::enable_loopback(true), ec);
+    }
+    if (ec) {
+        spdlog::error("LAN discovery can't use {}:{}: {}", options_.group, options_.port,
+                      ec.message());
+        asio::error_code ignored;
+        socket_.close(ignored);
+        return false;
+    }
+    asio::co_spawn(io_, receive_loop(), asio::detached);
+    arm_timer(std::chrono::steady_clock::duration::zero());
+    thread_ = std::thread([this] { io_.run(); });
+    spdlog::info("LAN discovery on {}:{}", options_.group, options_.port);
+    return true;
+}
+
+void LanDiscovery::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    asio::post(io_, [this] {
+        timer_.cancel();
+        asio::error_code ec;
+        socket_.close(ec);
+    });
+    thread_.join();
+}
+
+void LanDiscovery::arm_timer(std::chrono::steady_clock::duration delay) {
+    // Replaces any earlier wait, which completes with operation_aborted.
+    timer_.expires_after(delay);
+    timer_.async_wait([this](const asio::error_code& ec) {
+        if (ec || !socket_.is_open()) {
+            return;
+        }
+        announce();
+        arm_timer(options_.interval);
+    });
+}
+
+void LanDiscovery::announce() {
+    Announcement a;
+    a.username = options_.username;
+    a.node_id = options_.node_id;
+    a.key_hash = options_.key_hash;
+    a.port = options_.listen_port;
+    a.timestamp = static_cast<int64_t>(std::time(nullptr));
+    a.signature = sign_(signed_bytes(a));
+    last_announce_ = std::chrono::steady_clock::now();
+
+    asio::error_code ec;
+    socket_.send_to(asio::buffer(encode(a)), group_, 0, ec);
+    if (ec) {
+        // e.g. no route to the group while the network is down; next round.
+        spdlog::debug("LAN announcement failed: {}", ec.message());
+    }
+}
+
+asio::awaitable<void> LanDiscovery::receive_loop() {
+    std::array<char, 1024> buffer;
+    udp::endpoint from;
+    for (;;) {
+        asio::error_code ec;
+        const std::size_t bytes = co_await socket_.async_receive_from(
+            asio::buffer(buffer), from, asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec == asio::error::operation_aborted || !socket_.is_open()) {
+                co_return;
+            }
+            spdlog::debug("LAN discovery receive failed: {}", ec.message());
+            continue;
+        }
+        auto a = decode(std::string_view(buffer.data(), bytes));
+        if (!a || a->username == options_.username) {
+            continue;                           // not ours to read, or our own echo
+        }
+        // New here, or back after missing two rounds (e.g. restarted):
+        // answer soon rather than at our next round, so it learns about us
+        // as quickly as we learned about it.
+        const auto now = std::chrono::steady_clock::now();
+        if (heard_.size() >= kMaxHeard) {
+            heard_.clear();
+        }
+        auto& last_heard = heard_[a->username + "\n" + a->node_id];
+        if (last_heard == std::chrono::steady_clock::time_point{} ||
+            now - last_heard > 2 * options_.interval) {
+            const auto next = std::max(now, last_announce_ + kMinReannounce);
+            if (timer_.expiry() > next) {
+                arm_timer(next - now);
+            }
+        }
+        last_heard = now;
+        on_announcement_(*a, from.address().to_string());
+    }
+}
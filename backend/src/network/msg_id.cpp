@@ -0,0 +1,100 @@
+/**
+ * MsgId — binary message ids and the UUIDv7 generator.
+ */
+
+#include "network/msg_id.h"
+#include "crypto/nonce_source.h"
+
+#include <chrono>
+
+namespace {
+
+constexpr char kHex[] = "0123456789abcdef";
+
+// Offsets of the hex pairs in "xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx".
+constexpr std::array<uint8_t, 16> kPairAt = {0,  2,  4,  6,  9,  11, 14, 16,
+                                             19, 21, 24, 26, 28, 30, 32, 34};
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = static_cast<char>(c | 0x20);
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// Per thread: the millisecond of the last id and the 12-bit counter
+// under it. A counter that runs out borrows the next millisecond, so ids
+// from one thread never go backwards.
+struct Sequence {
+    uint64_t ms = 0;
+    uint16_t counter = 0;
+};
+
+thread_local Sequence sequence;
+
+} // namespace
+
+MsgId MsgId::generate() {
+    const auto now = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count());
+    MsgId id;
+    // Ids are public; they only need to be unique, like nonces.
+    nonce_source::fill(id.bytes.data(), id.bytes.size());
+    auto& seq = sequence;
+    if (now > seq.ms) {
+        seq.ms = now;
+        // A random start, with room to count up before borrowing.
+        seq.counter = static_cast<uint16_t>(((id.bytes[6] << 8) | id.bytes[7]) & 0x07FF);
+    } else if (++seq.counter > 0x0FFF) {
+        ++seq.ms;
+        seq.counter = 0;
+    }
+    for (int i = 5; i >= 0; --i) {
+        id.bytes[i] = static_cast<uint8_t>(seq.ms >> (8 * (5 - i)));
+    }
+    id.bytes[6] = static_cast<uint8_t>(0x70 | (seq.counter >> 8));
+    id.bytes[7] = static_cast<uint8_t>(seq.counter);
+    id.bytes[8] = static_cast<uint8_t>((id.bytes[8] & 0x3F) | 0x80);
+    return id;
+}
+
+std::optional<MsgId> MsgId::parse(std::string_view text) {
+    if (text.size() != kTextSize || text[8] != '-' || text[13] != '-' || text[18] != '-' ||
+        text[23] != '-') {
+        return std::nullopt;
+    }
+    MsgId id;
+    for (std::size_t i = 0; i < id.bytes.size(); ++i) {
+        const int hi = hex_value(text[kPairAt[i]]);
+        const int lo = hex_value(text[kPairAt[i] + 1]);
+        if ((hi | lo) < 0) {
+            return std::nullopt;
+        }
+        id.bytes[i] = static_cast<uint8_t>(hi << 4 | lo);
+    }
+    return id;
+}
+
+void MsgId::format(char* out) const {
+    out[8] = out[13] = out[18] = out[23] = '-';
+    for (std::size_t i = 0; i < bytes.size(); ++i) {
+        out[kPairAt[i]] = kHex[bytes[i] >> 4];
+        out[kPairAt[i] + 1] = kHex[bytes[i] & 0x0F];
+    }
+}
+
+std::string MsgId::str() const {
+    std::string out(kTextSize, '\0');
+    format(out.data());
+    return out;
+}
+
+uint64_t MsgId::unix_ms() const {
+    uint64_t ms = 0;
+    for (int i = 0; i < 6; ++i) {
+        ms = ms << 8 | bytes[i];
+    }
+    return ms;
+}
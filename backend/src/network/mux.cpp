@@ -0,0 +1,74 @@
+/**
+ * Mux frame header encoding. See include/network/mux.h for the layout.
+ */
+
+#include "network/mux.h"
+
+namespace mux {
+
+namespace {
+
+uint32_t read_u32(std::string_view bytes) {
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < 4; ++i) {
+        value = (value << 8) | static_cast<uint8_t>(bytes[i]);
+    }
+    return value;
+}
+
+void append_u32(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>((value >> shift) & 0xFF);
+    }
+}
+
+std::string header(Op op, uint32_t channel, std::size_t body_size) {
+    std::string out;
+    out.reserve(kHeaderSize + body_size);
+    out += static_cast<char>(kMagic);
+    out += static_cast<char>(op);
+    append_u32(out, channel);
+    return out;
+}
+
+} // namespace
+
+std::optional<Frame> parse(std::string_view frame) {
+    if (frame.size() < kHeaderSize || !is_mux_frame(frame)) {
+        return std::nullopt;
+    }
+    const auto op = static_cast<uint8_t>(frame[1]);
+    if (op < static_cast<uint8_t>(Op::Data) || op > static_cast<uint8_t>(Op::Close)) {
+        return std::nullopt;
+    }
+    Frame out{static_cast<Op>(op), read_u32(frame.substr(2, 4)), frame.substr(kHeaderSize)};
+    if (out.op == Op::Window && out.body.size() != 4) {
+        return std::nullopt;
+    }
+    return out;
+}
+
+std::optional<uint32_t> parse_window(std::string_view body) {
+    if (body.size() != 4) {
+        return std::nullopt;
+    }
+    return read_u32(body);
+}
+
+std::string encode_data(uint32_t channel, std::string_view envelope) {
+    std::string out = header(Op::Data, channel, envelope.size());
+    out.append(envelope);
+    return out;
+}
+
+std::string encode_window(uint32_t channel, uint32_t credit) {
+    std::string out = header(Op::Window, channel, 4);
+    append_u32(out, credit);
+    return out;
+}
+
+std::string encode_close(uint32_t channel) {
+    return header(Op::Close, channel, 0);
+}
+
+} // namespace mux
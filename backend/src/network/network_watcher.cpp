@@ -0,0 +1,96 @@
+/**
+ * NetworkWatcher — rtnetlink address and link notifications.
+ */
+
+#include "network/network_watcher.h"
+
+#include <chrono>
+#include <optional>
+
+#include <spdlog/spdlog.h>
+
+#if defined(__linux__)
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Also how often stop() is noticed.
+constexpr auto kPollInterval = std::chrono::milliseconds(500);
+constexpr auto kSettle = std::chrono::seconds(1);
+
+} // namespace
+
+NetworkWatcher::NetworkWatcher(Listener on_change) : on_change_(std::move(on_change)) {}
+
+NetworkWatcher::~NetworkWatcher() {
+    stop();
+}
+
+bool NetworkWatcher::start() {
+#if defined(__linux__)
+    const int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    sockaddr_nl local{};
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (fd < 0 || bind(fd, reinterpret_cast<const sockaddr*>(&local), sizeof local) < 0) {
+        spdlog::warn("Cannot watch network interfaces; address changes are polled");
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    stopping_ = false;
+    thread_ = std::thread([this, fd] { watch(fd); });
+    return true;
+#else
+    return false;
+#endif
+}
+
+void NetworkWatcher::stop() {
+    stopping_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void NetworkWatcher::watch([[maybe_unused]] int fd) {
+#if defined(__linux__)
+    using Clock = std::chrono::steady_clock;
+    std::optional<Clock::time_point> due;     // report once the burst settles
+    alignas(nlmsghdr) char buf[8192];
+    while (!stopping_) {
+        pollfd pfd{fd, POLLIN, 0};
+        if (poll(&pfd, 1, static_cast<int>(kPollInterval.count())) > 0) {
+            ssize_t n;
+            while ((n = recv(fd, buf, sizeof buf, 0)) > 0) {
+                auto len = static_cast<unsigned>(n);
+                for (auto* h = reinterpret_cast<nlmsghdr*>(buf); NLMSG_OK(h, len);
+                     h = NLMSG_NEXT(h, len)) {
+                    switch (h->nlmsg_type) {
+                    case RTM_NEWADDR:
+                    case RTM_DELADDR:
+                    case RTM_NEWLINK:
+                    case RTM_DELLINK:
+                        due = Clock::now() + kSettle;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+            }
+        }
+        if (due && Clock::now() >= *due) {
+            due.reset();
+            spdlog::debug("Network interfaces changed");
+            on_change_();
+        }
+    }
+    close(fd);
+#endif
+}
@@ -0,0 +1,47 @@
+/**
+ * PeerCapabilities — per-peer wire format negotiation state.
+ */
+
+#include "network/peer_capabilities.h"
+
+PeerCapabilities::PeerCapabilities(bool binary_enabled)
+    : binary_enabled_(binary_enabled) {}
+
+void PeerCapabilities::update(const std::string& username, uint32_t capabilities) {
+    std::lock_guard lock(mutex_);
+    caps_[username] = capabilities;
+}
+
+void PeerCapabilities::observe(const Envelope& env, WireFormat format) {
+    if (env.from.empty()) {
+        return;
+    }
+    if (env.type == EnvelopeType::Hello) {
+        update(env.from, env.capabilities);
+    } else if (format == WireFormat::Binary) {
+        std::lock_guard lock(mutex_);
+        caps_[env.from] |= envelope::kCapBinaryV1;
+    }
+}
+
+WireFormat PeerCapabilities::format_for(const std::string& username) const {
+    if (!binary_enabled_) {
+        return WireFormat::Json;
+    }
+    std::lock_guard lock(mutex_);
+    auto it = caps_.find(username);
+    return it != caps_.end() && (it->second & envelope::kCapBinaryV1)
+        ? WireFormat::Binary
+        : WireFormat::Json;
+}
+
+bool PeerCapabilities::supports(const std::string& username, uint32_t capabilities) const {
+    std::lock_guard lock(mutex_);
+    auto it = caps_.find(username);
+    return it != caps_.end() && (it->second & capabilities) == capabilities;
+}
+
+void PeerCapabilities::forget(const std::string& username) {
+    std::lock_guard lock(mutex_);
+    caps_.erase(username);
+}
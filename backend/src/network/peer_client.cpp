@@ -1,13 +1,706 @@
 /**
  * PeerClient — Connects to a remote peer and sends messages.
  *
- * Resolves peer IP from Supabase user record, opens a TCP connection,
- * and writes length-prefixed JSON payloads.
+ * Races a TCP connect over the addresses a peer published, then writes
+ * length-prefixed envelope frames through a coalescing queue.
  */
 
 #include "network/peer_client.h"
+#include "network/backpressure.h"
+#include "network/coro.h"
+#include "network/dns_cache.h"
+#include "network/timer_wheel.h"
+#include "telemetry/capture.h"
+#include "telemetry/memory.h"
+#include "telemetry/metrics.h"
 
-// TODO: Implement
-// - PeerClient::connect(ip, port) — async TCP connect
-// - PeerClient::send(json_payload) — length-prefix + write
-// - PeerClient::disconnect()
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <future>
+#include <optional>
+#include <span>
+#include <utility>
+
+#if defined(__linux__)
+#include <cstddef>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+using asio::ip::tcp;
+
+namespace {
+
+metrics::Gauge& send_queue_bytes =
+    metrics::gauge("p2p_peer_send_queue_bytes", "Bytes queued for peers and not yet written");
+metrics::Counter& frames_sent =
+    metrics::counter("p2p_peer_tx_frames_total", "Frames written to peers");
+metrics::Counter& segments_sent =
+    metrics::counter("p2p_peer_tx_segments_total",
+                     "TCP segments sent on outbound peer connections (Linux), counted when "
+                     "their queue drains");
+metrics::Counter& corked_writes =
+    metrics::counter("p2p_peer_corked_writes_total",
+                     "Peer writes made with TCP_CORK on because more frames were queued");
+
+#if defined(__linux__)
+// glibc's tcp_info stops before the counters Linux 4.2 appended; the
+// kernel's layout continues from there as below.
+struct TcpInfo {
+    struct tcp_info base;
+    uint64_t pacing_rate;
+    uint64_t max_pacing_rate;
+    uint64_t bytes_acked;
+    uint64_t bytes_received;
+    uint32_t segs_out;
+    uint32_t segs_in;
+};
+#endif
+
+// With TCP_CORK the kernel only sends full segments until it is cleared
+// (or 200 ms pass), so a burst that takes several writes doesn't go out
+// as one short packet per write. No-op elsewhere than Linux.
+void set_cork(tcp::socket& socket, bool on) {
+#if defined(__linux__) && defined(TCP_CORK)
+    const int value = on ? 1 : 0;
+    ::setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+#else
+    (void)socket;
+    (void)on;
+#endif
+}
+
+// Segments the kernel has sent on `socket` (pure ACKs included); nullopt
+// before Linux 4.2 or elsewhere.
+std::optional<uint32_t> segments_out(tcp::socket& socket) {
+#if defined(__linux__) && defined(TCP_INFO)
+    TcpInfo info{};
+    socklen_t len = sizeof(info);
+    if (::getsockopt(socket.native_handle(), IPPROTO_TCP, TCP_INFO, &info, &len) != 0 ||
+        len < offsetof(TcpInfo, segs_out) + sizeof(info.segs_out)) {
+        return std::nullopt;
+    }
+    return info.segs_out;
+#else
+    (void)socket;
+    return std::nullopt;
+#endif
+}
+
+struct HostPort {
+    std::string host;
+    uint16_t port;
+};
+
+// "host", "host:port", "[ipv6]:port" or a bare IPv6 address.
+std::optional<HostPort> split_endpoint(std::string_view text, uint16_t default_port) {
+    std::string_view host = text;
+    std::string_view port;
+    if (text.starts_with('[')) {
+        const auto close = text.find(']');
+        if (close == std::string_view::npos) {
+            return std::nullopt;
+        }
+        host = text.substr(1, close - 1);
+        if (close + 1 < text.size()) {
+            if (text[close + 1] != ':') {
+                return std::nullopt;
+            }
+            port = text.substr(close + 2);
+        }
+    } else if (const auto colon = text.rfind(':');
+               colon != std::string_view::npos && text.find(':') == colon) {
+        host = text.substr(0, colon);
+        port = text.substr(colon + 1);
+    }
+
+    uint16_t number = default_port;
+    if (!port.empty()) {
+        const auto [end, err] = std::from_chars(port.data(), port.data() + port.size(), number);
+        if (err != std::errc() || end != port.data() + port.size() || number == 0) {
+            return std::nullopt;
+        }
+    }
+    return HostPort{std::string(host), number};
+}
+
+/// Call `done` once every name in `hosts` is resolved (or failed).
+void resolve_all(const std::vector<std::string>& hosts, std::function<void(bool)> done) {
+    auto left = std::make_shared<std::atomic<std::size_t>>(hosts.size());
+    for (const auto& host : hosts) {
+        DnsCache::shared().resolve(host, [left, done](const DnsCache::Addresses&) {
+            if (left->fetch_sub(1) == 1) {
+                done(true);
+            }
+        });
+    }
+}
+
+} // namespace
+
+PeerClient::PeerClient(asio::io_context& io, std::size_t queue_budget,
+                       std::size_t zerocopy_min_bytes)
+    : io_(io), socket_(io), queue_budget_(queue_budget),
+      zerocopy_min_bytes_(zerocopy_min_bytes) {}
+
+std::vector<tcp::endpoint> PeerClient::resolve_endpoints(const PeerAddress& address,
+                                                         std::vector<std::string>* unresolved) {
+    std::vector<tcp::endpoint> v4, v6;
+    std::optional<tcp::endpoint> first;
+    auto add_endpoint = [&](const tcp::endpoint& endpoint) {
+        if (first == endpoint || std::ranges::find(v4, endpoint) != v4.end() ||
+            std::ranges::find(v6, endpoint) != v6.end()) {
+            return;
+        }
+        if (!first) {
+            first = endpoint;
+        } else {
+            (endpoint.address().is_v6() ? v6 : v4).push_back(endpoint);
+        }
+    };
+    auto add = [&](std::string_view text) {
+        const auto parsed = split_endpoint(text, address.port);
+        asio::error_code ec;
+        if (parsed) {
+            if (const auto ip = asio::ip::make_address(parsed->host, ec); !ec) {
+                add_endpoint(tcp::endpoint(ip, parsed->port));
+                return;
+            }
+        }
+        if (!parsed || !DnsCache::is_hostname(parsed->host)) {
+            spdlog::warn("Invalid peer address '{}'", text);
+            return;
+        }
+        // A name: only what the cache already has, so a send never waits
+        // on DNS while there is another address to try.
+        if (auto addresses = DnsCache::shared().lookup(parsed->host)) {
+            for (const auto& ip : *addresses) {
+                add_endpoint(tcp::endpoint(ip, parsed->port));
+            }
+        } else if (unresolved) {
+            unresolved->push_back(parsed->host);
+        }
+    };
+    add(address.ip);
+    for (const auto& alternate : address.alternates) {
+        add(alternate);
+    }
+
+    // RFC 8305 §4: after the first, alternate families so one that is
+    // broken on this network costs a stagger, not a run of timeouts.
+    std::vector<tcp::endpoint> out;
+    if (!first) {
+        return out;
+    }
+    out.push_back(*first);
+    auto& next = first->address().is_v6() ? v4 : v6;
+    auto& other = first->address().is_v6() ? v6 : v4;
+    for (std::size_t i = 0; i < std::max(next.size(), other.size()); ++i) {
+        if (i < next.size()) out.push_back(next[i]);
+        if (i < other.size()) out.push_back(other[i]);
+    }
+    return out;
+}
+
+struct PeerClient::Race {
+    Race(asio::io_context& io, std::vector<tcp::endpoint> endpoints, Completion done)
+        : endpoints(std::move(endpoints)), wheel(TimerWheel::of(io)), done(std::move(done)) {}
+
+    std::vector<tcp::endpoint> endpoints;
+    std::vector<std::shared_ptr<tcp::socket>> attempts;   // one per endpoint tried so far
+    TimerWheel& wheel;                                    // runs callbacks on io_, like a timer
+    TimerWheel::Handle deadline;
+    TimerWheel::Handle stagger;
+    std::size_t pending = 0;
+    bool finished = false;
+    Completion done;
+};
+
+void PeerClient::start_connect(std::vector<tcp::endpoint> endpoints,
+                               std::chrono::milliseconds timeout, Completion done) {
+    asio::post(io_, [self = shared_from_this(), endpoints = std::move(endpoints), timeout,
+                     done = std::move(done)]() mutable {
+        auto race = std::make_shared<Race>(self->io_, std::move(endpoints), std::move(done));
+        race->deadline = race->wheel.schedule(timeout, [self, race] {
+            self->end_race(*race, asio::error::timed_out);
+        });
+        self->next_attempt(race);
+    });
+}
+
+void PeerClient::next_attempt(const std::shared_ptr<Race>& race) {
+    if (race->finished || race->attempts.size() == race->endpoints.size()) {
+        return;
+    }
+    const auto& endpoint = race->endpoints[race->attempts.size()];
+    auto socket = race->attempts.emplace_back(std::make_shared<tcp::socket>(io_));
+    ++race->pending;
+    socket->async_connect(endpoint, [self = shared_from_this(), race, socket](
+                                        const asio::error_code& ec) {
+        --race->pending;
+        if (race->finished) {
+            return;                             // lost the race; end_race closed it
+        }
+        if (!ec) {
+            self->socket_ = std::move(*socket);
+            self->end_race(*race, ec);
+        } else if (race->attempts.size() < race->endpoints.size()) {
+            self->next_attempt(race);           // don't sit out the stagger
+        } else if (race->pending == 0) {
+            self->end_race(*race, ec);
+        }
+    });
+    if (race->attempts.size() < race->endpoints.size()) {
+        // Replaces the wait for the attempt before, if still armed.
+        race->wheel.cancel(race->stagger);
+        race->stagger = race->wheel.schedule(kConnectStagger, [self = shared_from_this(), race] {
+            self->next_attempt(race);
+        });
+    }
+}
+
+void PeerClient::end_race(Race& race, const asio::error_code& ec) {
+    if (race.finished) {
+        return;
+    }
+    race.finished = true;
+    race.wheel.cancel(race.deadline);
+    race.wheel.cancel(race.stagger);
+    for (auto& attempt : race.attempts) {
+        asio::error_code ignored;
+        attempt->close(ignored);                // the winner's was moved out already
+    }
+    if (!ec && zerocopy_min_bytes_ > 0) {
+        zerocopy_.enable(socket_, zerocopy_min_bytes_);
+    }
+    auto done = std::move(race.done);
+    done(ec);
+}
+
+bool PeerClient::finish_connect(const PeerAddress& address, const asio::error_code& ec) {
+    const auto others = address.alternates.empty()
+        ? std::string() : fmt::format(" (+{} more)", address.alternates.size());
+    if (ec) {
+        spdlog::warn("Failed to connect to {}:{}{} — {}", address.ip, address.port, others,
+                     ec == asio::error::timed_out ? "timed out" : ec.message());
+        asio::error_code ignored;
+        socket_.close(ignored);
+        return false;
+    }
+
+    asio::error_code ignored;
+    socket_.set_option(tcp::no_delay(true), ignored);
+    {
+        std::lock_guard lock(mutex_);
+        corked_ = false;
+        segments_seen_.reset();
+    }
+    const auto remote = socket_.remote_endpoint(ignored);
+    spdlog::debug("Connected to peer at {}:{}", remote.address().to_string(), remote.port());
+    {
+        std::lock_guard lock(mutex_);
+        remote_ = fmt::format("{}:{}", remote.address().to_string(), remote.port());
+    }
+    return true;
+}
+
+bool PeerClient::connect(const std::string& ip, uint16_t port,
+                         std::chrono::milliseconds timeout) {
+    return connect(PeerAddress{ip, port, {}}, timeout);
+}
+
+bool PeerClient::connect(const PeerAddress& address, std::chrono::milliseconds timeout) {
+    if (io_.get_executor().running_in_this_thread()) {
+        spdlog::error("PeerClient::connect called from its own I/O thread");
+        return false;
+    }
+
+    std::vector<std::string> unresolved;
+    auto endpoints = resolve_endpoints(address, &unresolved);
+    if (endpoints.empty() && !unresolved.empty()) {
+        // Names alone, none cached yet: the one wait for DNS, out of the
+        // connect's own time.
+        const auto started = std::chrono::steady_clock::now();
+        auto resolved = std::make_shared<std::promise<bool>>();
+        auto ready = resolved->get_future();
+        resolve_all(unresolved, [resolved](bool) { resolved->set_value(true); });
+        if (ready.wait_for(timeout) != std::future_status::ready) {
+            spdlog::warn("Resolving {} timed out", address.ip);
+            return false;
+        }
+        timeout -= std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        endpoints = resolve_endpoints(address);
+    }
+    if (endpoints.empty() || timeout <= std::chrono::milliseconds(0)) {
+        return false;
+    }
+
+    std::promise<asio::error_code> done;
+    auto result = done.get_future();
+    start_connect(std::move(endpoints), timeout,
+                  [&done](const asio::error_code& ec) { done.set_value(ec); });
+    return finish_connect(address, result.get());
+}
+
+asio::awaitable<bool> PeerClient::co_connect(std::string ip, uint16_t port,
+                                             std::chrono::milliseconds timeout) {
+    co_return co_await co_connect(PeerAddress{std::move(ip), port, {}}, timeout);
+}
+
+asio::awaitable<bool> PeerClient::co_connect(PeerAddress address,
+                                             std::chrono::milliseconds timeout) {
+    std::vector<std::string> unresolved;
+    auto endpoints = resolve_endpoints(address, &unresolved);
+    if (endpoints.empty() && !unresolved.empty()) {
+        // Names alone, none cached yet: the one wait for DNS, out of the
+        // connect's own time. DnsCache resolves one name at a time, so a
+        // hung lookup must not hold this send; its late answer still
+        // lands in the cache for the next one.
+        const auto started = std::chrono::steady_clock::now();
+        auto resolved = coro::Deferred<bool>::start(
+            [&](auto done) { resolve_all(unresolved, std::move(done)); });
+        if (!co_await resolved->get_for(timeout)) {
+            spdlog::warn("Resolving {} timed out", address.ip);
+            co_return false;
+        }
+        timeout -= std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - started);
+        endpoints = resolve_endpoints(address);
+    }
+    if (endpoints.empty() || timeout <= std::chrono::milliseconds(0)) {
+        co_return false;
+    }
+
+    const auto ec = co_await coro::from_callback<asio::error_code>([&](auto done) {
+        start_connect(std::move(endpoints), timeout, std::move(done));
+    });
+    co_return finish_connect(address, ec);
+}
+
+bool PeerClient::send(std::string_view payload, std::chrono::milliseconds timeout) {
+    if (io_.get_executor().running_in_this_thread()) {
+        spdlog::error("PeerClient::send called from its own I/O thread");
+        return false;
+    }
+
+    auto done = std::make_shared<std::promise<asio::error_code>>();
+    auto result = done->get_future();
+    {
+        std::unique_lock lock(mutex_);
+        const bool has_room = drained_.wait_for(lock, timeout, [&] {
+            return !socket_.is_open() || has_room_locked(payload.size(), TrafficClass::Interactive);
+        });
+        if (!has_room) {
+            spdlog::warn("Peer send queue full ({} bytes queued)", queued_bytes_);
+            return false;
+        }
+        if (!enqueue_locked(std::string(payload),
+                            [done](const asio::error_code& ec) { done->set_value(ec); },
+                            TrafficClass::Interactive)) {
+            return false;
+        }
+    }
+
+    const auto ec = result.get();
+    if (ec) {
+        spdlog::warn("Send failed: {}", ec.message());
+        return false;
+    }
+    return true;
+}
+
+asio::awaitable<bool> PeerClient::co_send(std::string payload) {
+    const auto ec = co_await coro::from_callback<asio::error_code>([&](auto done) {
+        if (!send_async(std::move(payload), done)) {
+            done(asio::error::no_buffer_space);
+        }
+    });
+    if (ec) {
+        spdlog::warn("Send failed: {}", ec.message());
+        co_return false;
+    }
+    co_return true;
+}
+
+bool PeerClient::send_async(std::string payload, Completion done, TrafficClass cls) {
+    std::lock_guard lock(mutex_);
+    if (!has_room_locked(payload.size(), cls)) {
+        return false;
+    }
+    return enqueue_locked(std::move(payload), std::move(done), cls);
+}
+
+bool PeerClient::has_room_locked(std::size_t bytes, TrafficClass cls) const {
+    if (queued_bytes_ + bytes > queue_budget_) {
+        return false;
+    }
+    // Past the SendQueues memory budget only control frames still queue;
+    // chat goes the offline way instead.
+    if (cls != TrafficClass::Control && memory::over_budget(memory::Area::SendQueues, bytes)) {
+        return false;
+    }
+    return cls != TrafficClass::Bulk ||
+           class_bytes_[traffic::index(cls)] + bytes <=
+               queue_budget_ / 100 * traffic::kBulkBudgetPercent;
+}
+
+std::size_t PeerClient::queued_bytes() const {
+    std::lock_guard lock(mutex_);
+    return queued_bytes_;
+}
+
+bool PeerClient::enqueue_locked(std::string payload, Completion done, TrafficClass cls) {
+    if (!socket_.is_open()) {
+        return false;
+    }
+    capture::frame(capture::Kind::FrameOut, remote_, payload);
+    const std::size_t bytes = framing::kHeaderSize + payload.size();
+    queued_bytes_ += bytes;
+    class_bytes_[traffic::index(cls)] += bytes;
+    send_queue_bytes.add(static_cast<int64_t>(bytes));
+    memory::charge(memory::Area::SendQueues, static_cast<int64_t>(bytes));
+    queues_[traffic::index(cls)].push_back(
+        OutFrame{framing::encode_header(static_cast<uint32_t>(payload.size())),
+                 std::move(payload), std::move(done), cls});
+    if (!writing_) {
+        writing_ = true;
+        asio::post(io_, bind_handler_memory(post_memory_,
+                                            [self = shared_from_this()] { self->write_pending(); }));
+    }
+    return true;
+}
+
+void PeerClient::write_pending() {
+    // Cap a single gathered write; whatever is left goes in the next one.
+    constexpr std::size_t kMaxBatchFrames = 64;
+    constexpr std::size_t kMaxBatchBytes = 256 * 1024;
+
+    std::size_t bytes = 0;
+    {
+        std::lock_guard lock(mutex_);
+        // Deficit round robin: each round a waiting class earns its quantum
+        // and writes frames while its credit covers them. Rounds repeat
+        // until the batch is full or every queue is empty, so one class on
+        // its own still fills whole batches.
+        bool full = false;
+        while (!full && inflight_.size() < kMaxBatchFrames) {
+            bool waiting = false;
+            for (std::size_t c = 0; c < kTrafficClasses && !full; ++c) {
+                auto& queue = queues_[c];
+                if (queue.empty()) {
+                    deficit_[c] = 0;            // no banking credit while idle
+                    continue;
+                }
+                deficit_[c] += traffic::kQuantum[c];
+                while (!queue.empty() && queue.front().payload.size() <= deficit_[c]) {
+                    const std::size_t size = queue.front().payload.size();
+                    if (inflight_.size() == kMaxBatchFrames ||
+                        (!inflight_.empty() && bytes + size > kMaxBatchBytes)) {
+                        full = true;
+                        break;
+                    }
+                    deficit_[c] -= size;
+                    bytes += size;
+                    inflight_.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+                waiting = waiting || !queue.empty();
+            }
+            if (!waiting) {
+                break;
+            }
+        }
+        if (inflight_.empty()) {
+            writing_ = false;
+            on_drain_locked();
+            return;
+        }
+        // Frames left behind go in the next write; hold partial segments
+        // for them rather than send one short packet per write.
+        const bool more = std::ranges::any_of(queues_, [](const auto& q) { return !q.empty(); });
+        if (more && !corked_) {
+            set_cork(socket_, true);
+            corked_ = true;
+        }
+        if (corked_) {
+            corked_writes.inc();
+        }
+        urgent_batch_ = corked_ && std::ranges::any_of(inflight_, [](const OutFrame& frame) {
+            return frame.cls != TrafficClass::Bulk;
+        });
+    }
+
+    // inflight_ is complete before taking buffer views, so no frame moves.
+    gather_.clear();
+    gather_.reserve(inflight_.size() * 2);
+    for (const auto& frame : inflight_) {
+        gather_.push_back(asio::buffer(frame.header));
+        gather_.push_back(asio::buffer(frame.payload));
+    }
+
+    if (zerocopy_.wants(bytes)) {
+        zerocopy_batch_ = true;
+        zerocopy_.async_write(gather_, [self = shared_from_this()](const asio::error_code& ec) {
+            self->on_write(ec);
+        });
+        return;
+    }
+
+    // A span, not the vector: the write operation copies its buffer sequence.
+    asio::async_write(socket_, std::span<const asio::const_buffer>(gather_),
+        bind_handler_memory(write_memory_,
+            [self = shared_from_this()](const asio::error_code& ec, std::size_t) {
+                self->on_write(ec);
+            }));
+}
+
+void PeerClient::on_write(const asio::error_code& ec) {
+    std::size_t written = 0;
+    const std::size_t inflight_frames = inflight_.size();
+    std::array<std::size_t, kTrafficClasses> by_class{};
+    for (auto& frame : inflight_) {
+        const std::size_t bytes = framing::kHeaderSize + frame.payload.size();
+        written += bytes;
+        by_class[traffic::index(frame.cls)] += bytes;
+        if (frame.done) {
+            frame.done(ec);
+        }
+    }
+    if (zerocopy_batch_) {
+        // The kernel may still be sending from these pages.
+        zerocopy_batch_ = false;
+        zerocopy_.retain(std::exchange(inflight_, {}));
+    } else {
+        inflight_.clear();
+    }
+
+    {
+        std::lock_guard lock(mutex_);
+        queued_bytes_ -= written;
+        for (std::size_t c = 0; c < kTrafficClasses; ++c) {
+            class_bytes_[c] -= by_class[c];
+        }
+        send_queue_bytes.add(-static_cast<int64_t>(written));
+        memory::charge(memory::Area::SendQueues, -static_cast<int64_t>(written));
+    }
+    drained_.notify_all();
+
+    if (ec) {
+        fail_all(ec);
+        return;
+    }
+    frames_sent.inc(inflight_frames);
+    // A chat or control frame doesn't wait out the rest of the burst: it
+    // is in the socket now, so uncorking sends it as NODELAY would.
+    {
+        std::lock_guard lock(mutex_);
+        if (std::exchange(urgent_batch_, false) && corked_) {
+            set_cork(socket_, false);
+            corked_ = false;
+        }
+    }
+    write_pending();
+}
+
+void PeerClient::on_drain_locked() {
+    if (corked_) {
+        set_cork(socket_, false);
+        corked_ = false;
+    }
+    if (const auto segments = segments_out(socket_)) {
+        // The first sample only sets the baseline: the handshake isn't ours.
+        if (segments_seen_) {
+            segments_sent.inc(*segments - *segments_seen_);
+        }
+        segments_seen_ = segments;
+    }
+}
+
+void PeerClient::fail_all(const asio::error_code& ec) {
+    asio::error_code ignored;
+    socket_.close(ignored);
+
+    std::array<std::deque<OutFrame>, kTrafficClasses> pending;
+    {
+        std::lock_guard lock(mutex_);
+        pending.swap(queues_);
+        send_queue_bytes.add(-static_cast<int64_t>(queued_bytes_));
+        memory::charge(memory::Area::SendQueues, -static_cast<int64_t>(queued_bytes_));
+        queued_bytes_ = 0;
+        class_bytes_ = {};
+        deficit_ = {};
+        writing_ = false;
+        corked_ = false;
+        urgent_batch_ = false;
+    }
+    drained_.notify_all();
+    for (auto& queue : pending) {
+        for (auto& frame : queue) {
+            if (frame.done) {
+                frame.done(ec);
+            }
+        }
+    }
+}
+
+asio::awaitable<void> PeerClient::co_read(FrameHandler on_frame, std::size_t max_frame_size) {
+    FrameReader reader(max_frame_size);
+    std::string_view payload;
+    const std::string remote = [this] {
+        std::lock_guard lock(mutex_);
+        return remote_;
+    }();
+    for (;;) {
+        // Forwarded messages land in the same queues a session's do.
+        if (backpressure_ && backpressure_->paused()) {
+            co_await backpressure_->wait();
+        }
+        asio::error_code ec;
+        auto span = reader.prepare();
+        const std::size_t bytes = co_await socket_.async_read_some(
+            asio::buffer(span.data(), span.size()), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec != asio::error::eof && ec != asio::error::operation_aborted) {
+                spdlog::warn("Read from peer failed: {}", ec.message());
+            }
+            co_return;
+        }
+        reader.commit(bytes);
+        for (;;) {
+            const auto status = reader.next(payload);
+            if (status == FrameReader::Status::NeedMore) {
+                break;
+            }
+            if (status == FrameReader::Status::Oversized) {
+                spdlog::error("Peer sent a frame above the {} byte limit, closing",
+                              reader.max_frame_size());
+                co_return;
+            }
+            capture::frame(capture::Kind::FrameIn, remote, payload);
+            on_frame(payload);
+        }
+    }
+}
+
+void PeerClient::disconnect() {
+    // Closing cancels an in-flight write; on_write then fails the queue.
+    auto close = [this] {
+        if (socket_.is_open()) {
+            asio::error_code ec;
+            socket_.shutdown(tcp::socket::shutdown_both, ec);
+            socket_.close(ec);
+        }
+    };
+    if (io_.get_executor().running_in_this_thread()) {
+        close();
+        return;
+    }
+    std::promise<void> done;
+    asio::post(io_, [&] { close(); done.set_value(); });
+    done.get_future().wait();
+}
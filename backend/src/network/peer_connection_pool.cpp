@@ -0,0 +1,362 @@
+/**
+ * PeerConnectionPool — Reuses outbound peer connections.
+ *
+ * Connections idle for longer than Options::idle_timeout are closed by a
+ * periodic sweep; when the pool is full the least recently used connection
+ * is closed to make room.
+ */
+
+#include "network/peer_connection_pool.h"
+#include "network/peer_client.h"
+#include "telemetry/peer_usage.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+using Clock = std::chrono::steady_clock;
+
+PeerConnectionPool::PeerConnectionPool() : PeerConnectionPool(Options{}) {}
+
+PeerConnectionPool::PeerConnectionPool(Options options)
+    : options_(options),
+      work_(asio::make_work_guard(io_)),
+      sweep_timer_(io_) {
+    schedule_sweep();
+    thread_ = std::thread([this] { io_.run(); });
+}
+
+PeerConnectionPool::~PeerConnectionPool() {
+    close_all();
+    asio::post(io_, [this] { sweep_timer_.cancel(); });
+    work_.reset();
+    io_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+bool PeerConnectionPool::send(const std::string& username, const PeerAddress& address,
+                              std::string_view payload) {
+    bool reused = false;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        reused = it != entries_.end() && it->second.address == address;
+    }
+
+    auto client = acquire(username, address, false);
+    if (client && client->send(payload)) {
+        peer_usage::of(username).sent(payload.size());
+        return true;
+    }
+
+    // A warm connection may have been closed by the peer since last use;
+    // retry once on a fresh socket before reporting failure.
+    if (reused) {
+        spdlog::debug("Pooled connection to {} went stale, reconnecting", username);
+        client = acquire(username, address, true);
+        if (client && client->send(payload)) {
+            peer_usage::of(username).sent(payload.size());
+            return true;
+        }
+    }
+
+    evict(username);
+    return false;
+}
+
+void PeerConnectionPool::send_async(const std::string& username, const PeerAddress& address,
+                                    std::string payload, std::function<void(bool)> done,
+                                    TrafficClass cls) {
+    peer_usage::of(username).sent(payload.size());
+    std::shared_ptr<PeerClient> client;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        if (it != entries_.end() && it->second.address == address &&
+            it->second.client->is_open()) {
+            it->second.last_used = Clock::now();
+            client = it->second.client;
+        }
+        if (!client) {
+            auto [queued, first] = connecting_async_.try_emplace(username);
+            queued->second.push_back({std::move(payload), std::move(done), false, cls});
+            if (first) {
+                asio::co_spawn(io_, connect_and_flush(username, address), asio::detached);
+            }
+            return;
+        }
+    }
+    if (!client->send_async(std::move(payload), [done](const asio::error_code& ec) {
+            if (done) done(!ec);
+        }, cls)) {
+        asio::post(io_, [done = std::move(done)] {
+            if (done) done(false);
+        });
+    }
+}
+
+void PeerConnectionPool::connect_async(const std::string& username, const PeerAddress& address,
+                                       std::function<void(bool)> done) {
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        if (it == entries_.end() || it->second.address != address ||
+            !it->second.client->is_open()) {
+            auto [queued, first] = connecting_async_.try_emplace(username);
+            queued->second.push_back({std::string(), std::move(done), true});
+            if (first) {
+                asio::co_spawn(io_, connect_and_flush(username, address), asio::detached);
+            }
+            return;
+        }
+        it->second.last_used = Clock::now();
+    }
+    asio::post(io_, [done = std::move(done)] { done(true); });
+}
+
+asio::awaitable<void> PeerConnectionPool::connect_and_flush(std::string username,
+                                                            PeerAddress address) {
+    // A blocking send() racing this connect may connect too; whichever
+    // pools its client last wins, the other socket is closed.
+    auto client = std::make_shared<PeerClient>(io_, options_.send_queue_bytes,
+                                               options_.zerocopy_min_bytes);
+    const bool connected = co_await client->co_connect(address, options_.connect_timeout);
+    if (connected && options_.hello) {
+        client->send_async(options_.hello(), {}, TrafficClass::Control);
+    }
+
+    std::vector<QueuedSend> queued;
+    std::shared_ptr<PeerClient> displaced;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = connecting_async_.find(username);
+        if (it != connecting_async_.end()) {
+            queued.swap(it->second);
+            connecting_async_.erase(it);
+        }
+        if (connected) {
+            auto& entry = entries_[username];
+            displaced = std::move(entry.client);
+            entry = Entry{client, std::move(address), Clock::now()};
+            if (entries_.size() > options_.max_connections) {
+                evict_lru_locked();
+            }
+        }
+    }
+    if (displaced) {
+        displaced->disconnect();
+    }
+
+    for (auto& send : queued) {
+        auto done = send.done;
+        if (send.connect_only) {
+            done(connected);
+            continue;
+        }
+        if (!connected || !client->send_async(std::move(send.payload),
+                                              [done](const asio::error_code& ec) {
+                                                  if (done) done(!ec);
+                                              },
+                                              send.cls)) {
+            if (done) done(false);
+        }
+    }
+}
+
+std::shared_ptr<PeerClient> PeerConnectionPool::acquire(const std::string& username,
+                                                        const PeerAddress& address,
+                                                        bool force_new) {
+    std::shared_ptr<PeerClient> known;
+    std::shared_ptr<std::mutex> connect_gate;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        if (it != entries_.end()) {
+            const bool same_endpoint = it->second.address == address;
+            if (!force_new && same_endpoint && it->second.client->is_open()) {
+                it->second.last_used = Clock::now();
+                return it->second.client;
+            }
+            known = it->second.client;
+        }
+        auto& gate = connecting_[username];
+        if (!gate) {
+            gate = std::make_shared<std::mutex>();
+        }
+        connect_gate = gate;
+    }
+
+    // Single-flight: concurrent senders to the same peer wait for one
+    // connect instead of racing to open (and then discard) several sockets.
+    // Connecting happens outside mutex_ so a slow peer doesn't block others.
+    std::lock_guard connecting(*connect_gate);
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        if (it != entries_.end() && it->second.client != known &&
+            it->second.address == address && it->second.client->is_open()) {
+            it->second.last_used = Clock::now();
+            return it->second.client;
+        }
+    }
+
+    auto client = std::make_shared<PeerClient>(io_, options_.send_queue_bytes,
+                                               options_.zerocopy_min_bytes);
+    const bool connected = client->connect(address, options_.connect_timeout);
+    if (connected && options_.hello) {
+        client->send_async(options_.hello(), {}, TrafficClass::Control);
+    }
+
+    std::shared_ptr<PeerClient> displaced;
+    {
+        std::lock_guard lock(mutex_);
+        connecting_.erase(username);
+        auto it = entries_.find(username);
+        if (it != entries_.end()) {
+            displaced = std::move(it->second.client);
+            entries_.erase(it);
+        }
+        if (connected) {
+            entries_.emplace(username, Entry{client, address, Clock::now()});
+            if (entries_.size() > options_.max_connections) {
+                evict_lru_locked();
+            }
+        }
+    }
+    if (displaced) {
+        displaced->disconnect();
+    }
+    return connected ? client : nullptr;
+}
+
+void PeerConnectionPool::evict_lru_locked() {
+    // Linear scan: the pool is small and eviction only happens when full.
+    auto oldest = std::min_element(entries_.begin(), entries_.end(),
+        [](const auto& a, const auto& b) { return a.second.last_used < b.second.last_used; });
+    if (oldest != entries_.end()) {
+        auto client = std::move(oldest->second.client);
+        entries_.erase(oldest);
+        asio::post(io_, [client] { client->disconnect(); });
+    }
+}
+
+bool PeerConnectionPool::has_connection(const std::string& username) const {
+    std::lock_guard lock(mutex_);
+    auto it = entries_.find(username);
+    return it != entries_.end() && it->second.client->is_open();
+}
+
+void PeerConnectionPool::evict(const std::string& username) {
+    std::shared_ptr<PeerClient> client;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(username);
+        if (it == entries_.end()) {
+            return;
+        }
+        client = std::move(it->second.client);
+        entries_.erase(it);
+    }
+    client->disconnect();
+}
+
+void PeerConnectionPool::keep_warm(std::vector<std::string> usernames) {
+    std::lock_guard lock(mutex_);
+    warm_.clear();
+    warm_.insert(std::make_move_iterator(usernames.begin()),
+                 std::make_move_iterator(usernames.end()));
+}
+
+void PeerConnectionPool::close_all() {
+    std::unordered_map<std::string, Entry> entries;
+    {
+        std::lock_guard lock(mutex_);
+        entries.swap(entries_);
+    }
+    for (auto& [_, entry] : entries) {
+        entry.client->disconnect();
+    }
+}
+
+bool PeerConnectionPool::drain(std::chrono::steady_clock::time_point deadline) {
+    constexpr std::chrono::milliseconds kPoll{10};
+    for (;;) {
+        std::vector<std::shared_ptr<PeerClient>> clients;
+        bool connecting;
+        {
+            std::lock_guard lock(mutex_);
+            connecting = !connecting_async_.empty();
+            for (const auto& [_, entry] : entries_) {
+                clients.push_back(entry.client);
+            }
+        }
+        const bool busy = connecting ||
+            std::any_of(clients.begin(), clients.end(), [](const auto& client) {
+                return client->is_open() && client->queued_bytes() > 0;
+            });
+        if (!busy) {
+            return true;
+        }
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(
+            std::min<std::chrono::steady_clock::duration>(kPoll, deadline - now));
+    }
+}
+
+std::size_t PeerConnectionPool::size() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+std::unordered_map<std::string, std::size_t> PeerConnectionPool::queued_by_peer() const {
+    std::unordered_map<std::string, std::size_t> queued;
+    std::lock_guard lock(mutex_);
+    for (const auto& [username, entry] : entries_) {
+        if (const std::size_t bytes = entry.client->queued_bytes(); bytes > 0) {
+            queued.emplace(username, bytes);
+        }
+    }
+    return queued;
+}
+
+void PeerConnectionPool::schedule_sweep() {
+    sweep_timer_.expires_after(std::max<std::chrono::seconds>(options_.idle_timeout / 2,
+                                                              std::chrono::seconds(1)));
+    sweep_timer_.async_wait([this](const asio::error_code& ec) {
+        if (ec) {
+            return;
+        }
+        sweep();
+        schedule_sweep();
+    });
+}
+
+void PeerConnectionPool::sweep() {
+    watchdog::Tag busy("peer_pool.sweep");
+    const auto cutoff = Clock::now() - options_.idle_timeout;
+    std::vector<std::shared_ptr<PeerClient>> idle;
+    {
+        std::lock_guard lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            const bool unused = it->second.last_used < cutoff && !warm_.contains(it->first);
+            if (unused || !it->second.client->is_open()) {
+                idle.push_back(std::move(it->second.client));
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto& client : idle) {
+        client->disconnect();
+    }
+    if (!idle.empty()) {
+        spdlog::debug("Evicted {} idle peer connection(s)", idle.size());
+    }
+}
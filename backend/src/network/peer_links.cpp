@@ -0,0 +1,460 @@
+/**
+ * PeerLinks — Channels for several identities over shared peer links.
+ *
+ * All state sits under one mutex. Frames are handed to a link's PeerClient
+ * under it, so each channel's frames keep their order; PeerClient runs its
+ * completions on the links' thread without its own lock held, and they may
+ * take this one.
+ */
+
+#include "network/peer_links.h"
+#include "network/mux.h"
+#include "telemetry/memory.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <future>
+
+#include <spdlog/spdlog.h>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+metrics::Gauge& links_open =
+    metrics::gauge("p2p_mux_links", "Outbound peer links shared by local identities");
+metrics::Gauge& channels_open =
+    metrics::gauge("p2p_mux_channels", "Identity-pair channels on shared peer links");
+metrics::Counter& window_stalls =
+    metrics::counter("p2p_mux_window_stalls_total",
+                     "Times a link channel had frames left waiting for window credit");
+
+} // namespace
+
+PeerLinks::PeerLinks() : PeerLinks(Options{}) {}
+
+PeerLinks::PeerLinks(Options options)
+    : options_(options),
+      work_(asio::make_work_guard(io_)),
+      sweep_timer_(io_) {
+    schedule_sweep();
+    thread_ = std::thread([this] { io_.run(); });
+}
+
+PeerLinks::~PeerLinks() {
+    std::unordered_map<std::string, std::shared_ptr<Link>> links;
+    {
+        std::lock_guard lock(mutex_);
+        links.swap(links_);
+        for (const auto& [_, link] : links) {
+            for (const auto& [_, channel] : link->channels) {
+                memory::charge(memory::Area::SendQueues,
+                               -static_cast<int64_t>(channel.waiting_bytes));
+            }
+        }
+        update_gauges_locked();
+    }
+    for (auto& [_, link] : links) {
+        link->client->disconnect();
+    }
+    asio::post(io_, [this] { sweep_timer_.cancel(); });
+    work_.reset();
+    io_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+std::string PeerLinks::link_key(const PeerAddress& address) {
+    return address.ip + ":" + std::to_string(address.port);
+}
+
+std::string PeerLinks::pair_key(const std::string& from, const std::string& to) {
+    return from + '\n' + to;
+}
+
+void PeerLinks::set_hello(const std::string& from, std::function<std::string()> hello) {
+    std::lock_guard lock(mutex_);
+    hellos_[from] = std::move(hello);
+}
+
+bool PeerLinks::send(const std::string& from, const std::string& to, const PeerAddress& address,
+                     std::string_view payload) {
+    auto result = std::make_shared<std::promise<bool>>();
+    auto written = result->get_future();
+    send_async(from, to, address, std::string(payload),
+               [result](bool ok) { result->set_value(ok); });
+    // A channel out of credit waits for the receiver; don't wait forever.
+    if (written.wait_for(options_.connect_timeout + std::chrono::seconds(5)) !=
+        std::future_status::ready) {
+        return false;
+    }
+    return written.get();
+}
+
+void PeerLinks::send_async(const std::string& from, const std::string& to,
+                           const PeerAddress& address, std::string payload,
+                           std::function<void(bool)> done, TrafficClass cls) {
+    std::vector<std::function<void(bool)>> failed;
+    {
+        std::lock_guard lock(mutex_);
+        std::shared_ptr<Link> link;
+        Channel& channel = channel_locked(from, to, address, link);
+        const std::size_t bytes = payload.size();
+        if (channel.waiting_bytes + bytes > options_.channel_queue_bytes) {
+            failed.push_back(std::move(done));
+        } else {
+            channel.waiting.push_back({std::move(payload), std::move(done), cls});
+            channel.waiting_bytes += bytes;
+            memory::charge(memory::Area::SendQueues, static_cast<int64_t>(bytes));
+            if (link->connected) {
+                pump_locked(*link, channel, failed);
+            }
+        }
+        update_gauges_locked();
+    }
+    fail(std::move(failed));
+}
+
+void PeerLinks::connect_async(const std::string& from, const std::string& to,
+                              const PeerAddress& address, std::function<void(bool)> done) {
+    std::lock_guard lock(mutex_);
+    std::shared_ptr<Link> link;
+    Channel& channel = channel_locked(from, to, address, link);
+    update_gauges_locked();
+    if (link->connected) {
+        asio::post(io_, [done = std::move(done)] { done(true); });
+        return;
+    }
+    // An empty frame stands in for the connect: pump_locked completes it
+    // without sending anything once the link is up.
+    channel.waiting.push_back({std::string(), std::move(done), TrafficClass::Control});
+}
+
+PeerLinks::Channel& PeerLinks::channel_locked(const std::string& from, const std::string& to,
+                                              const PeerAddress& address,
+                                              std::shared_ptr<Link>& link) {
+    const auto now = Clock::now();
+    auto& slot = links_[link_key(address)];
+    // A dead link's reader hasn't noticed yet; its drop_link leaves this
+    // replacement alone.
+    if (!slot || (slot->connected && !slot->client->is_open())) {
+        slot = std::make_shared<Link>();
+        slot->client = std::make_shared<PeerClient>(io_, options_.send_queue_bytes,
+                                                    options_.zerocopy_min_bytes);
+        slot->address = address;
+        slot->last_used = now;
+        asio::co_spawn(io_, run_link(slot), asio::detached);
+        link = slot;
+        if (links_.size() > options_.max_links) {
+            evict_lru_locked();
+        }
+    } else {
+        link = slot;
+    }
+    link->last_used = now;
+
+    auto [pair, added] = link->by_pair.try_emplace(pair_key(from, to), link->next_id);
+    if (added) {
+        Channel channel;
+        channel.id = link->next_id++;
+        channel.from = from;
+        channel.to = to;
+        channel.credit = mux::kWindow;
+        link->channels.emplace(channel.id, std::move(channel));
+    }
+    Channel& channel = link->channels.at(pair->second);
+    channel.last_used = now;
+    return channel;
+}
+
+void PeerLinks::pump_locked(Link& link, Channel& channel,
+                            std::vector<std::function<void(bool)>>& failed) {
+    if (!channel.greeted) {
+        channel.greeted = true;
+        auto hello = hellos_.find(channel.from);
+        if (hello != hellos_.end() && hello->second) {
+            std::string frame = hello->second();
+            channel.credit -= static_cast<int64_t>(frame.size());
+            link.client->send_async(mux::encode_data(channel.id, frame), {},
+                                    TrafficClass::Control);
+        }
+    }
+    // A frame goes while any credit is left, so frames larger than the
+    // window still get through; the receiver allows one frame of overshoot.
+    while (!channel.waiting.empty() &&
+           (channel.credit > 0 || channel.waiting.front().payload.empty())) {
+        Waiting next = std::move(channel.waiting.front());
+        channel.waiting.pop_front();
+        const std::size_t bytes = next.payload.size();
+        channel.waiting_bytes -= bytes;
+        memory::charge(memory::Area::SendQueues, -static_cast<int64_t>(bytes));
+        if (bytes == 0) {
+            if (next.done) {
+                asio::post(io_, [done = std::move(next.done)] { done(true); });
+            }
+            continue;
+        }
+        auto done = next.done;
+        if (link.client->send_async(mux::encode_data(channel.id, next.payload),
+                                    [done](const asio::error_code& ec) {
+                                        if (done) done(!ec);
+                                    },
+                                    next.cls)) {
+            channel.credit -= static_cast<int64_t>(bytes);
+        } else {
+            failed.push_back(std::move(done));
+        }
+    }
+    if (!channel.waiting.empty() && link.connected) {
+        window_stalls.inc();
+    }
+}
+
+asio::awaitable<void> PeerLinks::run_link(std::shared_ptr<Link> link) {
+    if (co_await link->client->co_connect(link->address, options_.connect_timeout)) {
+        std::vector<std::function<void(bool)>> failed;
+        {
+            std::lock_guard lock(mutex_);
+            link->connected = true;
+            for (auto& [_, channel] : link->channels) {
+                pump_locked(*link, channel, failed);
+            }
+        }
+        fail(std::move(failed));
+        spdlog::debug("Peer link to {} open", link_key(link->address));
+        // No backpressure: window credit fills no queue of ours.
+        co_await link->client->co_read(
+            [this, link = link.get()](std::string_view frame) { on_window(*link, frame); });
+    }
+    drop_link(link);
+}
+
+void PeerLinks::on_window(Link& link, std::string_view frame) {
+    const auto parsed = mux::parse(frame);
+    if (!parsed || parsed->op != mux::Op::Window) {
+        return;
+    }
+    const auto credit = mux::parse_window(parsed->body);
+    std::vector<std::function<void(bool)>> failed;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = link.channels.find(parsed->channel);
+        if (it == link.channels.end() || !credit) {
+            return;
+        }
+        // Never more than a full window, whatever the remote claims.
+        it->second.credit = std::min<int64_t>(it->second.credit + *credit, mux::kWindow);
+        pump_locked(link, it->second, failed);
+    }
+    fail(std::move(failed));
+}
+
+void PeerLinks::drop_link(const std::shared_ptr<Link>& link) {
+    std::vector<std::function<void(bool)>> failed;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = links_.find(link_key(link->address));
+        if (it != links_.end() && it->second == link) {
+            links_.erase(it);
+        }
+        for (auto& [_, channel] : link->channels) {
+            for (auto& waiting : channel.waiting) {
+                failed.push_back(std::move(waiting.done));
+            }
+            memory::charge(memory::Area::SendQueues,
+                           -static_cast<int64_t>(channel.waiting_bytes));
+        }
+        link->channels.clear();
+        link->by_pair.clear();
+        update_gauges_locked();
+    }
+    link->client->disconnect();
+    for (auto& done : failed) {
+        if (done) done(false);
+    }
+}
+
+void PeerLinks::fail(std::vector<std::function<void(bool)>> dones) {
+    std::erase_if(dones, [](const auto& done) { return !done; });
+    if (dones.empty()) {
+        return;
+    }
+    asio::post(io_, [dones = std::move(dones)] {
+        for (const auto& done : dones) {
+            done(false);
+        }
+    });
+}
+
+bool PeerLinks::has_channel(const std::string& from, const std::string& to) const {
+    const auto key = pair_key(from, to);
+    std::lock_guard lock(mutex_);
+    return std::any_of(links_.begin(), links_.end(), [&](const auto& entry) {
+        const Link& link = *entry.second;
+        return link.connected && link.client->is_open() && link.by_pair.contains(key);
+    });
+}
+
+void PeerLinks::keep_warm(const std::string& from, std::vector<std::string> usernames) {
+    std::lock_guard lock(mutex_);
+    auto& warm = warm_[from];
+    warm.clear();
+    warm.insert(std::make_move_iterator(usernames.begin()),
+                std::make_move_iterator(usernames.end()));
+}
+
+void PeerLinks::close_channels(const std::string& from) {
+    std::vector<std::shared_ptr<Link>> unused;
+    std::vector<std::function<void(bool)>> failed;
+    {
+        std::lock_guard lock(mutex_);
+        hellos_.erase(from);
+        warm_.erase(from);
+        for (auto it = links_.begin(); it != links_.end();) {
+            Link& link = *it->second;
+            for (auto ch = link.channels.begin(); ch != link.channels.end();) {
+                if (ch->second.from != from) {
+                    ++ch;
+                    continue;
+                }
+                if (link.connected) {
+                    link.client->send_async(mux::encode_close(ch->first), {},
+                                            TrafficClass::Control);
+                }
+                for (auto& waiting : ch->second.waiting) {
+                    failed.push_back(std::move(waiting.done));
+                }
+                memory::charge(memory::Area::SendQueues,
+                               -static_cast<int64_t>(ch->second.waiting_bytes));
+                link.by_pair.erase(pair_key(from, ch->second.to));
+                ch = link.channels.erase(ch);
+            }
+            if (link.channels.empty()) {
+                unused.push_back(std::move(it->second));
+                it = links_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        update_gauges_locked();
+    }
+    for (auto& link : unused) {
+        link->client->disconnect();
+    }
+    fail(std::move(failed));
+}
+
+bool PeerLinks::drain(std::chrono::steady_clock::time_point deadline) {
+    constexpr std::chrono::milliseconds kPoll{10};
+    for (;;) {
+        bool busy = false;
+        {
+            std::lock_guard lock(mutex_);
+            for (const auto& [_, link] : links_) {
+                busy = busy || !link->connected ||
+                       (link->client->is_open() && link->client->queued_bytes() > 0);
+                for (const auto& [_, channel] : link->channels) {
+                    busy = busy || !channel.waiting.empty();
+                }
+            }
+        }
+        if (!busy) {
+            return true;
+        }
+        const auto now = Clock::now();
+        if (now >= deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::min<Clock::duration>(kPoll, deadline - now));
+    }
+}
+
+std::size_t PeerLinks::links() const {
+    std::lock_guard lock(mutex_);
+    return links_.size();
+}
+
+std::size_t PeerLinks::channels() const {
+    std::lock_guard lock(mutex_);
+    std::size_t count = 0;
+    for (const auto& [_, link] : links_) {
+        count += link->channels.size();
+    }
+    return count;
+}
+
+void PeerLinks::evict_lru_locked() {
+    auto oldest = std::min_element(links_.begin(), links_.end(),
+        [](const auto& a, const auto& b) { return a.second->last_used < b.second->last_used; });
+    if (oldest != links_.end()) {
+        // Its reader then ends and drop_link fails what it held.
+        auto client = oldest->second->client;
+        links_.erase(oldest);
+        asio::post(io_, [client] { client->disconnect(); });
+    }
+}
+
+void PeerLinks::update_gauges_locked() {
+    std::size_t count = 0;
+    for (const auto& [_, link] : links_) {
+        count += link->channels.size();
+    }
+    links_open.set(static_cast<int64_t>(links_.size()));
+    channels_open.set(static_cast<int64_t>(count));
+}
+
+void PeerLinks::schedule_sweep() {
+    sweep_timer_.expires_after(std::max<std::chrono::seconds>(options_.idle_timeout / 2,
+                                                              std::chrono::seconds(1)));
+    sweep_timer_.async_wait([this](const asio::error_code& ec) {
+        if (ec) {
+            return;
+        }
+        sweep();
+        schedule_sweep();
+    });
+}
+
+void PeerLinks::sweep() {
+    watchdog::Tag busy("peer_links.sweep");
+    const auto cutoff = Clock::now() - options_.idle_timeout;
+    std::vector<std::shared_ptr<Link>> idle;
+    std::size_t closed = 0;
+    {
+        std::lock_guard lock(mutex_);
+        for (auto it = links_.begin(); it != links_.end();) {
+            Link& link = *it->second;
+            if (!link.connected) {
+                ++it;
+                continue;
+            }
+            for (auto ch = link.channels.begin(); ch != link.channels.end();) {
+                const Channel& channel = ch->second;
+                const auto warm = warm_.find(channel.from);
+                const bool kept = warm != warm_.end() && warm->second.contains(channel.to);
+                if (channel.last_used >= cutoff || kept || !channel.waiting.empty()) {
+                    ++ch;
+                    continue;
+                }
+                link.client->send_async(mux::encode_close(ch->first), {}, TrafficClass::Control);
+                link.by_pair.erase(pair_key(channel.from, channel.to));
+                ch = link.channels.erase(ch);
+                ++closed;
+            }
+            if (link.channels.empty() || !link.client->is_open()) {
+                idle.push_back(std::move(it->second));
+                it = links_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        update_gauges_locked();
+    }
+    for (auto& link : idle) {
+        link->client->disconnect();
+    }
+    if (closed > 0 || !idle.empty()) {
+        spdlog::debug("Closed {} idle link channel(s) and {} link(s)", closed, idle.size());
+    }
+}
@@ -1,16 +1,199 @@
 /**
  * PeerServer — Listens for incoming TCP connections from other peers.
  *
- * Uses standalone ASIO for async I/O.
- * Each connected peer gets its own session that reads length-prefixed
- * JSON messages off the wire.
+ * Uses standalone ASIO for async I/O; the accept loop and each session's
+ * read loop are C++20 coroutines. Each connected peer gets its own
+ * PeerSession that reads length-prefixed frames off the wire. With an IoContextPool, sessions are spread
+ * across the pool and each one runs on its own strand, so the message
+ * callback may be invoked from several threads at once. With several
+ * acceptors, each has its own accept loop on its own context, and the
+ * kernel's SO_REUSEPORT hashing does the spreading.
  */
 
 #include "network/peer_server.h"
+#include "network/admission.h"
+#include "network/io_context_pool.h"
+#include "network/peer_session.h"
+#include "network/session_pool.h"
+#include "telemetry/capture.h"
+#include "telemetry/trace.h"
 
-// TODO: Implement
-// - PeerServer::PeerServer(io_context, port)
-// - PeerServer::start()           — async_accept loop
-// - PeerServer::on_accept(socket) — create PeerSession
-// - PeerSession::read_message()   — read header + body
-// - PeerSession::write_message()  — send header + body
+#include <spdlog/spdlog.h>
+
+using asio::ip::tcp;
+
+namespace {
+
+#if defined(SO_REUSEPORT)
+using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// A peer that vanishes without a FIN is found within about a minute,
+// rather than when the next write times out.
+constexpr int kKeepaliveIdleSeconds = 30;
+constexpr int kKeepaliveIntervalSeconds = 10;
+constexpr int kKeepaliveProbes = 3;
+
+tcp::acceptor make_acceptor(asio::io_context& io, uint16_t port, bool reuse_port) {
+    const tcp::endpoint endpoint(tcp::v4(), port);
+    tcp::acceptor acceptor(io);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(asio::socket_base::reuse_address(true));
+    if (reuse_port) {
+#if defined(SO_REUSEPORT)
+        acceptor.set_option(reuse_port_option(true));
+#else
+        spdlog::warn("node.listen_reuse_port isn't supported on this platform; ignoring it");
+#endif
+    }
+    acceptor.bind(endpoint);
+    acceptor.listen();
+    return acceptor;
+}
+
+std::size_t acceptor_count(const IoContextPool& pool, std::size_t wanted) {
+#if defined(SO_REUSEPORT)
+    return wanted == 0 ? pool.thread_count() : wanted;
+#else
+    if (wanted != 1) {
+        spdlog::warn("node.listen_acceptors needs SO_REUSEPORT; using one acceptor");
+    }
+    return 1;
+#endif
+}
+
+/// Frames are small and latency-bound: no Nagle, no delayed ACK for the
+/// first exchange (Linux clears TCP_QUICKACK again on its own), and
+/// keepalive probes on an idle connection. Failures are harmless.
+void tune_socket(tcp::socket& socket) {
+    asio::error_code ignored;
+    socket.set_option(tcp::no_delay(true), ignored);
+    socket.set_option(asio::socket_base::keep_alive(true), ignored);
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    socket.set_option(asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPIDLE>(
+                          kKeepaliveIdleSeconds), ignored);
+    socket.set_option(asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPINTVL>(
+                          kKeepaliveIntervalSeconds), ignored);
+    socket.set_option(asio::detail::socket_option::integer<IPPROTO_TCP, TCP_KEEPCNT>(
+                          kKeepaliveProbes), ignored);
+#endif
+#if defined(TCP_QUICKACK)
+    socket.set_option(asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK>(true),
+                      ignored);
+#endif
+}
+
+} // namespace
+
+PeerServer::PeerServer(asio::io_context& io, uint16_t port, std::size_t max_frame_size,
+                       bool reuse_port)
+    : session_pool_(std::make_shared<SessionPool>(SessionPool::Options{})),
+      max_frame_size_(max_frame_size) {
+    acceptors_.push_back(make_acceptor(io, port, reuse_port));
+}
+
+PeerServer::PeerServer(IoContextPool& pool, uint16_t port, Listen listen)
+    : pool_(&pool),
+      session_pool_(std::make_shared<SessionPool>(SessionPool::Options{})),
+      max_frame_size_(listen.max_frame_size) {
+    const std::size_t count = acceptor_count(pool, listen.acceptors);
+    acceptors_.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        acceptors_.push_back(
+            make_acceptor(pool.context(i), port, listen.reuse_port || count > 1));
+    }
+}
+
+asio::any_io_executor PeerServer::session_executor(tcp::acceptor& acceptor) {
+    if (pool_ && acceptors_.size() == 1) {
+        return asio::make_strand(pool_->next());
+    }
+    return asio::make_strand(acceptor.get_executor());
+}
+
+void PeerServer::start() {
+    for (auto& acceptor : acceptors_) {
+        asio::co_spawn(acceptor.get_executor(), accept_loop(acceptor), asio::detached);
+    }
+    if (acceptors_.size() > 1) {
+        spdlog::info("Accepting peer connections on {} sockets (SO_REUSEPORT)", acceptors_.size());
+    }
+}
+
+void PeerServer::stop() {
+    for (auto& acceptor : acceptors_) {
+        asio::post(acceptor.get_executor(), [&acceptor] {
+            asio::error_code ec;
+            acceptor.close(ec);
+        });
+    }
+}
+
+void PeerServer::set_on_message(MessageCallback cb) {
+    on_message_ = std::move(cb);
+}
+
+void PeerServer::set_relay_hub(RelayHub* hub) {
+    relay_hub_ = hub;
+}
+
+void PeerServer::set_admission(std::shared_ptr<AdmissionControl> admission) {
+    admission_ = std::move(admission);
+}
+
+void PeerServer::set_backpressure(std::shared_ptr<Backpressure> backpressure) {
+    backpressure_ = std::move(backpressure);
+}
+
+void PeerServer::set_pool_idle(std::size_t max_idle) {
+    SessionPool::Options opts;
+    opts.max_idle = max_idle;
+    session_pool_ = std::make_shared<SessionPool>(opts);
+}
+
+asio::awaitable<void> PeerServer::accept_loop(tcp::acceptor& acceptor) {
+    for (;;) {
+        asio::error_code ec;
+        tcp::socket socket = co_await acceptor.async_accept(
+            session_executor(acceptor), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec == asio::error::operation_aborted || !acceptor.is_open()) {
+                co_return;
+            }
+            spdlog::warn("Peer accept failed: {}", ec.message());
+            continue;
+        }
+
+        if (admission_) {
+            auto remote = socket.remote_endpoint(ec);
+            if (ec || !admission_->open_connection(remote.address())) {
+                spdlog::debug("Refusing peer connection from {}",
+                              ec ? "unknown" : remote.address().to_string());
+                socket.close(ec);
+                continue;
+            }
+        }
+
+        tune_socket(socket);
+
+        // Session and control block in one recycled block.
+        auto session = std::allocate_shared<PeerSession>(
+            SessionPool::Allocator<PeerSession>(session_pool_),
+            std::move(socket),
+            [this](const std::string& remote, std::string_view payload) {
+                // Where a sampled message's trace starts (telemetry/trace.h).
+                trace::Span span("net", "peer_frame", trace::sample());
+                capture::frame(capture::Kind::FrameIn, remote, payload);
+                if (on_message_) {
+                    on_message_(remote, payload);
+                }
+            },
+            max_frame_size_);
+        spdlog::info("Peer connected from {}", session->remote());
+        session->set_relay_hub(relay_hub_);
+        session->set_admission(admission_);
+        session->set_backpressure(backpressure_);
+        session->set_pool(session_pool_);
+        session->start();
+    }
+}
@@ -0,0 +1,260 @@
+/**
+ * PeerSession — One inbound peer connection.
+ *
+ * Read loop (coroutine): async_read_some into the FrameReader's free space,
+ * then drain every complete frame before issuing the next read, after
+ * waiting out any backpressure from the queues those frames fill. On a relay
+ * the same socket also writes the frames forwarded to its client.
+ */
+
+#include "network/peer_session.h"
+#include "network/admission.h"
+#include "network/backpressure.h"
+#include "network/mux.h"
+#include "network/relay.h"
+#include "network/relay_hub.h"
+#include "network/session_pool.h"
+
+#include <span>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+using asio::ip::tcp;
+
+PeerSession::PeerSession(tcp::socket socket, FrameHandler on_frame,
+                         std::size_t max_frame_size)
+    : socket_(std::move(socket)),
+      on_frame_(std::move(on_frame)),
+      max_frame_size_(max_frame_size) {
+    asio::error_code ec;
+    auto ep = socket_.remote_endpoint(ec);
+    if (!ec) {
+        address_ = ep.address();
+    }
+    remote_ = ec ? "unknown" : ep.address().to_string() + ":" + std::to_string(ep.port());
+}
+
+PeerSession::~PeerSession() {
+    if (admission_) {
+        admission_->close_connection(address_);
+    }
+}
+
+void PeerSession::start() {
+    asio::co_spawn(socket_.get_executor(), run(shared_from_this()), asio::detached);
+}
+
+void PeerSession::close() {
+    closed_ = true;
+    asio::error_code ec;
+    socket_.shutdown(tcp::socket::shutdown_both, ec);
+    socket_.close(ec);
+}
+
+bool PeerSession::send_async(std::string payload, std::size_t budget) {
+    std::lock_guard lock(mutex_);
+    const std::size_t size = framing::kHeaderSize + payload.size();
+    if (closed_ || queued_bytes_ + size > budget) {
+        return false;
+    }
+    queued_bytes_ += size;
+    queue_.push_back(OutFrame{framing::encode_header(static_cast<uint32_t>(payload.size())),
+                              std::move(payload)});
+    if (!writing_) {
+        writing_ = true;
+        asio::post(socket_.get_executor(),
+                   bind_handler_memory(post_memory_,
+                                       [self = shared_from_this()] { self->write_pending(); }));
+    }
+    return true;
+}
+
+void PeerSession::enable_zerocopy(std::size_t min_bytes) {
+    asio::post(socket_.get_executor(), [self = shared_from_this(), min_bytes] {
+        self->zerocopy_.enable(self->socket_, min_bytes);
+    });
+}
+
+void PeerSession::write_pending() {
+    constexpr std::size_t kMaxBatchFrames = 64;
+    std::size_t bytes = 0;
+    {
+        std::lock_guard lock(mutex_);
+        while (!queue_.empty() && inflight_.size() < kMaxBatchFrames) {
+            bytes += queue_.front().payload.size();
+            inflight_.push_back(std::move(queue_.front()));
+            queue_.pop_front();
+        }
+        if (inflight_.empty()) {
+            writing_ = false;
+            return;
+        }
+    }
+    gather_.clear();
+    for (const auto& frame : inflight_) {
+        gather_.push_back(asio::buffer(frame.header));
+        gather_.push_back(asio::buffer(frame.payload));
+    }
+    if (zerocopy_.wants(bytes)) {
+        zerocopy_batch_ = true;
+        zerocopy_.async_write(gather_, [self = shared_from_this()](const asio::error_code& ec) {
+            self->on_write(ec);
+        });
+        return;
+    }
+    // A span, not the vector: the write operation copies its buffer sequence.
+    asio::async_write(socket_, std::span<const asio::const_buffer>(gather_),
+        bind_handler_memory(write_memory_,
+            [self = shared_from_this()](const asio::error_code& ec, std::size_t) {
+                self->on_write(ec);
+            }));
+}
+
+void PeerSession::on_write(const asio::error_code& ec) {
+    std::size_t written = 0;
+    for (const auto& frame : inflight_) {
+        written += framing::kHeaderSize + frame.payload.size();
+    }
+    if (zerocopy_batch_) {
+        zerocopy_batch_ = false;
+        zerocopy_.retain(std::exchange(inflight_, {}));
+    } else {
+        inflight_.clear();
+    }
+    if (ec) {
+        close();
+        std::lock_guard lock(mutex_);
+        queue_.clear();
+        queued_bytes_ = 0;
+        writing_ = false;
+        return;
+    }
+    {
+        std::lock_guard lock(mutex_);
+        queued_bytes_ -= written;
+    }
+    write_pending();
+}
+
+asio::awaitable<void> PeerSession::run(std::shared_ptr<PeerSession> self) {
+    FrameReader reader = self->pool_
+        ? FrameReader(self->max_frame_size_, self->pool_->take_buffer())
+        : FrameReader(self->max_frame_size_);
+    // Destroyed before `reader` on every way out of the loop.
+    struct RecycleBuffer {
+        FrameReader& reader;
+        SessionPool* pool;
+        ~RecycleBuffer() {
+            if (pool) pool->give_buffer(reader.release());
+        }
+    } recycle{reader, self->pool_.get()};
+    std::string_view payload;
+
+    for (;;) {
+        // Leaving the bytes in the socket lets TCP slow the peer down.
+        if (self->backpressure_ && self->backpressure_->paused()) {
+            co_await self->backpressure_->wait();
+        }
+        asio::error_code ec;
+        auto span = reader.prepare();
+        const std::size_t bytes = co_await self->socket_.async_read_some(
+            asio::buffer(span.data(), span.size()),
+            asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec != asio::error::eof && ec != asio::error::operation_aborted) {
+                spdlog::warn("Peer {} read failed: {}", self->remote_, ec.message());
+            }
+            self->close();
+            if (self->relay_hub_) {
+                self->relay_hub_->on_close(*self);
+            }
+            co_return;
+        }
+
+        reader.commit(bytes);
+
+        for (;;) {
+            const auto status = reader.next(payload);
+            if (status == FrameReader::Status::NeedMore) {
+                break;
+            }
+            if (status == FrameReader::Status::Oversized) {
+                spdlog::error("Peer {} sent a frame above the {} byte limit, closing",
+                              self->remote_, reader.max_frame_size());
+                self->close();
+                if (self->relay_hub_) {
+                    self->relay_hub_->on_close(*self);
+                }
+                co_return;
+            }
+            // A mux frame is charged to admission inside, after its
+            // channel's credit is counted.
+            if (mux::is_mux_frame(payload)) {
+                if (!self->on_mux_frame(payload)) {
+                    self->close();
+                    if (self->relay_hub_) {
+                        self->relay_hub_->on_close(*self);
+                    }
+                    co_return;
+                }
+                continue;
+            }
+            // Before anything looks inside: a flood from one address is
+            // dropped here at the cost of the read.
+            if (self->admission_ && !self->admission_->admit_frame(self->address_)) {
+                continue;
+            }
+            if (self->relay_hub_ && relay::is_relay_frame(payload)) {
+                self->relay_hub_->on_frame(self, payload);
+            } else if (self->on_frame_) {
+                self->on_frame_(self->remote_, payload);
+            }
+        }
+    }
+}
+
+bool PeerSession::on_mux_frame(std::string_view frame) {
+    const auto parsed = mux::parse(frame);
+    if (!parsed) {
+        spdlog::warn("Peer {} sent a malformed mux frame, closing", remote_);
+        return false;
+    }
+    if (parsed->op == mux::Op::Close) {
+        mux_consumed_.erase(parsed->channel);
+        return true;
+    }
+    if (parsed->op != mux::Op::Data) {
+        return true;                            // credit is ours to give
+    }
+    auto it = mux_consumed_.find(parsed->channel);
+    if (it == mux_consumed_.end()) {
+        if (mux_consumed_.size() >= mux::kMaxChannels) {
+            spdlog::warn("Peer {} opened more than {} mux channels, closing", remote_,
+                         mux::kMaxChannels);
+            return false;
+        }
+        it = mux_consumed_.emplace(parsed->channel, 0).first;
+    }
+    // A sender may start a frame while it has any credit left, so one
+    // frame can overshoot the window; more than that ignores it.
+    it->second += static_cast<uint32_t>(parsed->body.size());
+    if (it->second > mux::kWindow + max_frame_size_) {
+        spdlog::warn("Peer {} overran mux channel {}'s window, closing", remote_,
+                     parsed->channel);
+        return false;
+    }
+    // A frame admission drops still counts, or its credit would never
+    // come back and the channel would stall.
+    const bool admitted = !admission_ || admission_->admit_frame(address_);
+    if (admitted && on_frame_ && !parsed->body.empty()) {
+        on_frame_(remote_, parsed->body);
+    }
+    // Credit in half-window steps keeps window frames rare without
+    // stalling a sender that is keeping up.
+    if (it->second >= mux::kWindow / 2 &&
+        send_async(mux::encode_window(parsed->channel, it->second), mux::kWindow)) {
+        it->second = 0;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+/**
+ * Relay frame header encoding. See include/network/relay.h for the layout.
+ */
+
+#include "network/relay.h"
+
+#include <algorithm>
+
+namespace relay {
+
+std::optional<Frame> parse(std::string_view frame) {
+    if (frame.size() < kHeaderSize || !is_relay_frame(frame)) {
+        return std::nullopt;
+    }
+    const auto op = static_cast<uint8_t>(frame[1]);
+    const std::size_t name_len = static_cast<uint8_t>(frame[2]);
+    if ((op != static_cast<uint8_t>(Op::Register) && op != static_cast<uint8_t>(Op::Forward)) ||
+        name_len == 0 || frame.size() < kHeaderSize + name_len) {
+        return std::nullopt;
+    }
+    return Frame{static_cast<Op>(op), frame.substr(kHeaderSize, name_len),
+                 frame.substr(kHeaderSize + name_len)};
+}
+
+std::string register_signed_bytes(std::string_view username, int64_t timestamp) {
+    return "relay_register\n" + std::string(username) + "\n" + std::to_string(timestamp);
+}
+
+namespace {
+
+std::string header(Op op, std::string_view username, std::size_t body_size) {
+    const std::size_t name_len = std::min<std::size_t>(username.size(), 0xFF);
+    std::string out;
+    out.reserve(kHeaderSize + name_len + body_size);
+    out += static_cast<char>(kMagic);
+    out += static_cast<char>(op);
+    out += static_cast<char>(name_len);
+    out.append(username.substr(0, name_len));
+    return out;
+}
+
+} // namespace
+
+std::string encode_register(std::string_view username, int64_t timestamp,
+                            std::span<const uint8_t> signature) {
+    std::string out = header(Op::Register, username, 8 + signature.size());
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out += static_cast<char>((static_cast<uint64_t>(timestamp) >> shift) & 0xFF);
+    }
+    out.append(reinterpret_cast<const char*>(signature.data()), signature.size());
+    return out;
+}
+
+std::string encode_forward(std::string_view to, std::string_view envelope) {
+    std::string out = header(Op::Forward, to, envelope.size());
+    out.append(envelope);
+    return out;
+}
+
+std::optional<Registration> parse_register(std::string_view body) {
+    if (body.size() != 8 + kSignatureSize) {
+        return std::nullopt;
+    }
+    uint64_t ts = 0;
+    for (std::size_t i = 0; i < 8; ++i) {
+        ts = (ts << 8) | static_cast<uint8_t>(body[i]);
+    }
+    return Registration{static_cast<int64_t>(ts), body.substr(8)};
+}
+
+} // namespace relay
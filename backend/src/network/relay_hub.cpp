@@ -0,0 +1,179 @@
+/**
+ * RelayHub — registrations and rate-limited forwarding on a relay node.
+ */
+
+#include "network/relay_hub.h"
+#include "network/framing.h"
+#include "network/peer_session.h"
+#include "network/relay.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Counter& forwarded_bytes =
+    metrics::counter("p2p_relay_forwarded_bytes_total", "Bytes a relay queued for its clients");
+metrics::Counter& dropped_frames =
+    metrics::counter("p2p_relay_dropped_frames_total",
+                     "Frames a relay dropped: unknown recipient, rate limit or full queue");
+metrics::Gauge& relay_clients =
+    metrics::gauge("p2p_relay_clients", "Clients registered with this relay");
+
+} // namespace
+
+bool RelayHub::take(TokenBucket& bucket, std::size_t bytes, uint64_t rate, Clock::time_point now) {
+    // At least one full frame, or a slow limit could never pass a big one.
+    const double burst = static_cast<double>(
+        std::max<uint64_t>(rate, framing::kHeaderSize + framing::kDefaultMaxFrameSize));
+    return bucket.take(static_cast<double>(bytes), static_cast<double>(rate), burst, now);
+}
+
+RelayHub::RelayHub(Options options, Verifier verify)
+    : verify_(std::move(verify)), options_(options) {}
+
+void RelayHub::set_options(Options options) {
+    std::unique_lock lock(mutex_);
+    options_ = options;
+}
+
+std::size_t RelayHub::clients() const {
+    std::shared_lock lock(mutex_);
+    return clients_.size();
+}
+
+void RelayHub::on_frame(const std::shared_ptr<PeerSession>& session, std::string_view frame) {
+    auto parsed = relay::parse(frame);
+    if (!parsed) {
+        spdlog::warn("Malformed relay frame from {}", session->remote());
+        return;
+    }
+    switch (parsed->op) {
+    case relay::Op::Register:
+        on_register(session, std::string(parsed->username), parsed->body);
+        break;
+    case relay::Op::Forward:
+        forward(parsed->username, frame);
+        break;
+    }
+}
+
+void RelayHub::on_register(const std::shared_ptr<PeerSession>& session, std::string username,
+                           std::string_view body) {
+    auto reg = relay::parse_register(body);
+    std::chrono::seconds skew;
+    {
+        std::shared_lock lock(mutex_);
+        skew = options_.max_clock_skew;
+        auto it = clients_.find(username);
+        if (reg && it != clients_.end() && it->second.session.lock() == session) {
+            return;                     // a refresh on the registered session
+        }
+    }
+    if (!reg || std::abs(static_cast<int64_t>(std::time(nullptr)) - reg->timestamp) > skew.count()) {
+        spdlog::warn("Ignoring relay registration for {} from {}: stale or malformed",
+                     username, session->remote());
+        return;
+    }
+    verify_(username, relay::register_signed_bytes(username, reg->timestamp),
+            std::string(reg->signature),
+            [this, username, weak = std::weak_ptr<PeerSession>(session)](bool ok) {
+        auto session = weak.lock();
+        if (!session) {
+            return;
+        }
+        if (!ok) {
+            spdlog::warn("Refusing relay registration for {} from {}: bad signature",
+                         username, session->remote());
+            return;
+        }
+        std::unique_lock lock(mutex_);
+        if (!clients_.contains(username) && clients_.size() >= options_.max_clients) {
+            spdlog::warn("Refusing relay registration for {}: {} clients already",
+                         username, clients_.size());
+            return;
+        }
+        Client& client = clients_[username];
+        client.session = weak;
+        std::lock_guard bucket_lock(client.mutex);
+        client.bucket = {};
+        if (options_.zerocopy_min_bytes > 0) {
+            session->enable_zerocopy(options_.zerocopy_min_bytes);
+        }
+        relay_clients.set(static_cast<int64_t>(clients_.size()));
+        spdlog::info("Relaying for {} ({})", username, session->remote());
+    });
+}
+
+void RelayHub::forward(std::string_view to, std::string_view frame) {
+    std::shared_ptr<PeerSession> session;
+    std::size_t budget = 0;
+    {
+        std::shared_lock lock(mutex_);
+        auto it = clients_.find(to);
+        if (it != clients_.end()) {
+            session = it->second.session.lock();
+        }
+        if (!session) {
+            lock.unlock();
+            if (it != clients_.end()) {
+                forget_closed(to);
+            }
+            dropped_frames.inc();
+            spdlog::debug("Relay: no client {}", to);
+            return;
+        }
+        const auto now = Clock::now();
+        Client& client = it->second;
+        std::lock_guard bucket_lock(client.mutex);
+        if (!take(client.bucket, frame.size(), options_.client_bytes_per_sec, now)) {
+            dropped_frames.inc();
+            spdlog::debug("Relay: {} is over its rate limit", to);
+            return;
+        }
+        if (options_.bytes_per_sec > 0) {
+            std::lock_guard total_lock(total_mutex_);
+            if (!take(total_, frame.size(), options_.bytes_per_sec, now)) {
+                client.bucket.tokens += static_cast<double>(frame.size());
+                dropped_frames.inc();
+                spdlog::debug("Relay: over the relay's rate limit");
+                return;
+            }
+        }
+        budget = options_.client_queue_bytes;
+    }
+    if (!session->send_async(std::string(frame), budget)) {
+        dropped_frames.inc();
+        spdlog::debug("Relay: queue for {} is full", to);
+        return;
+    }
+    forwarded_bytes.inc(frame.size());
+}
+
+void RelayHub::forget_closed(std::string_view to) {
+    std::unique_lock lock(mutex_);
+    auto it = clients_.find(to);
+    if (it != clients_.end() && it->second.session.expired()) {
+        clients_.erase(it);
+        relay_clients.set(static_cast<int64_t>(clients_.size()));
+    }
+}
+
+void RelayHub::on_close(const PeerSession& session) {
+    std::unique_lock lock(mutex_);
+    const auto dropped = std::erase_if(clients_, [&](const auto& entry) {
+        auto s = entry.second.session.lock();
+        if (s.get() == &session) {
+            spdlog::info("Relay client {} disconnected", entry.first);
+            return true;
+        }
+        return !s;
+    });
+    if (dropped) {
+        relay_clients.set(static_cast<int64_t>(clients_.size()));
+    }
+}
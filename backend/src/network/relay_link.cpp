@@ -0,0 +1,111 @@
+/**
+ * RelayLink — the client side of relay mode.
+ */
+
+#include "network/relay_link.h"
+#include "network/peer_client.h"
+#include "network/relay.h"
+
+#include <algorithm>
+#include <ctime>
+#include <span>
+
+#include <spdlog/spdlog.h>
+
+RelayLink::RelayLink(std::string username, Options options, Signer sign, FrameHandler on_frame)
+    : username_(std::move(username)),
+      options_(std::move(options)),
+      sign_(std::move(sign)),
+      on_frame_(std::move(on_frame)),
+      remote_("relay " + options_.ip + ":" + std::to_string(options_.port)),
+      refresh_timer_(io_),
+      retry_timer_(io_) {}
+
+RelayLink::~RelayLink() {
+    stop();
+}
+
+void RelayLink::start() {
+    if (thread_.joinable()) {
+        return;
+    }
+    asio::co_spawn(io_, run(), asio::detached);
+    thread_ = std::thread([this] { io_.run(); });
+}
+
+void RelayLink::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    stopping_ = true;
+    asio::post(io_, [this] {
+        refresh_timer_.cancel();
+        retry_timer_.cancel();
+        if (client_) {
+            client_->disconnect();
+        }
+    });
+    thread_.join();
+}
+
+std::string RelayLink::registration() const {
+    const auto now = static_cast<int64_t>(std::time(nullptr));
+    const std::string sig = sign_(relay::register_signed_bytes(username_, now));
+    return relay::encode_register(
+        username_, now, std::span(reinterpret_cast<const uint8_t*>(sig.data()), sig.size()));
+}
+
+void RelayLink::deliver(std::string_view frame) {
+    auto parsed = relay::parse(frame);
+    if (!parsed || parsed->op != relay::Op::Forward || parsed->username != username_) {
+        spdlog::warn("Unexpected frame from {}", remote_);
+        return;
+    }
+    if (on_frame_) {
+        on_frame_(remote_, parsed->body);
+    }
+}
+
+asio::awaitable<void> RelayLink::run() {
+    auto backoff = std::chrono::seconds(1);
+    while (!stopping_) {
+        auto client = std::make_shared<PeerClient>(io_);
+        client->set_backpressure(options_.backpressure);
+        client_ = client;
+        if (co_await client->co_connect(options_.ip, options_.port, options_.connect_timeout)) {
+            // The relay verifies this before it forwards anything to us.
+            client->send_async(registration());
+            connected_ = true;
+            backoff = std::chrono::seconds(1);
+            spdlog::info("Connected to {}; registering as {}", remote_, username_);
+            asio::co_spawn(io_, keep_registered(client), asio::detached);
+            co_await client->co_read([this](std::string_view frame) { deliver(frame); });
+            connected_ = false;
+            refresh_timer_.cancel();
+            client->disconnect();
+            if (!stopping_) {
+                spdlog::warn("Lost {}; reconnecting", remote_);
+            }
+        }
+        if (stopping_) {
+            break;
+        }
+        retry_timer_.expires_after(backoff);
+        asio::error_code ec;
+        co_await retry_timer_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+        backoff = std::min(backoff * 2, options_.max_backoff);
+    }
+    client_.reset();
+}
+
+asio::awaitable<void> RelayLink::keep_registered(std::shared_ptr<PeerClient> client) {
+    for (;;) {
+        refresh_timer_.expires_after(options_.refresh);
+        asio::error_code ec;
+        co_await refresh_timer_.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+        if (ec || stopping_ || !client->is_open()) {
+            co_return;
+        }
+        client->send_async(registration());
+    }
+}
@@ -0,0 +1,135 @@
+/**
+ * SessionPool — free lists of session blocks and read buffers.
+ */
+
+#include "network/session_pool.h"
+#include "telemetry/metrics.h"
+
+#include <new>
+
+namespace {
+
+metrics::Gauge& blocks_in_use =
+    metrics::gauge("p2p_session_pool_in_use", "Peer sessions living in pooled blocks");
+metrics::Gauge& blocks_idle =
+    metrics::gauge("p2p_session_pool_idle", "Freed session blocks kept for the next connection");
+metrics::Gauge& buffers_idle =
+    metrics::gauge("p2p_session_pool_buffers_idle", "Read buffers kept for the next connection");
+metrics::Counter& blocks_reused =
+    metrics::counter("p2p_session_pool_reused_total",
+                     "Accepted connections that reused a pooled session block");
+
+} // namespace
+
+SessionPool::SessionPool(Options options)
+    : options_(options),
+      reclaimer_(memory::Area::Pools, [this](std::size_t bytes) { trim(bytes); }) {}
+
+SessionPool::~SessionPool() {
+    for (void* block : idle_blocks_) {
+        huge_pages::deallocate(block, block_size_);
+    }
+    blocks_idle.add(-static_cast<int64_t>(idle_blocks_.size()));
+    buffers_idle.add(-static_cast<int64_t>(idle_buffers_.size()));
+    memory::charge(memory::Area::Pools,
+                   -static_cast<int64_t>(idle_blocks_.size() * block_size_ +
+                                         idle_buffers_.size() * options_.buffer_size));
+}
+
+void SessionPool::trim(std::size_t bytes) {
+    std::vector<void*> blocks;
+    std::vector<framing::Buffer> buffers;
+    {
+        std::lock_guard lock(mutex_);
+        std::size_t freed = 0;
+        while (freed < bytes && !idle_buffers_.empty()) {
+            buffers.push_back(std::move(idle_buffers_.back()));
+            idle_buffers_.pop_back();
+            freed += options_.buffer_size;
+        }
+        while (freed < bytes && !idle_blocks_.empty()) {
+            blocks.push_back(idle_blocks_.back());
+            idle_blocks_.pop_back();
+            freed += block_size_;
+        }
+        blocks_idle.add(-static_cast<int64_t>(blocks.size()));
+        buffers_idle.add(-static_cast<int64_t>(buffers.size()));
+        memory::charge(memory::Area::Pools, -static_cast<int64_t>(freed));
+    }
+    for (void* block : blocks) {
+        huge_pages::deallocate(block, block_size_);
+    }
+}
+
+void* SessionPool::allocate(std::size_t bytes) {
+    memory::charge(memory::Area::PeerSessions, static_cast<int64_t>(bytes));
+    {
+        std::lock_guard lock(mutex_);
+        if (block_size_ == 0) {
+            block_size_ = bytes;
+        }
+        if (bytes == block_size_) {
+            blocks_in_use.add(1);
+            if (!idle_blocks_.empty()) {
+                void* block = idle_blocks_.back();
+                idle_blocks_.pop_back();
+                blocks_idle.add(-1);
+                memory::charge(memory::Area::Pools, -static_cast<int64_t>(bytes));
+                blocks_reused.inc();
+                return block;
+            }
+        }
+    }
+    return huge_pages::allocate(bytes);
+}
+
+void SessionPool::deallocate(void* block, std::size_t bytes) {
+    memory::charge(memory::Area::PeerSessions, -static_cast<int64_t>(bytes));
+    {
+        std::lock_guard lock(mutex_);
+        if (bytes == block_size_) {
+            blocks_in_use.add(-1);
+            if (idle_blocks_.size() < options_.max_idle &&
+                !memory::over_budget(memory::Area::Pools, bytes)) {
+                idle_blocks_.push_back(block);
+                blocks_idle.add(1);
+                memory::charge(memory::Area::Pools, static_cast<int64_t>(bytes));
+                return;
+            }
+        }
+    }
+    huge_pages::deallocate(block, bytes);
+}
+
+framing::Buffer SessionPool::take_buffer() {
+    // Charged at its handed-out size; a jumbo frame's growth isn't counted.
+    memory::charge(memory::Area::PeerSessions, static_cast<int64_t>(options_.buffer_size));
+    {
+        std::lock_guard lock(mutex_);
+        if (!idle_buffers_.empty()) {
+            auto buffer = std::move(idle_buffers_.back());
+            idle_buffers_.pop_back();
+            buffers_idle.add(-1);
+            memory::charge(memory::Area::Pools, -static_cast<int64_t>(options_.buffer_size));
+            return buffer;
+        }
+    }
+    return framing::Buffer(options_.buffer_size);
+}
+
+void SessionPool::give_buffer(framing::Buffer buffer) {
+    memory::charge(memory::Area::PeerSessions, -static_cast<int64_t>(options_.buffer_size));
+    if (memory::over_budget(memory::Area::Pools, options_.buffer_size)) {
+        return;
+    }
+    if (buffer.size() != options_.buffer_size) {
+        buffer.resize(options_.buffer_size);
+        buffer.shrink_to_fit();
+    }
+    std::lock_guard lock(mutex_);
+    if (idle_buffers_.size() < options_.max_idle) {
+        idle_buffers_.push_back(std::move(buffer));
+        buffers_idle.add(1);
+        memory::charge(memory::Area::Pools, static_cast<int64_t>(options_.buffer_size));
+    }
+}
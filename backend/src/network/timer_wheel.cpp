@@ -0,0 +1,247 @@
+/**
+ * TimerWheel — O(1) timers on one steady_timer per io_context.
+ *
+ * A deadline d (in ticks) at level k sits in slot (d >> 6k) % 64. Level k
+ * only holds deadlines at least 64^k ticks out, so its slot is always ahead
+ * of the wheel's position in that level, at most a full lap; when now_
+ * reaches the start of the slot, its nodes are placed again, lower down.
+ * Rotating a level's bitmap to the wheel's position and counting trailing
+ * zeros finds its next occupied slot, and between that and now_ there is
+ * nothing to do, so advance() jumps straight to it.
+ */
+
+#include "network/timer_wheel.h"
+
+#include <algorithm>
+#include <bit>
+
+asio::execution_context::id TimerWheel::id;
+
+TimerWheel& TimerWheel::of(asio::io_context& io) {
+    return asio::use_service<TimerWheel>(io);
+}
+
+TimerWheel& TimerWheel::of(const asio::any_io_executor& ex) {
+    // Every context in the backend is an io_context (network/io_context_pool.h).
+    return of(static_cast<asio::io_context&>(asio::query(ex, asio::execution::context)));
+}
+
+TimerWheel::TimerWheel(asio::execution_context& context)
+    : asio::execution_context::service(context),
+      timer_(static_cast<asio::io_context&>(context)) {
+    heads_.fill(kNil);
+}
+
+void TimerWheel::shutdown() {
+    std::vector<Callback> dropped;
+    {
+        std::lock_guard lock(mutex_);
+        shut_down_ = true;
+        for (auto& node : nodes_) {
+            if (node.generation != 0) {
+                dropped.push_back(std::move(node.callback));
+            }
+        }
+        nodes_.clear();
+        free_ = kNil;
+        heads_.fill(kNil);
+        occupied_.fill(0);
+        pending_ = 0;
+        timer_.cancel();
+    }
+    // Captures are released outside the lock: a destructor may cancel().
+}
+
+uint64_t TimerWheel::current_tick() const {
+    return static_cast<uint64_t>((Clock::now() - epoch_) / kTick);
+}
+
+TimerWheel::Handle TimerWheel::schedule(Clock::duration delay, Callback callback) {
+    std::lock_guard lock(mutex_);
+    if (shut_down_) {
+        return {};
+    }
+    const auto since_epoch = Clock::now() - epoch_;
+    const auto now = static_cast<uint64_t>(since_epoch / kTick);
+    if (pending_ == 0) {
+        now_ = std::max(now_, now);     // nothing in between to run
+    }
+    // Rounded up from the exact due time, so it never runs early.
+    const auto due = static_cast<uint64_t>(
+        (since_epoch + std::max(delay, Clock::duration::zero()) + kTick - Clock::duration(1)) /
+        kTick);
+
+    uint32_t i;
+    if (free_ != kNil) {
+        i = free_;
+        free_ = nodes_[i].next;
+    } else {
+        i = static_cast<uint32_t>(nodes_.size());
+        nodes_.emplace_back();
+    }
+    Node& node = nodes_[i];
+    node.callback = std::move(callback);
+    node.deadline = std::max(due, now + 1);
+    if (++next_generation_ == 0) {
+        ++next_generation_;
+    }
+    node.generation = next_generation_;
+    link(i);
+    ++pending_;
+    arm_locked();
+    return {i, node.generation};
+}
+
+bool TimerWheel::cancel(Handle handle) {
+    std::vector<Callback> dropped;
+    std::lock_guard lock(mutex_);
+    if (!handle || handle.index >= nodes_.size() ||
+        nodes_[handle.index].generation != handle.generation) {
+        return false;
+    }
+    release(handle.index, dropped);
+    // The timer isn't pulled back: it wakes once for nothing at worst.
+    return true;
+}
+
+std::size_t TimerWheel::pending() const {
+    std::lock_guard lock(mutex_);
+    return pending_;
+}
+
+void TimerWheel::link(uint32_t i) {
+    Node& node = nodes_[i];
+    const uint64_t deadline = std::max(node.deadline, now_ + 1);
+    const uint64_t delta = deadline - now_;
+    std::size_t level = 0;
+    while (level + 1 < kLevels && delta >> (kLevelBits * (level + 1)) != 0) {
+        ++level;
+    }
+    const uint64_t span = uint64_t{1} << (kLevelBits * kLevels);
+    const uint64_t at = delta < span ? deadline : now_ + span - 1;
+    const std::size_t index = (at >> (kLevelBits * level)) & (kSlots - 1);
+
+    node.slot = static_cast<uint32_t>(level * kSlots + index);
+    node.prev = kNil;
+    node.next = heads_[node.slot];
+    if (node.next != kNil) {
+        nodes_[node.next].prev = i;
+    }
+    heads_[node.slot] = i;
+    occupied_[level] |= uint64_t{1} << index;
+}
+
+void TimerWheel::unlink(uint32_t i) {
+    Node& node = nodes_[i];
+    if (node.prev != kNil) {
+        nodes_[node.prev].next = node.next;
+    } else {
+        heads_[node.slot] = node.next;
+        if (node.next == kNil) {
+            occupied_[node.slot / kSlots] &= ~(uint64_t{1} << (node.slot % kSlots));
+        }
+    }
+    if (node.next != kNil) {
+        nodes_[node.next].prev = node.prev;
+    }
+}
+
+void TimerWheel::release(uint32_t i, std::vector<Callback>& out) {
+    unlink(i);
+    free_node(i, out);
+}
+
+void TimerWheel::free_node(uint32_t i, std::vector<Callback>& out) {
+    Node& node = nodes_[i];
+    out.push_back(std::move(node.callback));
+    node.callback = nullptr;
+    node.generation = 0;
+    node.next = free_;
+    free_ = i;
+    --pending_;
+}
+
+uint64_t TimerWheel::next_tick() const {
+    uint64_t next = UINT64_MAX;
+    for (std::size_t level = 0; level < kLevels; ++level) {
+        if (occupied_[level] == 0) {
+            continue;
+        }
+        const unsigned shift = kLevelBits * static_cast<unsigned>(level);
+        const uint64_t from = (now_ >> shift) + 1;
+        const int skip = std::countr_zero(
+            std::rotr(occupied_[level], static_cast<int>(from & (kSlots - 1))));
+        next = std::min(next, (from + static_cast<uint64_t>(skip)) << shift);
+    }
+    return next;
+}
+
+void TimerWheel::advance(uint64_t target, std::vector<Callback>& due) {
+    while (pending_ > 0) {
+        const uint64_t next = next_tick();
+        if (next > target) {
+            break;
+        }
+        now_ = next;
+        // Highest level first, so what it pours into a slot that starts
+        // now is poured or run in the same pass.
+        for (std::size_t level = kLevels - 1; level > 0; --level) {
+            const unsigned shift = kLevelBits * static_cast<unsigned>(level);
+            if ((now_ & ((uint64_t{1} << shift) - 1)) != 0) {
+                continue;
+            }
+            const uint32_t slot =
+                static_cast<uint32_t>(level * kSlots + ((now_ >> shift) & (kSlots - 1)));
+            uint32_t i = heads_[slot];
+            heads_[slot] = kNil;
+            occupied_[level] &= ~(uint64_t{1} << (slot % kSlots));
+            while (i != kNil) {
+                const uint32_t next_node = nodes_[i].next;
+                if (nodes_[i].deadline <= now_) {
+                    free_node(i, due);          // due already: don't wait a tick
+                } else {
+                    link(i);
+                }
+                i = next_node;
+            }
+        }
+        const uint32_t slot = static_cast<uint32_t>(now_ & (kSlots - 1));
+        while (heads_[slot] != kNil) {
+            release(heads_[slot], due);
+        }
+    }
+    now_ = std::max(now_, target);
+}
+
+void TimerWheel::arm_locked() {
+    if (pending_ == 0) {
+        return;
+    }
+    const uint64_t next = next_tick();
+    if (next >= armed_for_) {
+        return;
+    }
+    armed_for_ = next;
+    timer_.expires_at(epoch_ + next * kTick);
+    timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            on_timer();
+        }
+    });
+}
+
+void TimerWheel::on_timer() {
+    std::vector<Callback> due;
+    {
+        std::lock_guard lock(mutex_);
+        if (shut_down_) {
+            return;
+        }
+        armed_for_ = UINT64_MAX;
+        advance(current_tick(), due);
+        arm_locked();
+    }
+    for (auto& callback : due) {
+        callback();
+    }
+}
@@ -0,0 +1,700 @@
+/**
+ * UdpTransport — hole-punched UDP connections carrying reliable streams.
+ *
+ * Packet layout (protocol/message_format.md §2.6), all integers big-endian:
+ *
+ *   off  size  field
+ *     0     1  magic (0x55, 'U')
+ *     1     1  type (Type below)
+ *     2     8  connection id, chosen at random by whoever punched
+ *    10        punch     → the sender's username
+ *              punch_ack → nothing
+ *              data      → stream (1), fragment seq (4), flags (1; bit 0 =
+ *                          last fragment of a frame), the fragment's bytes
+ *              ack       → stream (1), next seq expected (4), the seq acked (4)
+ *              close     → nothing
+ *
+ * Sends go through the socket in non-blocking mode: a datagram the kernel
+ * won't take right now is dropped like one lost on the wire, and resent.
+ */
+
+#include "network/udp_transport.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <random>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+using asio::ip::udp;
+
+namespace {
+
+metrics::Counter& packets_sent =
+    metrics::counter("p2p_udp_packets_sent_total", "Datagrams the UDP transport sent");
+metrics::Counter& fragments_resent =
+    metrics::counter("p2p_udp_retransmits_total", "Fragments the UDP transport sent again");
+metrics::Gauge& connections =
+    metrics::gauge("p2p_udp_connections", "Open UDP transport connections");
+
+constexpr uint8_t kMagic = 0x55;
+
+enum Type : uint8_t {
+    kPunch    = 1,
+    kPunchAck = 2,
+    kData     = 3,
+    kAck      = 4,
+    kClose    = 5,
+};
+
+constexpr std::size_t kHeaderSize = 10;
+constexpr std::size_t kDataHeaderSize = kHeaderSize + 6;
+// Small enough to cross any path we'll meet without IP fragmentation.
+constexpr std::size_t kMaxDatagram = 1200;
+constexpr std::size_t kFragmentSize = kMaxDatagram - kDataHeaderSize;
+constexpr uint8_t kLastFragment = 0x01;
+constexpr uint64_t kMaxReorder = 4096;          // fragments buffered past a gap
+constexpr int kMaxSends = 10;                   // then the connection is dead
+constexpr double kMinWindow = 4;
+constexpr double kMaxWindow = 1024;
+// Messages may go this far past a window that Files has filled.
+constexpr std::size_t kMessagesHeadroom = 8;
+constexpr auto kBusyTick = std::chrono::milliseconds(50);
+constexpr auto kIdleTick = std::chrono::seconds(1);
+constexpr auto kMinRto = std::chrono::milliseconds(200);
+constexpr auto kMaxRto = std::chrono::milliseconds(5000);
+
+void put_u32(std::string& out, uint32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out += static_cast<char>((v >> shift) & 0xFF);
+    }
+}
+
+void put_u64(std::string& out, uint64_t v) {
+    for (int shift = 56; shift >= 0; shift -= 8) {
+        out += static_cast<char>((v >> shift) & 0xFF);
+    }
+}
+
+uint64_t get_be(std::string_view in, std::size_t offset, std::size_t bytes) {
+    uint64_t v = 0;
+    for (std::size_t i = 0; i < bytes; ++i) {
+        v = (v << 8) | static_cast<uint8_t>(in[offset + i]);
+    }
+    return v;
+}
+
+std::string header(uint8_t type, uint64_t id) {
+    std::string out;
+    out.reserve(kMaxDatagram);
+    out += static_cast<char>(kMagic);
+    out += static_cast<char>(type);
+    put_u64(out, id);
+    return out;
+}
+
+std::string endpoint_name(const udp::endpoint& ep) {
+    return "udp " + ep.address().to_string() + ":" + std::to_string(ep.port());
+}
+
+uint64_t random_id() {
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+} // namespace
+
+UdpTransport::UdpTransport(Options options)
+    : options_(std::move(options)), socket_(io_), timer_(io_) {}
+
+UdpTransport::~UdpTransport() {
+    stop();
+}
+
+void UdpTransport::set_on_message(MessageCallback cb) {
+    on_message_ = std::move(cb);
+}
+
+bool UdpTransport::start() {
+    if (thread_.joinable()) {
+        return true;
+    }
+    asio::error_code ec;
+    socket_.open(udp::v4(), ec);
+    if (!ec) {
+        socket_.bind(udp::endpoint(udp::v4(), options_.port), ec);
+    }
+    if (!ec) {
+        socket_.non_blocking(true, ec);
+    }
+    if (ec) {
+        spdlog::error("UDP transport can't use port {}: {}", options_.port, ec.message());
+        asio::error_code ignored;
+        socket_.close(ignored);
+        return false;
+    }
+    asio::co_spawn(io_, receive_loop(), asio::detached);
+    arm_timer(false);
+    thread_ = std::thread([this] { io_.run(); });
+    spdlog::info("UDP transport on port {}", options_.port);
+    return true;
+}
+
+void UdpTransport::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    asio::post(io_, [this] {
+        // Tell peers, so they fall back at once instead of at their timeout.
+        for (auto& [id, conn] : conns_) {
+            send_control(*conn, kClose);
+        }
+        while (!conns_.empty()) {
+            drop(conns_.begin()->first);
+        }
+        timer_.cancel();
+        asio::error_code ec;
+        socket_.close(ec);
+    });
+    thread_.join();
+}
+
+void UdpTransport::punch(const std::string& username, const std::string& ip, uint16_t port) {
+    asio::error_code ec;
+    const auto address = asio::ip::make_address(ip, ec);
+    if (ec || port == 0) {
+        spdlog::debug("Not punching {}: bad UDP endpoint {}:{}", username, ip, port);
+        return;
+    }
+    asio::post(io_, [this, username, remote = udp::endpoint(address, port)] {
+        do_punch(username, remote);
+    });
+}
+
+bool UdpTransport::established(const std::string& username) const {
+    std::lock_guard lock(mutex_);
+    return established_.contains(username);
+}
+
+std::size_t UdpTransport::size() const {
+    std::lock_guard lock(mutex_);
+    return size_;
+}
+
+void UdpTransport::send_async(const std::string& username, std::string payload, Stream stream,
+                              std::function<void(bool ok)> done) {
+    asio::post(io_, [this, username, payload = std::move(payload), stream,
+                     done = std::move(done)]() mutable {
+        do_send(username, std::move(payload), stream, std::move(done));
+    });
+}
+
+bool UdpTransport::send(const std::string& username, std::string_view payload, Stream stream,
+                        std::chrono::milliseconds timeout) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    auto result = promise->get_future();
+    send_async(username, std::string(payload), stream,
+               [promise](bool ok) { promise->set_value(ok); });
+    return result.wait_for(timeout) == std::future_status::ready && result.get();
+}
+
+// ─── Receiving ───────────────────────────────────────────────────────────────
+
+asio::awaitable<void> UdpTransport::receive_loop() {
+    std::array<char, 2048> buffer;
+    udp::endpoint from;
+    for (;;) {
+        asio::error_code ec;
+        const std::size_t bytes = co_await socket_.async_receive_from(
+            asio::buffer(buffer), from, asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (ec == asio::error::operation_aborted || !socket_.is_open()) {
+                co_return;
+            }
+            // e.g. an ICMP port unreachable for an earlier send, on Windows
+            spdlog::debug("UDP receive failed: {}", ec.message());
+            continue;
+        }
+        on_packet(from, std::string_view(buffer.data(), bytes));
+    }
+}
+
+void UdpTransport::on_packet(const udp::endpoint& from, std::string_view packet) {
+    if (packet.size() < kHeaderSize || static_cast<uint8_t>(packet[0]) != kMagic) {
+        return;
+    }
+    const auto type = static_cast<uint8_t>(packet[1]);
+    const uint64_t id = get_be(packet, 2, 8);
+    const auto body = packet.substr(kHeaderSize);
+    if (type == kPunch) {
+        on_punch(from, id, body);
+        return;
+    }
+    auto it = conns_.find(id);
+    if (it == conns_.end()) {
+        // Most likely the peer restarted and lost the connection: say so,
+        // so it stops sending here and punches afresh.
+        if (type == kData) {
+            std::string close = header(kClose, id);
+            send_raw(from, close);
+        }
+        return;
+    }
+    Connection& conn = *it->second;
+    if (conn.remote != from) {
+        spdlog::info("UDP connection {} moved to {}", conn.remote_name, endpoint_name(from));
+        conn.remote = from;
+        conn.remote_name = endpoint_name(from);
+    }
+    conn.last_heard = Clock::now();
+    switch (type) {
+    case kPunchAck:
+        if (!conn.established && !conn.username.empty()) {
+            conn.punches_left = 0;
+            conn.next_punch = {};
+            set_established(conn, true);
+            spdlog::info("UDP connection to {} at {} established", conn.username,
+                         conn.remote_name);
+            flush(conn);
+        }
+        break;
+    case kData:
+        on_data(conn, body);
+        break;
+    case kAck:
+        on_ack(conn, body);
+        break;
+    case kClose:
+        spdlog::debug("{} closed its UDP connection", conn.remote_name);
+        drop(id);
+        break;
+    default:
+        break;
+    }
+}
+
+void UdpTransport::on_punch(const udp::endpoint& from, uint64_t id, std::string_view name) {
+    const auto now = Clock::now();
+    auto it = conns_.find(id);
+    if (it == conns_.end()) {
+        if (conns_.size() >= options_.max_connections) {
+            spdlog::debug("Ignoring UDP punch from {}: {} connections already",
+                          endpoint_name(from), conns_.size());
+            return;
+        }
+        auto conn = std::make_unique<Connection>();
+        conn->id = id;
+        conn->remote = from;
+        conn->remote_name = endpoint_name(from);
+        conn->established = true;
+        it = conns_.emplace(id, std::move(conn)).first;
+        {
+            std::lock_guard lock(mutex_);
+            size_ = conns_.size();
+        }
+        connections.set(static_cast<int64_t>(conns_.size()));
+        spdlog::debug("UDP punch from {} at {}", name, endpoint_name(from));
+
+        // Their probe means their NAT now lets us through too: if our own
+        // punch towards them went unanswered, it's worth another go, at the
+        // port their NAT actually gave them if it isn't the published one.
+        if (auto mine = by_user_.find(std::string(name)); mine != by_user_.end()) {
+            Connection& ours = *conns_.at(mine->second);
+            if (!ours.established && ours.remote.address() == from.address()) {
+                ours.remote = from;
+                ours.remote_name = endpoint_name(from);
+                ours.punches_left = options_.punch_attempts;
+                send_punch(ours, now);
+                wake();
+            }
+        }
+    }
+    Connection& conn = *it->second;
+    if (conn.remote != from) {
+        spdlog::info("UDP connection {} moved to {}", conn.remote_name, endpoint_name(from));
+        conn.remote = from;
+        conn.remote_name = endpoint_name(from);
+    }
+    conn.last_heard = now;
+    send_control(conn, kPunchAck);
+}
+
+void UdpTransport::on_data(Connection& conn, std::string_view body) {
+    if (body.size() < 6 || static_cast<uint8_t>(body[0]) >= kStreams) {
+        return;
+    }
+    const auto index = static_cast<uint8_t>(body[0]);
+    const auto seq = static_cast<uint32_t>(get_be(body, 1, 4));
+    const bool last = (static_cast<uint8_t>(body[5]) & kLastFragment) != 0;
+    const auto bytes = body.substr(6);
+    RecvStream& stream = conn.recv[index];
+    if (seq >= static_cast<uint64_t>(stream.next) + kMaxReorder) {
+        return;                         // too far ahead to buffer; it will come again
+    }
+
+    // Appends one in-order fragment; false if the frame grew too big.
+    auto consume = [&](bool is_last, std::string_view fragment) {
+        if (stream.partial.size() + fragment.size() > options_.max_frame_size) {
+            return false;
+        }
+        stream.partial.append(fragment);
+        ++stream.next;
+        if (is_last) {
+            if (on_message_) {
+                on_message_(conn.remote_name, stream.partial);
+            }
+            stream.partial.clear();
+        }
+        return true;
+    };
+
+    bool ok = true;
+    if (seq == stream.next) {
+        ok = consume(last, bytes);
+        while (ok && !stream.early.empty() && stream.early.begin()->first == stream.next) {
+            auto node = stream.early.extract(stream.early.begin());
+            ok = consume(node.mapped().first, node.mapped().second);
+        }
+    } else if (seq > stream.next) {
+        stream.early.try_emplace(seq, last, std::string(bytes));
+    }
+    if (!ok) {
+        spdlog::error("{} sent a frame above the {} byte limit, closing",
+                      conn.remote_name, options_.max_frame_size);
+        send_control(conn, kClose);
+        drop(conn.id);
+        return;
+    }
+
+    std::string ack;
+    ack += static_cast<char>(index);
+    put_u32(ack, stream.next);
+    put_u32(ack, seq);
+    send_control(conn, kAck, ack);
+}
+
+void UdpTransport::on_ack(Connection& conn, std::string_view body) {
+    if (body.size() < 9 || static_cast<uint8_t>(body[0]) >= kStreams) {
+        return;
+    }
+    SendStream& stream = conn.send[static_cast<uint8_t>(body[0])];
+    const auto next = static_cast<uint32_t>(get_be(body, 1, 4));
+    const auto seq = static_cast<uint32_t>(get_be(body, 5, 4));
+    const auto now = Clock::now();
+
+    auto acked = [&](std::map<uint32_t, Fragment>::iterator it) {
+        const Fragment& fragment = it->second;
+        if (fragment.sends == 1) {
+            sample_rtt(conn, now - fragment.sent);      // Karn: never from a resend
+        }
+        conn.queued_bytes -= fragment.bytes;
+        --conn.in_flight;
+        conn.cwnd = std::min(kMaxWindow, conn.cwnd < conn.ssthresh ? conn.cwnd + 1
+                                                                   : conn.cwnd + 1 / conn.cwnd);
+        return stream.unacked.erase(it);
+    };
+    for (auto it = stream.unacked.begin(); it != stream.unacked.end() && it->first < next;) {
+        it = acked(it);
+    }
+    if (auto it = stream.unacked.find(seq); it != stream.unacked.end()) {
+        acked(it);
+    }
+
+    // A fragment three later ones have overtaken is most likely lost: resend
+    // it now rather than at its timeout, and halve the window.
+    for (auto it = stream.unacked.begin(); it != stream.unacked.end() && it->first < seq; ++it) {
+        if (++it->second.overtaken == 3) {
+            transmit(conn, it->second);
+            conn.ssthresh = std::max(kMinWindow, conn.cwnd / 2);
+            conn.cwnd = conn.ssthresh;
+        }
+    }
+    flush(conn);
+}
+
+// ─── Sending ─────────────────────────────────────────────────────────────────
+
+void UdpTransport::do_punch(const std::string& username, const udp::endpoint& remote) {
+    Connection* conn = nullptr;
+    if (auto it = by_user_.find(username); it != by_user_.end()) {
+        conn = conns_.at(it->second).get();
+        if (conn->established || conn->next_punch != Clock::time_point{}) {
+            return;
+        }
+    } else {
+        if (conns_.size() >= options_.max_connections) {
+            spdlog::debug("Not punching {}: {} connections already", username, conns_.size());
+            return;
+        }
+        auto created = std::make_unique<Connection>();
+        created->id = random_id();
+        created->username = username;
+        conn = created.get();
+        by_user_[username] = created->id;
+        conns_.emplace(created->id, std::move(created));
+        {
+            std::lock_guard lock(mutex_);
+            size_ = conns_.size();
+        }
+        connections.set(static_cast<int64_t>(conns_.size()));
+    }
+    const auto now = Clock::now();
+    conn->remote = remote;
+    conn->remote_name = endpoint_name(remote);
+    conn->last_heard = now;             // the idle clock starts at the first punch
+    conn->punches_left = options_.punch_attempts;
+    spdlog::debug("Punching towards {} at {}", username, conn->remote_name);
+    send_punch(*conn, now);
+    wake();
+}
+
+void UdpTransport::send_punch(Connection& conn, Clock::time_point now) {
+    send_control(conn, kPunch, options_.username);
+    if (conn.punches_left > 0) {
+        --conn.punches_left;
+    }
+    conn.next_punch = now + options_.punch_interval;
+}
+
+void UdpTransport::give_up(Connection& conn) {
+    spdlog::info("No UDP answer from {} at {}", conn.username, conn.remote_name);
+    conn.next_punch = {};
+    for (auto& stream : conn.send) {
+        for (auto& fragment : stream.pending) {
+            if (fragment.done) {
+                fragment.done(false);
+            }
+        }
+        stream.pending.clear();
+    }
+    conn.queued_bytes = 0;
+}
+
+void UdpTransport::do_send(const std::string& username, std::string payload, Stream stream,
+                           std::function<void(bool)> done) {
+    auto it = by_user_.find(username);
+    Connection* conn = it == by_user_.end() ? nullptr : conns_.at(it->second).get();
+    if (!conn || (!conn->established && conn->next_punch == Clock::time_point{}) ||
+        conn->queued_bytes + payload.size() > options_.send_queue_bytes) {
+        if (done) {
+            done(false);
+        }
+        return;
+    }
+    SendStream& out = conn->send[static_cast<uint8_t>(stream)];
+    std::size_t offset = 0;
+    do {
+        const std::size_t n = std::min(kFragmentSize, payload.size() - offset);
+        const bool last = offset + n == payload.size();
+        Fragment fragment;
+        fragment.seq = out.next_seq++;
+        fragment.bytes = n;
+        fragment.packet = header(kData, conn->id);
+        fragment.packet += static_cast<char>(stream);
+        put_u32(fragment.packet, fragment.seq);
+        fragment.packet += static_cast<char>(last ? kLastFragment : 0);
+        fragment.packet.append(payload, offset, n);
+        if (last) {
+            fragment.done = std::move(done);
+        }
+        out.pending.push_back(std::move(fragment));
+        offset += n;
+    } while (offset < payload.size());
+    conn->queued_bytes += payload.size();
+    if (conn->established) {
+        flush(*conn);
+    }
+}
+
+void UdpTransport::flush(Connection& conn) {
+    bool sent = false;
+    for (std::size_t index = 0; index < kStreams; ++index) {
+        SendStream& stream = conn.send[index];
+        const std::size_t window = static_cast<std::size_t>(conn.cwnd) +
+            (index == static_cast<std::size_t>(Stream::Messages) ? kMessagesHeadroom : 0);
+        while (!stream.pending.empty() && conn.in_flight < window) {
+            const uint32_t seq = stream.pending.front().seq;
+            Fragment& fragment =
+                stream.unacked.emplace(seq, std::move(stream.pending.front())).first->second;
+            stream.pending.pop_front();
+            ++conn.in_flight;
+            transmit(conn, fragment);
+            sent = true;
+            if (fragment.done) {
+                auto done = std::move(fragment.done);
+                fragment.done = nullptr;
+                done(true);
+            }
+        }
+    }
+    if (sent) {
+        wake();
+    }
+}
+
+void UdpTransport::transmit(Connection& conn, Fragment& fragment) {
+    if (fragment.sends > 0) {
+        fragments_resent.inc();
+    }
+    fragment.sent = Clock::now();
+    fragment.overtaken = 0;
+    ++fragment.sends;
+    send_raw(conn.remote, fragment.packet);
+    conn.last_sent = fragment.sent;
+}
+
+void UdpTransport::send_control(Connection& conn, uint8_t type, std::string_view body) {
+    std::string packet = header(type, conn.id);
+    packet.append(body);
+    send_raw(conn.remote, packet);
+    conn.last_sent = Clock::now();
+}
+
+void UdpTransport::send_raw(const udp::endpoint& to, std::string_view packet) {
+    asio::error_code ec;
+    socket_.send_to(asio::buffer(packet.data(), packet.size()), to, 0, ec);
+    if (ec && ec != asio::error::would_block) {
+        spdlog::debug("UDP send to {} failed: {}", endpoint_name(to), ec.message());
+        return;
+    }
+    packets_sent.inc();
+}
+
+void UdpTransport::sample_rtt(Connection& conn, Clock::duration rtt) {
+    const double r = std::chrono::duration<double>(rtt).count();
+    if (conn.srtt == 0) {
+        conn.srtt = r;
+        conn.rttvar = r / 2;
+    } else {
+        conn.rttvar = 0.75 * conn.rttvar + 0.25 * std::abs(conn.srtt - r);
+        conn.srtt = 0.875 * conn.srtt + 0.125 * r;
+    }
+    const auto rto = std::chrono::milliseconds(
+        static_cast<int64_t>((conn.srtt + 4 * conn.rttvar) * 1000));
+    conn.rto = std::clamp<std::chrono::milliseconds>(rto, kMinRto, kMaxRto);
+}
+
+// ─── Connections ─────────────────────────────────────────────────────────────
+
+void UdpTransport::set_established(Connection& conn, bool established) {
+    conn.established = established;
+    if (conn.username.empty()) {
+        return;
+    }
+    std::lock_guard lock(mutex_);
+    if (established) {
+        established_.insert(conn.username);
+    } else {
+        established_.erase(conn.username);
+    }
+}
+
+void UdpTransport::drop(uint64_t id) {
+    auto it = conns_.find(id);
+    if (it == conns_.end()) {
+        return;
+    }
+    auto conn = std::move(it->second);
+    conns_.erase(it);
+    if (!conn->username.empty()) {
+        if (auto u = by_user_.find(conn->username); u != by_user_.end() && u->second == id) {
+            by_user_.erase(u);
+        }
+    }
+    set_established(*conn, false);
+    {
+        std::lock_guard lock(mutex_);
+        size_ = conns_.size();
+    }
+    connections.set(static_cast<int64_t>(conns_.size()));
+    for (auto& stream : conn->send) {
+        for (auto& fragment : stream.pending) {
+            if (fragment.done) {
+                fragment.done(false);
+            }
+        }
+    }
+}
+
+void UdpTransport::tick() {
+    const auto now = Clock::now();
+    bool busy = false;
+    std::vector<uint64_t> dead;
+    for (auto& [id, entry] : conns_) {
+        Connection& conn = *entry;
+        if (now - conn.last_heard > options_.idle_timeout) {
+            spdlog::debug("UDP connection {} went quiet", conn.remote_name);
+            dead.push_back(id);
+            continue;
+        }
+        if (!conn.established) {
+            if (conn.next_punch != Clock::time_point{}) {
+                busy = true;
+                if (now >= conn.next_punch) {
+                    if (conn.punches_left > 0) {
+                        send_punch(conn, now);
+                    } else {
+                        give_up(conn);
+                    }
+                }
+            }
+            continue;
+        }
+
+        bool timed_out = false;
+        bool failed = false;
+        for (auto& stream : conn.send) {
+            for (auto& [seq, fragment] : stream.unacked) {
+                busy = true;
+                if (now - fragment.sent < conn.rto) {
+                    continue;
+                }
+                if (fragment.sends >= kMaxSends) {
+                    failed = true;
+                    break;
+                }
+                transmit(conn, fragment);
+                timed_out = true;
+            }
+        }
+        if (failed) {
+            spdlog::info("UDP connection {} stopped answering", conn.remote_name);
+            dead.push_back(id);
+            continue;
+        }
+        if (timed_out) {
+            conn.ssthresh = std::max(kMinWindow, conn.cwnd / 2);
+            conn.cwnd = kMinWindow;
+            conn.rto = std::min<std::chrono::milliseconds>(conn.rto * 2, kMaxRto);
+        }
+        // Only the side that punched keeps the NAT mappings open; the
+        // answers refresh the other side's.
+        if (!conn.username.empty() && now - conn.last_sent >= options_.keepalive) {
+            send_control(conn, kPunch, options_.username);
+        }
+    }
+    for (const uint64_t id : dead) {
+        drop(id);
+    }
+    arm_timer(busy);
+}
+
+void UdpTransport::arm_timer(bool busy) {
+    timer_busy_ = busy;
+    timer_.expires_after(busy ? std::chrono::duration_cast<Clock::duration>(kBusyTick)
+                              : std::chrono::duration_cast<Clock::duration>(kIdleTick));
+    timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            tick();
+        }
+    });
+}
+
+void UdpTransport::wake() {
+    if (!timer_busy_) {
+        arm_timer(true);
+    }
+}
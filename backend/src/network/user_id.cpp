@@ -0,0 +1,90 @@
+/**
+ * UserId — the process-wide username table.
+ *
+ * Names are stored in fixed-size chunks that never move once allocated,
+ * so name() is two loads and the index can key on string_views into them.
+ */
+
+#include "network/user_id.h"
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace user_id {
+
+namespace {
+
+constexpr uint32_t kChunkBits = 12;
+constexpr uint32_t kChunkSize = 1u << kChunkBits;
+constexpr uint32_t kChunks = kMaxUsers / kChunkSize;
+
+struct Table {
+    std::shared_mutex mutex;                    // guards index and count
+    std::unordered_map<std::string_view, UserId> index;
+    uint32_t count = 0;
+    // Published with a release store; name() reads them without the lock.
+    std::array<std::atomic<std::string*>, kChunks> chunks{};
+    std::array<std::unique_ptr<std::string[]>, kChunks> owned;
+};
+
+Table& table() {
+    static Table t;
+    return t;
+}
+
+const std::string kEmpty;
+
+} // namespace
+
+UserId intern(std::string_view username) {
+    if (username.empty()) {
+        return UserId::None;
+    }
+    if (const UserId id = find(username); id != UserId::None) {
+        return id;
+    }
+    auto& t = table();
+    std::unique_lock lock(t.mutex);
+    if (auto it = t.index.find(username); it != t.index.end()) {
+        return it->second;
+    }
+    if (t.count >= kMaxUsers) {
+        return UserId::None;
+    }
+    const uint32_t slot = t.count++;
+    const uint32_t chunk = slot >> kChunkBits;
+    if (!t.owned[chunk]) {
+        t.owned[chunk] = std::make_unique<std::string[]>(kChunkSize);
+        t.chunks[chunk].store(t.owned[chunk].get(), std::memory_order_release);
+    }
+    std::string& stored = t.owned[chunk][slot & (kChunkSize - 1)];
+    stored.assign(username);
+    const auto id = static_cast<UserId>(slot + 1);
+    t.index.emplace(stored, id);
+    return id;
+}
+
+UserId find(std::string_view username) {
+    auto& t = table();
+    std::shared_lock lock(t.mutex);
+    auto it = t.index.find(username);
+    return it == t.index.end() ? UserId::None : it->second;
+}
+
+const std::string& name(UserId id) {
+    const auto value = static_cast<uint32_t>(id);
+    if (value == 0 || value > kMaxUsers) {
+        return kEmpty;
+    }
+    const uint32_t slot = value - 1;
+    // An id is only handed out after its chunk was published and its name
+    // written, under the mutex its receiver synchronised with.
+    const std::string* chunk = table().chunks[slot >> kChunkBits].load(std::memory_order_acquire);
+    return chunk ? chunk[slot & (kChunkSize - 1)] : kEmpty;
+}
+
+} // namespace user_id
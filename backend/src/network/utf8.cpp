@@ -0,0 +1,294 @@
+/**
+ * utf8 — vectorised UTF-8 validation.
+ *
+ * The SIMD kernels follow Keiser & Lemire, "Validating UTF-8 In Less Than
+ * One Instruction Per Byte" (2021): every byte is classified together
+ * with the one before it through three 16-entry nibble tables, whose AND
+ * is non-zero exactly where a two-byte pattern is illegal (too short, too
+ * long, overlong, surrogate, too large). Third and fourth continuation
+ * bytes are checked separately from the lead two and three bytes back.
+ * Blocks of pure ASCII only check that no sequence was left open.
+ */
+
+#include "network/utf8.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define P2P_UTF8_AVX2 1
+    #include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #define P2P_UTF8_NEON 1
+    #include <arm_neon.h>
+#endif
+
+namespace {
+
+#if P2P_UTF8_AVX2 || P2P_UTF8_NEON
+
+// Error classes for a (previous byte, byte) pair.
+constexpr uint8_t kTooShort  = 1 << 0;   // 11______ 0_______ / 11______ 11______
+constexpr uint8_t kTooLong   = 1 << 1;   // 0_______ 10______
+constexpr uint8_t kOverlong3 = 1 << 2;   // 11100000 100_____
+constexpr uint8_t kTooLarge  = 1 << 3;   // 11110100 1001____ and above
+constexpr uint8_t kSurrogate = 1 << 4;   // 11101101 101_____
+constexpr uint8_t kOverlong2 = 1 << 5;   // 1100000_ 10______
+constexpr uint8_t kTooLarge1000 = 1 << 6; // 11110101 1000____ and above
+constexpr uint8_t kOverlong4 = 1 << 6;   // 11110000 1000____
+constexpr uint8_t kTwoConts  = 1 << 7;   // 10______ 10______
+constexpr uint8_t kCarry = kTooShort | kTooLong | kTwoConts;
+
+// Indexed by the high nibble of the previous byte.
+constexpr uint8_t kByte1High[16] = {
+    kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong, kTooLong,
+    kTwoConts, kTwoConts, kTwoConts, kTwoConts,
+    kTooShort | kOverlong2,
+    kTooShort,
+    kTooShort | kOverlong3 | kSurrogate,
+    kTooShort | kTooLarge | kTooLarge1000 | kOverlong4,
+};
+
+// Indexed by the low nibble of the previous byte.
+constexpr uint8_t kByte1Low[16] = {
+    kCarry | kOverlong3 | kOverlong2 | kOverlong4,
+    kCarry | kOverlong2,
+    kCarry,
+    kCarry,
+    kCarry | kTooLarge,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000 | kSurrogate,
+    kCarry | kTooLarge | kTooLarge1000,
+    kCarry | kTooLarge | kTooLarge1000,
+};
+
+// Indexed by the high nibble of the byte itself.
+constexpr uint8_t kByte2High[16] = {
+    kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort, kTooShort,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge1000 | kOverlong4,
+    kTooLong | kOverlong2 | kTwoConts | kOverlong3 | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooLong | kOverlong2 | kTwoConts | kSurrogate | kTooLarge,
+    kTooShort, kTooShort, kTooShort, kTooShort,
+};
+
+#endif
+
+#if P2P_UTF8_AVX2
+
+/// Validator state carried from one 32-byte block to the next.
+struct Avx2State {
+    __m256i prev;
+    __m256i incomplete;                 // a sequence runs past `prev`
+    __m256i error;
+};
+
+__attribute__((target("avx2")))
+inline __m256i table(const uint8_t (&t)[16]) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t)));
+}
+
+/// `in` shifted right by N bytes across the whole register, with the
+/// last N bytes of `prev` shifted in.
+template <int N>
+__attribute__((target("avx2")))
+inline __m256i prev_bytes(__m256i in, __m256i prev) {
+    return _mm256_alignr_epi8(in, _mm256_permute2x128_si256(prev, in, 0x21), 16 - N);
+}
+
+__attribute__((target("avx2")))
+inline void check_block(Avx2State& s, __m256i in) {
+    const __m256i low4 = _mm256_set1_epi8(0x0F);
+    if (_mm256_movemask_epi8(in) == 0) {
+        // ASCII: fine as long as the previous block didn't end mid-sequence.
+        s.error = _mm256_or_si256(s.error, s.incomplete);
+        s.prev = in;
+        s.incomplete = _mm256_setzero_si256();
+        return;
+    }
+    const __m256i prev1 = prev_bytes<1>(in, s.prev);
+    const __m256i b1_high = _mm256_shuffle_epi8(
+        table(kByte1High), _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low4));
+    const __m256i b1_low = _mm256_shuffle_epi8(table(kByte1Low), _mm256_and_si256(prev1, low4));
+    const __m256i b2_high = _mm256_shuffle_epi8(
+        table(kByte2High), _mm256_and_si256(_mm256_srli_epi16(in, 4), low4));
+    const __m256i special = _mm256_and_si256(_mm256_and_si256(b1_high, b1_low), b2_high);
+
+    // Bytes two or three after a three- or four-byte lead must be
+    // continuations; `special` flags every continuation as TWO_CONTS, so
+    // the two must agree.
+    const __m256i prev2 = prev_bytes<2>(in, s.prev);
+    const __m256i prev3 = prev_bytes<3>(in, s.prev);
+    const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+    const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+    const __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                            _mm256_set1_epi8(static_cast<char>(0x80)));
+    s.error = _mm256_or_si256(s.error, _mm256_xor_si256(must23, special));
+
+    // A lead in the last three bytes whose sequence the block cuts off.
+    const __m256i max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+    s.incomplete = _mm256_subs_epu8(in, max);
+    s.prev = in;
+}
+
+__attribute__((target("avx2")))
+bool valid_avx2(const uint8_t* p, std::size_t n) {
+    Avx2State s{_mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()};
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        check_block(s, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i)));
+    }
+    // The tail, padded with ASCII: an open sequence then fails on the pad.
+    alignas(32) uint8_t tail[32] = {};
+    std::memcpy(tail, p + i, n - i);
+    check_block(s, _mm256_load_si256(reinterpret_cast<const __m256i*>(tail)));
+    s.error = _mm256_or_si256(s.error, s.incomplete);
+    return _mm256_testz_si256(s.error, s.error);
+}
+
+bool cpu_has_avx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+#elif P2P_UTF8_NEON
+
+struct NeonState {
+    uint8x16_t prev = vdupq_n_u8(0);
+    uint8x16_t incomplete = vdupq_n_u8(0);
+    uint8x16_t error = vdupq_n_u8(0);
+};
+
+inline void check_block(NeonState& s, uint8x16_t in) {
+    const uint8x16_t low4 = vdupq_n_u8(0x0F);
+    if (vmaxvq_u8(in) < 0x80) {
+        s.error = vorrq_u8(s.error, s.incomplete);
+        s.prev = in;
+        s.incomplete = vdupq_n_u8(0);
+        return;
+    }
+    const uint8x16_t prev1 = vextq_u8(s.prev, in, 15);
+    const uint8x16_t b1_high = vqtbl1q_u8(vld1q_u8(kByte1High), vshrq_n_u8(prev1, 4));
+    const uint8x16_t b1_low = vqtbl1q_u8(vld1q_u8(kByte1Low), vandq_u8(prev1, low4));
+    const uint8x16_t b2_high = vqtbl1q_u8(vld1q_u8(kByte2High), vshrq_n_u8(in, 4));
+    const uint8x16_t special = vandq_u8(vandq_u8(b1_high, b1_low), b2_high);
+
+    const uint8x16_t prev2 = vextq_u8(s.prev, in, 14);
+    const uint8x16_t prev3 = vextq_u8(s.prev, in, 13);
+    const uint8x16_t third = vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80));
+    const uint8x16_t fourth = vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80));
+    const uint8x16_t must23 = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+    s.error = vorrq_u8(s.error, veorq_u8(must23, special));
+
+    static constexpr uint8_t kMax[16] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+    s.incomplete = vqsubq_u8(in, vld1q_u8(kMax));
+    s.prev = in;
+}
+
+bool valid_neon(const uint8_t* p, std::size_t n) {
+    NeonState s;
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        check_block(s, vld1q_u8(p + i));
+    }
+    uint8_t tail[16] = {};
+    std::memcpy(tail, p + i, n - i);
+    check_block(s, vld1q_u8(tail));
+    s.error = vorrq_u8(s.error, s.incomplete);
+    return vmaxvq_u8(s.error) == 0;
+}
+
+#endif
+
+} // namespace
+
+namespace utf8 {
+
+namespace scalar {
+
+bool valid(std::string_view text) {
+    const auto* p = reinterpret_cast<const uint8_t*>(text.data());
+    const auto* end = p + text.size();
+    while (p < end) {
+        // Skip ASCII eight bytes at a time.
+        if (end - p >= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            if ((word & 0x8080808080808080ull) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        const uint8_t b0 = *p;
+        if (b0 < 0x80) {
+            ++p;
+            continue;
+        }
+        int len;
+        uint8_t lo = 0x80, hi = 0xBF;           // allowed range of the second byte
+        if (b0 >= 0xC2 && b0 <= 0xDF) {
+            len = 2;
+        } else if (b0 >= 0xE0 && b0 <= 0xEF) {
+            len = 3;
+            if (b0 == 0xE0) lo = 0xA0;
+            if (b0 == 0xED) hi = 0x9F;
+        } else if (b0 >= 0xF0 && b0 <= 0xF4) {
+            len = 4;
+            if (b0 == 0xF0) lo = 0x90;
+            if (b0 == 0xF4) hi = 0x8F;
+        } else {
+            return false;
+        }
+        if (end - p < len) {
+            return false;
+        }
+        for (int i = 1; i < len; ++i) {
+            if (p[i] < (i == 1 ? lo : 0x80) || p[i] > (i == 1 ? hi : 0xBF)) {
+                return false;
+            }
+        }
+        p += len;
+    }
+    return true;
+}
+
+} // namespace scalar
+
+bool valid(std::string_view text) {
+    const auto* p = reinterpret_cast<const uint8_t*>(text.data());
+#if P2P_UTF8_AVX2
+    if (text.size() >= 32 && cpu_has_avx2()) {
+        return valid_avx2(p, text.size());
+    }
+#elif P2P_UTF8_NEON
+    if (text.size() >= 32) {
+        return valid_neon(p, text.size());
+    }
+#endif
+    (void)p;
+    return scalar::valid(text);
+}
+
+const char* implementation() {
+#if P2P_UTF8_AVX2
+    return cpu_has_avx2() ? "avx2" : "scalar";
+#elif P2P_UTF8_NEON
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace utf8
@@ -0,0 +1,280 @@
+/**
+ * ZeroCopySender — MSG_ZEROCOPY sendmsg and error-queue completions.
+ */
+
+#include "network/zero_copy.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#include <spdlog/spdlog.h>
+
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define P2P_HAVE_ZEROCOPY 1
+#endif
+
+#ifdef P2P_HAVE_ZEROCOPY
+
+namespace {
+
+metrics::Counter& zerocopy_bytes =
+    metrics::counter("p2p_zerocopy_bytes_total", "Bytes written to peers with MSG_ZEROCOPY");
+metrics::Counter& zerocopy_copied =
+    metrics::counter("p2p_zerocopy_copied_total",
+                     "Connections that stopped using MSG_ZEROCOPY because the kernel copied anyway");
+
+} // namespace
+
+struct ZeroCopySender::State : std::enable_shared_from_this<State> {
+    /// Buffers behind the zero-copy sends numbered [first, first + count).
+    struct Held {
+        uint32_t first;
+        uint32_t count;
+        uint32_t remaining;                     // sends the kernel still holds
+        std::shared_ptr<void> buffers;
+    };
+
+    asio::ip::tcp::socket* socket = nullptr;
+    std::size_t min_bytes = 0;
+    bool enabled = false;
+
+    // The kernel numbers each zero-copy sendmsg that sends anything, from 0.
+    uint32_t next_id = 0;
+    uint32_t unretained = 0;                    // first id not yet passed to retain()
+    std::deque<Held> held;
+    bool reaping = false;                       // an error-queue wait is pending
+
+    // The write in progress.
+    std::vector<iovec> iov;
+    std::size_t next_iov = 0;
+    Completion done;
+
+    void write();
+    void finish(const asio::error_code& ec);
+    void advance(std::size_t n);
+
+    void arm_reap();
+    /// Read every completion queued so far; false if there were none.
+    bool reap();
+    void release(uint32_t lo, uint32_t hi);
+};
+
+void ZeroCopySender::State::write() {
+    const int fd = socket->native_handle();
+    bool copy = false;                          // retry one send without the flag
+    while (next_iov < iov.size()) {
+        msghdr msg{};
+        msg.msg_iov = iov.data() + next_iov;
+        msg.msg_iovlen = std::min<std::size_t>(iov.size() - next_iov, IOV_MAX);
+        const int flags = enabled && !copy ? MSG_ZEROCOPY : 0;
+        const ssize_t n = ::sendmsg(fd, &msg, flags | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                socket->async_wait(asio::ip::tcp::socket::wait_write,
+                    [self = shared_from_this()](const asio::error_code& ec) {
+                        if (ec) {
+                            self->finish(ec);
+                        } else {
+                            self->write();
+                        }
+                    });
+                return;
+            }
+            if (errno == ENOBUFS && flags) {
+                copy = true;                    // out of notification memory: copy this one
+                continue;
+            }
+            finish(asio::error_code(errno, asio::error::get_system_category()));
+            return;
+        }
+        if (flags) {
+            ++next_id;
+            zerocopy_bytes.inc(static_cast<uint64_t>(n));
+        }
+        copy = false;
+        advance(static_cast<std::size_t>(n));
+    }
+    finish({});
+}
+
+void ZeroCopySender::State::advance(std::size_t n) {
+    while (n > 0 && next_iov < iov.size()) {
+        iovec& v = iov[next_iov];
+        if (n < v.iov_len) {
+            v.iov_base = static_cast<char*>(v.iov_base) + n;
+            v.iov_len -= n;
+            return;
+        }
+        n -= v.iov_len;
+        ++next_iov;
+    }
+}
+
+void ZeroCopySender::State::finish(const asio::error_code& ec) {
+    iov.clear();
+    next_iov = 0;
+    auto callback = std::move(done);
+    done = nullptr;
+    callback(ec);
+}
+
+void ZeroCopySender::State::arm_reap() {
+    if (reaping || held.empty()) {
+        return;
+    }
+    reaping = true;
+    socket->async_wait(asio::ip::tcp::socket::wait_error,
+        [self = shared_from_this()](const asio::error_code& ec) {
+            self->reaping = false;
+            if (ec) {
+                return;                         // closed: the socket may be gone
+            }
+            // A wake with nothing queued is the connection failing, not a
+            // completion; waiting again would only spin. Otherwise wait
+            // again before a last drain, so nothing queued in between is
+            // missed.
+            if (self->reap()) {
+                self->arm_reap();
+                self->reap();
+            }
+        });
+}
+
+bool ZeroCopySender::State::reap() {
+    const int fd = socket->native_handle();
+    bool any = false;
+    for (;;) {
+        alignas(cmsghdr) char control[128];
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return any;
+        }
+        for (cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (!(c->cmsg_level == IPPROTO_IP && c->cmsg_type == IP_RECVERR) &&
+                !(c->cmsg_level == IPPROTO_IPV6 && c->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(c), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) {
+                continue;
+            }
+            any = true;
+            if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && enabled) {
+                enabled = false;
+                zerocopy_copied.inc();
+                spdlog::debug("Kernel copied a zero-copy send; using plain sends on this connection");
+            }
+            release(err.ee_info, err.ee_data);
+        }
+    }
+}
+
+void ZeroCopySender::State::release(uint32_t lo, uint32_t hi) {
+    // Ids wrap, so work in offsets from `lo`.
+    const int64_t last = static_cast<uint32_t>(hi - lo);
+    for (auto& entry : held) {
+        const int64_t from = static_cast<int32_t>(entry.first - lo);
+        const int64_t to = from + entry.count - 1;
+        const int64_t overlap = std::min(to, last) - std::max<int64_t>(from, 0) + 1;
+        if (overlap > 0) {
+            entry.remaining -= static_cast<uint32_t>(std::min<int64_t>(overlap, entry.remaining));
+        }
+    }
+    std::erase_if(held, [](const Held& entry) { return entry.remaining == 0; });
+}
+
+ZeroCopySender::ZeroCopySender() : state_(std::make_shared<State>()) {}
+
+ZeroCopySender::~ZeroCopySender() = default;
+
+bool ZeroCopySender::enable(asio::ip::tcp::socket& socket, std::size_t min_bytes) {
+    const int one = 1;
+    if (min_bytes == 0 ||
+        ::setsockopt(socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) != 0) {
+        return false;
+    }
+    asio::error_code ec;
+    socket.native_non_blocking(true, ec);
+    if (ec) {
+        return false;
+    }
+    state_->socket = &socket;
+    state_->min_bytes = min_bytes;
+    state_->enabled = true;
+    return true;
+}
+
+bool ZeroCopySender::wants(std::size_t bytes) const {
+    return state_->enabled && bytes >= state_->min_bytes;
+}
+
+void ZeroCopySender::async_write(std::span<const asio::const_buffer> buffers, Completion done) {
+    State& s = *state_;
+    s.iov.clear();
+    s.iov.reserve(buffers.size());
+    for (const auto& buffer : buffers) {
+        s.iov.push_back(iovec{const_cast<void*>(buffer.data()), buffer.size()});
+    }
+    s.next_iov = 0;
+    s.done = std::move(done);
+    s.write();
+}
+
+void ZeroCopySender::retain_erased(std::shared_ptr<void> buffers) {
+    State& s = *state_;
+    if (s.next_id == s.unretained) {
+        return;                                 // every byte was copied: nothing pinned
+    }
+    const uint32_t count = s.next_id - s.unretained;
+    s.held.push_back(State::Held{s.unretained, count, count, std::move(buffers)});
+    s.unretained = s.next_id;
+    s.arm_reap();
+    s.reap();
+}
+
+#else
+
+struct ZeroCopySender::State {};
+
+ZeroCopySender::ZeroCopySender() : state_(std::make_shared<State>()) {}
+
+ZeroCopySender::~ZeroCopySender() = default;
+
+bool ZeroCopySender::enable(asio::ip::tcp::socket&, std::size_t) {
+    return false;
+}
+
+bool ZeroCopySender::wants(std::size_t) const {
+    return false;
+}
+
+void ZeroCopySender::async_write(std::span<const asio::const_buffer>, Completion done) {
+    done(asio::error::operation_not_supported);
+}
+
+void ZeroCopySender::retain_erased(std::shared_ptr<void>) {}
+
+#endif
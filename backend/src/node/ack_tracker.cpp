@@ -0,0 +1,209 @@
+/**
+ * AckTracker — retransmission of unacknowledged direct messages.
+ *
+ * The wheel has `slots` buckets of `tick` each; a deadline `d` (in ticks
+ * since construction) lives in bucket d % slots, and deadlines more than a
+ * lap ahead simply stay put until a pass finds them due. Each entry has at
+ * most one live bucket reference, told apart from stale ones (left behind
+ * by acks and reschedules) by its generation.
+ */
+
+#include "node/ack_tracker.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include <spdlog/spdlog.h>
+
+AckTracker::AckTracker(asio::io_context& io, Options options, Retransmit retransmit,
+                       GiveUp give_up)
+    : options_(options),
+      retransmit_(std::move(retransmit)),
+      give_up_(std::move(give_up)),
+      timer_(io),
+      wheel_(std::max<std::size_t>(1, options.slots)),
+      processed_tick_(0) {
+    options_.tick = std::max(options_.tick, std::chrono::milliseconds(1));
+}
+
+uint64_t AckTracker::now_tick() const {
+    return static_cast<uint64_t>((Clock::now() - epoch_) / options_.tick);
+}
+
+std::chrono::milliseconds AckTracker::backoff(int retries) const {
+    auto delay = options_.ack_timeout;
+    for (int i = 0; i < retries && delay < options_.max_backoff; ++i) {
+        delay *= 2;
+    }
+    return std::min(delay, options_.max_backoff);
+}
+
+void AckTracker::track(std::string msg_id, Envelope envelope, Reseal reseal) {
+    std::lock_guard lock(mutex_);
+    if (stopped_) {
+        return;
+    }
+    const auto ticks = (backoff(0) + options_.tick - std::chrono::milliseconds(1)) / options_.tick;
+    auto& entry = entries_[msg_id];
+    entry.envelope = std::move(envelope);
+    entry.reseal = std::move(reseal);
+    entry.retries = 0;
+    entry.deadline = now_tick() + std::max<uint64_t>(1, static_cast<uint64_t>(ticks));
+    schedule_locked(msg_id, entry);
+    arm_locked();
+}
+
+std::optional<Envelope> AckTracker::reseal(const std::string& msg_id) {
+    Reseal reseal;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = entries_.find(msg_id);
+        if (it == entries_.end() || !it->second.reseal) {
+            return std::nullopt;
+        }
+        reseal = std::move(it->second.reseal);
+        it->second.reseal = nullptr;
+    }
+    // Signing takes a while; not under the lock.
+    auto envelope = reseal();
+    if (envelope) {
+        std::lock_guard lock(mutex_);
+        if (auto it = entries_.find(msg_id); it != entries_.end()) {
+            it->second.envelope = *envelope;
+        }
+    }
+    return envelope;
+}
+
+bool AckTracker::acknowledge(const std::string& msg_id) {
+    std::lock_guard lock(mutex_);
+    return entries_.erase(msg_id) > 0;
+}
+
+void AckTracker::cancel(const std::string& msg_id) {
+    std::lock_guard lock(mutex_);
+    entries_.erase(msg_id);
+}
+
+void AckTracker::stop() {
+    std::lock_guard lock(mutex_);
+    stopped_ = true;
+    entries_.clear();
+    for (auto& slot : wheel_) slot.clear();
+    timer_.cancel();
+    armed_ = false;
+}
+
+std::size_t AckTracker::give_up_all() {
+    std::vector<std::tuple<std::string, Envelope, Reseal>> expired;
+    {
+        std::lock_guard lock(mutex_);
+        stopped_ = true;
+        expired.reserve(entries_.size());
+        for (auto& [id, entry] : entries_) {
+            expired.emplace_back(id, std::move(entry.envelope), std::move(entry.reseal));
+        }
+        entries_.clear();
+        for (auto& slot : wheel_) slot.clear();
+        timer_.cancel();
+        armed_ = false;
+    }
+    give_up(expired);
+    return expired.size();
+}
+
+std::size_t AckTracker::pending() const {
+    std::lock_guard lock(mutex_);
+    return entries_.size();
+}
+
+void AckTracker::schedule_locked(const std::string& id, Entry& entry) {
+    entry.generation = ++next_generation_;
+    wheel_[entry.deadline % wheel_.size()].push_back({id, entry.generation});
+}
+
+void AckTracker::arm_locked() {
+    if (armed_) {
+        return;
+    }
+    armed_ = true;
+    timer_.expires_at(epoch_ + (now_tick() + 1) * options_.tick);
+    timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            on_tick();
+        }
+    });
+}
+
+void AckTracker::on_tick() {
+    std::vector<std::pair<std::string, Envelope>> resend;
+    std::vector<std::tuple<std::string, Envelope, Reseal>> expired;
+    {
+        std::lock_guard lock(mutex_);
+        armed_ = false;
+        if (stopped_) {
+            return;
+        }
+
+        // Run every bucket since the last pass; after a long stall, one
+        // lap covers all of them.
+        const uint64_t current = now_tick();
+        const uint64_t first = current - processed_tick_ > wheel_.size()
+            ? current - wheel_.size() + 1 : processed_tick_ + 1;
+        std::vector<SlotRef> due;
+        for (uint64_t t = first; t <= current; ++t) {
+            auto& slot = wheel_[t % wheel_.size()];
+            due.swap(slot);
+            for (auto& ref : due) {
+                auto it = entries_.find(ref.msg_id);
+                if (it == entries_.end() || it->second.generation != ref.generation) {
+                    continue;                           // acked or rescheduled
+                }
+                Entry& entry = it->second;
+                if (entry.deadline > current) {
+                    slot.push_back(std::move(ref));     // a later lap
+                    continue;
+                }
+                if (entry.retries >= options_.max_retries) {
+                    expired.emplace_back(it->first, std::move(entry.envelope),
+                                         std::move(entry.reseal));
+                    entries_.erase(it);
+                    continue;
+                }
+                ++entry.retries;
+                const auto ticks = std::max<int64_t>(1, backoff(entry.retries) / options_.tick);
+                entry.deadline = current + static_cast<uint64_t>(ticks);
+                schedule_locked(it->first, entry);
+                resend.emplace_back(it->first, entry.envelope);
+            }
+            due.clear();
+        }
+        processed_tick_ = current;
+
+        if (entries_.empty()) {
+            for (auto& s : wheel_) s.clear();          // only stale references left
+        } else {
+            arm_locked();
+        }
+    }
+
+    for (const auto& [id, env] : resend) {
+        spdlog::debug("No ack for {} from {} yet; retransmitting", id, env.to);
+        if (retransmit_) retransmit_(id, env);
+    }
+    give_up(expired);
+}
+
+void AckTracker::give_up(std::vector<std::tuple<std::string, Envelope, Reseal>>& expired) {
+    for (auto& [id, env, reseal] : expired) {
+        if (reseal) {
+            auto resealed = reseal();
+            if (!resealed) {
+                spdlog::error("Could not reseal {} for {}; dropping it", id, env.to);
+                continue;
+            }
+            env = std::move(*resealed);
+        }
+        if (give_up_) give_up_(id, std::move(env));
+    }
+}
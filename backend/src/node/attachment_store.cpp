@@ -0,0 +1,243 @@
+/**
+ * AttachmentStore — content hashes, shared sealed streams and the index
+ * of received files.
+ *
+ * `<dir>/received` is append-only text, one download per line:
+ *
+ *   <hash hex> <size> <mtime ticks> <path>
+ *
+ * A later line for the same hash replaces an earlier one.
+ */
+
+#include "node/attachment_store.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+int64_t mtime_of(const std::filesystem::path& path, std::error_code& ec) {
+    return static_cast<int64_t>(
+        std::filesystem::last_write_time(path, ec).time_since_epoch().count());
+}
+
+} // namespace
+
+AttachmentStore::AttachmentStore(std::filesystem::path dir, std::chrono::seconds keep)
+    : dir_(std::move(dir)), keep_(keep) {}
+
+AttachmentStore::~AttachmentStore() {
+    while (!shared_.empty()) {
+        drop(shared_.begin());
+    }
+}
+
+std::optional<AttachmentStore::Hash> AttachmentStore::hash_file(DiskFile& file, uint64_t size,
+                                                                std::vector<uint8_t>& buffer) {
+    if (buffer.empty()) {
+        buffer.resize(64 * 1024);
+    }
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, nullptr, 0, crypto_generichash_BYTES);
+    for (uint64_t offset = 0; offset < size;) {
+        const auto n = static_cast<std::size_t>(std::min<uint64_t>(buffer.size(), size - offset));
+        if (!file.read_at(offset, {buffer.data(), n})) {
+            return std::nullopt;
+        }
+        crypto_generichash_update(&state, buffer.data(), n);
+        offset += n;
+    }
+    Hash hash;
+    crypto_generichash_final(&state, hash.data(), hash.size());
+    return hash;
+}
+
+std::string AttachmentStore::hex(const Hash& hash) {
+    char out[crypto_generichash_BYTES * 2 + 1];
+    sodium_bin2hex(out, sizeof(out), hash.data(), hash.size());
+    return out;
+}
+
+std::optional<AttachmentStore::Hash> AttachmentStore::parse(std::string_view hex) {
+    Hash hash;
+    std::size_t len = 0;
+    if (hex.size() != hash.size() * 2 ||
+        sodium_hex2bin(hash.data(), hash.size(), hex.data(), hex.size(), nullptr, &len,
+                       nullptr) != 0 ||
+        len != hash.size()) {
+        return std::nullopt;
+    }
+    return hash;
+}
+
+void AttachmentStore::additional_data(const Hash& hash, uint64_t offset, uint8_t out[24]) {
+    std::copy_n(hash.begin(), 16, out);
+    for (int i = 23; i >= 16; --i) {
+        out[i] = static_cast<uint8_t>(offset);
+        offset >>= 8;
+    }
+}
+
+void AttachmentStore::load() {
+    std::error_code ec;
+    // Their keys died with the process that sealed them.
+    for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+        if (entry.path().extension() == ".sealed") {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+    std::ifstream in(dir_ / "received");
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string hex_hash;
+        Received r;
+        if (!(fields >> hex_hash >> r.size >> r.mtime)) {
+            continue;
+        }
+        std::string path;
+        std::getline(fields >> std::ws, path);
+        if (auto hash = parse(hex_hash); hash && !path.empty()) {
+            r.path = path;
+            received_[*hash] = std::move(r);
+        }
+    }
+    if (!received_.empty()) {
+        spdlog::debug("{} received file(s) indexed by content", received_.size());
+    }
+}
+
+// ─── Shared streams ──────────────────────────────────────────────────────────
+
+std::filesystem::path AttachmentStore::spool_path(const Hash& hash) const {
+    return dir_ / (hex(hash) + ".sealed");
+}
+
+AttachmentStore::Shared* AttachmentStore::share(const Hash& hash,
+                                                const std::filesystem::path& path,
+                                                uint64_t size, std::size_t chunk_size) {
+    if (auto it = shared_.find(hash); it != shared_.end()) {
+        auto& s = it->second;
+        if (s.failed || s.chunk_size != chunk_size || s.size != size) {
+            return nullptr;
+        }
+        ++s.users;
+        s.last_used = Clock::now();
+        return &s;
+    }
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    auto& s = shared_[hash];
+    if (!s.source.open(path, DiskFile::Mode::Read) ||
+        !s.spool.open(spool_path(hash), DiskFile::Mode::ReadWrite)) {
+        spdlog::warn("Cannot spool {} for sharing; sealing per transfer", path.string());
+        drop(shared_.find(hash));
+        return nullptr;
+    }
+    s.hash = hash;
+    s.size = size;
+    s.chunk_size = chunk_size;
+    crypto_secretstream_xchacha20poly1305_keygen(s.key.data());
+    crypto_secretstream_xchacha20poly1305_init_push(&s.state, s.header.data(), s.key.data());
+    s.users = 1;
+    s.last_used = Clock::now();
+    return &s;
+}
+
+void AttachmentStore::release(Shared& shared) {
+    --shared.users;
+    shared.last_used = Clock::now();
+}
+
+bool AttachmentStore::sealed_chunk(Shared& shared, uint64_t offset, std::span<uint8_t> out,
+                                   std::vector<uint8_t>& buffer) {
+    const std::size_t n = out.size() - kSealBytes;
+    // Chunk i sits at i * (chunk_size + kSealBytes) in the spool.
+    const uint64_t at = offset / shared.chunk_size * (shared.chunk_size + kSealBytes);
+    shared.last_used = Clock::now();
+    if (offset + n <= shared.spooled) {
+        return shared.spool.read_at(at, out);
+    }
+    if (offset != shared.sealed) {
+        return false;
+    }
+    if (buffer.size() < n) {
+        buffer.resize(n);
+    }
+    if (!shared.source.read_at(offset, {buffer.data(), n})) {
+        shared.failed = true;
+        return false;
+    }
+    uint8_t ad[24];
+    additional_data(shared.hash, offset, ad);
+    const bool final = offset + n == shared.size;
+    crypto_secretstream_xchacha20poly1305_push(
+        &shared.state, out.data(), nullptr, buffer.data(), n, ad, sizeof(ad),
+        final ? crypto_secretstream_xchacha20poly1305_TAG_FINAL
+              : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE);
+    shared.sealed = offset + n;
+    // A chunk that didn't reach the spool still goes out; only transfers
+    // behind this one lose it.
+    if (shared.spooled == offset && shared.spool.write_at(at, out)) {
+        shared.spooled = shared.sealed;
+    } else {
+        shared.failed = true;
+    }
+    if (final) {
+        shared.source.close();
+        sodium_memzero(&shared.state, sizeof(shared.state));
+    }
+    return true;
+}
+
+void AttachmentStore::drop(std::map<Hash, Shared>::iterator it) {
+    auto& s = it->second;
+    s.source.close();
+    s.spool.close();
+    std::error_code ec;
+    std::filesystem::remove(spool_path(it->first), ec);
+    sodium_memzero(s.key.data(), s.key.size());
+    sodium_memzero(&s.state, sizeof(s.state));
+    shared_.erase(it);
+}
+
+void AttachmentStore::sweep(Clock::time_point now) {
+    for (auto it = shared_.begin(); it != shared_.end();) {
+        const auto next = std::next(it);
+        if (it->second.users <= 0 && now - it->second.last_used >= keep_) {
+            drop(it);
+        }
+        it = next;
+    }
+}
+
+// ─── Received files ──────────────────────────────────────────────────────────
+
+std::optional<std::filesystem::path> AttachmentStore::find(const Hash& hash, uint64_t size) const {
+    auto it = received_.find(hash);
+    if (it == received_.end() || it->second.size != size) {
+        return std::nullopt;
+    }
+    std::error_code ec;
+    const auto on_disk = std::filesystem::file_size(it->second.path, ec);
+    if (ec || on_disk != size || mtime_of(it->second.path, ec) != it->second.mtime || ec) {
+        return std::nullopt;                    // moved, deleted or edited since
+    }
+    return it->second.path;
+}
+
+void AttachmentStore::remember(const Hash& hash, uint64_t size,
+                               const std::filesystem::path& path) {
+    std::error_code ec;
+    Received r{size, mtime_of(path, ec), std::filesystem::absolute(path, ec)};
+    if (ec) {
+        return;
+    }
+    std::filesystem::create_directories(dir_, ec);
+    std::ofstream out(dir_ / "received", std::ios::app);
+    out << hex(hash) << ' ' << r.size << ' ' << r.mtime << ' ' << r.path.string() << '\n';
+    received_[hash] = std::move(r);
+}
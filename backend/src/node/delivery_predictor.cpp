@@ -0,0 +1,42 @@
+/**
+ * DeliveryPredictor — per-friend connect success as a moving average, and
+ * the choice between dialling, the offline mailbox, or both.
+ */
+
+#include "node/delivery_predictor.h"
+
+DeliveryPredictor::DeliveryPredictor(Options options) : options_(options) {}
+
+DeliveryPredictor::Path DeliveryPredictor::choose(const std::string& peer, const Signals& signals,
+                                                  Clock::time_point now) {
+    if (signals.connected) {
+        return Path::Direct;
+    }
+    std::lock_guard lock(mutex_);
+    auto& entry = entries_.try_emplace(peer, Entry{options_.prior, {}}).first->second;
+    const bool away = !signals.online &&
+                      (!signals.seen_ago || *signals.seen_ago > options_.stale_after);
+    if (!away) {
+        return entry.rate < options_.both_below ? Path::Both : Path::Direct;
+    }
+    if (entry.rate >= options_.offline_below) {
+        return Path::Both;
+    }
+    if (now - entry.probed_at >= options_.probe_every) {
+        entry.probed_at = now;
+        return Path::Both;
+    }
+    return Path::Offline;
+}
+
+void DeliveryPredictor::record(const std::string& peer, bool ok) {
+    std::lock_guard lock(mutex_);
+    auto& entry = entries_.try_emplace(peer, Entry{options_.prior, {}}).first->second;
+    entry.rate += options_.weight * ((ok ? 1.0 : 0.0) - entry.rate);
+}
+
+double DeliveryPredictor::success_rate(const std::string& peer) const {
+    std::lock_guard lock(mutex_);
+    const auto it = entries_.find(peer);
+    return it == entries_.end() ? options_.prior : it->second.rate;
+}
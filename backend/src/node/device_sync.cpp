@@ -0,0 +1,344 @@
+/**
+ * DeviceSync — history sync between a user's own devices by range digests.
+ *
+ * Every step is stateless: each message carries what the next one needs
+ * (the ranges or days it covers and where to answer), so rounds with
+ * several devices, or both ends starting one at once, need no bookkeeping.
+ */
+
+#include "node/device_sync.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <optional>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+metrics::Counter& sync_rounds =
+    metrics::counter("p2p_device_sync_rounds_total", "Device sync rounds started with another device");
+metrics::Counter& rows_sent =
+    metrics::counter("p2p_device_sync_rows_sent_total", "Message rows sent to our other devices");
+metrics::Counter& rows_imported =
+    metrics::counter("p2p_device_sync_rows_imported_total",
+                     "Message rows our other devices had and this one did not");
+
+constexpr std::size_t kMonth = 7;               // "YYYY-MM"
+constexpr std::size_t kDay = 10;                // "YYYY-MM-DD"
+
+std::string to_hex(const std::array<uint8_t, 16>& hash) {
+    char hex[33];
+    sodium_bin2hex(hex, sizeof(hex), hash.data(), hash.size());
+    return hex;
+}
+
+json ranges_json(const std::vector<MessageStore::RangeDigest>& digests) {
+    json out = json::array();
+    for (const auto& d : digests) {
+        out.push_back(json::array({d.key, d.count, to_hex(d.hash)}));
+    }
+    return out;
+}
+
+/// Nullopt if a hash isn't 32 hex digits; throws json::exception on a
+/// malformed entry.
+std::optional<std::vector<MessageStore::RangeDigest>> parse_ranges(const json& j) {
+    std::vector<MessageStore::RangeDigest> out;
+    for (const auto& r : j) {
+        MessageStore::RangeDigest d;
+        d.key = r.at(0).get<std::string>();
+        d.count = r.at(1).get<uint64_t>();
+        const auto hex = r.at(2).get<std::string>();
+        if (hex.size() != 2 * d.hash.size() ||
+            sodium_hex2bin(d.hash.data(), d.hash.size(), hex.data(), hex.size(), nullptr,
+                           nullptr, nullptr) != 0) {
+            return std::nullopt;
+        }
+        out.push_back(std::move(d));
+    }
+    return out;
+}
+
+/// Keys whose digests differ, including keys only one side has.
+std::vector<std::string> differing(const std::vector<MessageStore::RangeDigest>& mine,
+                                   const std::vector<MessageStore::RangeDigest>& theirs) {
+    std::map<std::string, const MessageStore::RangeDigest*> by_key;
+    for (const auto& d : theirs) {
+        by_key[d.key] = &d;
+    }
+    std::vector<std::string> keys;
+    for (const auto& d : mine) {
+        auto it = by_key.find(d.key);
+        if (it == by_key.end() || !(*it->second == d)) {
+            keys.push_back(d.key);
+        }
+        if (it != by_key.end()) {
+            by_key.erase(it);
+        }
+    }
+    for (const auto& [key, d] : by_key) {
+        keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+json message_json(const MessageStore::Message& m) {
+    return {{"msg_id", m.msg_id},
+            {"peer", m.peer},
+            {"direction", m.direction == MessageStore::Direction::Sent ? "sent" : "received"},
+            {"text", m.plaintext},
+            {"timestamp", m.timestamp},
+            {"delivered", m.delivered},
+            {"delivery_method", m.delivery_method},
+            {"sender", m.sender},
+            {"expires_at", m.expires_at}};
+}
+
+} // namespace
+
+DeviceSync::DeviceSync(asio::io_context& io, MessageStore& store, Options options, Send send,
+                       Imported imported)
+    : options_(std::move(options)),
+      store_(store),
+      send_(std::move(send)),
+      imported_(std::move(imported)),
+      timer_(io) {
+    options_.max_ids = std::max<std::size_t>(1, options_.max_ids);
+}
+
+void DeviceSync::start() {
+    for (const auto& device : options_.devices) {
+        begin_round(device);
+    }
+    arm();
+}
+
+void DeviceSync::stop() {
+    std::lock_guard lock(mutex_);
+    stopped_ = true;
+    timer_.cancel();
+}
+
+void DeviceSync::arm() {
+    std::lock_guard lock(mutex_);
+    if (stopped_) {
+        return;
+    }
+    timer_.expires_after(options_.interval);
+    timer_.async_wait([weak = weak_from_this()](const asio::error_code& ec) {
+        if (auto self = weak.lock(); self && !ec) {
+            self->start();
+        }
+    });
+}
+
+void DeviceSync::send(const std::string& address, json message) const {
+    message["reply_to"] = options_.self;
+    send_(address, message);
+}
+
+void DeviceSync::begin_round(const std::string& device) {
+    sync_rounds.inc();
+    store_.range_digests(kMonth, {}, [weak = weak_from_this(), device](auto months) {
+        if (auto self = weak.lock()) {
+            self->send(device, {{"op", "ranges"},
+                                {"level", kMonth},
+                                {"within", json::array()},
+                                {"ranges", ranges_json(months)}});
+        }
+    });
+}
+
+void DeviceSync::on_message(std::string_view payload) {
+    const auto j = json::parse(payload, nullptr, false);
+    if (!j.is_object()) {
+        spdlog::warn("Malformed device sync message");
+        return;
+    }
+    try {
+        const auto op = j.at("op").get<std::string>();
+        if (op == "rows") {
+            on_rows(j.at("rows"));
+            return;
+        }
+        const auto reply_to = j.at("reply_to").get<std::string>();
+        if (reply_to.empty()) {
+            return;
+        }
+        if (op == "ranges") {
+            const auto level = j.at("level").get<std::size_t>();
+            if (level != kMonth && level != kDay) {
+                return;
+            }
+            auto ranges = parse_ranges(j.at("ranges"));
+            if (!ranges) {
+                spdlog::warn("Malformed device sync message: bad range hash");
+                return;
+            }
+            on_ranges(reply_to, level, j.at("within").get<std::vector<std::string>>(),
+                      std::move(*ranges));
+        } else if (op == "ids") {
+            on_ids(reply_to, j.at("days").get<std::vector<std::string>>(),
+                   j.at("ids").get<std::vector<std::string>>());
+        } else if (op == "want") {
+            send_rows(reply_to, j.at("ids").get<std::vector<std::string>>());
+        }
+    } catch (const json::exception& e) {
+        spdlog::warn("Malformed device sync message: {}", e.what());
+    }
+}
+
+void DeviceSync::on_ranges(const std::string& reply_to, std::size_t level,
+                           const std::vector<std::string>& within,
+                           std::vector<MessageStore::RangeDigest> theirs) {
+    store_.range_digests(level, within, [weak = weak_from_this(), reply_to, level,
+                                         theirs = std::move(theirs)](auto mine) {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        const auto keys = differing(mine, theirs);
+        if (keys.empty()) {
+            spdlog::debug("History in sync with {}", reply_to);
+            return;
+        }
+        if (level == kMonth) {
+            // Narrow down to days: ours within the months that differ.
+            self->store_.range_digests(kDay, keys, [weak, reply_to, keys](auto days) {
+                if (auto self = weak.lock()) {
+                    self->send(reply_to, {{"op", "ranges"},
+                                          {"level", kDay},
+                                          {"within", keys},
+                                          {"ranges", ranges_json(days)}});
+                }
+            });
+            return;
+        }
+        spdlog::info("History differs from {} on {} day(s)", reply_to, keys.size());
+        // Our ids for those days, max_ids to a message; our counts say
+        // where to split.
+        std::map<std::string, uint64_t> counts;
+        for (const auto& d : mine) {
+            counts[d.key] = d.count;
+        }
+        std::vector<std::string> chunk;
+        uint64_t in_chunk = 0;
+        const auto flush = [&] {
+            self->store_.ids_for_days(chunk, [weak, reply_to, days = chunk](auto ids) {
+                if (auto self = weak.lock()) {
+                    self->send(reply_to, {{"op", "ids"}, {"days", days}, {"ids", ids}});
+                }
+            });
+            chunk.clear();
+            in_chunk = 0;
+        };
+        for (const auto& day : keys) {
+            const uint64_t n = counts[day];
+            if (!chunk.empty() && in_chunk + n > self->options_.max_ids) {
+                flush();
+            }
+            chunk.push_back(day);
+            in_chunk += n;
+        }
+        flush();
+    });
+}
+
+void DeviceSync::on_ids(const std::string& reply_to, const std::vector<std::string>& days,
+                        std::vector<std::string> theirs) {
+    store_.ids_for_days(days, [weak = weak_from_this(), reply_to,
+                               theirs = std::move(theirs)](auto mine) mutable {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        std::sort(mine.begin(), mine.end());
+        std::sort(theirs.begin(), theirs.end());
+        std::vector<std::string> missing_there, missing_here;
+        std::set_difference(mine.begin(), mine.end(), theirs.begin(), theirs.end(),
+                            std::back_inserter(missing_there));
+        std::set_difference(theirs.begin(), theirs.end(), mine.begin(), mine.end(),
+                            std::back_inserter(missing_here));
+        spdlog::debug("Device sync with {}: sending {}, asking for {}", reply_to,
+                      missing_there.size(), missing_here.size());
+        const std::size_t step = self->options_.max_ids;
+        for (std::size_t i = 0; i < missing_here.size(); i += step) {
+            const auto end = missing_here.begin() + std::min(missing_here.size(), i + step);
+            self->send(reply_to, {{"op", "want"},
+                                  {"ids", std::vector<std::string>(missing_here.begin() + i, end)}});
+        }
+        self->send_rows(reply_to, std::move(missing_there));
+    });
+}
+
+void DeviceSync::send_rows(const std::string& reply_to, std::vector<std::string> msg_ids) {
+    // Read max_ids rows at a time so a first sync of a long history never
+    // holds all of it in memory at once.
+    for (std::size_t i = 0; i < msg_ids.size(); i += options_.max_ids) {
+        const auto end = msg_ids.begin() + std::min(msg_ids.size(), i + options_.max_ids);
+        std::vector<std::string> ids(std::make_move_iterator(msg_ids.begin() + i),
+                                     std::make_move_iterator(end));
+        store_.messages_by_ids(std::move(ids), [weak = weak_from_this(), reply_to](auto messages) {
+            auto self = weak.lock();
+            if (!self) {
+                return;
+            }
+            json batch = json::array();
+            std::size_t bytes = 0;
+            for (const auto& m : messages) {
+                batch.push_back(message_json(m));
+                bytes += m.plaintext.size() + m.msg_id.size() + m.peer.size() + 64;
+                if (bytes >= self->options_.batch_bytes) {
+                    rows_sent.inc(batch.size());
+                    self->send(reply_to, {{"op", "rows"}, {"rows", std::move(batch)}});
+                    batch = json::array();
+                    bytes = 0;
+                }
+            }
+            if (!batch.empty()) {
+                rows_sent.inc(batch.size());
+                self->send(reply_to, {{"op", "rows"}, {"rows", std::move(batch)}});
+            }
+        });
+    }
+}
+
+void DeviceSync::on_rows(const json& rows) {
+    std::vector<MessageStore::Message> messages;
+    messages.reserve(rows.size());
+    for (const auto& r : rows) {
+        MessageStore::Message m;
+        m.msg_id = r.at("msg_id").get<std::string>();
+        m.peer = r.at("peer").get<std::string>();
+        m.direction = r.at("direction").get<std::string>() == "sent"
+            ? MessageStore::Direction::Sent : MessageStore::Direction::Received;
+        m.plaintext = r.at("text").get<std::string>();
+        m.timestamp = r.at("timestamp").get<std::string>();
+        m.delivered = r.value("delivered", false);
+        m.delivery_method = r.value("delivery_method", "direct");
+        m.sender = r.value("sender", "");
+        m.expires_at = r.value("expires_at", "");
+        if (m.msg_id.empty() || m.peer.empty() || m.timestamp.size() < kDay) {
+            continue;
+        }
+        messages.push_back(std::move(m));
+    }
+    store_.import_messages(std::move(messages), [weak = weak_from_this()](std::size_t count) {
+        auto self = weak.lock();
+        if (!self || count == 0) {
+            return;
+        }
+        rows_imported.inc(count);
+        spdlog::info("Device sync: imported {} message(s)", count);
+        if (self->imported_) {
+            self->imported_(count);
+        }
+    });
+}
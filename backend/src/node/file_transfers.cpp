@@ -0,0 +1,710 @@
+/**
+ * FileTransfers — chunked, resumable file streams between friends.
+ *
+ * Frame bodies (all integers big-endian, ids as 16 raw bytes):
+ *
+ *   file_chunk   id | offset u64 | flags u8 | [stream header] | sealed chunk
+ *   file_ack     id | offset u64 | flags u8
+ *   file_cancel  id
+ *
+ * A chunk's first 24 bytes (id and offset) are its additional data, so a
+ * sealed chunk only opens at the position it was written for. A chunk of
+ * a shared stream has the content hash's first 16 bytes in place of the id
+ * in its additional data instead, so it opens in any transfer of that content.
+ */
+
+#include "node/file_transfers.h"
+#include "crypto/base64.h"
+
+#include <algorithm>
+#include <future>
+
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::size_t kIdBytes = 16;
+constexpr std::size_t kPrefixBytes = kIdBytes + 8;       // additional data of a chunk
+constexpr std::size_t kChunkHeadBytes = kPrefixBytes + 1;
+constexpr std::size_t kStreamHeaderBytes = crypto_secretstream_xchacha20poly1305_HEADERBYTES;
+constexpr std::size_t kSealBytes = crypto_secretstream_xchacha20poly1305_ABYTES;
+
+constexpr uint8_t kChunkHasHeader = 0x01;   // file_chunk: a new stream starts here
+constexpr uint8_t kChunkShared = 0x02;      // file_chunk: of the content's shared stream
+constexpr uint8_t kAckRestart = 0x01;       // file_ack: restart the stream at offset
+constexpr uint8_t kAckHave = 0x02;          // file_ack: the receiver already has the content
+
+void put_u64(uint8_t* p, uint64_t v) {
+    for (int i = 7; i >= 0; --i) {
+        p[i] = static_cast<uint8_t>(v);
+        v >>= 8;
+    }
+}
+
+uint64_t get_u64(const uint8_t* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+std::string id_hex(const uint8_t* raw) {
+    char hex[kIdBytes * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), raw, kIdBytes);
+    return hex;
+}
+
+bool id_raw(const std::string& hex, uint8_t* raw) {
+    std::size_t len = 0;
+    return hex.size() == kIdBytes * 2 &&
+           sodium_hex2bin(raw, kIdBytes, hex.data(), hex.size(), nullptr, &len, nullptr) == 0 &&
+           len == kIdBytes;
+}
+
+/// `id | offset | flags`, with room for `extra` more bytes.
+std::string control_body(const std::string& id, uint64_t offset, uint8_t flags,
+                         std::size_t extra = 0) {
+    std::string body(kChunkHeadBytes + extra, '\0');
+    auto* p = reinterpret_cast<uint8_t*>(body.data());
+    id_raw(id, p);
+    put_u64(p + kIdBytes, offset);
+    p[kPrefixBytes] = flags;
+    return body;
+}
+
+std::string cancel_body(const std::string& id) {
+    std::string body(kIdBytes, '\0');
+    id_raw(id, reinterpret_cast<uint8_t*>(body.data()));
+    return body;
+}
+
+/// The offered name reduced to one harmless path component, made unique
+/// within `dir` with a " (n)" suffix.
+std::filesystem::path download_path(const std::filesystem::path& dir, std::string name) {
+    for (char& c : name) {
+        if (c == '/' || c == '\\' || c == ':' || static_cast<unsigned char>(c) < 0x20) {
+            c = '_';
+        }
+    }
+    if (name.empty() || name == "." || name == "..") {
+        name = "download";
+    }
+    const std::filesystem::path base(name);
+    std::filesystem::path candidate = dir / base;
+    std::error_code ec;
+    for (int n = 1; std::filesystem::exists(candidate, ec); ++n) {
+        candidate = dir / (base.stem().string() + " (" + std::to_string(n) + ")" +
+                           base.extension().string());
+    }
+    return candidate;
+}
+
+std::filesystem::path attachment_dir(const FileTransfers::Options& options) {
+    return options.attachment_dir.empty() ? options.download_dir / ".attachments"
+                                          : options.attachment_dir;
+}
+
+} // namespace
+
+// ─── Offer payload ───────────────────────────────────────────────────────────
+
+std::string FileTransfers::offer_payload(const Offer& offer) {
+    json j{{"transfer_id", offer.transfer_id},
+           {"name", offer.name},
+           {"size", offer.size},
+           {"chunk_size", offer.chunk_size},
+           {"key", base64::encode(std::span<const uint8_t>(offer.key))}};
+    if (offer.hash) {
+        j["hash"] = AttachmentStore::hex(*offer.hash);
+    }
+    return j.dump();
+}
+
+std::optional<FileTransfers::Offer> FileTransfers::parse_offer(std::string_view payload) {
+    const auto j = json::parse(payload, nullptr, false);
+    if (!j.is_object()) {
+        return std::nullopt;
+    }
+    Offer offer;
+    std::vector<uint8_t> key;
+    uint8_t raw_id[kIdBytes];
+    try {
+        offer.transfer_id = j.at("transfer_id").get<std::string>();
+        offer.name = j.at("name").get<std::string>();
+        offer.size = j.at("size").get<uint64_t>();
+        offer.chunk_size = j.at("chunk_size").get<std::size_t>();
+        if (!base64::decode(j.at("key").get<std::string>(), key)) {
+            return std::nullopt;
+        }
+        if (j.contains("hash")) {
+            offer.hash = AttachmentStore::parse(j.at("hash").get<std::string>());
+            if (!offer.hash) {
+                return std::nullopt;
+            }
+        }
+    } catch (const json::exception&) {
+        return std::nullopt;
+    }
+    if (!id_raw(offer.transfer_id, raw_id) || key.size() != offer.key.size() ||
+        offer.chunk_size == 0 || offer.chunk_size > kMaxChunkSize) {
+        return std::nullopt;
+    }
+    std::copy(key.begin(), key.end(), offer.key.begin());
+    sodium_memzero(key.data(), key.size());
+    return offer;
+}
+
+// ─── Lifetime ────────────────────────────────────────────────────────────────
+
+FileTransfers::FileTransfers(Options options, Transport transport, EventCallback on_event)
+    : options_(std::move(options)),
+      transport_(std::move(transport)),
+      on_event_(std::move(on_event)),
+      store_(attachment_dir(options_), options_.share_keep),
+      work_(asio::make_work_guard(io_)),
+      sweep_timer_(io_),
+      thread_([this] { io_.run(); }) {
+    options_.chunk_size = std::clamp<std::size_t>(options_.chunk_size, 1, kMaxChunkSize);
+    options_.window_chunks = std::max<std::size_t>(options_.window_chunks, 2);
+    asio::post(io_, [this] {
+        if (options_.content_addressed) {
+            store_.load();
+        }
+        arm_sweep();
+    });
+}
+
+FileTransfers::~FileTransfers() {
+    stop();
+    work_.reset();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void FileTransfers::stop() {
+    asio::post(io_, [this] {
+        stopped_ = true;
+        sweep_timer_.cancel();
+    });
+}
+
+template <typename Fn>
+auto FileTransfers::call(Fn fn) -> decltype(fn()) {
+    std::promise<decltype(fn())> result;
+    asio::post(io_, [&] { result.set_value(fn()); });
+    return result.get_future().get();
+}
+
+std::filesystem::path FileTransfers::part_path(const std::string& id) const {
+    return options_.download_dir / (id + ".part");
+}
+
+// ─── Sending ─────────────────────────────────────────────────────────────────
+
+std::optional<std::string> FileTransfers::send(const std::string& to,
+                                               const std::filesystem::path& path) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (ec || !std::filesystem::is_regular_file(path, ec)) {
+        spdlog::warn("send_file: {} is not a readable file", path.string());
+        return std::nullopt;
+    }
+
+    Offer offer;
+    uint8_t raw_id[kIdBytes];
+    randombytes_buf(raw_id, sizeof(raw_id));
+    offer.transfer_id = id_hex(raw_id);
+    offer.name = path.filename().string();
+    offer.size = size;
+    offer.chunk_size = options_.chunk_size;
+    crypto_secretstream_xchacha20poly1305_keygen(offer.key.data());
+    std::string id = offer.transfer_id;
+
+    asio::post(io_, [this, to, path, offer = std::move(offer)]() mutable {
+        Outgoing out;
+        if (!out.file.open(path, DiskFile::Mode::Read)) {
+            spdlog::warn("send_file: cannot open {}", path.string());
+            sodium_memzero(offer.key.data(), offer.key.size());
+            on_event_("file_done", json{{"transfer_id", offer.transfer_id}, {"peer", to},
+                                        {"direction", "sent"}, {"status", "failed"}});
+            return;
+        }
+        if (options_.content_addressed) {
+            // One read of the file up front; a recipient that has it, or a
+            // second recipient of it, saves every later one.
+            offer.hash = AttachmentStore::hash_file(out.file, offer.size, buffer_);
+            if (offer.hash && transport_.shares && transport_.shares(to)) {
+                out.shared = store_.share(*offer.hash, path, offer.size, offer.chunk_size);
+                if (out.shared) {
+                    offer.key = out.shared->key;
+                }
+            }
+        }
+        out.to = to;
+        out.offer = std::move(offer);
+        out.last_heard = Clock::now();
+        auto& o = outgoing_.emplace(out.offer.transfer_id, std::move(out)).first->second;
+        spdlog::info("Offering {} ({} bytes) to {}", o.offer.name, o.offer.size, to);
+        transport_.send_offer(to, o.offer);
+    });
+    return id;
+}
+
+void FileTransfers::restart(Outgoing& out, uint64_t offset) {
+    // A fresh header means a fresh nonce sequence, so restarting under the
+    // same key never reuses a nonce.
+    out.streaming = true;
+    out.final_sent = false;
+    out.header_due = true;
+    out.sent = out.acked = offset;
+    // The shared stream only ever starts at 0.
+    out.shared_stream = out.shared && offset == 0;
+}
+
+void FileTransfers::pump(Outgoing& out) {
+    watchdog::Tag busy("files.pump");
+    const uint64_t window = options_.window_chunks * out.offer.chunk_size;
+    while (out.streaming && !out.final_sent && out.sent - out.acked < window) {
+        const auto n = static_cast<std::size_t>(
+            std::min<uint64_t>(out.offer.chunk_size, out.offer.size - out.sent));
+        const bool final = out.sent + n == out.offer.size;
+        const std::size_t header = out.header_due ? kStreamHeaderBytes : 0;
+        const uint8_t flags = (out.header_due ? kChunkHasHeader : 0) |
+                              (out.shared_stream ? kChunkShared : 0);
+        std::string body = control_body(out.offer.transfer_id, out.sent, flags,
+                                        header + n + kSealBytes);
+        auto* p = reinterpret_cast<uint8_t*>(body.data());
+        bool read = true;
+        if (out.shared_stream) {
+            if (out.header_due) {
+                std::copy(out.shared->header.begin(), out.shared->header.end(),
+                          p + kChunkHeadBytes);
+            }
+            read = store_.sealed_chunk(*out.shared, out.sent,
+                                       {p + kChunkHeadBytes + header, n + kSealBytes}, buffer_);
+        } else {
+            if (buffer_.size() < n) {
+                buffer_.resize(n);
+            }
+            read = out.file.read_at(out.sent, {buffer_.data(), n});
+            if (read) {
+                if (out.header_due) {
+                    crypto_secretstream_xchacha20poly1305_init_push(
+                        &out.state, p + kChunkHeadBytes, out.offer.key.data());
+                }
+                crypto_secretstream_xchacha20poly1305_push(
+                    &out.state, p + kChunkHeadBytes + header, nullptr, buffer_.data(), n, p,
+                    kPrefixBytes,
+                    final ? crypto_secretstream_xchacha20poly1305_TAG_FINAL
+                          : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE);
+            }
+        }
+        if (!read) {
+            spdlog::error("send_file: {} changed while it was being sent", out.offer.name);
+            transport_.send(out.to, EnvelopeType::FileCancel, cancel_body(out.offer.transfer_id));
+            finish_outgoing(out.offer.transfer_id, "failed");
+            return;
+        }
+        out.header_due = false;
+        transport_.send(out.to, EnvelopeType::FileChunk, std::move(body));
+        out.sent += n;
+        out.final_sent = final;
+    }
+}
+
+void FileTransfers::on_ack(const std::string& from, std::vector<uint8_t> body) {
+    asio::post(io_, [this, from, body = std::move(body)] {
+        if (body.size() != kChunkHeadBytes) {
+            return;
+        }
+        const std::string id = id_hex(body.data());
+        auto it = outgoing_.find(id);
+        if (it == outgoing_.end() || it->second.to != from) {
+            return;
+        }
+        auto& out = it->second;
+        const uint64_t offset = get_u64(body.data() + kIdBytes);
+        if (offset > out.offer.size) {
+            return;
+        }
+        out.last_heard = Clock::now();
+        out.stalls = 0;
+
+        if ((body[kPrefixBytes] & kAckHave) && offset == out.offer.size) {
+            spdlog::info("{} already has {}", from, out.offer.name);
+            finish_outgoing(id, "completed");
+            return;
+        }
+        if (body[kPrefixBytes] & kAckRestart) {
+            spdlog::debug("{} asked for {} from offset {}", from, id, offset);
+            restart(out, offset);
+        } else if (!out.streaming || offset < out.acked || offset > out.sent) {
+            return;                     // stale: from before the last restart
+        } else {
+            out.acked = offset;
+            if (out.final_sent && offset == out.offer.size) {
+                spdlog::info("Sent {} to {}", out.offer.name, from);
+                finish_outgoing(id, "completed");
+                return;
+            }
+        }
+        pump(out);
+    });
+}
+
+void FileTransfers::finish_outgoing(const std::string& id, std::string_view status) {
+    auto it = outgoing_.find(id);
+    if (it == outgoing_.end()) {
+        return;
+    }
+    on_event_("file_done", json{{"transfer_id", id}, {"peer", it->second.to},
+                                {"direction", "sent"}, {"status", status}});
+    if (it->second.shared) {
+        store_.release(*it->second.shared);
+    }
+    sodium_memzero(it->second.offer.key.data(), it->second.offer.key.size());
+    sodium_memzero(&it->second.state, sizeof(it->second.state));
+    outgoing_.erase(it);
+}
+
+// ─── Receiving ───────────────────────────────────────────────────────────────
+
+void FileTransfers::on_offer(const std::string& from, Offer offer) {
+    asio::post(io_, [this, from, offer = std::move(offer)]() mutable {
+        if (auto it = incoming_.find(offer.transfer_id); it != incoming_.end()) {
+            // A repeated offer: the sender heard nothing from us for a
+            // while. Tell it again where to continue.
+            auto& in = it->second;
+            if (in.from == from) {
+                in.last_heard = Clock::now();
+                if (in.accepted) {
+                    send_ack(in, true);
+                }
+            }
+            sodium_memzero(offer.key.data(), offer.key.size());
+            return;
+        }
+
+        // A .part left by an earlier attempt resumes at its last whole
+        // chunk, and always re-fetches the final one so the stream can end.
+        uint64_t resume = 0;
+        std::error_code ec;
+        const auto part = std::filesystem::file_size(part_path(offer.transfer_id), ec);
+        if (!ec && offer.size > 0) {
+            resume = std::min<uint64_t>(part, offer.size - 1) / offer.chunk_size * offer.chunk_size;
+        }
+
+        spdlog::info("{} offers {} ({} bytes)", from, offer.name, offer.size);
+        const bool have = offer.hash && store_.find(*offer.hash, offer.size);
+        on_event_("file_offer", json{{"transfer_id", offer.transfer_id}, {"from", from},
+                                     {"name", offer.name}, {"size", offer.size},
+                                     {"resume_offset", resume}, {"have", have}});
+        Incoming in;
+        in.from = from;
+        in.offer = std::move(offer);
+        in.received = in.acked = resume;
+        in.last_heard = Clock::now();
+        incoming_.emplace(in.offer.transfer_id, std::move(in));
+    });
+}
+
+bool FileTransfers::accept(const std::string& transfer_id) {
+    return call([&] {
+        auto it = incoming_.find(transfer_id);
+        if (it == incoming_.end() || it->second.accepted) {
+            return false;
+        }
+        auto& in = it->second;
+        if (in.offer.hash) {
+            if (auto have = store_.find(*in.offer.hash, in.offer.size)) {
+                spdlog::info("Already have {} from {} as {}", in.offer.name, in.from,
+                             have->string());
+                transport_.send(in.from, EnvelopeType::FileAck,
+                                control_body(transfer_id, in.offer.size, kAckHave));
+                on_event_("file_done", json{{"transfer_id", transfer_id}, {"peer", in.from},
+                                            {"direction", "received"}, {"status", "completed"},
+                                            {"path", have->string()}});
+                sodium_memzero(in.offer.key.data(), in.offer.key.size());
+                incoming_.erase(it);
+                return true;
+            }
+        }
+        const auto path = part_path(transfer_id);
+        std::error_code ec;
+        std::filesystem::create_directories(options_.download_dir, ec);
+        if (std::filesystem::exists(path, ec)) {
+            std::filesystem::resize_file(path, in.received, ec);
+        } else {
+            in.received = in.acked = 0;
+        }
+        if (ec || !in.file.open(path, DiskFile::Mode::ReadWrite)) {
+            spdlog::error("Cannot write {}", path.string());
+            return false;
+        }
+        if (in.offer.hash && !hash_part(in)) {
+            in.received = in.acked = 0;         // unreadable: start over
+            crypto_generichash_init(&in.digest, nullptr, 0, crypto_generichash_BYTES);
+        }
+        in.accepted = true;
+        in.last_heard = Clock::now();
+        send_ack(in, true);
+        return true;
+    });
+}
+
+void FileTransfers::send_ack(Incoming& in, bool restart) {
+    in.acked = in.received;
+    if (restart) {
+        in.streaming = false;
+    }
+    transport_.send(in.from, EnvelopeType::FileAck,
+                    control_body(in.offer.transfer_id, in.received, restart ? kAckRestart : 0));
+}
+
+bool FileTransfers::hash_part(Incoming& in) {
+    crypto_generichash_init(&in.digest, nullptr, 0, crypto_generichash_BYTES);
+    if (buffer_.size() < in.offer.chunk_size) {
+        buffer_.resize(in.offer.chunk_size);
+    }
+    for (uint64_t offset = 0; offset < in.received;) {
+        const auto n = static_cast<std::size_t>(
+            std::min<uint64_t>(in.offer.chunk_size, in.received - offset));
+        if (!in.file.read_at(offset, {buffer_.data(), n})) {
+            return false;
+        }
+        crypto_generichash_update(&in.digest, buffer_.data(), n);
+        offset += n;
+    }
+    return true;
+}
+
+void FileTransfers::on_chunk(const std::string& from, std::vector<uint8_t> body) {
+    asio::post(io_, [this, from, body = std::move(body)] {
+        watchdog::Tag busy("files.on_chunk");
+        if (body.size() < kChunkHeadBytes) {
+            return;
+        }
+        const std::string id = id_hex(body.data());
+        auto it = incoming_.find(id);
+        if (it == incoming_.end() || it->second.from != from || !it->second.accepted) {
+            return;
+        }
+        auto& in = it->second;
+        const uint64_t offset = get_u64(body.data() + kIdBytes);
+        const bool shared = body[kPrefixBytes] & kChunkShared;
+        std::size_t pos = kChunkHeadBytes;
+        if (shared && !in.offer.hash) {
+            return;
+        }
+
+        // Chunks of an abandoned stream are skipped until the restarted
+        // one's header arrives at the offset we asked for.
+        if (body[kPrefixBytes] & kChunkHasHeader) {
+            if (body.size() < pos + kStreamHeaderBytes || offset != in.received ||
+                crypto_secretstream_xchacha20poly1305_init_pull(&in.state, body.data() + pos,
+                                                                in.offer.key.data()) != 0) {
+                return;
+            }
+            in.streaming = true;
+            in.shared_stream = shared;
+            pos += kStreamHeaderBytes;
+        } else if (!in.streaming || offset != in.received || shared != in.shared_stream) {
+            return;
+        }
+        uint8_t shared_ad[kPrefixBytes];
+        if (shared) {
+            AttachmentStore::additional_data(*in.offer.hash, offset, shared_ad);
+        }
+
+        const std::size_t sealed = body.size() - pos;
+        if (buffer_.size() < in.offer.chunk_size) {
+            buffer_.resize(in.offer.chunk_size);
+        }
+        unsigned long long n = 0;
+        unsigned char tag = 0;
+        if (sealed < kSealBytes || sealed - kSealBytes > in.offer.chunk_size ||
+            crypto_secretstream_xchacha20poly1305_pull(&in.state, buffer_.data(), &n, &tag,
+                                                       body.data() + pos, sealed,
+                                                       shared ? shared_ad : body.data(),
+                                                       kPrefixBytes) != 0) {
+            spdlog::warn("Chunk of {} from {} did not open; restarting at {}", id, from,
+                         in.received);
+            send_ack(in, true);
+            return;
+        }
+
+        const bool final = tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+        const uint64_t end = offset + n;
+        if (end > in.offer.size || (final ? end != in.offer.size : n != in.offer.chunk_size)) {
+            spdlog::warn("{} sent a chunk of {} that doesn't match its offer", from, id);
+            transport_.send(from, EnvelopeType::FileCancel, cancel_body(id));
+            finish_incoming(id, "failed", false);
+            return;
+        }
+        if (!in.file.write_at(offset, {buffer_.data(), static_cast<std::size_t>(n)})) {
+            spdlog::error("Writing {} failed", part_path(id).string());
+            transport_.send(from, EnvelopeType::FileCancel, cancel_body(id));
+            finish_incoming(id, "failed", true);
+            return;
+        }
+        if (in.offer.hash) {
+            crypto_generichash_update(&in.digest, buffer_.data(), n);
+        }
+        in.received = end;
+        in.last_heard = Clock::now();
+
+        if (final) {
+            complete(in);
+        } else if (in.received - in.acked >= options_.window_chunks / 2 * in.offer.chunk_size) {
+            send_ack(in, false);
+        }
+    });
+}
+
+void FileTransfers::complete(Incoming& in) {
+    const std::string id = in.offer.transfer_id;
+    in.file.close();
+    if (in.offer.hash) {
+        AttachmentStore::Hash got;
+        crypto_generichash_final(&in.digest, got.data(), got.size());
+        if (sodium_memcmp(got.data(), in.offer.hash->data(), got.size()) != 0) {
+            spdlog::warn("{} from {} doesn't match its hash", in.offer.name, in.from);
+            transport_.send(in.from, EnvelopeType::FileCancel, cancel_body(id));
+            finish_incoming(id, "failed", false);
+            return;
+        }
+    }
+    send_ack(in, false);
+
+    const auto target = download_path(options_.download_dir, in.offer.name);
+    std::error_code ec;
+    std::filesystem::rename(part_path(id), target, ec);
+    if (ec) {
+        spdlog::error("Cannot move {} to {}: {}", part_path(id).string(), target.string(),
+                      ec.message());
+        finish_incoming(id, "failed", true);
+        return;
+    }
+    spdlog::info("Received {} from {}", target.string(), in.from);
+    if (in.offer.hash && options_.content_addressed) {
+        store_.remember(*in.offer.hash, in.offer.size, target);
+    }
+    on_event_("file_done", json{{"transfer_id", id}, {"peer", in.from}, {"direction", "received"},
+                                {"status", "completed"}, {"path", target.string()}});
+    sodium_memzero(in.offer.key.data(), in.offer.key.size());
+    sodium_memzero(&in.state, sizeof(in.state));
+    incoming_.erase(id);
+}
+
+void FileTransfers::finish_incoming(const std::string& id, std::string_view status,
+                                    bool keep_part) {
+    auto it = incoming_.find(id);
+    if (it == incoming_.end()) {
+        return;
+    }
+    auto& in = it->second;
+    in.file.close();
+    if (!keep_part) {
+        std::error_code ec;
+        std::filesystem::remove(part_path(id), ec);
+    }
+    on_event_("file_done", json{{"transfer_id", id}, {"peer", in.from},
+                                {"direction", "received"}, {"status", status}});
+    sodium_memzero(in.offer.key.data(), in.offer.key.size());
+    sodium_memzero(&in.state, sizeof(in.state));
+    incoming_.erase(it);
+}
+
+// ─── Cancelling ──────────────────────────────────────────────────────────────
+
+bool FileTransfers::cancel(const std::string& transfer_id) {
+    return call([&] {
+        if (auto it = outgoing_.find(transfer_id); it != outgoing_.end()) {
+            transport_.send(it->second.to, EnvelopeType::FileCancel, cancel_body(transfer_id));
+            finish_outgoing(transfer_id, "cancelled");
+            return true;
+        }
+        if (auto it = incoming_.find(transfer_id); it != incoming_.end()) {
+            transport_.send(it->second.from, EnvelopeType::FileCancel, cancel_body(transfer_id));
+            finish_incoming(transfer_id, "cancelled", false);
+            return true;
+        }
+        return false;
+    });
+}
+
+void FileTransfers::on_cancel(const std::string& from, std::vector<uint8_t> body) {
+    asio::post(io_, [this, from, body = std::move(body)] {
+        if (body.size() != kIdBytes) {
+            return;
+        }
+        const std::string id = id_hex(body.data());
+        if (auto it = outgoing_.find(id); it != outgoing_.end() && it->second.to == from) {
+            spdlog::info("{} cancelled {}", from, it->second.offer.name);
+            if (it->second.shared_stream) {
+                // Maybe its hash check failed: hand the stream out no more.
+                it->second.shared->failed = true;
+            }
+            finish_outgoing(id, "cancelled");
+        } else if (auto in = incoming_.find(id); in != incoming_.end() && in->second.from == from) {
+            spdlog::info("{} cancelled {}", from, in->second.offer.name);
+            finish_incoming(id, "cancelled", false);
+        }
+    });
+}
+
+// ─── Stalls ──────────────────────────────────────────────────────────────────
+
+void FileTransfers::arm_sweep() {
+    if (stopped_) {
+        return;
+    }
+    sweep_timer_.expires_after(options_.stall_timeout);
+    sweep_timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            sweep();
+            arm_sweep();
+        }
+    });
+}
+
+void FileTransfers::sweep() {
+    const auto now = Clock::now();
+    std::vector<std::string> failed;
+    for (auto& [id, out] : outgoing_) {
+        if (now - out.last_heard < options_.stall_timeout) {
+            continue;
+        }
+        if (++out.stalls > options_.max_stalls) {
+            failed.push_back(id);
+            continue;
+        }
+        // Lost chunks, a lost ack or a receiver that restarted: the offer
+        // brings back an ack with a restart either way.
+        out.last_heard = now;
+        transport_.send_offer(out.to, out.offer);
+    }
+    for (const auto& id : failed) {
+        spdlog::warn("{} stopped answering; giving up on {}", outgoing_.at(id).to, id);
+        transport_.send(outgoing_.at(id).to, EnvelopeType::FileCancel, cancel_body(id));
+        finish_outgoing(id, "failed");
+    }
+
+    // The sender repeats its offer while it is alive, so an incoming
+    // transfer this quiet has been abandoned; its .part stays for a resume.
+    failed.clear();
+    const auto abandon = options_.stall_timeout * (options_.max_stalls + 1);
+    for (const auto& [id, in] : incoming_) {
+        if (now - in.last_heard >= abandon) {
+            failed.push_back(id);
+        }
+    }
+    for (const auto& id : failed) {
+        finish_incoming(id, "failed", true);
+    }
+    store_.sweep(now);
+}
@@ -0,0 +1,64 @@
+/**
+ * FriendKeys — sorted fixed-width key table behind PeerDirectory.
+ */
+
+#include "node/friend_keys.h"
+
+#include <algorithm>
+#include <numeric>
+
+bool FriendKeys::add(std::string_view username, std::span<const uint8_t> public_key,
+                     std::span<const uint8_t> signing_key) {
+    Keys keys;
+    if (public_key.size() != keys.public_key.size() ||
+        signing_key.size() != keys.signing_key.size()) {
+        return false;
+    }
+    std::copy(public_key.begin(), public_key.end(), keys.public_key.begin());
+    std::copy(signing_key.begin(), signing_key.end(), keys.signing_key.begin());
+    hashes_.push_back(hash(username));
+    keys_.push_back(keys);
+    usernames_.emplace_back(username);
+    return true;
+}
+
+void FriendKeys::sort() {
+    std::vector<std::size_t> order(hashes_.size());
+    std::iota(order.begin(), order.end(), std::size_t{0});
+    std::ranges::sort(order, {}, [this](std::size_t i) { return hashes_[i]; });
+
+    std::vector<uint64_t> hashes;
+    std::vector<Keys> keys;
+    std::vector<std::string> usernames;
+    hashes.reserve(order.size());
+    keys.reserve(order.size());
+    usernames.reserve(order.size());
+    for (const std::size_t i : order) {
+        hashes.push_back(hashes_[i]);
+        keys.push_back(keys_[i]);
+        usernames.push_back(std::move(usernames_[i]));
+    }
+    hashes_ = std::move(hashes);
+    keys_ = std::move(keys);
+    usernames_ = std::move(usernames);
+}
+
+const FriendKeys::Keys* FriendKeys::find(std::string_view username) const {
+    const uint64_t h = hash(username);
+    auto it = std::lower_bound(hashes_.begin(), hashes_.end(), h);
+    for (; it != hashes_.end() && *it == h; ++it) {
+        const auto i = static_cast<std::size_t>(it - hashes_.begin());
+        if (usernames_[i] == username) {
+            return &keys_[i];
+        }
+    }
+    return nullptr;
+}
+
+uint64_t FriendKeys::hash(std::string_view username) {
+    uint64_t h = 0xcbf29ce484222325ULL;         // FNV-1a
+    for (unsigned char c : username) {
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    return h;
+}
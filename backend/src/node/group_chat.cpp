@@ -0,0 +1,309 @@
+/**
+ * GroupChat — group membership and sender keys.
+ */
+
+#include "node/group_chat.h"
+#include "crypto/base64.h"
+#include "crypto/nonce_source.h"
+
+#include <algorithm>
+
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr std::size_t kIdBytes = 16;          // group ids are 32 hex characters
+
+std::string new_group_id() {
+    uint8_t raw[kIdBytes];
+    randombytes_buf(raw, sizeof(raw));
+    char hex[kIdBytes * 2 + 1];
+    sodium_bin2hex(hex, sizeof(hex), raw, sizeof(raw));
+    return hex;
+}
+
+bool valid_group_id(const std::string& id) {
+    return id.size() == kIdBytes * 2 &&
+           std::all_of(id.begin(), id.end(), [](char c) {
+               return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+           });
+}
+
+/// Sort and de-duplicate, so member lists compare equal.
+void normalize_members(std::vector<std::string>& members) {
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+    std::erase(members, std::string());
+}
+
+} // namespace
+
+// ─── Grant payload ───────────────────────────────────────────────────────────
+
+std::string GroupChat::grant_payload(const Grant& grant) {
+    return json{{"group_id", grant.group.group_id},
+                {"name", grant.group.name},
+                {"created_by", grant.group.created_by},
+                {"members", grant.group.members},
+                {"key", base64::encode(std::span<const uint8_t>(grant.key))}}.dump();
+}
+
+std::optional<GroupChat::Grant> GroupChat::parse_grant(std::string_view payload) {
+    const auto j = json::parse(payload, nullptr, false);
+    if (!j.is_object()) {
+        return std::nullopt;
+    }
+    Grant grant;
+    std::vector<uint8_t> key;
+    try {
+        grant.group.group_id = j.at("group_id").get<std::string>();
+        grant.group.name = j.at("name").get<std::string>();
+        grant.group.created_by = j.at("created_by").get<std::string>();
+        grant.group.members = j.at("members").get<std::vector<std::string>>();
+        if (!base64::decode(j.at("key").get<std::string>(), key)) {
+            return std::nullopt;
+        }
+    } catch (const json::exception&) {
+        return std::nullopt;
+    }
+    if (!valid_group_id(grant.group.group_id) || key.size() != grant.key.size() ||
+        grant.group.members.size() > kMaxMembers ||
+        !is_member(grant.group, grant.group.created_by)) {
+        sodium_memzero(key.data(), key.size());
+        return std::nullopt;
+    }
+    std::copy(key.begin(), key.end(), grant.key.begin());
+    sodium_memzero(key.data(), key.size());
+    return grant;
+}
+
+// ─── Lifetime ────────────────────────────────────────────────────────────────
+
+GroupChat::GroupChat(MessageStore& store, std::string self)
+    : store_(store), self_(std::move(self)) {}
+
+GroupChat::~GroupChat() {
+    for (auto& [id, key] : keys_) {
+        sodium_memzero(key.data(), key.size());
+    }
+}
+
+void GroupChat::load() {
+    auto groups = store_.load_groups();
+    auto keys = store_.load_sender_keys();
+    std::lock_guard lock(mutex_);
+    for (auto& g : groups) {
+        std::string id = g.group_id;
+        groups_.insert_or_assign(std::move(id), std::move(g));
+    }
+    for (auto& k : keys) {
+        if (k.key.size() == crypto_secretbox_KEYBYTES) {
+            Key& slot = keys_[{k.group_id, k.sender}];
+            std::copy(k.key.begin(), k.key.end(), slot.begin());
+        }
+        sodium_memzero(k.key.data(), k.key.size());
+    }
+    if (!groups_.empty()) {
+        spdlog::info("Loaded {} group(s)", groups_.size());
+    }
+}
+
+// ─── Membership ──────────────────────────────────────────────────────────────
+
+bool GroupChat::is_member(const Group& group, const std::string& username) {
+    return std::find(group.members.begin(), group.members.end(), username) != group.members.end();
+}
+
+GroupChat::Group GroupChat::create(std::string name, std::vector<std::string> members) {
+    Group group{new_group_id(), std::move(name), self_, std::move(members), {}};
+    group.members.push_back(self_);
+    normalize_members(group.members);
+    {
+        std::lock_guard lock(mutex_);
+        groups_[group.group_id] = group;
+    }
+    store_.upsert_group(group, [id = group.group_id](bool ok) {
+        if (!ok) {
+            spdlog::error("Could not store group {}", id);
+        }
+    });
+    return group;
+}
+
+std::optional<GroupChat::Group> GroupChat::find(const std::string& group_id) const {
+    std::lock_guard lock(mutex_);
+    auto it = groups_.find(group_id);
+    if (it == groups_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+std::vector<GroupChat::Group> GroupChat::list() const {
+    std::lock_guard lock(mutex_);
+    std::vector<Group> out;
+    out.reserve(groups_.size());
+    for (const auto& [id, group] : groups_) {
+        out.push_back(group);
+    }
+    std::sort(out.begin(), out.end(),
+              [](const Group& a, const Group& b) { return a.name < b.name; });
+    return out;
+}
+
+bool GroupChat::accept_grant(const std::string& from, Grant grant, bool& joined) {
+    joined = false;
+    Group& incoming = grant.group;
+    normalize_members(incoming.members);
+    if (!is_member(incoming, self_) || !is_member(incoming, from)) {
+        spdlog::warn("Ignoring key for group {} from {}: membership doesn't include us both",
+                     incoming.group_id, from);
+        return false;
+    }
+
+    std::optional<Group> changed;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = groups_.find(incoming.group_id);
+        if (it == groups_.end()) {
+            joined = true;
+            changed = incoming;
+            groups_.emplace(incoming.group_id, incoming);
+        } else if (from == it->second.created_by) {
+            if (it->second.name != incoming.name || it->second.members != incoming.members) {
+                it->second.name = incoming.name;
+                it->second.members = incoming.members;
+                changed = it->second;
+                // Anyone removed may still hold our key; make a new one.
+                keys_.erase({incoming.group_id, self_});
+                granted_.erase(incoming.group_id);
+            }
+        } else if (!is_member(it->second, from)) {
+            spdlog::warn("Ignoring key for group {} from {}: not a member", incoming.group_id, from);
+            return false;
+        }
+        keys_[{incoming.group_id, from}] = grant.key;
+    }
+    if (changed) {
+        store_.upsert_group(std::move(*changed));
+    }
+    store_key(incoming.group_id, from, grant.key);
+    sodium_memzero(grant.key.data(), grant.key.size());
+    return true;
+}
+
+// ─── Keys ────────────────────────────────────────────────────────────────────
+
+void GroupChat::store_key(const std::string& group_id, const std::string& sender, const Key& key) {
+    store_.set_sender_key({group_id, sender, std::vector<uint8_t>(key.begin(), key.end())},
+                          [group_id, sender](bool ok) {
+        if (!ok) {
+            spdlog::error("Could not store {}'s key for group {}", sender, group_id);
+        }
+    });
+}
+
+bool GroupChat::own_key(const std::string& group_id, Key& out) {
+    bool fresh = false;
+    {
+        std::lock_guard lock(mutex_);
+        auto group = groups_.find(group_id);
+        if (group == groups_.end() || !is_member(group->second, self_)) {
+            return false;
+        }
+        auto [it, inserted] = keys_.try_emplace({group_id, self_});
+        if (inserted) {
+            crypto_secretbox_keygen(it->second.data());
+            granted_.erase(group_id);
+            fresh = true;
+        }
+        out = it->second;
+    }
+    if (fresh) {
+        store_key(group_id, self_, out);
+    }
+    return true;
+}
+
+std::string GroupChat::seal(const std::string& group_id, std::string_view plaintext) {
+    Key key;
+    if (!own_key(group_id, key)) {
+        return {};
+    }
+    std::string out(crypto_secretbox_NONCEBYTES + crypto_secretbox_MACBYTES + plaintext.size(), '\0');
+    auto* p = reinterpret_cast<uint8_t*>(out.data());
+    nonce_source::fill(p, crypto_secretbox_NONCEBYTES);
+    crypto_secretbox_easy(p + crypto_secretbox_NONCEBYTES,
+                          reinterpret_cast<const uint8_t*>(plaintext.data()), plaintext.size(),
+                          p, key.data());
+    sodium_memzero(key.data(), key.size());
+    return out;
+}
+
+std::optional<GroupChat::Grant> GroupChat::own_grant(const std::string& group_id) {
+    Grant grant;
+    if (!own_key(group_id, grant.key)) {
+        return std::nullopt;
+    }
+    auto group = find(group_id);
+    if (!group) {
+        sodium_memzero(grant.key.data(), grant.key.size());
+        return std::nullopt;
+    }
+    grant.group = std::move(*group);
+    grant.group.created_at.clear();
+    return grant;
+}
+
+std::vector<std::string> GroupChat::take_ungranted(const std::string& group_id) {
+    std::lock_guard lock(mutex_);
+    auto group = groups_.find(group_id);
+    if (group == groups_.end()) {
+        return {};
+    }
+    auto& granted = granted_[group_id];
+    std::vector<std::string> out;
+    for (const auto& member : group->second.members) {
+        if (member != self_ && granted.insert(member).second) {
+            out.push_back(member);
+        }
+    }
+    return out;
+}
+
+void GroupChat::grant_failed(const std::string& group_id, const std::string& member) {
+    std::lock_guard lock(mutex_);
+    if (auto it = granted_.find(group_id); it != granted_.end()) {
+        it->second.erase(member);
+    }
+}
+
+std::optional<std::string> GroupChat::open(const std::string& group_id, const std::string& from,
+                                           std::span<const uint8_t> nonce,
+                                           std::span<const uint8_t> ciphertext) const {
+    if (nonce.size() != crypto_secretbox_NONCEBYTES ||
+        ciphertext.size() < crypto_secretbox_MACBYTES) {
+        return std::nullopt;
+    }
+    Key key;
+    {
+        std::lock_guard lock(mutex_);
+        auto it = keys_.find({group_id, from});
+        if (it == keys_.end()) {
+            return std::nullopt;
+        }
+        key = it->second;
+    }
+    std::string plaintext(ciphertext.size() - crypto_secretbox_MACBYTES, '\0');
+    const int rc = crypto_secretbox_open_easy(reinterpret_cast<uint8_t*>(plaintext.data()),
+                                              ciphertext.data(), ciphertext.size(),
+                                              nonce.data(), key.data());
+    sodium_memzero(key.data(), key.size());
+    if (rc != 0) {
+        return std::nullopt;
+    }
+    return plaintext;
+}
@@ -0,0 +1,72 @@
+/**
+ * HeartbeatSchedule — the Supabase heartbeat, sent only when it tells
+ * someone something.
+ *
+ * With the defaults (60 s / 240 s) an idle node on a stable address sends
+ * after 60, 120 and then every 240 s, a quarter of the fixed-rate traffic.
+ * An address change is caught at the latest by the next check, and at once
+ * where the platform reports interface changes (network/network_watcher.h).
+ */
+
+#include "node/heartbeat_schedule.h"
+
+#include <algorithm>
+
+HeartbeatSchedule::HeartbeatSchedule(Options options) {
+    set_options(options);
+}
+
+void HeartbeatSchedule::set_options(Options options) {
+    std::lock_guard lock(mutex_);
+    options.interval = std::max(options.interval, std::chrono::seconds(1));
+    options.max_interval = std::max(options.max_interval, options.interval);
+    options_ = options;
+    if (delay_ != std::chrono::seconds(0)) {
+        delay_ = std::clamp(delay_, options_.interval, options_.max_interval);
+    }
+}
+
+void HeartbeatSchedule::reached(Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    last_reached_ = now;
+}
+
+void HeartbeatSchedule::network_changed() {
+    std::lock_guard lock(mutex_);
+    force_ = true;
+}
+
+bool HeartbeatSchedule::due(const std::string& address, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    const auto since = now - last_sent_;
+    bool send = force_ || address != address_ || since >= options_.max_interval;
+    if (!send && since >= delay_) {
+        // Peers dialling us since the last heartbeat prove the address
+        // works; wait for a quiet check (max_interval still applies).
+        send = !(last_reached_ > last_sent_ && now - last_reached_ < options_.interval);
+    }
+    if (send) {
+        force_ = false;
+        sending_ = address;
+        last_sent_ = now;
+    }
+    return send;
+}
+
+void HeartbeatSchedule::sent(bool ok) {
+    std::lock_guard lock(mutex_);
+    if (!ok) {
+        force_ = true;                        // retry at the next check
+        delay_ = options_.interval;
+        return;
+    }
+    delay_ = sending_ == address_ ? std::min(delay_ * 2, options_.max_interval)
+                                  : options_.interval;
+    delay_ = std::max(delay_, options_.interval);
+    address_ = std::move(sending_);
+}
+
+std::chrono::seconds HeartbeatSchedule::delay() const {
+    std::lock_guard lock(mutex_);
+    return std::max(delay_, options_.interval);
+}
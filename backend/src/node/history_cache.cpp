@@ -0,0 +1,130 @@
+/**
+ * HistoryCache — serialized newest history pages, LRU over conversations.
+ */
+
+#include "node/history_cache.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+metrics::Counter& cache_hits =
+    metrics::counter("p2p_history_cache_hits_total", "GET /messages answered from the page cache");
+metrics::Counter& cache_misses =
+    metrics::counter("p2p_history_cache_misses_total",
+                     "Newest-page GET /messages that had to read the store");
+metrics::Gauge& cache_bytes =
+    metrics::gauge("p2p_history_cache_bytes", "Serialized history pages held in the page cache");
+
+} // namespace
+
+HistoryCache::HistoryCache(std::size_t max_bytes)
+    : max_bytes_(max_bytes),
+      reclaimer_(memory::Area::History, [this](std::size_t bytes) {
+          std::lock_guard lock(mutex_);
+          shrink_locked(bytes);
+          account_locked();
+      }) {}
+
+HistoryCache::~HistoryCache() {
+    memory::charge(memory::Area::History, -static_cast<int64_t>(charged_));
+}
+
+void HistoryCache::set_max_bytes(std::size_t max_bytes) {
+    std::lock_guard lock(mutex_);
+    max_bytes_ = max_bytes;
+    evict_locked();
+}
+
+std::size_t HistoryCache::slot(const std::string& peer) const {
+    return std::hash<std::string>{}(peer) % kSlots;
+}
+
+HistoryCache::Body HistoryCache::get(const std::string& peer, std::size_t limit) {
+    std::lock_guard lock(mutex_);
+    auto it = entries_.find(peer);
+    if (it == entries_.end()) {
+        cache_misses.inc();
+        return nullptr;
+    }
+    auto page = it->second.pages.find(limit);
+    if (page == it->second.pages.end()) {
+        cache_misses.inc();
+        return nullptr;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    cache_hits.inc();
+    return page->second;
+}
+
+uint64_t HistoryCache::ticket(const std::string& peer) const {
+    std::lock_guard lock(mutex_);
+    return changes_[slot(peer)];
+}
+
+void HistoryCache::put(const std::string& peer, std::size_t limit, Body body, uint64_t ticket) {
+    std::lock_guard lock(mutex_);
+    if (!body || body->size() > max_bytes_ || changes_[slot(peer)] != ticket) {
+        return;
+    }
+    auto it = entries_.find(peer);
+    if (it == entries_.end()) {
+        lru_.push_front(peer);
+        it = entries_.emplace(peer, Entry{{}, 0, lru_.begin()}).first;
+    } else {
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+    }
+    auto& entry = it->second;
+    auto& page = entry.pages[limit];
+    if (page) {
+        entry.bytes -= page->size();
+        bytes_ -= page->size();
+    }
+    page = std::move(body);
+    entry.bytes += page->size();
+    bytes_ += page->size();
+    evict_locked();
+}
+
+void HistoryCache::invalidate(const std::string& peer) {
+    std::lock_guard lock(mutex_);
+    ++changes_[slot(peer)];
+    if (auto it = entries_.find(peer); it != entries_.end()) {
+        erase_locked(it);
+        account_locked();
+    }
+}
+
+std::size_t HistoryCache::bytes() const {
+    std::lock_guard lock(mutex_);
+    return bytes_;
+}
+
+void HistoryCache::erase_locked(std::unordered_map<std::string, Entry>::iterator it) {
+    bytes_ -= it->second.bytes;
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
+
+void HistoryCache::shrink_locked(std::size_t bytes) {
+    const std::size_t target = bytes_ > bytes ? bytes_ - bytes : 0;
+    while (bytes_ > target && !lru_.empty()) {
+        erase_locked(entries_.find(lru_.back()));
+    }
+}
+
+void HistoryCache::evict_locked() {
+    account_locked();
+    shrink_locked(std::max(bytes_ > max_bytes_ ? bytes_ - max_bytes_ : 0,
+                           memory::excess(memory::Area::History)));
+    account_locked();
+}
+
+void HistoryCache::account_locked() {
+    memory::charge(memory::Area::History,
+                   static_cast<int64_t>(bytes_) - static_cast<int64_t>(charged_));
+    charged_ = bytes_;
+    cache_bytes.set(static_cast<int64_t>(bytes_));
+}
@@ -0,0 +1,99 @@
+/**
+ * LatencySlo — per-stage latency of direct messages from our clock and the
+ * peer's hold time in their ack.
+ */
+
+#include "node/latency_slo.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+
+namespace {
+
+metrics::Histogram& e2e_seconds =
+    metrics::histogram("p2p_e2e_latency_seconds",
+                       "Direct message from send_message to the peer's UI, one way (estimated)");
+metrics::Histogram& seal_seconds =
+    metrics::histogram("p2p_e2e_seal_seconds",
+                       "Direct message from send_message to its frame handed to the transport");
+metrics::Histogram& network_seconds =
+    metrics::histogram("p2p_e2e_network_seconds",
+                       "Direct message round trip to its ack, less the time the peer held it");
+metrics::Histogram& peer_seconds =
+    metrics::histogram("p2p_e2e_peer_seconds",
+                       "Direct message from its frame reaching the peer to the peer storing it");
+metrics::Counter& measured =
+    metrics::counter("p2p_e2e_slo_messages_total",
+                     "Direct messages whose end-to-end latency was measured");
+metrics::Counter& breaches =
+    metrics::counter("p2p_e2e_slo_breaches_total",
+                     "Measured direct messages slower end to end than the latency objective");
+metrics::Counter& seal_over =
+    metrics::counter("p2p_e2e_seal_over_budget_total", "Measured messages over the seal budget");
+metrics::Counter& network_over =
+    metrics::counter("p2p_e2e_network_over_budget_total",
+                     "Measured messages over the network budget");
+metrics::Counter& peer_over =
+    metrics::counter("p2p_e2e_peer_over_budget_total", "Measured messages over the peer budget");
+
+} // namespace
+
+LatencySlo::LatencySlo(Options options) : options_(options) {}
+
+void LatencySlo::sent(const std::string& msg_id, Clock::time_point enqueued,
+                      Clock::time_point wire) {
+    std::lock_guard lock(mutex_);
+    expire_locked(wire);
+    if (pending_.try_emplace(msg_id, Sent{enqueued, wire}).second) {
+        order_.emplace_back(wire, msg_id);
+    }
+}
+
+bool LatencySlo::acked(const std::string& msg_id, Clock::duration held, Clock::time_point acked) {
+    Sent sent;
+    {
+        std::lock_guard lock(mutex_);
+        const auto it = pending_.find(msg_id);
+        if (it == pending_.end()) {
+            return false;
+        }
+        sent = it->second;
+        pending_.erase(it);             // its order_ entry goes when it reaches the front
+    }
+    const auto seal = sent.wire - sent.enqueued;
+    const auto peer = std::clamp<Clock::duration>(held, Clock::duration::zero(), acked - sent.wire);
+    const auto network = acked - sent.wire - peer;
+    const auto e2e = seal + network / 2 + peer;
+
+    seal_seconds.record(seal);
+    network_seconds.record(network);
+    peer_seconds.record(peer);
+    e2e_seconds.record(e2e);
+    measured.inc();
+    if (e2e > options_.objective) {
+        breaches.inc();
+    }
+    if (seal > options_.seal_budget) {
+        seal_over.inc();
+    }
+    if (network > options_.network_budget) {
+        network_over.inc();
+    }
+    if (peer > options_.peer_budget) {
+        peer_over.inc();
+    }
+    return true;
+}
+
+void LatencySlo::expire_locked(Clock::time_point now) {
+    while (!order_.empty() &&
+           (now - order_.front().first > options_.max_age || order_.size() > options_.max_pending)) {
+        // An entry acked since, or sent() again under the same id later,
+        // is not the one this refers to.
+        const auto it = pending_.find(order_.front().second);
+        if (it != pending_.end() && it->second.wire == order_.front().first) {
+            pending_.erase(it);
+        }
+        order_.pop_front();
+    }
+}
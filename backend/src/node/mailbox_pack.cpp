@@ -0,0 +1,108 @@
+/**
+ * mailbox_pack — many offline envelopes for one recipient in one row.
+ *
+ *   base64 of:  u8 flags (bit 0 = zstd), then, zstd-compressed if flagged,
+ *               repeated { u32 length (big-endian), binary envelope }
+ */
+
+#include "node/mailbox_pack.h"
+#include "crypto/base64.h"
+#include "network/compression.h"
+
+#include <cstdio>
+
+#include <sodium.h>
+
+namespace mailbox_pack {
+namespace {
+
+constexpr uint8_t kZstd = 0x01;
+
+void put_u32(std::string& out, uint32_t v) {
+    const char bytes[] = {static_cast<char>(v >> 24), static_cast<char>(v >> 16),
+                          static_cast<char>(v >> 8), static_cast<char>(v)};
+    out.append(bytes, sizeof(bytes));
+}
+
+uint32_t get_u32(std::string_view in) {
+    const auto* p = reinterpret_cast<const uint8_t*>(in.data());
+    return uint32_t{p[0]} << 24 | uint32_t{p[1]} << 16 | uint32_t{p[2]} << 8 | p[3];
+}
+
+} // namespace
+
+std::optional<std::string> pack(std::span<const std::string> rows) {
+    std::string body;
+    std::string raw;
+    for (const auto& row : rows) {
+        auto env = base64::decode(row, raw) ? envelope::decode(raw) : std::nullopt;
+        if (!env) {
+            return std::nullopt;
+        }
+        const std::string binary = envelope::encode_binary(*env);
+        put_u32(body, static_cast<uint32_t>(binary.size()));
+        body += binary;
+    }
+    // The envelopes are ciphertext, but their headers (type, from, to,
+    // timestamps a few seconds apart) compress well.
+    auto compressed = compression::compress(body, 0);
+    std::string packed(1, static_cast<char>(compressed ? kZstd : 0));
+    packed += compressed ? *compressed : body;
+    return std::string(kPrefix) + base64::encode(packed);
+}
+
+std::optional<std::vector<Envelope>> unpack(std::string_view ciphertext) {
+    if (!is_pack(ciphertext)) {
+        return std::nullopt;
+    }
+    std::string packed;
+    if (!base64::decode(ciphertext.substr(kPrefix.size()), packed) || packed.empty()) {
+        return std::nullopt;
+    }
+    std::optional<std::string> inflated;
+    std::string_view body = std::string_view(packed).substr(1);
+    if (static_cast<uint8_t>(packed[0]) & kZstd) {
+        inflated = compression::decompress(body);
+        if (!inflated) {
+            return std::nullopt;
+        }
+        body = *inflated;
+    }
+
+    std::vector<Envelope> out;
+    while (!body.empty()) {
+        if (body.size() < 4 || get_u32(body) > body.size() - 4) {
+            return std::nullopt;
+        }
+        const uint32_t size = get_u32(body);
+        auto env = envelope::decode_binary(body.substr(4, size));
+        if (!env) {
+            return std::nullopt;
+        }
+        out.push_back(std::move(*env));
+        body.remove_prefix(4 + size);
+    }
+    return out;
+}
+
+std::string row_id(std::span<const std::string> msg_ids) {
+    crypto_generichash_state state;
+    crypto_generichash_init(&state, nullptr, 0, 16);
+    for (const auto& id : msg_ids) {
+        // NUL-separated: ids never contain one.
+        crypto_generichash_update(&state, reinterpret_cast<const uint8_t*>(id.c_str()),
+                                  id.size() + 1);
+    }
+    uint8_t b[16];
+    crypto_generichash_final(&state, b, sizeof(b));
+    b[6] = (b[6] & 0x0F) | 0x80;        // RFC 9562 version 8 (custom)
+    b[8] = (b[8] & 0x3F) | 0x80;
+    char out[37];
+    std::snprintf(out, sizeof(out),
+                  "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                  b[0], b[1], b[2], b[3], b[4], b[5], b[6], b[7],
+                  b[8], b[9], b[10], b[11], b[12], b[13], b[14], b[15]);
+    return out;
+}
+
+} // namespace mailbox_pack
@@ -6,10 +6,3526 @@
  */
 
 #include "node/node.h"
+#include "crypto/base64.h"
+#include "crypto/key_rotation.h"
+#include "network/compression.h"
+#include "network/coro.h"
+#include "network/cpu_affinity.h"
+#include "network/json_fields.h"
+#include "network/msg_id.h"
+#include "network/relay.h"
+#include "network/timestamp.h"
+#include "node/mailbox_pack.h"
+#include "node/state_snapshot.h"
+#include "telemetry/metrics.h"
+#include "telemetry/peer_usage.h"
+#include "telemetry/trace.h"
+#include "telemetry/watchdog.h"
+#include <algorithm>
+#include <array>
+#include <charconv>
 
-// TODO: Implement Node class methods
-// - Node::Node(config)           — load or generate identity
-// - Node::register_with_supabase — publish public key + IP
-// - Node::add_friend(username)   — resolve via Supabase, store locally
-// - Node::send_message(to, text) — encrypt → send direct or push offline
-// - Node::receive_message(…)     — decrypt, verify, store locally
+#include <cstdlib>
+#include <ctime>
+#include <limits>
+#include <future>
+#include <tuple>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+metrics::Histogram& parse_seconds =
+    metrics::histogram("p2p_frame_parse_seconds", "Decoding of one peer frame into an envelope");
+metrics::Counter& malformed_frames =
+    metrics::counter("p2p_frames_malformed_total", "Peer frames that failed to decode");
+metrics::Counter& unknown_sender_frames =
+    metrics::counter("p2p_frames_unknown_sender_total",
+                     "Peer frames dropped before verification: sender neither a friend nor cached");
+metrics::Counter& offline_fallbacks =
+    metrics::counter("p2p_send_offline_fallbacks_total",
+                     "Direct sends whose connect neared its deadline, so the offline copy went too");
+metrics::Counter& predicted_both =
+    metrics::counter("p2p_send_predicted_both_total",
+                     "Sends queued offline at once, with a direct copy if the connect succeeds");
+metrics::Counter& predicted_offline =
+    metrics::counter("p2p_send_predicted_offline_total",
+                     "Sends queued offline without a connect: the friend looked away and unreachable");
+metrics::Counter& prewarms =
+    metrics::counter("p2p_peer_prewarms_total",
+                     "Connects to a friend started before there was anything to send");
+metrics::Counter& lan_peers_found =
+    metrics::counter("p2p_lan_peers_found_total",
+                     "Friends found at a new LAN endpoint by a verified announcement");
+metrics::Counter& lan_rejected =
+    metrics::counter("p2p_lan_announcements_rejected_total",
+                     "LAN announcements under a known username that failed verification");
+metrics::Counter& heartbeats_sent =
+    metrics::counter("p2p_heartbeats_sent_total", "Supabase heartbeats sent");
+metrics::Counter& heartbeats_skipped =
+    metrics::counter("p2p_heartbeats_skipped_total",
+                     "Heartbeat checks that sent nothing: address unchanged and not yet due");
+metrics::Gauge& heartbeat_delay =
+    metrics::gauge("p2p_heartbeat_delay_seconds", "Current wait between idle heartbeats");
+metrics::Counter& signals_sent =
+    metrics::counter("p2p_signals_sent_total", "Typing and read signals sent to peers");
+metrics::Counter& signals_received =
+    metrics::counter("p2p_signals_received_total",
+                     "Typing and read signals from peers passed on to the UI");
+
+PeerConnectionPool::Options pool_options(const json& config) {
+    PeerConnectionPool::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.idle_timeout = std::chrono::seconds(node.value("peer_idle_timeout", 60));
+    opts.max_connections = node.value("peer_pool_size", 256);
+    opts.send_queue_bytes = node.value("peer_send_queue_bytes", 4 * 1024 * 1024);
+    opts.zerocopy_min_bytes = node.value("peer_zerocopy_min_bytes", 64 * 1024);
+
+    // Announce ourselves on every new connection so the remote can answer
+    // in binary; JSON-only builds still announce the rest.
+    const auto username = node.value("username", "");
+    uint32_t caps = node.value("binary_envelope", true) ? envelope::kLocalCapabilities : 0;
+    if (compression::available() && node.value("compress_min_bytes", 0) >= 0) {
+        caps |= envelope::kCapZstdV1;
+    }
+    caps |= envelope::kCapSignalV1 | envelope::kCapAeadV1 | envelope::kCapMailboxPackV1 |
+            envelope::kCapMuxV1 | envelope::kCapFileShareV1;
+    if (node.value("latency_slo_ms", 200) > 0) {
+        caps |= envelope::kCapTimingV1;
+    }
+    opts.hello = [username, caps] { return envelope::make_hello(username, caps); };
+    return opts;
+}
+
+// `node.advertise_addresses`; nullopt (absent) = detect them.
+std::optional<std::vector<std::string>> advertise_addresses(const json& config) {
+    const auto node = config.value("node", json::object());
+    if (!node.contains("advertise_addresses") || !node["advertise_addresses"].is_array()) {
+        return std::nullopt;
+    }
+    std::vector<std::string> out;
+    for (const auto& address : node["advertise_addresses"]) {
+        if (address.is_string() && address.get<std::string>().find(',') == std::string::npos) {
+            out.push_back(address.get<std::string>());
+        }
+    }
+    return out;
+}
+
+std::unique_ptr<PrewarmPolicy> prewarm_policy(const json& config) {
+    const auto node = config.value("node", json::object());
+    if (!node.value("prewarm", true)) {
+        return nullptr;
+    }
+    PrewarmPolicy::Options opts;
+    opts.keep_warm = node.value("prewarm_keep_warm", opts.keep_warm);
+    return std::make_unique<PrewarmPolicy>(opts);
+}
+
+std::unique_ptr<DeliveryPredictor> delivery_predictor(const json& config) {
+    if (!config.value("node", json::object()).value("predict_delivery", true)) {
+        return nullptr;
+    }
+    return std::make_unique<DeliveryPredictor>(DeliveryPredictor::Options{});
+}
+
+std::unique_ptr<LatencySlo> latency_slo(const json& config) {
+    const auto objective = config.value("node", json::object()).value("latency_slo_ms", 200);
+    if (objective <= 0) {
+        return nullptr;
+    }
+    // The stage budgets keep their shares of the default 200 ms.
+    LatencySlo::Options opts;
+    opts.objective = std::chrono::milliseconds(objective);
+    opts.seal_budget = opts.objective / 5;
+    opts.network_budget = opts.objective * 3 / 5;
+    opts.peer_budget = opts.objective / 5;
+    return std::make_unique<LatencySlo>(opts);
+}
+
+std::unique_ptr<ReorderBuffer> reorder_buffer(const json& config) {
+    const auto hold = config.value("node", json::object()).value("reorder_hold_ms", 250);
+    if (hold <= 0) {
+        return nullptr;
+    }
+    ReorderBuffer::Options opts;
+    opts.hold = std::chrono::milliseconds(hold);
+    return std::make_unique<ReorderBuffer>(opts);
+}
+
+// A new `seq` run: later than any earlier run's, barring a clock step back.
+uint64_t seq_run() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                     std::chrono::system_clock::now().time_since_epoch())
+                                     .count());
+}
+
+PeerSessions::Options session_options(const json& config) {
+    PeerSessions::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.lifetime = std::chrono::seconds(
+        std::max(60, node.value("session_lifetime", static_cast<int>(opts.lifetime.count()))));
+    opts.max_clock_skew = std::chrono::seconds(node.value("max_clock_skew", 300));
+    opts.aes_gcm = node.value("session_aes_gcm", true);
+    opts.resume_window = std::chrono::seconds(std::max(
+        0, node.value("session_resume_window", static_cast<int>(opts.resume_window.count()))));
+    return opts;
+}
+
+/// What a session frame's tag also covers, so it can't be relabelled.
+std::string session_aad(const std::string& from, const std::string& to) {
+    return from + '\0' + to;
+}
+
+PeerDirectory::Options directory_options(const json& config) {
+    PeerDirectory::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.ttl = std::chrono::seconds(node.value("peer_cache_ttl", 300));
+    opts.negative_ttl = std::chrono::seconds(node.value("peer_cache_negative_ttl", 30));
+    return opts;
+}
+
+HeartbeatSchedule::Options heartbeat_options(const json& config) {
+    HeartbeatSchedule::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.interval = std::chrono::seconds(
+        node.value("heartbeat_interval", static_cast<int>(opts.interval.count())));
+    opts.max_interval = std::chrono::seconds(
+        node.value("heartbeat_max_interval", static_cast<int>(opts.max_interval.count())));
+    return opts;
+}
+
+PresenceTable::Options presence_options(const json& config) {
+    PresenceTable::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.interval = std::chrono::seconds(
+        std::max(1, node.value("presence_interval", static_cast<int>(opts.interval.count()))));
+    opts.timeout = std::chrono::seconds(
+        node.value("presence_timeout", static_cast<int>(opts.timeout.count())));
+    opts.max_probe_interval = std::chrono::seconds(
+        node.value("presence_max_probe_interval", static_cast<int>(opts.max_probe_interval.count())));
+    return opts;
+}
+
+/// Smallest plaintext worth compressing; a negative node.compress_min_bytes
+/// turns compression off (and it is then not advertised either).
+std::size_t compress_min_bytes(const json& config) {
+    const auto node = config.value("node", json::object());
+    const long long min = node.value("compress_min_bytes",
+                                     static_cast<long long>(compression::kDefaultMinSize));
+    return min < 0 ? std::numeric_limits<std::size_t>::max() : static_cast<std::size_t>(min);
+}
+
+/// What a ping's signature covers: binds it to both ends and to its time,
+/// so it can only be replayed to us, and only within the clock-skew window.
+std::string ping_signed_bytes(const Envelope& env) {
+    return "ping\n" + env.from + "\n" + env.to + "\n" + env.timestamp;
+}
+
+AckTracker::Options ack_options(const json& config) {
+    AckTracker::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.ack_timeout = std::chrono::milliseconds(
+        node.value("ack_timeout_ms", static_cast<int>(opts.ack_timeout.count())));
+    opts.max_retries = node.value("ack_max_retries", opts.max_retries);
+    return opts;
+}
+
+OfflineMailbox::Options mailbox_options(const json& config) {
+    OfflineMailbox::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.flush_delay = std::chrono::milliseconds(
+        node.value("mailbox_flush_delay_ms", static_cast<int>(opts.flush_delay.count())));
+    opts.batch_size = node.value("mailbox_batch_size", opts.batch_size);
+    opts.retry_delay = std::chrono::milliseconds(
+        node.value("mailbox_retry_ms", static_cast<int>(opts.retry_delay.count())));
+    opts.max_attempts = node.value("mailbox_max_attempts", opts.max_attempts);
+    opts.pack_window = std::chrono::milliseconds(
+        node.value("mailbox_pack_window_ms", static_cast<int>(opts.pack_window.count())));
+    opts.pack_max_messages = std::max<std::size_t>(
+        1, node.value("mailbox_pack_max_messages", opts.pack_max_messages));
+    // Older rows would be rejected by the recipient anyway.
+    opts.max_age = std::chrono::seconds(node.value("replay_window", Node::kDefaultReplayWindow));
+    return opts;
+}
+
+FileTransfers::Options file_options(const json& config) {
+    FileTransfers::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.download_dir = node.value("download_dir", opts.download_dir.string());
+    opts.chunk_size = node.value("file_chunk_size", opts.chunk_size);
+    opts.window_chunks = node.value("file_window_chunks", opts.window_chunks);
+    opts.content_addressed = node.value("file_content_addressed", opts.content_addressed);
+    opts.attachment_dir = node.value("attachment_dir", opts.attachment_dir.string());
+    opts.share_keep = std::chrono::seconds(
+        node.value("file_share_keep", static_cast<int>(opts.share_keep.count())));
+    return opts;
+}
+
+RelayHub::Options relay_hub_options(const json& config) {
+    RelayHub::Options opts;
+    const auto relay = config.value("relay", json::object());
+    opts.max_clients = relay.value("max_clients", opts.max_clients);
+    opts.bytes_per_sec = relay.value("bytes_per_sec", opts.bytes_per_sec);
+    opts.client_bytes_per_sec = relay.value("client_bytes_per_sec", opts.client_bytes_per_sec);
+    opts.client_queue_bytes = relay.value("client_queue_bytes", opts.client_queue_bytes);
+    opts.max_clock_skew = std::chrono::seconds(config.at("node").value("max_clock_skew", 300));
+    opts.zerocopy_min_bytes = config.at("node").value("peer_zerocopy_min_bytes", 64 * 1024);
+    return opts;
+}
+
+AdmissionControl::Options admission_options(const json& config) {
+    AdmissionControl::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.max_connections = node.value("max_peer_connections", opts.max_connections);
+    opts.max_connections_per_ip = node.value("max_connections_per_ip", opts.max_connections_per_ip);
+    opts.ip_frames_per_sec = node.value("ip_frames_per_sec", opts.ip_frames_per_sec);
+    opts.ip_frame_burst = node.value("ip_frame_burst", opts.ip_frame_burst);
+    opts.sender_frames_per_sec = node.value("peer_frames_per_sec", opts.sender_frames_per_sec);
+    opts.sender_frame_burst = node.value("peer_frame_burst", opts.sender_frame_burst);
+    return opts;
+}
+
+/// `relay.server` if set at all: "" asks for the published relay to be
+/// cleared, which an absent key doesn't.
+std::optional<std::string> relay_server(const json& config) {
+    const auto relay = config.value("relay", json::object());
+    if (!relay.contains("server") || !relay["server"].is_string()) {
+        return std::nullopt;
+    }
+    return relay["server"].get<std::string>();
+}
+
+UdpTransport::Options udp_options(const json& config) {
+    UdpTransport::Options opts;
+    const auto node = config.value("node", json::object());
+    const auto udp = config.value("udp", json::object());
+    opts.username = node.value("username", "");
+    opts.port = udp.value("port", node.value("listen_port", Node::kDefaultPeerPort));
+    opts.max_connections = udp.value("max_connections", opts.max_connections);
+    opts.send_queue_bytes = node.value("peer_send_queue_bytes", opts.send_queue_bytes);
+    opts.keepalive = std::chrono::seconds(
+        std::max(1, udp.value("keepalive_interval", static_cast<int>(opts.keepalive.count()))));
+    opts.idle_timeout = std::chrono::seconds(
+        udp.value("idle_timeout", static_cast<int>(opts.idle_timeout.count())));
+    return opts;
+}
+
+LanDiscovery::Options lan_options(const json& config) {
+    LanDiscovery::Options opts;
+    const auto lan = config.value("lan", json::object());
+    opts.group = lan.value("group", opts.group);
+    opts.port = lan.value("port", opts.port);
+    opts.interval = std::chrono::seconds(
+        std::max(1, lan.value("interval", static_cast<int>(opts.interval.count()))));
+    return opts;
+}
+
+/// Pool key of the connection to a relay; usernames never contain ':'.
+std::string relay_pool_key(const std::string& relay) {
+    return "relay:" + relay;
+}
+
+/// Pool key of the connection to another of our devices.
+std::string device_pool_key(const std::string& address) {
+    return "device:" + address;
+}
+
+/// `sync` settings; `self` is the address the other devices answer to,
+/// `sync.self` if set.
+DeviceSync::Options device_sync_options(const json& config, std::string self) {
+    DeviceSync::Options opts;
+    const auto sync = config.value("sync", json::object());
+    opts.devices = sync.value("devices", std::vector<std::string>{});
+    opts.self = sync.value("self", self);
+    opts.interval = std::chrono::seconds(
+        std::max(10, sync.value("interval", static_cast<int>(opts.interval.count()))));
+    opts.batch_bytes = sync.value("batch_bytes", opts.batch_bytes);
+    return opts;
+}
+
+/// What a group_message signature covers: the sender, the group and the
+/// sealed body, so a message can't be replayed into another group.
+std::string group_signed_bytes(const Envelope& env) {
+    return "group_message\n" + env.from + "\n" + env.to + "\n" +
+           std::string(env.nonce.begin(), env.nonce.end()) +
+           std::string(env.ciphertext.begin(), env.ciphertext.end());
+}
+
+/// What a file_ack or file_cancel signature covers: both ends and the body,
+/// so it can't be replayed into another conversation or transfer.
+std::string file_control_signed_bytes(const Envelope& env) {
+    return std::string(envelope::type_name(env.type)) + "\n" + env.from + "\n" + env.to + "\n" +
+           std::string(env.ciphertext.begin(), env.ciphertext.end());
+}
+
+std::size_t history_cache_bytes(const json& config) {
+    return config.value("database", json::object())
+        .value("history_cache_bytes", std::size_t{4} * 1024 * 1024);
+}
+
+std::unique_ptr<SupabaseClient> make_supabase(const json& config, asio::io_context& io,
+                                              std::shared_ptr<SupabaseClient::Transport> shared) {
+    const auto sb = config.value("supabase", json::object());
+    const std::string url = sb.value("url", "");
+    if (url.empty()) {
+        return nullptr;
+    }
+    if (shared) {
+        return std::make_unique<SupabaseClient>(std::move(shared), url, sb.value("anon_key", ""));
+    }
+    return std::make_unique<SupabaseClient>(io, url, sb.value("anon_key", ""));
+}
+
+// Delta payload records are "<op> <delta_id> <target> <value>", the op as
+// its DeltaOp digit and the value (possibly empty) running to the end.
+constexpr std::string_view kDeltaOpNames[] = {"", "react", "unreact", "edit", "delete"};
+constexpr std::size_t kMaxDeltaId = 64;         // delta ids and the msg_ids they target
+constexpr std::size_t kMaxEmojiBytes = 64;
+constexpr std::size_t kMaxDeltaBatch = 64;      // records per payload
+
+std::optional<MessageStore::DeltaOp> delta_op(std::string_view name) {
+    for (std::size_t i = 1; i < std::size(kDeltaOpNames); ++i) {
+        if (kDeltaOpNames[i] == name) {
+            return static_cast<MessageStore::DeltaOp>(i);
+        }
+    }
+    return std::nullopt;
+}
+
+std::string_view delta_op_name(MessageStore::DeltaOp op) {
+    return kDeltaOpNames[static_cast<std::size_t>(op)];
+}
+
+std::string delta_record(const MessageStore::Delta& d) {
+    std::string out;
+    out.reserve(4 + d.delta_id.size() + d.target.size() + d.value.size());
+    out += static_cast<char>('0' + static_cast<int>(d.op));
+    out += ' ';
+    out += d.delta_id;
+    out += ' ';
+    out += d.target;
+    out += ' ';
+    out += d.value;
+    return out;
+}
+
+// Just the record's own fields; nullopt if it isn't one.
+std::optional<MessageStore::Delta> parse_delta_record(std::string_view r) {
+    if (r.size() < 2 || r[0] < '1' || r[0] > '4' || r[1] != ' ') {
+        return std::nullopt;
+    }
+    MessageStore::Delta d;
+    d.op = static_cast<MessageStore::DeltaOp>(r[0] - '0');
+    r.remove_prefix(2);
+    const auto id_end = r.find(' ');
+    const auto target_end = id_end == std::string_view::npos ? id_end : r.find(' ', id_end + 1);
+    if (target_end == std::string_view::npos || id_end == 0 || id_end > kMaxDeltaId ||
+        target_end == id_end + 1 || target_end - id_end - 1 > kMaxDeltaId) {
+        return std::nullopt;
+    }
+    d.delta_id = r.substr(0, id_end);
+    d.target = r.substr(id_end + 1, target_end - id_end - 1);
+    d.value = r.substr(target_end + 1);
+    return d;
+}
+
+// Address of the interface that routes to the internet; no packet is sent.
+std::string detect_local_ip() {
+    try {
+        asio::io_context io;
+        asio::ip::udp::socket s(io);
+        s.connect({asio::ip::make_address("8.8.8.8"), 53});
+        return s.local_endpoint().address().to_string();
+    } catch (const std::exception&) {
+        return "127.0.0.1";
+    }
+}
+
+// Global IPv6 address of the interface that routes to the internet; empty
+// without one. No packet is sent.
+std::string detect_local_ip6() {
+    try {
+        asio::io_context io;
+        asio::ip::udp::socket s(io);
+        s.connect({asio::ip::make_address("2001:4860:4860::8888"), 53});
+        const auto address = s.local_endpoint().address().to_v6();
+        if (address.is_link_local() || address.is_loopback() || address.is_v4_mapped()) {
+            return "";
+        }
+        return address.to_string();
+    } catch (const std::exception&) {
+        return "";
+    }
+}
+
+// "1.2.3.4:9200" → ("1.2.3.4", 9200); a bare address gets the default port.
+std::pair<std::string, uint16_t> split_address(const std::string& addr) {
+    const auto colon = addr.rfind(':');
+    if (colon == std::string::npos || addr.find(':') != colon) {
+        return {addr, Node::kDefaultPeerPort};   // no port, or a bare IPv6 address
+    }
+    try {
+        return {addr.substr(0, colon), static_cast<uint16_t>(std::stoi(addr.substr(colon + 1)))};
+    } catch (const std::exception&) {
+        return {addr.substr(0, colon), Node::kDefaultPeerPort};
+    }
+}
+
+// Inverse of split_address.
+std::string join_address(const std::string& ip, uint16_t port) {
+    if (ip.empty() || port == Node::kDefaultPeerPort || port == 0) {
+        return ip;
+    }
+    return ip + ":" + std::to_string(port);
+}
+
+// Where to dial `peer` directly: where they were heard on the LAN, if they
+// were, then last_ip, then the addresses they listed.
+PeerAddress peer_address(const PeerDirectory::Peer& peer) {
+    PeerAddress address{peer.ip, peer.port, {}};
+    if (!peer.lan.empty()) {
+        const auto [ip, port] = split_address(peer.lan);
+        address = {ip, port, {}};
+        if (!peer.ip.empty()) {
+            // Explicit port: an alternate without one takes the LAN port.
+            const auto host = peer.ip.find(':') == std::string::npos ? peer.ip : "[" + peer.ip + "]";
+            address.alternates.push_back(host + ":" + std::to_string(peer.port));
+        }
+    }
+    for (std::size_t start = 0; start < peer.addresses.size();) {
+        auto end = peer.addresses.find(',', start);
+        if (end == std::string::npos) {
+            end = peer.addresses.size();
+        }
+        if (end > start) {
+            address.alternates.push_back(peer.addresses.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return address;
+}
+
+// Whether to dial `peer` rather than go through their relay: on the LAN we
+// can reach them even when the internet can't.
+bool dial_direct(const PeerDirectory::Peer& peer) {
+    return !peer.lan.empty() || peer.relay.empty();
+}
+
+// Whether Supabase saw a long-offline friend in the last five minutes, i.e.
+// whether their refreshed address is worth a ping. PostgREST reports
+// last_seen with a fraction and a +00:00 offset.
+bool seen_recently(const std::string& iso) {
+    const auto seen = timestamp::parse(iso);
+    return seen && static_cast<int64_t>(std::time(nullptr)) - *seen < 5 * 60;
+}
+
+} // namespace
+
+Node::Node(const json& config, asio::io_context& io, Shared shared)
+    : username_(config.at("node").at("username").get<std::string>()),
+      node_id_(config.at("node").value("node_id", "")),
+      binary_envelope_(config.at("node").value("binary_envelope", true)),
+      listen_port_(config.at("node").value("listen_port", kDefaultPeerPort)),
+      advertise_ip_(config.at("node").value("advertise_ip", "")),
+      advertise_addresses_(advertise_addresses(config)),
+      replay_window_(config.at("node").value("replay_window", kDefaultReplayWindow)),
+      tunables_(tunables_from(config)),
+      crypto_workers_(shared.crypto_workers
+                          ? std::move(shared.crypto_workers)
+                          : std::make_shared<CryptoWorkers>(io.get_executor(),
+                                                            crypto_worker_options(config))),
+      sessions_(config.at("node").value("peer_sessions", true)
+                    ? std::make_unique<PeerSessions>(session_options(config)) : nullptr),
+      history_cache_(history_cache_bytes(config)),
+      store_(store_options(config)),
+      groups_(store_, username_),
+      supabase_(make_supabase(config, io, std::move(shared.supabase))),
+      directory_([this](const std::string& username) -> std::optional<PeerDirectory::Peer> {
+                     if (!supabase_) return std::nullopt;
+                     auto row = supabase_->lookup_user(username);
+                     return row ? peer_from_row(*row) : std::nullopt;
+                 },
+                 directory_options(config)),
+      peer_pool_(pool_options(config)),
+      links_(std::move(shared.links)),
+      prewarm_(prewarm_policy(config)),
+      delivery_(delivery_predictor(config)),
+      peer_caps_(binary_envelope_),
+      relay_server_(relay_server(config)),
+      admission_(std::make_shared<AdmissionControl>(admission_options(config))),
+      acks_(io, ack_options(config),
+            [this](const std::string& id, const Envelope& env) { retransmit(id, env); },
+            [this](const std::string& id, Envelope env) { give_up_direct(id, std::move(env)); }),
+      latency_(latency_slo(config)),
+      offline_fallback_after_(pool_options(config).connect_timeout * 3 / 4),
+      mailbox_(supabase_ ? std::make_shared<OfflineMailbox>(
+                               io, store_, *supabase_, username_, mailbox_options(config),
+                               config.at("node").value("mailbox_pack", true)
+                                   ? OfflineMailbox::Packable([this](const std::string& to) {
+                                         return peer_caps_.supports(
+                                             to, envelope::kCapMailboxPackV1);
+                                     })
+                                   : OfflineMailbox::Packable())
+                         : nullptr),
+      transfers_(file_options(config),
+                 {[this](const std::string& to, const FileTransfers::Offer& offer) {
+                      send_file_offer(to, offer);
+                  },
+                  [this](const std::string& to, EnvelopeType type, std::string body) {
+                      send_file_frame(to, type, std::move(body));
+                  },
+                  [this](const std::string& to) {
+                      return peer_caps_.supports(to, envelope::kCapFileShareV1);
+                  }},
+                 [this](std::string_view event, const json& data) { emit(event, data); }),
+      presence_(presence_options(config)),
+      heartbeat_(heartbeat_options(config)),
+      heartbeat_timer_(io),
+      presence_timer_(io),
+      signals_(SignalGate::Options{}),
+      signal_timer_(asio::make_strand(io)),
+      reorder_(reorder_buffer(config)),
+      reorder_timer_(asio::make_strand(io)),
+      seq_run_(seq_run()),
+      delta_batch_(config.at("node").value("delta_batch_ms", 50)),
+      snapshot_path_(store_options(config).in_memory
+                         ? ""
+                         : config.at("node").value("state_snapshot", "state.snap")) {
+    store_.set_on_change([this](const std::string& peer) { history_cache_.invalidate(peer); });
+    if (shared.backpressure) {
+        store_.set_backpressure(*shared.backpressure);
+    }
+    // The DB thread opens SQLite while this one loads the key pair.
+    auto opened = store_.open_async();
+    if (!CryptoManager::init()) {
+        throw std::runtime_error("libsodium initialisation failed");
+    }
+    load_identity(config.at("node"), !store_options(config).in_memory);
+    crypto_.set_split_open_bytes(config.at("node").value(
+        "crypto_split_bytes", CryptoManager::kDefaultSplitOpenBytes));
+    // Backlog pages open on the crypto workers, between their own jobs.
+    crypto_.set_spread([workers = crypto_workers_](std::size_t count,
+                                                   const std::function<void(std::size_t)>& fn) {
+        workers->for_each(count, fn);
+    });
+    user_id::intern(username_);     // our other devices' frames come from us
+    if (links_) {
+        links_->set_hello(username_, pool_options(config).hello);
+    }
+    if (config.value("relay", json::object()).value("enabled", false)) {
+        relay_hub_ = std::make_unique<RelayHub>(
+            relay_hub_options(config),
+            [this](const std::string& username, std::string signed_bytes, std::string signature,
+                   std::function<void(bool)> done) {
+                verify_relay_client(username, std::move(signed_bytes), std::move(signature),
+                                    std::move(done));
+            });
+        spdlog::info("Serving as a relay");
+    }
+    if (relay_server_ && !relay_server_->empty()) {
+        RelayLink::Options opts;
+        std::tie(opts.ip, opts.port) = split_address(*relay_server_);
+        opts.refresh = std::chrono::seconds(
+            std::max(1, config.value("relay", json::object()).value("refresh_interval", 30)));
+        opts.backpressure = shared.backpressure;
+        relay_link_ = std::make_unique<RelayLink>(
+            username_, opts,
+            [this](const std::string& bytes) { return crypto_.sign(bytes); },
+            [this](const std::string& remote, std::string_view frame) { on_frame(remote, frame); });
+    }
+    const auto sb = config.value("supabase", json::object());
+    if (supabase_ && sb.value("realtime", true)) {
+        realtime_ = std::make_unique<SupabaseRealtime>(
+            sb.value("url", ""), sb.value("anon_key", ""), username_, SupabaseRealtime::Options{},
+            [this](std::vector<SupabaseClient::OfflineMessage> rows) {
+                receive_pushed_offline(std::move(rows));
+            },
+            // Whatever was queued before the channel was joined.
+            [this] { fetch_offline_messages(); });
+    }
+    if (config.contains("udp")) {
+        // Like relay.server: a present but disabled section clears the
+        // published endpoint, an absent one leaves it be.
+        udp_endpoint_ = "";
+        if (config["udp"].value("enabled", false)) {
+            auto opts = udp_options(config);
+            udp_endpoint_ = (advertise_ip_.empty() ? detect_local_ip() : advertise_ip_) + ":" +
+                            std::to_string(opts.port);
+            udp_ = std::make_unique<UdpTransport>(std::move(opts));
+            udp_->set_on_message([this](const std::string& remote, std::string_view frame) {
+                on_frame(remote, frame);
+            });
+        }
+    }
+    if (config.value("lan", json::object()).value("enabled", false)) {
+        auto opts = lan_options(config);
+        opts.username = username_;
+        opts.node_id = node_id_;
+        opts.key_hash = LanDiscovery::key_hash(crypto_.signing_public_key());
+        opts.listen_port = listen_port_;
+        lan_interval_ = opts.interval;
+        lan_ = std::make_unique<LanDiscovery>(
+            std::move(opts), [this](const std::string& bytes) { return crypto_.sign(bytes); },
+            [this](const LanDiscovery::Announcement& announcement, const std::string& ip) {
+                on_lan_announcement(announcement, ip);
+            });
+    }
+    database_ok_ = opened.get();
+    if (database_ok_) {
+        if (!restore_snapshot()) {
+            load_friends();
+        }
+        groups_.load();
+        auto sync = device_sync_options(config, advertised_address());
+        if (!sync.devices.empty()) {
+            device_sync_ = std::make_shared<DeviceSync>(
+                io, store_, std::move(sync),
+                [this](const std::string& address, const json& message) {
+                    send_device_sync(address, message);
+                },
+                [this](std::size_t count) { emit("history_synced", json{{"count", count}}); });
+        }
+    } else {
+        spdlog::error("Local database unavailable; history and friends will not be kept");
+    }
+}
+
+MessageStore::Options Node::store_options(const json& config) {
+    MessageStore::Options opts;
+    const auto db = config.value("database", json::object());
+    opts.path = db.value("local_db_path", opts.path);
+    opts.in_memory = db.value("engine", "sqlite") == "memory";
+    opts.synchronous = db.value("synchronous", opts.synchronous);
+    opts.cache_size_kib = db.value("cache_size_kib", opts.cache_size_kib);
+    opts.commit_window = std::chrono::milliseconds(
+        db.value("commit_window_ms", static_cast<int>(opts.commit_window.count())));
+    opts.commit_batch = std::max<std::size_t>(1, db.value("commit_batch", opts.commit_batch));
+    opts.archive_after = std::chrono::hours(24 * db.value("archive_after_days", 0));
+    opts.archive_dir = db.value("archive_dir", opts.archive_dir);
+    opts.delta_views = db.value("delta_views", opts.delta_views);
+    opts.read_connections = db.value("read_connections", opts.read_connections);
+    opts.cpus = cpu_affinity::from_config("database.cpus", db.value("cpus", ""));
+    // The passphrase comes from the environment, never from the config file.
+    opts.encrypt = db.value("encrypt", false);
+    if (opts.encrypt) {
+        const std::string var = db.value("passphrase_env", "P2P_DB_PASSPHRASE");
+        if (const char* passphrase = std::getenv(var.c_str())) {
+            opts.passphrase = passphrase;
+        }
+    }
+    // Must match the window accept_plaintext() enforces.
+    opts.replay_window = std::chrono::seconds(
+        config.at("node").value("replay_window", Node::kDefaultReplayWindow));
+    return opts;
+}
+
+CryptoWorkers::Options Node::crypto_worker_options(const json& config) {
+    CryptoWorkers::Options opts;
+    const auto node = config.value("node", json::object());
+    opts.threads = node.value("crypto_threads", opts.threads);
+    opts.queue_depth = node.value("crypto_queue_depth", opts.queue_depth);
+    opts.inline_max_bytes = node.value("crypto_inline_bytes", opts.inline_max_bytes);
+    // A worker sharing a core with another gets half its execution units.
+    opts.cpus = cpu_affinity::one_per_core(
+        cpu_affinity::from_config("node.crypto_cpus", node.value("crypto_cpus", "")));
+    return opts;
+}
+
+PeerLinks::Options Node::link_options(const json& config) {
+    const auto pool = pool_options(config);
+    PeerLinks::Options opts;
+    opts.idle_timeout = pool.idle_timeout;
+    opts.connect_timeout = pool.connect_timeout;
+    opts.max_links = pool.max_connections;
+    opts.send_queue_bytes = pool.send_queue_bytes;
+    opts.zerocopy_min_bytes = pool.zerocopy_min_bytes;
+    return opts;
+}
+
+Node::Tunables Node::tunables_from(const json& config) {
+    const auto node = config.value("node", json::object());
+    return {std::chrono::seconds(node.value("heartbeat_interval", 60)),
+            presence_options(config).interval,
+            std::chrono::seconds(node.value("max_clock_skew", 300)),
+            compress_min_bytes(config)};
+}
+
+void Node::load_identity(const json& node, bool durable) {
+    const std::string seed = node.value("key_seed", "");
+    std::string cached_id;
+    if (!seed.empty()) {
+        spdlog::warn("Keys derived from node.key_seed: for test fleets only");
+        crypto_.derive_keypair(seed);
+    } else if (!durable) {
+        // Nothing else this node keeps outlives it either.
+        spdlog::info("In-memory database: using a fresh key pair");
+        crypto_.generate_keypair();
+    } else {
+        const std::string key_store = node.value("key_store", "keys.bin");
+        const std::string key_file = node.value("key_file", "keys.json");
+        if (key_store.empty() || !crypto_.load_keystore(key_store, cached_id)) {
+            if (crypto_.load_keypair(key_file)) {
+                spdlog::info("Loaded key pair from {}", key_file);
+            } else {
+                spdlog::info("No key pair at {}; generating a new one", key_file);
+                crypto_.generate_keypair();
+                crypto_.save_keypair(key_file);     // the portable copy, for other devices
+            }
+            cached_id = crypto_.derived_node_id();
+            if (!key_store.empty()) {
+                crypto_.save_keystore(key_store, cached_id);
+            }
+        }
+        if (!key_store.empty() &&
+            crypto_.load_retired(key_store + ".previous", key_update_, key_update_until_)) {
+            spdlog::info("Keys were rotated; announcing the new ones to friends until {}",
+                         timestamp::format(key_update_until_));
+        }
+    }
+    if (node_id_.empty()) {
+        node_id_ = cached_id.empty() ? crypto_.derived_node_id() : cached_id;
+    }
+}
+
+bool Node::rotate_keys(const json& config) {
+    const auto node = config.value("node", json::object());
+    const std::string username = node.value("username", "");
+    const std::string key_store = node.value("key_store", "keys.bin");
+    const std::string key_file = node.value("key_file", "keys.json");
+    if (username.empty() || key_store.empty() || !node.value("key_seed", "").empty()) {
+        spdlog::error("rotate-keys needs node.username and node.key_store, and no node.key_seed");
+        return false;
+    }
+    CryptoManager current(0);
+    std::string node_id;
+    if (!current.load_keystore(key_store, node_id)) {
+        if (!current.load_keypair(key_file)) {
+            spdlog::error("No keys to rotate in {} or {}", key_store, key_file);
+            return false;
+        }
+        node_id = current.derived_node_id();
+    }
+    const std::string previous = key_store + ".previous";
+    std::vector<uint8_t> pending;
+    int64_t pending_until = 0;
+    if (current.load_retired(previous, pending, pending_until)) {
+        spdlog::warn("The last rotation's window runs until {}; messages still sealed to the "
+                     "key before it will no longer open", timestamp::format(pending_until));
+    }
+
+    CryptoManager next(0);
+    next.generate_keypair();
+    const int64_t until = static_cast<int64_t>(std::time(nullptr)) +
+                          node.value("key_grace_days", 14) * int64_t{86400};
+    std::vector<uint8_t> update = key_rotation::make_body(next, username, until);
+    const std::string sig = current.sign(key_rotation::signed_bytes(username, update));
+    update.insert(update.end(), sig.begin(), sig.end());
+
+    // The retired key first: a rotation cut short after it leaves the old
+    // keystore in place, and the record is ignored as holding the current key.
+    if (!current.save_retired(previous, update, until) ||
+        !next.save_keystore(key_store, node_id)) {
+        return false;
+    }
+    next.save_keypair(key_file);        // the portable copy, for other devices
+    spdlog::info("Rotated the keys in {}; the next start announces them to friends until {}",
+                 key_store, timestamp::format(until));
+    return true;
+}
+
+void Node::apply_config(const json& config) {
+    tunables_.publish(tunables_from(config));
+    directory_.set_options(directory_options(config));
+    presence_.set_options(presence_options(config));
+    heartbeat_.set_options(heartbeat_options(config));
+    const auto store = store_options(config);
+    store_.set_commit_policy(store.commit_window, store.commit_batch);
+    history_cache_.set_max_bytes(history_cache_bytes(config));
+    if (relay_hub_) {
+        relay_hub_->set_options(relay_hub_options(config));
+    }
+    admission_->set_options(admission_options(config));
+
+    const auto sb = config.value("supabase", json::object());
+    const std::string url = sb.value("url", "");
+    if (supabase_ && !url.empty()) {
+        supabase_->set_endpoint(url, sb.value("anon_key", ""));
+        if (realtime_) {
+            realtime_->set_endpoint(url, sb.value("anon_key", ""));
+        }
+    } else if (supabase_ || !url.empty()) {
+        spdlog::warn("Turning Supabase on or off needs a restart");
+    }
+}
+
+std::string Node::alternate_addresses() const {
+    std::vector<std::string> out;
+    if (advertise_addresses_) {
+        out = *advertise_addresses_;
+    } else {
+        // Whatever else this host answers on: its IPv6 address, and its LAN
+        // address when advertise_ip names another one (a public IP).
+        const auto port = std::to_string(listen_port_);
+        if (auto v6 = detect_local_ip6(); !v6.empty()) {
+            out.push_back("[" + v6 + "]:" + port);
+        }
+        if (!advertise_ip_.empty()) {
+            if (auto lan = detect_local_ip(); lan != advertise_ip_ && lan != "127.0.0.1") {
+                out.push_back(lan + ":" + port);
+            }
+        }
+    }
+    std::string joined;
+    for (const auto& address : out) {
+        joined += joined.empty() ? address : "," + address;
+    }
+    return joined;
+}
+
+std::string Node::advertised_address() const {
+    std::string ip = advertise_ip_.empty() ? detect_local_ip() : advertise_ip_;
+    if (listen_port_ != kDefaultPeerPort) {
+        ip += ":" + std::to_string(listen_port_);
+    }
+    return ip;
+}
+
+std::optional<PeerDirectory::Peer> Node::peer_from_row(const json& row) {
+    PeerDirectory::Peer peer;
+    peer.username = row.value("username", "");
+    if (!base64::decode(row.value("public_key", ""), peer.public_key) ||
+        peer.public_key.size() != crypto_box_PUBLICKEYBYTES) {
+        spdlog::warn("User {} has no usable public key", peer.username);
+        return std::nullopt;
+    }
+    if (!base64::decode(row.value("signing_key", ""), peer.signing_key) ||
+        peer.signing_key.size() != crypto_sign_PUBLICKEYBYTES) {
+        peer.signing_key.clear();
+    }
+    const auto ip = row.contains("last_ip") && row["last_ip"].is_string()
+        ? row["last_ip"].get<std::string>() : std::string();
+    std::tie(peer.ip, peer.port) = split_address(ip);
+    if (row.contains("last_seen") && row["last_seen"].is_string()) {
+        peer.last_seen = row["last_seen"].get<std::string>();
+    }
+    if (row.contains("relay") && row["relay"].is_string()) {
+        peer.relay = row["relay"].get<std::string>();
+    }
+    if (row.contains("udp") && row["udp"].is_string()) {
+        peer.udp = row["udp"].get<std::string>();
+    }
+    if (row.contains("addresses") && row["addresses"].is_string()) {
+        peer.addresses = row["addresses"].get<std::string>();
+    }
+    return peer;
+}
+
+// ─── Supabase ────────────────────────────────────────────────────────────────
+
+void Node::start_sync() {
+    if (!supabase_) {
+        spdlog::warn("No Supabase configured; peers cannot discover this node");
+        set_sync_state("register", register_state_, SyncState::Skipped);
+        set_sync_state("offline_fetch", offline_state_, SyncState::Skipped);
+        return;
+    }
+    set_sync_state("register", register_state_, SyncState::Running);
+    published_addresses_ = alternate_addresses();
+    supabase_->async_register_user(username_, node_id_, base64::encode(crypto_.public_key()),
+                                   base64::encode(crypto_.signing_public_key()),
+                                   advertised_address(), relay_server_, udp_endpoint_,
+                                   published_addresses_, [this](bool ok) {
+        if (ok) {
+            spdlog::info("Registered {} with Supabase", username_);
+        }
+        set_sync_state("register", register_state_, ok ? SyncState::Done : SyncState::Failed);
+        // Fetch after registering, so nothing a sender queues because it
+        // still saw us offline slips in behind the drain. A failed
+        // registration doesn't stop the drain: what is queued is still ours.
+        if (stopping_.load()) {
+            return;
+        }
+        sync_thread_ = std::jthread([this] {
+            set_sync_state("offline_fetch", offline_state_, SyncState::Running);
+            set_sync_state("offline_fetch", offline_state_,
+                           fetch_offline_messages() ? SyncState::Done : SyncState::Failed);
+        });
+        // From here on, rows queued for us are pushed as they are inserted.
+        if (realtime_) {
+            realtime_->start();
+        }
+    });
+}
+
+const char* Node::sync_state_name(SyncState state) {
+    switch (state) {
+        case SyncState::Pending: return "pending";
+        case SyncState::Running: return "running";
+        case SyncState::Done:    return "done";
+        case SyncState::Failed:  return "failed";
+        case SyncState::Skipped: return "skipped";
+    }
+    return "pending";
+}
+
+void Node::set_sync_state(const char* phase, std::atomic<SyncState>& slot, SyncState state) {
+    slot.store(state);
+    emit("startup", {{"phase", phase}, {"state", sync_state_name(state)}});
+}
+
+json Node::status_json() const {
+    return {{"username", username_},
+            {"node_id", node_id_},
+            {"peer_port", listen_port_},
+            {"startup", {{"database", database_ok_ ? "done" : "failed"},
+                         {"register", sync_state_name(register_state_.load())},
+                         {"offline_fetch", sync_state_name(offline_state_.load())}}}};
+}
+
+std::optional<json> Node::peers_json(const std::string& sort, std::size_t limit) const {
+    static constexpr std::string_view kFields[] = {
+        "crypto_us", "bytes_in", "bytes_out", "frames_in", "frames_out", "queued_bytes",
+    };
+    const auto field = std::ranges::find(kFields, sort);
+    if (field == std::end(kFields)) {
+        return std::nullopt;
+    }
+    struct Row {
+        std::string username;
+        std::array<uint64_t, std::size(kFields)> values{};
+    };
+    auto queued = peer_pool_.queued_by_peer();
+    std::vector<Row> rows;
+    for (auto& [username, c] : peer_usage::snapshot()) {
+        const auto q = queued.extract(username);
+        if (c.frames_in == 0 && c.frames_out == 0 && c.crypto_ns == 0 && !q) {
+            continue;
+        }
+        rows.push_back({std::move(username),
+                        {c.crypto_ns / 1000, c.bytes_in, c.bytes_out, c.frames_in, c.frames_out,
+                         q ? q.mapped() : 0}});
+    }
+    for (auto& [username, bytes] : queued) {
+        rows.push_back({username, {0, 0, 0, 0, 0, bytes}});
+    }
+    const auto by = static_cast<std::size_t>(field - std::begin(kFields));
+    const std::size_t n = std::min(limit, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + static_cast<std::ptrdiff_t>(n), rows.end(),
+                      [by](const Row& a, const Row& b) { return a.values[by] > b.values[by]; });
+
+    json peers = json::array();
+    for (std::size_t i = 0; i < n; ++i) {
+        json peer = {{"username", rows[i].username}};
+        for (std::size_t f = 0; f < std::size(kFields); ++f) {
+            peer[std::string(kFields[f])] = rows[i].values[f];
+        }
+        peers.push_back(std::move(peer));
+    }
+    return json{{"sort", sort}, {"peers", std::move(peers)}};
+}
+
+void Node::start_mailbox() {
+    if (mailbox_) {
+        mailbox_->start();
+    }
+}
+
+void Node::start_heartbeat() {
+    if (!supabase_) {
+        return;
+    }
+    if (!network_watcher_) {
+        network_watcher_ = std::make_unique<NetworkWatcher>([this] {
+            asio::post(heartbeat_timer_.get_executor(), [this] {
+                heartbeat_.network_changed();
+                heartbeat_check();
+            });
+        });
+        if (!network_watcher_->start()) {
+            spdlog::debug("No interface notifications; the heartbeat polls the address");
+        }
+    }
+    heartbeat_timer_.expires_after(std::max(tunables_.read().heartbeat_interval,
+                                            std::chrono::seconds(1)));
+    heartbeat_timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            heartbeat_check();
+            start_heartbeat();
+        }
+    });
+}
+
+void Node::heartbeat_check() {
+    if (stopping_.load()) {
+        return;
+    }
+    if (heartbeat_.due(advertised_address())) {
+        heartbeat_tick();
+    } else {
+        heartbeats_skipped.inc();
+    }
+    heartbeat_delay.set(static_cast<double>(heartbeat_.delay().count()));
+}
+
+void Node::heartbeat_tick() {
+    // A network change that moved last_ip likely moved the rest too.
+    if (auto addresses = alternate_addresses(); addresses != published_addresses_) {
+        published_addresses_ = addresses;
+        supabase_->async_update_addresses(username_, addresses, {});
+    }
+    heartbeats_sent.inc();
+    supabase_->async_heartbeat(username_, advertised_address(), friend_usernames(),
+                               [this](std::optional<std::vector<json>> rows) {
+        heartbeat_.sent(rows.has_value());
+        if (rows) {
+            mailbox_->network_up();
+            refresh_friends(*rows);
+        }
+    });
+}
+
+std::vector<std::string> Node::friend_usernames() const {
+    std::vector<std::string> friends;
+    for (const auto& peer : directory_.pinned()) {
+        friends.push_back(peer.username);
+    }
+    return friends;
+}
+
+std::vector<PeerDirectory::Peer> Node::refresh_friends(const std::vector<json>& rows) {
+    std::vector<PeerDirectory::Peer> peers;
+    for (const auto& row : rows) {
+        auto peer = peer_from_row(row);
+        if (!peer) {
+            continue;
+        }
+        directory_.update_address(peer->username, peer->ip, peer->port, peer->last_seen,
+                                  peer->relay, peer->udp, peer->addresses);
+        peers.push_back(std::move(*peer));
+    }
+    return peers;
+}
+
+void Node::start_presence() {
+    presence_tick();
+    presence_timer_.expires_after(tunables_.read().presence_interval);
+    presence_timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            start_presence();
+        }
+    });
+}
+
+void Node::start_relay() {
+    if (relay_link_) {
+        relay_link_->start();
+    }
+}
+
+void Node::start_udp() {
+    if (udp_ && !udp_->start()) {
+        udp_.reset();
+        udp_endpoint_ = "";
+    }
+}
+
+void Node::start_lan() {
+    if (lan_ && !lan_->start()) {
+        lan_.reset();
+    }
+}
+
+void Node::start_device_sync() {
+    if (device_sync_) {
+        device_sync_->start();
+    }
+}
+
+bool Node::drain(std::chrono::steady_clock::time_point deadline) {
+    const bool written = peer_pool_.drain(deadline) && (!links_ || links_->drain(deadline));
+    while (acks_.pending() > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const std::size_t unacked = acks_.give_up_all();
+    store_.flush();
+    if (!written) {
+        spdlog::warn("Shutdown deadline passed with frames still queued to peers");
+    }
+    if (unacked > 0) {
+        spdlog::info("{} message(s) unacknowledged at shutdown; queued for Supabase", unacked);
+    }
+    return written && unacked == 0;
+}
+
+void Node::stop() {
+    stopping_.store(true);
+    heartbeat_timer_.cancel();
+    presence_timer_.cancel();
+    asio::post(signal_timer_.get_executor(), [this] { signal_timer_.cancel(); });
+    asio::post(reorder_timer_.get_executor(), [this] { reorder_timer_.cancel(); });
+    if (reorder_) {
+        // Store what is still waiting for a gap that won't fill now.
+        reorder_->expire(ReorderBuffer::Clock::time_point::max());
+    }
+    if (network_watcher_) {
+        network_watcher_->stop();
+    }
+    if (device_sync_) {
+        device_sync_->stop();
+    }
+    if (relay_link_) {
+        relay_link_->stop();
+    }
+    if (udp_) {
+        udp_->stop();
+    }
+    if (lan_) {
+        lan_->stop();
+    }
+    if (realtime_) {
+        realtime_->stop();
+    }
+    acks_.stop();
+    if (mailbox_) {
+        mailbox_->stop();
+    }
+    transfers_.stop();
+    peer_pool_.close_all();
+    if (links_) {
+        links_->close_channels(username_);
+    }
+    save_snapshot();
+}
+
+// ─── UI events ───────────────────────────────────────────────────────────────
+
+void Node::set_on_event(EventCallback cb) {
+    on_event_ = std::move(cb);
+}
+
+void Node::emit(std::string_view event, const json& data) const {
+    if (on_event_) {
+        on_event_(event, data);
+    }
+}
+
+void Node::mark_active(const std::string& username) {
+    if (presence_.heard(username)) {
+        emit("friend_online", json{{"username", username}});
+    }
+}
+
+void Node::on_lan_announcement(const LanDiscovery::Announcement& announcement,
+                               const std::string& ip) {
+    if (!directory_.known(announcement.username)) {
+        return;                                 // not a friend, nor anyone we talk to
+    }
+    auto peer = directory_.cached(announcement.username);
+    if (!peer || peer->signing_key.empty() ||
+        announcement.key_hash != LanDiscovery::key_hash(peer->signing_key)) {
+        lan_rejected.inc();
+        return;
+    }
+    // The same bound as an envelope's: two machines on one LAN rarely
+    // disagree about the time by more.
+    const auto now = static_cast<int64_t>(std::time(nullptr));
+    if (std::abs(now - announcement.timestamp) > tunables_.read().max_clock_skew.count() ||
+        !crypto_.verify(LanDiscovery::signed_bytes(announcement), announcement.signature,
+                        peer->signing_key)) {
+        lan_rejected.inc();
+        return;
+    }
+    {
+        std::lock_guard lock(lan_mutex_);
+        lan_seen_[announcement.username] = std::chrono::steady_clock::now();
+    }
+    const auto endpoint = ip + ":" + std::to_string(announcement.port);
+    if (peer->lan != endpoint) {
+        spdlog::info("Found {} on the LAN at {}", announcement.username, endpoint);
+        directory_.set_lan(announcement.username, endpoint);
+        lan_peers_found.inc();
+    }
+    mark_active(announcement.username);
+}
+
+void Node::expire_lan_peers() {
+    const auto cutoff = std::chrono::steady_clock::now() - 3 * lan_interval_;
+    std::vector<std::string> expired;
+    {
+        std::lock_guard lock(lan_mutex_);
+        std::erase_if(lan_seen_, [&](const auto& seen) {
+            if (seen.second >= cutoff) {
+                return false;
+            }
+            expired.push_back(seen.first);
+            return true;
+        });
+    }
+    for (const auto& username : expired) {
+        spdlog::info("{} left the LAN", username);
+        directory_.set_lan(username, "");
+    }
+}
+
+void Node::presence_tick() {
+    auto plan = presence_.tick(friend_usernames());
+
+    for (const auto& username : plan.went_offline) {
+        emit("friend_offline", json{{"username", username}});
+    }
+    for (const auto& username : plan.ping) {
+        send_ping(username);
+    }
+    keep_warm();
+    expire_lan_peers();
+    if (udp_) {
+        // Keep punching towards friends we have no UDP connection to: theirs
+        // towards us can only get through our NAT while ours is open.
+        for (const auto& peer : directory_.pinned()) {
+            over_udp(peer);
+        }
+    }
+    if (plan.lookup.empty()) {
+        return;
+    }
+    if (!supabase_) {
+        for (const auto& username : plan.lookup) {
+            send_ping(username);
+        }
+        return;
+    }
+    // Long offline: their address has most likely changed, and Supabase
+    // knows whether there is any point in dialling it. One request for all.
+    supabase_->async_lookup_users(std::move(plan.lookup),
+                                  [this](std::optional<std::vector<json>> rows) {
+        if (!rows) {
+            return;
+        }
+        for (const auto& peer : refresh_friends(*rows)) {
+            if (seen_recently(peer.last_seen)) {
+                presence_.pinged(peer.username);
+                send_ping(peer.username);
+            }
+        }
+    });
+}
+
+void Node::prewarm(const std::string& username) {
+    if (!prewarm_ || !presence_.is_online(username)) {
+        return;
+    }
+    auto peer = directory_.cached(username);
+    if (peer && reachable(*peer) && prewarm_->hinted(username)) {
+        warm_route(*peer);
+    }
+}
+
+void Node::keep_warm() {
+    if (!prewarm_) {
+        return;
+    }
+    std::vector<std::string> keys;
+    std::vector<std::string> linked;
+    for (const auto& username : prewarm_->keep_warm()) {
+        auto peer = directory_.cached(username);
+        if (!peer || !presence_.is_online(username) || !reachable(*peer)) {
+            continue;
+        }
+        if (over_link(*peer) && dial_direct(*peer)) {
+            if (!links_->has_channel(username_, username) && prewarm_->hinted(username)) {
+                warm_route(*peer);
+            }
+            linked.push_back(username);
+            continue;
+        }
+        auto key = peer->relay.empty() ? peer->username : relay_pool_key(peer->relay);
+        if (!peer_pool_.has_connection(key) && prewarm_->hinted(username)) {
+            warm_route(*peer);
+        }
+        keys.push_back(std::move(key));
+    }
+    peer_pool_.keep_warm(std::move(keys));
+    if (links_) {
+        links_->keep_warm(username_, std::move(linked));
+    }
+}
+
+void Node::warm_route(const PeerDirectory::Peer& peer) {
+    prewarms.inc();
+    open_route(peer, [this, peer](bool ok) {
+        if (ok && !stopping_) {
+            // The handshake is the other half of a cold first send.
+            asio::post(presence_timer_.get_executor(), [this, peer] { start_session(peer); });
+        }
+    });
+}
+
+void Node::send_ping(const std::string& to) {
+    auto peer = directory_.cached(to);
+    if (!peer || !reachable(*peer)) {
+        return;
+    }
+    announce_keys(to);
+    Envelope ping;
+    ping.type = EnvelopeType::Ping;
+    ping.from = username_;
+    ping.to = to;
+    ping.timestamp = envelope::now_timestamp();
+    const std::string sig = crypto_.sign(ping_signed_bytes(ping));
+    ping.signature.assign(sig.begin(), sig.end());
+    send_frame_async(*peer, envelope::encode(ping, peer_caps_.format_for(to)), {},
+                     TrafficClass::Control);
+}
+
+void Node::on_ping_received(const Envelope& env) {
+    const auto keys = directory_.keys(env.from);
+    const auto sent = envelope::parse_timestamp(env.timestamp);
+    const auto now = static_cast<int64_t>(std::time(nullptr));
+    if (!keys || env.to != username_ || !sent ||
+        std::abs(now - *sent) > tunables_.read().max_clock_skew.count() ||
+        !crypto_.verify(ping_signed_bytes(env),
+                        std::string(env.signature.begin(), env.signature.end()),
+                        keys->signing_key)) {
+        spdlog::debug("Ignoring unverifiable ping from {}", env.from);
+        return;
+    }
+    mark_active(env.from);
+    if (presence_.should_reply(env.from)) {
+        send_ping(env.from);
+    }
+}
+
+// ─── Friends ─────────────────────────────────────────────────────────────────
+
+bool Node::restore_snapshot() {
+    if (snapshot_path_.empty()) {
+        return false;
+    }
+    auto snap = StateSnapshot::load(snapshot_path_, store_.generation());
+    if (!snap) {
+        return false;
+    }
+    std::vector<PeerDirectory::Peer> friends;
+    friends.reserve(snap->friends.size());
+    for (auto& f : snap->friends) {
+        if (!f.last_heard.empty()) {
+            presence_.restore_last_heard(f.peer.username, std::move(f.last_heard));
+        }
+        friends.push_back(std::move(f.peer));
+    }
+    directory_.seed(friends);
+    // A few hundred X25519 computations: off the startup path.
+    warm_thread_ = std::jthread([this, peers = std::move(snap->shared_key_peers)] {
+        crypto_.warm_shared_keys(peers);
+    });
+    spdlog::info("Restored {} friend(s) from state snapshot {}", friends.size(), snapshot_path_);
+    return true;
+}
+
+void Node::save_snapshot() {
+    if (snapshot_path_.empty() || !database_ok_) {
+        return;
+    }
+    StateSnapshot snap;
+    snap.generation = store_.generation();
+    for (auto& peer : directory_.pinned()) {
+        auto last_heard = presence_.last_heard(peer.username);
+        snap.friends.push_back({std::move(peer), last_heard.value_or("")});
+    }
+    snap.shared_key_peers = crypto_.cached_peers();
+    if (snap.save(snapshot_path_)) {
+        spdlog::info("State snapshot written to {}", snapshot_path_);
+    }
+}
+
+void Node::load_friends() {
+    std::vector<PeerDirectory::Peer> friends;
+    for (auto& f : store_.load_friends()) {
+        PeerDirectory::Peer peer;
+        peer.username = std::move(f.username);
+        peer.public_key = std::move(f.public_key);
+        peer.signing_key = std::move(f.signing_key);
+        std::tie(peer.ip, peer.port) = split_address(f.last_ip);
+        peer.last_seen = std::move(f.last_seen);
+        friends.push_back(std::move(peer));
+    }
+    directory_.seed(friends);
+    spdlog::info("Loaded {} friend(s) from the local database", friends.size());
+}
+
+bool Node::add_friend(const std::string& username) {
+    if (username == username_) {
+        return false;
+    }
+    auto peer = directory_.lookup(username);
+    if (!peer) {
+        spdlog::warn("add_friend: user {} not found", username);
+        return false;
+    }
+    if (peer->signing_key.empty()) {
+        spdlog::warn("add_friend: {} has not published a signing key; "
+                     "their messages cannot be verified", username);
+    }
+    directory_.pin(*peer);   // TOFU: these keys are now pinned
+    store_.upsert_friend({peer->username, peer->public_key, peer->signing_key,
+                          join_address(peer->ip, peer->port), peer->last_seen, ""});
+    spdlog::info("Added friend {}", username);
+    return true;
+}
+
+asio::awaitable<std::optional<json>> Node::add_friends(std::vector<std::string> usernames) {
+    std::sort(usernames.begin(), usernames.end());
+    usernames.erase(std::unique(usernames.begin(), usernames.end()), usernames.end());
+    std::erase_if(usernames, [&](const std::string& u) { return u.empty() || u == username_; });
+
+    std::vector<PeerDirectory::Peer> peers;
+    std::vector<std::string> missing;           // sorted, as usernames is
+    for (auto& username : usernames) {
+        if (auto peer = directory_.cached(username)) {
+            peers.push_back(std::move(*peer));
+        } else {
+            missing.push_back(std::move(username));
+        }
+    }
+    std::vector<std::string> not_found;
+    if (!missing.empty()) {
+        std::optional<std::vector<json>> rows;
+        if (supabase_) {
+            rows = co_await supabase_->co_lookup_users(missing);
+        } else {
+            rows.emplace();
+        }
+        if (!rows) {
+            spdlog::warn("add_friends: lookup of {} user(s) failed", missing.size());
+            co_return std::nullopt;
+        }
+        std::vector<char> found(missing.size(), 0);
+        for (const auto& row : *rows) {
+            auto peer = peer_from_row(row);
+            const auto it = peer ? std::lower_bound(missing.begin(), missing.end(), peer->username)
+                                 : missing.end();
+            if (it == missing.end() || *it != peer->username || found[it - missing.begin()]) {
+                continue;
+            }
+            found[it - missing.begin()] = 1;
+            peers.push_back(std::move(*peer));
+        }
+        for (std::size_t i = 0; i < missing.size(); ++i) {
+            if (!found[i]) {
+                not_found.push_back(std::move(missing[i]));
+            }
+        }
+    }
+
+    std::vector<MessageStore::Friend> rows;
+    rows.reserve(peers.size());
+    for (const auto& peer : peers) {
+        if (peer.signing_key.empty()) {
+            spdlog::warn("add_friends: {} has not published a signing key; "
+                         "their messages cannot be verified", peer.username);
+        }
+        rows.push_back({peer.username, peer.public_key, peer.signing_key,
+                        join_address(peer.ip, peer.port), peer.last_seen, ""});
+    }
+    const bool stored = co_await coro::from_callback<bool>([&](auto done) {
+        store_.upsert_friends(std::move(rows), std::move(done));
+    });
+    if (!stored) {
+        spdlog::warn("add_friends: could not store {} friend(s)", peers.size());
+        co_return std::nullopt;
+    }
+    directory_.seed(peers);     // TOFU: these keys are now pinned
+
+    // Their first messages shouldn't each pay an X25519 computation.
+    std::vector<std::vector<uint8_t>> keys;
+    json added = json::array();
+    for (auto& peer : peers) {
+        added.push_back(peer.username);
+        keys.push_back(std::move(peer.public_key));
+    }
+    const std::size_t bytes = keys.size() * crypto_box_PUBLICKEYBYTES;
+    crypto_workers_->run(username_, bytes, [this, keys = std::move(keys)] {
+        crypto_.warm_shared_keys(keys);
+        return std::function<void()>();
+    }, TrafficClass::Bulk);
+    spdlog::info("Added {} friend(s); {} not found", added.size(), not_found.size());
+    co_return json{{"added", std::move(added)}, {"not_found", std::move(not_found)}};
+}
+
+asio::awaitable<std::optional<std::string>> Node::friends_page() {
+    auto friends = co_await coro::from_callback<std::vector<MessageStore::Friend>>([&](auto done) {
+        store_.friends(std::move(done));
+    });
+
+    // Written directly, as history_page() does, so a long friend list is
+    // never held twice. Keys are in the order dump() would sort them.
+    std::string out = "[";
+    out.reserve(friends.size() * 512);
+    auto field = [&out](std::string_view key, std::string_view value) {
+        out += ",\"";
+        out += key;
+        out += "\":";
+        json_fields::append_string(out, value);
+    };
+    for (const auto& f : friends) {
+        // Our own contact beats Supabase; the directory may in turn hold a
+        // fresher last_seen than the stored row.
+        auto peer = directory_.cached(f.username);
+        const std::string last_seen = presence_.last_heard(f.username).value_or(
+            peer && !peer->last_seen.empty() ? peer->last_seen : f.last_seen);
+        // From the store's in-memory summary: no query per friend.
+        const auto summary = store_.summary(f.username);
+
+        out += out.size() > 1 ? ",{\"added_at\":" : "{\"added_at\":";
+        json_fields::append_string(out, f.added_at);
+        field("last_ip", f.last_ip);
+        if (summary) {
+            out += ",\"last_message\":{\"direction\":";
+            out += summary->last_direction == MessageStore::Direction::Sent ? "\"sent\""
+                                                                            : "\"received\"";
+            field("msg_id", summary->last_msg_id);
+            field("text", summary->last_text);
+            field("timestamp", summary->last_timestamp);
+            out += '}';
+        } else {
+            out += ",\"last_message\":null";
+        }
+        field("last_seen", last_seen);
+        out += presence_.is_online(f.username) ? ",\"online\":true" : ",\"online\":false";
+        field("public_key", base64::encode(f.public_key));
+        field("signing_key", base64::encode(f.signing_key));
+        out += ",\"unread\":";
+        out += std::to_string(summary ? summary->unread : 0);
+        field("username", f.username);
+        out += '}';
+    }
+    out += ']';
+    co_return out;
+}
+
+asio::awaitable<HistoryCache::Body> Node::history_page(std::string peer, std::size_t limit,
+                                                       std::size_t offset, std::string before) {
+    // Only the newest page is cached: it's the one the UI keeps re-reading.
+    const bool newest = offset == 0 && before.empty();
+    uint64_t ticket = 0;
+    if (newest) {
+        // The chat was opened: a message to them is likely next.
+        prewarm(peer);
+        if (auto cached = history_cache_.get(peer, limit)) {
+            co_return cached;
+        }
+        ticket = history_cache_.ticket(peer);
+    }
+    auto page = co_await coro::from_callback<std::optional<MessageStore::HistoryPage>>([&](auto done) {
+        if (before.empty()) {
+            store_.history(peer, limit, offset, std::move(done));
+        } else {
+            store_.history_before(peer, before, limit, std::move(done));
+        }
+    });
+    if (!page) {
+        co_return nullptr;
+    }
+
+    // Written directly rather than through a json DOM: pages of long
+    // messages are mostly text, and this is the path that escapes it.
+    // Keys are in the order dump() would sort them.
+    std::string out = "{\"has_more\":";
+    out += page->has_more ? "true" : "false";
+    out += ",\"messages\":[";
+    for (std::size_t i = 0; i < page->messages.size(); ++i) {
+        if (i) out += ',';
+        append_message_json(out, page->messages[i]);
+    }
+    // The cursor for "load older": the oldest message on this page.
+    out += "],\"next_before\":";
+    if (page->has_more) {
+        json_fields::append_string(out, page->messages.front().msg_id);
+    } else {
+        out += "null";
+    }
+    if (page->total) {
+        out += ",\"total\":";
+        out += std::to_string(*page->total);
+    }
+    out += '}';
+    auto body = std::make_shared<const std::string>(std::move(out));
+    if (newest) {
+        history_cache_.put(peer, limit, body, ticket);
+    }
+    co_return body;
+}
+
+asio::awaitable<std::optional<std::string>> Node::messages_since_page(std::string peer,
+                                                                     std::string since,
+                                                                     std::size_t limit) {
+    auto page = co_await coro::from_callback<std::optional<MessageStore::HistoryPage>>([&](auto done) {
+        store_.history_after(peer, since, limit, std::move(done));
+    });
+    if (!page) {
+        co_return std::nullopt;
+    }
+
+    std::string out = "{\"has_more\":";
+    out += page->has_more ? "true" : "false";
+    out += ",\"messages\":[";
+    for (std::size_t i = 0; i < page->messages.size(); ++i) {
+        if (i) out += ',';
+        append_message_json(out, page->messages[i]);
+    }
+    // The cursor for the next poll: the newest message seen so far.
+    out += "],\"next_since\":";
+    json_fields::append_string(out, page->messages.empty() ? since : page->messages.back().msg_id);
+    out += '}';
+    co_return out;
+}
+
+asio::awaitable<std::optional<std::string>> Node::search_page(std::string query, std::string peer,
+                                                              std::size_t limit) {
+    auto hits = co_await coro::from_callback<std::optional<std::vector<MessageStore::SearchHit>>>(
+        [&](auto done) { store_.search(query, peer, limit, std::move(done)); });
+    if (!hits) {
+        co_return std::nullopt;
+    }
+    std::string out = "{\"results\":[";
+    for (std::size_t i = 0; i < hits->size(); ++i) {
+        if (i) out += ',';
+        append_message_json(out, (*hits)[i].message, &(*hits)[i].snippet);
+    }
+    out += "]}";
+    co_return out;
+}
+
+json Node::message_json(const MessageStore::Message& m) const {
+    const bool sent = m.direction == MessageStore::Direction::Sent;
+    json out;
+    if (!m.sender.empty()) {
+        // A group message: the peer column holds the group.
+        out = {{"msg_id", m.msg_id},
+               {"group_id", m.peer},
+               {"from", m.sender},
+               {"to", m.peer},
+               {"text", m.plaintext},
+               {"timestamp", m.timestamp},
+               {"direction", sent ? "sent" : "received"},
+               {"delivered", m.delivered},
+               {"delivery_method", m.delivery_method}};
+    } else {
+        out = {{"msg_id", m.msg_id},
+               {"from", sent ? username_ : m.peer},
+               {"to", sent ? m.peer : username_},
+               {"text", m.plaintext},
+               {"timestamp", m.timestamp},
+               {"direction", sent ? "sent" : "received"},
+               {"delivered", m.delivered},
+               {"delivery_method", m.delivery_method}};
+    }
+    if (!m.expires_at.empty()) {
+        out["expires_at"] = m.expires_at;
+    }
+    if (!m.reactions.empty()) {
+        json reactions = json::array();
+        for (const auto& r : m.reactions) {
+            reactions.push_back({{"emoji", r.emoji}, {"from", r.from.empty() ? username_ : r.from}});
+        }
+        out["reactions"] = std::move(reactions);
+    }
+    if (m.edited) {
+        out["edited"] = true;
+    }
+    if (m.deleted) {
+        out["deleted"] = true;
+    }
+    return out;
+}
+
+void Node::append_message_json(std::string& out, const MessageStore::Message& m,
+                               const std::string* snippet) const {
+    // The fields of message_json(), in the order its dump() would sort them.
+    const bool sent = m.direction == MessageStore::Direction::Sent;
+    const bool group = !m.sender.empty();
+    const auto field = [&out](std::string_view key, std::string_view value) {
+        out += ",\"";
+        out += key;
+        out += "\":";
+        json_fields::append_string(out, value);
+    };
+    out += m.deleted ? "{\"deleted\":true,\"delivered\":" : "{\"delivered\":";
+    out += m.delivered ? "true" : "false";
+    field("delivery_method", m.delivery_method);
+    field("direction", sent ? "sent" : "received");
+    if (m.edited) {
+        out += ",\"edited\":true";
+    }
+    if (!m.expires_at.empty()) {
+        field("expires_at", m.expires_at);
+    }
+    field("from", group ? m.sender : sent ? username_ : m.peer);
+    if (group) {
+        field("group_id", m.peer);
+    }
+    field("msg_id", m.msg_id);
+    if (!m.reactions.empty()) {
+        out += ",\"reactions\":[";
+        for (std::size_t i = 0; i < m.reactions.size(); ++i) {
+            out += i ? ",{\"emoji\":" : "{\"emoji\":";
+            json_fields::append_string(out, m.reactions[i].emoji);
+            out += ",\"from\":";
+            json_fields::append_string(out, m.reactions[i].from.empty() ? username_
+                                                                        : m.reactions[i].from);
+            out += '}';
+        }
+        out += ']';
+    }
+    if (snippet) {
+        field("snippet", *snippet);
+    }
+    field("text", m.plaintext);
+    field("timestamp", m.timestamp);
+    field("to", group || sent ? m.peer : username_);
+    out += '}';
+}
+
+// ─── Transports ──────────────────────────────────────────────────────────────
+
+bool Node::reachable(const PeerDirectory::Peer& peer) const {
+    return !peer.ip.empty() || !peer.lan.empty() || !peer.relay.empty() ||
+           (udp_ && !peer.udp.empty());
+}
+
+bool Node::over_udp(const PeerDirectory::Peer& peer) {
+    if (!udp_ || peer.udp.empty()) {
+        return false;
+    }
+    if (udp_->established(peer.username)) {
+        return true;
+    }
+    const auto [ip, port] = split_address(peer.udp);
+    udp_->punch(peer.username, ip, port);
+    return false;
+}
+
+bool Node::over_link(const PeerDirectory::Peer& peer) const {
+    return links_ && peer_caps_.supports(peer.username, envelope::kCapMuxV1);
+}
+
+bool Node::send_frame(const PeerDirectory::Peer& peer, std::string_view frame) {
+    if (peer.lan.empty() && over_udp(peer) && udp_->send(peer.username, frame)) {
+        return true;
+    }
+    if (dial_direct(peer)) {
+        if (peer.ip.empty() && peer.lan.empty()) {
+            return false;
+        }
+        return over_link(peer)
+            ? links_->send(username_, peer.username, peer_address(peer), frame)
+            : peer_pool_.send(peer.username, peer_address(peer), frame);
+    }
+    const auto [ip, port] = split_address(peer.relay);
+    return peer_pool_.send(relay_pool_key(peer.relay), {ip, port, {}},
+                           relay::encode_forward(peer.username, frame));
+}
+
+void Node::open_route(const PeerDirectory::Peer& peer, std::function<void(bool)> done) {
+    if (peer.lan.empty() && over_udp(peer)) {
+        done(true);
+        return;
+    }
+    if (peer.ip.empty() && peer.lan.empty() && peer.relay.empty()) {
+        done(false);
+        return;
+    }
+    if (dial_direct(peer)) {
+        if (over_link(peer)) {
+            links_->connect_async(username_, peer.username, peer_address(peer), std::move(done));
+            return;
+        }
+        peer_pool_.connect_async(peer.username, peer_address(peer), std::move(done));
+        return;
+    }
+    const auto [ip, port] = split_address(peer.relay);
+    peer_pool_.connect_async(relay_pool_key(peer.relay), {ip, port, {}}, std::move(done));
+}
+
+void Node::send_frame_async(const PeerDirectory::Peer& peer, std::string frame,
+                            std::function<void(bool ok)> done, TrafficClass cls) {
+    // No TCP fallback here: a frame lost with a dying UDP connection is
+    // resent by its own retry path (acks, file stall rounds, presence).
+    if (peer.lan.empty() && over_udp(peer)) {
+        // Bulk on its own stream, so a lost chunk never holds up a chat message.
+        const auto stream = cls == TrafficClass::Bulk ? UdpTransport::Stream::Files
+                                                      : UdpTransport::Stream::Messages;
+        udp_->send_async(peer.username, std::move(frame), stream, std::move(done));
+        return;
+    }
+    if (peer.ip.empty() && peer.lan.empty() && peer.relay.empty()) {
+        if (done) {
+            done(false);
+        }
+        return;
+    }
+    if (dial_direct(peer)) {
+        if (over_link(peer)) {
+            links_->send_async(username_, peer.username, peer_address(peer), std::move(frame),
+                               std::move(done), cls);
+            return;
+        }
+        peer_pool_.send_async(peer.username, peer_address(peer), std::move(frame), std::move(done),
+                              cls);
+        return;
+    }
+    const auto [ip, port] = split_address(peer.relay);
+    peer_pool_.send_async(relay_pool_key(peer.relay), {ip, port, {}},
+                          relay::encode_forward(peer.username, frame), std::move(done), cls);
+}
+
+void Node::verify_relay_client(const std::string& username, std::string signed_bytes,
+                               std::string signature, std::function<void(bool)> done) {
+    auto check = [this, signed_bytes = std::move(signed_bytes),
+                  signature = std::move(signature)](const PeerDirectory::Peer& peer) {
+        return !peer.signing_key.empty() && crypto_.verify(signed_bytes, signature, peer.signing_key);
+    };
+    if (auto peer = directory_.cached(username)) {
+        done(check(*peer));
+        return;
+    }
+    if (!supabase_) {
+        done(false);
+        return;
+    }
+    supabase_->async_lookup_user(username, [check = std::move(check), done = std::move(done)](
+                                               std::optional<json> row) {
+        auto peer = row ? peer_from_row(*row) : std::nullopt;
+        done(peer && check(*peer));
+    });
+}
+
+DeliveryPredictor::Signals Node::delivery_signals(const PeerDirectory::Peer& peer) const {
+    DeliveryPredictor::Signals signals;
+    if (peer.lan.empty() && udp_ && udp_->established(peer.username)) {
+        signals.connected = true;
+    } else if (dial_direct(peer)) {
+        signals.connected = over_link(peer) ? links_->has_channel(username_, peer.username)
+                                            : peer_pool_.has_connection(peer.username);
+    } else {
+        signals.connected = peer_pool_.has_connection(relay_pool_key(peer.relay));
+    }
+    signals.online = presence_.is_online(peer.username);
+    // Presence's own record is fresher than the directory's when we have one.
+    const auto seen = timestamp::parse(presence_.last_heard(peer.username).value_or(peer.last_seen));
+    if (seen) {
+        const auto ago = static_cast<int64_t>(std::time(nullptr)) - *seen;
+        signals.seen_ago = std::chrono::seconds(std::max<int64_t>(ago, 0));
+    }
+    return signals;
+}
+
+// ─── Sending ─────────────────────────────────────────────────────────────────
+
+asio::awaitable<bool> Node::send_message(std::string to_user, std::string plaintext,
+                                         std::string expires_at) {
+    auto peer = directory_.lookup(to_user);
+    if (!peer) {
+        spdlog::warn("send_message: unknown recipient {}", to_user);
+        co_return false;
+    }
+    if (prewarm_) {
+        prewarm_->contacted(to_user);
+    }
+
+    const std::string msg_id = MsgId::generate().str();
+    const std::string timestamp = envelope::now_timestamp();
+    // The timestamp is repeated inside the ciphertext, where it is signed;
+    // the envelope's copy can be rewritten in transit.
+    json payload = {{"text", plaintext}, {"msg_id", msg_id}, {"timestamp", timestamp},
+                    {"seq", next_seq(to_user)}};
+    if (!expires_at.empty()) {
+        payload["expires_at"] = expires_at;
+    }
+    MessageStore::Message record{msg_id, to_user, MessageStore::Direction::Sent,
+                                 plaintext, timestamp, false, "direct", {}, std::move(expires_at)};
+    co_return co_await send_payload(*peer, msg_id, timestamp, payload.dump(),
+                                    [this, record = std::move(record)](const char* method) mutable {
+                                        record.delivery_method = method;
+                                        store_.insert_message(std::move(record));
+                                    });
+}
+
+asio::awaitable<bool> Node::send_payload(PeerDirectory::Peer peer, std::string msg_id,
+                                         std::string timestamp, std::string body,
+                                         std::function<void(const char*)> keep) {
+    // The connect starts first and runs while the payload is sealed, so the
+    // caller waits for the slower of the two rather than for both.
+    const std::string to_user = peer.username;
+    const auto started = std::chrono::steady_clock::now();
+    std::shared_ptr<coro::Deferred<bool>> route;
+    auto path = DeliveryPredictor::Path::Direct;
+    if (reachable(peer) && delivery_) {
+        path = delivery_->choose(to_user, delivery_signals(peer));
+    }
+    if (reachable(peer) && path != DeliveryPredictor::Path::Offline) {
+        route = coro::Deferred<bool>::start([&](auto done) {
+            open_route(peer, [this, to_user, done = std::move(done)](bool ok) {
+                if (delivery_) {
+                    delivery_->record(to_user, ok);
+                }
+                done(ok);
+            });
+        });
+        announce_keys(to_user);     // ahead of anything signed with them
+    } else if (path == DeliveryPredictor::Path::Offline) {
+        predicted_offline.inc();
+    }
+
+    auto compressed = peer_caps_.supports(to_user, envelope::kCapZstdV1)
+        ? compression::compress(body, tunables_.read().compress_min_bytes) : std::nullopt;
+    if (compressed) {
+        body = std::move(*compressed);
+    }
+    const auto compression = compressed ? PayloadCompression::Zstd : PayloadCompression::None;
+    const auto seal_signed = [this, to_user, key = peer.public_key, body, compression, timestamp] {
+        return seal_message(to_user, key, body, compression, timestamp);
+    };
+
+    std::optional<Envelope> env;                // signed, once built
+    if (route) {
+        // Under the session key if one is up (one AEAD, sealed here). The
+        // signed form is then only built if the message has to go to
+        // Supabase after all.
+        auto sealed = seal_session(to_user, EnvelopeType::Message, compression, body);
+        AckTracker::Reseal reseal = seal_signed;
+        if (!sealed) {
+            start_session(peer);
+            sealed = env = co_await seal_on_worker(to_user, body.size(), seal_signed);
+            reseal = nullptr;
+        }
+        if (sealed) {
+            std::string frame = envelope::encode(*sealed, peer_caps_.format_for(to_user));
+            std::optional<bool> connected;
+            if (path == DeliveryPredictor::Path::Both) {
+                predicted_both.inc();
+            } else {
+                const auto left = offline_fallback_after_ - (std::chrono::steady_clock::now() - started);
+                connected = co_await route->get_for(
+                    std::max<std::chrono::steady_clock::duration>(left, std::chrono::milliseconds(0)));
+                if (!connected) {
+                    offline_fallbacks.inc();
+                }
+            }
+            if (!connected) {
+                // Predicted unreliable, or the connect is near its deadline:
+                // queue the offline copy now rather than once it fails.
+                // Should the connect succeed, the direct copy goes out too;
+                // the peer keeps one of the two by msg_id, and its ack
+                // marks ours delivered.
+                route->on_ready([this, peer, frame = std::move(frame)](bool ok) mutable {
+                    if (ok) {
+                        send_frame_async(peer, std::move(frame));
+                    }
+                });
+            } else if (*connected) {
+                // Tracked before the send so even an instant ack finds it pending.
+                acks_.track(msg_id, *sealed, std::move(reseal));
+                const bool sent = co_await coro::from_callback<bool>([&](auto done) {
+                    send_frame_async(peer, std::move(frame), std::move(done));
+                });
+                if (sent) {
+                    if (latency_ && peer_caps_.supports(to_user, envelope::kCapTimingV1)) {
+                        latency_->sent(msg_id, started, std::chrono::steady_clock::now());
+                    }
+                    // Stored as undelivered until the peer's ack says it is
+                    // on their disk. The ack needs a round trip plus the
+                    // peer's commit window, so it can't overtake this insert
+                    // on the DB thread.
+                    keep("direct");
+                    co_return true;
+                }
+                acks_.cancel(msg_id);
+            }
+        }
+    }
+
+    if (!env) {
+        env = co_await seal_on_worker(to_user, body.size(), seal_signed);
+    }
+    if (!env) {
+        spdlog::error("send_message: encryption for {} failed", to_user);
+        co_return false;
+    }
+    queue_offline(msg_id, to_user, *env);
+    keep("offline");
+    co_return false;
+}
+
+asio::awaitable<std::optional<json>> Node::send_delta(std::string peer, std::string target,
+                                                      std::string op, std::string value) {
+    const auto kind = delta_op(op);
+    if (!kind || target.empty() || target.size() > kMaxDeltaId ||
+        target.find(' ') != std::string::npos ||
+        (*kind == MessageStore::DeltaOp::Delete) != value.empty() ||
+        (*kind != MessageStore::DeltaOp::Edit && value.size() > kMaxEmojiBytes)) {
+        co_return std::nullopt;
+    }
+    if (!groups_.find(peer) && !directory_.known(peer)) {
+        co_return std::nullopt;
+    }
+
+    MessageStore::Delta delta{MsgId::generate().str(), std::move(target), peer, {}, *kind,
+                              std::move(value), envelope::now_timestamp()};
+    json out = {{"delta_id", delta.delta_id}};
+    bool first;
+    {
+        std::lock_guard lock(deltas_mutex_);
+        auto& batch = pending_deltas_[peer];
+        first = batch.empty();
+        batch.push_back(std::move(delta));
+    }
+    if (!first) {
+        co_return out;                          // goes out with the batch ahead of it
+    }
+    // The first delta of a batch waits out the window and takes the batch
+    // with it: a burst of reactions costs one envelope, not one each.
+    if (delta_batch_.count() > 0) {
+        asio::steady_timer timer(co_await asio::this_coro::executor, delta_batch_);
+        asio::error_code ec;
+        co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+    }
+    std::vector<MessageStore::Delta> batch;
+    {
+        std::lock_guard lock(deltas_mutex_);
+        auto it = pending_deltas_.find(peer);
+        batch = std::move(it->second);
+        pending_deltas_.erase(it);
+    }
+    co_await send_deltas(peer, std::move(batch));
+    co_return out;
+}
+
+asio::awaitable<void> Node::send_deltas(std::string peer, std::vector<MessageStore::Delta> batch) {
+    json event = on_event_ ? deltas_json(peer, batch) : json();
+    const auto group = groups_.find(peer);
+    std::optional<PeerDirectory::Peer> friend_peer;
+    if (!group) {
+        friend_peer = directory_.lookup(peer);
+    }
+
+    for (std::size_t at = 0; at < batch.size(); at += kMaxDeltaBatch) {
+        const std::string batch_id = MsgId::generate().str();
+        const std::string timestamp = envelope::now_timestamp();
+        json records = json::array();
+        for (std::size_t i = at; i < batch.size() && i < at + kMaxDeltaBatch; ++i) {
+            records.push_back(delta_record(batch[i]));
+        }
+        json payload = {{"deltas", std::move(records)}, {"msg_id", batch_id},
+                        {"timestamp", timestamp}};
+        if (group) {
+            send_group_keys(peer);
+            broadcast_group(*group, payload.dump(), timestamp);
+        } else if (friend_peer) {
+            // In the friend's seq order, so an edit never lands before the
+            // message it edits.
+            payload["seq"] = next_seq(peer);
+            co_await send_payload(*friend_peer, batch_id, timestamp, payload.dump(),
+                                  [](const char*) {});
+        }
+    }
+    // Our own copy, whether or not it reached anyone: like a sent message.
+    store_.append_deltas(std::move(batch), [this, event = std::move(event)](bool ok) {
+        if (ok) {
+            emit("message_delta", event);
+        }
+    });
+}
+
+json Node::deltas_json(const std::string& peer,
+                       const std::vector<MessageStore::Delta>& deltas) const {
+    json items = json::array();
+    for (const auto& d : deltas) {
+        items.push_back({{"delta_id", d.delta_id},
+                         {"msg_id", d.target},
+                         {"op", delta_op_name(d.op)},
+                         {"value", d.value},
+                         {"from", d.author.empty() ? username_ : d.author},
+                         {"timestamp", d.timestamp}});
+    }
+    return {{"peer", peer}, {"deltas", std::move(items)}};
+}
+
+asio::awaitable<std::optional<Envelope>> Node::seal_on_worker(
+    const std::string& to, std::size_t bytes, std::function<std::optional<Envelope>()> seal) {
+    co_return co_await coro::from_callback<std::optional<Envelope>>([&](auto done) {
+        crypto_workers_->run(to, bytes, [seal = std::move(seal), done = std::move(done)] {
+            return std::function<void()>([done, env = seal()]() mutable { done(std::move(env)); });
+        });
+    });
+}
+
+void Node::queue_offline(const std::string& msg_id, const std::string& to, const Envelope& env) {
+    // The stored row carries the whole envelope (always JSON, since we
+    // can't know which build will fetch it). The mailbox inserts it in
+    // Supabase with whatever else is waiting.
+    if (!mailbox_) {
+        spdlog::error("Could not deliver or queue message for {}", to);
+        return;
+    }
+    if (env.type != EnvelopeType::KeyUpdate) {
+        announce_keys(to, true);    // so they can check what follows
+    }
+    mailbox_->post(msg_id, to, base64::encode(envelope::encode_json(env)), [to](bool ok) {
+        if (ok) {
+            spdlog::info("{} unreachable; message queued for Supabase", to);
+        } else {
+            spdlog::error("Could not deliver or queue message for {}", to);
+        }
+    });
+}
+
+std::optional<Envelope> Node::seal_message(const std::string& to,
+                                           const std::vector<uint8_t>& public_key,
+                                           const std::string& body, PayloadCompression compression,
+                                           const std::string& timestamp) const {
+    const std::string boxed = crypto_.encrypt(body, public_key);
+    if (boxed.empty()) {
+        return std::nullopt;
+    }
+    Envelope env;
+    env.type = EnvelopeType::Message;
+    env.compression = compression;
+    env.from = username_;
+    env.to = to;
+    env.timestamp = timestamp;
+    const auto* p = reinterpret_cast<const uint8_t*>(boxed.data());
+    env.nonce.assign(p, p + crypto_box_NONCEBYTES);
+    env.ciphertext.assign(p + crypto_box_NONCEBYTES, p + boxed.size());
+    const std::string sig = crypto_.sign(std::string(boxed, crypto_box_NONCEBYTES));
+    env.signature.assign(sig.begin(), sig.end());
+    return env;
+}
+
+std::optional<Envelope> Node::seal_session(const std::string& to, EnvelopeType inner,
+                                           PayloadCompression compression,
+                                           std::string_view payload) {
+    if (!sessions_) {
+        return std::nullopt;
+    }
+    // Inner frame: type, compression, payload.
+    std::string plaintext;
+    plaintext.reserve(2 + payload.size());
+    plaintext.push_back(static_cast<char>(inner));
+    plaintext.push_back(static_cast<char>(compression));
+    plaintext.append(payload);
+    auto sealed = sessions_->seal(to, plaintext, session_aad(username_, to));
+    if (!sealed) {
+        return std::nullopt;
+    }
+    Envelope env;
+    env.type = EnvelopeType::Session;
+    env.from = username_;
+    env.to = to;
+    env.timestamp = envelope::now_timestamp();
+    env.nonce = std::move(sealed->nonce);
+    env.ciphertext = std::move(sealed->ciphertext);
+    return env;
+}
+
+// ─── Receiving ───────────────────────────────────────────────────────────────
+
+void Node::on_direct_frame(const std::string& remote, std::string_view frame) {
+    heartbeat_.reached();
+    on_frame(remote, frame);
+}
+
+void Node::on_frame(const std::string& remote, std::string_view frame) {
+    watchdog::Tag busy("node.on_frame");
+    trace::Span span("node", "on_frame", trace::current());
+    const auto parse_start = std::chrono::steady_clock::now();
+    const auto format = envelope::detect(frame);
+    auto env = format ? envelope::decode(frame) : std::nullopt;
+    parse_seconds.record(std::chrono::steady_clock::now() - parse_start);
+    if (!env) {
+        malformed_frames.inc();
+        spdlog::warn("Malformed frame from {}", remote);
+        return;
+    }
+    // Every handler below needs the sender's keys from the directory, and
+    // never fetches them; drop a stranger (or a spoofed name) before it
+    // costs a verification or a table entry, then hold the rest to a rate.
+    if (env->from == username_) {
+        // Another of our devices: all that comes from them is sync (and
+        // the pool's hello). Checked against our own key, so no directory.
+        if (env->type == EnvelopeType::Sync && admission_->admit_sender(env->sender)) {
+            peer_usage::of(username_).received(frame.size());
+            receive_device_sync(std::move(*env));
+        }
+        return;
+    }
+    if (!directory_.known(env->from)) {
+        unknown_sender_frames.inc();
+        spdlog::debug("Dropping frame from {} ({}): unknown sender", env->from, remote);
+        return;
+    }
+    // Only now: a stranger's name would add a table entry per spoofed sender.
+    peer_usage::of(env->from).received(frame.size());
+    if (!admission_->admit_sender(env->sender)) {
+        return;
+    }
+    peer_caps_.observe(*env, *format);
+
+    switch (env->type) {
+    case EnvelopeType::Message:
+        receive_direct(std::move(*env));
+        break;
+    case EnvelopeType::Ack:
+        on_ack_received(*env);
+        break;
+    case EnvelopeType::Hello:
+        spdlog::debug("hello from {} ({}), capabilities {:#x}", env->from, remote, env->capabilities);
+        announce_keys(env->from);
+        break;
+    case EnvelopeType::Ping:
+        on_ping_received(*env);
+        break;
+    case EnvelopeType::FileOffer:
+        on_file_offer(*env);
+        break;
+    case EnvelopeType::FileChunk:
+        transfers_.on_chunk(env->from, std::move(env->ciphertext));
+        break;
+    case EnvelopeType::FileAck:
+        if (verify_file_control(*env)) {
+            mark_active(env->from);
+            transfers_.on_ack(env->from, std::move(env->ciphertext));
+        }
+        break;
+    case EnvelopeType::FileCancel:
+        if (verify_file_control(*env)) {
+            transfers_.on_cancel(env->from, std::move(env->ciphertext));
+        }
+        break;
+    case EnvelopeType::GroupKey:
+        on_group_key(*env);
+        break;
+    case EnvelopeType::GroupMessage:
+        receive_group(std::move(*env));
+        break;
+    case EnvelopeType::KeyExchange:
+        on_key_exchange(*env);
+        break;
+    case EnvelopeType::KeyUpdate:
+        on_key_update(*env);
+        break;
+    case EnvelopeType::Session:
+        receive_session(std::move(*env));
+        break;
+    default:
+        spdlog::warn("Unknown envelope type from {}", remote);
+        break;
+    }
+}
+
+bool Node::on_message_received(const Envelope& env, DurableCallback on_durable) {
+    const auto keys = directory_.keys(env.from);
+    if (!keys) {
+        spdlog::warn("Dropping message from {}: not a friend", env.from);
+        return false;
+    }
+
+    auto result = open_signed(env, *keys);
+    return deliver_received(env, result, std::move(on_durable));
+}
+
+void Node::receive_direct(Envelope env) {
+    // One cache line of keys from the friend table rides along to the
+    // worker, rather than a copy of the whole directory entry.
+    const auto keys = directory_.keys(env.from);
+    if (!keys) {
+        spdlog::warn("Dropping message from {}: not a friend", env.from);
+        return;
+    }
+    const std::string from = env.from;
+    const std::size_t bytes = env.ciphertext.size();
+    const auto arrived = std::chrono::steady_clock::now();
+    auto trace = logging::tracing() ? std::make_shared<logging::MessageTrace>(from) : nullptr;
+    crypto_workers_->run(from, bytes, [this, env = std::move(env), keys = *keys, arrived,
+                                      trace = std::move(trace), flow = trace::current()] {
+        trace::Span span("crypto", "open", flow);
+        if (trace) trace->stage("queue");
+        auto result = open_signed(env, keys);
+        if (trace) {
+            trace->stage("verify", result.verify_time);
+            trace->stage("decrypt", result.decrypt_time);
+        }
+        return std::function<void()>([this, env, result = std::move(result), trace, flow, arrived] {
+            trace::Span span("node", "deliver", flow);
+            deliver_received(env, result, [this, from = env.from, arrived](const std::string& msg_id) {
+                send_ack(from, msg_id, std::chrono::steady_clock::now() - arrived);
+            }, trace);
+        });
+    });
+}
+
+bool Node::deliver_received(const Envelope& env, const CryptoManager::OpenResult& result,
+                            DurableCallback on_durable,
+                            std::shared_ptr<logging::MessageTrace> trace) {
+    auto accepted = accept_plaintext(env, result);
+    if (!accepted) {
+        if (trace) {
+            trace->set_result(result.status == CryptoManager::OpenStatus::Ok ? "rejected"
+                              : result.status == CryptoManager::OpenStatus::BadSignature
+                                  ? "bad_signature" : "decrypt_failed");
+        }
+        return false;
+    }
+
+    mark_active(env.from);
+    if (prewarm_) {
+        prewarm_->contacted(env.from);
+    }
+
+    const std::string id = accepted->message.msg_id;
+    if (trace) trace->set_msg_id(id);
+    const auto seq = accepted->seq;
+    auto record = [this, from = env.from, id, accepted = std::move(*accepted),
+                   on_durable = std::move(on_durable), trace = std::move(trace),
+                   flow = trace::current()]() mutable {
+        if (trace) trace->stage("reorder");
+        auto event = accepted_event(accepted);
+        const auto queued = flow ? trace::Clock::now() : trace::Clock::time_point{};
+        record_accepted(std::move(accepted), [this, from, id, event = std::move(event),
+                                              on_durable = std::move(on_durable),
+                                              trace = std::move(trace), flow, queued](auto status) {
+            trace::complete("store", "record_received", queued, flow);
+            if (trace) trace->stage("store");
+            switch (status) {
+            case MessageStore::InsertResult::Inserted: {
+                spdlog::info("Message from {} ({})", from, id);
+                trace::Span span("ui", "notify", flow);
+                emit(event.first, event.second);
+                if (trace) {
+                    trace->stage("notify");
+                    trace->set_result("stored");
+                }
+                break;
+            }
+            case MessageStore::InsertResult::Duplicate:
+                // Already stored: most likely a retransmit after a lost ack.
+                spdlog::warn("Dropping replayed message {} from {}", id, from);
+                if (trace) trace->set_result("duplicate");
+                break;
+            case MessageStore::InsertResult::Failed:
+                spdlog::error("Could not store message {} from {}", id, from);
+                if (trace) trace->set_result("store_failed");
+                return;
+            }
+            if (on_durable) {
+                on_durable(id);
+            }
+        });
+    };
+    if (reorder_ && seq) {
+        if (reorder_->offer(env.sender, *seq, std::move(record))) {
+            asio::post(reorder_timer_.get_executor(), [this] { arm_reorder_timer(); });
+        }
+    } else {
+        record();
+    }
+    return true;
+}
+
+void Node::send_ack(const std::string& to, const std::string& msg_id,
+                    std::optional<std::chrono::steady_clock::duration> held) {
+    auto peer = directory_.cached(to);
+    if (!peer || !reachable(*peer)) {
+        return;
+    }
+    std::string body = msg_id;
+    if (held && peer_caps_.supports(to, envelope::kCapTimingV1)) {
+        const auto us = std::chrono::duration_cast<std::chrono::microseconds>(*held).count();
+        body += '\0';
+        body += std::to_string(us);
+    }
+    if (auto sealed = seal_session(to, EnvelopeType::Ack, PayloadCompression::None, body)) {
+        send_frame_async(*peer, envelope::encode(*sealed, peer_caps_.format_for(to)), {},
+                         TrafficClass::Control);
+        return;
+    }
+    Envelope ack;
+    ack.type = EnvelopeType::Ack;
+    ack.from = username_;
+    ack.to = to;
+    ack.timestamp = envelope::now_timestamp();
+    ack.ack_msg_id = msg_id;
+    const std::string sig = crypto_.sign(msg_id);
+    ack.signature.assign(sig.begin(), sig.end());
+    send_frame_async(*peer, envelope::encode(ack, peer_caps_.format_for(to)), {},
+                     TrafficClass::Control);
+}
+
+void Node::on_ack_received(const Envelope& env) {
+    const auto keys = directory_.keys(env.from);
+    if (!keys || env.ack_msg_id.empty() ||
+        !crypto_.verify(env.ack_msg_id, std::string(env.signature.begin(), env.signature.end()),
+                        keys->signing_key)) {
+        spdlog::warn("Ignoring unverifiable ack from {}", env.from);
+        return;
+    }
+    acknowledged(env.from, env.ack_msg_id);
+}
+
+void Node::acknowledged(const std::string& from, const std::string& msg_id) {
+    mark_active(from);
+    acks_.acknowledge(msg_id);
+    store_.mark_delivered(msg_id, [this, from, msg_id](bool ok) {
+        if (ok) {
+            spdlog::debug("{} acknowledged {}", from, msg_id);
+            emit("delivered", json{{"peer", from}, {"msg_id", msg_id}});
+        }
+    });
+}
+
+// ─── Sessions ────────────────────────────────────────────────────────────────
+
+void Node::start_session(const PeerDirectory::Peer& peer) {
+    if (!sessions_) {
+        return;
+    }
+    if (auto body = sessions_->initiate(peer.username,
+                                        peer_caps_.supports(peer.username, envelope::kCapAeadV1))) {
+        send_key_exchange(peer, *body);
+    }
+}
+
+void Node::send_key_exchange(const PeerDirectory::Peer& peer, const std::string& body) {
+    Envelope env;
+    env.type = EnvelopeType::KeyExchange;
+    env.from = username_;
+    env.to = peer.username;
+    env.timestamp = envelope::now_timestamp();
+    env.ciphertext.assign(body.begin(), body.end());
+    // Resume steps carry a MAC under the ticket's secret instead.
+    if (const auto phase = PeerSessions::phase(env.ciphertext);
+        phase && PeerSessions::is_signed(*phase)) {
+        const std::string sig =
+            crypto_.sign(PeerSessions::signed_bytes(username_, peer.username, env.ciphertext));
+        env.signature.assign(sig.begin(), sig.end());
+    }
+    send_frame_async(peer, envelope::encode(env, peer_caps_.format_for(peer.username)), {},
+                     TrafficClass::Control);
+}
+
+void Node::on_key_exchange(const Envelope& env) {
+    const auto phase = PeerSessions::phase(env.ciphertext);
+    if (!sessions_ || !phase || env.to != username_) {
+        return;
+    }
+    auto peer = directory_.cached(env.from);
+    if (!peer || peer->signing_key.empty() ||
+        (PeerSessions::is_signed(*phase) &&
+         !crypto_.verify(PeerSessions::signed_bytes(env.from, env.to, env.ciphertext),
+                         std::string(env.signature.begin(), env.signature.end()),
+                         peer->signing_key))) {
+        spdlog::warn("Ignoring unverifiable key exchange from {}", env.from);
+        return;
+    }
+    switch (*phase) {
+    case PeerSessions::Phase::Init:
+        if (auto reply = sessions_->accept(env.from, env.ciphertext); reply && reachable(*peer)) {
+            send_key_exchange(*peer, *reply);
+        }
+        break;
+    case PeerSessions::Phase::Accept:
+        if (sessions_->complete(env.from, env.ciphertext)) {
+            spdlog::debug("Session with {} established", env.from);
+        }
+        break;
+    case PeerSessions::Phase::Resume:
+        if (auto reply = sessions_->resume(env.from, env.ciphertext); reply && reachable(*peer)) {
+            send_key_exchange(*peer, *reply);
+        }
+        break;
+    case PeerSessions::Phase::Resumed:
+        if (sessions_->resumed(env.from, env.ciphertext)) {
+            spdlog::debug("Session with {} resumed", env.from);
+        }
+        break;
+    case PeerSessions::Phase::Reject:
+        if (sessions_->rejected(env.from, env.ciphertext) && reachable(*peer)) {
+            start_session(*peer);               // signed, this time
+        }
+        break;
+    }
+}
+
+void Node::announce_keys(const std::string& to, bool offline) {
+    if (key_update_.empty() || key_update_until_ <= static_cast<int64_t>(std::time(nullptr))) {
+        return;
+    }
+    {
+        // Live, at most hourly; into the mailbox, once per run.
+        const auto now = std::chrono::steady_clock::now();
+        std::lock_guard lock(key_update_mutex_);
+        auto& sent = offline ? key_update_queued_ : key_update_sent_;
+        auto [it, fresh] = sent.try_emplace(to, now);
+        if (!fresh && (offline || now - it->second < std::chrono::hours(1))) {
+            return;
+        }
+        it->second = now;
+    }
+    Envelope env;
+    env.type = EnvelopeType::KeyUpdate;
+    env.from = username_;
+    env.to = to;
+    env.timestamp = envelope::now_timestamp();
+    env.ciphertext.assign(key_update_.begin(), key_update_.begin() + key_rotation::kBodySize);
+    env.signature.assign(key_update_.begin() + key_rotation::kBodySize, key_update_.end());
+    if (offline) {
+        queue_offline(MsgId::generate().str(), to, env);
+        return;
+    }
+    if (auto peer = directory_.cached(to); peer && reachable(*peer)) {
+        send_frame_async(*peer, envelope::encode(env, peer_caps_.format_for(to)), {},
+                         TrafficClass::Control);
+    }
+}
+
+void Node::on_key_update(const Envelope& env) {
+    const auto keys = directory_.keys(env.from);
+    const auto update = key_rotation::parse(env.from, env.ciphertext);
+    if (!keys || !update) {
+        spdlog::warn("Ignoring malformed key update from {}", env.from);
+        return;
+    }
+    if (update->public_key == keys->public_key && update->signing_key == keys->signing_key) {
+        return;     // a repeat of one already taken
+    }
+    // Only the key we pin can hand over to the next one.
+    if (!crypto_.verify(key_rotation::signed_bytes(env.from, env.ciphertext),
+                        std::string(env.signature.begin(), env.signature.end()),
+                        keys->signing_key)) {
+        spdlog::warn("Ignoring unverifiable key update from {}", env.from);
+        return;
+    }
+    const auto peer = directory_.rotate_keys(
+        env.from, FriendKeys::Keys{update->public_key, update->signing_key}, update->until);
+    if (!peer) {
+        return;
+    }
+    store_.upsert_friend({peer->username, peer->public_key, peer->signing_key,
+                          join_address(peer->ip, peer->port), peer->last_seen, ""});
+    crypto_workers_->run(env.from, crypto_box_PUBLICKEYBYTES,
+                         [this, key = peer->public_key] {
+                             crypto_.warm_shared_keys({key});
+                             return std::function<void()>();
+                         }, TrafficClass::Bulk);
+    spdlog::info("{} rotated their keys; the old ones are accepted until {}", env.from,
+                 timestamp::format(update->until));
+}
+
+CryptoManager::OpenResult Node::open_signed(const Envelope& env,
+                                            const FriendKeys::Keys& keys) const {
+    const CryptoManager::OpenRequest request{env.nonce, env.ciphertext, env.signature,
+                                             keys.public_key, keys.signing_key};
+    auto result = crypto_.open_batch(std::span(&request, 1), 1).front();
+    if (result.status != CryptoManager::OpenStatus::Ok) {
+        if (const auto old = directory_.retired(env.from)) {
+            const CryptoManager::OpenRequest again{env.nonce, env.ciphertext, env.signature,
+                                                   old->public_key, old->signing_key};
+            if (auto retry = crypto_.open_batch(std::span(&again, 1), 1).front();
+                retry.status == CryptoManager::OpenStatus::Ok) {
+                result = std::move(retry);
+            }
+        }
+    }
+    return result;
+}
+
+void Node::receive_session(Envelope env) {
+    if (!sessions_ || env.to != username_) {
+        return;
+    }
+    const std::string from = env.from;
+    const std::size_t bytes = env.ciphertext.size();
+    const auto arrived = std::chrono::steady_clock::now();
+    crypto_workers_->run(from, bytes, [this, env = std::move(env), arrived]() mutable {
+        auto plaintext = sessions_->open(env.from, env.nonce, env.ciphertext,
+                                         session_aad(env.from, env.to));
+        return std::function<void()>([this, env = std::move(env), arrived,
+                                      plaintext = std::move(plaintext)]() mutable {
+            if (!plaintext || plaintext->size() < 2) {
+                spdlog::debug("Dropping session frame from {}: no session to open it", env.from);
+                // Most likely we restarted and they kept sending on the old
+                // session; a new handshake retires it at their end.
+                if (auto peer = directory_.cached(env.from); peer && reachable(*peer)) {
+                    start_session(*peer);
+                }
+                return;
+            }
+            const auto inner = static_cast<EnvelopeType>((*plaintext)[0]);
+            const auto compression = static_cast<PayloadCompression>((*plaintext)[1]);
+            plaintext->erase(0, 2);
+            if (inner == EnvelopeType::Ack) {
+                // timing_v1: "<msg_id>\0<microseconds the peer held it>".
+                if (const auto nul = plaintext->rfind('\0'); nul != std::string::npos) {
+                    uint64_t us = 0;
+                    const char* digits = plaintext->data() + nul + 1;
+                    const char* end = plaintext->data() + plaintext->size();
+                    if (digits != end && std::from_chars(digits, end, us).ptr == end) {
+                        plaintext->resize(nul);
+                        if (latency_) {
+                            latency_->acked(*plaintext, std::chrono::microseconds(us), arrived);
+                        }
+                    }
+                }
+                acknowledged(env.from, *plaintext);
+            } else if (inner == EnvelopeType::Message &&
+                       (compression == PayloadCompression::None ||
+                        compression == PayloadCompression::Zstd)) {
+                env.type = EnvelopeType::Message;
+                env.compression = compression;
+                CryptoManager::OpenResult result;
+                result.status = CryptoManager::OpenStatus::Ok;
+                result.plaintext = std::move(*plaintext);
+                deliver_received(env, result, [this, from = env.from, arrived](const std::string& msg_id) {
+                    send_ack(from, msg_id, std::chrono::steady_clock::now() - arrived);
+                });
+            } else if (inner == EnvelopeType::Signal) {
+                on_signal(env.from, *plaintext);
+            } else {
+                spdlog::warn("Unknown session frame from {}", env.from);
+            }
+        });
+    });
+}
+
+// ─── Typing and read receipts ────────────────────────────────────────────────
+
+void Node::send_typing(const std::string& to, bool typing) {
+    if (typing) {
+        prewarm(to);
+    }
+    offer_signal({to, SignalGate::Kind::Typing, typing ? "1" : "0"});
+}
+
+void Node::send_read_receipt(const std::string& peer, const std::string& msg_id) {
+    if (msg_id.empty() || msg_id.size() > 64) {
+        return;
+    }
+    store_.mark_read(peer, msg_id);
+    offer_signal({peer, SignalGate::Kind::Read, msg_id});
+}
+
+void Node::offer_signal(SignalGate::Signal signal) {
+    // Nobody to tell: not a friend we can reach, offline, or a build that
+    // would not open the frame.
+    if (!sessions_ || !directory_.known(signal.peer) || !presence_.is_online(signal.peer) ||
+        !peer_caps_.supports(signal.peer, envelope::kCapSignalV1)) {
+        return;
+    }
+    if (signals_.offer(signal)) {
+        transmit_signal(signal);
+    } else {
+        asio::post(signal_timer_.get_executor(), [this] { arm_signal_timer(); });
+    }
+}
+
+void Node::transmit_signal(const SignalGate::Signal& signal) {
+    auto peer = directory_.cached(signal.peer);
+    if (!peer || !reachable(*peer)) {
+        return;
+    }
+    std::string body;
+    body.push_back(static_cast<char>(signal.kind));
+    body.append(signal.value);
+    auto sealed = seal_session(signal.peer, EnvelopeType::Signal, PayloadCompression::None, body);
+    if (!sealed) {
+        // Not worth a signed frame; the next message brings a session up.
+        return;
+    }
+    signals_sent.inc();
+    send_frame_async(*peer, envelope::encode(*sealed, peer_caps_.format_for(signal.peer)), {});
+}
+
+void Node::arm_signal_timer() {
+    const auto due = signals_.next_due();
+    if (!due || stopping_.load()) {
+        return;
+    }
+    signal_timer_.expires_at(*due);
+    signal_timer_.async_wait([this](const asio::error_code& ec) {
+        if (ec) {
+            return;                     // re-armed or stopped
+        }
+        for (const auto& signal : signals_.flush()) {
+            transmit_signal(signal);
+        }
+        arm_signal_timer();
+    });
+}
+
+std::string Node::next_seq(const std::string& to) {
+    std::lock_guard lock(seq_mutex_);
+    return ReorderBuffer::format({seq_run_, ++next_seq_[to]});
+}
+
+void Node::arm_reorder_timer() {
+    const auto due = reorder_->next_deadline();
+    if (!due || stopping_.load()) {
+        return;
+    }
+    reorder_timer_.expires_at(*due);
+    reorder_timer_.async_wait([this](const asio::error_code& ec) {
+        if (ec) {
+            return;                     // re-armed or stopped
+        }
+        reorder_->expire();
+        arm_reorder_timer();
+    });
+}
+
+void Node::on_signal(const std::string& from, std::string_view body) {
+    if (body.empty()) {
+        return;
+    }
+    SignalGate::Signal signal{from, static_cast<SignalGate::Kind>(body[0]),
+                              std::string(body.substr(1))};
+    json data;
+    if (signal.kind == SignalGate::Kind::Typing && (signal.value == "0" || signal.value == "1")) {
+        data = {{"username", from}, {"typing", signal.value == "1"}};
+    } else if (signal.kind == SignalGate::Kind::Read && !signal.value.empty() &&
+               signal.value.size() <= 64) {
+        data = {{"username", from}, {"msg_id", signal.value}};
+    } else {
+        spdlog::debug("Ignoring unknown signal from {}", from);
+        return;
+    }
+    mark_active(from);
+    if (signals_.received(signal)) {
+        signals_received.inc();
+        emit(signal.kind == SignalGate::Kind::Typing ? "typing" : "read", data);
+    }
+}
+
+// ─── Files ───────────────────────────────────────────────────────────────────
+
+std::optional<std::string> Node::send_file(const std::string& to_user, const std::string& path) {
+    auto peer = directory_.lookup(to_user);
+    if (!peer || !reachable(*peer)) {
+        // Files have no offline fallback: Supabase is no place for them.
+        spdlog::warn("send_file: {} has no known address", to_user);
+        return std::nullopt;
+    }
+    return transfers_.send(to_user, path);
+}
+
+bool Node::accept_file(const std::string& transfer_id) {
+    return transfers_.accept(transfer_id);
+}
+
+bool Node::cancel_file(const std::string& transfer_id) {
+    return transfers_.cancel(transfer_id);
+}
+
+void Node::send_file_offer(const std::string& to, const FileTransfers::Offer& offer) {
+    auto peer = directory_.cached(to);
+    if (!peer || !reachable(*peer)) {
+        return;                         // the next stall round offers again
+    }
+    std::string payload = FileTransfers::offer_payload(offer);
+    const std::string boxed = crypto_.encrypt(payload, peer->public_key);
+    sodium_memzero(payload.data(), payload.size());
+    if (boxed.empty()) {
+        spdlog::error("send_file: encryption for {} failed", to);
+        return;
+    }
+    Envelope env;
+    env.type = EnvelopeType::FileOffer;
+    env.from = username_;
+    env.to = to;
+    env.timestamp = envelope::now_timestamp();
+    const auto* p = reinterpret_cast<const uint8_t*>(boxed.data());
+    env.nonce.assign(p, p + crypto_box_NONCEBYTES);
+    env.ciphertext.assign(p + crypto_box_NONCEBYTES, p + boxed.size());
+    const std::string sig = crypto_.sign(std::string(boxed, crypto_box_NONCEBYTES));
+    env.signature.assign(sig.begin(), sig.end());
+    send_frame_async(*peer, envelope::encode(env, peer_caps_.format_for(to)), {},
+                     TrafficClass::Control);
+}
+
+void Node::send_file_frame(const std::string& to, EnvelopeType type, std::string body) {
+    auto peer = directory_.cached(to);
+    if (!peer || !reachable(*peer)) {
+        return;
+    }
+    Envelope env;
+    env.type = type;
+    env.from = username_;
+    env.to = to;
+    env.timestamp = envelope::now_timestamp();
+    env.ciphertext.assign(body.begin(), body.end());
+    // Chunks are authenticated by their stream; only the control frames,
+    // which anyone could forge otherwise, carry a signature.
+    if (type != EnvelopeType::FileChunk) {
+        const std::string sig = crypto_.sign(file_control_signed_bytes(env));
+        env.signature.assign(sig.begin(), sig.end());
+    }
+    // Chunks are bulk; the acks and cancels that pace them are not.
+    send_frame_async(*peer, envelope::encode(env, peer_caps_.format_for(to)), {},
+                     type == EnvelopeType::FileChunk ? TrafficClass::Bulk : TrafficClass::Control);
+}
+
+void Node::on_file_offer(const Envelope& env) {
+    auto peer = directory_.cached(env.from);
+    if (!peer || peer->signing_key.empty()) {
+        spdlog::warn("Dropping file offer from {}: not a friend", env.from);
+        return;
+    }
+    const CryptoManager::OpenRequest request{env.nonce, env.ciphertext, env.signature,
+                                             peer->public_key, peer->signing_key};
+    auto result = crypto_.open_batch(std::span(&request, 1), 1).front();
+    auto offer = result.status == CryptoManager::OpenStatus::Ok
+        ? FileTransfers::parse_offer(result.plaintext) : std::nullopt;
+    sodium_memzero(result.plaintext.data(), result.plaintext.size());
+    if (!offer) {
+        spdlog::warn("Rejected file offer from {}", env.from);
+        return;
+    }
+    mark_active(env.from);
+    transfers_.on_offer(env.from, std::move(*offer));
+}
+
+bool Node::verify_file_control(const Envelope& env) {
+    auto peer = directory_.cached(env.from);
+    if (!peer || peer->signing_key.empty() || env.to != username_ ||
+        !crypto_.verify(file_control_signed_bytes(env),
+                        std::string(env.signature.begin(), env.signature.end()),
+                        peer->signing_key)) {
+        spdlog::debug("Ignoring unverifiable {} from {}", envelope::type_name(env.type), env.from);
+        return false;
+    }
+    return true;
+}
+
+void Node::retransmit(const std::string& msg_id, const Envelope& env) {
+    auto peer = directory_.cached(env.to);
+    if (!peer || !reachable(*peer)) {
+        return;                         // counts as a try; the next may find an address
+    }
+    spdlog::debug("Retransmitting {} to {}", msg_id, env.to);
+    if (env.type == EnvelopeType::Session && !(sessions_ && sessions_->current(env.to, env.nonce))) {
+        // The session it went out on has been replaced; they may no longer
+        // hold its keys. Signed from now on.
+        if (auto resealed = acks_.reseal(msg_id)) {
+            send_frame_async(*peer, envelope::encode(*resealed, peer_caps_.format_for(env.to)));
+        }
+        return;
+    }
+    send_frame_async(*peer, envelope::encode(env, peer_caps_.format_for(env.to)));
+}
+
+void Node::give_up_direct(const std::string& msg_id, Envelope env) {
+    if (!mailbox_) {
+        spdlog::warn("{} never acknowledged {}; no offline queue to fall back to", env.to, msg_id);
+        return;
+    }
+    spdlog::info("{} never acknowledged {}; queuing it for Supabase", env.to, msg_id);
+    // A copy that did arrive is dropped by the peer as a replay.
+    mailbox_->post(msg_id, env.to, base64::encode(envelope::encode_json(env)),
+                   [this, msg_id, to = env.to](bool ok) {
+        if (ok) {
+            store_.set_delivery_method(msg_id, "offline");
+        } else {
+            spdlog::error("Could not queue unacknowledged message {} for {}", msg_id, to);
+        }
+    });
+}
+
+std::optional<Node::Accepted> Node::accept_plaintext(const Envelope& env,
+                                                     const CryptoManager::OpenResult& result) {
+    if (result.status != CryptoManager::OpenStatus::Ok) {
+        spdlog::warn("Rejected message from {}: {}", env.from,
+                     result.status == CryptoManager::OpenStatus::BadSignature
+                         ? "bad signature" : "decryption failed");
+        return std::nullopt;
+    }
+
+    std::optional<std::string> inflated;
+    if (env.compression == PayloadCompression::Zstd) {
+        inflated = compression::decompress(result.plaintext);
+        if (!inflated) {
+            spdlog::warn("Message from {} has a payload that doesn't decompress", env.from);
+            return std::nullopt;
+        }
+    }
+    const std::string& plaintext = inflated ? *inflated : result.plaintext;
+
+    std::string text, msg_id, timestamp, seq, expires_at;
+    std::vector<std::string> records;
+    bool has_text = false, has_msg_id = false, has_timestamp = false, has_seq = false;
+    bool has_deltas = false;
+    const json_fields::Field fields[] = {
+        {"text", &text, nullptr, &has_text},
+        {"msg_id", &msg_id, nullptr, &has_msg_id},
+        {"timestamp", &timestamp, nullptr, &has_timestamp},
+        {"seq", &seq, nullptr, &has_seq},
+        {"expires_at", &expires_at, nullptr, nullptr},
+        {"deltas", nullptr, &records, &has_deltas},
+    };
+    if (!json_fields::read(plaintext, fields) || !(has_text || has_deltas) || !has_msg_id) {
+        spdlog::warn("Message from {} has a malformed payload", env.from);
+        return std::nullopt;
+    }
+
+    // Older builds don't sign a timestamp; their ids are simply never pruned.
+    bool signed_timestamp = false;
+    if (has_timestamp) {
+        const auto sent = envelope::parse_timestamp(timestamp);
+        const auto now = static_cast<int64_t>(std::time(nullptr));
+        if (!sent || *sent < now - replay_window_.count() || *sent > now + tunables_.read().max_clock_skew.count()) {
+            spdlog::warn("Rejected message from {}: timestamp outside the replay window", env.from);
+            return std::nullopt;
+        }
+        signed_timestamp = true;
+    } else {
+        timestamp = env.timestamp;
+    }
+    if (!expires_at.empty()) {
+        // The sender's choice, signed with the text. One that isn't a time
+        // is dropped: the message is kept rather than lost.
+        const auto at = envelope::parse_timestamp(expires_at);
+        expires_at = at ? envelope::format_timestamp(*at) : std::string();
+    }
+    Accepted accepted{{std::move(msg_id), env.from, MessageStore::Direction::Received,
+                       std::move(text), std::move(timestamp), true, "direct", {},
+                       std::move(expires_at)},
+                      signed_timestamp};
+    if (env.type == EnvelopeType::GroupMessage) {
+        // Kept in the group's conversation, under its author.
+        accepted.message.peer = env.to;
+        accepted.message.sender = env.from;
+    } else if (has_seq) {
+        // Malformed is as good as absent: the message is just not reordered.
+        accepted.seq = ReorderBuffer::parse(seq);
+    }
+    if (has_deltas) {
+        // A delta batch: its msg_id only guards against a replay. Records
+        // this build can't read are skipped, the rest still count.
+        const auto& m = accepted.message;
+        for (std::size_t i = 0; i < records.size() && i < kMaxDeltaBatch; ++i) {
+            if (auto d = parse_delta_record(records[i])) {
+                d->peer = m.peer;
+                d->author = m.sender.empty() ? m.peer : m.sender;
+                d->timestamp = m.timestamp;
+                accepted.deltas.push_back(std::move(*d));
+            }
+        }
+        if (accepted.deltas.empty()) {
+            spdlog::warn("Delta batch from {} has no readable records", env.from);
+            return std::nullopt;
+        }
+    }
+    return accepted;
+}
+
+void Node::record_accepted(Accepted accepted, MessageStore::InsertCallback done) {
+    if (accepted.deltas.empty()) {
+        store_.record_received(std::move(accepted.message), accepted.signed_timestamp,
+                               std::move(done));
+    } else {
+        store_.record_deltas(std::move(accepted.message.msg_id),
+                             std::move(accepted.message.timestamp), accepted.signed_timestamp,
+                             std::move(accepted.deltas), std::move(done));
+    }
+}
+
+std::pair<std::string_view, json> Node::accepted_event(const Accepted& accepted) const {
+    if (!on_event_) {
+        return {};
+    }
+    if (accepted.deltas.empty()) {
+        return {"new_message", message_json(accepted.message)};
+    }
+    return {"message_delta", deltas_json(accepted.message.peer, accepted.deltas)};
+}
+
+bool Node::fetch_offline_messages() {
+    if (!supabase_) {
+        return false;
+    }
+    std::lock_guard lock(offline_mutex_);
+    // Three stages overlap: while a page is decoded and opened here, the
+    // next is already on its way from Supabase and the one before is being
+    // committed on the DB thread. Each page is settled one call late, so
+    // its acks go out a page late too; the last page's are deleted below.
+    std::optional<OfflineStage> previous;
+    BacklogCounts counts;
+    auto delivered = supabase_->fetch_offline_messages_paged(
+        username_, [&](const std::vector<SupabaseClient::OfflineMessage>& page) {
+            auto staged = stage_offline_page(page, false);
+            std::vector<std::string> acks;
+            if (previous) {
+                acks = settle_offline_page(*previous, &counts);
+            }
+            previous = std::move(staged);
+            return acks;
+        });
+    if (previous) {
+        const auto acks = settle_offline_page(*previous, &counts);
+        if (!acks.empty() && !supabase_->delete_offline_messages(acks)) {
+            spdlog::warn("Could not delete {} handled offline messages; they will be "
+                         "delivered again next time", acks.size());
+        }
+    }
+    if (delivered) {
+        spdlog::info("Processed {} offline message(s)", *delivered);
+    }
+    // One event for the whole backlog: thousands of new_message pushes
+    // would overrun a UI's send queue (websocket-events-guide.md §4.3).
+    if (!counts.empty()) {
+        std::size_t total = 0;
+        json peers = json::object();
+        for (const auto& [peer, n] : counts) {
+            total += n;
+            peers[peer] = n;
+        }
+        emit("backlog_loaded", json{{"count", total}, {"peers", std::move(peers)}});
+    }
+    return delivered.has_value();
+}
+
+Node::OfflineStage Node::stage_offline_page(
+    const std::vector<SupabaseClient::OfflineMessage>& page, bool announce) {
+    // Decode the page, then verify + decrypt it as one parallel batch.
+    std::vector<Envelope> envs;
+    std::vector<FriendKeys::Keys> senders;
+    std::vector<std::size_t> rows;          // page index of each envelope
+    envs.reserve(page.size());
+    senders.reserve(page.size());
+    for (std::size_t r = 0; r < page.size(); ++r) {
+        const auto& row = page[r];
+        // A pack row holds several envelopes, each checked on its own.
+        std::vector<Envelope> row_envs;
+        if (mailbox_pack::is_pack(row.ciphertext)) {
+            if (auto unpacked = mailbox_pack::unpack(row.ciphertext)) {
+                row_envs = std::move(*unpacked);
+            }
+        } else if (std::string raw; base64::decode(row.ciphertext, raw)) {
+            if (auto env = envelope::decode(raw)) {
+                row_envs.push_back(std::move(*env));
+            }
+        }
+        if (row_envs.empty()) {
+            spdlog::warn("Dropping undeliverable offline message {} from {}", row.id, row.from_user);
+        }
+        for (auto& env : row_envs) {
+            // A sender who rotated their keys queues the update ahead of
+            // what it signed with the new ones; take it before looking
+            // anyone's keys up.
+            if (env.type == EnvelopeType::KeyUpdate) {
+                on_key_update(env);
+                continue;
+            }
+            envs.push_back(std::move(env));
+            rows.push_back(r);
+        }
+    }
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < envs.size(); ++i) {
+        const auto keys = directory_.keys(envs[i].from);
+        if (envs[i].type != EnvelopeType::Message || !keys) {
+            spdlog::warn("Dropping undeliverable offline message {} from {}", page[rows[i]].id,
+                         page[rows[i]].from_user);
+            continue;
+        }
+        if (kept != i) {
+            envs[kept] = std::move(envs[i]);
+            rows[kept] = rows[i];
+        }
+        senders.push_back(*keys);
+        ++kept;
+    }
+    envs.resize(kept);
+    rows.resize(kept);
+
+    std::vector<CryptoManager::OpenRequest> requests;
+    requests.reserve(envs.size());
+    for (std::size_t i = 0; i < envs.size(); ++i) {
+        requests.push_back({envs[i].nonce, envs[i].ciphertext, envs[i].signature,
+                            senders[i].public_key, senders[i].signing_key});
+    }
+    auto results = crypto_.open_batch(requests);
+    // Queued before the sender rotated their keys: signed with the old ones.
+    for (std::size_t i = 0; i < envs.size(); ++i) {
+        if (results[i].status != CryptoManager::OpenStatus::Ok &&
+            directory_.retired(envs[i].from)) {
+            results[i] = open_signed(envs[i], senders[i]);
+        }
+    }
+
+    // The whole page lands in the store's commit window, so it is
+    // written as one group commit.
+    std::vector<std::pair<std::size_t, Accepted>> accepted;     // page row, message
+    accepted.reserve(envs.size());
+    for (std::size_t i = 0; i < envs.size(); ++i) {
+        if (auto a = accept_plaintext(envs[i], results[i])) {
+            accepted.emplace_back(rows[i], std::move(*a));
+        }
+    }
+    // Each sender's messages in their order, which rows queued in one
+    // batch need not be in. Messages without a `seq` go first, as queued.
+    const auto order = [](const Accepted& a) {
+        return std::tuple<const std::string&, bool, uint64_t, uint64_t>(
+            a.message.peer, a.seq.has_value(), a.seq ? a.seq->run : 0, a.seq ? a.seq->n : 0);
+    };
+    std::ranges::stable_sort(accepted, {}, [&](const auto& item) { return order(item.second); });
+
+    OfflineStage stage;
+    stage.ids.reserve(page.size());
+    for (const auto& row : page) {
+        stage.ids.push_back(row.id);
+    }
+    stage.pending.reserve(accepted.size());
+    for (auto& [row, a] : accepted) {
+        a.message.delivery_method = "offline";
+        auto done = std::make_shared<std::promise<MessageStore::InsertResult>>();
+        stage.pending.push_back({row, a.message.peer, done->get_future()});
+        const UserId sender = user_id::find(a.message.peer);
+        const auto seq = a.seq;
+        auto record = [this, done, announce, a = std::move(a)]() mutable {
+            std::pair<std::string_view, json> event;
+            if (announce) {
+                event = accepted_event(a);
+            }
+            record_accepted(std::move(a), [this, done, event = std::move(event)](auto status) {
+                if (status == MessageStore::InsertResult::Inserted && !event.first.empty()) {
+                    emit(event.first, event.second);
+                }
+                done->set_value(status);
+            });
+        };
+        // Already in order: never held, or the wait in settle would be too.
+        if (reorder_ && seq) {
+            reorder_->offer(sender, *seq, std::move(record), false);
+        } else {
+            record();
+        }
+    }
+    return stage;
+}
+
+std::vector<std::string> Node::settle_offline_page(OfflineStage& stage, BacklogCounts* counts) {
+    // Rejected rows can never succeed later, so every row counts as
+    // handled once processed — except one whose insert failed, which
+    // stays in Supabase for the next fetch.
+    std::vector<bool> keep(stage.ids.size(), false);
+    for (auto& p : stage.pending) {
+        const auto status = p.result.get();
+        if (status == MessageStore::InsertResult::Failed) {
+            keep[p.row] = true;
+        } else if (status == MessageStore::InsertResult::Inserted && counts) {
+            ++(*counts)[p.peer];
+        }
+    }
+    // Offline messages are not acked: the sender is usually still
+    // offline, and a backlog would mean one connect attempt per row.
+
+    std::vector<std::string> handled;
+    handled.reserve(stage.ids.size());
+    for (std::size_t r = 0; r < stage.ids.size(); ++r) {
+        if (!keep[r]) {
+            handled.push_back(std::move(stage.ids[r]));
+        }
+    }
+    return handled;
+}
+
+void Node::receive_pushed_offline(std::vector<SupabaseClient::OfflineMessage> rows) {
+    std::lock_guard lock(offline_mutex_);
+    auto stage = stage_offline_page(rows, true);
+    const auto handled = settle_offline_page(stage, nullptr);
+    // A row that fails to delete is fetched again by the next drain and
+    // dropped by the store as a duplicate.
+    if (!handled.empty() && !supabase_->delete_offline_messages(handled)) {
+        spdlog::warn("Could not delete {} pushed offline message(s) from Supabase", handled.size());
+    }
+}
+
+// ─── Groups ──────────────────────────────────────────────────────────────────
+
+json Node::group_json(const GroupChat::Group& group) {
+    return {{"group_id", group.group_id},
+            {"name", group.name},
+            {"created_by", group.created_by},
+            {"members", group.members},
+            {"created_at", group.created_at}};
+}
+
+std::optional<json> Node::create_group(const std::string& name,
+                                       const std::vector<std::string>& members) {
+    if (members.empty() || members.size() >= GroupChat::kMaxMembers) {
+        return std::nullopt;
+    }
+    for (const auto& member : members) {
+        auto peer = directory_.cached(member);
+        if (member != username_ && (!peer || peer->signing_key.empty())) {
+            spdlog::warn("create_group: {} is not a friend", member);
+            return std::nullopt;
+        }
+    }
+    auto group = groups_.create(name, members);
+    spdlog::info("Created group {} ({}) with {} member(s)", group.name, group.group_id,
+                 group.members.size());
+    send_group_keys(group.group_id);
+    return group_json(group);
+}
+
+json Node::groups_json() const {
+    json out = json::array();
+    for (const auto& group : groups_.list()) {
+        out.push_back(group_json(group));
+    }
+    return out;
+}
+
+std::optional<json> Node::send_group_message(const std::string& group_id,
+                                             const std::string& plaintext) {
+    auto group = groups_.find(group_id);
+    if (!group) {
+        return std::nullopt;
+    }
+    // Members without our key get it first, on the connection the message
+    // follows, so it arrives before the message does.
+    send_group_keys(group_id);
+
+    const std::string msg_id = MsgId::generate().str();
+    const std::string timestamp = envelope::now_timestamp();
+    const json payload = {{"text", plaintext}, {"msg_id", msg_id}, {"timestamp", timestamp}};
+    auto sent = broadcast_group(*group, payload.dump(), timestamp);
+    if (!sent) {
+        spdlog::error("send_group_message: we are not in group {}", group_id);
+        return std::nullopt;
+    }
+
+    MessageStore::Message record{msg_id, group_id, MessageStore::Direction::Sent,
+                                 plaintext, timestamp, false, "direct", username_};
+    store_.insert_message(std::move(record));
+    return json{{"msg_id", msg_id},
+                {"group_id", group_id},
+                {"sent", std::move(sent->first)},
+                {"unreachable", std::move(sent->second)}};
+}
+
+std::optional<std::pair<json, json>> Node::broadcast_group(const GroupChat::Group& group,
+                                                           const std::string& body,
+                                                           const std::string& timestamp) {
+    const std::string& group_id = group.group_id;
+    const std::string sealed = groups_.seal(group_id, body);
+    if (sealed.empty()) {
+        return std::nullopt;
+    }
+
+    Envelope env;
+    env.type = EnvelopeType::GroupMessage;
+    env.from = username_;
+    env.to = group_id;
+    env.timestamp = timestamp;
+    const auto* p = reinterpret_cast<const uint8_t*>(sealed.data());
+    env.nonce.assign(p, p + crypto_secretbox_NONCEBYTES);
+    env.ciphertext.assign(p + crypto_secretbox_NONCEBYTES, p + sealed.size());
+    const std::string sig = crypto_.sign(group_signed_bytes(env));
+    env.signature.assign(sig.begin(), sig.end());
+
+    // One encoding per wire format, whatever the group size.
+    std::optional<std::string> frames[2];
+    json sent = json::array();
+    json unreachable = json::array();
+    for (const auto& member : group.members) {
+        if (member == username_) {
+            continue;
+        }
+        auto peer = directory_.cached(member);
+        if (!peer || !reachable(*peer)) {
+            unreachable.push_back(member);
+            continue;
+        }
+        const WireFormat format = peer_caps_.format_for(member);
+        auto& frame = frames[format == WireFormat::Binary ? 1 : 0];
+        if (!frame) {
+            frame = envelope::encode(env, format);
+        }
+        send_frame_async(*peer, *frame);
+        sent.push_back(member);
+    }
+    return std::pair{std::move(sent), std::move(unreachable)};
+}
+
+void Node::send_group_keys(const std::string& group_id) {
+    // own_grant() first: making a new key resets who has been sent it.
+    auto grant = groups_.own_grant(group_id);
+    if (!grant) {
+        return;
+    }
+    const auto members = groups_.take_ungranted(group_id);
+    if (members.empty()) {
+        sodium_memzero(grant->key.data(), grant->key.size());
+        return;
+    }
+    std::string payload = GroupChat::grant_payload(*grant);
+    sodium_memzero(grant->key.data(), grant->key.size());
+
+    for (const auto& member : members) {
+        auto peer = directory_.cached(member);
+        const std::string boxed = peer && reachable(*peer)
+            ? crypto_.encrypt(payload, peer->public_key) : std::string();
+        if (boxed.empty()) {
+            groups_.grant_failed(group_id, member);     // tried again with the next message
+            continue;
+        }
+        Envelope env;
+        env.type = EnvelopeType::GroupKey;
+        env.from = username_;
+        env.to = member;
+        env.timestamp = envelope::now_timestamp();
+        const auto* p = reinterpret_cast<const uint8_t*>(boxed.data());
+        env.nonce.assign(p, p + crypto_box_NONCEBYTES);
+        env.ciphertext.assign(p + crypto_box_NONCEBYTES, p + boxed.size());
+        const std::string sig = crypto_.sign(std::string(boxed, crypto_box_NONCEBYTES));
+        env.signature.assign(sig.begin(), sig.end());
+        send_frame_async(*peer, envelope::encode(env, peer_caps_.format_for(member)),
+                              [this, group_id, member](bool ok) {
+            if (!ok) {
+                groups_.grant_failed(group_id, member);
+            }
+        }, TrafficClass::Control);
+    }
+    sodium_memzero(payload.data(), payload.size());
+}
+
+void Node::on_group_key(const Envelope& env) {
+    auto peer = directory_.cached(env.from);
+    if (!peer || peer->signing_key.empty()) {
+        spdlog::warn("Dropping group key from {}: not a friend", env.from);
+        return;
+    }
+    const CryptoManager::OpenRequest request{env.nonce, env.ciphertext, env.signature,
+                                             peer->public_key, peer->signing_key};
+    auto result = crypto_.open_batch(std::span(&request, 1), 1).front();
+    auto grant = result.status == CryptoManager::OpenStatus::Ok
+        ? GroupChat::parse_grant(result.plaintext) : std::nullopt;
+    sodium_memzero(result.plaintext.data(), result.plaintext.size());
+    if (!grant) {
+        spdlog::warn("Rejected group key from {}", env.from);
+        return;
+    }
+    mark_active(env.from);
+    const std::string group_id = grant->group.group_id;
+    bool joined = false;
+    if (groups_.accept_grant(env.from, std::move(*grant), joined) && joined) {
+        if (auto group = groups_.find(group_id)) {
+            spdlog::info("{} added us to group {} ({})", env.from, group->name, group_id);
+            emit("group_joined", group_json(*group));
+        }
+    }
+}
+
+void Node::receive_group(Envelope env) {
+    auto group = groups_.find(env.to);
+    auto peer = directory_.cached(env.from);
+    if (!group || !GroupChat::is_member(*group, env.from) || !peer || peer->signing_key.empty()) {
+        spdlog::warn("Dropping group message from {}: not a member we can verify", env.from);
+        return;
+    }
+    const std::string from = env.from;
+    const std::size_t bytes = env.ciphertext.size();
+    auto trace = logging::tracing() ? std::make_shared<logging::MessageTrace>(from) : nullptr;
+    crypto_workers_->run(from, bytes, [this, env = std::move(env),
+                                      signing_key = std::move(peer->signing_key),
+                                      trace = std::move(trace)] {
+        using Clock = std::chrono::steady_clock;
+        if (trace) trace->stage("queue");
+        CryptoManager::OpenResult result;
+        const auto start = Clock::now();
+        const bool valid = crypto_.verify(group_signed_bytes(env),
+                                          std::string(env.signature.begin(), env.signature.end()),
+                                          signing_key);
+        const auto verified = Clock::now();
+        result.verify_time = verified - start;
+        if (!valid) {
+            result.status = CryptoManager::OpenStatus::BadSignature;
+        } else if (auto plaintext = groups_.open(env.to, env.from, env.nonce, env.ciphertext)) {
+            result.status = CryptoManager::OpenStatus::Ok;
+            result.plaintext = std::move(*plaintext);
+        }
+        result.decrypt_time = Clock::now() - verified;
+        if (trace) {
+            trace->stage("verify", result.verify_time);
+            trace->stage("decrypt", result.decrypt_time);
+        }
+        return std::function<void()>([this, env, result = std::move(result), trace] {
+            deliver_received(env, result, {}, trace);
+        });
+    });
+}
+
+// ─── Device sync ─────────────────────────────────────────────────────────────
+
+void Node::send_device_sync(const std::string& address, const json& message) {
+    std::string body = message.dump();
+    auto compressed = compression::compress(body, tunables_.read().compress_min_bytes);
+    if (compressed) {
+        body = std::move(*compressed);
+    }
+    // Sealed to our own key: only a device holding keys.json can open it.
+    const std::string boxed = crypto_.encrypt(body, crypto_.public_key());
+    if (boxed.empty()) {
+        return;
+    }
+    Envelope env;
+    env.type = EnvelopeType::Sync;
+    env.compression = compressed ? PayloadCompression::Zstd : PayloadCompression::None;
+    env.from = username_;
+    env.to = username_;
+    env.timestamp = envelope::now_timestamp();
+    const auto* p = reinterpret_cast<const uint8_t*>(boxed.data());
+    env.nonce.assign(p, p + crypto_box_NONCEBYTES);
+    env.ciphertext.assign(p + crypto_box_NONCEBYTES, p + boxed.size());
+    const std::string sig = crypto_.sign(std::string(boxed, crypto_box_NONCEBYTES));
+    env.signature.assign(sig.begin(), sig.end());
+
+    const auto [ip, port] = split_address(address);
+    peer_pool_.send_async(device_pool_key(address), {ip, port, {}},
+                          envelope::encode(env, peer_caps_.format_for(username_)),
+                          [address](bool ok) {
+        if (!ok) {
+            spdlog::debug("Device sync: {} unreachable", address);
+        }
+    }, TrafficClass::Bulk);
+}
+
+void Node::receive_device_sync(Envelope env) {
+    if (!device_sync_ || env.to != username_) {
+        return;
+    }
+    const std::size_t bytes = env.ciphertext.size();
+    crypto_workers_->run(username_, bytes, [this, env = std::move(env)] {
+        const CryptoManager::OpenRequest request{env.nonce, env.ciphertext, env.signature,
+                                                 crypto_.public_key(),
+                                                 crypto_.signing_public_key()};
+        auto result = crypto_.open_batch(std::span(&request, 1), 1).front();
+        std::optional<std::string> payload;
+        if (result.status == CryptoManager::OpenStatus::Ok) {
+            payload = env.compression == PayloadCompression::Zstd
+                ? compression::decompress(result.plaintext) : std::move(result.plaintext);
+        }
+        return std::function<void()>([this, payload = std::move(payload)] {
+            if (!payload) {
+                spdlog::warn("Rejected device sync message: not from one of our devices");
+                return;
+            }
+            device_sync_->on_message(*payload);
+        });
+    }, TrafficClass::Bulk);
+}
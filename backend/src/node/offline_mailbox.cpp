@@ -0,0 +1,294 @@
+/**
+ * OfflineMailbox — batched, persistent inserts into Supabase's offline queue.
+ *
+ * At most one flush runs at a time. A flush peeks a batch from the outbox,
+ * inserts it with one POST and only then deletes it locally, so a crash
+ * between the two resends rows Supabase already has; the insert ignores
+ * duplicate ids, which makes that harmless.
+ */
+
+#include "node/offline_mailbox.h"
+#include "node/mailbox_pack.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <map>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Counter& packed_messages =
+    metrics::counter("p2p_mailbox_packed_total", "Offline messages inserted inside pack rows");
+metrics::Counter& pack_rows =
+    metrics::counter("p2p_mailbox_pack_rows_total", "Pack rows inserted in Supabase");
+
+} // namespace
+
+OfflineMailbox::OfflineMailbox(asio::io_context& io, MessageStore& store,
+                               SupabaseClient& supabase, std::string from_user, Options options,
+                               Packable packable)
+    : options_(options),
+      store_(store),
+      supabase_(supabase),
+      from_user_(std::move(from_user)),
+      packable_(std::move(packable)),
+      timer_(io),
+      batch_limit_(std::max<std::size_t>(1, options.batch_size)) {
+    options_.batch_size = batch_limit_;
+}
+
+void OfflineMailbox::post(std::string msg_id, std::string to_user, std::string ciphertext,
+                          MessageStore::Done done) {
+    const auto delay = packable_ && packable_(to_user)
+        ? std::max(options_.flush_delay, options_.pack_window)
+        : options_.flush_delay;
+    SupabaseClient::OfflineMessage row{msg_id, from_user_, to_user, ciphertext, ""};
+    store_.outbox_add({std::move(msg_id), std::move(to_user), std::move(ciphertext), "", 0},
+                      [weak = weak_from_this(), row = std::move(row), delay,
+                       done = std::move(done)](bool ok) mutable {
+        auto self = weak.lock();
+        if (ok) {
+            if (done) done(true);
+            if (self) {
+                std::lock_guard lock(self->mutex_);
+                self->arm_locked(delay);
+            }
+            return;
+        }
+        if (!self) {
+            if (done) done(false);
+            return;
+        }
+        spdlog::warn("Outbox unavailable; inserting {} in Supabase directly", row.id);
+        self->supabase_.async_push_offline_messages(
+            {std::move(row)}, [done = std::move(done)](SupabaseClient::PushStatus status) {
+                if (done) done(status == SupabaseClient::PushStatus::Ok);
+            });
+    });
+}
+
+void OfflineMailbox::start() {
+    compact();
+    flush();
+}
+
+void OfflineMailbox::network_up() {
+    {
+        std::lock_guard lock(mutex_);
+        if (stopped_ || backoff_.count() == 0) {
+            return;
+        }
+        spdlog::debug("Supabase reachable again; flushing the outbox");
+        backoff_ = std::chrono::milliseconds(0);
+    }
+    flush();
+}
+
+void OfflineMailbox::stop() {
+    std::lock_guard lock(mutex_);
+    stopped_ = true;
+    timer_.cancel();
+    armed_ = false;
+}
+
+void OfflineMailbox::arm_locked(std::chrono::milliseconds delay) {
+    if (stopped_) {
+        return;
+    }
+    if (flushing_) {
+        again_ = true;
+        return;
+    }
+    if (armed_ && (backoff_.count() != 0 ||
+                   timer_.expiry() <= asio::steady_timer::clock_type::now() + delay)) {
+        return;                         // a flush (or retry) is already due
+    }
+    armed_ = true;                      // expires_after() cancels a later wait
+    timer_.expires_after(delay);
+    timer_.async_wait([weak = weak_from_this()](const asio::error_code& ec) {
+        auto self = weak.lock();
+        if (!ec && self) {
+            self->flush();
+        }
+    });
+}
+
+void OfflineMailbox::flush() {
+    std::size_t limit;
+    {
+        std::lock_guard lock(mutex_);
+        if (stopped_) {
+            return;
+        }
+        if (flushing_) {
+            again_ = true;
+            return;
+        }
+        flushing_ = true;
+        again_ = false;
+        if (armed_) {
+            armed_ = false;
+            timer_.cancel();
+        }
+        limit = batch_limit_;
+    }
+    store_.outbox_peek(limit, [weak = weak_from_this(), limit](auto entries) {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        if (!entries) {
+            self->finish(false, true);          // try again after the backoff
+        } else if (entries->empty()) {
+            self->finish(true, false);
+        } else {
+            self->on_batch(std::move(*entries), limit);
+        }
+    });
+}
+
+void OfflineMailbox::on_batch(std::vector<MessageStore::OutboxEntry> entries,
+                              std::size_t limit) {
+    const bool more = entries.size() >= limit;
+
+    std::vector<std::string> ids;
+    ids.reserve(entries.size());
+    for (const auto& e : entries) {
+        ids.push_back(e.msg_id);
+    }
+    auto rows = rows_for(std::move(entries));
+
+    supabase_.async_push_offline_messages(
+        std::move(rows), [weak = weak_from_this(), ids = std::move(ids),
+                          more](SupabaseClient::PushStatus status) mutable {
+        auto self = weak.lock();
+        if (!self) {
+            return;
+        }
+        switch (status) {
+        case SupabaseClient::PushStatus::Ok:
+            spdlog::info("Queued {} offline message(s) in Supabase", ids.size());
+            self->store_.outbox_remove(std::move(ids), [weak = std::move(weak), more](bool) {
+                if (auto self = weak.lock()) {
+                    self->finish(true, more);
+                }
+            });
+            return;
+        case SupabaseClient::PushStatus::Rejected:
+            if (ids.size() > 1) {
+                // A bulk insert is all or nothing: narrow down the bad row.
+                {
+                    std::lock_guard lock(self->mutex_);
+                    self->batch_limit_ = ids.size() / 2;
+                    self->flushing_ = false;
+                }
+                self->flush();
+                return;
+            }
+            // Retried (after the backoff, behind everything else) until
+            // compaction drops it: a rejection may also be a setup problem
+            // that gets fixed, such as a wrong anon key.
+            spdlog::warn("Supabase rejected offline message {}", ids.front());
+            self->store_.outbox_failed(std::move(ids), [weak = std::move(weak)](bool) {
+                if (auto self = weak.lock()) {
+                    self->finish(false, true);
+                }
+            });
+            return;
+        case SupabaseClient::PushStatus::Failed:
+            // Supabase or the network is down; the rows are fine, so this
+            // doesn't count against them.
+            self->finish(false, true);
+            return;
+        }
+    });
+}
+
+std::vector<SupabaseClient::OfflineMessage> OfflineMailbox::rows_for(
+    std::vector<MessageStore::OutboxEntry> entries) const {
+    std::vector<SupabaseClient::OfflineMessage> rows;
+    rows.reserve(entries.size());
+    // Each packable recipient's messages, in outbox order.
+    std::map<std::string, std::vector<MessageStore::OutboxEntry*>> by_recipient;
+    for (auto& e : entries) {
+        if (packable_ && packable_(e.to_user)) {
+            by_recipient[e.to_user].push_back(&e);
+        } else {
+            rows.push_back({std::move(e.msg_id), from_user_, std::move(e.to_user),
+                            std::move(e.ciphertext), ""});
+        }
+    }
+
+    auto add = [&](std::span<MessageStore::OutboxEntry* const> run) {
+        std::vector<std::string> ids, envelopes;
+        for (const auto* e : run) {
+            ids.push_back(e->msg_id);
+            envelopes.push_back(e->ciphertext);
+        }
+        auto packed = run.size() > 1 ? mailbox_pack::pack(envelopes) : std::nullopt;
+        if (!packed) {
+            for (auto* e : run) {
+                rows.push_back({std::move(e->msg_id), from_user_, std::move(e->to_user),
+                                std::move(e->ciphertext), ""});
+            }
+            return;
+        }
+        rows.push_back({mailbox_pack::row_id(ids), from_user_, run.front()->to_user,
+                        std::move(*packed), ""});
+        packed_messages.inc(run.size());
+        pack_rows.inc();
+    };
+    for (auto& [to_user, run] : by_recipient) {
+        std::size_t begin = 0, bytes = 0;
+        for (std::size_t i = 0; i < run.size(); ++i) {
+            const std::size_t size = run[i]->ciphertext.size();
+            if (i > begin && (i - begin == options_.pack_max_messages ||
+                              bytes + size > options_.pack_max_bytes)) {
+                add(std::span(run).subspan(begin, i - begin));
+                begin = i;
+                bytes = 0;
+            }
+            bytes += size;
+        }
+        add(std::span(run).subspan(begin));
+    }
+    return rows;
+}
+
+void OfflineMailbox::finish(bool ok, bool more) {
+    bool flush_now = false;
+    {
+        std::lock_guard lock(mutex_);
+        flushing_ = false;
+        if (stopped_) {
+            return;
+        }
+        batch_limit_ = options_.batch_size;
+        if (ok) {
+            backoff_ = std::chrono::milliseconds(0);
+            flush_now = more || again_;
+        } else {
+            backoff_ = backoff_.count() == 0
+                ? options_.retry_delay
+                : std::min(backoff_ * 2, options_.max_retry_delay);
+            spdlog::debug("Outbox flush failed; retrying in {} ms", backoff_.count());
+            arm_locked(backoff_);
+        }
+        again_ = false;
+    }
+    if (!ok) {
+        compact();
+    } else if (flush_now) {
+        flush();
+    }
+}
+
+void OfflineMailbox::compact() {
+    store_.outbox_compact(options_.max_age, options_.max_attempts,
+                          [](std::vector<std::string> dropped) {
+        for (const auto& id : dropped) {
+            spdlog::warn("Dropping offline message {}: it could not be queued in Supabase", id);
+        }
+    });
+}
@@ -0,0 +1,344 @@
+/**
+ * PeerDirectory — TTL + negative caching with single-flight lookups.
+ */
+
+#include "node/peer_directory.h"
+#include "network/user_id.h"
+
+#include <algorithm>
+#include <ctime>
+
+#include <spdlog/spdlog.h>
+
+PeerDirectory::PeerDirectory(Fetcher fetcher) : PeerDirectory(std::move(fetcher), Options{}) {}
+
+PeerDirectory::PeerDirectory(Fetcher fetcher, Options options)
+    : fetcher_(std::move(fetcher)),
+      options_(options),
+      reclaimer_(memory::Area::Directory, [this](std::size_t bytes) { shrink(bytes); }) {}
+
+PeerDirectory::~PeerDirectory() {
+    memory::charge(memory::Area::Directory, -static_cast<int64_t>(size() * kEntryBytes));
+}
+
+void PeerDirectory::set_options(Options options) {
+    options_.publish(options);
+}
+
+PeerDirectory::Shard& PeerDirectory::shard(const std::string& username) const {
+    return shards_[std::hash<std::string>{}(username) % kShards];
+}
+
+std::optional<PeerDirectory::Peer> PeerDirectory::lookup(const std::string& username) {
+    Shard& s = shard(username);
+    std::promise<std::optional<Peer>> promise;
+    std::shared_future<std::optional<Peer>> waiting;
+    {
+        std::lock_guard lock(s.mutex);
+        auto it = s.entries.find(username);
+        if (it != s.entries.end() && (it->second.pinned || Clock::now() < it->second.expires)) {
+            touch_locked(s, it->second);
+            return it->second.peer;
+        }
+        auto flight = s.inflight.find(username);
+        if (flight != s.inflight.end()) {
+            waiting = flight->second;
+        } else {
+            s.inflight.emplace(username, promise.get_future().share());
+        }
+    }
+    if (waiting.valid()) {
+        return waiting.get();
+    }
+
+    std::optional<Peer> result;
+    try {
+        result = fetcher_ ? fetcher_(username) : std::nullopt;
+    } catch (const std::exception& e) {
+        spdlog::warn("Peer lookup for {} failed: {}", username, e.what());
+    }
+
+    {
+        std::lock_guard lock(s.mutex);
+        auto it = s.entries.find(username);
+        // A pin that landed while we were fetching wins over the fetch.
+        if (it == s.entries.end() || !it->second.pinned) {
+            store_locked(s, username, result);
+        } else {
+            result = it->second.peer;
+        }
+        s.inflight.erase(username);
+    }
+    promise.set_value(result);
+    return result;
+}
+
+std::optional<PeerDirectory::Peer> PeerDirectory::cached(const std::string& username) const {
+    const Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it == s.entries.end() || (!it->second.pinned && Clock::now() >= it->second.expires)) {
+        return std::nullopt;
+    }
+    return it->second.peer;
+}
+
+bool PeerDirectory::known(const std::string& username) const {
+    const Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    return it != s.entries.end() && it->second.peer &&
+           (it->second.pinned || Clock::now() < it->second.expires);
+}
+
+void PeerDirectory::seed(const std::vector<Peer>& friends) {
+    for (const auto& peer : friends) {
+        pin_entry(peer);
+    }
+    rebuild_friend_keys();
+}
+
+void PeerDirectory::pin(const Peer& peer) {
+    pin_entry(peer);
+    rebuild_friend_keys();
+}
+
+void PeerDirectory::pin_entry(const Peer& peer) {
+    user_id::intern(peer.username);
+    Shard& s = shard(peer.username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(peer.username);
+    if (it != s.entries.end() && !it->second.pinned) {
+        s.lru.erase(it->second.lru);
+    }
+    if (it == s.entries.end()) {
+        memory::charge(memory::Area::Directory, kEntryBytes);
+    }
+    Entry& entry = s.entries[peer.username];
+    entry.peer = peer;
+    entry.pinned = true;
+    entry.lru = {};
+}
+
+void PeerDirectory::unpin(const std::string& username) {
+    Shard& s = shard(username);
+    std::unique_lock lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it == s.entries.end()) {
+        return;
+    }
+    if (!it->second.pinned) {
+        s.lru.erase(it->second.lru);
+    }
+    const bool pinned = it->second.pinned;
+    s.entries.erase(it);
+    memory::charge(memory::Area::Directory, -static_cast<int64_t>(kEntryBytes));
+    lock.unlock();
+    if (pinned) {
+        rebuild_friend_keys();
+    }
+}
+
+void PeerDirectory::rebuild_friend_keys() {
+    // Under the mutex from the snapshot to the publish: two rebuilds racing
+    // could otherwise publish the older snapshot last.
+    std::lock_guard lock(friend_keys_mutex_);
+    FriendKeys table;
+    for (const auto& peer : pinned()) {
+        table.add(peer.username, peer.public_key, peer.signing_key);
+    }
+    table.sort();
+    friend_keys_.publish(std::move(table));
+}
+
+std::optional<FriendKeys::Keys> PeerDirectory::keys(const std::string& username) const {
+    if (const auto* keys = friend_keys().find(username)) {
+        return *keys;
+    }
+    // Someone looked up but not pinned: the fresh cached entry, as cached().
+    const Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it == s.entries.end() || !it->second.peer ||
+        (!it->second.pinned && Clock::now() >= it->second.expires)) {
+        return std::nullopt;
+    }
+    const Peer& peer = *it->second.peer;
+    FriendKeys::Keys keys;
+    if (peer.public_key.size() != keys.public_key.size() ||
+        peer.signing_key.size() != keys.signing_key.size()) {
+        return std::nullopt;
+    }
+    std::copy(peer.public_key.begin(), peer.public_key.end(), keys.public_key.begin());
+    std::copy(peer.signing_key.begin(), peer.signing_key.end(), keys.signing_key.begin());
+    return keys;
+}
+
+std::optional<PeerDirectory::Peer> PeerDirectory::rotate_keys(const std::string& username,
+                                                              const FriendKeys::Keys& next,
+                                                              int64_t until) {
+    Peer updated;
+    FriendKeys::Keys old;
+    {
+        Shard& s = shard(username);
+        std::lock_guard lock(s.mutex);
+        auto it = s.entries.find(username);
+        if (it == s.entries.end() || !it->second.pinned || !it->second.peer) {
+            return std::nullopt;
+        }
+        Peer& peer = *it->second.peer;
+        if (peer.public_key.size() != old.public_key.size() ||
+            peer.signing_key.size() != old.signing_key.size()) {
+            return std::nullopt;
+        }
+        std::copy(peer.public_key.begin(), peer.public_key.end(), old.public_key.begin());
+        std::copy(peer.signing_key.begin(), peer.signing_key.end(), old.signing_key.begin());
+        peer.public_key.assign(next.public_key.begin(), next.public_key.end());
+        peer.signing_key.assign(next.signing_key.begin(), next.signing_key.end());
+        updated = peer;
+    }
+    {
+        std::lock_guard lock(retired_mutex_);
+        retired_[username] = {old, until};
+    }
+    rebuild_friend_keys();
+    return updated;
+}
+
+std::optional<FriendKeys::Keys> PeerDirectory::retired(const std::string& username) const {
+    std::lock_guard lock(retired_mutex_);
+    auto it = retired_.find(username);
+    if (it == retired_.end()) {
+        return std::nullopt;
+    }
+    if (it->second.until <= static_cast<int64_t>(std::time(nullptr))) {
+        retired_.erase(it);
+        return std::nullopt;
+    }
+    return it->second.keys;
+}
+
+void PeerDirectory::update_address(const std::string& username, const std::string& ip,
+                                   uint16_t port, const std::string& last_seen,
+                                   const std::string& relay, const std::string& udp,
+                                   const std::string& addresses) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it == s.entries.end() || !it->second.peer) {
+        return;
+    }
+    it->second.peer->ip = ip;
+    if (port != 0) {
+        it->second.peer->port = port;
+    }
+    it->second.peer->last_seen = last_seen;
+    it->second.peer->relay = relay;
+    it->second.peer->udp = udp;
+    it->second.peer->addresses = addresses;
+    if (!it->second.pinned) {
+        it->second.expires = Clock::now() + options_.read().ttl;
+        touch_locked(s, it->second);
+    }
+}
+
+void PeerDirectory::set_lan(const std::string& username, const std::string& lan) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it != s.entries.end() && it->second.peer) {
+        it->second.peer->lan = lan;
+    }
+}
+
+void PeerDirectory::invalidate(const std::string& username) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it != s.entries.end() && !it->second.pinned) {
+        s.lru.erase(it->second.lru);
+        s.entries.erase(it);
+        memory::charge(memory::Area::Directory, -static_cast<int64_t>(kEntryBytes));
+    }
+}
+
+std::vector<PeerDirectory::Peer> PeerDirectory::pinned() const {
+    std::vector<Peer> out;
+    for (const Shard& s : shards_) {
+        std::lock_guard lock(s.mutex);
+        for (const auto& [name, entry] : s.entries) {
+            if (entry.pinned && entry.peer) {
+                out.push_back(*entry.peer);
+            }
+        }
+    }
+    return out;
+}
+
+std::size_t PeerDirectory::size() const {
+    std::size_t total = 0;
+    for (const Shard& s : shards_) {
+        std::lock_guard lock(s.mutex);
+        total += s.entries.size();
+    }
+    return total;
+}
+
+void PeerDirectory::store_locked(Shard& s, const std::string& username,
+                                 std::optional<Peer> peer) {
+    const Options& options = options_.read();
+    const auto ttl = peer ? options.ttl : options.negative_ttl;
+    if (peer) {
+        user_id::intern(username);      // known now: its frames get a UserId
+    }
+    auto it = s.entries.find(username);
+    if (it == s.entries.end()) {
+        s.lru.push_front(username);
+        it = s.entries.emplace(username, Entry{}).first;
+        it->second.lru = s.lru.begin();
+        memory::charge(memory::Area::Directory, kEntryBytes);
+    } else {
+        touch_locked(s, it->second);
+    }
+    it->second.peer = std::move(peer);
+    it->second.expires = Clock::now() + ttl;
+
+    // Each shard holds its share of the limit, at least one entry; over
+    // the memory budget, it makes room for this one.
+    const std::size_t limit = std::max<std::size_t>(1, (options.max_entries + kShards - 1) / kShards);
+    while (s.lru.size() > limit) {
+        evict_one_locked(s);
+    }
+    if (s.lru.size() > 1 && memory::excess(memory::Area::Directory) > 0) {
+        evict_one_locked(s);
+    }
+}
+
+void PeerDirectory::evict_one_locked(Shard& s) {
+    s.entries.erase(s.lru.back());
+    s.lru.pop_back();
+    memory::charge(memory::Area::Directory, -static_cast<int64_t>(kEntryBytes));
+}
+
+void PeerDirectory::shrink(std::size_t bytes) {
+    std::size_t freed = 0;
+    bool progress = true;
+    while (freed < bytes && progress) {
+        progress = false;
+        for (Shard& s : shards_) {
+            std::lock_guard lock(s.mutex);
+            if (!s.lru.empty()) {
+                evict_one_locked(s);
+                freed += kEntryBytes;
+                progress = true;
+            }
+        }
+    }
+}
+
+void PeerDirectory::touch_locked(Shard& s, Entry& entry) {
+    if (entry.pinned) {
+        return;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, entry.lru);
+}
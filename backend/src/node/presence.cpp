@@ -0,0 +1,125 @@
+/**
+ * PresenceTable — friend presence from peer traffic and ping probes.
+ *
+ * A tick runs every `interval`, so an online friend is pinged once they
+ * have been quiet for half of it; with the default 30 s / 90 s that gives
+ * two unanswered pings before they are reported offline.
+ */
+
+#include "node/presence.h"
+#include "network/envelope.h"
+
+#include <algorithm>
+#include <unordered_set>
+
+PresenceTable::PresenceTable(Options options) : options_(options) {}
+
+void PresenceTable::set_options(Options options) {
+    options_.publish(options);
+}
+
+PresenceTable::Shard& PresenceTable::shard(const std::string& username) const {
+    return shards_[std::hash<std::string>{}(username) % kShards];
+}
+
+bool PresenceTable::heard(const std::string& username, Clock::time_point now) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto& entry = s.entries[username];
+    const bool came_online = !entry.online;
+    entry.online = true;
+    entry.last_heard = now;
+    entry.last_heard_at = envelope::now_timestamp();
+    entry.probe_delay = std::chrono::seconds(0);
+    return came_online;
+}
+
+bool PresenceTable::should_reply(const std::string& username, Clock::time_point now) {
+    const auto interval = options_.read().interval;
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto& entry = s.entries[username];
+    if (now - entry.last_pinged < interval) {
+        return false;                   // this ping answers ours
+    }
+    entry.last_pinged = now;
+    return true;
+}
+
+void PresenceTable::pinged(const std::string& username, Clock::time_point now) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    s.entries[username].last_pinged = now;
+}
+
+PresenceTable::Plan PresenceTable::tick(const std::vector<std::string>& friends,
+                                        Clock::time_point now) {
+    const Options& options = options_.read();
+    const auto half = options.interval / 2;
+    Plan plan;
+
+    const std::unordered_set<std::string> current(friends.begin(), friends.end());
+    for (Shard& s : shards_) {
+        std::lock_guard lock(s.mutex);
+        std::erase_if(s.entries, [&](const auto& kv) { return !current.contains(kv.first); });
+    }
+
+    for (const auto& username : friends) {
+        Shard& s = shard(username);
+        std::lock_guard lock(s.mutex);
+        auto& entry = s.entries[username];      // new friends start offline, probe due
+        if (entry.online) {
+            const auto quiet = now - entry.last_heard;
+            if (quiet >= options.timeout) {
+                entry.online = false;
+                entry.probe_delay = options.interval;
+                entry.next_probe = now + entry.probe_delay;
+                plan.went_offline.push_back(username);
+            } else if (quiet >= half && now - entry.last_pinged >= half) {
+                entry.last_pinged = now;
+                plan.ping.push_back(username);
+            }
+            continue;
+        }
+        if (now < entry.next_probe) {
+            continue;
+        }
+        if (entry.probe_delay >= options.max_probe_interval) {
+            plan.lookup.push_back(username);
+        } else {
+            entry.last_pinged = now;
+            plan.ping.push_back(username);
+        }
+        entry.probe_delay = entry.probe_delay.count() == 0
+            ? options.interval
+            : std::min(entry.probe_delay * 2, options.max_probe_interval);
+        entry.next_probe = now + entry.probe_delay;
+    }
+    return plan;
+}
+
+bool PresenceTable::is_online(const std::string& username) const {
+    const Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    return it != s.entries.end() && it->second.online;
+}
+
+std::optional<std::string> PresenceTable::last_heard(const std::string& username) const {
+    const Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto it = s.entries.find(username);
+    if (it == s.entries.end() || it->second.last_heard_at.empty()) {
+        return std::nullopt;
+    }
+    return it->second.last_heard_at;
+}
+
+void PresenceTable::restore_last_heard(const std::string& username, std::string at) {
+    Shard& s = shard(username);
+    std::lock_guard lock(s.mutex);
+    auto& entry = s.entries[username];
+    if (entry.last_heard_at.empty()) {
+        entry.last_heard_at = std::move(at);
+    }
+}
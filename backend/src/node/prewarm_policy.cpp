@@ -0,0 +1,63 @@
+/**
+ * PrewarmPolicy — contact scores with exponential decay, and a cooldown
+ * on prewarm hints.
+ *
+ * A score is kept with the time it was last brought up to date and only
+ * decayed when touched or ranked, so idle friends cost nothing.
+ */
+
+#include "node/prewarm_policy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+PrewarmPolicy::PrewarmPolicy(Options options) : options_(options) {}
+
+double PrewarmPolicy::score_at(const Entry& entry, Clock::time_point now) const {
+    if (entry.score == 0 || now <= entry.scored_at) {
+        return entry.score;
+    }
+    const double half_lives = std::chrono::duration<double>(now - entry.scored_at).count() /
+                              std::max<double>(1, options_.half_life.count());
+    return entry.score * std::exp2(-half_lives);
+}
+
+void PrewarmPolicy::contacted(const std::string& peer, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    auto& entry = entries_[peer];
+    entry.score = score_at(entry, now) + 1;
+    entry.scored_at = now;
+}
+
+bool PrewarmPolicy::hinted(const std::string& peer, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    auto& entry = entries_[peer];
+    if (entry.hinted_ever && now - entry.hinted_at < options_.cooldown) {
+        return false;
+    }
+    entry.hinted_at = now;
+    entry.hinted_ever = true;
+    return true;
+}
+
+std::vector<std::string> PrewarmPolicy::keep_warm(Clock::time_point now) const {
+    std::vector<std::pair<double, const std::string*>> ranked;
+    std::lock_guard lock(mutex_);
+    ranked.reserve(entries_.size());
+    for (const auto& [peer, entry] : entries_) {
+        // Below 1/16: no message in four half-lives and never many before.
+        if (const double score = score_at(entry, now); score >= 1.0 / 16) {
+            ranked.emplace_back(score, &peer);
+        }
+    }
+    const auto k = std::min(options_.keep_warm, ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + static_cast<std::ptrdiff_t>(k), ranked.end(),
+                      [](const auto& a, const auto& b) { return a.first > b.first; });
+    std::vector<std::string> out;
+    out.reserve(k);
+    for (std::size_t i = 0; i < k; ++i) {
+        out.push_back(*ranked[i].second);
+    }
+    return out;
+}
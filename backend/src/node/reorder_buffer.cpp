@@ -0,0 +1,140 @@
+/**
+ * ReorderBuffer — per-sender sequence numbers with a bounded hold for gaps.
+ */
+
+#include "node/reorder_buffer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <utility>
+
+std::string ReorderBuffer::format(Seq seq) {
+    return std::to_string(seq.run) + "." + std::to_string(seq.n);
+}
+
+std::optional<ReorderBuffer::Seq> ReorderBuffer::parse(std::string_view text) {
+    const auto dot = text.find('.');
+    if (dot == std::string_view::npos) {
+        return std::nullopt;
+    }
+    Seq seq;
+    const auto number = [](std::string_view digits, uint64_t& out) {
+        const auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), out);
+        return !digits.empty() && err == std::errc() && end == digits.data() + digits.size();
+    };
+    if (!number(text.substr(0, dot), seq.run) || !number(text.substr(dot + 1), seq.n)) {
+        return std::nullopt;
+    }
+    return seq;
+}
+
+ReorderBuffer::ReorderBuffer(Options options) : options_(options) {}
+
+bool ReorderBuffer::offer(UserId sender, Seq seq, Release release, bool may_hold,
+                          Clock::time_point now) {
+    if (sender == UserId::None) {
+        release();
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    auto it = senders_.find(sender);
+    if (it == senders_.end()) {
+        if (senders_.size() >= options_.max_senders) {
+            evict_idle();
+        }
+        it = senders_.emplace(sender, Sender{}).first;
+    }
+    Sender& s = it->second;
+
+    if (s.next == 0 || seq.run > s.run) {
+        // First message we see of this run: it sets where the sequence is.
+        flush(s);
+        s.run = seq.run;
+        s.next = seq.n + 1;
+        release();
+        return false;
+    }
+    if (seq.run < s.run || seq.n < s.next) {
+        release();                              // late, or a retransmit
+        return false;
+    }
+    if (seq.n > s.next && may_hold) {
+        const auto [slot, inserted] = s.held.try_emplace(seq.n, std::move(release));
+        if (!inserted) {
+            release();                          // a duplicate of one held; the store drops it
+            return false;
+        }
+        if (s.held.size() == 1) {
+            s.deadline = now + options_.hold;
+        } else if (s.held.size() > options_.max_held) {
+            // Too far behind to be worth waiting for.
+            s.next = s.held.begin()->first;
+            drain(s, now);
+        }
+        return true;
+    }
+
+    // Next in line, or released anyway: first whatever it overtakes.
+    while (!s.held.empty() && s.held.begin()->first < seq.n) {
+        auto node = s.held.extract(s.held.begin());
+        node.mapped()();
+    }
+    release();
+    s.next = seq.n + 1;
+    drain(s, now);
+    return false;
+}
+
+void ReorderBuffer::drain(Sender& s, Clock::time_point now) {
+    bool moved = false;
+    while (!s.held.empty() && s.held.begin()->first == s.next) {
+        auto node = s.held.extract(s.held.begin());
+        node.mapped()();
+        ++s.next;
+        moved = true;
+    }
+    if (moved && !s.held.empty()) {
+        s.deadline = now + options_.hold;       // a new gap
+    }
+}
+
+void ReorderBuffer::flush(Sender& s) {
+    while (!s.held.empty()) {
+        auto node = s.held.extract(s.held.begin());
+        s.next = node.key() + 1;
+        node.mapped()();
+    }
+}
+
+void ReorderBuffer::expire(Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    for (auto& [sender, s] : senders_) {
+        if (!s.held.empty() && s.deadline <= now) {
+            flush(s);
+        }
+    }
+}
+
+std::optional<ReorderBuffer::Clock::time_point> ReorderBuffer::next_deadline() const {
+    std::lock_guard lock(mutex_);
+    std::optional<Clock::time_point> earliest;
+    for (const auto& [sender, s] : senders_) {
+        if (!s.held.empty() && (!earliest || s.deadline < *earliest)) {
+            earliest = s.deadline;
+        }
+    }
+    return earliest;
+}
+
+std::size_t ReorderBuffer::held() const {
+    std::lock_guard lock(mutex_);
+    std::size_t count = 0;
+    for (const auto& [sender, s] : senders_) {
+        count += s.held.size();
+    }
+    return count;
+}
+
+void ReorderBuffer::evict_idle() {
+    std::erase_if(senders_, [](const auto& entry) { return entry.second.held.empty(); });
+}
@@ -0,0 +1,97 @@
+/**
+ * SignalGate — typing indicators and read receipts, coalesced per peer.
+ *
+ * A peer we never signalled is taken as "not typing", so a stray stop
+ * (the UI sends one after every burst) costs nothing.
+ */
+
+#include "node/signal_gate.h"
+
+namespace {
+
+std::size_t lane_index(SignalGate::Kind kind) {
+    return kind == SignalGate::Kind::Read ? 1 : 0;
+}
+
+const std::string& last_value(const std::string& value, SignalGate::Kind kind) {
+    static const std::string not_typing = "0";
+    return value.empty() && kind == SignalGate::Kind::Typing ? not_typing : value;
+}
+
+} // namespace
+
+SignalGate::SignalGate(Options options) : options_(options) {}
+
+bool SignalGate::repeat(const Lane& lane, Kind kind, const std::string& value,
+                        Clock::time_point now) const {
+    if (value != last_value(lane.value, kind)) {
+        return false;
+    }
+    // Still typing: say so again before the receiver's indicator times out.
+    return !(kind == Kind::Typing && value == "1" && now - lane.at >= options_.typing_refresh);
+}
+
+bool SignalGate::offer(const Signal& signal, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    auto& lane = entries_[signal.peer].out[lane_index(signal.kind)];
+    if (repeat(lane, signal.kind, signal.value, now)) {
+        lane.held.reset();              // back to what the peer already has
+        return false;
+    }
+    if (now - lane.at < options_.min_interval) {
+        lane.held = signal.value;
+        return false;
+    }
+    lane.value = signal.value;
+    lane.at = now;
+    lane.held.reset();
+    return true;
+}
+
+std::vector<SignalGate::Signal> SignalGate::flush(Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    std::vector<Signal> due;
+    for (auto& [peer, entry] : entries_) {
+        for (const Kind kind : {Kind::Typing, Kind::Read}) {
+            auto& lane = entry.out[lane_index(kind)];
+            if (!lane.held || now - lane.at < options_.min_interval) {
+                continue;
+            }
+            std::string value = std::move(*lane.held);
+            lane.held.reset();
+            if (repeat(lane, kind, value, now)) {
+                continue;
+            }
+            lane.value = value;
+            lane.at = now;
+            due.push_back({peer, kind, std::move(value)});
+        }
+    }
+    return due;
+}
+
+std::optional<SignalGate::Clock::time_point> SignalGate::next_due() const {
+    std::lock_guard lock(mutex_);
+    std::optional<Clock::time_point> next;
+    for (const auto& [peer, entry] : entries_) {
+        for (const auto& lane : entry.out) {
+            if (lane.held && (!next || lane.at + options_.min_interval < *next)) {
+                next = lane.at + options_.min_interval;
+            }
+        }
+    }
+    return next;
+}
+
+bool SignalGate::received(const Signal& signal, Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    auto& lane = entries_[signal.peer].in[lane_index(signal.kind)];
+    if (signal.value == last_value(lane.value, signal.kind) &&
+        !(signal.value == "1" && signal.kind == Kind::Typing &&
+          now - lane.at >= options_.min_interval)) {
+        return false;                   // only "typing" is worth repeating
+    }
+    lane.value = signal.value;
+    lane.at = now;
+    return true;
+}
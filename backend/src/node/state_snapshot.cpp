@@ -0,0 +1,219 @@
+/**
+ * StateSnapshot — binary encoding and memory-mapped loading.
+ *
+ * Layout, little-endian:
+ *
+ *   magic "P2PSNAP1" | u32 version | u32 0 | u64 generation
+ *   | u64 payload size | 32-byte BLAKE2b of the payload | payload
+ *
+ * The payload is a u32 friend count and the friends, then a u32 key count
+ * and the public keys. Strings and byte strings are u32-length-prefixed.
+ */
+
+#include "node/state_snapshot.h"
+#include "storage/mapped_file.h"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string_view>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+
+constexpr char kMagic[8] = {'P', '2', 'P', 'S', 'N', 'A', 'P', '1'};
+constexpr uint32_t kVersion = 4;          // 2: friends carry their relay; 3: and UDP endpoint;
+                                          // 4: and alternate addresses
+constexpr std::size_t kChecksumBytes = crypto_generichash_BYTES;   // 32
+constexpr std::size_t kHeaderBytes = sizeof(kMagic) + 4 + 4 + 8 + 8 + kChecksumBytes;
+
+void put_u16(std::string& out, uint16_t v) {
+    out += static_cast<char>(v & 0xff);
+    out += static_cast<char>(v >> 8);
+}
+
+void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+void put_u64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+void put_bytes(std::string& out, const void* data, std::size_t size) {
+    put_u32(out, static_cast<uint32_t>(size));
+    out.append(static_cast<const char*>(data), size);
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put_bytes(out, s.data(), s.size());
+}
+
+/// Bounds-checked reader over the mapped payload; every get fails once
+/// the input runs short, so a truncated file decodes to nothing.
+class Reader {
+public:
+    explicit Reader(std::span<const uint8_t> data) : data_(data) {}
+
+    bool u16(uint16_t& v) {
+        uint64_t x;
+        if (!uint(2, x)) return false;
+        v = static_cast<uint16_t>(x);
+        return true;
+    }
+    bool u32(uint32_t& v) {
+        uint64_t x;
+        if (!uint(4, x)) return false;
+        v = static_cast<uint32_t>(x);
+        return true;
+    }
+    bool u64(uint64_t& v) { return uint(8, v); }
+
+    bool bytes(std::vector<uint8_t>& out) {
+        uint32_t n;
+        if (!u32(n) || data_.size() - pos_ < n) return false;
+        out.assign(data_.begin() + pos_, data_.begin() + pos_ + n);
+        pos_ += n;
+        return true;
+    }
+    bool string(std::string& out) {
+        uint32_t n;
+        if (!u32(n) || data_.size() - pos_ < n) return false;
+        out.assign(reinterpret_cast<const char*>(data_.data()) + pos_, n);
+        pos_ += n;
+        return true;
+    }
+    [[nodiscard]] bool done() const { return pos_ == data_.size(); }
+
+private:
+    bool uint(std::size_t width, uint64_t& v) {
+        if (data_.size() - pos_ < width) return false;
+        v = 0;
+        for (std::size_t i = 0; i < width; ++i) {
+            v |= static_cast<uint64_t>(data_[pos_ + i]) << (8 * i);
+        }
+        pos_ += width;
+        return true;
+    }
+
+    std::span<const uint8_t> data_;
+    std::size_t pos_ = 0;
+};
+
+} // namespace
+
+bool StateSnapshot::save(const std::string& path) const {
+    std::string payload;
+    put_u32(payload, static_cast<uint32_t>(friends.size()));
+    for (const auto& f : friends) {
+        put_string(payload, f.peer.username);
+        put_bytes(payload, f.peer.public_key.data(), f.peer.public_key.size());
+        put_bytes(payload, f.peer.signing_key.data(), f.peer.signing_key.size());
+        put_string(payload, f.peer.ip);
+        put_u16(payload, f.peer.port);
+        put_string(payload, f.peer.last_seen);
+        put_string(payload, f.peer.relay);
+        put_string(payload, f.peer.udp);
+        put_string(payload, f.peer.addresses);
+        put_string(payload, f.last_heard);
+    }
+    put_u32(payload, static_cast<uint32_t>(shared_key_peers.size()));
+    for (const auto& key : shared_key_peers) {
+        put_bytes(payload, key.data(), key.size());
+    }
+
+    std::string header(kMagic, sizeof(kMagic));
+    put_u32(header, kVersion);
+    put_u32(header, 0);
+    put_u64(header, generation);
+    put_u64(header, payload.size());
+    uint8_t checksum[kChecksumBytes];
+    crypto_generichash(checksum, sizeof(checksum),
+                       reinterpret_cast<const uint8_t*>(payload.data()), payload.size(), nullptr, 0);
+    header.append(reinterpret_cast<const char*>(checksum), sizeof(checksum));
+
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+        if (!out.flush()) {
+            spdlog::warn("Cannot write state snapshot {}", tmp);
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        spdlog::warn("Cannot replace state snapshot {}: {}", path, ec.message());
+        return false;
+    }
+    return true;
+}
+
+std::optional<StateSnapshot> StateSnapshot::load(const std::string& path, uint64_t generation) {
+    MappedFile file(path);
+    const auto data = file.bytes();
+    if (data.size() < kHeaderBytes || std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+        if (!data.empty()) {
+            spdlog::warn("Ignoring state snapshot {}: not a snapshot", path);
+        }
+        return std::nullopt;
+    }
+
+    Reader header(data.subspan(sizeof(kMagic), kHeaderBytes - sizeof(kMagic) - kChecksumBytes));
+    uint32_t version = 0, flags = 0;
+    uint64_t written_generation = 0, payload_size = 0;
+    header.u32(version);
+    header.u32(flags);
+    header.u64(written_generation);
+    header.u64(payload_size);
+    if (version != kVersion || payload_size != data.size() - kHeaderBytes) {
+        spdlog::info("Ignoring state snapshot {}: version {} or size mismatch", path, version);
+        return std::nullopt;
+    }
+    if (written_generation != generation) {
+        spdlog::info("State snapshot {} is stale (generation {}, database {})", path,
+                     written_generation, generation);
+        return std::nullopt;
+    }
+    const auto payload = data.subspan(kHeaderBytes);
+    uint8_t checksum[kChecksumBytes];
+    crypto_generichash(checksum, sizeof(checksum), payload.data(), payload.size(), nullptr, 0);
+    if (sodium_memcmp(checksum, data.data() + kHeaderBytes - kChecksumBytes, kChecksumBytes) != 0) {
+        spdlog::warn("Ignoring state snapshot {}: checksum mismatch", path);
+        return std::nullopt;
+    }
+
+    StateSnapshot snap;
+    snap.generation = generation;
+    Reader in(payload);
+    uint32_t count = 0;
+    bool ok = in.u32(count);
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        Friend f;
+        ok = in.string(f.peer.username) && in.bytes(f.peer.public_key) &&
+             in.bytes(f.peer.signing_key) && in.string(f.peer.ip) && in.u16(f.peer.port) &&
+             in.string(f.peer.last_seen) && in.string(f.peer.relay) && in.string(f.peer.udp) &&
+             in.string(f.peer.addresses) && in.string(f.last_heard);
+        snap.friends.push_back(std::move(f));
+    }
+    ok = ok && in.u32(count);
+    for (uint32_t i = 0; ok && i < count; ++i) {
+        std::vector<uint8_t> key;
+        ok = in.bytes(key);
+        snap.shared_key_peers.push_back(std::move(key));
+    }
+    if (!ok || !in.done()) {
+        spdlog::warn("Ignoring state snapshot {}: truncated payload", path);
+        return std::nullopt;
+    }
+    return snap;
+}
@@ -0,0 +1,146 @@
+/**
+ * DiskFile — positional reads and writes, POSIX and Win32.
+ */
+
+#include "storage/disk_file.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+DiskFile::~DiskFile() {
+    close();
+}
+
+DiskFile::DiskFile(DiskFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+DiskFile& DiskFile::operator=(DiskFile&& other) noexcept {
+    if (this != &other) {
+        close();
+#ifdef _WIN32
+        handle_ = std::exchange(other.handle_, nullptr);
+#else
+        fd_ = std::exchange(other.fd_, -1);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool DiskFile::open(const std::filesystem::path& path, Mode mode) {
+    close();
+    const bool write = mode == Mode::ReadWrite;
+    HANDLE file = CreateFileW(path.c_str(), write ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                              FILE_SHARE_READ, nullptr, write ? OPEN_ALWAYS : OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    handle_ = file;
+    return true;
+}
+
+void DiskFile::close() {
+    if (handle_) {
+        CloseHandle(handle_);
+        handle_ = nullptr;
+    }
+}
+
+bool DiskFile::is_open() const {
+    return handle_ != nullptr;
+}
+
+bool DiskFile::read_at(uint64_t offset, std::span<uint8_t> out) {
+    while (!out.empty()) {
+        OVERLAPPED at{};
+        at.Offset = static_cast<DWORD>(offset);
+        at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD n = 0;
+        const auto want = static_cast<DWORD>(std::min<std::size_t>(out.size(), 1u << 30));
+        if (!handle_ || !ReadFile(handle_, out.data(), want, &n, &at) || n == 0) {
+            return false;
+        }
+        offset += n;
+        out = out.subspan(n);
+    }
+    return true;
+}
+
+bool DiskFile::write_at(uint64_t offset, std::span<const uint8_t> data) {
+    while (!data.empty()) {
+        OVERLAPPED at{};
+        at.Offset = static_cast<DWORD>(offset);
+        at.OffsetHigh = static_cast<DWORD>(offset >> 32);
+        DWORD n = 0;
+        const auto want = static_cast<DWORD>(std::min<std::size_t>(data.size(), 1u << 30));
+        if (!handle_ || !WriteFile(handle_, data.data(), want, &n, &at) || n == 0) {
+            return false;
+        }
+        offset += n;
+        data = data.subspan(n);
+    }
+    return true;
+}
+
+#else
+
+bool DiskFile::open(const std::filesystem::path& path, Mode mode) {
+    close();
+    const int flags = mode == Mode::ReadWrite ? O_RDWR | O_CREAT : O_RDONLY;
+    fd_ = ::open(path.c_str(), flags | O_CLOEXEC, 0644);
+    return fd_ >= 0;
+}
+
+void DiskFile::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool DiskFile::is_open() const {
+    return fd_ >= 0;
+}
+
+bool DiskFile::read_at(uint64_t offset, std::span<uint8_t> out) {
+    while (!out.empty()) {
+        const ssize_t n = ::pread(fd_, out.data(), out.size(), static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        offset += static_cast<uint64_t>(n);
+        out = out.subspan(static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+bool DiskFile::write_at(uint64_t offset, std::span<const uint8_t> data) {
+    while (!data.empty()) {
+        const ssize_t n = ::pwrite(fd_, data.data(), data.size(), static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        offset += static_cast<uint64_t>(n);
+        data = data.subspan(static_cast<std::size_t>(n));
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,496 @@
+/**
+ * EncryptedVfs — page-level XChaCha20-Poly1305 under SQLite.
+ *
+ * Which I/O carries a page image depends on the file:
+ *   database  every read and write, in whole pages at page offsets;
+ *             partial reads (the 100-byte header) open the whole page
+ *   WAL       a kPageSize write or read is a frame's page; a read of a
+ *             whole frame (recovery) holds one after its 24-byte header
+ *   journal   a kPageSize write or read is a page record's image
+ * Everything else — WAL and journal headers, page numbers, checksums —
+ * passes through. The sector size is reported as 512 bytes so that a
+ * journal header is never page-sized.
+ */
+
+#include "storage/encrypted_vfs.h"
+#include "crypto/nonce_source.h"
+#include "telemetry/metrics.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Counter& pages_encrypted =
+    metrics::counter("p2p_db_pages_encrypted_total", "Database page images sealed on write");
+metrics::Counter& pages_decrypted =
+    metrics::counter("p2p_db_pages_decrypted_total",
+                     "Database page images opened on read (page cache misses)");
+
+constexpr std::size_t kNonceBytes = crypto_aead_xchacha20poly1305_ietf_NPUBBYTES;
+constexpr std::size_t kTagBytes = crypto_aead_xchacha20poly1305_ietf_ABYTES;
+constexpr std::size_t kKeyBytes = crypto_aead_xchacha20poly1305_ietf_KEYBYTES;
+constexpr std::size_t kSaltBytes = crypto_pwhash_SALTBYTES;
+constexpr std::size_t kCheckBytes = 32;
+constexpr int kJournalSectorSize = 512;
+constexpr int kWalFrameHeader = 24;
+
+static_assert(kNonceBytes + kTagBytes == EncryptedVfs::kReserveBytes);
+
+enum class Kind { Plain, Database, Wal, Journal };
+
+struct CryptFile {
+    sqlite3_file base;
+    const EncryptedVfs* vfs;
+    Kind kind;
+    uint8_t* scratch;               // one page, for sealing writes
+    sqlite3_file* real;             // the wrapped file, right after this struct
+};
+
+CryptFile* crypt(sqlite3_file* f) {
+    return reinterpret_cast<CryptFile*>(f);
+}
+
+sqlite3_file* real(sqlite3_file* f) {
+    return crypt(f)->real;
+}
+
+// ── File methods ────────────────────────────────────────────────────────
+
+int x_close(sqlite3_file* f) {
+    auto* cf = crypt(f);
+    const int rc = cf->real->pMethods ? cf->real->pMethods->xClose(cf->real) : SQLITE_OK;
+    sqlite3_free(cf->scratch);
+    cf->scratch = nullptr;
+    return rc;
+}
+
+/// Open every whole page image in `buf`, which was read from `offset`.
+int open_pages(CryptFile* cf, uint8_t* buf, int amount, sqlite3_int64 offset) {
+    const int page = EncryptedVfs::kPageSize;
+    switch (cf->kind) {
+    case Kind::Database:
+        for (int done = 0; done < amount; done += page) {
+            if (!cf->vfs->decrypt_page(buf + done)) {
+                spdlog::error("Database page at offset {} failed authentication", offset + done);
+                return SQLITE_IOERR_DATA;
+            }
+        }
+        return SQLITE_OK;
+    case Kind::Wal:
+    case Kind::Journal: {
+        uint8_t* image = nullptr;
+        if (amount == page) {
+            image = buf;
+        } else if (cf->kind == Kind::Wal && amount == page + kWalFrameHeader) {
+            image = buf + kWalFrameHeader;
+        }
+        if (image && !cf->vfs->decrypt_page(image)) {
+            spdlog::error("Page image at offset {} failed authentication", offset);
+            return SQLITE_IOERR_DATA;
+        }
+        return SQLITE_OK;
+    }
+    case Kind::Plain:
+        break;
+    }
+    return SQLITE_OK;
+}
+
+int x_read(sqlite3_file* f, void* out, int amount, sqlite3_int64 offset) {
+    auto* cf = crypt(f);
+    const int page = EncryptedVfs::kPageSize;
+    if (cf->kind == Kind::Database && (offset % page != 0 || amount % page != 0)) {
+        // Part of one page (the header, read before the page size is
+        // known): read the page, open it, copy the part.
+        const sqlite3_int64 start = offset - offset % page;
+        if (offset + amount > start + page) {
+            return SQLITE_IOERR_READ;
+        }
+        int rc = cf->real->pMethods->xRead(cf->real, cf->scratch, page, start);
+        if (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ) {
+            return rc;
+        }
+        if (open_pages(cf, cf->scratch, page, start) != SQLITE_OK) {
+            return SQLITE_IOERR_DATA;
+        }
+        std::memcpy(out, cf->scratch + (offset - start), static_cast<std::size_t>(amount));
+        return rc;
+    }
+    const int rc = cf->real->pMethods->xRead(cf->real, out, amount, offset);
+    if (cf->kind == Kind::Plain || (rc != SQLITE_OK && rc != SQLITE_IOERR_SHORT_READ)) {
+        return rc;
+    }
+    // A short read is zero-filled past the end, and zero pages are holes.
+    const int opened = open_pages(cf, static_cast<uint8_t*>(out), amount, offset);
+    return opened != SQLITE_OK ? opened : rc;
+}
+
+int x_write(sqlite3_file* f, const void* data, int amount, sqlite3_int64 offset) {
+    auto* cf = crypt(f);
+    const int page = EncryptedVfs::kPageSize;
+    const bool whole_pages = offset % page == 0 && amount % page == 0;
+    if (cf->kind == Kind::Database && !whole_pages) {
+        spdlog::error("Refusing a partial-page write to an encrypted database");
+        return SQLITE_IOERR_WRITE;
+    }
+    const bool is_image = cf->kind == Kind::Database ||
+                          ((cf->kind == Kind::Wal || cf->kind == Kind::Journal) && amount == page);
+    if (!is_image) {
+        return cf->real->pMethods->xWrite(cf->real, data, amount, offset);
+    }
+    const auto* src = static_cast<const uint8_t*>(data);
+    for (int done = 0; done < amount; done += page) {
+        std::memcpy(cf->scratch, src + done, page);
+        cf->vfs->encrypt_page(cf->scratch);
+        const int rc = cf->real->pMethods->xWrite(cf->real, cf->scratch, page, offset + done);
+        if (rc != SQLITE_OK) {
+            return rc;
+        }
+    }
+    return SQLITE_OK;
+}
+
+int x_truncate(sqlite3_file* f, sqlite3_int64 size) {
+    return real(f)->pMethods->xTruncate(real(f), size);
+}
+
+int x_sync(sqlite3_file* f, int flags) {
+    return real(f)->pMethods->xSync(real(f), flags);
+}
+
+int x_file_size(sqlite3_file* f, sqlite3_int64* size) {
+    return real(f)->pMethods->xFileSize(real(f), size);
+}
+
+int x_lock(sqlite3_file* f, int level) {
+    return real(f)->pMethods->xLock(real(f), level);
+}
+
+int x_unlock(sqlite3_file* f, int level) {
+    return real(f)->pMethods->xUnlock(real(f), level);
+}
+
+int x_check_reserved_lock(sqlite3_file* f, int* out) {
+    return real(f)->pMethods->xCheckReservedLock(real(f), out);
+}
+
+int x_file_control(sqlite3_file* f, int op, void* arg) {
+    return real(f)->pMethods->xFileControl(real(f), op, arg);
+}
+
+int x_sector_size(sqlite3_file* f) {
+    (void)f;
+    return kJournalSectorSize;
+}
+
+int x_device_characteristics(sqlite3_file* f) {
+    return real(f)->pMethods->xDeviceCharacteristics(real(f));
+}
+
+int x_shm_map(sqlite3_file* f, int region, int size, int extend, void volatile** out) {
+    return real(f)->pMethods->xShmMap(real(f), region, size, extend, out);
+}
+
+int x_shm_lock(sqlite3_file* f, int offset, int n, int flags) {
+    return real(f)->pMethods->xShmLock(real(f), offset, n, flags);
+}
+
+void x_shm_barrier(sqlite3_file* f) {
+    real(f)->pMethods->xShmBarrier(real(f));
+}
+
+int x_shm_unmap(sqlite3_file* f, int delete_flag) {
+    return real(f)->pMethods->xShmUnmap(real(f), delete_flag);
+}
+
+// Version 2: shared memory for WAL, but no xFetch, so no memory mapping.
+const sqlite3_io_methods kIoMethods = {
+    2,
+    x_close, x_read, x_write, x_truncate, x_sync, x_file_size,
+    x_lock, x_unlock, x_check_reserved_lock, x_file_control,
+    x_sector_size, x_device_characteristics,
+    x_shm_map, x_shm_lock, x_shm_barrier, x_shm_unmap,
+    nullptr, nullptr,
+};
+
+// ── VFS methods ─────────────────────────────────────────────────────────
+
+const EncryptedVfs* owner(sqlite3_vfs* vfs) {
+    return static_cast<const EncryptedVfs*>(vfs->pAppData);
+}
+
+constexpr int kRealOffset = (sizeof(CryptFile) + 7) & ~7;
+
+int x_open(sqlite3_vfs* vfs, const char* name, sqlite3_file* f, int flags, int* out_flags) {
+    auto* cf = crypt(f);
+    cf->vfs = owner(vfs);
+    cf->scratch = nullptr;
+    cf->real = reinterpret_cast<sqlite3_file*>(reinterpret_cast<char*>(f) + kRealOffset);
+    f->pMethods = nullptr;
+
+    if (flags & SQLITE_OPEN_MAIN_DB) {
+        cf->kind = Kind::Database;
+    } else if (flags & SQLITE_OPEN_WAL) {
+        cf->kind = Kind::Wal;
+    } else if (flags & SQLITE_OPEN_MAIN_JOURNAL) {
+        cf->kind = Kind::Journal;
+    } else {
+        // Temporary databases and statement journals: MessageStore sets
+        // temp_store = MEMORY, so they never reach a file.
+        cf->kind = Kind::Plain;
+    }
+
+    sqlite3_vfs* base = cf->vfs->real();
+    const int rc = base->xOpen(base, name, cf->real, flags, out_flags);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    if (cf->kind != Kind::Plain) {
+        cf->scratch = static_cast<uint8_t*>(sqlite3_malloc(EncryptedVfs::kPageSize));
+        if (!cf->scratch) {
+            if (cf->real->pMethods) {
+                cf->real->pMethods->xClose(cf->real);
+            }
+            return SQLITE_NOMEM;
+        }
+    }
+    f->pMethods = &kIoMethods;
+    return SQLITE_OK;
+}
+
+int x_delete(sqlite3_vfs* vfs, const char* name, int sync_dir) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xDelete(base, name, sync_dir);
+}
+
+int x_access(sqlite3_vfs* vfs, const char* name, int flags, int* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xAccess(base, name, flags, out);
+}
+
+int x_full_pathname(sqlite3_vfs* vfs, const char* name, int size, char* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xFullPathname(base, name, size, out);
+}
+
+void* x_dl_open(sqlite3_vfs* vfs, const char* name) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xDlOpen(base, name);
+}
+
+void x_dl_error(sqlite3_vfs* vfs, int size, char* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    base->xDlError(base, size, out);
+}
+
+void (*x_dl_sym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xDlSym(base, handle, symbol);
+}
+
+void x_dl_close(sqlite3_vfs* vfs, void* handle) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    base->xDlClose(base, handle);
+}
+
+int x_randomness(sqlite3_vfs* vfs, int size, char* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xRandomness(base, size, out);
+}
+
+int x_sleep(sqlite3_vfs* vfs, int micros) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xSleep(base, micros);
+}
+
+int x_current_time(sqlite3_vfs* vfs, double* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xCurrentTime(base, out);
+}
+
+int x_get_last_error(sqlite3_vfs* vfs, int size, char* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    return base->xGetLastError ? base->xGetLastError(base, size, out) : 0;
+}
+
+int x_current_time_int64(sqlite3_vfs* vfs, sqlite3_int64* out) {
+    sqlite3_vfs* base = owner(vfs)->real();
+    if (base->iVersion >= 2 && base->xCurrentTimeInt64) {
+        return base->xCurrentTimeInt64(base, out);
+    }
+    double days = 0;
+    const int rc = base->xCurrentTime(base, &days);
+    *out = static_cast<sqlite3_int64>(days * 86400000.0);
+    return rc;
+}
+
+// ── Key ─────────────────────────────────────────────────────────────────
+
+/// What `<path>-salt` holds besides the salt: proof of the key, so a
+/// wrong passphrase is caught before SQLite reads a page.
+void key_check(const uint8_t* key, uint8_t* out) {
+    static constexpr char kContext[] = "p2p-chat local database key check";
+    crypto_generichash(out, kCheckBytes, reinterpret_cast<const uint8_t*>(kContext),
+                       sizeof(kContext) - 1, key, kKeyBytes);
+}
+
+} // namespace
+
+EncryptedVfs::EncryptedVfs(sqlite3_vfs* real, std::string name)
+    : real_(real),
+      name_(std::move(name)),
+      arena_(kKeyBytes),
+      key_(arena_.take(kKeyBytes)) {
+    vfs_.iVersion = 2;
+    vfs_.szOsFile = kRealOffset + real_->szOsFile;
+    vfs_.mxPathname = real_->mxPathname;
+    vfs_.zName = name_.c_str();
+    vfs_.pAppData = this;
+    vfs_.xOpen = x_open;
+    vfs_.xDelete = x_delete;
+    vfs_.xAccess = x_access;
+    vfs_.xFullPathname = x_full_pathname;
+    vfs_.xDlOpen = x_dl_open;
+    vfs_.xDlError = x_dl_error;
+    vfs_.xDlSym = x_dl_sym;
+    vfs_.xDlClose = x_dl_close;
+    vfs_.xRandomness = x_randomness;
+    vfs_.xSleep = x_sleep;
+    vfs_.xCurrentTime = x_current_time;
+    vfs_.xGetLastError = x_get_last_error;
+    vfs_.xCurrentTimeInt64 = x_current_time_int64;
+}
+
+EncryptedVfs::~EncryptedVfs() {
+    sqlite3_vfs_unregister(&vfs_);
+}
+
+std::unique_ptr<EncryptedVfs> EncryptedVfs::open(const std::string& path,
+                                                 std::string_view passphrase) {
+    if (passphrase.empty()) {
+        spdlog::error("database.encrypt is on but no passphrase was given");
+        return nullptr;
+    }
+    sqlite3_vfs* base = sqlite3_vfs_find(nullptr);
+    if (!base || sodium_init() < 0) {
+        spdlog::error("Cannot set up database encryption");
+        return nullptr;
+    }
+    static std::atomic<unsigned> instances{0};
+    std::unique_ptr<EncryptedVfs> vfs(
+        new EncryptedVfs(base, "p2p-encrypted-" + std::to_string(instances++)));
+
+    namespace fs = std::filesystem;
+    const std::string salt_path = path + "-salt";
+    std::error_code ec;
+    const bool have_db = fs::exists(path, ec) && fs::file_size(path, ec) > 0;
+    uint8_t salt[kSaltBytes];
+    uint8_t check[kCheckBytes];
+    std::ifstream in(salt_path, std::ios::binary);
+    const bool have_salt = in &&
+        in.read(reinterpret_cast<char*>(salt), sizeof(salt)) &&
+        in.read(reinterpret_cast<char*>(check), sizeof(check));
+    if (have_db && !have_salt) {
+        spdlog::error("Database {} exists but is not encrypted (no {}); move it aside or "
+                      "turn database.encrypt off", path, salt_path);
+        return nullptr;
+    }
+    if (!have_salt) {
+        randombytes_buf(salt, sizeof(salt));
+    }
+
+    if (crypto_pwhash(vfs->key_.data(), kKeyBytes, passphrase.data(), passphrase.size(), salt,
+                      crypto_pwhash_OPSLIMIT_INTERACTIVE, crypto_pwhash_MEMLIMIT_INTERACTIVE,
+                      crypto_pwhash_ALG_ARGON2ID13) != 0) {
+        spdlog::error("Cannot derive the database key: out of memory");
+        return nullptr;
+    }
+    uint8_t expected[kCheckBytes];
+    key_check(vfs->key_.data(), expected);
+    if (have_salt) {
+        if (sodium_memcmp(expected, check, sizeof(check)) != 0) {
+            spdlog::error("Wrong passphrase for database {}", path);
+            return nullptr;
+        }
+    } else {
+        const std::string tmp = salt_path + ".tmp";
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(salt), sizeof(salt));
+        out.write(reinterpret_cast<const char*>(expected), sizeof(expected));
+        out.close();
+        fs::rename(tmp, salt_path, ec);
+        if (!out || ec) {
+            spdlog::error("Cannot write {}", salt_path);
+            return nullptr;
+        }
+    }
+
+    if (sqlite3_vfs_register(&vfs->vfs_, 0) != SQLITE_OK) {
+        spdlog::error("Cannot register the encrypting VFS");
+        return nullptr;
+    }
+    return vfs;
+}
+
+void EncryptedVfs::encrypt_page(uint8_t* page) const {
+    constexpr std::size_t body = kPageSize - kReserveBytes;
+    uint8_t* nonce = page + body;
+    uint8_t* tag = nonce + kNonceBytes;
+    nonce_source::fill(nonce, kNonceBytes);
+    crypto_aead_xchacha20poly1305_ietf_encrypt_detached(page, tag, nullptr, page, body, nullptr,
+                                                        0, nullptr, nonce, key_.data());
+    pages_encrypted.inc();
+}
+
+bool EncryptedVfs::decrypt_page(uint8_t* page) const {
+    constexpr std::size_t body = kPageSize - kReserveBytes;
+    uint8_t* nonce = page + body;
+    const uint8_t* tag = nonce + kNonceBytes;
+    if (sodium_is_zero(nonce, kReserveBytes)) {
+        return sodium_is_zero(page, body);      // a hole, not a sealed page
+    }
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt_detached(page, nullptr, page, body, tag,
+                                                            nullptr, 0, nonce,
+                                                            key_.data()) != 0) {
+        return false;
+    }
+    // SQLite never writes the reserved bytes; give them back as it left them.
+    sodium_memzero(nonce, kReserveBytes);
+    pages_decrypted.inc();
+    return true;
+}
+
+std::string EncryptedVfs::seal(std::string_view plain, std::string_view context) const {
+    std::string out(kNonceBytes + kTagBytes + plain.size(), '\0');
+    auto* nonce = reinterpret_cast<uint8_t*>(out.data());
+    uint8_t* tag = nonce + kNonceBytes;
+    nonce_source::fill(nonce, kNonceBytes);
+    crypto_aead_xchacha20poly1305_ietf_encrypt_detached(
+        tag + kTagBytes, tag, nullptr, reinterpret_cast<const uint8_t*>(plain.data()),
+        plain.size(), reinterpret_cast<const uint8_t*>(context.data()), context.size(), nullptr,
+        nonce, key_.data());
+    return out;
+}
+
+std::optional<std::string> EncryptedVfs::unseal(std::string_view sealed,
+                                                std::string_view context) const {
+    if (sealed.size() < kNonceBytes + kTagBytes) {
+        return std::nullopt;
+    }
+    const auto* nonce = reinterpret_cast<const uint8_t*>(sealed.data());
+    const uint8_t* tag = nonce + kNonceBytes;
+    std::string out(sealed.size() - kNonceBytes - kTagBytes, '\0');
+    if (crypto_aead_xchacha20poly1305_ietf_decrypt_detached(
+            reinterpret_cast<uint8_t*>(out.data()), nullptr, tag + kTagBytes, out.size(), tag,
+            reinterpret_cast<const uint8_t*>(context.data()), context.size(), nonce,
+            key_.data()) != 0) {
+        return std::nullopt;
+    }
+    return out;
+}
@@ -0,0 +1,480 @@
+/**
+ * HistoryArchive — compressed, append-only segment files for old history.
+ *
+ * A block on disk, little-endian:
+ *
+ *   magic "P2PA" | u8 flags | u32 count | u32 raw size | u32 payload size
+ *   | payload
+ *
+ * flags: 1 = payload is zstd (network/compression.h), 2 = payload is
+ * sealed (EncryptedVfs::seal, with the peer as context). The raw form is
+ * `count` messages, each: msg_id, u8 direction, plaintext, timestamp,
+ * u8 delivered, delivery_method, sender — strings u32-length-prefixed.
+ */
+
+#include "storage/history_archive.h"
+#include "network/compression.h"
+#include "storage/encrypted_vfs.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+metrics::Counter& blocks_written =
+    metrics::counter("p2p_archive_blocks_written_total", "History archive blocks appended");
+metrics::Counter& blocks_decoded =
+    metrics::counter("p2p_archive_blocks_decoded_total",
+                     "History archive blocks read from a segment and decoded");
+
+constexpr char kMagic[4] = {'P', '2', 'P', 'A'};
+constexpr std::size_t kHeaderBytes = sizeof(kMagic) + 1 + 4 + 4 + 4;
+constexpr uint8_t kCompressed = 1;
+constexpr uint8_t kSealed = 2;
+constexpr std::size_t kDecodedBlocks = 16;
+constexpr std::size_t kMappings = 32;
+constexpr std::size_t kTermHashes = 4;
+
+void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+/// Bounds-checked reader over a decoded block.
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data_(data) {}
+
+    bool u8(uint8_t& v) {
+        if (pos_ == data_.size()) return false;
+        v = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+    bool u32(uint32_t& v) {
+        if (data_.size() - pos_ < 4) return false;
+        v = 0;
+        for (int i = 0; i < 4; ++i) {
+            v |= static_cast<uint32_t>(static_cast<uint8_t>(data_[pos_ + i])) << (8 * i);
+        }
+        pos_ += 4;
+        return true;
+    }
+    bool string(std::string& out) {
+        uint32_t n;
+        if (!u32(n) || data_.size() - pos_ < n) return false;
+        out.assign(data_.substr(pos_, n));
+        pos_ += n;
+        return true;
+    }
+    [[nodiscard]] bool done() const { return pos_ == data_.size(); }
+
+private:
+    std::string_view data_;
+    std::size_t pos_ = 0;
+};
+
+uint32_t get_u32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+bool word_byte(char c) {
+    const auto u = static_cast<unsigned char>(c);
+    return u >= 0x80 || std::isalnum(u);
+}
+
+char fold(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+struct Token {
+    std::size_t begin;
+    std::size_t end;
+    std::string word;                           // lowercased
+};
+
+/// Runs of letters and digits (any non-ASCII byte counts as a letter).
+std::vector<Token> tokenize(std::string_view text) {
+    std::vector<Token> tokens;
+    std::size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && !word_byte(text[i])) ++i;
+        const std::size_t begin = i;
+        std::string word;
+        for (; i < text.size() && word_byte(text[i]); ++i) {
+            word += fold(text[i]);
+        }
+        if (!word.empty()) {
+            tokens.push_back({begin, i, std::move(word)});
+        }
+    }
+    return tokens;
+}
+
+uint64_t term_hash(std::string_view term) {
+    uint64_t h = 0xcbf29ce484222325ULL;         // FNV-1a
+    for (char c : term) {
+        h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+constexpr std::size_t kTermBits = std::tuple_size_v<HistoryArchive::Terms> * 8;
+
+void add_term(HistoryArchive::Terms& terms, std::string_view term) {
+    const uint64_t h = term_hash(term);
+    for (std::size_t k = 0; k < kTermHashes; ++k) {
+        const std::size_t bit = (h >> (k * 16)) % kTermBits;
+        terms[bit / 8] |= static_cast<uint8_t>(1u << (bit % 8));
+    }
+}
+
+bool has_term(const HistoryArchive::Terms& terms, std::string_view term) {
+    const uint64_t h = term_hash(term);
+    for (std::size_t k = 0; k < kTermHashes; ++k) {
+        const std::size_t bit = (h >> (k * 16)) % kTermBits;
+        if (!(terms[bit / 8] & (1u << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// Append `data` to the file at `path` (truncated to `keep` bytes first,
+/// or created) and flush it to the device.
+bool write_durably(const std::string& path, uint64_t keep, const std::string& data) {
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(path, ec);
+    if (!ec && size != keep) {
+        if (size < keep) {
+            spdlog::error("Archive segment {} is shorter than its index ({} < {})", path, size,
+                          keep);
+            return false;
+        }
+        std::filesystem::resize_file(path, keep, ec);
+        if (ec) {
+            spdlog::error("Cannot trim archive segment {}: {}", path, ec.message());
+            return false;
+        }
+    } else if (ec && keep != 0) {
+        spdlog::error("Archive segment {} is missing", path);
+        return false;
+    }
+    std::FILE* f = std::fopen(path.c_str(), "ab");
+    if (!f) {
+        spdlog::error("Cannot open archive segment {}", path);
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size() && std::fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && ::fsync(fileno(f)) == 0;
+#endif
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) {
+        spdlog::error("Cannot write archive segment {}", path);
+    }
+    return ok;
+}
+
+} // namespace
+
+// ─── Query ───────────────────────────────────────────────────────────────────
+
+HistoryArchive::Query::Query(std::string_view text) {
+    for (auto& t : tokenize(text)) {
+        words_.push_back(std::move(t.word));
+    }
+    last_is_prefix_ = !words_.empty() && word_byte(text.back());
+}
+
+bool HistoryArchive::Query::may_match(const Terms& terms) const {
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+        const auto& w = words_[i];
+        if (i + 1 < words_.size() || !last_is_prefix_) {
+            if (!has_term(terms, w)) return false;
+        } else if (w.size() >= 3 && !has_term(terms, std::string_view(w).substr(0, 3))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<std::string> HistoryArchive::Query::match(std::string_view text) const {
+    const auto tokens = tokenize(text);
+    std::vector<bool> hit(tokens.size());
+    for (std::size_t i = 0; i < words_.size(); ++i) {
+        const bool prefix = i + 1 == words_.size() && last_is_prefix_;
+        bool found = false;
+        for (std::size_t t = 0; t < tokens.size(); ++t) {
+            const auto& word = tokens[t].word;
+            if (prefix ? word.starts_with(words_[i]) : word == words_[i]) {
+                hit[t] = found = true;
+            }
+        }
+        if (!found) return std::nullopt;
+    }
+
+    // Twelve words from just before the first match, like the FTS snippet.
+    constexpr std::size_t kWords = 12;
+    const auto first = static_cast<std::size_t>(std::find(hit.begin(), hit.end(), true) -
+                                                hit.begin());
+    const std::size_t from = first > 2 ? first - 2 : 0;
+    const std::size_t to = std::min(tokens.size(), from + kWords);
+    std::string snippet = from > 0 ? "…" : "";
+    std::size_t pos = tokens[from].begin;
+    for (std::size_t t = from; t < to; ++t) {
+        snippet.append(text.substr(pos, tokens[t].begin - pos));
+        const auto word = text.substr(tokens[t].begin, tokens[t].end - tokens[t].begin);
+        if (hit[t]) {
+            snippet.append("**").append(word).append("**");
+        } else {
+            snippet.append(word);
+        }
+        pos = tokens[t].end;
+    }
+    if (to < tokens.size()) {
+        snippet += "…";
+    } else {
+        snippet.append(text.substr(pos));
+    }
+    return snippet;
+}
+
+// ─── Segments ────────────────────────────────────────────────────────────────
+
+HistoryArchive::HistoryArchive(std::string dir, const EncryptedVfs* cipher)
+    : dir_(std::move(dir)), cipher_(cipher) {}
+
+std::string HistoryArchive::segment_path(const std::string& peer, int64_t segment) const {
+    std::string hex(peer.size() * 2 + 1, '\0');
+    sodium_bin2hex(hex.data(), hex.size(), reinterpret_cast<const unsigned char*>(peer.data()),
+                   peer.size());
+    hex.pop_back();
+    return dir_ + "/" + hex + "." + std::to_string(segment) + ".seg";
+}
+
+HistoryArchive::Block HistoryArchive::encode(const std::string& peer, const Messages& messages,
+                                             uint64_t base, std::string& out) const {
+    Block block;
+    block.offset = base + out.size();
+    block.count = static_cast<uint32_t>(messages.size());
+    std::string raw;
+    for (const auto& m : messages) {
+        put_string(raw, m.msg_id);
+        raw += static_cast<char>(m.direction == MessageStore::Direction::Sent ? 0 : 1);
+        put_string(raw, m.plaintext);
+        put_string(raw, m.timestamp);
+        raw += static_cast<char>(m.delivered ? 1 : 0);
+        put_string(raw, m.delivery_method);
+        put_string(raw, m.sender);
+
+        if (block.first_ts.empty() || m.timestamp < block.first_ts) block.first_ts = m.timestamp;
+        if (m.timestamp > block.last_ts) block.last_ts = m.timestamp;
+        for (const auto& t : tokenize(m.plaintext)) {
+            add_term(block.terms, t.word);
+            if (t.word.size() > 3) add_term(block.terms, std::string_view(t.word).substr(0, 3));
+        }
+    }
+
+    uint8_t flags = 0;
+    std::string payload;
+    if (raw.size() <= compression::kMaxDecompressedSize) {
+        if (auto packed = compression::compress(raw, 0)) {
+            payload = std::move(*packed);
+            flags |= kCompressed;
+        }
+    }
+    if (!(flags & kCompressed)) {
+        payload = raw;
+    }
+    if (cipher_) {
+        payload = cipher_->seal(payload, peer);
+        flags |= kSealed;
+    }
+
+    out.append(kMagic, sizeof(kMagic));
+    out += static_cast<char>(flags);
+    put_u32(out, block.count);
+    put_u32(out, static_cast<uint32_t>(raw.size()));
+    put_u32(out, static_cast<uint32_t>(payload.size()));
+    out += payload;
+    block.length = static_cast<uint32_t>(base + out.size() - block.offset);
+    return block;
+}
+
+std::optional<HistoryArchive::Block> HistoryArchive::append(const std::string& peer,
+                                                            int64_t segment, uint64_t end,
+                                                            const Messages& messages) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    std::string bytes;
+    Block block = encode(peer, messages, end, bytes);
+    block.segment = segment;
+    const std::string path = segment_path(peer, segment);
+    forget(path);
+    if (!write_durably(path, end, bytes)) {
+        return std::nullopt;
+    }
+    blocks_written.inc();
+    return block;
+}
+
+std::optional<std::vector<HistoryArchive::Block>> HistoryArchive::rewrite(
+    const std::string& peer, int64_t segment, const std::vector<Messages>& blocks) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_, ec);
+    std::string bytes;
+    std::vector<Block> index;
+    for (const auto& messages : blocks) {
+        index.push_back(encode(peer, messages, 0, bytes));
+        index.back().segment = segment;
+    }
+    const std::string path = segment_path(peer, segment);
+    forget(path);
+    std::filesystem::remove(path, ec);
+    if (!write_durably(path, 0, bytes)) {
+        return std::nullopt;
+    }
+    blocks_written.inc(index.size());
+    return index;
+}
+
+void HistoryArchive::remove_segments(const std::string& peer, int64_t keep) {
+    const std::string prefix = segment_path(peer, 0);
+    const std::string stem = prefix.substr(dir_.size() + 1, prefix.size() - dir_.size() - 6);
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir_, ec)) {
+        const std::string name = entry.path().filename().string();
+        if (!name.starts_with(stem) || !name.ends_with(".seg")) {
+            continue;
+        }
+        const std::string path = entry.path().string();
+        if (keep >= 0 && name == stem + std::to_string(keep) + ".seg") {
+            continue;
+        }
+        forget(path);
+        std::error_code rm;
+        std::filesystem::remove(entry.path(), rm);
+    }
+}
+
+const MappedFile& HistoryArchive::mapping(const std::string& path) {
+    auto it = mappings_.find(path);
+    if (it == mappings_.end()) {
+        if (mappings_.size() >= kMappings) {
+            mappings_.clear();
+        }
+        it = mappings_.emplace(path, std::make_unique<MappedFile>(path)).first;
+    }
+    return *it->second;
+}
+
+void HistoryArchive::forget(const std::string& path) {
+    mappings_.erase(path);
+    decoded_.remove_if([&](const auto& entry) { return entry.first.starts_with(path + "@"); });
+}
+
+std::shared_ptr<const HistoryArchive::Messages> HistoryArchive::read(const std::string& peer,
+                                                                     const Block& block) {
+    const std::string path = segment_path(peer, block.segment);
+    const std::string key = path + "@" + std::to_string(block.offset);
+    for (auto it = decoded_.begin(); it != decoded_.end(); ++it) {
+        if (it->first == key) {
+            decoded_.splice(decoded_.begin(), decoded_, it);
+            return decoded_.front().second;
+        }
+    }
+
+    auto bytes = mapping(path).bytes();
+    if (bytes.size() < block.offset + block.length) {
+        forget(path);                           // mapped before the last append
+        bytes = mapping(path).bytes();
+    }
+    const auto fail = [&](const char* why) -> std::shared_ptr<const Messages> {
+        spdlog::error("Archive block {}@{} unreadable: {}", path, block.offset, why);
+        return nullptr;
+    };
+    if (bytes.size() < block.offset + block.length || block.length < kHeaderBytes) {
+        return fail("past the end of the segment");
+    }
+    const uint8_t* p = bytes.data() + block.offset;
+    if (std::memcmp(p, kMagic, sizeof(kMagic)) != 0) {
+        return fail("bad magic");
+    }
+    const uint8_t flags = p[4];
+    const uint32_t count = get_u32(p + 5);
+    const uint32_t raw_size = get_u32(p + 9);
+    const uint32_t payload_size = get_u32(p + 13);
+    if (payload_size != block.length - kHeaderBytes || count != block.count) {
+        return fail("header does not match the index");
+    }
+
+    std::string data(reinterpret_cast<const char*>(p + kHeaderBytes), payload_size);
+    if (flags & kSealed) {
+        auto opened = cipher_ ? cipher_->unseal(data, peer) : std::nullopt;
+        if (!opened) {
+            return fail(cipher_ ? "authentication failed" : "sealed, but no key");
+        }
+        data = std::move(*opened);
+    }
+    if (flags & kCompressed) {
+        auto unpacked = compression::decompress(data);
+        if (!unpacked) {
+            return fail("cannot decompress");
+        }
+        data = std::move(*unpacked);
+    }
+    if (data.size() != raw_size) {
+        return fail("size mismatch");
+    }
+
+    auto messages = std::make_shared<Messages>();
+    messages->reserve(count);
+    Reader r(data);
+    for (uint32_t i = 0; i < count; ++i) {
+        MessageStore::Message m;
+        uint8_t direction = 0, delivered = 0;
+        if (!r.string(m.msg_id) || !r.u8(direction) || !r.string(m.plaintext) ||
+            !r.string(m.timestamp) || !r.u8(delivered) || !r.string(m.delivery_method) ||
+            !r.string(m.sender)) {
+            return fail("truncated");
+        }
+        m.peer = peer;
+        m.direction = direction == 0 ? MessageStore::Direction::Sent
+                                     : MessageStore::Direction::Received;
+        m.delivered = delivered != 0;
+        messages->push_back(std::move(m));
+    }
+    if (!r.done()) {
+        return fail("trailing bytes");
+    }
+    blocks_decoded.inc();
+
+    decoded_.emplace_front(key, messages);
+    if (decoded_.size() > kDecodedBlocks) {
+        decoded_.pop_back();
+    }
+    return messages;
+}
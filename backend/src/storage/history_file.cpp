@@ -0,0 +1,342 @@
+/**
+ * History export file, little-endian:
+ *
+ *   header: "P2PHIST1"
+ *   chunk:  magic "P2PC" | u8 flags | u32 count | u32 raw size | u32 payload size
+ *           | payload
+ *   end:    a chunk with count 0
+ *
+ * flags: 1 = payload is zstd (network/compression.h). The raw form is
+ * `count` records, each: peer, msg_id, u8 direction, plaintext, timestamp,
+ * u8 delivered, delivery_method, sender — strings u32-length-prefixed, as
+ * in archive blocks (storage/history_archive.cpp) plus the peer.
+ */
+
+#include "storage/history_file.h"
+#include "network/compression.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <string_view>
+
+#include <spdlog/spdlog.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr char kHeader[8] = {'P', '2', 'P', 'H', 'I', 'S', 'T', '1'};
+constexpr char kChunkMagic[4] = {'P', '2', 'P', 'C'};
+constexpr std::size_t kChunkHeaderBytes = sizeof(kChunkMagic) + 1 + 4 + 4 + 4;
+constexpr uint8_t kCompressed = 1;
+/// Bound on a chunk's payload, so a damaged length can't ask for an
+/// arbitrarily large allocation. A chunk overshoots kChunkBytes by at most
+/// one message.
+constexpr uint32_t kMaxPayload = 64 * 1024 * 1024;
+/// The smallest record: six empty strings and two bytes.
+constexpr std::size_t kMinRecordBytes = 6 * 4 + 2;
+/// Log progress every this many messages.
+constexpr std::size_t kProgressEvery = 100000;
+
+void put_u32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+        out += static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+}
+
+void put_string(std::string& out, const std::string& s) {
+    put_u32(out, static_cast<uint32_t>(s.size()));
+    out += s;
+}
+
+uint32_t get_u32(const char* p) {
+    const auto* u = reinterpret_cast<const uint8_t*>(p);
+    return static_cast<uint32_t>(u[0]) | static_cast<uint32_t>(u[1]) << 8 |
+           static_cast<uint32_t>(u[2]) << 16 | static_cast<uint32_t>(u[3]) << 24;
+}
+
+/// Bounds-checked reader over a chunk's raw records.
+class Reader {
+public:
+    explicit Reader(std::string_view data) : data_(data) {}
+
+    bool u8(uint8_t& v) {
+        if (pos_ == data_.size()) return false;
+        v = static_cast<uint8_t>(data_[pos_++]);
+        return true;
+    }
+    bool string(std::string& out) {
+        if (data_.size() - pos_ < 4) return false;
+        const uint32_t n = get_u32(data_.data() + pos_);
+        pos_ += 4;
+        if (data_.size() - pos_ < n) return false;
+        out.assign(data_.substr(pos_, n));
+        pos_ += n;
+        return true;
+    }
+    [[nodiscard]] bool done() const { return pos_ == data_.size(); }
+
+private:
+    std::string_view data_;
+    std::size_t pos_ = 0;
+};
+
+bool read_exactly(std::FILE* in, char* out, std::size_t n) {
+    return std::fread(out, 1, n, in) == n;
+}
+
+/// Create `path` for writing, readable by its owner only.
+std::FILE* create_private(const std::string& path) {
+#ifdef _WIN32
+    return std::fopen(path.c_str(), "wb");
+#else
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return nullptr;
+    }
+    std::FILE* f = ::fdopen(fd, "wb");
+    if (!f) {
+        ::close(fd);
+    }
+    return f;
+#endif
+}
+
+void binary_mode([[maybe_unused]] std::FILE* f) {
+#ifdef _WIN32
+    _setmode(_fileno(f), _O_BINARY);
+#endif
+}
+
+} // namespace
+
+// ─── Writer ──────────────────────────────────────────────────────────────────
+
+HistoryFileWriter::HistoryFileWriter(std::FILE* out) : out_(out) {
+    raw_.reserve(kChunkBytes + 4096);
+}
+
+bool HistoryFileWriter::add(const MessageStore::Message& m) {
+    if (!ok_) {
+        return false;
+    }
+    put_string(raw_, m.peer);
+    put_string(raw_, m.msg_id);
+    raw_ += static_cast<char>(m.direction == MessageStore::Direction::Sent ? 0 : 1);
+    put_string(raw_, m.plaintext);
+    put_string(raw_, m.timestamp);
+    raw_ += static_cast<char>(m.delivered ? 1 : 0);
+    put_string(raw_, m.delivery_method);
+    put_string(raw_, m.sender);
+    ++count_;
+    return raw_.size() < kChunkBytes || write_chunk();
+}
+
+bool HistoryFileWriter::finish() {
+    // The last records, then the empty end marker.
+    if (ok_ && count_ > 0) {
+        write_chunk();
+    }
+    if (ok_) {
+        write_chunk();
+    }
+    ok_ = ok_ && std::fflush(out_) == 0;
+    if (!ok_) {
+        spdlog::error("Cannot write the history file");
+    }
+    return ok_;
+}
+
+bool HistoryFileWriter::write_chunk() {
+    uint8_t flags = 0;
+    std::string payload;
+    if (!raw_.empty() && raw_.size() <= compression::kMaxDecompressedSize) {
+        if (auto packed = compression::compress(raw_, 0)) {
+            payload = std::move(*packed);
+            flags |= kCompressed;
+        }
+    }
+    const std::string& body = (flags & kCompressed) ? payload : raw_;
+
+    std::string head;
+    if (!started_) {
+        head.append(kHeader, sizeof(kHeader));
+        started_ = true;
+    }
+    head.append(kChunkMagic, sizeof(kChunkMagic));
+    head += static_cast<char>(flags);
+    put_u32(head, count_);
+    put_u32(head, static_cast<uint32_t>(raw_.size()));
+    put_u32(head, static_cast<uint32_t>(body.size()));
+    ok_ = std::fwrite(head.data(), 1, head.size(), out_) == head.size() &&
+          std::fwrite(body.data(), 1, body.size(), out_) == body.size();
+    if (!ok_) {
+        spdlog::error("Cannot write the history file: {}", std::strerror(errno));
+    }
+    raw_.clear();
+    count_ = 0;
+    return ok_;
+}
+
+// ─── Reader ──────────────────────────────────────────────────────────────────
+
+HistoryFileReader::HistoryFileReader(std::FILE* in) : in_(in) {}
+
+std::optional<std::vector<MessageStore::Message>> HistoryFileReader::next() {
+    const auto fail = [](const char* why) {
+        spdlog::error("Bad history file: {}", why);
+        return std::nullopt;
+    };
+    if (ended_) {
+        return std::vector<MessageStore::Message>{};
+    }
+    if (!started_) {
+        char header[sizeof(kHeader)];
+        if (!read_exactly(in_, header, sizeof(header)) ||
+            std::memcmp(header, kHeader, sizeof(kHeader)) != 0) {
+            return fail("not a history export");
+        }
+        started_ = true;
+    }
+
+    char head[kChunkHeaderBytes];
+    if (!read_exactly(in_, head, sizeof(head))) {
+        return fail("it ends early (truncated copy?)");
+    }
+    if (std::memcmp(head, kChunkMagic, sizeof(kChunkMagic)) != 0) {
+        return fail("bad chunk magic");
+    }
+    const auto flags = static_cast<uint8_t>(head[4]);
+    const uint32_t count = get_u32(head + 5);
+    const uint32_t raw_size = get_u32(head + 9);
+    const uint32_t payload_size = get_u32(head + 13);
+    if (payload_size > kMaxPayload || raw_size > kMaxPayload) {
+        return fail("chunk too large");
+    }
+    if (count > raw_size / kMinRecordBytes) {
+        return fail("more records than the chunk has room for");
+    }
+    std::string data(payload_size, '\0');
+    if (!read_exactly(in_, data.data(), data.size())) {
+        return fail("it ends early (truncated copy?)");
+    }
+    if (flags & kCompressed) {
+        auto unpacked = compression::decompress(data);
+        if (!unpacked) {
+            return fail(compression::available() ? "cannot decompress a chunk"
+                                                 : "compressed, and this build has no zstd");
+        }
+        data = std::move(*unpacked);
+    }
+    if (data.size() != raw_size) {
+        return fail("size mismatch");
+    }
+
+    std::vector<MessageStore::Message> messages;
+    messages.reserve(count);
+    Reader r(data);
+    for (uint32_t i = 0; i < count; ++i) {
+        MessageStore::Message m;
+        uint8_t direction = 0, delivered = 0;
+        if (!r.string(m.peer) || !r.string(m.msg_id) || !r.u8(direction) ||
+            !r.string(m.plaintext) || !r.string(m.timestamp) || !r.u8(delivered) ||
+            !r.string(m.delivery_method) || !r.string(m.sender)) {
+            return fail("truncated record");
+        }
+        if (m.peer.empty() || m.msg_id.empty()) {
+            return fail("record without a conversation or id");
+        }
+        m.direction = direction == 0 ? MessageStore::Direction::Sent
+                                     : MessageStore::Direction::Received;
+        m.delivered = delivered != 0;
+        messages.push_back(std::move(m));
+    }
+    if (!r.done()) {
+        return fail("trailing bytes in a chunk");
+    }
+    ended_ = count == 0;
+    return messages;
+}
+
+// ─── Commands ────────────────────────────────────────────────────────────────
+
+bool history_file::export_to(MessageStore& store, const std::string& path) {
+    const bool piped = path == "-";
+    std::FILE* out = piped ? stdout : create_private(path);
+    if (!out) {
+        spdlog::error("Cannot create {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    binary_mode(out);
+    const auto started = std::chrono::steady_clock::now();
+    HistoryFileWriter writer(out);
+    std::size_t written = 0;
+    std::promise<std::optional<std::size_t>> done;
+    store.export_history(
+        [&](const MessageStore::Message& m) {
+            if (++written % kProgressEvery == 0) {
+                spdlog::info("Exported {} messages…", written);
+            }
+            return writer.add(m);
+        },
+        [&](std::optional<std::size_t> count) { done.set_value(count); });
+    const auto count = done.get_future().get();
+    bool ok = count && writer.finish();
+    if (!piped) {
+        ok = std::fclose(out) == 0 && ok;
+    }
+    if (!ok) {
+        spdlog::error("History export to {} failed", path);
+        return false;
+    }
+    const std::chrono::duration<double> took = std::chrono::steady_clock::now() - started;
+    spdlog::info("Exported {} message(s) to {} in {:.1f} s", *count, piped ? "stdout" : path,
+                 took.count());
+    return true;
+}
+
+bool history_file::import_from(MessageStore& store, const std::string& path) {
+    const bool piped = path == "-";
+    std::FILE* in = piped ? stdin : std::fopen(path.c_str(), "rb");
+    if (!in) {
+        spdlog::error("Cannot open {}: {}", path, std::strerror(errno));
+        return false;
+    }
+    binary_mode(in);
+    const auto started = std::chrono::steady_clock::now();
+    HistoryFileReader reader(in);
+    std::size_t read = 0;
+    std::promise<std::optional<std::size_t>> done;
+    store.import_history(
+        [&]() {
+            auto batch = reader.next();
+            if (batch && (read + batch->size()) / kProgressEvery > read / kProgressEvery) {
+                spdlog::info("Imported {} messages…", read + batch->size());
+            }
+            read += batch ? batch->size() : 0;
+            return batch;
+        },
+        [&](std::optional<std::size_t> count) { done.set_value(count); });
+    const auto stored = done.get_future().get();
+    if (!piped) {
+        std::fclose(in);
+    }
+    if (!stored) {
+        spdlog::error("History import from {} failed; what was committed is kept, and running "
+                      "it again picks up the rest",
+                      path);
+        return false;
+    }
+    const std::chrono::duration<double> took = std::chrono::steady_clock::now() - started;
+    spdlog::info("Imported {} message(s) from {} ({} new) in {:.1f} s", read,
+                 piped ? "stdin" : path, *stored, took.count());
+    return true;
+}
@@ -0,0 +1,58 @@
+/**
+ * MappedFile — mmap / MapViewOfFile of a whole file, read-only.
+ */
+
+#include "storage/mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    file_ = file;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        return;
+    }
+    mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_) {
+        return;
+    }
+    data_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+    size_ = data_ ? static_cast<std::size_t>(size.QuadPart) : 0;
+#else
+    fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st {};
+    if (fd_ < 0 || ::fstat(fd_, &st) != 0 || st.st_size == 0) {
+        return;
+    }
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+                        fd_, 0);
+    if (data != MAP_FAILED) {
+        data_ = data;
+        size_ = static_cast<std::size_t>(st.st_size);
+    }
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+#else
+    if (data_) ::munmap(data_, size_);
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
@@ -0,0 +1,3044 @@
+/**
+ * MessageStore — Local SQLite persistence on a dedicated DB thread.
+ *
+ * Schema: ARCHITECTURE.md §8.1. The DB thread is a single-threaded
+ * io_context, the same pattern PeerConnectionPool uses for client sockets;
+ * the sqlite3 connection is only ever touched from it.
+ */
+
+#include "storage/message_store.h"
+#include "network/cpu_affinity.h"
+#include "network/msg_id.h"
+#include "storage/encrypted_vfs.h"
+#include "storage/history_archive.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <future>
+#include <iterator>
+
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+#include <sqlite3.h>
+
+namespace {
+
+metrics::Histogram& commit_seconds =
+    metrics::histogram("p2p_store_commit_seconds", "SQLite group commit of buffered message inserts");
+metrics::Counter& inserted_rows =
+    metrics::counter("p2p_store_inserts_total", "Message rows written by group commits");
+metrics::Gauge& pending_inserts =
+    metrics::gauge("p2p_store_pending_inserts", "Message inserts waiting for the next group commit");
+metrics::Counter& archived_rows =
+    metrics::counter("p2p_store_archived_total", "Messages moved to the history archive");
+metrics::Counter& expired_rows =
+    metrics::counter("p2p_store_expired_total", "Disappearing messages deleted past their expiry");
+
+const std::string kMemoryPath = ":memory:";
+
+const char* const kSchema = R"sql(
+CREATE TABLE IF NOT EXISTS identity (
+    username    TEXT PRIMARY KEY,
+    node_id     TEXT NOT NULL,
+    public_key  BLOB NOT NULL,
+    secret_key  BLOB NOT NULL,
+    signing_pk  BLOB NOT NULL,
+    signing_sk  BLOB NOT NULL
+);
+CREATE TABLE IF NOT EXISTS friends (
+    username    TEXT PRIMARY KEY,
+    public_key  BLOB NOT NULL,
+    signing_pk  BLOB NOT NULL,
+    last_ip     TEXT,
+    last_seen   TIMESTAMP,
+    added_at    TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+CREATE TABLE IF NOT EXISTS messages (
+    msg_id          TEXT PRIMARY KEY,
+    peer            TEXT NOT NULL,
+    direction       TEXT NOT NULL,
+    plaintext       TEXT NOT NULL,
+    timestamp       TIMESTAMP NOT NULL,
+    delivered       BOOLEAN DEFAULT FALSE,
+    delivery_method TEXT NOT NULL DEFAULT 'direct',
+    sender          TEXT,
+    expires_at      TIMESTAMP,
+    FOREIGN KEY (peer) REFERENCES friends(username)
+);
+CREATE INDEX IF NOT EXISTS idx_messages_peer_time ON messages(peer, timestamp);
+-- Reactions, edits and deletes, append-only; the rowid is the order they
+-- apply in. op: 1 react, 2 unreact, 3 edit, 4 delete. An empty author is us.
+CREATE TABLE IF NOT EXISTS message_deltas (
+    delta_id    TEXT PRIMARY KEY,
+    target      TEXT NOT NULL,
+    peer        TEXT NOT NULL,
+    author      TEXT NOT NULL DEFAULT '',
+    op          INTEGER NOT NULL,
+    value       TEXT NOT NULL DEFAULT '',
+    timestamp   TIMESTAMP NOT NULL
+);
+-- A UUID msg_id is stored as its 16 bytes (a BLOB), any other as text.
+CREATE TABLE IF NOT EXISTS seen_message_ids (
+    msg_id      TEXT PRIMARY KEY,
+    received_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    sent_at     TIMESTAMP
+);
+CREATE TABLE IF NOT EXISTS outbox (
+    msg_id      TEXT PRIMARY KEY,
+    to_user     TEXT NOT NULL,
+    ciphertext  TEXT NOT NULL,
+    queued_at   TIMESTAMP NOT NULL DEFAULT (strftime('%Y-%m-%dT%H:%M:%SZ', 'now')),
+    attempts    INTEGER NOT NULL DEFAULT 0
+);
+CREATE TABLE IF NOT EXISTS state_generation (
+    id          INTEGER PRIMARY KEY CHECK (id = 1),
+    value       INTEGER NOT NULL
+);
+INSERT OR IGNORE INTO state_generation (id, value) VALUES (1, 0);
+CREATE TABLE IF NOT EXISTS groups (
+    group_id    TEXT PRIMARY KEY,
+    name        TEXT NOT NULL,
+    created_by  TEXT NOT NULL,
+    created_at  TIMESTAMP DEFAULT CURRENT_TIMESTAMP
+);
+CREATE TABLE IF NOT EXISTS group_members (
+    group_id    TEXT NOT NULL,
+    username    TEXT NOT NULL,
+    PRIMARY KEY (group_id, username)
+);
+CREATE TABLE IF NOT EXISTS group_sender_keys (
+    group_id    TEXT NOT NULL,
+    sender      TEXT NOT NULL,
+    sender_key  BLOB NOT NULL,
+    PRIMARY KEY (group_id, sender)
+);
+-- The history archive's sparse index: one row per block of a segment
+-- file (storage/history_archive.h), and the id of every archived message.
+CREATE TABLE IF NOT EXISTS archive_blocks (
+    peer        TEXT NOT NULL,
+    segment     INTEGER NOT NULL,
+    byte_offset INTEGER NOT NULL,
+    byte_length INTEGER NOT NULL,
+    messages    INTEGER NOT NULL,
+    first_ts    TIMESTAMP NOT NULL,
+    last_ts     TIMESTAMP NOT NULL,
+    terms       BLOB NOT NULL,
+    PRIMARY KEY (peer, segment, byte_offset)
+) WITHOUT ROWID;
+CREATE TABLE IF NOT EXISTS archived_messages (
+    msg_id      TEXT PRIMARY KEY,
+    peer        TEXT NOT NULL,
+    timestamp   TIMESTAMP NOT NULL
+) WITHOUT ROWID;
+-- One row per conversation for the friends list: its newest message and
+-- how many received messages are newer than the last one read. Kept by
+-- triggers; an archived message leaves it alone (it is still there).
+CREATE TABLE IF NOT EXISTS conversation_summary (
+    peer            TEXT PRIMARY KEY,
+    last_msg_id     TEXT NOT NULL,
+    last_text       TEXT NOT NULL,
+    last_timestamp  TIMESTAMP NOT NULL,
+    last_direction  TEXT NOT NULL,
+    unread          INTEGER NOT NULL DEFAULT 0,
+    read_upto       TIMESTAMP NOT NULL DEFAULT ''
+) WITHOUT ROWID;
+CREATE TRIGGER IF NOT EXISTS summary_insert AFTER INSERT ON messages BEGIN
+    INSERT OR IGNORE INTO conversation_summary
+        (peer, last_msg_id, last_text, last_timestamp, last_direction)
+    VALUES (new.peer, '', '', '', '');
+    UPDATE conversation_summary SET last_msg_id = new.msg_id,
+        last_text = substr(new.plaintext, 1, 160), last_timestamp = new.timestamp,
+        last_direction = new.direction
+    WHERE peer = new.peer AND new.timestamp >= last_timestamp;
+    UPDATE conversation_summary SET unread = unread + 1
+    WHERE peer = new.peer AND new.direction = 'received' AND new.timestamp > read_upto;
+END;
+CREATE TRIGGER IF NOT EXISTS summary_delete AFTER DELETE ON messages
+WHEN NOT EXISTS (SELECT 1 FROM archived_messages WHERE msg_id = old.msg_id) BEGIN
+    UPDATE conversation_summary SET unread = unread - 1
+    WHERE peer = old.peer AND old.direction = 'received' AND old.timestamp > read_upto
+      AND unread > 0;
+    DELETE FROM conversation_summary
+    WHERE peer = old.peer AND NOT EXISTS (SELECT 1 FROM messages WHERE peer = old.peer);
+    UPDATE conversation_summary
+    SET (last_msg_id, last_text, last_timestamp, last_direction) =
+        (SELECT msg_id, substr(plaintext, 1, 160), timestamp, direction FROM messages
+         WHERE peer = old.peer ORDER BY timestamp DESC, rowid DESC LIMIT 1)
+    WHERE peer = old.peer AND last_msg_id = old.msg_id;
+END;
+CREATE TRIGGER IF NOT EXISTS friends_gen_insert AFTER INSERT ON friends BEGIN
+    UPDATE state_generation SET value = value + 1;
+END;
+CREATE TRIGGER IF NOT EXISTS friends_gen_update AFTER UPDATE ON friends BEGIN
+    UPDATE state_generation SET value = value + 1;
+END;
+CREATE TRIGGER IF NOT EXISTS friends_gen_delete AFTER DELETE ON friends BEGIN
+    UPDATE state_generation SET value = value + 1;
+END;
+)sql";
+
+// Applied after kSchema; each must be safe to re-run. ALTER TABLE has no
+// IF NOT EXISTS, so added columns go through add_column_if_missing().
+const char* const kIndexes = R"sql(
+CREATE INDEX IF NOT EXISTS idx_seen_sent_at ON seen_message_ids(sent_at);
+-- Arrival order within a conversation (the index carries the rowid).
+CREATE INDEX IF NOT EXISTS idx_messages_peer ON messages(peer);
+-- Device sync lists the messages of a day across all conversations.
+CREATE INDEX IF NOT EXISTS idx_messages_time ON messages(timestamp);
+CREATE INDEX IF NOT EXISTS idx_archived_time ON archived_messages(timestamp);
+-- A message's deltas in the order they apply (the index carries the rowid).
+CREATE INDEX IF NOT EXISTS idx_message_deltas_target ON message_deltas(target);
+-- Disappearing messages, soonest first. Partial: the rows that never expire
+-- (nearly all of them) cost the index nothing.
+CREATE INDEX IF NOT EXISTS idx_messages_expires ON messages(expires_at)
+WHERE expires_at IS NOT NULL;
+-- A database from before conversation_summary: one row per conversation,
+-- with the history it already has counted as read.
+INSERT OR IGNORE INTO conversation_summary
+    (peer, last_msg_id, last_text, last_timestamp, last_direction, read_upto)
+SELECT peer, msg_id, substr(plaintext, 1, 160), MAX(timestamp), direction, MAX(timestamp)
+FROM messages WHERE NOT EXISTS (SELECT 1 FROM conversation_summary) GROUP BY peer;
+)sql";
+
+// What import_history() brings up to date once at the end instead of row
+// by row: the secondary indexes on `messages`, and the conversation
+// summaries. kSchema and kIndexes recreate them.
+const char* const kDropForImport = R"sql(
+DROP INDEX IF EXISTS idx_messages_peer_time;
+DROP INDEX IF EXISTS idx_messages_peer;
+DROP INDEX IF EXISTS idx_messages_time;
+DROP TRIGGER IF EXISTS summary_insert;
+)sql";
+
+// The summary_insert trigger's work for the rows an import stored (rowid
+// > ?1), one conversation at a time. The unread counts are recounted after.
+const char* const kSummarizeImported = R"sql(
+INSERT INTO conversation_summary
+    (peer, last_msg_id, last_text, last_timestamp, last_direction)
+SELECT peer, msg_id, substr(plaintext, 1, 160), MAX(timestamp), direction
+FROM messages WHERE rowid > ?1 GROUP BY peer
+ON CONFLICT (peer) DO UPDATE SET last_msg_id = excluded.last_msg_id,
+    last_text = excluded.last_text, last_timestamp = excluded.last_timestamp,
+    last_direction = excluded.last_direction
+WHERE excluded.last_timestamp >= conversation_summary.last_timestamp
+)sql";
+
+// Full-text index over message text, kept in sync by triggers so every
+// writer (including a future one) updates it in the same transaction.
+// External content: the text is stored once, in `messages`. The prefix
+// indexes make search-as-you-type ("mee*") as cheap as a whole word.
+const char* const kSearchSchema = R"sql(
+CREATE VIRTUAL TABLE IF NOT EXISTS messages_fts USING fts5(
+    plaintext, content = 'messages', content_rowid = 'rowid',
+    tokenize = 'unicode61 remove_diacritics 2', prefix = '2 3'
+);
+CREATE TRIGGER IF NOT EXISTS messages_fts_insert AFTER INSERT ON messages BEGIN
+    INSERT INTO messages_fts (rowid, plaintext) VALUES (new.rowid, new.plaintext);
+END;
+CREATE TRIGGER IF NOT EXISTS messages_fts_delete AFTER DELETE ON messages BEGIN
+    INSERT INTO messages_fts (messages_fts, rowid, plaintext)
+    VALUES ('delete', old.rowid, old.plaintext);
+END;
+CREATE TRIGGER IF NOT EXISTS messages_fts_update AFTER UPDATE OF plaintext ON messages BEGIN
+    INSERT INTO messages_fts (messages_fts, rowid, plaintext)
+    VALUES ('delete', old.rowid, old.plaintext);
+    INSERT INTO messages_fts (rowid, plaintext) VALUES (new.rowid, new.plaintext);
+END;
+)sql";
+
+// Indexed by MessageStore::Statement.
+const char* const kStatementSql[] = {
+    // kInsertMessage — an archived msg_id counts as already stored; an
+    // expires_at that isn't a time is dropped, so it can't stall the sweep
+    "INSERT OR IGNORE INTO messages "
+    "(msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at) "
+    "SELECT ?1, ?2, ?3, ?4, ?5, ?6, ?7, NULLIF(?8, ''), "
+    "strftime('%Y-%m-%dT%H:%M:%SZ', NULLIF(?9, '')) "
+    "WHERE NOT EXISTS (SELECT 1 FROM archived_messages WHERE msg_id = ?1)",
+    // kInsertSeen
+    "INSERT OR IGNORE INTO seen_message_ids (msg_id, sent_at) VALUES (?1, ?2)",
+    // kPruneSeen — ?1 is an SQLite time modifier such as '-604800 seconds'
+    "DELETE FROM seen_message_ids "
+    "WHERE sent_at < strftime('%Y-%m-%dT%H:%M:%SZ', 'now', ?1)",
+    // kMarkDelivered
+    "UPDATE messages SET delivered = TRUE WHERE msg_id = ?1",
+    // kSetDeliveryMethod
+    "UPDATE messages SET delivery_method = ?2 WHERE msg_id = ?1",
+    // kDeleteMessage
+    "DELETE FROM messages WHERE msg_id = ?1",
+    // kSelectHistory
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE peer = ?1 "
+    "ORDER BY timestamp DESC, rowid DESC LIMIT ?2 OFFSET ?3",
+    // kSelectHistoryBeforeId — keyset: strictly older than message ?3
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE peer = ?1 AND (timestamp, rowid) < "
+    "(SELECT timestamp, rowid FROM messages WHERE msg_id = ?3 AND peer = ?1) "
+    "ORDER BY timestamp DESC, rowid DESC LIMIT ?2",
+    // kSelectHistoryBeforeTime — keyset: strictly older than timestamp ?3
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE peer = ?1 AND timestamp < ?3 "
+    "ORDER BY timestamp DESC, rowid DESC LIMIT ?2",
+    // kSelectHistoryAfter — stored after message ?3, in arrival (rowid)
+    // order: a received message's timestamp is the sender's clock and may
+    // sort before messages we already have. An empty ?3 starts from the
+    // beginning; an unknown msg_id matches nothing.
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE peer = ?1 AND rowid > IFNULL("
+    "(SELECT rowid FROM messages WHERE msg_id = ?3 AND peer = ?1), "
+    "CASE WHEN ?3 = '' THEN 0 END) "
+    "ORDER BY rowid LIMIT ?2",
+    // kSearch — bm25-rank the ?4 most recent matches, snippet the top ?3.
+    // Ranking every match would cost time proportional to how common the
+    // term is; snippets are only built for the rows returned.
+    "WITH recent AS ("
+    "  SELECT f.rowid AS id, bm25(messages_fts) AS score "
+    "  FROM messages_fts f JOIN messages m ON m.rowid = f.rowid "
+    "  WHERE messages_fts MATCH ?1 AND (?2 IS NULL OR m.peer = ?2) "
+    "  ORDER BY f.rowid DESC LIMIT ?4), "
+    "top AS (SELECT id, score FROM recent ORDER BY score LIMIT ?3) "
+    "SELECT m.msg_id, m.peer, m.direction, m.plaintext, m.timestamp, m.delivered, "
+    "m.delivery_method, m.sender, m.expires_at, snippet(messages_fts, 0, '**', '**', '…', 12) "
+    "FROM top JOIN messages_fts ON messages_fts.rowid = top.id "
+    "JOIN messages m ON m.rowid = top.id "
+    "WHERE messages_fts MATCH ?1 ORDER BY top.score",
+    // kCountHistory
+    "SELECT COUNT(*) FROM messages WHERE peer = ?1",
+    // kUpsertFriend
+    "INSERT INTO friends (username, public_key, signing_pk, last_ip, last_seen) "
+    "VALUES (?1, ?2, ?3, ?4, ?5) "
+    "ON CONFLICT(username) DO UPDATE SET public_key = excluded.public_key, "
+    "signing_pk = excluded.signing_pk, last_ip = excluded.last_ip, "
+    "last_seen = excluded.last_seen",
+    // kDeleteFriend
+    "DELETE FROM friends WHERE username = ?1",
+    // kSelectFriends
+    "SELECT username, public_key, signing_pk, last_ip, last_seen, "
+    "strftime('%Y-%m-%dT%H:%M:%SZ', added_at) FROM friends ORDER BY username",
+    // kSelectGeneration
+    "SELECT value FROM state_generation WHERE id = 1",
+    // kUpsertGroup
+    "INSERT INTO groups (group_id, name, created_by) VALUES (?1, ?2, ?3) "
+    "ON CONFLICT(group_id) DO UPDATE SET name = excluded.name",
+    // kDeleteGroupMembers
+    "DELETE FROM group_members WHERE group_id = ?1",
+    // kInsertGroupMember
+    "INSERT OR IGNORE INTO group_members (group_id, username) VALUES (?1, ?2)",
+    // kSelectGroups — one row per member, grouped by group_id
+    "SELECT g.group_id, g.name, g.created_by, strftime('%Y-%m-%dT%H:%M:%SZ', g.created_at), "
+    "m.username FROM groups g LEFT JOIN group_members m ON m.group_id = g.group_id "
+    "ORDER BY g.group_id, m.username",
+    // kUpsertSenderKey
+    "INSERT OR REPLACE INTO group_sender_keys (group_id, sender, sender_key) VALUES (?1, ?2, ?3)",
+    // kSelectSenderKeys
+    "SELECT group_id, sender, sender_key FROM group_sender_keys",
+    // kOutboxAdd
+    "INSERT OR REPLACE INTO outbox (msg_id, to_user, ciphertext) VALUES (?1, ?2, ?3)",
+    // kOutboxSelect
+    "SELECT msg_id, to_user, ciphertext, queued_at, attempts FROM outbox "
+    "ORDER BY attempts, rowid LIMIT ?1",
+    // kOutboxDelete
+    "DELETE FROM outbox WHERE msg_id = ?1",
+    // kOutboxFailed
+    "UPDATE outbox SET attempts = attempts + 1 WHERE msg_id = ?1",
+    // kOutboxSelectStale — ?1 is an SQLite time modifier, ?2 the attempt cap
+    "SELECT msg_id FROM outbox "
+    "WHERE queued_at < strftime('%Y-%m-%dT%H:%M:%SZ', 'now', ?1) OR attempts >= ?2",
+    // kSelectDigestRows — one pass to build the day digests
+    "SELECT msg_id, substr(timestamp, 1, 10) FROM messages UNION ALL "
+    "SELECT msg_id, substr(timestamp, 1, 10) FROM archived_messages",
+    // kSelectIdsForDay — ?1 is "YYYY-MM-DD"; '~' sorts after any time suffix
+    "SELECT msg_id FROM messages WHERE timestamp >= ?1 AND timestamp < ?1 || '~' UNION ALL "
+    "SELECT msg_id FROM archived_messages WHERE timestamp >= ?1 AND timestamp < ?1 || '~'",
+    // kSelectMessage
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE msg_id = ?1",
+    // kSelectPeer
+    "SELECT peer FROM messages WHERE msg_id = ?1",
+    // kArchivePeer — a conversation with a message old enough to archive;
+    // ?1 is an SQLite time modifier. Undelivered sent messages stay live,
+    // and so do disappearing ones until the expiry sweep deletes them.
+    "SELECT peer FROM messages "
+    "WHERE timestamp < strftime('%Y-%m-%dT%H:%M:%SZ', 'now', ?1) "
+    "AND (delivered OR direction = 'received') AND expires_at IS NULL LIMIT 1",
+    // kArchiveSelect — the oldest of them in conversation ?1
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE peer = ?1 "
+    "AND timestamp < strftime('%Y-%m-%dT%H:%M:%SZ', 'now', ?2) "
+    "AND (delivered OR direction = 'received') AND expires_at IS NULL "
+    "ORDER BY timestamp, rowid LIMIT ?3",
+    // kArchiveTail — where the next block of ?1 goes
+    "SELECT segment, byte_offset + byte_length FROM archive_blocks WHERE peer = ?1 "
+    "ORDER BY segment DESC, byte_offset DESC LIMIT 1",
+    // kArchiveInsertBlock
+    "INSERT INTO archive_blocks "
+    "(peer, segment, byte_offset, byte_length, messages, first_ts, last_ts, terms) "
+    "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)",
+    // kArchiveInsertId
+    "INSERT OR IGNORE INTO archived_messages (msg_id, peer, timestamp) VALUES (?1, ?2, ?3)",
+    // kArchiveBlocks — columns as read_block() expects them
+    "SELECT segment, byte_offset, byte_length, messages, first_ts, last_ts, terms "
+    "FROM archive_blocks WHERE peer = ?1 ORDER BY segment, byte_offset",
+    // kArchiveSearchBlocks — every block of ?1 (all when NULL), newest first
+    "SELECT segment, byte_offset, byte_length, messages, first_ts, last_ts, terms, peer "
+    "FROM archive_blocks WHERE ?1 IS NULL OR peer = ?1 ORDER BY last_ts DESC",
+    // kSelectArchived
+    "SELECT peer, timestamp FROM archived_messages WHERE msg_id = ?1",
+    // kArchiveDeleteBlocks
+    "DELETE FROM archive_blocks WHERE peer = ?1",
+    // kArchiveDeleteId
+    "DELETE FROM archived_messages WHERE msg_id = ?1",
+    // kHasArchive — whether ?1 (any conversation when NULL) has archived
+    // messages; each half is a single index probe
+    "SELECT EXISTS (SELECT 1 FROM archive_blocks WHERE ?1 IS NULL) "
+    "OR EXISTS (SELECT 1 FROM archive_blocks WHERE peer = ?1)",
+    // kSelectSummaries — one conversation, or all of them when ?1 is NULL
+    "SELECT peer, last_msg_id, last_text, last_timestamp, last_direction, unread "
+    "FROM conversation_summary WHERE ?1 IS NULL OR peer = ?1",
+    // kMarkRead — read up to message ?2; never moves back
+    "UPDATE conversation_summary SET read_upto = MAX(read_upto, IFNULL("
+    "(SELECT timestamp FROM messages WHERE msg_id = ?2 AND peer = ?1), read_upto)) "
+    "WHERE peer = ?1",
+    // kCountUnread — from the (peer, timestamp) index
+    "UPDATE conversation_summary SET unread = (SELECT COUNT(*) FROM messages "
+    "WHERE peer = ?1 AND direction = 'received' "
+    "AND timestamp > conversation_summary.read_upto) WHERE peer = ?1",
+    // kExportBlocks — every archive block, each conversation oldest first
+    "SELECT segment, byte_offset, byte_length, messages, first_ts, last_ts, terms, peer "
+    "FROM archive_blocks ORDER BY peer, segment, byte_offset",
+    // kExportMessages
+    "SELECT msg_id, peer, direction, plaintext, timestamp, delivered, delivery_method, sender, "
+    "expires_at FROM messages WHERE expires_at IS NULL ORDER BY rowid",
+    // kSelectExpired — from idx_messages_expires: only the rows due
+    "SELECT msg_id, peer, timestamp FROM messages "
+    "WHERE expires_at IS NOT NULL AND expires_at <= strftime('%Y-%m-%dT%H:%M:%SZ', 'now') "
+    "ORDER BY expires_at LIMIT ?1",
+    // kNextExpiry — the soonest expires_at and how many seconds away it is
+    "SELECT expires_at, strftime('%s', expires_at) - strftime('%s', 'now') FROM messages "
+    "WHERE expires_at IS NOT NULL ORDER BY expires_at LIMIT 1",
+    // kInsertDelta — a delta_id already stored is a replay
+    "INSERT OR IGNORE INTO message_deltas "
+    "(delta_id, target, peer, author, op, value, timestamp) VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7)",
+    // kSelectDeltas — in the order they apply
+    "SELECT peer, author, op, value FROM message_deltas WHERE target = ?1 ORDER BY rowid",
+    // kSelectDeltaTargets
+    "SELECT DISTINCT target FROM message_deltas",
+    // kDeleteDeltas
+    "DELETE FROM message_deltas WHERE target = ?1",
+    // kBegin
+    "BEGIN",
+    // kCommit
+    "COMMIT",
+    // kRollback
+    "ROLLBACK",
+    // kSavepoint
+    "SAVEPOINT row",
+    // kRelease
+    "RELEASE row",
+    // kRollbackTo
+    "ROLLBACK TO row",
+};
+
+/// Resets a cached statement and clears its bindings when it goes out of scope.
+class StatementScope {
+public:
+    explicit StatementScope(sqlite3_stmt* stmt) : stmt_(stmt) {}
+    ~StatementScope() {
+        sqlite3_reset(stmt_);
+        sqlite3_clear_bindings(stmt_);
+    }
+    StatementScope(const StatementScope&) = delete;
+    StatementScope& operator=(const StatementScope&) = delete;
+
+private:
+    sqlite3_stmt* stmt_;
+};
+
+void bind_text(sqlite3_stmt* stmt, int index, const std::string& value) {
+    sqlite3_bind_text(stmt, index, value.data(), static_cast<int>(value.size()), SQLITE_TRANSIENT);
+}
+
+void bind_blob(sqlite3_stmt* stmt, int index, const std::vector<uint8_t>& value) {
+    // A non-null pointer keeps an empty key as a zero-length BLOB rather
+    // than NULL, which the NOT NULL columns would reject.
+    static const uint8_t kEmpty = 0;
+    sqlite3_bind_blob(stmt, index, value.empty() ? &kEmpty : value.data(),
+                      static_cast<int>(value.size()), SQLITE_TRANSIENT);
+}
+
+// Seen ids that are UUIDs are keyed by their 16 bytes, anything else a
+// peer sent by its text. SQLite never finds a BLOB equal to a TEXT.
+void bind_seen_id(sqlite3_stmt* stmt, int index, const std::string& msg_id) {
+    if (const auto id = MsgId::parse(msg_id)) {
+        sqlite3_bind_blob(stmt, index, id->bytes.data(), static_cast<int>(id->bytes.size()),
+                          SQLITE_TRANSIENT);
+    } else {
+        bind_text(stmt, index, msg_id);
+    }
+}
+
+std::string column_text(sqlite3_stmt* stmt, int col) {
+    const auto* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, col));
+    return text ? std::string(text, static_cast<std::size_t>(sqlite3_column_bytes(stmt, col)))
+                : std::string();
+}
+
+std::vector<uint8_t> column_blob(sqlite3_stmt* stmt, int col) {
+    const auto* data = static_cast<const uint8_t*>(sqlite3_column_blob(stmt, col));
+    const int size = sqlite3_column_bytes(stmt, col);
+    return data ? std::vector<uint8_t>(data, data + size) : std::vector<uint8_t>();
+}
+
+/// The common leading columns (msg_id ... expires_at) of a messages row.
+MessageStore::Message read_message(sqlite3_stmt* s) {
+    MessageStore::Message m;
+    m.msg_id = column_text(s, 0);
+    m.peer = column_text(s, 1);
+    m.direction = column_text(s, 2) == "sent" ? MessageStore::Direction::Sent
+                                               : MessageStore::Direction::Received;
+    m.plaintext = column_text(s, 3);
+    m.timestamp = column_text(s, 4);
+    m.delivered = sqlite3_column_int(s, 5) != 0;
+    m.delivery_method = column_text(s, 6);
+    m.sender = column_text(s, 7);
+    m.expires_at = column_text(s, 8);
+    return m;
+}
+
+/// Turn free text into an FTS5 query: every word must appear, the last one
+/// may be a prefix (the user is probably still typing it). Words are quoted,
+/// so FTS5 operators and stray quotes in the input are searched literally
+/// instead of failing to parse.
+std::string fts_query(const std::string& text) {
+    std::string query;
+    std::size_t i = 0;
+    while (i < text.size()) {
+        while (i < text.size() && std::isspace(static_cast<unsigned char>(text[i]))) ++i;
+        if (i == text.size()) break;
+        if (!query.empty()) query += ' ';
+        query += '"';
+        for (; i < text.size() && !std::isspace(static_cast<unsigned char>(text[i])); ++i) {
+            if (text[i] == '"') query += '"';
+            query += text[i];
+        }
+        query += '"';
+    }
+    if (!query.empty() && !std::isspace(static_cast<unsigned char>(text.back()))) {
+        query += '*';
+    }
+    return query;
+}
+
+const char* direction_name(MessageStore::Direction d) {
+    return d == MessageStore::Direction::Sent ? "sent" : "received";
+}
+
+/// An archive_blocks row, from column `col` on.
+HistoryArchive::Block read_block(sqlite3_stmt* s, int col) {
+    HistoryArchive::Block b;
+    b.segment = sqlite3_column_int64(s, col);
+    b.offset = static_cast<uint64_t>(sqlite3_column_int64(s, col + 1));
+    b.length = static_cast<uint32_t>(sqlite3_column_int64(s, col + 2));
+    b.count = static_cast<uint32_t>(sqlite3_column_int64(s, col + 3));
+    b.first_ts = column_text(s, col + 4);
+    b.last_ts = column_text(s, col + 5);
+    const auto* terms = static_cast<const uint8_t*>(sqlite3_column_blob(s, col + 6));
+    if (terms && static_cast<std::size_t>(sqlite3_column_bytes(s, col + 6)) == b.terms.size()) {
+        std::copy(terms, terms + b.terms.size(), b.terms.begin());
+    } else {
+        b.terms.fill(0xff);                     // unknown: may match anything
+    }
+    return b;
+}
+
+bool has_schema_object(sqlite3* db, const char* name) {
+    sqlite3_stmt* probe = nullptr;
+    bool found = false;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE name = ?1", -1, &probe,
+                           nullptr) == SQLITE_OK) {
+        sqlite3_bind_text(probe, 1, name, -1, SQLITE_STATIC);
+        found = sqlite3_step(probe) == SQLITE_ROW;
+    }
+    sqlite3_finalize(probe);
+    return found;
+}
+
+} // namespace
+
+struct MessageStore::ArchiveIndex {
+    std::vector<HistoryArchive::Block> blocks;
+    std::size_t total = 0;                      // messages in all blocks
+};
+
+struct MessageStore::Reader {
+    /// The statements a reader prepares; kSearch only if the writer has
+    /// the search index.
+    static constexpr Statement kStatements[] = {
+        kSelectHistory, kSelectHistoryBeforeId, kSelectHistoryBeforeTime, kSelectHistoryAfter,
+        kSearch,        kCountHistory,          kSelectPeer,              kSelectDeltas,
+        kExportMessages, kHasArchive,           kBegin,                   kCommit,
+    };
+
+    /// One read transaction, so every query of a read sees the same commit.
+    class Snapshot {
+    public:
+        explicit Snapshot(Reader& reader) : reader_(reader), ok_(reader.run(kBegin)) {}
+        ~Snapshot() {
+            if (ok_) reader_.run(kCommit);
+        }
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+
+        explicit operator bool() const { return ok_; }
+
+    private:
+        Reader& reader_;
+        bool ok_;
+    };
+
+    sqlite3* db = nullptr;
+    std::array<sqlite3_stmt*, kStatementCount> stmts{};
+
+    Reader() = default;
+    ~Reader() {
+        for (auto* s : stmts) {
+            sqlite3_finalize(s);
+        }
+        sqlite3_close(db);
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    sqlite3_stmt* stmt(Statement s) const { return stmts[s]; }
+
+    bool run(Statement s) {
+        StatementScope scope(stmt(s));
+        const int rc = sqlite3_step(stmt(s));
+        if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+            spdlog::warn("SQLite error on a reader: {}", sqlite3_errmsg(db));
+            return false;
+        }
+        return true;
+    }
+
+    /// Whether `peer` (any conversation when empty) has archived messages.
+    /// Reads that could reach them go to the DB thread, so an error says
+    /// yes.
+    bool has_archive(const std::string& peer) {
+        auto* s = stmt(kHasArchive);
+        StatementScope scope(s);
+        if (!peer.empty()) {
+            bind_text(s, 1, peer);
+        }
+        return sqlite3_step(s) != SQLITE_ROW || sqlite3_column_int(s, 0) != 0;
+    }
+
+    /// MessageStore::is_live() on this connection.
+    bool is_live(const std::string& msg_id, const std::string& peer) {
+        auto* s = stmt(kSelectPeer);
+        StatementScope scope(s);
+        bind_text(s, 1, msg_id);
+        return sqlite3_step(s) == SQLITE_ROW && column_text(s, 0) == peer;
+    }
+};
+
+thread_local MessageStore::Reader* MessageStore::current_reader_ = nullptr;
+
+MessageStore::MessageStore() : MessageStore(Options{}) {}
+
+MessageStore::MessageStore(Options options)
+    : options_(std::move(options)),
+      work_(asio::make_work_guard(io_)),
+      commit_timer_(io_),
+      prune_timer_(io_),
+      archive_timer_(io_),
+      thread_([this] {
+          if (!options_.cpus.empty()) {
+              cpu_affinity::pin_current(options_.cpus);
+          }
+          io_.run();
+      }) {}
+
+MessageStore::~MessageStore() {
+    close();
+    work_.reset();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void MessageStore::post(std::function<void()> fn) {
+    unsettled_.fetch_add(1, std::memory_order_relaxed);
+    asio::post(io_, [this, fn = std::move(fn)] {
+        fn();
+        ++ran_;
+        settle();
+    });
+}
+
+void MessageStore::settle() {
+    if (ran_ > 0 && pending_.empty()) {
+        unsettled_.fetch_sub(ran_, std::memory_order_release);
+        ran_ = 0;
+    }
+}
+
+void MessageStore::post_bulk(std::function<void()> fn) {
+    std::lock_guard lock(bulk_mutex_);
+    bulk_.push_back(std::move(fn));
+    if (!bulk_posted_) {
+        bulk_posted_ = true;
+        post([this] { run_bulk(); });
+    }
+}
+
+void MessageStore::run_bulk() {
+    std::function<void()> job;
+    {
+        std::lock_guard lock(bulk_mutex_);
+        job = std::move(bulk_.front());
+        bulk_.pop_front();
+    }
+    job();
+    std::lock_guard lock(bulk_mutex_);
+    if (bulk_.empty()) {
+        bulk_posted_ = false;
+    } else {
+        post([this] { run_bulk(); });
+    }
+}
+
+void MessageStore::post_read(std::function<bool(Reader&)> read, std::function<void()> on_db,
+                             bool bulk) {
+    auto fallback = [this, bulk, on_db = std::move(on_db)]() mutable {
+        if (bulk) {
+            post_bulk(std::move(on_db));
+        } else {
+            post(std::move(on_db));
+        }
+    };
+    if (!reading_) {
+        fallback();
+        return;
+    }
+    auto job = [read = std::move(read), fallback = std::move(fallback)]() mutable {
+        if (!current_reader_ || !read(*current_reader_)) {
+            fallback();
+        }
+    };
+    if (unsettled_.load(std::memory_order_acquire) == 0) {
+        asio::post(read_io_, std::move(job));
+        return;
+    }
+    // Let the writes queued ahead of this read commit first.
+    post([this, job = std::move(job)]() mutable {
+        commit_pending();
+        if (reading_) {
+            asio::post(read_io_, std::move(job));
+        } else {
+            job();                              // closing: no reader here, so on_db
+        }
+    });
+}
+
+void MessageStore::start_readers() {
+    if (options_.in_memory || options_.read_connections == 0 || !readers_.empty()) {
+        return;
+    }
+    read_io_.restart();
+    read_work_.emplace(asio::make_work_guard(read_io_));
+    for (std::size_t i = 0; i < options_.read_connections; ++i) {
+        readers_.emplace_back([this] {
+            if (!options_.cpus.empty()) {
+                cpu_affinity::unpin_current();  // the DB thread's pinning isn't ours
+            }
+            Reader reader;
+            if (open_reader(reader)) {
+                current_reader_ = &reader;
+            }
+            read_io_.run();
+            current_reader_ = nullptr;
+        });
+    }
+    reading_ = true;
+}
+
+void MessageStore::stop_readers() {
+    reading_ = false;
+    read_work_.reset();
+    for (auto& reader : readers_) {
+        reader.join();
+    }
+    readers_.clear();
+}
+
+bool MessageStore::open_reader(Reader& reader) {
+    if (sqlite3_open_v2(options_.path.c_str(), &reader.db,
+                        SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX,
+                        vfs_ ? vfs_->name() : nullptr) != SQLITE_OK) {
+        spdlog::warn("Cannot open a read connection to {}: {}", options_.path,
+                     reader.db ? sqlite3_errmsg(reader.db) : "out of memory");
+        return false;
+    }
+    sqlite3_busy_timeout(reader.db, static_cast<int>(options_.busy_timeout.count()));
+    const std::string pragmas = "PRAGMA query_only = 1;"
+                                "PRAGMA cache_size = -" + std::to_string(options_.cache_size_kib) + ";"
+                                "PRAGMA temp_store = MEMORY;";
+    if (sqlite3_exec(reader.db, pragmas.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK) {
+        spdlog::warn("Cannot set up a read connection: {}", sqlite3_errmsg(reader.db));
+        return false;
+    }
+    for (const Statement i : Reader::kStatements) {
+        if (i == kSearch && !search_enabled_) {
+            continue;
+        }
+        if (sqlite3_prepare_v3(reader.db, kStatementSql[i], -1, SQLITE_PREPARE_PERSISTENT,
+                               &reader.stmts[i], nullptr) != SQLITE_OK) {
+            spdlog::warn("Cannot prepare statement {} on a reader: {}", static_cast<int>(i),
+                         sqlite3_errmsg(reader.db));
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MessageStore::open() {
+    return open_async().get();
+}
+
+std::future<bool> MessageStore::open_async() {
+    auto done = std::make_shared<std::promise<bool>>();
+    auto result = done->get_future();
+    post([this, done] {
+        if (db_) {
+            done->set_value(true);
+            return;
+        }
+        const char* vfs_name = nullptr;
+        if (options_.in_memory) {
+            options_.encrypt = false;
+            options_.archive_after = std::chrono::hours(0);
+        }
+        if (options_.encrypt) {
+            if (!vfs_) {
+                vfs_ = EncryptedVfs::open(options_.path, options_.passphrase);
+            }
+            sodium_memzero(options_.passphrase.data(), options_.passphrase.size());
+            options_.passphrase.clear();
+            if (!vfs_) {
+                done->set_value(false);
+                return;
+            }
+            vfs_name = vfs_->name();
+        }
+        sqlite3* db = nullptr;
+        const std::string& file = options_.in_memory ? kMemoryPath : options_.path;
+        if (sqlite3_open_v2(file.c_str(), &db,
+                            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX,
+                            vfs_name) != SQLITE_OK) {
+            spdlog::error("Cannot open database {}: {}", file,
+                          db ? sqlite3_errmsg(db) : "out of memory");
+            sqlite3_close(db);
+            done->set_value(false);
+            return;
+        }
+        db_ = db;
+        sqlite3_busy_timeout(db_, static_cast<int>(options_.busy_timeout.count()));
+        if (vfs_) {
+            // Fixed page geometry: only takes effect on a new database,
+            // which is the one that needs it.
+            int reserve = EncryptedVfs::kReserveBytes;
+            exec(("PRAGMA page_size = " + std::to_string(EncryptedVfs::kPageSize) + ";").c_str());
+            sqlite3_file_control(db_, "main", SQLITE_FCNTL_RESERVE_BYTES, &reserve);
+        }
+
+        // A memory database has nothing to make durable.
+        const std::string pragmas =
+            (options_.in_memory ? "PRAGMA journal_mode = MEMORY;"
+                                  "PRAGMA synchronous = OFF;"
+                                : "PRAGMA journal_mode = WAL;"
+                                  "PRAGMA synchronous = " + options_.synchronous + ";") +
+            "PRAGMA cache_size = -" + std::to_string(options_.cache_size_kib) + ";"
+            "PRAGMA temp_store = MEMORY;";
+        // Summaries without their trigger are from an import that was cut
+        // short: they are rebuilt from the messages, all counted as read.
+        const bool stale_summaries = has_schema_object(db_, "conversation_summary") &&
+                                     !has_schema_object(db_, "summary_insert");
+        if (stale_summaries) {
+            spdlog::warn("Rebuilding conversation summaries after an interrupted import");
+        }
+        if (!exec(pragmas.c_str()) || !exec(kSchema) ||
+            !add_column_if_missing("seen_message_ids", "sent_at", "TIMESTAMP") ||
+            !add_column_if_missing("messages", "sender", "TEXT") ||
+            !add_column_if_missing("messages", "expires_at", "TIMESTAMP") ||
+            !pack_seen_ids() ||
+            (stale_summaries && !exec("DELETE FROM conversation_summary")) ||
+            !exec(kIndexes)) {
+            sqlite3_close(db_);
+            db_ = nullptr;
+            done->set_value(false);
+            return;
+        }
+        open_search_index();
+
+        for (std::size_t i = 0; i < kStatementCount; ++i) {
+            if (i == kSearch && !search_enabled_) {
+                continue;
+            }
+            if (sqlite3_prepare_v3(db_, kStatementSql[i], -1, SQLITE_PREPARE_PERSISTENT,
+                                   &stmts_[i], nullptr) != SQLITE_OK) {
+                spdlog::error("Cannot prepare statement {}: {}", i, sqlite3_errmsg(db_));
+                finalize_statements();
+                sqlite3_close(db_);
+                db_ = nullptr;
+                done->set_value(false);
+                return;
+            }
+        }
+        if (!archive_) {
+            archive_ = std::make_unique<HistoryArchive>(
+                options_.archive_dir.empty() ? options_.path + "-archive" : options_.archive_dir,
+                vfs_.get());
+        }
+        if (!load_summaries()) {
+            spdlog::warn("Conversation summaries unavailable until the next change");
+        }
+        {
+            std::unique_lock targets(delta_targets_mutex_);
+            StatementScope scope(stmt(kSelectDeltaTargets));
+            while (sqlite3_step(stmt(kSelectDeltaTargets)) == SQLITE_ROW) {
+                delta_targets_.insert(column_text(stmt(kSelectDeltaTargets), 0));
+            }
+        }
+        spdlog::info("Database opened: {}", file);
+        open_ = true;
+        if (options_.replay_window.count() > 0) {
+            prune_seen();
+        }
+        schedule_expiry();
+        if (options_.archive_after.count() > 0) {
+            // After whatever startup queued behind the open.
+            post_bulk([this] { archive_old(); });
+        }
+        start_readers();
+        done->set_value(true);
+    });
+    return result;
+}
+
+void MessageStore::set_commit_policy(std::chrono::milliseconds window, std::size_t batch) {
+    post([this, window, batch] {
+        options_.commit_window = window;
+        options_.commit_batch = std::max<std::size_t>(1, batch);
+    });
+}
+
+void MessageStore::close() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    std::promise<void> done;
+    auto result = done.get_future();
+    post([this, &done] {
+        commit_pending();
+        commit_timer_.cancel();
+        prune_timer_.cancel();
+        archive_timer_.cancel();
+        TimerWheel::of(io_).cancel(expiry_timer_);
+        expiry_timer_ = {};
+        expiry_due_.clear();
+        if (db_) {
+            finalize_statements();
+            sqlite3_close(db_);
+            db_ = nullptr;
+            spdlog::debug("Database closed");
+        }
+        done.set_value();
+    });
+    open_ = false;
+    result.wait();
+    stop_readers();
+}
+
+void MessageStore::finalize_statements() {
+    for (auto& s : stmts_) {
+        sqlite3_finalize(s);
+        s = nullptr;
+    }
+}
+
+bool MessageStore::exec(const char* sql) {
+    char* err = nullptr;
+    if (sqlite3_exec(db_, sql, nullptr, nullptr, &err) != SQLITE_OK) {
+        spdlog::error("SQLite error: {}", err ? err : "unknown");
+        sqlite3_free(err);
+        return false;
+    }
+    return true;
+}
+
+void MessageStore::open_search_index() {
+    // The insert trigger is the mark of a current index: a new database
+    // has none yet, and import_history() drops it while it works.
+    const bool current = has_schema_object(db_, "messages_fts_insert");
+
+    char* err = nullptr;
+    search_enabled_ = sqlite3_exec(db_, kSearchSchema, nullptr, nullptr, &err) == SQLITE_OK;
+    if (!search_enabled_) {
+        // Most likely an SQLite built without FTS5; everything but search works.
+        spdlog::warn("Message search unavailable: {}", err ? err : "unknown error");
+        sqlite3_free(err);
+        return;
+    }
+    if (!current) {
+        spdlog::info("Indexing existing messages for search");
+        search_enabled_ = exec("INSERT INTO messages_fts (messages_fts) VALUES ('rebuild')");
+    }
+}
+
+bool MessageStore::add_column_if_missing(const char* table, const char* column,
+                                         const char* type) {
+    sqlite3_stmt* info = nullptr;
+    const std::string pragma = std::string("PRAGMA table_info(") + table + ")";
+    if (sqlite3_prepare_v2(db_, pragma.c_str(), -1, &info, nullptr) != SQLITE_OK) {
+        spdlog::error("SQLite error: {}", sqlite3_errmsg(db_));
+        return false;
+    }
+    bool found = false;
+    while (!found && sqlite3_step(info) == SQLITE_ROW) {
+        found = column_text(info, 1) == column;
+    }
+    sqlite3_finalize(info);
+    if (found) {
+        return true;
+    }
+    spdlog::info("Upgrading database: adding {}.{}", table, column);
+    const std::string alter =
+        std::string("ALTER TABLE ") + table + " ADD COLUMN " + column + " " + type;
+    return exec(alter.c_str());
+}
+
+bool MessageStore::pack_seen_ids() {
+    sqlite3_stmt* select = nullptr;
+    if (sqlite3_prepare_v2(db_,
+                           "SELECT rowid, msg_id FROM seen_message_ids "
+                           "WHERE typeof(msg_id) = 'text' AND length(msg_id) = 36",
+                           -1, &select, nullptr) != SQLITE_OK) {
+        spdlog::error("SQLite error: {}", sqlite3_errmsg(db_));
+        return false;
+    }
+    std::vector<std::pair<sqlite3_int64, MsgId>> rows;
+    while (sqlite3_step(select) == SQLITE_ROW) {
+        if (const auto id = MsgId::parse(column_text(select, 1))) {
+            rows.emplace_back(sqlite3_column_int64(select, 0), *id);
+        }
+    }
+    sqlite3_finalize(select);
+    if (rows.empty()) {
+        return true;
+    }
+    spdlog::info("Upgrading database: packing {} seen message ids", rows.size());
+    if (!exec("BEGIN")) {
+        return false;
+    }
+    sqlite3_stmt* update = nullptr;
+    if (sqlite3_prepare_v2(db_, "UPDATE OR IGNORE seen_message_ids SET msg_id = ?2 WHERE rowid = ?1",
+                           -1, &update, nullptr) != SQLITE_OK) {
+        spdlog::error("SQLite error: {}", sqlite3_errmsg(db_));
+        exec("ROLLBACK");
+        return false;
+    }
+    bool ok = true;
+    for (const auto& [rowid, id] : rows) {
+        sqlite3_bind_int64(update, 1, rowid);
+        sqlite3_bind_blob(update, 2, id.bytes.data(), static_cast<int>(id.bytes.size()),
+                          SQLITE_STATIC);
+        ok = ok && step_done(update);
+        sqlite3_reset(update);
+    }
+    sqlite3_finalize(update);
+    if (!ok || !exec("COMMIT")) {
+        exec("ROLLBACK");
+        return false;
+    }
+    return true;
+}
+
+bool MessageStore::step_done(sqlite3_stmt* s) {
+    const int rc = sqlite3_step(s);
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+        spdlog::warn("SQLite error: {}", sqlite3_errmsg(db_));
+        return false;
+    }
+    return true;
+}
+
+bool MessageStore::run(Statement s) {
+    StatementScope scope(stmt(s));
+    return step_done(stmt(s));
+}
+
+std::string MessageStore::peer_of(const std::string& msg_id) {
+    {
+        StatementScope scope(stmt(kSelectPeer));
+        bind_text(stmt(kSelectPeer), 1, msg_id);
+        if (sqlite3_step(stmt(kSelectPeer)) == SQLITE_ROW) {
+            return column_text(stmt(kSelectPeer), 0);
+        }
+    }
+    StatementScope scope(stmt(kSelectArchived));
+    bind_text(stmt(kSelectArchived), 1, msg_id);
+    return sqlite3_step(stmt(kSelectArchived)) == SQLITE_ROW ? column_text(stmt(kSelectArchived), 0)
+                                                             : std::string();
+}
+
+bool MessageStore::is_live(const std::string& msg_id, const std::string& peer) {
+    StatementScope scope(stmt(kSelectPeer));
+    bind_text(stmt(kSelectPeer), 1, msg_id);
+    return sqlite3_step(stmt(kSelectPeer)) == SQLITE_ROW && column_text(stmt(kSelectPeer), 0) == peer;
+}
+
+bool MessageStore::bind_message(sqlite3_stmt* s, const Message& m) {
+    bind_text(s, 1, m.msg_id);
+    bind_text(s, 2, m.peer);
+    sqlite3_bind_text(s, 3, direction_name(m.direction), -1, SQLITE_STATIC);
+    bind_text(s, 4, m.plaintext);
+    bind_text(s, 5, m.timestamp);
+    sqlite3_bind_int(s, 6, m.delivered ? 1 : 0);
+    bind_text(s, 7, m.delivery_method);
+    bind_text(s, 8, m.sender);
+    bind_text(s, 9, m.expires_at);
+    return step_done(s);
+}
+
+// ─── Messages ────────────────────────────────────────────────────────────────
+
+void MessageStore::insert_message(Message message, Done done) {
+    if (backlog_) backlog_->add(1);
+    post([this, message = std::move(message), done = std::move(done)]() mutable {
+        if (backlog_) backlog_->add(-1);
+        InsertCallback adapt;
+        if (done) {
+            adapt = [done = std::move(done)](InsertResult r) { done(r != InsertResult::Failed); };
+        }
+        enqueue_insert({std::move(message), false, false, std::move(adapt)});
+    });
+}
+
+void MessageStore::record_received(Message message, bool expires, InsertCallback done) {
+    if (backlog_) backlog_->add(1);
+    post([this, message = std::move(message), expires, done = std::move(done)]() mutable {
+        if (backlog_) backlog_->add(-1);
+        enqueue_insert({std::move(message), true, expires, std::move(done)});
+    });
+}
+
+void MessageStore::flush() {
+    post([this] { commit_pending(); });
+}
+
+void MessageStore::append_deltas(std::vector<Delta> deltas, Done done) {
+    if (deltas.empty()) {
+        if (done) done(true);
+        return;
+    }
+    if (backlog_) backlog_->add(1);
+    post([this, deltas = std::move(deltas), done = std::move(done)]() mutable {
+        if (backlog_) backlog_->add(-1);
+        InsertCallback adapt;
+        if (done) {
+            adapt = [done = std::move(done)](InsertResult r) { done(r != InsertResult::Failed); };
+        }
+        PendingInsert insert;
+        insert.message.msg_id = deltas.front().delta_id;
+        insert.message.peer = deltas.front().peer;
+        insert.done = std::move(adapt);
+        insert.deltas = std::move(deltas);
+        enqueue_insert(std::move(insert));
+    });
+}
+
+void MessageStore::record_deltas(std::string batch_id, std::string sent_at, bool expires,
+                                 std::vector<Delta> deltas, InsertCallback done) {
+    if (deltas.empty()) {
+        done(InsertResult::Failed);
+        return;
+    }
+    if (backlog_) backlog_->add(1);
+    post([this, batch_id = std::move(batch_id), sent_at = std::move(sent_at), expires,
+          deltas = std::move(deltas), done = std::move(done)]() mutable {
+        if (backlog_) backlog_->add(-1);
+        PendingInsert insert;
+        insert.message.msg_id = std::move(batch_id);
+        insert.message.peer = deltas.front().peer;
+        insert.message.timestamp = std::move(sent_at);
+        insert.check_seen = true;
+        insert.expires = expires;
+        insert.done = std::move(done);
+        insert.deltas = std::move(deltas);
+        enqueue_insert(std::move(insert));
+    });
+}
+
+void MessageStore::apply_deltas(std::vector<Message>& messages) {
+    for (auto& m : messages) {
+        apply_deltas(m);
+    }
+}
+
+void MessageStore::apply_deltas(Message& m) {
+    if (!delta_targets_.contains(m.msg_id)) {
+        return;
+    }
+    if (const DeltaView* view = delta_view(m)) {
+        apply_view(*view, m);
+    }
+}
+
+void MessageStore::apply_deltas(Reader& reader, std::vector<Message>& messages) {
+    for (auto& m : messages) {
+        apply_deltas(reader, m);
+    }
+}
+
+void MessageStore::apply_deltas(Reader& reader, Message& m) {
+    {
+        std::shared_lock targets(delta_targets_mutex_);
+        if (!delta_targets_.contains(m.msg_id)) {
+            return;
+        }
+    }
+    DeltaView view;
+    if (fold_deltas(reader.stmt(kSelectDeltas), m, view)) {
+        apply_view(view, m);
+    }
+}
+
+void MessageStore::apply_view(const DeltaView& view, Message& m) {
+    m.reactions = view.reactions;
+    if (view.deleted) {
+        m.deleted = true;
+        m.plaintext.clear();
+    } else if (view.text) {
+        m.edited = true;
+        m.plaintext = *view.text;
+    }
+}
+
+const MessageStore::DeltaView* MessageStore::delta_view(const Message& m) {
+    if (auto it = delta_views_.find(m.msg_id); it != delta_views_.end()) {
+        delta_lru_.splice(delta_lru_.begin(), delta_lru_, it->second.lru);
+        return &it->second;
+    }
+    DeltaView view;
+    if (!fold_deltas(stmt(kSelectDeltas), m, view)) {
+        return nullptr;
+    }
+    while (!delta_lru_.empty() && delta_views_.size() >= std::max<std::size_t>(1, options_.delta_views)) {
+        delta_views_.erase(delta_lru_.back());
+        delta_lru_.pop_back();
+    }
+    delta_lru_.push_front(m.msg_id);
+    view.lru = delta_lru_.begin();
+    return &delta_views_.emplace(m.msg_id, std::move(view)).first->second;
+}
+
+bool MessageStore::fold_deltas(sqlite3_stmt* s, const Message& m, DeltaView& view) {
+    // Edits and deletes count only from the author: us for what we sent.
+    const std::string author = m.direction == Direction::Sent ? std::string()
+                               : m.sender.empty()             ? m.peer
+                                                              : m.sender;
+    StatementScope scope(s);
+    bind_text(s, 1, m.msg_id);
+    int rc;
+    while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+        if (column_text(s, 0) != m.peer) {
+            continue;                           // filed under another conversation
+        }
+        Reaction reaction{column_text(s, 3), column_text(s, 1)};
+        switch (static_cast<DeltaOp>(sqlite3_column_int(s, 2))) {
+        case DeltaOp::React:
+            if (std::find(view.reactions.begin(), view.reactions.end(), reaction) ==
+                view.reactions.end()) {
+                view.reactions.push_back(std::move(reaction));
+            }
+            break;
+        case DeltaOp::Unreact:
+            std::erase(view.reactions, reaction);
+            break;
+        case DeltaOp::Edit:
+            if (reaction.from == author) {
+                view.text = std::move(reaction.emoji);
+            }
+            break;
+        case DeltaOp::Delete:
+            view.deleted = view.deleted || reaction.from == author;
+            break;
+        }
+    }
+    if (rc != SQLITE_DONE) {
+        spdlog::warn("SQLite error: {}", sqlite3_errmsg(sqlite3_db_handle(s)));
+        return false;
+    }
+    if (view.deleted) {
+        view.reactions.clear();
+        view.text.reset();
+    }
+    return true;
+}
+
+void MessageStore::drop_delta_view(const std::string& target, bool gone) {
+    if (gone) {
+        std::unique_lock targets(delta_targets_mutex_);
+        delta_targets_.erase(target);
+    }
+    if (auto it = delta_views_.find(target); it != delta_views_.end()) {
+        delta_lru_.erase(it->second.lru);
+        delta_views_.erase(it);
+    }
+}
+
+void MessageStore::enqueue_insert(PendingInsert insert) {
+    if (!db_) {
+        if (insert.done) insert.done(InsertResult::Failed);
+        return;
+    }
+    pending_.push_back(std::move(insert));
+    pending_inserts.set(static_cast<int64_t>(pending_.size()));
+    if (pending_.size() >= options_.commit_batch) {
+        commit_pending();
+        return;
+    }
+    if (!commit_scheduled_) {
+        commit_scheduled_ = true;
+        commit_timer_.expires_after(options_.commit_window);
+        commit_timer_.async_wait([this](const asio::error_code& ec) {
+            if (!ec) {
+                commit_pending();
+            }
+        });
+    }
+}
+
+MessageStore::InsertResult MessageStore::write_one(const PendingInsert& insert, bool& stored) {
+    // Each row gets a savepoint so a failure undoes just that row — in
+    // particular a seen id is never kept without its message.
+    if (!run(kSavepoint)) {
+        return InsertResult::Failed;
+    }
+    bool ok = true;
+    bool fresh = true;
+    stored = false;
+    if (insert.check_seen) {
+        StatementScope scope(stmt(kInsertSeen));
+        bind_seen_id(stmt(kInsertSeen), 1, insert.message.msg_id);
+        if (insert.expires) {
+            bind_text(stmt(kInsertSeen), 2, insert.message.timestamp);
+        }
+        ok = step_done(stmt(kInsertSeen));
+        fresh = ok && sqlite3_changes(db_) > 0;
+    }
+    if (ok && fresh && !insert.deltas.empty()) {
+        // As for a message row, the delta ids back up a pruned seen entry.
+        bool added = false;
+        auto* s = stmt(kInsertDelta);
+        for (std::size_t i = 0; ok && i < insert.deltas.size(); ++i) {
+            const Delta& d = insert.deltas[i];
+            StatementScope scope(s);
+            bind_text(s, 1, d.delta_id);
+            bind_text(s, 2, d.target);
+            bind_text(s, 3, d.peer);
+            bind_text(s, 4, d.author);
+            sqlite3_bind_int(s, 5, static_cast<int>(d.op));
+            bind_text(s, 6, d.value);
+            bind_text(s, 7, d.timestamp);
+            ok = step_done(s);
+            added = added || (ok && sqlite3_changes(db_) > 0);
+        }
+        stored = ok && added;
+        fresh = !ok || !insert.check_seen || added;
+    } else if (ok && fresh) {
+        StatementScope scope(stmt(kInsertMessage));
+        ok = bind_message(stmt(kInsertMessage), insert.message);
+        stored = ok && sqlite3_changes(db_) > 0;
+        // The message row is a second line of defence once the id's seen
+        // entry has been pruned.
+        fresh = !ok || !insert.check_seen || sqlite3_changes(db_) > 0;
+    }
+    if (!ok) {
+        run(kRollbackTo);
+        stored = false;
+    }
+    run(kRelease);
+    if (!ok) {
+        return InsertResult::Failed;
+    }
+    return fresh ? InsertResult::Inserted : InsertResult::Duplicate;
+}
+
+void MessageStore::commit_pending() {
+    watchdog::Tag busy("store.commit");
+    if (commit_scheduled_) {
+        commit_scheduled_ = false;
+        commit_timer_.cancel();
+    }
+    if (pending_.empty()) {
+        return;
+    }
+    std::vector<PendingInsert> batch;
+    batch.swap(pending_);
+    pending_inserts.set(0);
+
+    std::vector<InsertResult> results(batch.size(), InsertResult::Failed);
+    if (db_) {
+        metrics::ScopedTimer timer(commit_seconds);
+        if (run(kBegin)) {
+            std::vector<bool> stored(batch.size());
+            for (std::size_t i = 0; i < batch.size(); ++i) {
+                bool row = false;
+                results[i] = write_one(batch[i], row);
+                stored[i] = row;
+            }
+            if (run(kCommit)) {
+                inserted_rows.inc(static_cast<uint64_t>(
+                    std::count(results.begin(), results.end(), InsertResult::Inserted)));
+                std::vector<const std::string*> changed;
+                bool sooner = false;            // a message expiring before the timer
+                for (std::size_t i = 0; i < batch.size(); ++i) {
+                    if (!stored[i]) continue;
+                    for (const auto& d : batch[i].deltas) {
+                        {
+                            std::unique_lock targets(delta_targets_mutex_);
+                            delta_targets_.insert(d.target);
+                        }
+                        drop_delta_view(d.target);
+                    }
+                    if (batch[i].deltas.empty()) {
+                        add_to_digest(batch[i].message);
+                    }
+                    const auto& expires_at = batch[i].message.expires_at;
+                    sooner = sooner || (!expires_at.empty() &&
+                                        (expiry_due_.empty() || expires_at < expiry_due_));
+                    const auto& peer = batch[i].message.peer;
+                    if (std::none_of(changed.begin(), changed.end(),
+                                     [&](const auto* p) { return *p == peer; })) {
+                        changed.push_back(&peer);
+                    }
+                }
+                for (const auto* peer : changed) load_summaries(peer);
+                if (on_change_) {
+                    for (const auto* peer : changed) on_change_(*peer);
+                }
+                if (sooner) {
+                    schedule_expiry();
+                }
+            } else {
+                run(kRollback);
+                std::fill(results.begin(), results.end(), InsertResult::Failed);
+            }
+        }
+    }
+    spdlog::trace("Group commit of {} insert(s)", batch.size());
+
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        if (batch[i].done) {
+            batch[i].done(results[i]);
+        }
+    }
+    settle();
+}
+
+void MessageStore::prune_seen() {
+    watchdog::Tag busy("store.prune");
+    commit_pending();
+    if (!db_) {
+        return;
+    }
+    // A signed timestamp older than the window is rejected before it gets
+    // here, so its seen entry can no longer stop anything.
+    const std::string age = "-" + std::to_string(options_.replay_window.count()) + " seconds";
+    {
+        StatementScope scope(stmt(kPruneSeen));
+        bind_text(stmt(kPruneSeen), 1, age);
+        if (step_done(stmt(kPruneSeen))) {
+            const int pruned = sqlite3_changes(db_);
+            if (pruned > 0) {
+                spdlog::debug("Pruned {} seen message id(s) past the replay window", pruned);
+            }
+        }
+    }
+    prune_timer_.expires_after(options_.prune_interval);
+    prune_timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            prune_seen();
+        }
+    });
+}
+
+void MessageStore::expire_messages() {
+    watchdog::Tag busy("store.expire");
+    commit_pending();
+    if (!db_) {
+        return;
+    }
+    std::vector<Message> due;
+    bool ok = run(kBegin);
+    if (ok) {
+        auto* s = stmt(kSelectExpired);
+        StatementScope scope(s);
+        sqlite3_bind_int64(s, 1, static_cast<sqlite3_int64>(kExpireBatch));
+        int rc;
+        while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+            Message m;
+            m.msg_id = column_text(s, 0);
+            m.peer = column_text(s, 1);
+            m.timestamp = column_text(s, 2);
+            due.push_back(std::move(m));
+        }
+        ok = rc == SQLITE_DONE;
+    }
+    for (std::size_t i = 0; ok && i < due.size(); ++i) {
+        // The delete triggers drop the row from messages_fts and
+        // conversation_summary in the same transaction.
+        {
+            StatementScope scope(stmt(kDeleteMessage));
+            bind_text(stmt(kDeleteMessage), 1, due[i].msg_id);
+            ok = step_done(stmt(kDeleteMessage));
+        }
+        if (ok && delta_targets_.contains(due[i].msg_id)) {
+            StatementScope scope(stmt(kDeleteDeltas));
+            bind_text(stmt(kDeleteDeltas), 1, due[i].msg_id);
+            ok = step_done(stmt(kDeleteDeltas));
+        }
+    }
+    if (!ok || !run(kCommit)) {
+        spdlog::warn("Expiring messages failed: {}", sqlite3_errmsg(db_));
+        run(kRollback);
+        // Try again later rather than spin on a persistent error.
+        expiry_due_.clear();
+        expiry_timer_ = TimerWheel::of(io_).schedule(options_.prune_interval, [this] {
+            expiry_timer_ = {};
+            expire_messages();
+        });
+        return;
+    }
+    if (!due.empty()) {
+        expired_rows.inc(due.size());
+        spdlog::debug("Expired {} disappearing message(s)", due.size());
+    }
+    std::vector<const std::string*> changed;
+    for (const auto& m : due) {
+        remove_from_digest(m);
+        drop_delta_view(m.msg_id, true);
+        if (std::none_of(changed.begin(), changed.end(),
+                         [&](const auto* p) { return *p == m.peer; })) {
+            changed.push_back(&m.peer);
+        }
+    }
+    for (const auto* peer : changed) load_summaries(peer);
+    if (on_change_) {
+        for (const auto* peer : changed) on_change_(*peer);
+    }
+    if (due.size() == kExpireBatch) {
+        post([this] { expire_messages(); });
+    } else {
+        schedule_expiry();
+    }
+}
+
+void MessageStore::schedule_expiry() {
+    if (!db_) {
+        return;
+    }
+    std::string next;
+    int64_t seconds = 0;
+    {
+        auto* s = stmt(kNextExpiry);
+        StatementScope scope(s);
+        if (sqlite3_step(s) == SQLITE_ROW) {
+            next = column_text(s, 0);
+            seconds = sqlite3_column_int64(s, 1);
+        }
+    }
+    if (next == expiry_due_ && (expiry_timer_ || next.empty())) {
+        return;
+    }
+    auto& wheel = TimerWheel::of(io_);
+    wheel.cancel(expiry_timer_);
+    expiry_timer_ = {};
+    expiry_due_ = next;
+    if (next.empty()) {
+        return;
+    }
+    expiry_timer_ = wheel.schedule(std::chrono::seconds(std::max<int64_t>(seconds, 0)), [this] {
+        expiry_timer_ = {};
+        expiry_due_.clear();
+        expire_messages();
+    });
+}
+
+void MessageStore::mark_delivered(std::string msg_id, Done done) {
+    post([this, msg_id = std::move(msg_id), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            StatementScope scope(stmt(kMarkDelivered));
+            bind_text(stmt(kMarkDelivered), 1, msg_id);
+            ok = step_done(stmt(kMarkDelivered)) && sqlite3_changes(db_) > 0;
+        }
+        if (ok && on_change_) {
+            on_change_(peer_of(msg_id));
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::set_delivery_method(std::string msg_id, std::string method, Done done) {
+    post([this, msg_id = std::move(msg_id), method = std::move(method), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            StatementScope scope(stmt(kSetDeliveryMethod));
+            bind_text(stmt(kSetDeliveryMethod), 1, msg_id);
+            bind_text(stmt(kSetDeliveryMethod), 2, method);
+            ok = step_done(stmt(kSetDeliveryMethod)) && sqlite3_changes(db_) > 0;
+        }
+        if (ok && on_change_) {
+            on_change_(peer_of(msg_id));
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::delete_message(std::string msg_id, Done done) {
+    post([this, msg_id = std::move(msg_id), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        std::string peer;
+        if (db_) {
+            peer = peer_of(msg_id);     // looked up while the row exists
+            {
+                StatementScope scope(stmt(kDeleteMessage));
+                bind_text(stmt(kDeleteMessage), 1, msg_id);
+                ok = step_done(stmt(kDeleteMessage)) && sqlite3_changes(db_) > 0;
+            }
+            if (!ok) {
+                ok = delete_archived(msg_id, peer);
+            }
+        }
+        if (ok && delta_targets_.contains(msg_id)) {
+            StatementScope scope(stmt(kDeleteDeltas));
+            bind_text(stmt(kDeleteDeltas), 1, msg_id);
+            step_done(stmt(kDeleteDeltas));
+            drop_delta_view(msg_id, true);
+        }
+        if (ok) {
+            day_digests_.reset();   // deletes are rare; rebuilt on next use
+            load_summaries(&peer);
+            if (on_change_) on_change_(peer);
+        }
+        if (done) done(ok);
+    });
+}
+
+std::optional<MessageStore::Summary> MessageStore::summary(const std::string& peer) const {
+    std::lock_guard lock(summaries_mutex_);
+    const auto it = summaries_.find(peer);
+    if (it == summaries_.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void MessageStore::mark_read(std::string peer, std::string msg_id, Done done) {
+    post([this, peer = std::move(peer), msg_id = std::move(msg_id), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_ && run(kBegin)) {
+            {
+                StatementScope scope(stmt(kMarkRead));
+                bind_text(stmt(kMarkRead), 1, peer);
+                bind_text(stmt(kMarkRead), 2, msg_id);
+                ok = step_done(stmt(kMarkRead));
+            }
+            if (ok) {
+                StatementScope scope(stmt(kCountUnread));
+                bind_text(stmt(kCountUnread), 1, peer);
+                ok = step_done(stmt(kCountUnread));
+            }
+            ok = ok && run(kCommit);
+            if (!ok) {
+                run(kRollback);
+            }
+        }
+        if (ok) {
+            load_summaries(&peer);
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::history(std::string peer, std::size_t limit, std::size_t offset,
+                           HistoryCallback done) {
+    auto on_db = [this, peer, limit, offset, done] {
+        commit_pending();
+        if (!db_) {
+            done(std::nullopt);
+            return;
+        }
+        std::size_t total = 0;
+        {
+            StatementScope scope(stmt(kCountHistory));
+            bind_text(stmt(kCountHistory), 1, peer);
+            if (sqlite3_step(stmt(kCountHistory)) != SQLITE_ROW) {
+                spdlog::warn("SQLite error: {}", sqlite3_errmsg(db_));
+                done(std::nullopt);
+                return;
+            }
+            total = static_cast<std::size_t>(sqlite3_column_int64(stmt(kCountHistory), 0));
+        }
+
+        std::optional<HistoryPage> page;
+        {
+            auto* s = stmt(kSelectHistory);
+            StatementScope scope(s);
+            bind_text(s, 1, peer);
+            sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(offset));
+            page = read_history(s, limit, true);
+        }
+        if (page) {
+            // Archived messages come after (are older than) every live one.
+            const auto archive = archive_index(peer);
+            page->total = total + archive.total;
+            fill_from_archive(*page, limit, peer, archive, archive.total,
+                              offset > total ? offset - total : 0, {});
+            apply_deltas(page->messages);
+        }
+        done(std::move(page));
+    };
+    post_read(
+        [this, peer = std::move(peer), limit, offset, done = std::move(done)](Reader& r) {
+            Reader::Snapshot snapshot(r);
+            if (!snapshot || r.has_archive(peer)) {
+                return false;                   // the DB thread adds the archive
+            }
+            std::size_t total = 0;
+            {
+                auto* s = r.stmt(kCountHistory);
+                StatementScope scope(s);
+                bind_text(s, 1, peer);
+                if (sqlite3_step(s) != SQLITE_ROW) {
+                    return false;
+                }
+                total = static_cast<std::size_t>(sqlite3_column_int64(s, 0));
+            }
+            auto* s = r.stmt(kSelectHistory);
+            StatementScope scope(s);
+            bind_text(s, 1, peer);
+            sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(offset));
+            auto page = read_history(s, limit, true);
+            if (!page) {
+                return false;
+            }
+            page->total = total;
+            apply_deltas(r, page->messages);
+            done(std::move(page));
+            return true;
+        },
+        std::move(on_db));
+}
+
+void MessageStore::history_before(std::string peer, std::string before, std::size_t limit,
+                                  HistoryCallback done) {
+    auto on_db = [this, peer, before, limit, done] {
+        commit_pending();
+        if (!db_) {
+            done(std::nullopt);
+            return;
+        }
+        // msg_ids are UUIDs; anything with a ':' is taken as an ISO 8601 time.
+        const bool by_time = before.find(':') != std::string::npos;
+        if (!by_time && !is_live(before, peer)) {
+            // Older than an archived message: the archive alone.
+            const auto archive = archive_index(peer);
+            HistoryPage page;
+            if (const auto at = archive_position(peer, archive, before)) {
+                fill_from_archive(page, limit, peer, archive, *at, 0, {});
+            }
+            apply_deltas(page.messages);
+            done(std::move(page));
+            return;
+        }
+        std::optional<HistoryPage> page;
+        {
+            auto* s = stmt(by_time ? kSelectHistoryBeforeTime : kSelectHistoryBeforeId);
+            StatementScope scope(s);
+            bind_text(s, 1, peer);
+            bind_text(s, 3, before);
+            page = read_history(s, limit, true);
+        }
+        if (page && !page->has_more) {
+            const auto archive = archive_index(peer);
+            fill_from_archive(*page, limit, peer, archive, archive.total, 0,
+                              by_time ? before : std::string());
+        }
+        if (page) {
+            apply_deltas(page->messages);
+        }
+        done(std::move(page));
+    };
+    post_read(
+        [this, peer = std::move(peer), before = std::move(before), limit,
+         done = std::move(done)](Reader& r) {
+            const bool by_time = before.find(':') != std::string::npos;
+            Reader::Snapshot snapshot(r);
+            if (!snapshot) {
+                return false;
+            }
+            if (!by_time && !r.is_live(before, peer)) {
+                if (r.has_archive(peer)) {
+                    return false;
+                }
+                done(HistoryPage{});            // unknown msg_id
+                return true;
+            }
+            auto* s = r.stmt(by_time ? kSelectHistoryBeforeTime : kSelectHistoryBeforeId);
+            StatementScope scope(s);
+            bind_text(s, 1, peer);
+            bind_text(s, 3, before);
+            auto page = read_history(s, limit, true);
+            if (!page || (!page->has_more && r.has_archive(peer))) {
+                return false;
+            }
+            apply_deltas(r, page->messages);
+            done(std::move(page));
+            return true;
+        },
+        std::move(on_db));
+}
+
+void MessageStore::history_after(std::string peer, std::string since, std::size_t limit,
+                                 HistoryCallback done) {
+    auto on_db = [this, peer, since, limit, done]() mutable {
+        commit_pending();
+        if (!db_) {
+            done(std::nullopt);
+            return;
+        }
+        // Archived messages were all stored before the live ones.
+        HistoryPage archived;
+        if (since.empty() || !is_live(since, peer)) {
+            const auto archive = archive_index(peer);
+            std::optional<std::size_t> from = 0;
+            if (!since.empty()) {
+                from = archive_position(peer, archive, since);
+                if (!from) {
+                    done(HistoryPage{});        // unknown msg_id
+                    return;
+                }
+                ++*from;
+            }
+            archive_forward(peer, archive, *from, limit + 1, archived.messages);
+            if (archived.messages.size() > limit) {
+                archived.messages.pop_back();
+                archived.has_more = true;
+                apply_deltas(archived.messages);
+                done(std::move(archived));
+                return;
+            }
+            since.clear();                      // the live rows from the start
+        }
+        auto* s = stmt(kSelectHistoryAfter);
+        StatementScope scope(s);
+        bind_text(s, 1, peer);
+        bind_text(s, 3, since);
+        auto page = read_history(s, limit - archived.messages.size(), false);
+        if (page && !archived.messages.empty()) {
+            page->messages.insert(page->messages.begin(),
+                                  std::make_move_iterator(archived.messages.begin()),
+                                  std::make_move_iterator(archived.messages.end()));
+        }
+        if (page) {
+            apply_deltas(page->messages);
+        }
+        done(std::move(page));
+    };
+    post_read(
+        [this, peer = std::move(peer), since = std::move(since), limit,
+         done = std::move(done)](Reader& r) {
+            Reader::Snapshot snapshot(r);
+            if (!snapshot) {
+                return false;
+            }
+            if (since.empty() || !r.is_live(since, peer)) {
+                if (r.has_archive(peer)) {
+                    return false;
+                }
+                if (!since.empty()) {
+                    done(HistoryPage{});        // unknown msg_id
+                    return true;
+                }
+            }
+            auto* s = r.stmt(kSelectHistoryAfter);
+            StatementScope scope(s);
+            bind_text(s, 1, peer);
+            bind_text(s, 3, since);
+            auto page = read_history(s, limit, false);
+            if (!page) {
+                return false;
+            }
+            apply_deltas(r, page->messages);
+            done(std::move(page));
+            return true;
+        },
+        std::move(on_db));
+}
+
+std::optional<MessageStore::HistoryPage> MessageStore::read_history(sqlite3_stmt* s,
+                                                                    std::size_t limit,
+                                                                    bool newest_first) {
+    // One row past the page tells us whether there is anything further.
+    sqlite3_bind_int64(s, 2, static_cast<sqlite3_int64>(limit) + 1);
+    HistoryPage page;
+    int rc;
+    while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+        if (page.messages.size() == limit) {
+            page.has_more = true;
+            break;
+        }
+        page.messages.push_back(read_message(s));
+    }
+    if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+        spdlog::warn("SQLite error: {}", sqlite3_errmsg(sqlite3_db_handle(s)));
+        return std::nullopt;
+    }
+    // Backward pages are selected newest first so they count back from the
+    // latest message.
+    if (newest_first) {
+        std::reverse(page.messages.begin(), page.messages.end());
+    }
+    return page;
+}
+
+void MessageStore::search(std::string text, std::string peer, std::size_t limit,
+                          SearchCallback done) {
+    auto on_db = [this, text, peer, limit, done] {
+        commit_pending();
+        if (!db_ || !stmt(kSearch)) {
+            done(std::nullopt);
+            return;
+        }
+        std::vector<SearchHit> hits;
+        const std::string query = fts_query(text);
+        if (query.empty()) {
+            done(std::move(hits));
+            return;
+        }
+        auto* s = stmt(kSearch);
+        StatementScope scope(s);
+        bind_text(s, 1, query);
+        if (!peer.empty()) {
+            bind_text(s, 2, peer);
+        }
+        sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(limit));
+        sqlite3_bind_int64(s, 4, static_cast<sqlite3_int64>(options_.search_candidates));
+        int rc;
+        while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+            hits.push_back({read_message(s), column_text(s, 9)});
+        }
+        if (rc != SQLITE_DONE) {
+            spdlog::warn("SQLite error: {}", sqlite3_errmsg(db_));
+            done(std::nullopt);
+            return;
+        }
+        if (hits.size() < limit) {
+            search_archive(text, peer, limit, hits);
+        }
+        for (auto& hit : hits) {
+            apply_deltas(hit.message);
+        }
+        // A deleted message's snippet would still show its text.
+        std::erase_if(hits, [](const SearchHit& hit) { return hit.message.deleted; });
+        done(std::move(hits));
+    };
+    post_read(
+        [this, text = std::move(text), peer = std::move(peer), limit,
+         done = std::move(done)](Reader& r) {
+            auto* s = r.stmt(kSearch);
+            if (!s) {
+                return false;
+            }
+            std::vector<SearchHit> hits;
+            const std::string query = fts_query(text);
+            if (query.empty()) {
+                done(std::move(hits));
+                return true;
+            }
+            Reader::Snapshot snapshot(r);
+            if (!snapshot) {
+                return false;
+            }
+            {
+                StatementScope scope(s);
+                bind_text(s, 1, query);
+                if (!peer.empty()) {
+                    bind_text(s, 2, peer);
+                }
+                sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(limit));
+                sqlite3_bind_int64(s, 4, static_cast<sqlite3_int64>(options_.search_candidates));
+                int rc;
+                while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+                    hits.push_back({read_message(s), column_text(s, 9)});
+                }
+                if (rc != SQLITE_DONE || (hits.size() < limit && r.has_archive(peer))) {
+                    return false;
+                }
+            }
+            for (auto& hit : hits) {
+                apply_deltas(r, hit.message);
+            }
+            std::erase_if(hits, [](const SearchHit& hit) { return hit.message.deleted; });
+            done(std::move(hits));
+            return true;
+        },
+        std::move(on_db));
+}
+
+// ─── History archive ─────────────────────────────────────────────────────────
+
+void MessageStore::archive_old() {
+    watchdog::Tag busy("store.archive");
+    commit_pending();
+    if (!db_) {
+        return;
+    }
+    const auto after = std::chrono::duration_cast<std::chrono::seconds>(options_.archive_after);
+    const std::string age = "-" + std::to_string(after.count()) + " seconds";
+    std::string peer;
+    {
+        StatementScope scope(stmt(kArchivePeer));
+        bind_text(stmt(kArchivePeer), 1, age);
+        if (sqlite3_step(stmt(kArchivePeer)) == SQLITE_ROW) {
+            peer = column_text(stmt(kArchivePeer), 0);
+        }
+    }
+    if (!peer.empty() && archive_block(peer, age)) {
+        // One block per turn, so reads and inserts queued meanwhile don't
+        // wait for a whole backlog to be archived.
+        post_bulk([this] { archive_old(); });
+        return;
+    }
+    archive_timer_.expires_after(options_.archive_interval);
+    archive_timer_.async_wait([this](const asio::error_code& ec) {
+        if (!ec) {
+            archive_old();
+        }
+    });
+}
+
+bool MessageStore::archive_block(const std::string& peer, const std::string& age) {
+    HistoryArchive::Messages batch;
+    {
+        auto* s = stmt(kArchiveSelect);
+        StatementScope scope(s);
+        bind_text(s, 1, peer);
+        bind_text(s, 2, age);
+        sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(HistoryArchive::kBlockMessages));
+        std::size_t bytes = 0;
+        while (bytes < HistoryArchive::kBlockBytes && sqlite3_step(s) == SQLITE_ROW) {
+            batch.push_back(read_message(s));
+            bytes += batch.back().plaintext.size();
+        }
+    }
+    if (batch.empty()) {
+        return false;
+    }
+    int64_t segment = 0;
+    uint64_t end = 0;
+    {
+        StatementScope scope(stmt(kArchiveTail));
+        bind_text(stmt(kArchiveTail), 1, peer);
+        if (sqlite3_step(stmt(kArchiveTail)) == SQLITE_ROW) {
+            segment = sqlite3_column_int64(stmt(kArchiveTail), 0);
+            end = static_cast<uint64_t>(sqlite3_column_int64(stmt(kArchiveTail), 1));
+        }
+    }
+    const auto block = archive_->append(peer, segment, end, batch);
+    if (!block || !run(kBegin)) {
+        return false;
+    }
+    // The block is on disk; it becomes the archive's, and the rows stop
+    // being live, in this one transaction.
+    bool ok;
+    {
+        auto* s = stmt(kArchiveInsertBlock);
+        StatementScope scope(s);
+        bind_text(s, 1, peer);
+        sqlite3_bind_int64(s, 2, block->segment);
+        sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(block->offset));
+        sqlite3_bind_int64(s, 4, block->length);
+        sqlite3_bind_int64(s, 5, block->count);
+        bind_text(s, 6, block->first_ts);
+        bind_text(s, 7, block->last_ts);
+        sqlite3_bind_blob(s, 8, block->terms.data(), static_cast<int>(block->terms.size()),
+                          SQLITE_STATIC);
+        ok = step_done(s);
+    }
+    for (const auto& m : batch) {
+        {
+            auto* s = stmt(kArchiveInsertId);
+            StatementScope scope(s);
+            bind_text(s, 1, m.msg_id);
+            bind_text(s, 2, peer);
+            bind_text(s, 3, m.timestamp);
+            ok = ok && step_done(s);
+        }
+        StatementScope scope(stmt(kDeleteMessage));
+        bind_text(stmt(kDeleteMessage), 1, m.msg_id);
+        ok = ok && step_done(stmt(kDeleteMessage));
+    }
+    if (!ok || !run(kCommit)) {
+        run(kRollback);
+        return false;
+    }
+    archived_rows.inc(batch.size());
+    spdlog::debug("Archived {} message(s) of {} up to {}", batch.size(), peer, block->last_ts);
+    if (on_change_) {
+        on_change_(peer);
+    }
+    return true;
+}
+
+MessageStore::ArchiveIndex MessageStore::archive_index(const std::string& peer) {
+    ArchiveIndex index;
+    auto* s = stmt(kArchiveBlocks);
+    StatementScope scope(s);
+    bind_text(s, 1, peer);
+    while (sqlite3_step(s) == SQLITE_ROW) {
+        index.blocks.push_back(read_block(s, 0));
+        index.total += index.blocks.back().count;
+    }
+    return index;
+}
+
+std::optional<std::size_t> MessageStore::archive_position(const std::string& peer,
+                                                          const ArchiveIndex& index,
+                                                          const std::string& msg_id) {
+    std::string timestamp;
+    {
+        StatementScope scope(stmt(kSelectArchived));
+        bind_text(stmt(kSelectArchived), 1, msg_id);
+        if (sqlite3_step(stmt(kSelectArchived)) != SQLITE_ROW ||
+            column_text(stmt(kSelectArchived), 0) != peer) {
+            return std::nullopt;
+        }
+        timestamp = column_text(stmt(kSelectArchived), 1);
+    }
+    // Only blocks whose time range covers the message need decoding.
+    std::size_t start = 0;
+    for (const auto& block : index.blocks) {
+        if (block.first_ts <= timestamp && timestamp <= block.last_ts) {
+            if (const auto messages = archive_->read(peer, block)) {
+                for (std::size_t i = 0; i < messages->size(); ++i) {
+                    if ((*messages)[i].msg_id == msg_id) {
+                        return start + i;
+                    }
+                }
+            }
+        }
+        start += block.count;
+    }
+    return std::nullopt;
+}
+
+void MessageStore::archive_back(const std::string& peer, const ArchiveIndex& index,
+                                std::size_t end, std::size_t skip,
+                                const std::string& before_time, std::size_t want,
+                                std::vector<Message>& out) {
+    if (want == 0) {
+        return;
+    }
+    std::size_t start = index.total;
+    for (auto it = index.blocks.rbegin(); it != index.blocks.rend(); ++it) {
+        start -= it->count;
+        if (start >= end || (!before_time.empty() && it->first_ts >= before_time)) {
+            continue;
+        }
+        const std::size_t upto = std::min<std::size_t>(end - start, it->count);
+        if (before_time.empty() && skip >= upto) {
+            skip -= upto;                       // skipped from the index alone
+            continue;
+        }
+        const auto messages = archive_->read(peer, *it);
+        if (!messages) {
+            continue;
+        }
+        for (std::size_t i = upto; i-- > 0;) {
+            const auto& m = (*messages)[i];
+            if (!before_time.empty() && m.timestamp >= before_time) {
+                continue;
+            }
+            if (skip > 0) {
+                --skip;
+                continue;
+            }
+            out.push_back(m);
+            if (out.size() == want) {
+                return;
+            }
+        }
+    }
+}
+
+void MessageStore::archive_forward(const std::string& peer, const ArchiveIndex& index,
+                                   std::size_t begin, std::size_t want,
+                                   std::vector<Message>& out) {
+    const std::size_t target = out.size() + want;
+    std::size_t start = 0;
+    for (const auto& block : index.blocks) {
+        const std::size_t next = start + block.count;
+        if (next > begin && out.size() < target) {
+            if (const auto messages = archive_->read(peer, block)) {
+                for (std::size_t i = begin > start ? begin - start : 0;
+                     i < messages->size() && out.size() < target; ++i) {
+                    out.push_back((*messages)[i]);
+                }
+            }
+        }
+        start = next;
+    }
+}
+
+void MessageStore::fill_from_archive(HistoryPage& page, std::size_t limit,
+                                     const std::string& peer, const ArchiveIndex& index,
+                                     std::size_t end, std::size_t skip,
+                                     const std::string& before_time) {
+    if (page.has_more || index.total == 0) {
+        return;
+    }
+    // One past what fits says whether the archive goes further back.
+    const std::size_t want = limit - page.messages.size();
+    std::vector<Message> older;
+    archive_back(peer, index, end, skip, before_time, want + 1, older);
+    if (older.size() > want) {
+        older.pop_back();
+        page.has_more = true;
+    }
+    page.messages.insert(page.messages.begin(), std::make_move_iterator(older.rbegin()),
+                         std::make_move_iterator(older.rend()));
+}
+
+void MessageStore::search_archive(const std::string& text, const std::string& peer,
+                                  std::size_t limit, std::vector<SearchHit>& hits) {
+    const HistoryArchive::Query query(text);
+    if (query.empty()) {
+        return;
+    }
+    // The sparse index rules most blocks out before any is decoded.
+    std::vector<std::pair<std::string, HistoryArchive::Block>> candidates;
+    {
+        auto* s = stmt(kArchiveSearchBlocks);
+        StatementScope scope(s);
+        if (!peer.empty()) {
+            bind_text(s, 1, peer);
+        }
+        while (sqlite3_step(s) == SQLITE_ROW) {
+            auto block = read_block(s, 0);
+            if (query.may_match(block.terms)) {
+                candidates.emplace_back(column_text(s, 7), std::move(block));
+            }
+        }
+    }
+    for (const auto& [block_peer, block] : candidates) {
+        const auto messages = archive_->read(block_peer, block);
+        if (!messages) {
+            continue;
+        }
+        for (auto it = messages->rbegin(); it != messages->rend(); ++it) {
+            if (auto snippet = query.match(it->plaintext)) {
+                hits.push_back({*it, std::move(*snippet)});
+                if (hits.size() == limit) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+bool MessageStore::delete_archived(const std::string& msg_id, std::string& peer) {
+    {
+        StatementScope scope(stmt(kSelectArchived));
+        bind_text(stmt(kSelectArchived), 1, msg_id);
+        if (sqlite3_step(stmt(kSelectArchived)) != SQLITE_ROW) {
+            return false;
+        }
+        peer = column_text(stmt(kSelectArchived), 0);
+    }
+    // Segments are append-only, so the conversation is written out again
+    // without the message, as the next segment number.
+    const auto index = archive_index(peer);
+    std::vector<HistoryArchive::Messages> kept;
+    for (const auto& block : index.blocks) {
+        const auto messages = archive_->read(peer, block);
+        if (!messages) {
+            return false;                       // never drop a block we can't read
+        }
+        HistoryArchive::Messages rest;
+        std::copy_if(messages->begin(), messages->end(), std::back_inserter(rest),
+                     [&](const Message& m) { return m.msg_id != msg_id; });
+        if (!rest.empty()) {
+            kept.push_back(std::move(rest));
+        }
+    }
+    const int64_t segment = index.blocks.empty() ? 0 : index.blocks.back().segment + 1;
+    std::vector<HistoryArchive::Block> blocks;
+    if (!kept.empty()) {
+        auto written = archive_->rewrite(peer, segment, kept);
+        if (!written) {
+            return false;
+        }
+        blocks = std::move(*written);
+    }
+    if (!run(kBegin)) {
+        return false;
+    }
+    bool ok;
+    {
+        StatementScope scope(stmt(kArchiveDeleteBlocks));
+        bind_text(stmt(kArchiveDeleteBlocks), 1, peer);
+        ok = step_done(stmt(kArchiveDeleteBlocks));
+    }
+    for (const auto& block : blocks) {
+        auto* s = stmt(kArchiveInsertBlock);
+        StatementScope scope(s);
+        bind_text(s, 1, peer);
+        sqlite3_bind_int64(s, 2, block.segment);
+        sqlite3_bind_int64(s, 3, static_cast<sqlite3_int64>(block.offset));
+        sqlite3_bind_int64(s, 4, block.length);
+        sqlite3_bind_int64(s, 5, block.count);
+        bind_text(s, 6, block.first_ts);
+        bind_text(s, 7, block.last_ts);
+        sqlite3_bind_blob(s, 8, block.terms.data(), static_cast<int>(block.terms.size()),
+                          SQLITE_STATIC);
+        ok = ok && step_done(s);
+    }
+    {
+        StatementScope scope(stmt(kArchiveDeleteId));
+        bind_text(stmt(kArchiveDeleteId), 1, msg_id);
+        ok = ok && step_done(stmt(kArchiveDeleteId));
+    }
+    if (!ok || !run(kCommit)) {
+        run(kRollback);
+        return false;
+    }
+    archive_->remove_segments(peer, blocks.empty() ? -1 : segment);
+    return true;
+}
+
+// ─── Friends ─────────────────────────────────────────────────────────────────
+
+void MessageStore::upsert_friend(Friend f, Done done) {
+    post([this, f = std::move(f), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            auto* s = stmt(kUpsertFriend);
+            StatementScope scope(s);
+            bind_text(s, 1, f.username);
+            bind_blob(s, 2, f.public_key);
+            bind_blob(s, 3, f.signing_key);
+            bind_text(s, 4, f.last_ip);
+            bind_text(s, 5, f.last_seen);
+            ok = step_done(s);
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::upsert_friends(std::vector<Friend> friends, Done done) {
+    post([this, friends = std::move(friends), done = std::move(done)] {
+        commit_pending();
+        bool ok = db_ && run(kBegin);
+        if (ok) {
+            auto* s = stmt(kUpsertFriend);
+            for (const auto& f : friends) {
+                StatementScope scope(s);
+                bind_text(s, 1, f.username);
+                bind_blob(s, 2, f.public_key);
+                bind_blob(s, 3, f.signing_key);
+                bind_text(s, 4, f.last_ip);
+                bind_text(s, 5, f.last_seen);
+                ok = step_done(s) && ok;
+            }
+            if (!ok || !run(kCommit)) {
+                run(kRollback);
+                ok = false;
+            }
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::remove_friend(std::string username, Done done) {
+    post([this, username = std::move(username), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            StatementScope scope(stmt(kDeleteFriend));
+            bind_text(stmt(kDeleteFriend), 1, username);
+            ok = step_done(stmt(kDeleteFriend)) && sqlite3_changes(db_) > 0;
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::friends(FriendsCallback done) {
+    post([this, done = std::move(done)] {
+        commit_pending();
+        std::vector<Friend> out;
+        if (db_) {
+            auto* s = stmt(kSelectFriends);
+            StatementScope scope(s);
+            while (sqlite3_step(s) == SQLITE_ROW) {
+                Friend f;
+                f.username = column_text(s, 0);
+                f.public_key = column_blob(s, 1);
+                f.signing_key = column_blob(s, 2);
+                f.last_ip = column_text(s, 3);
+                f.last_seen = column_text(s, 4);
+                f.added_at = column_text(s, 5);
+                out.push_back(std::move(f));
+            }
+        }
+        done(std::move(out));
+    });
+}
+
+std::vector<MessageStore::Friend> MessageStore::load_friends() {
+    std::promise<std::vector<Friend>> done;
+    auto result = done.get_future();
+    friends([&done](std::vector<Friend> list) { done.set_value(std::move(list)); });
+    return result.get();
+}
+
+uint64_t MessageStore::generation() {
+    std::promise<uint64_t> done;
+    auto result = done.get_future();
+    post([this, &done] {
+        uint64_t value = 0;
+        if (db_) {
+            auto* s = stmt(kSelectGeneration);
+            StatementScope scope(s);
+            if (sqlite3_step(s) == SQLITE_ROW) {
+                value = static_cast<uint64_t>(sqlite3_column_int64(s, 0));
+            }
+        }
+        done.set_value(value);
+    });
+    return result.get();
+}
+
+// ─── Groups ──────────────────────────────────────────────────────────────────
+
+void MessageStore::upsert_group(Group group, Done done) {
+    post([this, group = std::move(group), done = std::move(done)] {
+        commit_pending();
+        bool ok = db_ && run(kBegin);
+        if (ok) {
+            auto* s = stmt(kUpsertGroup);
+            {
+                StatementScope scope(s);
+                bind_text(s, 1, group.group_id);
+                bind_text(s, 2, group.name);
+                bind_text(s, 3, group.created_by);
+                ok = step_done(s);
+            }
+            {
+                StatementScope scope(stmt(kDeleteGroupMembers));
+                bind_text(stmt(kDeleteGroupMembers), 1, group.group_id);
+                ok = step_done(stmt(kDeleteGroupMembers)) && ok;
+            }
+            for (const auto& member : group.members) {
+                s = stmt(kInsertGroupMember);
+                StatementScope scope(s);
+                bind_text(s, 1, group.group_id);
+                bind_text(s, 2, member);
+                ok = step_done(s) && ok;
+            }
+            if (!ok || !run(kCommit)) {
+                run(kRollback);
+                ok = false;
+            }
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::groups(GroupsCallback done) {
+    post([this, done = std::move(done)] {
+        commit_pending();
+        std::vector<Group> out;
+        if (db_) {
+            auto* s = stmt(kSelectGroups);
+            StatementScope scope(s);
+            while (sqlite3_step(s) == SQLITE_ROW) {
+                std::string id = column_text(s, 0);
+                if (out.empty() || out.back().group_id != id) {
+                    out.push_back({std::move(id), column_text(s, 1), column_text(s, 2), {},
+                                   column_text(s, 3)});
+                }
+                if (sqlite3_column_type(s, 4) != SQLITE_NULL) {
+                    out.back().members.push_back(column_text(s, 4));
+                }
+            }
+        }
+        done(std::move(out));
+    });
+}
+
+std::vector<MessageStore::Group> MessageStore::load_groups() {
+    std::promise<std::vector<Group>> done;
+    auto result = done.get_future();
+    groups([&done](std::vector<Group> list) { done.set_value(std::move(list)); });
+    return result.get();
+}
+
+void MessageStore::set_sender_key(SenderKey key, Done done) {
+    post([this, key = std::move(key), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            auto* s = stmt(kUpsertSenderKey);
+            StatementScope scope(s);
+            bind_text(s, 1, key.group_id);
+            bind_text(s, 2, key.sender);
+            bind_blob(s, 3, key.key);
+            ok = step_done(s);
+        }
+        if (done) done(ok);
+    });
+}
+
+std::vector<MessageStore::SenderKey> MessageStore::load_sender_keys() {
+    std::promise<std::vector<SenderKey>> done;
+    auto result = done.get_future();
+    post([this, &done] {
+        std::vector<SenderKey> out;
+        if (db_) {
+            auto* s = stmt(kSelectSenderKeys);
+            StatementScope scope(s);
+            while (sqlite3_step(s) == SQLITE_ROW) {
+                out.push_back({column_text(s, 0), column_text(s, 1), column_blob(s, 2)});
+            }
+        }
+        done.set_value(std::move(out));
+    });
+    return result.get();
+}
+
+// ─── Outbox ──────────────────────────────────────────────────────────────────
+
+bool MessageStore::for_each_id(Statement s, const std::vector<std::string>& ids) {
+    if (!run(kBegin)) {
+        return false;
+    }
+    bool ok = true;
+    for (const auto& id : ids) {
+        StatementScope scope(stmt(s));
+        bind_text(stmt(s), 1, id);
+        ok = step_done(stmt(s)) && ok;
+    }
+    if (!ok || !run(kCommit)) {
+        run(kRollback);
+        return false;
+    }
+    return true;
+}
+
+void MessageStore::outbox_add(OutboxEntry entry, Done done) {
+    post([this, entry = std::move(entry), done = std::move(done)] {
+        commit_pending();
+        bool ok = false;
+        if (db_) {
+            auto* s = stmt(kOutboxAdd);
+            StatementScope scope(s);
+            bind_text(s, 1, entry.msg_id);
+            bind_text(s, 2, entry.to_user);
+            bind_text(s, 3, entry.ciphertext);
+            ok = step_done(s);
+        }
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::outbox_peek(std::size_t limit, OutboxCallback done) {
+    post([this, limit, done = std::move(done)] {
+        commit_pending();
+        if (!db_) {
+            done(std::nullopt);
+            return;
+        }
+        std::vector<OutboxEntry> entries;
+        auto* s = stmt(kOutboxSelect);
+        StatementScope scope(s);
+        sqlite3_bind_int64(s, 1, static_cast<sqlite3_int64>(limit));
+        int rc;
+        while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+            entries.push_back({column_text(s, 0), column_text(s, 1), column_text(s, 2),
+                               column_text(s, 3), sqlite3_column_int(s, 4)});
+        }
+        if (rc != SQLITE_DONE) {
+            spdlog::warn("SQLite error: {}", sqlite3_errmsg(db_));
+            done(std::nullopt);
+            return;
+        }
+        done(std::move(entries));
+    });
+}
+
+void MessageStore::outbox_remove(std::vector<std::string> msg_ids, Done done) {
+    post([this, msg_ids = std::move(msg_ids), done = std::move(done)] {
+        commit_pending();
+        const bool ok = db_ && for_each_id(kOutboxDelete, msg_ids);
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::outbox_failed(std::vector<std::string> msg_ids, Done done) {
+    post([this, msg_ids = std::move(msg_ids), done = std::move(done)] {
+        commit_pending();
+        const bool ok = db_ && for_each_id(kOutboxFailed, msg_ids);
+        if (done) done(ok);
+    });
+}
+
+void MessageStore::outbox_compact(std::chrono::seconds max_age, int max_attempts,
+                                  IdsCallback done) {
+    post([this, max_age, max_attempts, done = std::move(done)] {
+        commit_pending();
+        std::vector<std::string> stale;
+        if (db_) {
+            auto* s = stmt(kOutboxSelectStale);
+            StatementScope scope(s);
+            bind_text(s, 1, "-" + std::to_string(max_age.count()) + " seconds");
+            sqlite3_bind_int(s, 2, max_attempts);
+            while (sqlite3_step(s) == SQLITE_ROW) {
+                stale.push_back(column_text(s, 0));
+            }
+        }
+        if (!stale.empty() && !for_each_id(kOutboxDelete, stale)) {
+            stale.clear();
+        }
+        done(std::move(stale));
+    });
+}
+
+// ─── Device sync ─────────────────────────────────────────────────────────────
+
+namespace {
+
+void toggle_digest(MessageStore::RangeDigest& digest, const std::string& msg_id) {
+    std::array<uint8_t, 16> h;
+    crypto_generichash(h.data(), h.size(), reinterpret_cast<const uint8_t*>(msg_id.data()),
+                       msg_id.size(), nullptr, 0);
+    for (std::size_t i = 0; i < h.size(); ++i) {
+        digest.hash[i] ^= h[i];
+    }
+}
+
+} // namespace
+
+bool MessageStore::load_digests() {
+    if (day_digests_) {
+        return true;
+    }
+    watchdog::Tag busy("store.digests");
+    std::map<std::string, RangeDigest> days;
+    auto* s = stmt(kSelectDigestRows);
+    StatementScope scope(s);
+    int rc;
+    while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+        const std::string day = column_text(s, 1);
+        auto& digest = days[day];
+        digest.key = day;
+        ++digest.count;
+        toggle_digest(digest, column_text(s, 0));
+    }
+    if (rc != SQLITE_DONE) {
+        spdlog::warn("SQLite error: {}", sqlite3_errmsg(db_));
+        return false;
+    }
+    spdlog::debug("Loaded sync digests for {} day(s)", days.size());
+    day_digests_ = std::move(days);
+    return true;
+}
+
+void MessageStore::add_to_digest(const Message& m) {
+    if (!day_digests_) {
+        return;
+    }
+    const std::string day = m.timestamp.substr(0, 10);
+    auto& digest = (*day_digests_)[day];
+    digest.key = day;
+    ++digest.count;
+    toggle_digest(digest, m.msg_id);
+}
+
+void MessageStore::remove_from_digest(const Message& m) {
+    if (!day_digests_) {
+        return;
+    }
+    const auto it = day_digests_->find(m.timestamp.substr(0, 10));
+    if (it == day_digests_->end()) {
+        return;
+    }
+    toggle_digest(it->second, m.msg_id);
+    if (--it->second.count == 0) {
+        day_digests_->erase(it);
+    }
+}
+
+bool MessageStore::load_summaries(const std::string* peer) {
+    if (!db_) {
+        return false;
+    }
+    sqlite3_stmt* s = stmt(kSelectSummaries);
+    StatementScope scope(s);
+    if (peer) {
+        bind_text(s, 1, *peer);
+    }
+    std::unordered_map<std::string, Summary> rows;
+    int rc;
+    while ((rc = sqlite3_step(s)) == SQLITE_ROW) {
+        Summary summary;
+        summary.last_msg_id = column_text(s, 1);
+        summary.last_text = column_text(s, 2);
+        summary.last_timestamp = column_text(s, 3);
+        summary.last_direction = column_text(s, 4) == "sent" ? Direction::Sent
+                                                              : Direction::Received;
+        summary.unread = static_cast<std::size_t>(std::max<sqlite3_int64>(
+            0, sqlite3_column_int64(s, 5)));
+        rows.emplace(column_text(s, 0), std::move(summary));
+    }
+    if (rc != SQLITE_DONE) {
+        spdlog::error("Reading conversation summaries failed: {}", sqlite3_errmsg(db_));
+        return false;
+    }
+    std::lock_guard lock(summaries_mutex_);
+    if (!peer) {
+        summaries_ = std::move(rows);
+    } else if (rows.empty()) {
+        summaries_.erase(*peer);
+    } else {
+        summaries_.insert_or_assign(*peer, std::move(rows.begin()->second));
+    }
+    return true;
+}
+
+void MessageStore::range_digests(std::size_t key_length, std::vector<std::string> within,
+                                 DigestsCallback done) {
+    post_bulk([this, key_length, within = std::move(within), done = std::move(done)] {
+        commit_pending();
+        std::vector<RangeDigest> out;
+        if (!db_ || !load_digests()) {
+            done(std::move(out));
+            return;
+        }
+        const auto wanted = [&](const std::string& key) {
+            return within.empty() || std::any_of(within.begin(), within.end(),
+                                                 [&](const auto& w) { return key.starts_with(w); });
+        };
+        // Days are in key order, so each coarser range is a contiguous run.
+        for (const auto& [day, digest] : *day_digests_) {
+            const std::string key = day.substr(0, key_length);
+            if (!wanted(key)) {
+                continue;
+            }
+            if (out.empty() || out.back().key != key) {
+                out.push_back({key, 0, {}});
+            }
+            out.back().count += digest.count;
+            for (std::size_t i = 0; i < digest.hash.size(); ++i) {
+                out.back().hash[i] ^= digest.hash[i];
+            }
+        }
+        done(std::move(out));
+    });
+}
+
+void MessageStore::ids_for_days(std::vector<std::string> days, IdsCallback done) {
+    post_bulk([this, days = std::move(days), done = std::move(done)] {
+        commit_pending();
+        std::vector<std::string> ids;
+        if (db_) {
+            auto* s = stmt(kSelectIdsForDay);
+            for (const auto& day : days) {
+                StatementScope scope(s);
+                bind_text(s, 1, day);
+                while (sqlite3_step(s) == SQLITE_ROW) {
+                    ids.push_back(column_text(s, 0));
+                }
+            }
+        }
+        done(std::move(ids));
+    });
+}
+
+void MessageStore::messages_by_ids(std::vector<std::string> msg_ids, MessagesCallback done) {
+    post_bulk([this, msg_ids = std::move(msg_ids), done = std::move(done)] {
+        commit_pending();
+        std::vector<Message> messages;
+        if (db_) {
+            auto* s = stmt(kSelectMessage);
+            std::vector<const std::string*> missing;
+            for (const auto& id : msg_ids) {
+                StatementScope scope(s);
+                bind_text(s, 1, id);
+                if (sqlite3_step(s) == SQLITE_ROW) {
+                    messages.push_back(read_message(s));
+                } else {
+                    missing.push_back(&id);
+                }
+            }
+            std::map<std::string, ArchiveIndex> archives;
+            for (const auto* id : missing) {
+                std::string peer;
+                {
+                    StatementScope scope(stmt(kSelectArchived));
+                    bind_text(stmt(kSelectArchived), 1, *id);
+                    if (sqlite3_step(stmt(kSelectArchived)) != SQLITE_ROW) continue;
+                    peer = column_text(stmt(kSelectArchived), 0);
+                }
+                auto it = archives.find(peer);
+                if (it == archives.end()) {
+                    it = archives.emplace(peer, archive_index(peer)).first;
+                }
+                if (const auto at = archive_position(peer, it->second, *id)) {
+                    archive_forward(peer, it->second, *at, 1, messages);
+                }
+            }
+        }
+        done(std::move(messages));
+    });
+}
+
+void MessageStore::import_messages(std::vector<Message> messages, CountCallback done) {
+    post_bulk([this, messages = std::move(messages), done = std::move(done)]() mutable {
+        struct Tally {
+            std::size_t left = 0;
+            std::size_t stored = 0;
+            CountCallback done;
+        };
+        auto tally = std::make_shared<Tally>(Tally{messages.size(), 0, std::move(done)});
+        if (messages.empty()) {
+            if (tally->done) tally->done(0);
+            return;
+        }
+        // Through the group commit like any insert: a large import is
+        // written commit_batch rows to a transaction.
+        for (auto& m : messages) {
+            const bool received = m.direction == Direction::Received;
+            enqueue_insert({std::move(m), received, received, [tally](InsertResult r) {
+                if (r == InsertResult::Inserted) ++tally->stored;
+                if (--tally->left == 0 && tally->done) tally->done(tally->stored);
+            }});
+        }
+    });
+}
+
+// ─── Bulk transfer ───────────────────────────────────────────────────────────
+
+void MessageStore::export_history(MessageSink sink, TransferCallback done) {
+    auto on_db = [this, sink, done] {
+        watchdog::Tag busy("store.export");
+        commit_pending();
+        if (!db_ || !run(kBegin)) {
+            done(std::nullopt);
+            return;
+        }
+        std::size_t count = 0;
+        bool ok = true;
+        {
+            // Archived messages first: they are each conversation's oldest.
+            auto* s = stmt(kExportBlocks);
+            StatementScope scope(s);
+            int rc = SQLITE_DONE;
+            while (ok && (rc = sqlite3_step(s)) == SQLITE_ROW) {
+                // An unreadable block (logged) stops the export rather than
+                // leaving a silent hole in the copy.
+                const auto messages = archive_->read(column_text(s, 7), read_block(s, 0));
+                ok = messages != nullptr;
+                for (std::size_t i = 0; ok && messages && i < messages->size(); ++i) {
+                    ok = sink((*messages)[i]);
+                    count += ok;
+                }
+            }
+            if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+                spdlog::error("History export failed: {}", sqlite3_errmsg(db_));
+            }
+            ok = ok && rc == SQLITE_DONE;
+        }
+        if (ok) {
+            auto* s = stmt(kExportMessages);
+            StatementScope scope(s);
+            int rc = SQLITE_DONE;
+            while (ok && (rc = sqlite3_step(s)) == SQLITE_ROW) {
+                ok = sink(read_message(s));
+                count += ok;
+            }
+            if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+                spdlog::error("History export failed: {}", sqlite3_errmsg(db_));
+            }
+            ok = ok && rc == SQLITE_DONE;
+        }
+        run(kCommit);                           // a read transaction: nothing to undo
+        done(ok ? std::optional(count) : std::nullopt);
+    };
+    post_read(
+        [this, sink = std::move(sink), done = std::move(done)](Reader& r) {
+            watchdog::Tag busy("store.export");
+            Reader::Snapshot snapshot(r);
+            if (!snapshot || r.has_archive({})) {
+                return false;                   // archived messages come first
+            }
+            std::size_t count = 0;
+            bool ok = true;
+            auto* s = r.stmt(kExportMessages);
+            StatementScope scope(s);
+            int rc = SQLITE_DONE;
+            while (ok && (rc = sqlite3_step(s)) == SQLITE_ROW) {
+                ok = sink(read_message(s));
+                count += ok;
+            }
+            if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+                spdlog::error("History export failed: {}", sqlite3_errmsg(r.db));
+            }
+            ok = ok && rc == SQLITE_DONE;
+            done(ok ? std::optional(count) : std::nullopt);
+            return true;
+        },
+        std::move(on_db), true);
+}
+
+void MessageStore::import_history(MessageSource next, TransferCallback done) {
+    post_bulk([this, next = std::move(next), done = std::move(done)] {
+        watchdog::Tag busy("store.import");
+        commit_pending();
+        // Rows stored from here on are the import's; the search index and
+        // the summaries take them in one pass at the end.
+        sqlite3_int64 last_rowid = 0;
+        sqlite3_stmt* probe = nullptr;
+        if (db_ && sqlite3_prepare_v2(db_, "SELECT IFNULL(MAX(rowid), 0) FROM messages", -1, &probe,
+                                      nullptr) == SQLITE_OK &&
+            sqlite3_step(probe) == SQLITE_ROW) {
+            last_rowid = sqlite3_column_int64(probe, 0);
+        }
+        sqlite3_finalize(probe);
+        if (!db_ || !exec(kDropForImport) ||
+            (search_enabled_ && !exec("DROP TRIGGER IF EXISTS messages_fts_insert"))) {
+            done(std::nullopt);
+            return;
+        }
+        // The newest message imported into each conversation, as
+        // (timestamp, msg_id): the conversation is marked read up to it.
+        std::unordered_map<std::string, std::pair<std::string, std::string>> newest;
+        std::size_t stored = 0;
+        std::size_t rows = 0;                   // in the open transaction
+        bool in_transaction = false;
+        bool ok = true;
+        while (ok) {
+            auto batch = next();
+            if (!batch || batch->empty()) {
+                ok = batch.has_value();
+                break;
+            }
+            for (const auto& m : *batch) {
+                if (!in_transaction) {
+                    ok = in_transaction = run(kBegin);
+                }
+                bool fresh = false;
+                if (ok) {
+                    StatementScope scope(stmt(kInsertMessage));
+                    ok = bind_message(stmt(kInsertMessage), m);
+                    fresh = ok && sqlite3_changes(db_) > 0;
+                }
+                if (fresh && m.direction == Direction::Received) {
+                    // Seen like record_received(), so the peer resending it
+                    // later is a duplicate.
+                    StatementScope scope(stmt(kInsertSeen));
+                    bind_seen_id(stmt(kInsertSeen), 1, m.msg_id);
+                    bind_text(stmt(kInsertSeen), 2, m.timestamp);
+                    ok = step_done(stmt(kInsertSeen));
+                }
+                if (!ok) {
+                    break;
+                }
+                if (fresh) {
+                    ++stored;
+                    auto& last = newest[m.peer];
+                    if (m.timestamp >= last.first) {
+                        last = {m.timestamp, m.msg_id};
+                    }
+                }
+                if (++rows == kImportTransactionRows) {
+                    ok = run(kCommit);
+                    in_transaction = !ok;
+                    rows = 0;
+                }
+            }
+        }
+        if (in_transaction && !(ok && run(kCommit))) {
+            run(kRollback);
+            ok = false;
+        }
+
+        // Put back what was dropped in one transaction, each index built in
+        // one pass over rows already in place. If it doesn't commit, the
+        // triggers stay missing and the next open() rebuilds instead.
+        bool finished = run(kBegin) && exec(kSchema) && exec(kIndexes);
+        if (finished && search_enabled_) {
+            const std::string sql = "INSERT INTO messages_fts (rowid, plaintext) "
+                                    "SELECT rowid, plaintext FROM messages WHERE rowid > " +
+                                    std::to_string(last_rowid);
+            finished = exec(sql.c_str()) && exec(kSearchSchema);
+        }
+        if (finished) {
+            sqlite3_stmt* s = nullptr;
+            finished = sqlite3_prepare_v2(db_, kSummarizeImported, -1, &s, nullptr) == SQLITE_OK;
+            if (finished) {
+                sqlite3_bind_int64(s, 1, last_rowid);
+                finished = step_done(s);
+            }
+            sqlite3_finalize(s);
+        }
+        for (const auto& [peer, last] : newest) {
+            if (!finished) {
+                break;
+            }
+            {
+                StatementScope scope(stmt(kMarkRead));
+                bind_text(stmt(kMarkRead), 1, peer);
+                bind_text(stmt(kMarkRead), 2, last.second);
+                finished = step_done(stmt(kMarkRead));
+            }
+            StatementScope scope(stmt(kCountUnread));
+            bind_text(stmt(kCountUnread), 1, peer);
+            finished = finished && step_done(stmt(kCountUnread));
+        }
+        if (!(finished && run(kCommit))) {
+            run(kRollback);
+            ok = false;
+        }
+        day_digests_.reset();
+        load_summaries();
+        if (on_change_) {
+            for (const auto& [peer, last] : newest) on_change_(peer);
+        }
+        schedule_expiry();
+        spdlog::info("History import stored {} new message(s) in {} conversation(s)", stored,
+                     newest.size());
+        done(ok ? std::optional(stored) : std::nullopt);
+    });
+}
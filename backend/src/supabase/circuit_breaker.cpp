@@ -0,0 +1,118 @@
+/**
+ * CircuitBreaker — fail fast while Supabase is down, probe for recovery.
+ */
+
+#include "supabase/circuit_breaker.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+metrics::Counter& opened =
+    metrics::counter("p2p_supabase_circuit_opens_total",
+                     "Times Supabase requests started failing fast after too many errors");
+metrics::Counter& rejected =
+    metrics::counter("p2p_supabase_rejected_total",
+                     "Supabase requests failed at once because the circuit was open");
+
+long long seconds(CircuitBreaker::Clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::seconds>(d).count();
+}
+
+} // namespace
+
+CircuitBreaker::Admit CircuitBreaker::allow(Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    if (state_ == State::Open && now >= open_until_) {
+        state_ = State::HalfOpen;
+        probing_ = false;
+    }
+    if (state_ == State::Closed) {
+        return Admit::Yes;
+    }
+    if (state_ == State::HalfOpen && !probing_) {
+        probing_ = true;
+        return Admit::Probe;
+    }
+    rejected.inc();
+    return Admit::No;
+}
+
+void CircuitBreaker::record(Admit admitted, long status, Clock::duration took,
+                            Clock::time_point now) {
+    std::lock_guard lock(mutex_);
+    const bool bad = failed(status);
+    if (!bad) {
+        latencies_[latency_count_++ % kLatencies] = took;
+    }
+
+    if (state_ == State::HalfOpen) {
+        if (admitted != Admit::Probe) {
+            return;                             // sent before it opened
+        }
+        if (bad) {
+            open_locked(now);
+        } else {
+            spdlog::info("Supabase is answering again");
+            state_ = State::Closed;
+            probing_ = false;
+        }
+        return;
+    }
+    if (state_ == State::Open) {
+        return;                                 // sent before it opened
+    }
+
+    outcomes_.push_back({now, bad});
+    failures_ += bad;
+    while (!outcomes_.empty() && now - outcomes_.front().at > options_.window) {
+        failures_ -= outcomes_.front().failed;
+        outcomes_.pop_front();
+    }
+    if (outcomes_.size() >= options_.min_requests &&
+        static_cast<double>(failures_) >= options_.failure_ratio * static_cast<double>(outcomes_.size())) {
+        spdlog::warn("Supabase: {} of the last {} requests failed; failing fast for {} s",
+                     failures_, outcomes_.size(), seconds(options_.open_for));
+        opened.inc();
+        open_for_ = Clock::duration::zero();
+        open_locked(now);
+    }
+}
+
+void CircuitBreaker::open_locked(Clock::time_point now) {
+    if (open_for_ == Clock::duration::zero()) {
+        open_for_ = options_.open_for;
+    } else {
+        open_for_ = std::min<Clock::duration>(open_for_ * 2, options_.max_open_for);
+        spdlog::debug("Supabase probe failed; failing fast for {} s", seconds(open_for_));
+    }
+    state_ = State::Open;
+    open_until_ = now + open_for_;
+    probing_ = false;
+    outcomes_.clear();
+    failures_ = 0;
+}
+
+std::optional<CircuitBreaker::Clock::duration> CircuitBreaker::hedge_after() const {
+    std::vector<Clock::duration> recent;
+    {
+        std::lock_guard lock(mutex_);
+        if (state_ != State::Closed || latency_count_ < kMinLatencies) {
+            return std::nullopt;
+        }
+        const std::size_t n = std::min(latency_count_, kLatencies);
+        recent.assign(latencies_.begin(), latencies_.begin() + static_cast<std::ptrdiff_t>(n));
+    }
+    const auto p95 = recent.begin() + static_cast<std::ptrdiff_t>(recent.size() * 95 / 100);
+    std::nth_element(recent.begin(), p95, recent.end());
+    return *p95;
+}
+
+CircuitBreaker::State CircuitBreaker::state() const {
+    std::lock_guard lock(mutex_);
+    return state_;
+}
@@ -0,0 +1,240 @@
+/**
+ * CurlMulti — libcurl multi-socket interface on top of asio.
+ *
+ * Follows the curl "multi_socket" event-loop pattern (see libcurl's
+ * asiohiper.cpp example): curl owns protocol state, asio owns readiness.
+ */
+
+#include "supabase/curl_multi.h"
+#include "telemetry/metrics.h"
+
+#include <spdlog/spdlog.h>
+
+using asio::ip::tcp;
+
+namespace {
+
+metrics::Histogram& request_seconds =
+    metrics::histogram("p2p_supabase_request_seconds", "Supabase request round trip, as timed by curl");
+metrics::Counter& request_errors =
+    metrics::counter("p2p_supabase_errors_total", "Supabase requests that failed at the transport level");
+
+} // namespace
+
+CurlMulti::CurlMulti(asio::io_context& io)
+    : io_(io),
+      strand_(asio::make_strand(io)),
+      timer_(strand_) {
+    multi_ = curl_multi_init();
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &CurlMulti::socket_callback);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &CurlMulti::timer_callback);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+}
+
+CurlMulti::~CurlMulti() {
+    alive_.reset();
+    for (auto& [easy, done] : transfers_) {
+        curl_multi_remove_handle(multi_, easy);
+        if (done) {
+            done(easy, CURLE_ABORTED_BY_CALLBACK);
+        }
+    }
+    transfers_.clear();
+    curl_multi_cleanup(multi_);
+    for (auto& [fd, watch] : watches_) {
+        if (!watch.owned) {
+            asio::error_code ignored;
+            watch.socket->release(ignored);
+        }
+    }
+    watches_.clear();
+}
+
+void CurlMulti::start(CURL* easy, Completion done) {
+    asio::dispatch(strand_, [this, alive = std::weak_ptr<int>(alive_), easy,
+                             done = std::move(done)]() mutable {
+        if (alive.expired()) {
+            if (done) done(easy, CURLE_ABORTED_BY_CALLBACK);
+            return;
+        }
+        add_locked(easy, std::move(done));
+    });
+}
+
+void CurlMulti::add_locked(CURL* easy, Completion done) {
+    curl_easy_setopt(easy, CURLOPT_OPENSOCKETFUNCTION, &CurlMulti::open_socket);
+    curl_easy_setopt(easy, CURLOPT_OPENSOCKETDATA, this);
+    curl_easy_setopt(easy, CURLOPT_CLOSESOCKETFUNCTION, &CurlMulti::close_socket);
+    curl_easy_setopt(easy, CURLOPT_CLOSESOCKETDATA, this);
+    curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);   // prefer multiplexing over a new connection
+
+    transfers_.emplace(easy, std::move(done));
+    const CURLMcode rc = curl_multi_add_handle(multi_, easy);
+    if (rc != CURLM_OK) {
+        spdlog::error("curl_multi_add_handle failed: {}", curl_multi_strerror(rc));
+        auto node = transfers_.extract(easy);
+        if (node.mapped()) {
+            node.mapped()(easy, CURLE_FAILED_INIT);
+        }
+    }
+    // curl schedules an immediate timeout through timer_callback, which
+    // kicks off the transfer.
+}
+
+// ─── curl → asio ─────────────────────────────────────────────────────────────
+
+int CurlMulti::socket_callback(CURL*, curl_socket_t fd, int what, void* userp, void*) {
+    auto* self = static_cast<CurlMulti*>(userp);
+    auto it = self->watches_.find(fd);
+    if (it == self->watches_.end()) {
+        if (what == CURL_POLL_REMOVE) {
+            return 0;
+        }
+        // A socket curl opened itself. Borrow it so asio can poll it.
+        auto socket = std::make_shared<tcp::socket>(self->strand_);
+        asio::error_code ec;
+        socket->assign(tcp::v4(), fd, ec);
+        if (ec) {
+            spdlog::warn("CurlMulti: cannot watch socket {}: {}", static_cast<long long>(fd), ec.message());
+            return 0;
+        }
+        it = self->watches_.emplace(fd, Watch{std::move(socket)}).first;
+        it->second.owned = false;
+    }
+
+    if (what == CURL_POLL_REMOVE && !it->second.owned) {
+        asio::error_code ignored;
+        it->second.socket->release(ignored);   // cancels waits, leaves fd open for curl
+        self->watches_.erase(it);
+        return 0;
+    }
+    it->second.what = what == CURL_POLL_REMOVE ? CURL_POLL_NONE : what;
+    self->arm(fd);
+    return 0;
+}
+
+int CurlMulti::timer_callback(CURLM*, long timeout_ms, void* userp) {
+    auto* self = static_cast<CurlMulti*>(userp);
+    if (timeout_ms < 0) {
+        self->timer_.cancel();
+        return 0;
+    }
+    // Never call socket_action from inside a curl callback; even a zero
+    // timeout goes through the timer.
+    self->timer_.expires_after(std::chrono::milliseconds(timeout_ms));
+    self->timer_.async_wait([self, alive = std::weak_ptr<int>(self->alive_)](const asio::error_code& ec) {
+        if (!alive.expired()) {
+            self->on_timeout(ec);
+        }
+    });
+    return 0;
+}
+
+curl_socket_t CurlMulti::open_socket(void* userp, curlsocktype purpose, curl_sockaddr* address) {
+    auto* self = static_cast<CurlMulti*>(userp);
+    if (purpose != CURLSOCKTYPE_IPCXN || address->socktype != SOCK_STREAM ||
+        (address->family != AF_INET && address->family != AF_INET6)) {
+        return CURL_SOCKET_BAD;
+    }
+
+    auto socket = std::make_shared<tcp::socket>(self->strand_);
+    asio::error_code ec;
+    socket->open(address->family == AF_INET ? tcp::v4() : tcp::v6(), ec);
+    if (ec) {
+        spdlog::warn("CurlMulti: cannot open socket: {}", ec.message());
+        return CURL_SOCKET_BAD;
+    }
+    const curl_socket_t fd = socket->native_handle();
+    self->watches_[fd] = Watch{std::move(socket)};
+    return fd;
+}
+
+int CurlMulti::close_socket(void* userp, curl_socket_t fd) {
+    auto* self = static_cast<CurlMulti*>(userp);
+    auto it = self->watches_.find(fd);
+    if (it != self->watches_.end()) {
+        asio::error_code ignored;
+        it->second.socket->close(ignored);   // aborts pending waits
+        self->watches_.erase(it);
+    }
+    return 0;
+}
+
+// ─── asio → curl ─────────────────────────────────────────────────────────────
+
+void CurlMulti::arm(curl_socket_t fd) {
+    auto it = watches_.find(fd);
+    if (it == watches_.end()) {
+        return;
+    }
+    Watch& w = it->second;
+    const auto socket = w.socket;
+    auto alive = std::weak_ptr<int>(alive_);
+
+    if ((w.what & CURL_POLL_IN) && !w.reading) {
+        w.reading = true;
+        socket->async_wait(tcp::socket::wait_read,
+            [this, alive, fd, socket](const asio::error_code& ec) {
+                if (alive.expired()) return;
+                auto it = watches_.find(fd);
+                if (it == watches_.end() || it->second.socket != socket) return;
+                it->second.reading = false;
+                on_ready(fd, CURL_CSELECT_IN, ec);
+            });
+    }
+    if ((w.what & CURL_POLL_OUT) && !w.writing) {
+        w.writing = true;
+        socket->async_wait(tcp::socket::wait_write,
+            [this, alive, fd, socket](const asio::error_code& ec) {
+                if (alive.expired()) return;
+                auto it = watches_.find(fd);
+                if (it == watches_.end() || it->second.socket != socket) return;
+                it->second.writing = false;
+                on_ready(fd, CURL_CSELECT_OUT, ec);
+            });
+    }
+}
+
+void CurlMulti::on_ready(curl_socket_t fd, int direction, const asio::error_code& ec) {
+    if (ec == asio::error::operation_aborted) {
+        return;
+    }
+    int running = 0;
+    curl_multi_socket_action(multi_, fd, ec ? CURL_CSELECT_ERR : direction, &running);
+    drain_completed();
+    arm(fd);   // still interested? (socket_callback may have changed `what`)
+}
+
+void CurlMulti::on_timeout(const asio::error_code& ec) {
+    if (ec == asio::error::operation_aborted) {
+        return;
+    }
+    int running = 0;
+    curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running);
+    drain_completed();
+}
+
+void CurlMulti::drain_completed() {
+    int pending = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi_, &pending)) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        CURL* easy = msg->easy_handle;
+        const CURLcode result = msg->data.result;
+        curl_off_t total_us = 0;
+        if (result == CURLE_OK &&
+            curl_easy_getinfo(easy, CURLINFO_TOTAL_TIME_T, &total_us) == CURLE_OK) {
+            request_seconds.record(std::chrono::microseconds(total_us));
+        } else if (result != CURLE_OK) {
+            request_errors.inc();
+        }
+        curl_multi_remove_handle(multi_, easy);
+        auto node = transfers_.extract(easy);
+        if (!node.empty() && node.mapped()) {
+            node.mapped()(easy, result);
+        }
+    }
+}
@@ -0,0 +1,530 @@
+/**
+ * SupabaseRealtime — push delivery of offline messages.
+ */
+
+#include "supabase/realtime.h"
+#include "api/websocket.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <optional>
+
+#include <curl/curl.h>
+#include <fcntl.h>
+#include <nlohmann/json.hpp>
+#include <poll.h>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+metrics::Counter& rows_pushed =
+    metrics::counter("p2p_realtime_rows_total", "Offline messages pushed by Supabase Realtime");
+metrics::Counter& redials =
+    metrics::counter("p2p_realtime_reconnects_total",
+                     "Supabase Realtime connections dropped and redialled");
+metrics::Gauge& joined_gauge =
+    metrics::gauge("p2p_realtime_joined", "1 while the Supabase Realtime channel is joined");
+
+/// Where the WebSocket handshake goes for a project URL.
+struct Target {
+    std::string host;                           // with the port, if the URL has one
+    std::string path;
+};
+
+std::optional<Target> websocket_target(std::string_view base_url, std::string_view anon_key) {
+    const auto scheme = base_url.find("://");
+    if (scheme == std::string_view::npos) {
+        return std::nullopt;
+    }
+    std::string_view rest = base_url.substr(scheme + 3);
+    const auto slash = rest.find('/');
+    Target t;
+    t.host = std::string(rest.substr(0, slash));
+    if (t.host.empty()) {
+        return std::nullopt;
+    }
+    std::string_view prefix = slash == std::string_view::npos ? "" : rest.substr(slash);
+    while (prefix.ends_with('/')) prefix.remove_suffix(1);
+    t.path = std::string(prefix) + "/realtime/v1/websocket?apikey=" + std::string(anon_key) +
+             "&vsn=1.0.0";
+    return t;
+}
+
+/// `j[key]` if it is an object, else an empty one.
+json object_at(const json& j, const char* key) {
+    const auto it = j.find(key);
+    return it != j.end() && it->is_object() ? *it : json::object();
+}
+
+/// `j[key]` if it is a string, else "".
+std::string string_at(const json& j, const char* key) {
+    const auto it = j.find(key);
+    return it != j.end() && it->is_string() ? it->get<std::string>() : std::string();
+}
+
+} // namespace
+
+/// A WebSocket over a socket libcurl connected (and, for https, secured).
+class SupabaseRealtime::Connection {
+public:
+    explicit Connection(int wake_fd) : wake_fd_(wake_fd) {}
+
+    ~Connection() {
+        if (curl_) {
+            curl_easy_cleanup(curl_);
+        }
+    }
+
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    /// Dial `base_url` and upgrade to a WebSocket at `target`.
+    bool open(const std::string& base_url, const Target& target,
+              std::chrono::milliseconds timeout, std::size_t max_message) {
+        curl_ = curl_easy_init();
+        if (!curl_) {
+            return false;
+        }
+        curl_easy_setopt(curl_, CURLOPT_URL, base_url.c_str());
+        curl_easy_setopt(curl_, CURLOPT_CONNECT_ONLY, 1L);
+        // ALPN must not pick h2: the upgrade below is HTTP/1.1.
+        curl_easy_setopt(curl_, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+        curl_easy_setopt(curl_, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(timeout.count()));
+        curl_easy_setopt(curl_, CURLOPT_NOSIGNAL, 1L);
+        if (const CURLcode rc = curl_easy_perform(curl_); rc != CURLE_OK) {
+            spdlog::warn("Supabase Realtime: can't connect to {}: {}", target.host,
+                         curl_easy_strerror(rc));
+            return false;
+        }
+        curl_socket_t fd = CURL_SOCKET_BAD;
+        if (curl_easy_getinfo(curl_, CURLINFO_ACTIVESOCKET, &fd) != CURLE_OK ||
+            fd == CURL_SOCKET_BAD) {
+            return false;
+        }
+        fd_ = static_cast<int>(fd);
+
+        const std::string key = websocket::client_key();
+        const std::string request = "GET " + target.path + " HTTP/1.1\r\n"
+                                    "Host: " + target.host + "\r\n"
+                                    "Upgrade: websocket\r\n"
+                                    "Connection: Upgrade\r\n"
+                                    "Sec-WebSocket-Key: " + key + "\r\n"
+                                    "Sec-WebSocket-Version: 13\r\n\r\n";
+        if (!send(request)) {
+            return false;
+        }
+
+        // The response head; anything after it is already WebSocket data.
+        std::string head;
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::size_t end;
+        while ((end = head.find("\r\n\r\n")) == std::string::npos) {
+            if (head.size() > 16 * 1024 || !read_some(head, deadline)) {
+                spdlog::warn("Supabase Realtime: no handshake response from {}", target.host);
+                return false;
+            }
+        }
+        std::string_view status(head.data(), head.find("\r\n"));
+        if (!status.starts_with("HTTP/1.1 101")) {
+            spdlog::warn("Supabase Realtime: handshake refused: {}", status);
+            return false;
+        }
+        if (!has_header(std::string_view(head.data(), end),
+                        "sec-websocket-accept: " + websocket::accept_key(key))) {
+            spdlog::warn("Supabase Realtime: bad Sec-WebSocket-Accept from {}", target.host);
+            return false;
+        }
+        decoder_ = websocket::FrameDecoder(max_message, websocket::FrameDecoder::From::Server);
+        decoder_.feed(head.data() + end + 4, head.size() - end - 4);
+        return true;
+    }
+
+    /// Write all of `bytes`, waiting for the socket as needed.
+    bool send(std::string_view bytes) {
+        while (!bytes.empty()) {
+            std::size_t sent = 0;
+            const CURLcode rc = curl_easy_send(curl_, bytes.data(), bytes.size(), &sent);
+            if (rc == CURLE_AGAIN) {
+                pollfd p{fd_, POLLOUT, 0};
+                if (::poll(&p, 1, 5000) <= 0) {
+                    return false;
+                }
+                continue;
+            }
+            if (rc != CURLE_OK) {
+                return false;
+            }
+            bytes.remove_prefix(sent);
+        }
+        return true;
+    }
+
+    bool send_text(std::string_view text) {
+        return send(websocket::encode_client_frame(websocket::Opcode::Text, text));
+    }
+
+    enum class Wait { Readable, Timeout, Woken, Error };
+
+    /// Block until the socket has data, `timeout` passes or the wake pipe
+    /// is written to.
+    Wait wait(std::chrono::milliseconds timeout) {
+        pollfd p[2] = {{fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+        const int n = ::poll(p, 2, static_cast<int>(std::max<int64_t>(0, timeout.count())));
+        if (n < 0) {
+            return errno == EINTR ? Wait::Timeout : Wait::Error;
+        }
+        if (p[1].revents) {
+            return Wait::Woken;
+        }
+        if (p[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+            return Wait::Readable;
+        }
+        return Wait::Timeout;
+    }
+
+    /// Read everything available into the decoder. False once the peer
+    /// has closed the connection or it failed.
+    bool drain() {
+        char buf[16 * 1024];
+        for (;;) {
+            std::size_t n = 0;
+            const CURLcode rc = curl_easy_recv(curl_, buf, sizeof buf, &n);
+            if (rc == CURLE_AGAIN) {
+                return true;
+            }
+            if (rc != CURLE_OK || n == 0) {
+                return false;
+            }
+            decoder_.feed(buf, n);
+        }
+    }
+
+    websocket::FrameDecoder& decoder() { return decoder_; }
+
+private:
+    /// Append what is available to `out`, waiting until `deadline`.
+    bool read_some(std::string& out, std::chrono::steady_clock::time_point deadline) {
+        char buf[4096];
+        for (;;) {
+            std::size_t n = 0;
+            const CURLcode rc = curl_easy_recv(curl_, buf, sizeof buf, &n);
+            if (rc == CURLE_OK) {
+                out.append(buf, n);
+                return n > 0;
+            }
+            if (rc != CURLE_AGAIN) {
+                return false;
+            }
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0 || wait(left) != Wait::Readable) {
+                return false;
+            }
+        }
+    }
+
+    static bool has_header(std::string_view head, std::string_view line) {
+        // Header names are case-insensitive; the accept value is not.
+        for (std::size_t pos = head.find("\r\n"); pos != std::string_view::npos;) {
+            const std::size_t start = pos + 2;
+            pos = head.find("\r\n", start);
+            std::string_view h = head.substr(start, pos == std::string_view::npos
+                                                        ? std::string_view::npos : pos - start);
+            if (h.size() != line.size()) {
+                continue;
+            }
+            const auto colon = line.find(':');
+            bool same = true;
+            for (std::size_t i = 0; i < h.size() && same; ++i) {
+                const char a = i < colon ? static_cast<char>(std::tolower(
+                                               static_cast<unsigned char>(h[i]))) : h[i];
+                same = a == line[i];
+            }
+            if (same) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int wake_fd_;
+    CURL* curl_ = nullptr;
+    int fd_ = -1;
+    websocket::FrameDecoder decoder_;
+};
+
+SupabaseRealtime::SupabaseRealtime(std::string base_url, std::string anon_key,
+                                   std::string username, Options options, RowsHandler on_rows,
+                                   JoinedHandler on_joined)
+    : username_(std::move(username)),
+      options_(options),
+      on_rows_(std::move(on_rows)),
+      on_joined_(std::move(on_joined)),
+      base_url_(std::move(base_url)),
+      anon_key_(std::move(anon_key)),
+      topic_("realtime:p2p-inbox-" + username_) {
+    if (::pipe(wake_pipe_) == 0) {
+        ::fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+        ::fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+    }
+}
+
+SupabaseRealtime::~SupabaseRealtime() {
+    stop();
+    for (int fd : wake_pipe_) {
+        if (fd >= 0) ::close(fd);
+    }
+}
+
+void SupabaseRealtime::start() {
+    if (thread_.joinable() || wake_pipe_[0] < 0) {
+        return;
+    }
+    thread_ = std::thread([this] { run(); });
+}
+
+void SupabaseRealtime::stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    stopping_ = true;
+    wake();
+    thread_.join();
+}
+
+void SupabaseRealtime::set_endpoint(std::string base_url, std::string anon_key) {
+    {
+        std::lock_guard lock(mutex_);
+        if (base_url == base_url_ && anon_key == anon_key_) {
+            return;
+        }
+        base_url_ = std::move(base_url);
+        anon_key_ = std::move(anon_key);
+    }
+    redial_ = true;
+    wake();
+}
+
+void SupabaseRealtime::wake() {
+    const char byte = 1;
+    [[maybe_unused]] const auto n = ::write(wake_pipe_[1], &byte, 1);
+}
+
+void SupabaseRealtime::wait(std::chrono::milliseconds delay) {
+    pollfd p{wake_pipe_[0], POLLIN, 0};
+    ::poll(&p, 1, static_cast<int>(delay.count()));
+}
+
+void SupabaseRealtime::run() {
+    auto backoff = std::chrono::seconds(1);
+    while (!stopping_) {
+        // Wake-ups meant for the previous connection.
+        char sink[64];
+        while (::read(wake_pipe_[0], sink, sizeof sink) > 0) {}
+        redial_ = false;
+
+        if (session()) {
+            backoff = std::chrono::seconds(1);
+        }
+        joined_ = false;
+        joined_gauge.set(0);
+        if (stopping_) {
+            break;
+        }
+        redials.inc();
+        if (!redial_) {
+            spdlog::info("Supabase Realtime: reconnecting in {}s", backoff.count());
+            wait(backoff);
+            backoff = std::min(backoff * 2, options_.max_backoff);
+        }
+    }
+}
+
+bool SupabaseRealtime::session() {
+    std::string base_url, anon_key;
+    {
+        std::lock_guard lock(mutex_);
+        base_url = base_url_;
+        anon_key = anon_key_;
+    }
+    const auto target = websocket_target(base_url, anon_key);
+    if (!target) {
+        spdlog::warn("Supabase Realtime: can't use URL {}", base_url);
+        return false;
+    }
+    Connection conn(wake_pipe_[0]);
+    if (!conn.open(base_url, *target, options_.connect_timeout, options_.max_message_bytes)) {
+        return false;
+    }
+
+    heartbeat_ref_.clear();
+    bool was_joined = false;
+    if (!conn.send_text(join_message())) {
+        return false;
+    }
+    auto next_heartbeat = std::chrono::steady_clock::now() + options_.heartbeat;
+    std::vector<SupabaseClient::OfflineMessage> rows;
+    websocket::Opcode opcode;
+    std::string payload;
+    while (!stopping_ && !redial_) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= next_heartbeat) {
+            if (!heartbeat_ref_.empty()) {
+                spdlog::warn("Supabase Realtime: heartbeat unanswered; reconnecting");
+                break;
+            }
+            if (!conn.send_text(heartbeat_message())) {
+                break;
+            }
+            next_heartbeat = now + options_.heartbeat;
+        }
+        const auto waited = conn.wait(
+            std::chrono::duration_cast<std::chrono::milliseconds>(next_heartbeat - now));
+        if (waited == Connection::Wait::Error) {
+            break;
+        }
+        if (waited != Connection::Wait::Readable) {
+            continue;                           // heartbeat due, or stop/redial
+        }
+        const bool open = conn.drain();
+
+        bool ok = true;
+        for (;;) {
+            const auto status = conn.decoder().next(opcode, payload);
+            if (status == websocket::FrameDecoder::Status::NeedMore) {
+                break;
+            }
+            if (status == websocket::FrameDecoder::Status::Error) {
+                spdlog::warn("Supabase Realtime: malformed frame");
+                ok = false;
+                break;
+            }
+            if (opcode == websocket::Opcode::Ping) {
+                ok = conn.send(websocket::encode_client_frame(websocket::Opcode::Pong, payload));
+            } else if (opcode == websocket::Opcode::Close) {
+                ok = false;
+            } else if (opcode == websocket::Opcode::Text) {
+                ok = on_message(payload, rows);
+            }
+            if (!ok) {
+                break;
+            }
+        }
+        // Hand over what arrived together, even if the connection then
+        // went away.
+        if (!rows.empty()) {
+            rows_pushed.inc(rows.size());
+            on_rows_(std::move(rows));
+            rows.clear();
+        }
+        if (joined_ && !was_joined) {
+            was_joined = true;
+            spdlog::info("Supabase Realtime: subscribed to messages for {}", username_);
+            on_joined_();
+        }
+        if (!ok || !open) {
+            break;
+        }
+    }
+    if (!stopping_) {
+        spdlog::warn("Supabase Realtime: connection lost");
+    } else {
+        const char code[2] = {static_cast<char>(websocket::kCloseNormal >> 8),
+                              static_cast<char>(websocket::kCloseNormal & 0xFF)};
+        conn.send(websocket::encode_client_frame(websocket::Opcode::Close,
+                                                 std::string_view(code, 2)));
+    }
+    return was_joined;
+}
+
+bool SupabaseRealtime::on_message(std::string_view text,
+                                  std::vector<SupabaseClient::OfflineMessage>& rows) {
+    const auto msg = json::parse(text, nullptr, /*allow_exceptions=*/false);
+    if (!msg.is_object()) {
+        spdlog::warn("Supabase Realtime: message isn't a JSON object");
+        return false;
+    }
+    const auto event = string_at(msg, "event");
+    const auto ref = string_at(msg, "ref");         // null for pushes
+    const auto payload = object_at(msg, "payload");
+
+    if (event == "phx_reply") {
+        const bool ok = string_at(payload, "status") == "ok";
+        if (ref == heartbeat_ref_) {
+            heartbeat_ref_.clear();
+            return ok;
+        }
+        if (ref == join_ref_) {
+            if (!ok) {
+                spdlog::warn("Supabase Realtime: join refused: {}",
+                             object_at(payload, "response").dump());
+                return false;
+            }
+            joined_ = true;
+            joined_gauge.set(1);
+        }
+        return true;
+    }
+    if (string_at(msg, "topic") != topic_) {
+        return true;
+    }
+    if (event == "postgres_changes") {
+        const auto data = object_at(payload, "data");
+        if (string_at(data, "type") != "INSERT") {
+            return true;
+        }
+        const auto record = object_at(data, "record");
+        SupabaseClient::OfflineMessage row{string_at(record, "id"), string_at(record, "from_user"),
+                                           string_at(record, "to_user"),
+                                           string_at(record, "ciphertext"),
+                                           string_at(record, "created_at")};
+        if (row.id.empty() || row.to_user != username_) {
+            return true;
+        }
+        rows.push_back(std::move(row));
+        return true;
+    }
+    if (event == "system" && string_at(payload, "status") == "error") {
+        // E.g. the table isn't in the supabase_realtime publication.
+        spdlog::warn("Supabase Realtime: subscription failed: {}", string_at(payload, "message"));
+        return false;
+    }
+    if (event == "phx_error" || event == "phx_close") {
+        return false;
+    }
+    return true;
+}
+
+std::string SupabaseRealtime::join_message() {
+    std::string anon_key;
+    {
+        std::lock_guard lock(mutex_);
+        anon_key = anon_key_;
+    }
+    join_ref_ = std::to_string(next_ref_++);
+    const json change = {{"event", "INSERT"},
+                         {"schema", "public"},
+                         {"table", "messages"},
+                         {"filter", "to_user=eq." + username_}};
+    return json{{"topic", topic_},
+                {"event", "phx_join"},
+                {"payload", {{"config", {{"postgres_changes", json::array({change})}}},
+                             {"access_token", anon_key}}},
+                {"ref", join_ref_},
+                {"join_ref", join_ref_}}
+        .dump();
+}
+
+std::string SupabaseRealtime::heartbeat_message() {
+    heartbeat_ref_ = std::to_string(next_ref_++);
+    return json{{"topic", "phoenix"},
+                {"event", "heartbeat"},
+                {"payload", json::object()},
+                {"ref", heartbeat_ref_}}
+        .dump();
+}
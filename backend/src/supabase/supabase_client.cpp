@@ -3,14 +3,1079 @@
  *
  * Uses libcurl to talk to the Supabase PostgREST API.
  * Handles user registration, friend lookup, and offline messages.
+ *
+ * Connection reuse: a CURLSH share object holds the DNS cache, TLS session
+ * cache and (curl >= 7.57) the connection pool for every easy handle, and
+ * finished easy handles are parked for the next request rather than cleaned
+ * up. HTTP/2 is requested over TLS so overlapping requests from different
+ * threads multiplex on one connection where curl can arrange it.
+ *
+ * The Supabase host is resolved through the process's DnsCache, which
+ * refreshes it before it expires, and each request hands curl its
+ * addresses with CURLOPT_RESOLVE. curl's own resolver only runs while the
+ * cache has nothing yet.
  */
 
-#include "include/supabase/supabase_client.h"
+#include "supabase/supabase_client.h"
+#include "network/coro.h"
+#include "network/dns_cache.h"
+#include "network/json_fields.h"
+#include "network/timestamp.h"
+#include "telemetry/capture.h"
+#include "telemetry/metrics.h"
+#include "telemetry/trace.h"
+#include "telemetry/watchdog.h"
+
+#include <algorithm>
+#include <charconv>
+#include <ctime>
+#include <future>
+#include <iterator>
+#include <array>
+#include <mutex>
+#include <vector>
+
+#include <curl/curl.h>
+#include <spdlog/spdlog.h>
+
+using json = nlohmann::json;
+
+namespace {
+
+constexpr long kRequestTimeoutMs = 10000;
+
+std::size_t write_callback(char* data, std::size_t size, std::size_t nmemb, void* userp) {
+    static_cast<std::string*>(userp)->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+std::string url_escape(const std::string& value) {
+    char* escaped = curl_easy_escape(nullptr, value.c_str(), static_cast<int>(value.size()));
+    if (!escaped) {
+        return {};
+    }
+    std::string out(escaped);
+    curl_free(escaped);
+    return out;
+}
+
+/// Names per `username=in.(...)` request; keeps the URL well under common
+/// proxy limits (~8 KiB) even with escaping.
+constexpr std::size_t kNamesPerRequest = 100;
+
+/// A PostgREST in.() list: each value double-quoted so commas and
+/// parentheses in names don't split it, then URL-escaped.
+std::string in_list(std::span<const std::string> values) {
+    std::string list;
+    for (const auto& v : values) {
+        if (!list.empty()) list += ',';
+        list += '"';
+        for (char c : v) {
+            if (c == '"' || c == '\\') list += '\\';
+            list += c;
+        }
+        list += '"';
+    }
+    return url_escape(list);
+}
+
+std::string now_iso8601() {
+    return timestamp::format(static_cast<int64_t>(std::time(nullptr)));
+}
+
+metrics::Counter& hedged =
+    metrics::counter("p2p_supabase_hedged_total",
+                     "Supabase GETs sent again for taking longer than the recent p95");
+
+// Idle handles kept around; more than this many concurrent requests is
+// unusual (heartbeat + a lookup or two + the offline prefetch).
+constexpr std::size_t kMaxIdleHandles = 8;
+
+/// "POST /rest/v1/messages": a trace span's name, without the query and
+/// the usernames and ids in it.
+const char* span_name(std::string_view method, std::string_view endpoint) {
+    return trace::intern(std::string(method) + ' ' +
+                         std::string(endpoint.substr(0, endpoint.find('?'))));
+}
+
+} // namespace
+
+struct SupabaseClient::Transport {
+    CURLSH* share = nullptr;
+    // Async transfers keep connections in the CurlMulti's own cache: those
+    // sockets belong to asio and must not outlive the driver inside `share`.
+    CURLSH* async_share = nullptr;
+    std::array<std::mutex, CURL_LOCK_DATA_LAST> share_locks;
+
+    std::mutex mutex;
+    std::vector<CURL*> idle;
+
+    std::unique_ptr<CurlMulti> multi;       // null without an io_context
+
+    Transport() {
+        share = curl_share_init();
+        curl_share_setopt(share, CURLSHOPT_LOCKFUNC, &Transport::lock);
+        curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, &Transport::unlock);
+        curl_share_setopt(share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+        async_share = curl_share_init();
+        curl_share_setopt(async_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(async_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~Transport() {
+        // The driver hands its last transfers' handles back first.
+        multi.reset();
+        for (CURL* h : idle) {
+            curl_easy_cleanup(h);
+        }
+        curl_share_cleanup(share);
+        curl_share_cleanup(async_share);
+    }
+
+    CURL* acquire() {
+        {
+            std::lock_guard lock(mutex);
+            if (!idle.empty()) {
+                CURL* h = idle.back();
+                idle.pop_back();
+                // Clears options but keeps the handle's live connections
+                // and caches.
+                curl_easy_reset(h);
+                return h;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    void release(CURL* h) {
+        {
+            std::lock_guard lock(mutex);
+            if (idle.size() < kMaxIdleHandles) {
+                idle.push_back(h);
+                return;
+            }
+        }
+        curl_easy_cleanup(h);
+    }
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+        static_cast<Transport*>(userp)->share_locks[data].lock();
+    }
+
+    static void unlock(CURL*, curl_lock_data data, void* userp) {
+        static_cast<Transport*>(userp)->share_locks[data].unlock();
+    }
+};
+
+std::shared_ptr<SupabaseClient::Transport> SupabaseClient::make_transport(asio::io_context* io) {
+    static std::once_flag curl_init;
+    std::call_once(curl_init, [] { curl_global_init(CURL_GLOBAL_DEFAULT); });
+    auto transport = std::make_shared<Transport>();
+    if (io) {
+        transport->multi = std::make_unique<CurlMulti>(*io);
+    }
+    return transport;
+}
+
+SupabaseClient::SupabaseClient(const std::string& base_url, const std::string& anon_key)
+    : SupabaseClient(make_transport(), base_url, anon_key) {}
+
+SupabaseClient::Endpoint SupabaseClient::make_endpoint(const std::string& base_url,
+                                                       const std::string& anon_key) {
+    Endpoint ep{base_url, anon_key};
+    while (!ep.base_url.empty() && ep.base_url.back() == '/') {
+        ep.base_url.pop_back();
+    }
+    std::string_view rest = ep.base_url;
+    if (const auto scheme = rest.find("://"); scheme != std::string_view::npos) {
+        if (rest.substr(0, scheme) == "http") {
+            ep.port = 80;
+        }
+        rest.remove_prefix(scheme + 3);
+    }
+    rest = rest.substr(0, rest.find('/'));
+    if (const auto colon = rest.rfind(':');
+        colon != std::string_view::npos && rest.find(']', colon) == std::string_view::npos) {
+        uint16_t port = 0;
+        const auto digits = rest.substr(colon + 1);
+        if (std::from_chars(digits.data(), digits.data() + digits.size(), port).ec == std::errc() &&
+            port != 0) {
+            ep.port = port;
+        }
+        rest = rest.substr(0, colon);
+    }
+    ep.host = std::string(rest);
+    if (DnsCache::is_hostname(ep.host)) {
+        DnsCache::shared().lookup(ep.host);         // resolve ahead of the first request
+    }
+    return ep;
+}
+
+void SupabaseClient::set_endpoint(const std::string& base_url, const std::string& anon_key) {
+    auto ep = make_endpoint(base_url, anon_key);
+    const auto& current = endpoint_.read();
+    if (ep.base_url == current.base_url && ep.anon_key == current.anon_key) {
+        return;
+    }
+    spdlog::info("Supabase endpoint is now {}", ep.base_url);
+    endpoint_.publish(std::move(ep));
+}
+
+SupabaseClient::SupabaseClient(asio::io_context& io, const std::string& base_url,
+                               const std::string& anon_key)
+    : SupabaseClient(make_transport(&io), base_url, anon_key) {}
+
+SupabaseClient::SupabaseClient(std::shared_ptr<Transport> transport, const std::string& base_url,
+                               const std::string& anon_key)
+    : endpoint_(make_endpoint(base_url, anon_key)), transport_(std::move(transport)) {}
+
+SupabaseClient::~SupabaseClient() = default;
+
+// ─── Users ───────────────────────────────────────────────────────────────────
+
+bool SupabaseClient::register_user(const std::string& username,
+                                   const std::string& node_id,
+                                   const std::string& public_key,
+                                   const std::string& signing_key,
+                                   const std::string& ip,
+                                   const std::optional<std::string>& relay,
+                                   const std::optional<std::string>& udp,
+                                   const std::optional<std::string>& addresses) {
+    auto res = http_post("/rest/v1/users",
+                         user_row(username, node_id, public_key, signing_key, ip, relay, udp,
+                                  addresses).dump(),
+                         "resolution=merge-duplicates");
+    if (!res.ok()) {
+        spdlog::warn("Supabase register_user failed (HTTP {}): {}", res.status, res.body);
+        return false;
+    }
+    return true;
+}
+
+bool SupabaseClient::heartbeat(const std::string& username, const std::string& ip) {
+    const json body = {{"last_ip", ip}, {"last_seen", now_iso8601()}};
+    auto res = http_patch("/rest/v1/users?username=eq." + url_escape(username), body.dump());
+    if (!res.ok()) {
+        spdlog::warn("Supabase heartbeat failed (HTTP {})", res.status);
+        return false;
+    }
+    return true;
+}
+
+std::optional<std::vector<json>> SupabaseClient::heartbeat(const std::string& username,
+                                                           const std::string& ip,
+                                                           std::span<const std::string> friends) {
+    if (!heartbeat_rpc_missing_) {
+        const json body = {{"p_username", username}, {"p_ip", ip},
+                           {"p_friends", std::vector<std::string>(friends.begin(), friends.end())}};
+        auto res = http_post("/rest/v1/rpc/heartbeat", body.dump());
+        if (res.status != 404) {
+            if (!res.ok()) {
+                spdlog::warn("Supabase heartbeat failed (HTTP {})", res.status);
+                return std::nullopt;
+            }
+            return rows(res).value_or(std::vector<json>{});
+        }
+        note_heartbeat_rpc_missing();
+    }
+    if (!heartbeat(username, ip)) {
+        return std::nullopt;
+    }
+    return lookup_users(friends).value_or(std::vector<json>{});
+}
+
+std::optional<json> SupabaseClient::lookup_user(const std::string& username) {
+    auto res = http_get("/rest/v1/users?username=eq." + url_escape(username) + "&limit=1");
+    if (!res.ok()) {
+        spdlog::warn("Supabase lookup_user({}) failed (HTTP {})", username, res.status);
+        return std::nullopt;
+    }
+    return first_row(res);
+}
+
+std::optional<std::vector<json>> SupabaseClient::lookup_users(std::span<const std::string> usernames) {
+    std::vector<json> all;
+    for (std::size_t i = 0; i < usernames.size(); i += kNamesPerRequest) {
+        const auto chunk = usernames.subspan(i, std::min(kNamesPerRequest, usernames.size() - i));
+        auto res = http_get("/rest/v1/users?username=in.(" + in_list(chunk) + ")");
+        auto page = res.ok() ? rows(res) : std::nullopt;
+        if (!page) {
+            spdlog::warn("Supabase lookup_users failed (HTTP {})", res.status);
+            return std::nullopt;
+        }
+        std::move(page->begin(), page->end(), std::back_inserter(all));
+    }
+    return all;
+}
+
+void SupabaseClient::note_heartbeat_rpc_missing() {
+    if (!heartbeat_rpc_missing_.exchange(true)) {
+        spdlog::warn("Supabase has no heartbeat() function; falling back to a PATCH plus a "
+                     "friend lookup (see docs/infrastructure/01-supabase-setup.md)");
+    }
+}
+
+void SupabaseClient::note_take_rpc_missing() {
+    if (!take_rpc_missing_.exchange(true)) {
+        spdlog::warn("Supabase has no take_offline_messages() function; falling back to a GET "
+                     "and a DELETE per page (see docs/infrastructure/01-supabase-setup.md)");
+    }
+}
+
+json SupabaseClient::user_row(const std::string& username, const std::string& node_id,
+                              const std::string& public_key, const std::string& signing_key,
+                              const std::string& ip, const std::optional<std::string>& relay,
+                              const std::optional<std::string>& udp,
+                              const std::optional<std::string>& addresses) {
+    json row = {
+        {"username", username},
+        {"node_id", node_id},
+        {"public_key", public_key},
+        {"signing_key", signing_key},
+        {"last_ip", ip},
+        {"last_seen", now_iso8601()},
+    };
+    if (relay) {
+        row["relay"] = relay->empty() ? json(nullptr) : json(*relay);
+    }
+    if (udp) {
+        row["udp"] = udp->empty() ? json(nullptr) : json(*udp);
+    }
+    if (addresses) {
+        row["addresses"] = addresses->empty() ? json(nullptr) : json(*addresses);
+    }
+    return row;
+}
+
+std::optional<json> SupabaseClient::first_row(const HttpResponse& res) {
+    auto rows = json::parse(res.body, nullptr, /*allow_exceptions=*/false);
+    if (!rows.is_array() || rows.empty()) {
+        return std::nullopt;
+    }
+    return rows.front();
+}
+
+std::optional<std::vector<json>> SupabaseClient::rows(const HttpResponse& res) {
+    auto parsed = json::parse(res.body, nullptr, /*allow_exceptions=*/false);
+    if (!parsed.is_array()) {
+        return std::nullopt;
+    }
+    return parsed.get<std::vector<json>>();
+}
+
+// ─── Offline messages ────────────────────────────────────────────────────────
+
+bool SupabaseClient::push_offline_message(const std::string& to_user,
+                                          const std::string& from_user,
+                                          const std::string& ciphertext) {
+    const json body = {{"to_user", to_user}, {"from_user", from_user}, {"ciphertext", ciphertext}};
+    auto res = http_post("/rest/v1/messages", body.dump());
+    if (!res.ok()) {
+        spdlog::warn("Supabase push_offline_message failed (HTTP {})", res.status);
+        return false;
+    }
+    return true;
+}
+
+SupabaseClient::PushStatus SupabaseClient::push_offline_messages(
+    std::span<const OfflineMessage> messages) {
+    if (messages.empty()) {
+        return PushStatus::Ok;
+    }
+    auto res = http_post("/rest/v1/messages", offline_rows(messages),
+                         "return=minimal,resolution=ignore-duplicates");
+    const auto status = push_status(res);
+    if (status != PushStatus::Ok) {
+        spdlog::warn("Supabase push_offline_messages of {} row(s) failed (HTTP {}): {}",
+                     messages.size(), res.status, res.body);
+    }
+    return status;
+}
+
+std::string SupabaseClient::offline_rows(std::span<const OfflineMessage> messages) {
+    json body = json::array();
+    for (const auto& m : messages) {
+        body.push_back({{"id", m.id}, {"to_user", m.to_user}, {"from_user", m.from_user},
+                        {"ciphertext", m.ciphertext}});
+    }
+    return body.dump();
+}
+
+SupabaseClient::PushStatus SupabaseClient::push_status(const HttpResponse& res) {
+    if (res.ok()) {
+        return PushStatus::Ok;
+    }
+    // Timeouts and rate limiting are transient like 5xx and transport errors.
+    const bool rejected = res.status >= 400 && res.status < 500 &&
+                          res.status != 408 && res.status != 429;
+    return rejected ? PushStatus::Rejected : PushStatus::Failed;
+}
+
+std::vector<json> SupabaseClient::fetch_offline_messages(const std::string& username) {
+    std::vector<json> all;
+    fetch_offline_messages_paged(username, [&](const std::vector<OfflineMessage>& page) {
+        std::vector<std::string> ids;
+        ids.reserve(page.size());
+        for (const auto& m : page) {
+            all.push_back({{"id", m.id}, {"from_user", m.from_user}, {"to_user", m.to_user},
+                           {"ciphertext", m.ciphertext}, {"created_at", m.created_at}});
+            ids.push_back(m.id);
+        }
+        return ids;
+    });
+    return all;
+}
+
+std::optional<std::vector<SupabaseClient::OfflineMessage>>
+SupabaseClient::fetch_offline_page(const std::string& username,
+                                   const std::string& after_created_at,
+                                   const std::string& after_id,
+                                   std::size_t limit) {
+    // Keyset pagination on (created_at, id): stable even while earlier pages
+    // are being deleted, unlike offset paging.
+    std::string endpoint = "/rest/v1/messages?to_user=eq." + url_escape(username) +
+                           "&select=id,from_user,to_user,ciphertext,created_at"
+                           "&order=created_at.asc,id.asc&limit=" + std::to_string(limit);
+    if (!after_created_at.empty()) {
+        const std::string ts = url_escape("\"" + after_created_at + "\"");
+        endpoint += "&or=(created_at.gt." + ts + ",and(created_at.eq." + ts +
+                    ",id.gt." + url_escape(after_id) + "))";
+    }
+
+    auto res = http_get(endpoint);
+    if (!res.ok()) {
+        spdlog::warn("Supabase offline fetch failed (HTTP {})", res.status);
+        return std::nullopt;
+    }
+    return offline_page(res, limit);
+}
+
+std::optional<std::vector<SupabaseClient::OfflineMessage>>
+SupabaseClient::take_offline_page(const std::string& username,
+                                  const std::vector<std::string>& acks,
+                                  const std::string& after_created_at,
+                                  const std::string& after_id,
+                                  std::size_t limit) {
+    const json body = {
+        {"p_username", username},
+        {"p_ack", acks},
+        {"p_after_created_at", after_created_at.empty() ? json(nullptr) : json(after_created_at)},
+        {"p_after_id", after_id.empty() ? json(nullptr) : json(after_id)},
+        {"p_limit", limit},
+    };
+    auto res = http_post("/rest/v1/rpc/take_offline_messages", body.dump());
+    if (res.status == 404) {
+        note_take_rpc_missing();
+        return std::nullopt;
+    }
+    if (!res.ok()) {
+        spdlog::warn("Supabase offline fetch failed (HTTP {})", res.status);
+        return std::nullopt;
+    }
+    return offline_page(res, limit);
+}
+
+std::optional<std::vector<SupabaseClient::OfflineMessage>>
+SupabaseClient::offline_page(const HttpResponse& res, std::size_t limit) {
+    // A page is mostly ciphertext: read it without building a json DOM.
+    OfflineMessage m;
+    const json_fields::Field fields[] = {
+        {"id", &m.id},
+        {"from_user", &m.from_user},
+        {"to_user", &m.to_user},
+        {"ciphertext", &m.ciphertext},
+        {"created_at", &m.created_at},
+    };
+    std::vector<OfflineMessage> page;
+    page.reserve(limit);
+    if (!json_fields::read_rows(res.body, fields, [&] { page.push_back(std::move(m)); })) {
+        spdlog::warn("Supabase offline fetch returned a malformed page");
+        return std::nullopt;
+    }
+    return page;
+}
+
+std::optional<std::size_t> SupabaseClient::fetch_offline_messages_paged(const std::string& username,
+                                                                        const OfflinePageHandler& handler,
+                                                                        std::size_t page_size) {
+    if (page_size == 0) {
+        page_size = kDefaultOfflinePageSize;
+    }
+    if (!take_rpc_missing_) {
+        auto delivered = take_offline_messages_paged(username, handler, page_size);
+        if (delivered || !take_rpc_missing_) {
+            return delivered;
+        }
+    }
+    auto current = fetch_offline_page(username, "", "", page_size);
+    if (!current) {
+        return std::nullopt;
+    }
+
+    std::size_t delivered = 0;
+    std::future<std::optional<std::vector<OfflineMessage>>> next;
+    while (current && !current->empty()) {
+        const bool last = current->size() < page_size;
+        if (!last) {
+            next = std::async(std::launch::async, [this, &username, page_size,
+                                                   ts = current->back().created_at,
+                                                   id = current->back().id] {
+                return fetch_offline_page(username, ts, id, page_size);
+            });
+        }
+
+        delivered += current->size();
+        const auto acked = handler(*current);
+        if (!acked.empty() && !delete_offline_messages(acked)) {
+            spdlog::warn("Could not delete {} handled offline messages; they will be "
+                         "delivered again next time", acked.size());
+        }
+
+        if (last) {
+            break;
+        }
+        current = next.get();
+    }
+    return delivered;
+}
+
+std::optional<std::size_t> SupabaseClient::take_offline_messages_paged(
+    const std::string& username, const OfflinePageHandler& handler, std::size_t page_size) {
+    auto current = take_offline_page(username, {}, "", "", page_size);
+    if (!current) {
+        return std::nullopt;
+    }
+
+    // While the handler works on page k, the request for page k+1 is out
+    // carrying the acks of page k-1; page k's ride on the one after.
+    std::size_t delivered = 0;
+    std::vector<std::string> acks;
+    std::future<std::optional<std::vector<OfflineMessage>>> next;
+    while (current && !current->empty()) {
+        const bool last = current->size() < page_size;
+        if (!last) {
+            next = std::async(std::launch::async, [this, &username, page_size,
+                                                   acks = std::move(acks),
+                                                   ts = current->back().created_at,
+                                                   id = current->back().id] {
+                return take_offline_page(username, acks, ts, id, page_size);
+            });
+        }
+
+        delivered += current->size();
+        auto acked = handler(*current);
+        acks.insert(acks.end(), std::make_move_iterator(acked.begin()),
+                    std::make_move_iterator(acked.end()));
+
+        if (last) {
+            break;
+        }
+        current = next.get();
+    }
+    // A limit of 0 only deletes. Acks that went out with a failed request
+    // never reached Supabase: those rows are delivered again next time and
+    // dropped by the store as duplicates.
+    if (!acks.empty() && !take_offline_page(username, acks, "", "", 0)) {
+        spdlog::warn("Could not delete {} handled offline messages; they will be "
+                     "delivered again next time", acks.size());
+    }
+    return delivered;
+}
+
+bool SupabaseClient::delete_offline_messages(const std::vector<std::string>& ids) {
+    // Chunked so the URL stays well under common proxy limits (~8 KiB).
+    constexpr std::size_t kIdsPerRequest = 100;
+    bool ok = true;
+    for (std::size_t i = 0; i < ids.size(); i += kIdsPerRequest) {
+        std::string list;
+        for (std::size_t j = i; j < std::min(ids.size(), i + kIdsPerRequest); ++j) {
+            if (!list.empty()) list += ',';
+            list += url_escape(ids[j]);
+        }
+        auto res = http_delete("/rest/v1/messages?id=in.(" + list + ")");
+        if (!res.ok()) {
+            spdlog::warn("Supabase delete of offline messages failed (HTTP {})", res.status);
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// ─── Async API ───────────────────────────────────────────────────────────────
+
+void SupabaseClient::async_register_user(const std::string& username, const std::string& node_id,
+                                         const std::string& public_key,
+                                         const std::string& signing_key, const std::string& ip,
+                                         const std::optional<std::string>& relay,
+                                         const std::optional<std::string>& udp,
+                                         const std::optional<std::string>& addresses,
+                                         BoolCallback done) {
+    const bool with_addresses = addresses && !addresses_column_missing_;
+    perform_async("POST", "/rest/v1/users",
+                  user_row(username, node_id, public_key, signing_key, ip, relay, udp,
+                           with_addresses ? addresses : std::nullopt).dump(),
+                  "resolution=merge-duplicates",
+                  [this, username, node_id, public_key, signing_key, ip, relay, udp,
+                   with_addresses, done = std::move(done)](HttpResponse res) mutable {
+        // PostgREST rejects a column the table doesn't have (PGRST204).
+        if (with_addresses && res.status == 400 && res.body.find("addresses") != std::string::npos) {
+            note_addresses_column_missing();
+            async_register_user(username, node_id, public_key, signing_key, ip, relay, udp,
+                                std::nullopt, std::move(done));
+            return;
+        }
+        if (!res.ok()) {
+            spdlog::warn("Supabase register_user failed (HTTP {}): {}", res.status, res.body);
+        }
+        if (done) done(res.ok());
+    });
+}
+
+void SupabaseClient::note_addresses_column_missing() {
+    if (!addresses_column_missing_.exchange(true)) {
+        spdlog::warn("Supabase users table has no addresses column; peers will only try our "
+                     "last_ip (see docs/infrastructure/01-supabase-setup.md)");
+    }
+}
+
+void SupabaseClient::async_update_addresses(const std::string& username,
+                                            const std::string& addresses, BoolCallback done) {
+    if (addresses_column_missing_) {
+        if (done) done(false);
+        return;
+    }
+    const json body = {{"addresses", addresses.empty() ? json(nullptr) : json(addresses)}};
+    perform_async("PATCH", "/rest/v1/users?username=eq." + url_escape(username), body.dump(), "",
+                  [this, done = std::move(done)](HttpResponse res) {
+        if (res.status == 400 && res.body.find("addresses") != std::string::npos) {
+            note_addresses_column_missing();
+        } else if (!res.ok()) {
+            spdlog::warn("Supabase address update failed (HTTP {})", res.status);
+        }
+        if (done) done(res.ok());
+    });
+}
+
+void SupabaseClient::async_heartbeat(const std::string& username, const std::string& ip,
+                                     BoolCallback done) {
+    const json body = {{"last_ip", ip}, {"last_seen", now_iso8601()}};
+    perform_async("PATCH", "/rest/v1/users?username=eq." + url_escape(username), body.dump(), "",
+                  [done = std::move(done)](HttpResponse res) {
+        if (!res.ok()) {
+            spdlog::warn("Supabase heartbeat failed (HTTP {})", res.status);
+        }
+        if (done) done(res.ok());
+    });
+}
+
+void SupabaseClient::async_heartbeat(const std::string& username, const std::string& ip,
+                                     std::vector<std::string> friends, RowsCallback done) {
+    auto fallback = [this, username, ip](std::vector<std::string> friends, RowsCallback done) {
+        async_heartbeat(username, ip, [this, friends = std::move(friends),
+                                       done = std::move(done)](bool ok) mutable {
+            if (!ok) {
+                if (done) done(std::nullopt);
+                return;
+            }
+            async_lookup_users(std::move(friends), [done = std::move(done)](auto found) {
+                if (done) done(found ? std::move(*found) : std::vector<json>{});
+            });
+        });
+    };
+    if (heartbeat_rpc_missing_) {
+        fallback(std::move(friends), std::move(done));
+        return;
+    }
+    const json body = {{"p_username", username}, {"p_ip", ip}, {"p_friends", friends}};
+    perform_async("POST", "/rest/v1/rpc/heartbeat", body.dump(), "",
+                  [this, fallback, friends = std::move(friends),
+                   done = std::move(done)](HttpResponse res) mutable {
+        if (res.status == 404) {
+            note_heartbeat_rpc_missing();
+            fallback(std::move(friends), std::move(done));
+            return;
+        }
+        if (!res.ok()) {
+            spdlog::warn("Supabase heartbeat failed (HTTP {})", res.status);
+            if (done) done(std::nullopt);
+            return;
+        }
+        if (done) done(rows(res).value_or(std::vector<json>{}));
+    });
+}
+
+void SupabaseClient::async_lookup_user(const std::string& username, JsonCallback done) {
+    perform_async("GET", "/rest/v1/users?username=eq." + url_escape(username) + "&limit=1", "", "",
+                  [username, done = std::move(done)](HttpResponse res) {
+        if (!res.ok()) {
+            spdlog::warn("Supabase lookup_user({}) failed (HTTP {})", username, res.status);
+            if (done) done(std::nullopt);
+            return;
+        }
+        if (done) done(first_row(res));
+    });
+}
+
+void SupabaseClient::async_lookup_users(std::vector<std::string> usernames, RowsCallback done) {
+    if (usernames.empty()) {
+        if (done) done(std::vector<json>{});
+        return;
+    }
+    // The chunks run concurrently; their callbacks are serialised on the
+    // CurlMulti strand (or run inline), so the batch needs no lock.
+    struct Batch {
+        std::size_t outstanding;
+        bool ok = true;
+        std::vector<json> rows;
+        RowsCallback done;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->outstanding = (usernames.size() + kNamesPerRequest - 1) / kNamesPerRequest;
+    batch->done = std::move(done);
+
+    const std::span<const std::string> all(usernames);
+    for (std::size_t i = 0; i < all.size(); i += kNamesPerRequest) {
+        const auto chunk = all.subspan(i, std::min(kNamesPerRequest, all.size() - i));
+        perform_async("GET", "/rest/v1/users?username=in.(" + in_list(chunk) + ")", "", "",
+                      [batch](HttpResponse res) {
+            auto page = res.ok() ? rows(res) : std::nullopt;
+            if (!page) {
+                spdlog::warn("Supabase lookup_users failed (HTTP {})", res.status);
+                batch->ok = false;
+            } else {
+                std::move(page->begin(), page->end(), std::back_inserter(batch->rows));
+            }
+            if (--batch->outstanding == 0 && batch->done) {
+                batch->done(batch->ok ? std::optional(std::move(batch->rows)) : std::nullopt);
+            }
+        });
+    }
+}
+
+void SupabaseClient::async_push_offline_message(const std::string& to_user,
+                                                const std::string& from_user,
+                                                const std::string& ciphertext,
+                                                BoolCallback done) {
+    const json body = {{"to_user", to_user}, {"from_user", from_user}, {"ciphertext", ciphertext}};
+    perform_async("POST", "/rest/v1/messages", body.dump(), "",
+                  [done = std::move(done)](HttpResponse res) {
+        if (!res.ok()) {
+            spdlog::warn("Supabase push_offline_message failed (HTTP {})", res.status);
+        }
+        if (done) done(res.ok());
+    });
+}
+
+void SupabaseClient::async_push_offline_messages(std::vector<OfflineMessage> messages,
+                                                 PushCallback done) {
+    if (messages.empty()) {
+        if (done) done(PushStatus::Ok);
+        return;
+    }
+    perform_async("POST", "/rest/v1/messages", offline_rows(messages),
+                  "return=minimal,resolution=ignore-duplicates",
+                  [n = messages.size(), done = std::move(done)](HttpResponse res) {
+        const auto status = push_status(res);
+        if (status != PushStatus::Ok) {
+            spdlog::warn("Supabase push_offline_messages of {} row(s) failed (HTTP {}): {}",
+                         n, res.status, res.body);
+        }
+        if (done) done(status);
+    });
+}
+
+// ─── Coroutine variants ──────────────────────────────────────────────────────
+
+asio::awaitable<bool> SupabaseClient::co_register_user(std::string username, std::string node_id,
+                                                       std::string public_key,
+                                                       std::string signing_key, std::string ip,
+                                                       std::optional<std::string> relay,
+                                                       std::optional<std::string> udp,
+                                                       std::optional<std::string> addresses) {
+    co_return co_await coro::from_callback<bool>([&](auto done) {
+        async_register_user(username, node_id, public_key, signing_key, ip, relay, udp, addresses,
+                            std::move(done));
+    });
+}
+
+asio::awaitable<bool> SupabaseClient::co_heartbeat(std::string username, std::string ip) {
+    co_return co_await coro::from_callback<bool>([&](auto done) {
+        async_heartbeat(username, ip, std::move(done));
+    });
+}
+
+asio::awaitable<std::optional<std::vector<json>>> SupabaseClient::co_heartbeat(
+    std::string username, std::string ip, std::vector<std::string> friends) {
+    co_return co_await coro::from_callback<std::optional<std::vector<json>>>([&](auto done) {
+        async_heartbeat(username, ip, std::move(friends), std::move(done));
+    });
+}
+
+asio::awaitable<std::optional<json>> SupabaseClient::co_lookup_user(std::string username) {
+    co_return co_await coro::from_callback<std::optional<json>>([&](auto done) {
+        async_lookup_user(username, std::move(done));
+    });
+}
+
+asio::awaitable<std::optional<std::vector<json>>> SupabaseClient::co_lookup_users(
+    std::vector<std::string> usernames) {
+    co_return co_await coro::from_callback<std::optional<std::vector<json>>>([&](auto done) {
+        async_lookup_users(std::move(usernames), std::move(done));
+    });
+}
+
+asio::awaitable<bool> SupabaseClient::co_push_offline_message(std::string to_user,
+                                                              std::string from_user,
+                                                              std::string ciphertext) {
+    co_return co_await coro::from_callback<bool>([&](auto done) {
+        async_push_offline_message(to_user, from_user, ciphertext, std::move(done));
+    });
+}
+
+asio::awaitable<SupabaseClient::PushStatus> SupabaseClient::co_push_offline_messages(
+    std::vector<OfflineMessage> messages) {
+    co_return co_await coro::from_callback<PushStatus>([&](auto done) {
+        async_push_offline_messages(std::move(messages), std::move(done));
+    });
+}
+
+// ─── HTTP helpers ────────────────────────────────────────────────────────────
+
+SupabaseClient::HttpResponse SupabaseClient::http_get(const std::string& endpoint) {
+    return perform("GET", endpoint, nullptr, "");
+}
+
+SupabaseClient::HttpResponse SupabaseClient::http_post(const std::string& endpoint,
+                                                       const std::string& body,
+                                                       const std::string& prefer) {
+    return perform("POST", endpoint, &body, prefer);
+}
+
+SupabaseClient::HttpResponse SupabaseClient::http_patch(const std::string& endpoint,
+                                                        const std::string& body) {
+    return perform("PATCH", endpoint, &body, "");
+}
+
+SupabaseClient::HttpResponse SupabaseClient::http_delete(const std::string& endpoint) {
+    return perform("DELETE", endpoint, nullptr, "");
+}
+
+curl_slist* SupabaseClient::configure(CURL* curl, const char* method, const Endpoint& ep,
+                                      const std::string& url, const std::string* body,
+                                      const std::string& prefer, std::string* response_body,
+                                      curl_slist** resolve) {
+    curl_slist* headers = nullptr;
+    headers = curl_slist_append(headers, ("apikey: " + ep.anon_key).c_str());
+    headers = curl_slist_append(headers, ("Authorization: Bearer " + ep.anon_key).c_str());
+    headers = curl_slist_append(headers, "Content-Type: application/json");
+    if (!prefer.empty()) {
+        headers = curl_slist_append(headers, ("Prefer: " + prefer).c_str());
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, response_body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, kRequestTimeoutMs);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_SHARE, transport_->share);
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, 300L);
+    *resolve = nullptr;
+    if (DnsCache::is_hostname(ep.host)) {
+        if (auto addresses = DnsCache::shared().lookup(ep.host); addresses && !addresses->empty()) {
+            // "+" (curl 7.75): an entry that times out like a resolved one,
+            // instead of staying until removed.
+#if LIBCURL_VERSION_NUM >= 0x074B00
+            std::string entry = fmt::format("+{}:{}:", ep.host, ep.port);
+#else
+            std::string entry = fmt::format("{}:{}:", ep.host, ep.port);
+#endif
+            for (std::size_t i = 0; i < addresses->size(); ++i) {
+                const auto& address = (*addresses)[i];
+                entry += i ? "," : "";
+                entry += address.is_v6() ? '[' + address.to_string() + ']' : address.to_string();
+            }
+            *resolve = curl_slist_append(nullptr, entry.c_str());
+            curl_easy_setopt(curl, CURLOPT_RESOLVE, *resolve);
+        }
+    }
+    if (body) {
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body->data());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, static_cast<long>(body->size()));
+    }
+    return headers;
+}
+
+SupabaseClient::HttpResponse SupabaseClient::perform(const char* method,
+                                                     const std::string& endpoint,
+                                                     const std::string* body,
+                                                     const std::string& prefer) {
+    HttpResponse response;
+    const auto admitted = breaker_.allow();
+    if (admitted == CircuitBreaker::Admit::No) {
+        return response;
+    }
+    // Blocking: a stall here means a synchronous call was made on an I/O thread.
+    watchdog::Tag busy("supabase.perform");
+    trace::Span span("supabase", trace::enabled() ? span_name(method, endpoint) : "");
+    const auto sent = CircuitBreaker::Clock::now();
+    CURL* curl = transport_->acquire();
+    if (!curl) {
+        spdlog::error("curl_easy_init failed");
+        breaker_.record(admitted, response.status, CircuitBreaker::Clock::now() - sent);
+        return response;
+    }
+
+    const Endpoint& ep = endpoint_.read();
+    const std::string url = ep.base_url + endpoint;
+    curl_slist* resolve = nullptr;
+    curl_slist* headers = configure(curl, method, ep, url, body, prefer, &response.body, &resolve);
+
+    const CURLcode rc = curl_easy_perform(curl);
+    if (rc == CURLE_OK) {
+        curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &response.status);
+    } else {
+        spdlog::warn("{} {} failed: {}", method, endpoint, curl_easy_strerror(rc));
+    }
+    capture::http(method, endpoint, response.status, body ? *body : std::string_view(),
+                  response.body);
+
+    curl_slist_free_all(headers);
+    curl_slist_free_all(resolve);
+    transport_->release(curl);
+    breaker_.record(admitted, response.status, CircuitBreaker::Clock::now() - sent);
+    return response;
+}
+
+void SupabaseClient::perform_async(const char* method, std::string endpoint, std::string body,
+                                   std::string prefer, ResponseCallback done) {
+    const bool has_body = std::string_view(method) != "GET" && std::string_view(method) != "DELETE";
+    if (!transport_->multi) {
+        done(perform(method, endpoint, has_body ? &body : nullptr, prefer));
+        return;
+    }
+    const auto admitted = breaker_.allow();
+    if (admitted == CircuitBreaker::Admit::No) {
+        done(HttpResponse{});
+        return;
+    }
+    const auto hedge_after =
+        std::string_view(method) == "GET" ? breaker_.hedge_after() : std::nullopt;
+    if (!hedge_after) {
+        start_transfer(admitted, method, endpoint, body, prefer, std::move(done));
+        return;
+    }
+
+    // Both attempts and the timer finish on the CurlMulti strand, so the
+    // race needs no lock. The slower attempt runs to the end unheard.
+    struct Hedge {
+        asio::steady_timer timer;
+        ResponseCallback done;                  // null once answered
+        int running = 1;
+
+        Hedge(asio::strand<asio::io_context::executor_type>& strand, ResponseCallback done)
+            : timer(strand), done(std::move(done)) {}
+    };
+    auto hedge = std::make_shared<Hedge>(transport_->multi->strand(), std::move(done));
+    auto finish = [hedge](HttpResponse res) {
+        --hedge->running;
+        if (!hedge->done || (CircuitBreaker::failed(res.status) && hedge->running > 0)) {
+            return;                             // answered, or the other attempt may do better
+        }
+        hedge->timer.cancel();
+        auto done = std::move(hedge->done);
+        hedge->done = nullptr;
+        done(std::move(res));
+    };
+    hedge->timer.expires_after(*hedge_after);
+    hedge->timer.async_wait([this, alive = std::weak_ptr<int>(alive_), hedge, method,
+                             endpoint, prefer, finish](const asio::error_code& ec) {
+        if (ec || !hedge->done || alive.expired()) {
+            return;
+        }
+        const auto again = breaker_.allow();
+        if (again == CircuitBreaker::Admit::No) {
+            return;
+        }
+        hedged.inc();
+        ++hedge->running;
+        start_transfer(again, method, endpoint, "", prefer, finish);
+    });
+    start_transfer(admitted, method, endpoint, body, prefer, finish);
+}
+
+void SupabaseClient::start_transfer(CircuitBreaker::Admit admitted, const char* method,
+                                    const std::string& endpoint, const std::string& body,
+                                    const std::string& prefer, ResponseCallback done) {
+    const bool has_body = std::string_view(method) != "GET" && std::string_view(method) != "DELETE";
+
+    // Everything curl points into must outlive the transfer.
+    struct Transfer {
+        std::string method;
+        std::string endpoint;
+        std::string url;
+        std::string body;
+        curl_slist* headers = nullptr;
+        curl_slist* resolve = nullptr;
+        HttpResponse response;
+        ResponseCallback done;
+        const char* span = nullptr;             // set while tracing
+        trace::Clock::time_point started;
+        CircuitBreaker::Clock::time_point sent;
+    };
+    auto t = std::make_shared<Transfer>();
+    if (trace::enabled()) {
+        t->span = span_name(method, endpoint);
+        t->started = trace::Clock::now();
+    }
+    t->method = method;
+    t->endpoint = endpoint;
+    const Endpoint& ep = endpoint_.read();
+    t->url = ep.base_url + t->endpoint;
+    t->body = body;
+    t->done = std::move(done);
+    t->sent = CircuitBreaker::Clock::now();
+
+    CURL* curl = transport_->acquire();
+    if (!curl) {
+        spdlog::error("curl_easy_init failed");
+        breaker_.record(admitted, t->response.status, CircuitBreaker::Clock::now() - t->sent);
+        t->done(std::move(t->response));
+        return;
+    }
+    t->headers = configure(curl, t->method.c_str(), ep, t->url, has_body ? &t->body : nullptr,
+                           prefer, &t->response.body, &t->resolve);
+    // Only touched from the CurlMulti strand, so no lock callbacks needed.
+    curl_easy_setopt(curl, CURLOPT_SHARE, transport_->async_share);
 
-// TODO: Implement
-// - SupabaseClient::SupabaseClient(url, anon_key)
-// - SupabaseClient::register_user(username, node_id, public_key, ip)
-// - SupabaseClient::heartbeat(username, ip)   — update last_seen
-// - SupabaseClient::lookup_user(username)      — return public_key + last_ip
-// - SupabaseClient::push_offline_message(to, from, ciphertext)
-// - SupabaseClient::fetch_offline_messages(username) — GET + DELETE
+    transport_->multi->start(curl, [this, transport = transport_.get(), admitted,
+                                    alive = std::weak_ptr<int>(alive_), t](CURL* easy,
+                                                                           CURLcode rc) {
+        if (rc == CURLE_OK) {
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &t->response.status);
+        } else {
+            spdlog::warn("{} {} failed: {}", t->method, t->endpoint, curl_easy_strerror(rc));
+        }
+        curl_slist_free_all(t->headers);
+        curl_slist_free_all(t->resolve);
+        transport->release(easy);
+        if (t->span) {
+            trace::complete("supabase", t->span, t->started);
+        }
+        capture::http(t->method, t->endpoint, t->response.status, t->body, t->response.body);
+        if (!alive.expired()) {
+            breaker_.record(admitted, t->response.status,
+                            CircuitBreaker::Clock::now() - t->sent);
+            t->done(std::move(t->response));
+        }
+    });
+}
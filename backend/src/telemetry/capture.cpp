@@ -0,0 +1,223 @@
+/**
+ * Capture — the wire capture writer and reader.
+ *
+ * One writer for the process, behind a mutex: a capture is a diagnostic
+ * mode, so its cost only has to be bounded, not free. Records are built in
+ * a reused buffer and go through a 1 MiB stdio buffer.
+ */
+
+#include "telemetry/capture.h"
+
+#include <algorithm>
+#include <mutex>
+
+#include <spdlog/spdlog.h>
+
+namespace capture {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Bounds one field read back, so a corrupt length can't ask for the moon.
+constexpr uint64_t kMaxField = uint64_t{256} << 20;
+
+struct Writer {
+    ~Writer() {
+        if (file) std::fclose(file);
+    }
+
+    std::mutex mutex;
+    std::FILE* file = nullptr;
+    std::string path;                   // kept once the size limit closes the file
+    uint64_t written = 0;
+    uint64_t max_bytes = 0;
+    Clock::time_point last;
+    std::string scratch;
+};
+
+Writer& writer() {
+    static Writer w;
+    return w;
+}
+
+void put_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+void put_field(std::string& out, std::string_view s) {
+    put_varint(out, s.size());
+    out.append(s);
+}
+
+// Caller holds w.mutex.
+void close_locked(Writer& w) {
+    detail::enabled.store(false, std::memory_order_relaxed);
+    if (w.file) {
+        std::fclose(w.file);
+        w.file = nullptr;
+    }
+}
+
+void write(Kind kind, std::string_view method, std::string_view label, long status,
+           std::string_view request, std::string_view payload) {
+    auto& w = writer();
+    std::lock_guard lock(w.mutex);
+    if (!w.file) {
+        return;
+    }
+    const auto now = Clock::now();
+    auto& out = w.scratch;
+    out.clear();
+    out.push_back(static_cast<char>(kind));
+    put_varint(out, static_cast<uint64_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(now - w.last).count()));
+    w.last = now;
+    if (kind == Kind::Http) {
+        put_varint(out, method.size() + 1 + label.size());
+        out.append(method);
+        out.push_back(' ');
+        out.append(label);
+        put_varint(out, static_cast<uint64_t>(std::max(0L, status)));
+        put_field(out, request);
+    } else {
+        put_field(out, label);
+    }
+    put_field(out, payload);
+
+    if (w.written + out.size() > w.max_bytes) {
+        spdlog::warn("Wire capture {} reached its size limit; stopped", w.path);
+        close_locked(w);
+        return;
+    }
+    if (std::fwrite(out.data(), 1, out.size(), w.file) != out.size()) {
+        spdlog::error("Wire capture {} write failed; stopped", w.path);
+        close_locked(w);
+        return;
+    }
+    w.written += out.size();
+}
+
+bool get_varint(std::FILE* f, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        const int c = std::getc(f);
+        if (c == EOF) {
+            return false;
+        }
+        v |= static_cast<uint64_t>(c & 0x7F) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool get_field(std::FILE* f, std::string& s) {
+    uint64_t n = 0;
+    if (!get_varint(f, n) || n > kMaxField) {
+        return false;
+    }
+    s.resize(n);
+    return std::fread(s.data(), 1, n, f) == n;
+}
+
+} // namespace
+
+bool start(const std::string& path, uint64_t max_bytes) {
+    auto& w = writer();
+    std::lock_guard lock(w.mutex);
+    close_locked(w);
+    w.path = path;
+    if (path.empty()) {
+        return true;
+    }
+    w.file = std::fopen(path.c_str(), "wb");
+    if (!w.file) {
+        spdlog::error("Cannot open wire capture {}", path);
+        return false;
+    }
+    std::setvbuf(w.file, nullptr, _IOFBF, 1 << 20);
+    std::fwrite(kMagic.data(), 1, kMagic.size(), w.file);
+    w.written = kMagic.size();
+    w.max_bytes = max_bytes;
+    w.last = Clock::now();
+    detail::enabled.store(true, std::memory_order_relaxed);
+    spdlog::info("Capturing wire traffic to {}", path);
+    return true;
+}
+
+void apply(const nlohmann::json& config) {
+    const auto& cfg = config.contains("logging") ? config["logging"] : nlohmann::json::object();
+    const std::string path = cfg.value("capture_file", "");
+    const uint64_t max_bytes = cfg.value("capture_max_mib", uint64_t{1024}) << 20;
+    {
+        auto& w = writer();
+        std::lock_guard lock(w.mutex);
+        if (w.path == path) {
+            w.max_bytes = max_bytes;
+            return;
+        }
+    }
+    start(path, max_bytes);
+}
+
+void frame(Kind kind, std::string_view remote, std::string_view payload) {
+    if (enabled()) {
+        write(kind, {}, remote, 0, {}, payload);
+    }
+}
+
+void http(std::string_view method, std::string_view endpoint, long status,
+          std::string_view request, std::string_view response) {
+    if (enabled()) {
+        write(Kind::Http, method, endpoint, status, request, response);
+    }
+}
+
+Reader::Reader(const std::string& path) : file_(std::fopen(path.c_str(), "rb")) {
+    char magic[kMagic.size()];
+    if (file_ && (std::fread(magic, 1, sizeof(magic), file_) != sizeof(magic) ||
+                  std::string_view(magic, sizeof(magic)) != kMagic)) {
+        std::fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+Reader::~Reader() {
+    if (file_) std::fclose(file_);
+}
+
+bool Reader::next(Record& record) {
+    if (!file_) {
+        return false;
+    }
+    const int kind = std::getc(file_);
+    uint64_t delta = 0;
+    if (kind < static_cast<int>(Kind::FrameIn) || kind > static_cast<int>(Kind::Http) ||
+        !get_varint(file_, delta)) {
+        return false;
+    }
+    at_ += std::chrono::microseconds(delta);
+    record.kind = static_cast<Kind>(kind);
+    record.at = at_;
+    record.status = 0;
+    record.request.clear();
+    if (!get_field(file_, record.label)) {
+        return false;
+    }
+    if (record.kind == Kind::Http) {
+        uint64_t status = 0;
+        if (!get_varint(file_, status) || !get_field(file_, record.request)) {
+            return false;
+        }
+        record.status = static_cast<long>(status);
+    }
+    return get_field(file_, record.payload);
+}
+
+} // namespace capture
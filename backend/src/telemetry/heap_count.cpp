@@ -0,0 +1,88 @@
+/**
+ * HeapCount — the counting operator new, under P2P_COUNT_ALLOCATIONS.
+ */
+
+#include "telemetry/heap_count.h"
+
+#ifdef P2P_COUNT_ALLOCATIONS
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace {
+
+constexpr std::size_t kShards = 8;
+
+struct alignas(64) Shard {
+    std::atomic<uint64_t> count{0};
+};
+
+// Constant-initialized: operator new runs before any dynamic initializer.
+constinit std::array<Shard, kShards> shards{};
+constinit std::atomic<std::size_t> next_shard{0};
+
+void count() {
+    // Not a function-local static: that could allocate.
+    thread_local std::size_t index = kShards;
+    if (index == kShards) {
+        index = next_shard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    }
+    shards[index].count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* allocate(std::size_t size, std::size_t alignment) {
+    count();
+    size = size ? size : 1;
+    for (;;) {
+        void* p = alignment <= alignof(std::max_align_t)
+                      ? std::malloc(size)
+                      : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        if (p) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+} // namespace
+
+// The array and nothrow forms call these, and the library's operator
+// delete frees with free(), which matches both.
+void* operator new(std::size_t size) {
+    return allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+namespace heap_count {
+
+std::optional<uint64_t> total() {
+    uint64_t sum = 0;
+    for (const auto& shard : shards) {
+        sum += shard.count.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+} // namespace heap_count
+
+#else
+
+namespace heap_count {
+
+std::optional<uint64_t> total() {
+    return std::nullopt;
+}
+
+} // namespace heap_count
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * Logging — async spdlog pipeline and per-message traces.
+ */
+
+#include "telemetry/logging.h"
+#include "telemetry/capture.h"
+#include "telemetry/trace.h"
+
+#include <vector>
+
+#include <spdlog/async.h>
+#include <spdlog/sinks/rotating_file_sink.h>
+#include <spdlog/sinks/stdout_color_sinks.h>
+
+namespace logging {
+
+void init(const nlohmann::json& config) {
+    const auto& cfg = config.contains("logging") ? config["logging"] : nlohmann::json::object();
+
+    // One pool thread keeps records in order across sinks; the queue only
+    // has to absorb bursts (a full queue blocks the logging thread).
+    spdlog::init_thread_pool(cfg.value("async_queue", std::size_t{8192}), 1);
+
+    std::vector<spdlog::sink_ptr> sinks;
+    sinks.push_back(std::make_shared<spdlog::sinks::stdout_color_sink_mt>());
+    const std::string file = cfg.value("file", "node.log");
+    if (!file.empty()) {
+        try {
+            sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(
+                file, cfg.value("max_file_bytes", std::size_t{10} << 20),
+                cfg.value("max_files", std::size_t{3})));
+        } catch (const spdlog::spdlog_ex& e) {
+            spdlog::error("Cannot open log file {}: {}", file, e.what());
+        }
+    }
+
+    auto logger = std::make_shared<spdlog::async_logger>(
+        "node", sinks.begin(), sinks.end(), spdlog::thread_pool(),
+        spdlog::async_overflow_policy::block);
+    logger->flush_on(spdlog::level::warn);
+    spdlog::set_default_logger(std::move(logger));
+    spdlog::flush_every(std::chrono::seconds(1));
+
+    apply(config);
+}
+
+void apply(const nlohmann::json& config) {
+    const auto& cfg = config.contains("logging") ? config["logging"] : nlohmann::json::object();
+    spdlog::set_level(spdlog::level::from_str(cfg.value("level", "info")));
+
+    detail::trace_messages.store(cfg.value("trace_messages", false), std::memory_order_relaxed);
+    if (detail::trace_messages.load(std::memory_order_relaxed)) {
+#if SPDLOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+        spdlog::set_level(spdlog::level::trace);
+#else
+        spdlog::warn("logging.trace_messages is set but this build compiles traces out");
+#endif
+    }
+    trace::apply(config);
+    capture::apply(config);
+}
+
+void shutdown() {
+    capture::start({}, 0);                  // flush and close a capture
+    spdlog::shutdown();
+}
+
+MessageTrace::MessageTrace(std::string from)
+    : from_(std::move(from)), start_(Clock::now()), last_(start_) {}
+
+MessageTrace::~MessageTrace() {
+    const auto total = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start_);
+    SPDLOG_TRACE("msg from={} msg_id={} result={}{} total={}us", from_,
+                 msg_id_.empty() ? "-" : msg_id_, result_, stages_, total.count());
+}
+
+void MessageTrace::stage(std::string_view name) {
+    stage(name, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - last_));
+}
+
+void MessageTrace::stage(std::string_view name, std::chrono::nanoseconds took) {
+    stages_ += ' ';
+    stages_ += name;
+    stages_ += '=';
+    stages_ += std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(took).count());
+    stages_ += "us";
+    last_ = Clock::now();
+}
+
+} // namespace logging
@@ -0,0 +1,222 @@
+/**
+ * Memory — per-area byte accounts, budgets and the reclaim thread.
+ */
+
+#include "telemetry/memory.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace memory {
+
+namespace {
+
+constexpr std::array<const char*, kAreas> kNames = {
+    "peer_sessions", "pools", "directory", "history", "send_queues", "crypto_cache",
+};
+
+// Cheapest to rebuild first: under total pressure, the first areas asked
+// usually cover the whole excess.
+constexpr std::array<Area, kAreas> kReclaimOrder = {
+    Area::Pools, Area::History, Area::CryptoCache, Area::Directory,
+    Area::PeerSessions, Area::SendQueues,
+};
+
+std::array<metrics::Gauge*, kAreas> make_gauges() {
+    std::array<metrics::Gauge*, kAreas> gauges{};
+    for (std::size_t i = 0; i < kAreas; ++i) {
+        gauges[i] = &metrics::gauge(std::string("p2p_memory_") + kNames[i] + "_bytes",
+                                    std::string("Bytes held for ") + kNames[i]);
+    }
+    return gauges;
+}
+
+const std::array<metrics::Gauge*, kAreas> area_bytes = make_gauges();
+metrics::Gauge& total_bytes =
+    metrics::gauge("p2p_memory_bytes", "Bytes held by every accounted area together");
+metrics::Gauge& budget_bytes =
+    metrics::gauge("p2p_memory_budget_bytes", "Budget for p2p_memory_bytes; 0 = none");
+metrics::Counter& reclaims_total =
+    metrics::counter("p2p_memory_reclaims_total", "Caches asked to shrink to meet a budget");
+
+// Budgets in bytes, 0 = none; read on every charge, so atomics.
+std::array<std::atomic<int64_t>, kAreas> area_budgets{};
+std::atomic<int64_t> total_budget{0};
+
+std::size_t index(Area area) { return static_cast<std::size_t>(area); }
+
+int64_t over(int64_t used, int64_t budget) {
+    return budget > 0 && used > budget ? used - budget : 0;
+}
+
+} // namespace
+
+struct detail::Registered {
+    Area area;
+    std::function<void(std::size_t)> shrink;
+};
+
+namespace {
+
+struct Reclaim {
+    std::mutex mutex;                           // guards everything below
+    std::vector<detail::Registered*> reclaimers;
+    std::condition_variable wake;
+    std::atomic<bool> pressure{false};
+    bool stopping = false;
+    bool warned = false;                        // over budget after the last reclaim
+    std::thread thread;
+};
+
+Reclaim& instance() {
+    static Reclaim reclaim;
+    return reclaim;
+}
+
+/// Ask the reclaimers of each area over budget for the excess. Caller
+/// holds the reclaim mutex.
+void reclaim_locked(Reclaim& r) {
+    for (const Area area : kReclaimOrder) {
+        for (auto* reclaimer : r.reclaimers) {
+            if (reclaimer->area != area) {
+                continue;
+            }
+            const std::size_t bytes = excess(area);
+            if (bytes == 0) {
+                break;
+            }
+            reclaims_total.inc();
+            reclaimer->shrink(bytes);
+        }
+    }
+    const int64_t budget = total_budget.load(std::memory_order_relaxed);
+    const bool still_over = over(total_bytes.value(), budget) > 0;
+    if (still_over && !r.warned) {
+        spdlog::warn("Memory still over budget after reclaim: {} of {} bytes",
+                     total_bytes.value(), budget);
+    }
+    r.warned = still_over;
+}
+
+void run(Options options) {
+    Reclaim& r = instance();
+    std::unique_lock lock(r.mutex);
+    while (!r.stopping) {
+        r.wake.wait_for(lock, options.interval, [&] {
+            return r.stopping || r.pressure.load(std::memory_order_relaxed);
+        });
+        if (r.stopping) {
+            break;
+        }
+        r.pressure.store(false, std::memory_order_relaxed);
+        reclaim_locked(r);
+    }
+}
+
+} // namespace
+
+Options options(const nlohmann::json& config) {
+    const auto& node = config.contains("node") ? config["node"] : nlohmann::json::object();
+    constexpr std::size_t kMiB = 1024 * 1024;
+    Options options;
+    options.total = node.value("memory_budget_mb", std::size_t{0}) * kMiB;
+    if (node.contains("memory_budgets_mb") && node["memory_budgets_mb"].is_object()) {
+        const auto& areas = node["memory_budgets_mb"];
+        for (std::size_t i = 0; i < kAreas; ++i) {
+            options.areas[i] = areas.value(kNames[i], std::size_t{0}) * kMiB;
+        }
+    }
+    options.interval =
+        std::chrono::milliseconds(std::max(10, node.value("memory_check_interval_ms", 1000)));
+    return options;
+}
+
+void start(Options options) {
+    Reclaim& r = instance();
+    std::lock_guard lock(r.mutex);
+    if (r.thread.joinable()) {
+        return;
+    }
+    for (std::size_t i = 0; i < kAreas; ++i) {
+        area_budgets[i].store(static_cast<int64_t>(options.areas[i]), std::memory_order_relaxed);
+    }
+    total_budget.store(static_cast<int64_t>(options.total), std::memory_order_relaxed);
+    budget_bytes.set(static_cast<int64_t>(options.total));
+    r.stopping = false;
+    r.thread = std::thread(run, options);
+    if (options.total > 0) {
+        spdlog::info("Memory budget: {} MiB", options.total / (1024 * 1024));
+    }
+}
+
+void stop() {
+    Reclaim& r = instance();
+    std::thread thread;
+    {
+        std::lock_guard lock(r.mutex);
+        r.stopping = true;
+        thread = std::move(r.thread);
+    }
+    r.wake.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+    for (auto& budget : area_budgets) {
+        budget.store(0, std::memory_order_relaxed);
+    }
+    total_budget.store(0, std::memory_order_relaxed);
+    budget_bytes.set(0);
+}
+
+void charge(Area area, int64_t bytes) {
+    const std::size_t i = index(area);
+    area_bytes[i]->add(bytes);
+    total_bytes.add(bytes);
+    if (bytes > 0 && excess(area) > 0 &&
+        !instance().pressure.exchange(true, std::memory_order_relaxed)) {
+        instance().wake.notify_one();
+    }
+}
+
+int64_t used(Area area) {
+    return area_bytes[index(area)]->value();
+}
+
+std::size_t excess(Area area) {
+    const int64_t held = used(area);
+    const int64_t bytes = std::max(
+        over(held, area_budgets[index(area)].load(std::memory_order_relaxed)),
+        over(total_bytes.value(), total_budget.load(std::memory_order_relaxed)));
+    return static_cast<std::size_t>(std::clamp<int64_t>(bytes, 0, std::max<int64_t>(held, 0)));
+}
+
+bool over_budget(Area area, std::size_t bytes) {
+    const auto adding = static_cast<int64_t>(bytes);
+    const int64_t area_budget = area_budgets[index(area)].load(std::memory_order_relaxed);
+    const int64_t total = total_budget.load(std::memory_order_relaxed);
+    return (area_budget > 0 && used(area) + adding > area_budget) ||
+           (total > 0 && total_bytes.value() + adding > total);
+}
+
+Reclaimer::Reclaimer(Area area, std::function<void(std::size_t bytes)> shrink)
+    : state_(std::make_unique<detail::Registered>(detail::Registered{area, std::move(shrink)})) {
+    Reclaim& r = instance();
+    std::lock_guard lock(r.mutex);
+    r.reclaimers.push_back(state_.get());
+}
+
+Reclaimer::~Reclaimer() {
+    Reclaim& r = instance();
+    std::lock_guard lock(r.mutex);
+    std::erase(r.reclaimers, state_.get());
+}
+
+} // namespace memory
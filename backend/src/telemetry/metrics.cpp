@@ -0,0 +1,262 @@
+/**
+ * Metrics — lock-free recording, Prometheus rendering.
+ */
+
+#include "telemetry/metrics.h"
+#include "telemetry/heap_count.h"
+#include "network/huge_pages.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <variant>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+namespace metrics {
+
+namespace {
+
+/// This thread's histogram shard; threads are dealt shards round-robin.
+std::size_t shard_index() {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t index =
+        next.fetch_add(1, std::memory_order_relaxed) % Histogram::kShards;
+    return index;
+}
+
+struct Entry {
+    std::string name;
+    std::string help;
+    std::variant<std::unique_ptr<Counter>, std::unique_ptr<Gauge>,
+                 std::unique_ptr<Histogram>> metric;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<Entry> entries;                  // registration order
+
+    template <typename T>
+    T& get(const std::string& name, const std::string& help) {
+        std::lock_guard lock(mutex);
+        for (auto& entry : entries) {
+            if (entry.name == name) {
+                // A name reused for another kind of metric is a programming
+                // error; std::get throws on it.
+                return *std::get<std::unique_ptr<T>>(entry.metric);
+            }
+        }
+        auto metric = std::make_unique<T>();
+        T& ref = *metric;
+        entries.push_back({name, help, std::move(metric)});
+        return ref;
+    }
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+void append_number(std::string& out, double value) {
+    char buf[32];
+    const auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, ec == std::errc() ? end : buf);
+}
+
+void append_header(std::string& out, std::string_view name, std::string_view help,
+                   const char* type) {
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+/// Figures the process keeps anyway, read at scrape time instead of
+/// recorded: what perf-report divides by the messages a run handled.
+void append_process(std::string& out) {
+#ifndef _WIN32
+    rusage usage{};
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        const double seconds =
+            static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+            static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+        append_header(out, "p2p_process_cpu_seconds_total", "User and system CPU time, all threads",
+                      "counter");
+        out += "p2p_process_cpu_seconds_total ";
+        append_number(out, seconds);
+        out += '\n';
+    }
+#endif
+    if (const auto allocations = heap_count::total()) {
+        append_header(out, "p2p_heap_allocations_total",
+                      "Global operator new calls (P2P_COUNT_ALLOCATIONS builds)", "counter");
+        out += "p2p_heap_allocations_total ";
+        out += std::to_string(*allocations);
+        out += '\n';
+    }
+}
+
+/// The huge page arena, if node.huge_pages_mb set one up. With transparent
+/// huge pages the kernel may not have backed all of it, or may have split
+/// pages since, so coverage is read from it at scrape time.
+void append_huge_pages(std::string& out) {
+    const auto arena = huge_pages::coverage();
+    if (arena.backing == huge_pages::Backing::None) {
+        return;
+    }
+    const std::pair<const char*, std::size_t> rows[] = {
+        {"p2p_memory_huge_page_arena_bytes", arena.arena_bytes},
+        {"p2p_memory_huge_page_used_bytes", arena.used_bytes},
+        {"p2p_memory_huge_page_backed_bytes", arena.huge_bytes},
+    };
+    const char* help[] = {
+        "Bytes mapped for the huge page buffer arena",
+        "Bytes of the arena handed to session blocks and read buffers",
+        "Bytes of the arena the kernel backs with huge pages",
+    };
+    for (std::size_t i = 0; i < std::size(rows); ++i) {
+        append_header(out, rows[i].first, help[i], "gauge");
+        out += rows[i].first;
+        out += ' ';
+        out += std::to_string(rows[i].second);
+        out += '\n';
+    }
+}
+
+} // namespace
+
+void Histogram::record(std::chrono::nanoseconds duration) {
+    const uint64_t ns = duration.count() > 0 ? static_cast<uint64_t>(duration.count()) : 0;
+    Shard& shard = shards_[shard_index()];
+    shard.buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum_ns.fetch_add(ns, std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+    Snapshot snap;
+    snap.buckets.assign(kBuckets, 0);
+    for (const auto& shard : shards_) {
+        for (std::size_t i = 0; i < kBuckets; ++i) {
+            snap.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+        }
+        snap.sum_ns += shard.sum_ns.load(std::memory_order_relaxed);
+    }
+    // Counted from the buckets so quantiles stay consistent with them
+    // while other threads keep recording.
+    for (uint64_t n : snap.buckets) {
+        snap.count += n;
+    }
+    return snap;
+}
+
+std::size_t Histogram::bucket_of(uint64_t ns) {
+    constexpr uint64_t kSub = uint64_t{1} << kSubBits;
+    if (ns < kSub) {
+        return static_cast<std::size_t>(ns);
+    }
+    const unsigned exp = std::bit_width(ns) - 1;     // >= kSubBits
+    if (exp >= kMaxBits) {
+        return kBuckets - 1;
+    }
+    const unsigned shift = exp - kSubBits;
+    return ((exp - kSubBits + 1) << kSubBits) + static_cast<std::size_t>((ns >> shift) - kSub);
+}
+
+uint64_t Histogram::value_of(std::size_t bucket) {
+    constexpr uint64_t kSub = uint64_t{1} << kSubBits;
+    if (bucket < kSub) {
+        return bucket;
+    }
+    const unsigned shift = static_cast<unsigned>(bucket >> kSubBits) - 1;
+    const uint64_t lower = (kSub + (bucket & (kSub - 1))) << shift;
+    return lower + ((uint64_t{1} << shift) >> 1);
+}
+
+uint64_t Histogram::Snapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    const auto rank = std::max<uint64_t>(
+        1, static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count))));
+    uint64_t seen = 0;
+    for (std::size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return value_of(i);
+        }
+    }
+    return value_of(buckets.size() - 1);
+}
+
+Counter& counter(const std::string& name, const std::string& help) {
+    return registry().get<Counter>(name, help);
+}
+
+Gauge& gauge(const std::string& name, const std::string& help) {
+    return registry().get<Gauge>(name, help);
+}
+
+Histogram& histogram(const std::string& name, const std::string& help) {
+    return registry().get<Histogram>(name, help);
+}
+
+std::string render_prometheus() {
+    static constexpr double kQuantiles[] = {0.5, 0.9, 0.99};
+
+    Registry& reg = registry();
+    std::lock_guard lock(reg.mutex);
+    std::string out;
+    out.reserve(reg.entries.size() * 256);
+    for (const auto& entry : reg.entries) {
+        if (const auto* c = std::get_if<std::unique_ptr<Counter>>(&entry.metric)) {
+            append_header(out, entry.name, entry.help, "counter");
+            out += entry.name;
+            out += ' ';
+            out += std::to_string((*c)->value());
+            out += '\n';
+        } else if (const auto* g = std::get_if<std::unique_ptr<Gauge>>(&entry.metric)) {
+            append_header(out, entry.name, entry.help, "gauge");
+            out += entry.name;
+            out += ' ';
+            out += std::to_string((*g)->value());
+            out += '\n';
+        } else {
+            const auto snap = std::get<std::unique_ptr<Histogram>>(entry.metric)->snapshot();
+            append_header(out, entry.name, entry.help, "summary");
+            for (double q : kQuantiles) {
+                out += entry.name;
+                out += "{quantile=\"";
+                append_number(out, q);
+                out += "\"} ";
+                append_number(out, static_cast<double>(snap.quantile(q)) / 1e9);
+                out += '\n';
+            }
+            out += entry.name;
+            out += "_sum ";
+            append_number(out, static_cast<double>(snap.sum_ns) / 1e9);
+            out += '\n';
+            out += entry.name;
+            out += "_count ";
+            out += std::to_string(snap.count);
+            out += '\n';
+        }
+    }
+    append_process(out);
+    append_huge_pages(out);
+    return out;
+}
+
+} // namespace metrics
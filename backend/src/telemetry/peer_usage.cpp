@@ -0,0 +1,72 @@
+/**
+ * PeerUsage — per-peer traffic and crypto counters.
+ */
+
+#include "telemetry/peer_usage.h"
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace peer_usage {
+
+namespace {
+
+struct Hash {
+    using is_transparent = void;
+    std::size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+};
+
+template <typename T>
+using Map = std::unordered_map<std::string, T, Hash, std::equal_to<>>;
+
+struct Table {
+    std::mutex mutex;
+    Map<std::unique_ptr<Entry>> entries;        // never erased, so pointers stay valid
+};
+
+Table& table() {
+    static Table instance;
+    return instance;
+}
+
+} // namespace
+
+Counters Entry::counters() const {
+    return {frames_in_.load(std::memory_order_relaxed), bytes_in_.load(std::memory_order_relaxed),
+            frames_out_.load(std::memory_order_relaxed), bytes_out_.load(std::memory_order_relaxed),
+            crypto_ns_.load(std::memory_order_relaxed)};
+}
+
+Entry& of(std::string_view peer) {
+    thread_local Map<Entry*> cache;
+    if (auto it = cache.find(peer); it != cache.end()) {
+        return *it->second;
+    }
+    Table& t = table();
+    Entry* entry;
+    {
+        std::lock_guard lock(t.mutex);
+        auto it = t.entries.find(peer);
+        if (it == t.entries.end()) {
+            it = t.entries.emplace(std::string(peer), std::make_unique<Entry>()).first;
+        }
+        entry = it->second.get();
+    }
+    cache.emplace(std::string(peer), entry);
+    return *entry;
+}
+
+std::vector<std::pair<std::string, Counters>> snapshot() {
+    Table& t = table();
+    std::lock_guard lock(t.mutex);
+    std::vector<std::pair<std::string, Counters>> out;
+    out.reserve(t.entries.size());
+    for (const auto& [peer, entry] : t.entries) {
+        out.emplace_back(peer, entry->counters());
+    }
+    return out;
+}
+
+} // namespace peer_usage
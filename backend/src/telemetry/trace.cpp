@@ -0,0 +1,270 @@
+/**
+ * Trace — per-thread span rings and their Chrome trace-event dump.
+ *
+ * A ring has one writer, its thread, and is read by dump() from another.
+ * Each slot is a seqlock: its sequence is odd while the writer fills it and
+ * 2 * (index + 1) once done, so the reader keeps a slot only if it saw the
+ * same even sequence before and after copying it. The fields are relaxed
+ * atomics so that a read racing a write is torn, not undefined.
+ */
+
+#include "telemetry/trace.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+namespace trace {
+
+namespace {
+
+struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<const char*> category{nullptr};
+    std::atomic<const char*> name{nullptr};
+    std::atomic<int64_t> start_ns{0};
+    std::atomic<int64_t> duration_ns{0};
+    std::atomic<Flow> flow{0};
+};
+
+struct Ring {
+    explicit Ring(uint32_t tid) : tid(tid) {}
+
+    const uint32_t tid;
+    bool in_use = true;                         // guarded by Registry::mutex
+    std::atomic<uint64_t> head{0};              // spans ever written
+    std::array<Slot, kRingEvents> slots;
+};
+
+struct Registry {
+    std::mutex mutex;                           // guards rings and strings
+    // A thread's ring outlives it, for the next dump, and goes to the next
+    // new thread, so short-lived threads don't each cost a ring.
+    std::vector<std::shared_ptr<Ring>> rings;
+    std::set<std::string, std::less<>> strings;
+};
+
+Registry& registry() {
+    static Registry r;
+    return r;
+}
+
+const Clock::time_point epoch = Clock::now();
+std::atomic<uint32_t> sample_every{0};
+std::atomic<Flow> next_flow{0};
+
+thread_local Flow current_flow = 0;
+
+/// This thread's ring, taken on its first span and given back on exit.
+struct Owner {
+    Owner() {
+        Registry& r = registry();
+        std::lock_guard lock(r.mutex);
+        for (const auto& free : r.rings) {
+            if (!free->in_use) {
+                free->in_use = true;
+                ring = free;
+                return;
+            }
+        }
+        ring = std::make_shared<Ring>(static_cast<uint32_t>(r.rings.size() + 1));
+        r.rings.push_back(ring);
+    }
+
+    ~Owner() {
+        Registry& r = registry();
+        std::lock_guard lock(r.mutex);
+        ring->in_use = false;
+    }
+
+    std::shared_ptr<Ring> ring;
+};
+
+Ring& ring() {
+    thread_local Owner owner;
+    return *owner.ring;
+}
+
+void record(const char* category, const char* name, Clock::time_point start,
+            Clock::time_point end, Flow flow) {
+    Ring& r = ring();
+    const uint64_t index = r.head.load(std::memory_order_relaxed);
+    Slot& slot = r.slots[index % kRingEvents];
+    slot.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.category.store(category, std::memory_order_relaxed);
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.start_ns.store((start - epoch).count(), std::memory_order_relaxed);
+    slot.duration_ns.store((end - start).count(), std::memory_order_relaxed);
+    slot.flow.store(flow, std::memory_order_relaxed);
+    slot.seq.store(2 * index + 2, std::memory_order_release);
+    r.head.store(index + 1, std::memory_order_release);
+}
+
+struct Event {
+    const char* category;
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    Flow flow;
+    uint32_t tid;
+};
+
+void collect(const Ring& r, std::vector<Event>& out) {
+    const uint64_t head = r.head.load(std::memory_order_acquire);
+    const uint64_t first = head > kRingEvents ? head - kRingEvents : 0;
+    for (uint64_t i = first; i < head; ++i) {
+        const Slot& slot = r.slots[i % kRingEvents];
+        const uint64_t seq = slot.seq.load(std::memory_order_acquire);
+        if (seq != 2 * i + 2) {
+            continue;                           // overwritten since head was read
+        }
+        Event e{slot.category.load(std::memory_order_relaxed),
+                slot.name.load(std::memory_order_relaxed),
+                slot.start_ns.load(std::memory_order_relaxed),
+                slot.duration_ns.load(std::memory_order_relaxed),
+                slot.flow.load(std::memory_order_relaxed), r.tid};
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.seq.load(std::memory_order_relaxed) == seq) {
+            out.push_back(e);
+        }
+    }
+}
+
+double micros(int64_t ns) {
+    return static_cast<double>(ns) / 1000.0;
+}
+
+} // namespace
+
+void set_sample_every(uint32_t every) {
+    sample_every.store(every, std::memory_order_relaxed);
+    detail::enabled.store(every > 0, std::memory_order_relaxed);
+}
+
+void apply(const nlohmann::json& config) {
+    const auto& cfg = config.contains("logging") ? config["logging"] : nlohmann::json::object();
+    set_sample_every(cfg.value("trace_sample_every", uint32_t{0}));
+}
+
+Flow sample() {
+    if (!enabled()) {
+        return 0;
+    }
+    thread_local uint32_t seen = 0;
+    const uint32_t every = sample_every.load(std::memory_order_relaxed);
+    if (every == 0 || ++seen % every != 0) {
+        return 0;
+    }
+    return next_flow.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+Flow current() {
+    return current_flow;
+}
+
+void complete(const char* category, const char* name, Clock::time_point start, Flow flow) {
+    if (!enabled() || start == Clock::time_point{}) {
+        return;
+    }
+    record(category, name, start, Clock::now(), flow);
+}
+
+const char* intern(std::string_view s) {
+    Registry& r = registry();
+    std::lock_guard lock(r.mutex);
+    auto it = r.strings.find(s);
+    if (it == r.strings.end()) {
+        it = r.strings.emplace(s).first;
+    }
+    return it->c_str();
+}
+
+std::string dump() {
+    std::vector<Event> events;
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        Registry& r = registry();
+        std::lock_guard lock(r.mutex);
+        rings = r.rings;
+    }
+    for (const auto& r : rings) {
+        collect(*r, events);
+    }
+    std::sort(events.begin(), events.end(),
+              [](const Event& a, const Event& b) { return a.start_ns < b.start_ns; });
+
+    nlohmann::json out = nlohmann::json::array();
+    std::map<Flow, std::size_t> remaining;      // spans left per flow, for its arrows
+    for (const auto& e : events) {
+        if (e.flow != 0) {
+            ++remaining[e.flow];
+        }
+    }
+    std::set<Flow> started;
+    for (const auto& e : events) {
+        nlohmann::json span = {
+            {"name", e.name}, {"cat", e.category}, {"ph", "X"}, {"pid", 1}, {"tid", e.tid},
+            {"ts", micros(e.start_ns)}, {"dur", micros(e.duration_ns)},
+        };
+        if (e.flow != 0) {
+            span["args"] = {{"flow", e.flow}};
+        }
+        out.push_back(std::move(span));
+        if (e.flow == 0 || remaining[e.flow] == 0) {
+            continue;
+        }
+        // One arrow through the flow's spans in time order: start, steps,
+        // and the end bound to the enclosing slice.
+        const bool first = started.insert(e.flow).second;
+        const bool last = --remaining[e.flow] == 0;
+        if (first && last) {
+            continue;                           // a lone span has nothing to link
+        }
+        nlohmann::json arrow = {
+            {"name", "message"}, {"cat", "flow"}, {"ph", first ? "s" : last ? "f" : "t"},
+            {"id", e.flow}, {"pid", 1}, {"tid", e.tid}, {"ts", micros(e.start_ns)},
+        };
+        if (last) {
+            arrow["bp"] = "e";
+        }
+        out.push_back(std::move(arrow));
+    }
+    return nlohmann::json{{"traceEvents", std::move(out)}, {"displayTimeUnit", "ms"}}.dump();
+}
+
+Span::Span(const char* category, const char* name) noexcept
+    : category_(category), name_(name) {
+    if (enabled()) {
+        on_ = true;
+        flow_ = current_flow;
+        start_ = Clock::now();
+    }
+}
+
+Span::Span(const char* category, const char* name, Flow flow) noexcept
+    : category_(category), name_(name), flow_(flow) {
+    if (flow != 0) {
+        on_ = true;
+        scoped_ = true;
+        outer_ = current_flow;
+        current_flow = flow;
+        start_ = Clock::now();
+    }
+}
+
+Span::~Span() {
+    if (!on_) {
+        return;
+    }
+    record(category_, name_, start_, Clock::now(), flow_);
+    if (scoped_) {
+        current_flow = outer_;
+    }
+}
+
+} // namespace trace
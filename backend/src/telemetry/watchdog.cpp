@@ -0,0 +1,187 @@
+/**
+ * Watchdog — heartbeat lag and stall reports for the io_contexts.
+ */
+
+#include "telemetry/watchdog.h"
+#include "telemetry/metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace watchdog {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+metrics::Histogram& lag_seconds =
+    metrics::histogram("p2p_io_lag_seconds", "Delay before a posted heartbeat ran on an io_context");
+metrics::Histogram& stall_seconds =
+    metrics::histogram("p2p_io_stall_seconds", "Length of event loop stalls over the threshold");
+metrics::Counter& stalls_total =
+    metrics::counter("p2p_io_stalls_total", "Event loop stalls over the threshold");
+
+// One tag slot per thread, handed out on first use and never reused, so the
+// watchdog can read any thread's tag without caring whether it still exists.
+constexpr std::size_t kMaxThreads = 256;
+std::array<std::atomic<const char*>, kMaxThreads> tags{};
+
+/// This thread's tag slot, or -1 once all slots are taken.
+int tag_slot() {
+    static std::atomic<std::size_t> next{0};
+    thread_local const int slot = [] {
+        const std::size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        return i < kMaxThreads ? static_cast<int>(i) : -1;
+    }();
+    return slot;
+}
+
+} // namespace
+
+struct detail::Watched {
+    std::string name;
+    asio::io_context* io;                       // null once unregistered
+    std::atomic<int> thread_slot{-1};           // thread that ran the last heartbeat
+
+    std::mutex mutex;
+    bool pending = false;
+    bool reported = false;
+    Clock::time_point posted_at;
+};
+
+namespace {
+
+struct Watchdog {
+    std::mutex mutex;                           // guards everything below
+    std::vector<std::shared_ptr<detail::Watched>> states;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+};
+
+Watchdog& instance() {
+    static Watchdog dog;
+    return dog;
+}
+
+void beat(detail::Watched& state) {
+    state.thread_slot.store(tag_slot(), std::memory_order_relaxed);
+    std::lock_guard lock(state.mutex);
+    const auto lag = Clock::now() - state.posted_at;
+    lag_seconds.record(lag);
+    if (state.reported) {
+        stall_seconds.record(lag);
+        spdlog::info("{} event loop recovered after {} ms", state.name,
+                     std::chrono::duration_cast<std::chrono::milliseconds>(lag).count());
+    }
+    state.pending = false;
+}
+
+/// Post a heartbeat, or report the one still queued if it is overdue.
+/// Caller holds the watchdog mutex, so `state.io` is alive.
+void check(const std::shared_ptr<detail::Watched>& state, Clock::time_point now,
+           const Options& options) {
+    std::lock_guard lock(state->mutex);
+    if (!state->pending) {
+        state->pending = true;
+        state->reported = false;
+        state->posted_at = now;
+        asio::post(*state->io, [state] { beat(*state); });
+        return;
+    }
+    if (state->reported || now - state->posted_at < options.threshold || state->io->stopped()) {
+        return;
+    }
+    state->reported = true;
+    stalls_total.inc();
+    const int slot = state->thread_slot.load(std::memory_order_relaxed);
+    const char* tag = slot >= 0 ? tags[slot].load(std::memory_order_relaxed) : nullptr;
+    spdlog::warn("{} event loop stalled for {} ms, running: {}", state->name,
+                 std::chrono::duration_cast<std::chrono::milliseconds>(now - state->posted_at).count(),
+                 tag ? tag : "untagged handler");
+}
+
+void run(Options options) {
+    Watchdog& dog = instance();
+    std::unique_lock lock(dog.mutex);
+    while (!dog.wake.wait_for(lock, options.interval, [&] { return dog.stopping; })) {
+        const auto now = Clock::now();
+        for (const auto& state : dog.states) {
+            check(state, now, options);
+        }
+    }
+}
+
+} // namespace
+
+Options options(const nlohmann::json& config) {
+    const auto& node = config.contains("node") ? config["node"] : nlohmann::json::object();
+    Options options;
+    options.interval = std::chrono::milliseconds(node.value("watchdog_interval_ms", 100));
+    options.threshold = std::chrono::milliseconds(node.value("watchdog_threshold_ms", 250));
+    return options;
+}
+
+void start(Options options) {
+    Watchdog& dog = instance();
+    std::lock_guard lock(dog.mutex);
+    if (dog.thread.joinable() || options.interval.count() <= 0) {
+        return;
+    }
+    dog.stopping = false;
+    dog.thread = std::thread(run, options);
+    spdlog::debug("Watchdog checking {} event loops every {} ms", dog.states.size(),
+                  options.interval.count());
+}
+
+void stop() {
+    Watchdog& dog = instance();
+    std::thread thread;
+    {
+        std::lock_guard lock(dog.mutex);
+        dog.stopping = true;
+        thread = std::move(dog.thread);
+    }
+    dog.wake.notify_all();
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+Registration::Registration(std::string name, asio::io_context& io)
+    : state_(std::make_shared<detail::Watched>()) {
+    state_->name = std::move(name);
+    state_->io = &io;
+    Watchdog& dog = instance();
+    std::lock_guard lock(dog.mutex);
+    dog.states.push_back(state_);
+}
+
+Registration::~Registration() {
+    Watchdog& dog = instance();
+    std::lock_guard lock(dog.mutex);
+    std::erase(dog.states, state_);
+    // A heartbeat still queued on the context holds the state, not the context.
+    state_->io = nullptr;
+}
+
+Tag::Tag(const char* what) noexcept : prev_(nullptr) {
+    if (const int slot = tag_slot(); slot >= 0) {
+        prev_ = tags[slot].exchange(what, std::memory_order_relaxed);
+    }
+}
+
+Tag::~Tag() {
+    if (const int slot = tag_slot(); slot >= 0) {
+        tags[slot].store(prev_, std::memory_order_relaxed);
+    }
+}
+
+} // namespace watchdog
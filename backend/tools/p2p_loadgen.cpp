@@ -0,0 +1,607 @@
+/**
+ * p2p-loadgen — drives one node, or a mesh of local nodes, with simulated
+ * peers and reports ack round-trip latency and throughput.
+ *
+ * The simulated peers are real: each has its own key pair, and messages
+ * are built, encrypted, signed and framed exactly as Node::send_message
+ * does, then sent through PeerClient. The node only accepts messages from
+ * friends and acks them to the sender's stored address, so the peers are
+ * first provisioned into each target's database (with the node stopped;
+ * it loads friends at startup):
+ *
+ *     p2p-loadgen provision --peers 200 --keys lg-keys --ack-addr 127.0.0.1:9900 \
+ *                           --db alice/local_chat.db [--db bob/local_chat.db …]
+ *
+ *     p2p-loadgen run --peers 200 --keys lg-keys --ack-port 9900 \
+ *                     --target alice@127.0.0.1:9100=alice/keys.json [--target …] \
+ *                     --rate 5000 --duration 30 --sizes 64:70,1024:25,16384:5 [--json] \
+ *                     [--envelope json|binary] [--metrics 127.0.0.1:8080 …]
+ *
+ * With --metrics, each target's GET /metrics is read before and after the
+ * run, and the report adds what the nodes spent per acked message: CPU
+ * time, and heap allocations if they were built with
+ * P2P_COUNT_ALLOCATIONS (tools/perf_report.py builds on this).
+ *
+ * The load is open-loop: each message has a scheduled send time and its
+ * latency is measured from then, so a node that falls behind shows up as
+ * latency instead of silently slowing the generator down. Peer i sends to
+ * every target in turn.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include <sodium.h>
+#include <spdlog/spdlog.h>
+
+#include "crypto/crypto_manager.h"
+#include "network/envelope.h"
+#include "network/peer_client.h"
+#include "network/peer_server.h"
+#include "storage/message_store.h"
+#include "telemetry/metrics.h"
+
+namespace {
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+struct Target {
+    std::string username;
+    std::string ip;
+    uint16_t port = 0;
+    std::vector<uint8_t> public_key;
+};
+
+struct SizeClass {
+    std::size_t bytes;
+    double weight;
+};
+
+struct Options {
+    std::string command;
+    std::size_t peers = 10;
+    std::string keys_dir = "lg-keys";
+    std::string ack_addr = "127.0.0.1:9900";
+    uint16_t ack_port = 9900;
+    std::vector<std::string> dbs;
+    std::vector<std::string> targets;
+    double rate = 1000;                          // messages per second, all peers together
+    int duration = 10;                           // seconds
+    int drain = 5;                               // seconds to wait for late acks
+    std::vector<SizeClass> sizes{{64, 1}};
+    std::size_t threads = 0;                     // 0 = hardware concurrency
+    WireFormat envelope = WireFormat::Binary;
+    std::vector<std::string> metrics;            // HOST:PORT of each target's REST API
+    bool json_report = false;
+};
+
+[[noreturn]] void usage() {
+    std::fprintf(stderr,
+        "usage: p2p-loadgen provision --peers N --keys DIR --ack-addr IP:PORT --db PATH [--db PATH…]\n"
+        "       p2p-loadgen run --peers N --keys DIR --ack-port PORT\n"
+        "                       --target USER@IP:PORT=KEYS.json [--target …]\n"
+        "                       [--rate MSG/S] [--duration S] [--drain S]\n"
+        "                       [--sizes BYTES:WEIGHT,…] [--threads N] [--json]\n"
+        "                       [--envelope json|binary] [--metrics HOST:PORT …]\n");
+    std::exit(2);
+}
+
+std::vector<SizeClass> parse_sizes(const std::string& spec) {
+    std::vector<SizeClass> sizes;
+    std::size_t pos = 0;
+    while (pos < spec.size()) {
+        const auto comma = std::min(spec.find(',', pos), spec.size());
+        const std::string item = spec.substr(pos, comma - pos);
+        const auto colon = item.find(':');
+        sizes.push_back({std::stoul(item.substr(0, colon)),
+                         colon == std::string::npos ? 1.0 : std::stod(item.substr(colon + 1))});
+        pos = comma + 1;
+    }
+    return sizes;
+}
+
+Options parse_args(int argc, char** argv) {
+    if (argc < 2) usage();
+    Options opts;
+    opts.command = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--json") {
+            opts.json_report = true;
+            continue;
+        }
+        if (i + 1 >= argc) usage();
+        const std::string value = argv[++i];
+        try {
+            if (arg == "--peers") opts.peers = std::stoul(value);
+            else if (arg == "--keys") opts.keys_dir = value;
+            else if (arg == "--ack-addr") opts.ack_addr = value;
+            else if (arg == "--ack-port") opts.ack_port = static_cast<uint16_t>(std::stoi(value));
+            else if (arg == "--db") opts.dbs.push_back(value);
+            else if (arg == "--target") opts.targets.push_back(value);
+            else if (arg == "--rate") opts.rate = std::stod(value);
+            else if (arg == "--duration") opts.duration = std::stoi(value);
+            else if (arg == "--drain") opts.drain = std::stoi(value);
+            else if (arg == "--sizes") opts.sizes = parse_sizes(value);
+            else if (arg == "--threads") opts.threads = std::stoul(value);
+            else if (arg == "--envelope" && (value == "json" || value == "binary"))
+                opts.envelope = value == "json" ? WireFormat::Json : WireFormat::Binary;
+            else if (arg == "--metrics") opts.metrics.push_back(value);
+            else usage();
+        } catch (const std::exception&) {
+            usage();
+        }
+    }
+    return opts;
+}
+
+std::string peer_name(std::size_t i) {
+    return "lg-" + std::to_string(i);
+}
+
+/// Load peer `i`'s keys from the keys directory, creating them on first use.
+std::unique_ptr<CryptoManager> peer_keys(const std::string& dir, std::size_t i) {
+    // A simulated peer only ever talks to the targets.
+    auto crypto = std::make_unique<CryptoManager>(16);
+    const std::string path = (std::filesystem::path(dir) / (peer_name(i) + ".json")).string();
+    if (!crypto->load_keypair(path)) {
+        crypto->generate_keypair();
+        crypto->save_keypair(path);
+    }
+    return crypto;
+}
+
+/// USER@IP:PORT=KEYS.json; only the public key is taken from the key file.
+std::optional<Target> parse_target(const std::string& spec) {
+    const auto at = spec.find('@');
+    const auto colon = spec.find(':', at);
+    const auto eq = spec.find('=', colon);
+    if (at == std::string::npos || colon == std::string::npos || eq == std::string::npos) {
+        return std::nullopt;
+    }
+    Target target;
+    target.username = spec.substr(0, at);
+    target.ip = spec.substr(at + 1, colon - at - 1);
+    target.port = static_cast<uint16_t>(std::stoi(spec.substr(colon + 1, eq - colon - 1)));
+    CryptoManager keys;
+    if (!keys.load_keypair(spec.substr(eq + 1))) {
+        return std::nullopt;
+    }
+    target.public_key = keys.public_key();
+    return target;
+}
+
+// ─── provision ──────────────────────────────────────────────────────────────
+
+int provision(const Options& opts) {
+    if (opts.dbs.empty()) usage();
+    std::filesystem::create_directories(opts.keys_dir);
+    std::vector<std::unique_ptr<CryptoManager>> keys;
+    for (std::size_t i = 0; i < opts.peers; ++i) {
+        keys.push_back(peer_keys(opts.keys_dir, i));
+    }
+    for (const auto& path : opts.dbs) {
+        MessageStore::Options store_opts;
+        store_opts.path = path;
+        MessageStore store(store_opts);
+        if (!store.open()) {
+            spdlog::error("Cannot open {}", path);
+            return 1;
+        }
+        for (std::size_t i = 0; i < opts.peers; ++i) {
+            store.upsert_friend({peer_name(i), keys[i]->public_key(),
+                                 keys[i]->signing_public_key(), opts.ack_addr, "", ""});
+        }
+        store.close();
+        spdlog::info("Added {} simulated peer(s) as friends in {}", opts.peers, path);
+    }
+    return 0;
+}
+
+// ─── run ────────────────────────────────────────────────────────────────────
+
+/// Messages sent and not yet acked, by msg_id, with their scheduled time.
+class Pending {
+public:
+    void add(std::string msg_id, Clock::time_point scheduled) {
+        std::lock_guard lock(mutex_);
+        map_.emplace(std::move(msg_id), scheduled);
+    }
+
+    std::optional<Clock::time_point> take(const std::string& msg_id) {
+        std::lock_guard lock(mutex_);
+        auto it = map_.find(msg_id);
+        if (it == map_.end()) {
+            return std::nullopt;
+        }
+        const auto scheduled = it->second;
+        map_.erase(it);
+        return scheduled;
+    }
+
+    void drop(const std::string& msg_id) {
+        std::lock_guard lock(mutex_);
+        map_.erase(msg_id);
+    }
+
+    std::size_t size() const {
+        std::lock_guard lock(mutex_);
+        return map_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Clock::time_point> map_;
+};
+
+struct Stats {
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> send_failed{0};        // connect lost or send queue full
+    std::atomic<uint64_t> acked{0};
+    std::atomic<uint64_t> bytes{0};              // plaintext bytes of acked messages
+    metrics::Histogram latency;
+};
+
+/// One simulated peer: its keys and a connection to every target.
+struct SimPeer {
+    std::string name;
+    std::unique_ptr<CryptoManager> crypto;
+    std::vector<std::shared_ptr<PeerClient>> clients;   // one per target
+    std::unique_ptr<asio::steady_timer> timer;
+    Clock::time_point next;
+    std::size_t sequence = 0;
+    std::mt19937 rng;
+};
+
+std::string build_frame(SimPeer& peer, const Target& target, const std::string& msg_id,
+                        std::size_t bytes, WireFormat format) {
+    const std::string timestamp = envelope::now_timestamp();
+    std::string text(bytes, 'x');
+    for (std::size_t i = 0; i < text.size(); i += 7) {
+        text[i] = static_cast<char>('a' + peer.rng() % 26);
+    }
+    const json payload = {{"text", std::move(text)}, {"msg_id", msg_id}, {"timestamp", timestamp}};
+    const std::string boxed = peer.crypto->encrypt(payload.dump(), target.public_key);
+    if (boxed.empty()) {
+        return {};
+    }
+
+    Envelope env;
+    env.type = EnvelopeType::Message;
+    env.from = peer.name;
+    env.to = target.username;
+    env.timestamp = timestamp;
+    const auto* p = reinterpret_cast<const uint8_t*>(boxed.data());
+    env.nonce.assign(p, p + crypto_box_NONCEBYTES);
+    env.ciphertext.assign(p + crypto_box_NONCEBYTES, p + boxed.size());
+    const std::string sig = peer.crypto->sign(std::string(boxed, crypto_box_NONCEBYTES));
+    env.signature.assign(sig.begin(), sig.end());
+    return envelope::encode(env, format);
+}
+
+std::size_t pick_size(const std::vector<SizeClass>& sizes, std::mt19937& rng) {
+    double total = 0;
+    for (const auto& s : sizes) total += s.weight;
+    double r = std::uniform_real_distribution<double>(0, total)(rng);
+    for (const auto& s : sizes) {
+        if ((r -= s.weight) <= 0) return s.bytes;
+    }
+    return sizes.back().bytes;
+}
+
+double ms(uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+}
+
+/// What a node has spent so far, from its GET /metrics.
+struct NodeCounters {
+    double cpu_seconds = 0;
+    std::optional<uint64_t> allocations;        // only P2P_COUNT_ALLOCATIONS builds count
+};
+
+/// The value of an unlabelled sample `name` in a Prometheus text body.
+std::optional<double> sample(std::string_view body, std::string_view name) {
+    std::size_t pos = 0;
+    while (pos < body.size()) {
+        const auto end = std::min(body.find('\n', pos), body.size());
+        const std::string_view line = body.substr(pos, end - pos);
+        if (line.starts_with(name) && line.size() > name.size() && line[name.size()] == ' ') {
+            try {
+                return std::stod(std::string(line.substr(name.size() + 1)));
+            } catch (const std::exception&) {
+                return std::nullopt;
+            }
+        }
+        pos = end + 1;
+    }
+    return std::nullopt;
+}
+
+/// Scrape HOST:PORT/metrics; nullopt if the node can't be read.
+std::optional<NodeCounters> scrape(asio::io_context& io, const std::string& addr) {
+    const auto colon = addr.rfind(':');
+    if (colon == std::string::npos) {
+        return std::nullopt;
+    }
+    asio::error_code ec;
+    const auto ip = asio::ip::make_address(addr.substr(0, colon), ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    asio::ip::tcp::socket socket(io);
+    socket.connect({ip, static_cast<uint16_t>(std::stoi(addr.substr(colon + 1)))}, ec);
+    if (ec) {
+        return std::nullopt;
+    }
+    const std::string request = "GET /metrics HTTP/1.1\r\nHost: " + addr +
+                                "\r\nConnection: close\r\n\r\n";
+    asio::write(socket, asio::buffer(request), ec);
+    std::string response;
+    asio::read(socket, asio::dynamic_buffer(response), ec);
+    if (ec != asio::error::eof || !response.starts_with("HTTP/1.1 200")) {
+        return std::nullopt;
+    }
+    const auto cpu = sample(response, "p2p_process_cpu_seconds_total");
+    if (!cpu) {
+        return std::nullopt;
+    }
+    NodeCounters counters;
+    counters.cpu_seconds = *cpu;
+    if (const auto allocations = sample(response, "p2p_heap_allocations_total")) {
+        counters.allocations = static_cast<uint64_t>(*allocations);
+    }
+    return counters;
+}
+
+/// Every target's counters summed; nullopt if any can't be read.
+std::optional<NodeCounters> scrape_all(asio::io_context& io, const std::vector<std::string>& addrs) {
+    NodeCounters sum;
+    sum.allocations = 0;
+    for (const auto& addr : addrs) {
+        const auto counters = scrape(io, addr);
+        if (!counters) {
+            spdlog::error("Cannot read metrics from {}", addr);
+            return std::nullopt;
+        }
+        sum.cpu_seconds += counters->cpu_seconds;
+        if (sum.allocations && counters->allocations) {
+            *sum.allocations += *counters->allocations;
+        } else {
+            sum.allocations.reset();
+        }
+    }
+    return sum;
+}
+
+int run(const Options& opts) {
+    std::vector<Target> targets;
+    for (const auto& spec : opts.targets) {
+        auto target = parse_target(spec);
+        if (!target) {
+            spdlog::error("Bad --target {} (want USER@IP:PORT=KEYS.json)", spec);
+            return 1;
+        }
+        targets.push_back(std::move(*target));
+    }
+    if (targets.empty() || opts.peers == 0 || opts.rate <= 0 || opts.sizes.empty()) usage();
+
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    std::vector<std::jthread> threads;
+    const std::size_t n_threads =
+        opts.threads ? opts.threads : std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < n_threads; ++i) {
+        threads.emplace_back([&io] { io.run(); });
+    }
+
+    Pending pending;
+    Stats stats;
+    // A random run id keeps msg_ids unique across runs against the same
+    // database, whose seen table would otherwise report replays.
+    const std::string run_id = std::to_string(std::random_device{}());
+
+    PeerServer acks(io, opts.ack_port);
+    acks.set_on_message([&](const std::string&, std::string_view frame) {
+        auto env = envelope::decode(frame);
+        if (!env || env->type != EnvelopeType::Ack) {
+            return;                              // e.g. presence pings
+        }
+        if (auto scheduled = pending.take(env->ack_msg_id)) {
+            stats.latency.record(Clock::now() - *scheduled);
+            stats.acked.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    acks.start();
+
+    std::vector<std::unique_ptr<SimPeer>> peers;
+    for (std::size_t i = 0; i < opts.peers; ++i) {
+        auto peer = std::make_unique<SimPeer>();
+        peer->name = peer_name(i);
+        peer->crypto = peer_keys(opts.keys_dir, i);
+        peer->rng.seed(static_cast<uint32_t>(i));
+        for (const auto& target : targets) {
+            auto client = std::make_shared<PeerClient>(io);
+            if (!client->connect(target.ip, target.port)) {
+                spdlog::error("{} cannot connect to {}@{}:{}", peer->name, target.username,
+                              target.ip, target.port);
+                io.stop();
+                return 1;
+            }
+            peer->clients.push_back(std::move(client));
+        }
+        peer->timer = std::make_unique<asio::steady_timer>(io);
+        peers.push_back(std::move(peer));
+    }
+    spdlog::info("{} peer(s) connected to {} target(s); sending {:.0f} msg/s for {} s",
+                 peers.size(), targets.size(), opts.rate, opts.duration);
+
+    std::optional<NodeCounters> node_before;
+    if (!opts.metrics.empty()) {
+        node_before = scrape_all(io, opts.metrics);
+        if (!node_before) {
+            io.stop();
+            return 1;
+        }
+    }
+
+    // Each peer sends every peers/rate seconds, phases spread evenly.
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(peers.size()) / opts.rate));
+    const auto start = Clock::now();
+    const auto stop_at = start + std::chrono::seconds(opts.duration);
+
+    std::function<void(SimPeer&)> tick = [&](SimPeer& peer) {
+        const auto scheduled = peer.next;
+        peer.next += interval;
+        const std::size_t t = peer.sequence % targets.size();
+        const std::string msg_id = run_id + "-" + peer.name + "-" + std::to_string(peer.sequence++);
+        const std::size_t bytes = pick_size(opts.sizes, peer.rng);
+        std::string frame = build_frame(peer, targets[t], msg_id, bytes, opts.envelope);
+
+        pending.add(msg_id, scheduled);
+        if (frame.empty() || !peer.clients[t]->send_async(std::move(frame))) {
+            pending.drop(msg_id);
+            stats.send_failed.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            stats.sent.fetch_add(1, std::memory_order_relaxed);
+            stats.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+
+        if (peer.next < stop_at) {
+            peer.timer->expires_at(peer.next);
+            peer.timer->async_wait([&tick, &peer](const asio::error_code& ec) {
+                if (!ec) tick(peer);
+            });
+        }
+    };
+    for (std::size_t i = 0; i < peers.size(); ++i) {
+        SimPeer& peer = *peers[i];
+        peer.next = start + interval * i / peers.size();
+        peer.timer->expires_at(peer.next);
+        peer.timer->async_wait([&tick, &peer](const asio::error_code& ec) {
+            if (!ec) tick(peer);
+        });
+    }
+
+    uint64_t last_acked = 0;
+    while (Clock::now() < stop_at) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        const uint64_t acked = stats.acked.load();
+        const auto snap = stats.latency.snapshot();
+        if (!opts.json_report) {
+            std::fprintf(stderr, "sent %llu  acked %llu/s  in flight %zu  p99 %.2f ms\n",
+                         static_cast<unsigned long long>(stats.sent.load()),
+                         static_cast<unsigned long long>(acked - last_acked), pending.size(),
+                         ms(snap.quantile(0.99)));
+        }
+        last_acked = acked;
+    }
+    const auto drain_until = Clock::now() + std::chrono::seconds(opts.drain);
+    while (pending.size() > 0 && Clock::now() < drain_until) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    const double elapsed = std::chrono::duration<double>(stop_at - start).count();
+    const auto node_after =
+        node_before ? scrape_all(io, opts.metrics) : std::optional<NodeCounters>();
+
+    acks.stop();
+    for (auto& peer : peers) {
+        peer->timer->cancel();
+        for (auto& client : peer->clients) client->disconnect();
+    }
+    work.reset();
+    io.stop();
+    threads.clear();
+
+    const auto snap = stats.latency.snapshot();
+    uint64_t max_ns = 0;
+    for (std::size_t i = snap.buckets.size(); i-- > 0;) {
+        if (snap.buckets[i]) {
+            max_ns = metrics::Histogram::value_of(i);
+            break;
+        }
+    }
+    json report = {
+        {"envelope", opts.envelope == WireFormat::Json ? "json" : "binary"},
+        {"peers", peers.size()},
+        {"targets", targets.size()},
+        {"target_rate", opts.rate},
+        {"duration_s", elapsed},
+        {"sent", stats.sent.load()},
+        {"send_failed", stats.send_failed.load()},
+        {"acked", stats.acked.load()},
+        {"lost", pending.size()},
+        {"acked_per_s", static_cast<double>(stats.acked.load()) / elapsed},
+        {"mib_per_s", static_cast<double>(stats.bytes.load()) / elapsed / (1024.0 * 1024.0)},
+        {"latency_ms", {{"p50", ms(snap.quantile(0.5))},
+                        {"p90", ms(snap.quantile(0.9))},
+                        {"p99", ms(snap.quantile(0.99))},
+                        {"p999", ms(snap.quantile(0.999))},
+                        {"max", ms(max_ns)},
+                        {"mean", snap.count ? ms(snap.sum_ns / snap.count) : 0.0}}},
+    };
+    if (node_before && node_after && stats.acked.load() > 0) {
+        const auto acked = static_cast<double>(stats.acked.load());
+        json& node = report["node"];
+        node["cpu_us_per_msg"] = (node_after->cpu_seconds - node_before->cpu_seconds) * 1e6 / acked;
+        node["allocs_per_msg"] = nullptr;
+        if (node_before->allocations && node_after->allocations) {
+            node["allocs_per_msg"] =
+                static_cast<double>(*node_after->allocations - *node_before->allocations) / acked;
+        }
+    }
+    if (opts.json_report) {
+        std::printf("%s\n", report.dump(2).c_str());
+    } else {
+        const auto& l = report["latency_ms"];
+        std::printf("sent %llu, failed %llu, acked %llu, lost %zu\n"
+                    "throughput %.0f msg/s (target %.0f), %.2f MiB/s\n"
+                    "ack latency ms: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+                    static_cast<unsigned long long>(stats.sent.load()),
+                    static_cast<unsigned long long>(stats.send_failed.load()),
+                    static_cast<unsigned long long>(stats.acked.load()), pending.size(),
+                    report["acked_per_s"].get<double>(), opts.rate,
+                    report["mib_per_s"].get<double>(), l["p50"].get<double>(),
+                    l["p90"].get<double>(), l["p99"].get<double>(), l["p999"].get<double>(),
+                    l["max"].get<double>());
+        if (report.contains("node")) {
+            const auto& node = report["node"];
+            std::printf("node cost per message: %.1f us CPU", node["cpu_us_per_msg"].get<double>());
+            if (!node["allocs_per_msg"].is_null()) {
+                std::printf(", %.1f allocations", node["allocs_per_msg"].get<double>());
+            }
+            std::printf("\n");
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const Options opts = parse_args(argc, argv);
+    if (!CryptoManager::init()) {
+        spdlog::error("libsodium failed to initialise");
+        return 1;
+    }
+    if (opts.command == "provision") return provision(opts);
+    if (opts.command == "run") return run(opts);
+    usage();
+}
@@ -0,0 +1,377 @@
+/**
+ * p2p-replay — feeds a wire capture (telemetry/capture.h) back into a node
+ * through its real listener, to reproduce a performance problem from a
+ * customer's trace without their plaintext.
+ *
+ *     p2p-replay --capture node.cap --target 127.0.0.1:9100 \
+ *                [--supabase-port 54321] [--speed 1] [--linger 5] [--json]
+ *
+ * Start it first, then the node: it answers Supabase at once and waits up
+ * to 30 s for the node's peer port. The node must run with the identity
+ * the capture was taken under (test fleets: the same `node.key_seed`), with
+ * `supabase.url` at http://127.0.0.1:<supabase-port>, and with
+ * `node.replay_window` and `node.max_clock_skew` wide enough to cover the
+ * capture's age: envelopes go back as captured, signed timestamps and all.
+ * Frames sealed under a peer session only open if the capture was taken
+ * with `node.peer_sessions` off; otherwise they are still read, framed and
+ * dispatched, and rejected where the session key is missing.
+ *
+ * Frames the node read (FrameIn) are written to its peer port, one
+ * connection per captured remote address so they interleave as they did.
+ * Each Supabase request gets the captured responses to the same "METHOD
+ * endpoint" in order, then the last one again; failing that, those to the
+ * same path with any query; failing that, 404. Frames the node sent
+ * (FrameOut) are only counted, to compare with what it sends now.
+ *
+ * --speed scales the captured timing: 2 replays twice as fast, 0 as fast
+ * as the node takes it. A node too slow to keep up shows as the sender
+ * falling behind schedule, and as its send queues filling.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <asio.hpp>
+#include <nlohmann/json.hpp>
+#include <spdlog/spdlog.h>
+
+#include "api/http_parser.h"
+#include "network/peer_client.h"
+#include "telemetry/capture.h"
+
+namespace {
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+using asio::ip::tcp;
+
+constexpr std::size_t kMaxBody = 64 << 20;       // offline pushes can be large
+constexpr std::chrono::seconds kConnectWait{30};
+
+struct Options {
+    std::string capture;
+    std::string ip = "127.0.0.1";
+    uint16_t port = 0;
+    uint16_t supabase_port = 0;                  // 0: no stand-in
+    double speed = 1;                            // 0: as fast as possible
+    int linger = 5;                              // seconds Supabase stays up after the last frame
+    bool json_report = false;
+};
+
+[[noreturn]] void usage() {
+    std::fprintf(stderr,
+        "usage: p2p-replay --capture FILE --target IP:PORT [--supabase-port PORT]\n"
+        "                  [--speed X] [--linger S] [--json]\n");
+    std::exit(2);
+}
+
+Options parse_args(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        if (arg == "--json") {
+            opts.json_report = true;
+            continue;
+        }
+        if (i + 1 >= argc) usage();
+        const std::string value = argv[++i];
+        try {
+            if (arg == "--capture") opts.capture = value;
+            else if (arg == "--target") {
+                const auto colon = value.rfind(':');
+                if (colon == std::string::npos) usage();
+                opts.ip = value.substr(0, colon);
+                opts.port = static_cast<uint16_t>(std::stoi(value.substr(colon + 1)));
+            }
+            else if (arg == "--supabase-port") opts.supabase_port = static_cast<uint16_t>(std::stoi(value));
+            else if (arg == "--speed") opts.speed = std::stod(value);
+            else if (arg == "--linger") opts.linger = std::stoi(value);
+            else usage();
+        } catch (const std::exception&) {
+            usage();
+        }
+    }
+    if (opts.capture.empty() || opts.port == 0 || opts.speed < 0) usage();
+    return opts;
+}
+
+struct Stats {
+    std::atomic<uint64_t> http{0};
+    std::atomic<uint64_t> http_unmatched{0};     // answered 404
+};
+
+// ─── Supabase stand-in ──────────────────────────────────────────────────────
+
+/// Captured Supabase responses, handed out in order per request.
+class Responses {
+public:
+    struct Response {
+        long status;
+        std::string body;
+    };
+
+    void add(const capture::Record& r) {
+        const auto space = r.label.find(' ');
+        const std::string method = r.label.substr(0, space);
+        const std::string endpoint = r.label.substr(space + 1);
+        // A transport failure is answered as the closest thing over HTTP.
+        Response response{r.status ? r.status : 503, r.payload};
+        exact_[r.label].responses.push_back(response);
+        by_path_[method + ' ' + endpoint.substr(0, endpoint.find('?'))].responses.push_back(
+            std::move(response));
+    }
+
+    std::optional<Response> next(const std::string& method, const std::string& path,
+                                 const std::string& query) {
+        std::lock_guard lock(mutex_);
+        if (auto r = take(exact_, method + ' ' + path + (query.empty() ? "" : "?" + query))) {
+            return r;
+        }
+        return take(by_path_, method + ' ' + path);
+    }
+
+private:
+    struct Queue {
+        std::vector<Response> responses;
+        std::size_t next = 0;
+    };
+    using Map = std::unordered_map<std::string, Queue>;
+
+    static std::optional<Response> take(Map& map, const std::string& key) {
+        auto it = map.find(key);
+        if (it == map.end()) {
+            return std::nullopt;
+        }
+        auto& q = it->second;
+        return q.responses[std::min(q.next++, q.responses.size() - 1)];
+    }
+
+    std::mutex mutex_;
+    Map exact_;
+    Map by_path_;
+};
+
+asio::awaitable<void> serve(tcp::socket socket, Responses& responses, Stats& stats) {
+    HttpRequestReader reader(kMaxBody);
+    HttpRequest request;
+    for (;;) {
+        asio::error_code ec;
+        auto span = reader.prepare();
+        const std::size_t n = co_await socket.async_read_some(
+            asio::buffer(span.data(), span.size()), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            co_return;
+        }
+        reader.commit(n);
+        for (;;) {
+            const auto status = reader.next(request);
+            if (reader.take_continue()) {
+                static constexpr std::string_view kContinue = "HTTP/1.1 100 Continue\r\n\r\n";
+                co_await asio::async_write(socket, asio::buffer(kContinue),
+                                           asio::redirect_error(asio::use_awaitable, ec));
+            }
+            if (status == HttpRequestReader::Status::NeedMore) {
+                break;
+            }
+            if (status != HttpRequestReader::Status::Request || ec) {
+                co_return;
+            }
+            stats.http.fetch_add(1, std::memory_order_relaxed);
+            auto response = responses.next(request.method, request.path, request.query);
+            if (!response) {
+                stats.http_unmatched.fetch_add(1, std::memory_order_relaxed);
+                spdlog::debug("No captured response for {} {}", request.method, request.path);
+                response = Responses::Response{404, "{}"};
+            }
+            std::string out = fmt::format(
+                "HTTP/1.1 {} {}\r\nContent-Type: application/json\r\nContent-Length: {}\r\n\r\n",
+                response->status, response->status < 400 ? "OK" : "Error", response->body.size());
+            out += response->body;
+            co_await asio::async_write(socket, asio::buffer(out),
+                                       asio::redirect_error(asio::use_awaitable, ec));
+            if (ec || !request.keep_alive) {
+                co_return;
+            }
+        }
+    }
+}
+
+asio::awaitable<void> accept_loop(tcp::acceptor& acceptor, Responses& responses, Stats& stats) {
+    for (;;) {
+        asio::error_code ec;
+        tcp::socket socket = co_await acceptor.async_accept(
+            asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) {
+            if (!acceptor.is_open()) co_return;
+            continue;
+        }
+        asio::co_spawn(acceptor.get_executor(), serve(std::move(socket), responses, stats),
+                       asio::detached);
+    }
+}
+
+// ─── replay ─────────────────────────────────────────────────────────────────
+
+/// Connect to the node, retrying until it is up or kConnectWait passes.
+std::shared_ptr<PeerClient> connect(asio::io_context& io, const Options& opts,
+                                    Clock::time_point give_up) {
+    for (;;) {
+        auto client = std::make_shared<PeerClient>(io);
+        if (client->connect(opts.ip, opts.port, std::chrono::milliseconds(1000))) {
+            return client;
+        }
+        if (Clock::now() >= give_up) {
+            return nullptr;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+double ms(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+int run(const Options& opts) {
+    capture::Reader reader(opts.capture);
+    if (!reader.ok()) {
+        spdlog::error("{} is not a wire capture", opts.capture);
+        return 1;
+    }
+    std::vector<capture::Record> frames;
+    Responses responses;
+    uint64_t captured_out = 0, captured_http = 0;
+    capture::Record record;
+    while (reader.next(record)) {
+        switch (record.kind) {
+        case capture::Kind::FrameIn:
+            frames.push_back(std::move(record));
+            record = {};
+            break;
+        case capture::Kind::FrameOut:
+            ++captured_out;
+            break;
+        case capture::Kind::Http:
+            responses.add(record);
+            ++captured_http;
+            break;
+        }
+    }
+    spdlog::info("Capture holds {} frame(s) in, {} out and {} Supabase exchange(s)",
+                 frames.size(), captured_out, captured_http);
+
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    std::vector<std::jthread> threads;
+    for (int i = 0; i < 2; ++i) {
+        threads.emplace_back([&io] { io.run(); });
+    }
+    Stats stats;
+    std::optional<tcp::acceptor> supabase;
+    if (opts.supabase_port) {
+        supabase.emplace(io, tcp::endpoint(asio::ip::make_address("127.0.0.1"), opts.supabase_port));
+        asio::co_spawn(io, accept_loop(*supabase, responses, stats), asio::detached);
+    }
+
+    // One connection per remote the node heard from; the first waits for it.
+    std::unordered_map<std::string, std::shared_ptr<PeerClient>> clients;
+    if (!frames.empty()) {
+        auto first = connect(io, opts, Clock::now() + kConnectWait);
+        if (!first) {
+            spdlog::error("Cannot connect to {}:{}", opts.ip, opts.port);
+            io.stop();
+            return 1;
+        }
+        clients.emplace(frames.front().label, std::move(first));
+    }
+
+    uint64_t sent = 0, failed = 0, bytes = 0;
+    Clock::duration behind{};
+    const auto start = Clock::now();
+    for (auto& frame : frames) {
+        if (opts.speed > 0) {
+            const auto due = start + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::micro>(frame.at.count() / opts.speed));
+            std::this_thread::sleep_until(due);
+            behind = std::max(behind, Clock::now() - due);
+        }
+        auto& client = clients[frame.label];
+        if (!client && !(client = connect(io, opts, Clock::now()))) {
+            ++failed;
+            continue;
+        }
+        const std::size_t n = frame.payload.size();
+        // A full queue means the node is behind: wait for room, as a real
+        // peer's writes would.
+        if (client->send_async(frame.payload) || client->send(frame.payload)) {
+            ++sent;
+            bytes += n;
+        } else {
+            ++failed;
+        }
+    }
+    const auto drain_until = Clock::now() + kConnectWait;
+    while (Clock::now() < drain_until &&
+           std::any_of(clients.begin(), clients.end(),
+                       [](const auto& c) { return c.second && c.second->queued_bytes() > 0; })) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    const auto elapsed = Clock::now() - start;
+    std::this_thread::sleep_for(std::chrono::seconds(opts.linger));
+
+    for (auto& [remote, client] : clients) {
+        if (client) client->disconnect();
+    }
+    if (supabase) {
+        asio::post(io, [&supabase] { supabase->close(); });
+    }
+    work.reset();
+    io.stop();
+    threads.clear();
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const json report = {
+        {"frames_sent", sent},
+        {"frames_failed", failed},
+        {"bytes_sent", bytes},
+        {"connections", clients.size()},
+        {"captured_frames_out", captured_out},
+        {"http_answered", stats.http.load()},
+        {"http_unmatched", stats.http_unmatched.load()},
+        {"speed", opts.speed},
+        {"duration_s", seconds},
+        {"captured_duration_s",
+         frames.empty() ? 0.0 : std::chrono::duration<double>(frames.back().at).count()},
+        {"frames_per_s", seconds > 0 ? static_cast<double>(sent) / seconds : 0.0},
+        {"max_behind_ms", ms(behind)},
+    };
+    if (opts.json_report) {
+        std::printf("%s\n", report.dump(2).c_str());
+    } else {
+        std::printf("sent %llu frame(s) (%llu failed) over %zu connection(s) in %.2f s, "
+                    "%.0f frames/s\n"
+                    "fell behind schedule by at most %.2f ms\n"
+                    "answered %llu Supabase request(s), %llu without a captured response\n",
+                    static_cast<unsigned long long>(sent), static_cast<unsigned long long>(failed),
+                    clients.size(), seconds, report["frames_per_s"].get<double>(), ms(behind),
+                    static_cast<unsigned long long>(stats.http.load()),
+                    static_cast<unsigned long long>(stats.http_unmatched.load()));
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    return run(parse_args(argc, argv));
+}
@@ -0,0 +1,300 @@
+#!/usr/bin/env python3
+"""
+perf_report — the performance regression gate behind `cmake --build . --target perf-report`.
+
+Runs, from a build directory with the benchmarks and p2p-loadgen built
+(the `perf` preset):
+
+  1. secure-p2p-chat-bench, three repetitions, keeping each benchmark's
+     median CPU time per iteration;
+  2. a fixed p2p-loadgen scenario matrix against a node started fresh for
+     each node thread count: payload size x simulated peers x node I/O
+     threads x JSON or binary envelope. Each scenario reports acked
+     messages per second, p99 ack latency, and the node's CPU time and
+     heap allocations per message (the latter only when the node was
+     built with P2P_COUNT_ALLOCATIONS), read from its GET /metrics.
+
+The report goes to --out. With a baseline (a report from an earlier
+build, stored with --update-baseline) every metric is compared with it
+and the comparison goes to --diff:
+
+    {"baseline": "...", "regressions": 1, "host_mismatch": false,
+     "metrics": [{"scenario": "t4/p200/s1024/binary", "metric": "p99_ms",
+                  "baseline": 2.1, "current": 3.4, "change_pct": 61.9,
+                  "tolerance_pct": 25, "status": "regressed"}, ...]}
+
+Status is "ok", "improved", "regressed", "new" (not in the baseline) or
+"missing" (not in this run). The exit code is 1 if anything regressed,
+so CI fails the build. Tolerances are per metric (TOLERANCE_PCT below);
+a baseline may override them with a "tolerance_pct" object. Numbers only
+compare on the same machine: a baseline from another host is flagged.
+"""
+
+import argparse
+import json
+import os
+import platform
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+import urllib.request
+from datetime import datetime, timezone
+from pathlib import Path
+from typing import Optional
+
+SIZES = [64, 1024, 16384]
+PEERS = [10, 200]
+THREADS = [1, 4]
+ENVELOPES = ["json", "binary"]
+
+RATE = 2000             # messages per second, open loop
+DURATION = 10           # seconds per scenario
+DRAIN = 5               # seconds to wait for late acks
+
+# How far a metric may move the wrong way before it counts as a regression.
+# Latency is the noisiest; allocation counts barely move on their own.
+TOLERANCE_PCT = {
+    "msgs_per_s": 5,
+    "p99_ms": 25,
+    "cpu_us_per_msg": 10,
+    "allocs_per_msg": 2,
+    "lost": 0,
+    "cpu_ns": 10,
+}
+HIGHER_IS_BETTER = {"msgs_per_s"}
+
+BACKEND = "secure-p2p-chat-backend"
+BENCH = "secure-p2p-chat-bench"
+LOADGEN = "p2p-loadgen"
+
+
+def free_port() -> int:
+    """A loopback port nothing listens on right now."""
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def run_bench(build: Path) -> dict:
+    """Median CPU nanoseconds per iteration of every benchmark."""
+    with tempfile.TemporaryDirectory() as tmp:
+        out = Path(tmp) / "bench.json"
+        subprocess.run([str(build / BENCH), "--benchmark_repetitions=3",
+                        "--benchmark_report_aggregates_only=true",
+                        f"--benchmark_out={out}", "--benchmark_out_format=json"],
+                       check=True, stdout=subprocess.DEVNULL)
+        results = json.loads(out.read_text())
+    scale = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+    bench = {}
+    for b in results["benchmarks"]:
+        if b.get("aggregate_name") == "median":
+            bench[b["run_name"]] = {"cpu_ns": b["cpu_time"] * scale[b["time_unit"]]}
+    return bench
+
+
+class Node:
+    """One backend in a scratch directory, provisioned with the loadgen peers."""
+
+    def __init__(self, build: Path, workdir: Path, threads: int, peers: int, ack_port: int):
+        self.build = build
+        self.dir = workdir
+        self.listen_port = free_port()
+        self.api_port = free_port()
+        self.proc: Optional[subprocess.Popen] = None
+        config = {
+            "node": {
+                "username": "perf",
+                "listen_port": self.listen_port,
+                "api_port": self.api_port,
+                "ws_port": 0,
+                "io_threads": threads,
+                "key_store": "",
+                # All load comes from one address; the per-IP limits would
+                # measure themselves.
+                "max_peer_connections": 100000,
+                "max_connections_per_ip": 100000,
+                "ip_frames_per_sec": 10000000,
+                "ip_frame_burst": 10000000,
+                "peer_frames_per_sec": 10000000,
+                "peer_frame_burst": 10000000,
+            },
+            "supabase": {"url": ""},
+            "database": {"local_db_path": "local_chat.db"},
+            "logging": {"level": "warn", "file": "node.log"},
+        }
+        (self.dir / "config.json").write_text(json.dumps(config, indent=4))
+        # The first start writes the key pair; friends are added while stopped.
+        self.start()
+        self.stop()
+        subprocess.run([str(build / LOADGEN), "provision", "--peers", str(peers),
+                        "--keys", str(self.dir.parent / "lg-keys"),
+                        "--ack-addr", f"127.0.0.1:{ack_port}",
+                        "--db", str(self.dir / "local_chat.db")],
+                       check=True, stdout=subprocess.DEVNULL)
+
+    def start(self):
+        self.proc = subprocess.Popen([str(self.build / BACKEND), "config.json"], cwd=self.dir,
+                                     stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        deadline = time.monotonic() + 30
+        while time.monotonic() < deadline:
+            if self.proc.poll() is not None:
+                raise RuntimeError(f"node exited with {self.proc.returncode}; see {self.dir}/node.log")
+            try:
+                with urllib.request.urlopen(f"http://127.0.0.1:{self.api_port}/status", timeout=1):
+                    return
+            except OSError:
+                time.sleep(0.2)
+        raise RuntimeError("node did not answer GET /status within 30 s")
+
+    def stop(self):
+        if self.proc and self.proc.poll() is None:
+            self.proc.send_signal(signal.SIGINT)
+            try:
+                self.proc.wait(timeout=30)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+        self.proc = None
+
+    @property
+    def target(self) -> str:
+        return f"perf@127.0.0.1:{self.listen_port}={self.dir / 'keys.json'}"
+
+
+def run_scenarios(build: Path, rate: float, duration: int) -> dict:
+    scenarios = {}
+    with tempfile.TemporaryDirectory(prefix="perf-report-") as tmp:
+        for threads in THREADS:
+            ack_port = free_port()
+            workdir = Path(tmp) / f"node-t{threads}"
+            workdir.mkdir()
+            node = Node(build, workdir, threads, max(PEERS), ack_port)
+            node.start()
+            try:
+                for peers in PEERS:
+                    for size in SIZES:
+                        for envelope in ENVELOPES:
+                            name = f"t{threads}/p{peers}/s{size}/{envelope}"
+                            print(f"perf-report: {name}", file=sys.stderr, flush=True)
+                            result = subprocess.run(
+                                [str(build / LOADGEN), "run", "--peers", str(peers),
+                                 "--keys", str(Path(tmp) / "lg-keys"),
+                                 "--ack-port", str(ack_port), "--target", node.target,
+                                 "--rate", str(rate), "--duration", str(duration),
+                                 "--drain", str(DRAIN), "--sizes", f"{size}:1",
+                                 "--envelope", envelope,
+                                 "--metrics", f"127.0.0.1:{node.api_port}", "--json"],
+                                check=True, capture_output=True, text=True)
+                            run = json.loads(result.stdout)
+                            node_cost = run.get("node", {})
+                            scenarios[name] = {
+                                "msgs_per_s": run["acked_per_s"],
+                                "p99_ms": run["latency_ms"]["p99"],
+                                "cpu_us_per_msg": node_cost.get("cpu_us_per_msg"),
+                                "allocs_per_msg": node_cost.get("allocs_per_msg"),
+                                "lost": run["lost"],
+                            }
+            finally:
+                node.stop()
+    return scenarios
+
+
+def compare(report: dict, baseline: dict, baseline_path: str) -> dict:
+    tolerance = {**TOLERANCE_PCT, **baseline.get("tolerance_pct", {})}
+    rows = []
+
+    def diff(group: str, name: str, current: dict, base: dict):
+        for metric in sorted(set(current) | set(base)):
+            now, then = current.get(metric), base.get(metric)
+            row = {"scenario": name if group == "scenarios" else f"bench/{name}",
+                   "metric": metric, "baseline": then, "current": now}
+            if then is None or now is None:
+                # Not measured on one side: allocations without counting, say.
+                row["status"] = "new" if then is None else "missing"
+                rows.append(row)
+                continue
+            better_up = metric in HIGHER_IS_BETTER
+            allowed = tolerance.get(metric, 10)
+            if then == 0:
+                change = 0.0 if now == 0 else float("inf")
+            else:
+                change = (now - then) / then * 100
+            worse = -change if better_up else change
+            row["change_pct"] = round(change, 2) if change != float("inf") else None
+            row["tolerance_pct"] = allowed
+            if worse > allowed:
+                row["status"] = "regressed"
+            elif worse < -allowed:
+                row["status"] = "improved"
+            else:
+                row["status"] = "ok"
+            rows.append(row)
+
+    for group in ("bench", "scenarios"):
+        current, base = report.get(group, {}), baseline.get(group, {})
+        for name in sorted(set(current) | set(base)):
+            diff(group, name, current.get(name, {}), base.get(name, {}))
+    return {
+        "baseline": baseline_path,
+        "host_mismatch": report.get("host") != baseline.get("host"),
+        "regressions": sum(1 for r in rows if r["status"] == "regressed"),
+        "metrics": rows,
+    }
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0].strip())
+    parser.add_argument("--build-dir", required=True, type=Path)
+    parser.add_argument("--baseline", required=True, type=Path)
+    parser.add_argument("--out", required=True, type=Path)
+    parser.add_argument("--diff", required=True, type=Path)
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="store this run as the baseline instead of comparing")
+    parser.add_argument("--rate", type=float, default=RATE)
+    parser.add_argument("--duration", type=int, default=DURATION)
+    args = parser.parse_args()
+
+    report = {
+        "version": 1,
+        "generated": datetime.now(timezone.utc).strftime("%Y-%m-%dT%H:%M:%SZ"),
+        "host": {"system": platform.system(), "machine": platform.machine(),
+                 "cpus": os.cpu_count()},
+        "settings": {"rate": args.rate, "duration_s": args.duration, "sizes": SIZES,
+                     "peers": PEERS, "threads": THREADS, "envelopes": ENVELOPES},
+    }
+    try:
+        report["bench"] = run_bench(args.build_dir)
+        report["scenarios"] = run_scenarios(args.build_dir, args.rate, args.duration)
+    except (subprocess.CalledProcessError, RuntimeError, OSError) as e:
+        print(f"perf-report: {e}", file=sys.stderr)
+        return 2
+    args.out.write_text(json.dumps(report, indent=2) + "\n")
+
+    if args.update_baseline:
+        args.baseline.parent.mkdir(parents=True, exist_ok=True)
+        args.baseline.write_text(json.dumps(report, indent=2) + "\n")
+        print(f"perf-report: baseline stored in {args.baseline}")
+        return 0
+    if not args.baseline.exists():
+        print(f"perf-report: no baseline at {args.baseline}; run the perf-baseline target "
+              "on a known-good build to store one")
+        return 0
+
+    result = compare(report, json.loads(args.baseline.read_text()), str(args.baseline))
+    args.diff.write_text(json.dumps(result, indent=2) + "\n")
+    if result["host_mismatch"]:
+        print("perf-report: the baseline comes from another host; numbers may not compare")
+    for row in result["metrics"]:
+        if row["status"] == "regressed":
+            print(f"REGRESSED {row['scenario']} {row['metric']}: "
+                  f"{row['baseline']} -> {row['current']} ({row['change_pct']}%, "
+                  f"tolerance {row['tolerance_pct']}%)")
+    print(f"perf-report: {result['regressions']} regression(s); details in {args.diff}")
+    return 1 if result["regressions"] else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Two-stage PGO build of the backend (CMakePresets.json: pgo-generate, pgo-use).
+#
+#   1. Build an instrumented Release in build/pgo.
+#   2. Train it: the benchmark suite, plus $P2P_PGO_TRAIN if set, e.g. a
+#      script that starts build/pgo/secure-p2p-chat-backend, drives it with
+#      build/pgo/p2p-loadgen and stops it with SIGINT (profiles are written
+#      on a clean exit).
+#   3. Rebuild the same directory with the profile.
+#
+# Run from backend/. The result is build/pgo/secure-p2p-chat-backend.
+set -eu
+
+BUILD=build/pgo
+PROFILES=$BUILD/pgo
+
+cmake --preset pgo-generate
+cmake --build --preset pgo-generate
+rm -rf "$PROFILES"
+
+"$BUILD/secure-p2p-chat-bench" --benchmark_min_time=0.2s
+if [ -n "${P2P_PGO_TRAIN:-}" ]; then
+    sh -c "$P2P_PGO_TRAIN"
+fi
+
+# Clang writes raw profiles that need merging; GCC's .gcda files are used as is.
+if ls "$PROFILES"/*.profraw >/dev/null 2>&1; then
+    "${LLVM_PROFDATA:-llvm-profdata}" merge -output="$PROFILES/merged.profdata" "$PROFILES"/*.profraw
+fi
+
+cmake --preset pgo-use
+cmake --build --preset pgo-use
@@ -11,9 +11,14 @@ export default function App() {
   useWebSocket();
 
   const setBackendConnected = useUIStore((s) => s.setBackendConnected);
+  const wsConnected = useUIStore((s) => s.wsConnected);
 
-  // Poll backend health
+  // Poll backend health; an open event socket already proves it is up.
   useEffect(() => {
+    if (wsConnected) {
+      setBackendConnected(true);
+      return;
+    }
     const check = async () => {
       try {
         await api.getStatus();
@@ -25,7 +30,7 @@ export default function App() {
     check();
     const interval = setInterval(check, POLL_INTERVAL_MS * 3);
     return () => clearInterval(interval);
-  }, [setBackendConnected]);
+  }, [setBackendConnected, wsConnected]);
 
   return <AppShell />;
 }
@@ -3,6 +3,7 @@ import { ContactItem } from "./ContactItem";
 import { useContacts } from "@/hooks/useContacts";
 import { useChatStore } from "@/stores/chatStore";
 import { useContactStore } from "@/stores/contactStore";
+import { websocket } from "@/services/websocket";
 import { listItem } from "@/lib/animations";
 import { Users } from "lucide-react";
 
@@ -15,6 +16,11 @@ export function ContactList() {
   const handleSelect = (username: string) => {
     setActiveChat(username);
     clearUnread(username);
+    // The backend keeps the unread count; tell it, or the next poll brings it back.
+    const lastId = contacts.find((c) => c.username === username)?.lastMessageId;
+    if (lastId) {
+      websocket.send({ event: "mark_read", data: { peer: username, msg_id: lastId } });
+    }
   };
 
   if (loading && contacts.length === 0) {
@@ -1,5 +1,6 @@
 import { useEffect } from "react";
 import { useContactStore } from "@/stores/contactStore";
+import { useUIStore } from "@/stores/uiStore";
 import { POLL_INTERVAL_MS } from "@/lib/constants";
 
 export function useContacts() {
@@ -9,12 +10,17 @@ export function useContacts() {
   const searchQuery = useContactStore((s) => s.searchQuery);
   const fetchContacts = useContactStore((s) => s.fetchContacts);
   const setSearchQuery = useContactStore((s) => s.setSearchQuery);
+  const wsConnected = useUIStore((s) => s.wsConnected);
 
+  // Fetch on mount and whenever the event socket (re)connects; while it is
+  // up, friend_online / friend_offline keep the list current, so polling is
+  // only the fallback.
   useEffect(() => {
     fetchContacts();
+    if (wsConnected) return;
     const interval = setInterval(fetchContacts, POLL_INTERVAL_MS * 5);
     return () => clearInterval(interval);
-  }, [fetchContacts]);
+  }, [fetchContacts, wsConnected]);
 
   const filtered = searchQuery
     ? contacts.filter((c) =>
@@ -8,10 +8,12 @@ import type { WSEvent } from "@/types/events";
 export function useWebSocket() {
   const addMessage = useChatStore((s) => s.addMessage);
   const setTyping = useChatStore((s) => s.setTyping);
+  const fetchMessages = useChatStore((s) => s.fetchMessages);
   const setOnline = useContactStore((s) => s.setOnline);
   const setOffline = useContactStore((s) => s.setOffline);
   const updateLastMessage = useContactStore((s) => s.updateLastMessage);
   const incrementUnread = useContactStore((s) => s.incrementUnread);
+  const fetchContacts = useContactStore((s) => s.fetchContacts);
   const activeChat = useChatStore((s) => s.activeChat);
   const setWsConnected = useUIStore((s) => s.setWsConnected);
   const activeChatRef = useRef(activeChat);
@@ -25,10 +27,16 @@ export function useWebSocket() {
           updateLastMessage(
             event.data.from,
             event.data.text,
-            event.data.timestamp
+            event.data.timestamp,
+            event.data.msg_id
           );
           if (activeChatRef.current !== event.data.from) {
             incrementUnread(event.data.from);
+          } else {
+            websocket.send({
+              event: "mark_read",
+              data: { peer: event.data.from, msg_id: event.data.msg_id },
+            });
           }
           break;
         case "friend_online":
@@ -40,6 +48,17 @@ export function useWebSocket() {
         case "typing":
           setTyping(event.data.username, event.data.typing);
           break;
+        case "backlog_loaded": {
+          // A drain of the offline queue is announced once, not per
+          // message: the list brings previews and unread counts, and an
+          // open conversation it touched is read again.
+          fetchContacts();
+          const open = activeChatRef.current;
+          if (open && event.data.peers[open]) {
+            fetchMessages(open);
+          }
+          break;
+        }
       }
     };
 
@@ -55,5 +74,15 @@ export function useWebSocket() {
       clearInterval(interval);
       websocket.disconnect();
     };
-  }, [addMessage, setTyping, setOnline, setOffline, updateLastMessage, incrementUnread, setWsConnected]);
+  }, [
+    addMessage,
+    setTyping,
+    fetchMessages,
+    setOnline,
+    setOffline,
+    updateLastMessage,
+    incrementUnread,
+    fetchContacts,
+    setWsConnected,
+  ]);
 }
@@ -15,7 +15,12 @@ interface ContactState {
   setOnline: (username: string) => void;
   setOffline: (username: string) => void;
   setSearchQuery: (query: string) => void;
-  updateLastMessage: (username: string, text: string, time: string) => void;
+  updateLastMessage: (
+    username: string,
+    text: string,
+    time: string,
+    msgId?: string
+  ) => void;
   incrementUnread: (username: string) => void;
   clearUnread: (username: string) => void;
 }
@@ -33,11 +38,13 @@ export const useContactStore = create<ContactState>((set, get) => ({
       const existing = get().contacts;
       const contacts: ContactWithPreview[] = friends.map((f) => {
         const prev = existing.find((c) => c.username === f.username);
+        const last = f.last_message;
         return {
           ...f,
-          lastMessage: prev?.lastMessage,
-          lastMessageTime: prev?.lastMessageTime,
-          unreadCount: prev?.unreadCount ?? 0,
+          lastMessage: last?.text ?? prev?.lastMessage,
+          lastMessageTime: last?.timestamp ?? prev?.lastMessageTime,
+          lastMessageId: last?.msg_id ?? prev?.lastMessageId,
+          unreadCount: f.unread ?? prev?.unreadCount ?? 0,
         };
       });
       set({ contacts, loading: false });
@@ -92,11 +99,16 @@ export const useContactStore = create<ContactState>((set, get) => ({
 
   setSearchQuery: (query) => set({ searchQuery: query }),
 
-  updateLastMessage: (username, text, time) =>
+  updateLastMessage: (username, text, time, msgId) =>
     set((state) => ({
       contacts: state.contacts.map((c) =>
         c.username === username
-          ? { ...c, lastMessage: text, lastMessageTime: time }
+          ? {
+              ...c,
+              lastMessage: text,
+              lastMessageTime: time,
+              lastMessageId: msgId ?? c.lastMessageId,
+            }
           : c
       ),
     })),
@@ -6,10 +6,21 @@ export interface Contact {
   last_seen: string;
   last_ip: string;
   added_at: string;
+  /** Received messages after the last one marked read. */
+  unread?: number;
+  last_message?: LastMessage | null;
+}
+
+export interface LastMessage {
+  msg_id: string;
+  text: string;
+  timestamp: string;
+  direction: "sent" | "received";
 }
 
 export interface ContactWithPreview extends Contact {
   lastMessage?: string;
   lastMessageTime?: string;
+  lastMessageId?: string;
   unreadCount: number;
 }
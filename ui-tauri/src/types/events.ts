@@ -4,7 +4,11 @@ export type WSEvent =
   | { event: "new_message"; data: Message }
   | { event: "friend_online"; data: { username: string } }
   | { event: "friend_offline"; data: { username: string } }
-  | { event: "typing"; data: { username: string; typing: boolean } };
+  | { event: "typing"; data: { username: string; typing: boolean } }
+  | {
+      event: "backlog_loaded";
+      data: { count: number; peers: Record<string, number> };
+    };
 
 export type WSClientEvent =
   | { event: "typing"; data: { to: string; typing: boolean } }
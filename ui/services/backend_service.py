@@ -15,22 +15,46 @@ class BackendService:
     def __init__(self, base_url: str = "http://127.0.0.1:8080"):
         self.base_url = base_url.rstrip("/")
         self.session = requests.Session()
+        # This UI polls; the backend answers with Retry-After to pace it.
+        self.session.headers["X-Client-Mode"] = "poll"
+        self.session.hooks["response"].append(self._note_retry_after)
+        # Seconds until the next poll, as last advised by the backend
+        self.poll_interval: float = 1.0
+        # path -> (ETag, last body) for conditional polling
+        self._cache: dict[str, tuple[str, object]] = {}
+
+    def _note_retry_after(self, r, *args, **kwargs):
+        """Keep the poll interval the backend advised on any response."""
+        value = r.headers.get("Retry-After", "")
+        if value.isdigit():
+            self.poll_interval = float(value)
+
+    def _get_cached(self, path: str):
+        """GET with If-None-Match; a 304 returns the previous body."""
+        headers = {}
+        cached = self._cache.get(path)
+        if cached:
+            headers["If-None-Match"] = cached[0]
+        r = self.session.get(f"{self.base_url}{path}", headers=headers)
+        if r.status_code == 304 and cached:
+            return cached[1]
+        r.raise_for_status()
+        body = r.json()
+        if "ETag" in r.headers:
+            self._cache[path] = (r.headers["ETag"], body)
+        return body
 
     # ── Health ────────────────────────────────────────────────────────
 
     def status(self) -> dict:
         """GET /status — check if the backend is running."""
-        r = self.session.get(f"{self.base_url}/status")
-        r.raise_for_status()
-        return r.json()
+        return self._get_cached("/status")
 
     # ── Friends ───────────────────────────────────────────────────────
 
     def list_friends(self) -> list[dict]:
-        """GET /friends — return all friends."""
-        r = self.session.get(f"{self.base_url}/friends")
-        r.raise_for_status()
-        return r.json()
+        """GET /friends — return all friends (304s reuse the last list)."""
+        return self._get_cached("/friends")
 
     def add_friend(self, username: str) -> dict:
         """POST /friends — add a friend by username."""
@@ -52,6 +76,19 @@ class BackendService:
         r.raise_for_status()
         return r.json()
 
+    def wait_messages(self, peer: str, since: str = "", wait: int = 30,
+                      limit: int = 50) -> dict:
+        """GET /messages?since= — messages stored after `since` (a msg_id,
+        "" for all), held open up to `wait` seconds until one arrives.
+        Pass the returned "next_since" to the next call."""
+        r = self.session.get(
+            f"{self.base_url}/messages",
+            params={"peer": peer, "since": since, "wait": wait, "limit": limit},
+            timeout=wait + 10,
+        )
+        r.raise_for_status()
+        return r.json()
+
     def send_message(self, to_user: str, text: str) -> dict:
         """POST /messages — send a message to a peer."""
         r = self.session.post(